@@ -41,10 +41,13 @@
 #include "qapi/visitor.h"
 #include "qapi/qapi-types-common.h"
 #include "qapi/qapi-visit-common.h"
+#include "monitor/stats.h"
 #include "sysemu/reset.h"
 #include "qemu/guest-random.h"
 #include "sysemu/hw_accel.h"
 #include "kvm-cpus.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
 
 #include "hw/boards.h"
 
@@ -135,7 +138,13 @@ struct KVMState
     int nr_allocated_irq_routes;
     unsigned long *used_gsi_bitmap;
     unsigned int gsi_count;
+    /* irq_routes differs from what KVM was last given */
+    bool irq_routes_dirty;
     QTAILQ_HEAD(, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
+    /* dynamic MSI routes, least recently used first */
+    QTAILQ_HEAD(, KVMMSIRoute) msi_lru;
+    uint64_t msi_route_hits;
+    uint64_t msi_route_misses;
 #endif
     KVMMemoryListener memory_listener;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
@@ -149,6 +158,8 @@ struct KVMState
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     struct KVMDirtyRingReaper reaper;
+    uint32_t dirty_log_threads;     /* 0 for automatic */
+    int vm_stats_fd;                /* binary statistics of the VM, or -1 */
 };
 
 KVMState *kvm_state;
@@ -201,6 +212,9 @@ static QemuMutex kml_slots_lock;
 #define kvm_slots_unlock()  qemu_mutex_unlock(&kml_slots_lock)
 
 static void kvm_slot_init_dirty_bitmap(KVMSlot *mem);
+static void query_stats_cb(StatsResultList **result, StatsTarget target,
+                           strList *names, strList *targets, Error **errp);
+static void query_stats_schemas_cb(StatsSchemaList **result, Error **errp);
 
 static inline void kvm_resample_fd_remove(int gsi)
 {
@@ -417,6 +431,11 @@ static int do_kvm_destroy_vcpu(CPUState *cpu)
         }
     }
 
+    if (cpu->kvm_vcpu_stats_fd >= 0) {
+        close(cpu->kvm_vcpu_stats_fd);
+        cpu->kvm_vcpu_stats_fd = -1;
+    }
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
@@ -506,6 +525,12 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
         }
     }
 
+    cpu->kvm_vcpu_stats_fd = -1;
+    if (s->vm_stats_fd >= 0) {
+        ret = kvm_vcpu_ioctl(cpu, KVM_GET_STATS_FD, NULL);
+        cpu->kvm_vcpu_stats_fd = ret < 0 ? -1 : ret;
+    }
+
     ret = kvm_arch_init_vcpu(cpu);
     if (ret < 0) {
         error_setg_errno(errp, -ret,
@@ -528,6 +553,14 @@ static int kvm_mem_flags(MemoryRegion *mr)
     if (memory_region_get_dirty_log_mask(mr) != 0) {
         flags |= KVM_MEM_LOG_DIRTY_PAGES;
     }
+    /*
+     * Dirty rate measurement and the dirty limit count the pages that KVM
+     * logs for each vCPU, without the migration bitmap.
+     */
+    if (global_dirty_tracking && mr->ram_block &&
+        qemu_ram_is_migratable(mr->ram_block)) {
+        flags |= KVM_MEM_LOG_DIRTY_PAGES;
+    }
     if (readonly && kvm_readonly_mem_allowed) {
         flags |= KVM_MEM_READONLY;
     }
@@ -615,18 +648,119 @@ static void kvm_log_stop(MemoryListener *listener,
     }
 }
 
-/* get kvm's dirty pages bitmap and update qemu's */
+/*
+ * Global dirty tracking that does not include migration leaves the dirty
+ * log mask of the regions alone, so update the flags of all slots when
+ * tracking starts and stops.
+ */
+static void kvm_log_global_update(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener,
+                                          listener);
+    int i;
+
+    kvm_slots_lock();
+    for (i = 0; i < kvm_state->nr_slots; i++) {
+        KVMSlot *mem = &kml->slots[i];
+        ram_addr_t offset;
+        MemoryRegion *mr;
+
+        if (!mem->memory_size) {
+            continue;
+        }
+        mr = memory_region_from_host(mem->ram, &offset);
+        if (mr && kvm_slot_update_flags(kml, mem, mr) < 0) {
+            abort();
+        }
+    }
+    kvm_slots_unlock();
+}
+
+/*
+ * Merging the dirty bitmap of a large slot into the ram_list bitmaps is
+ * split across threads, each of them taking at least this much memory.
+ */
+#define KVM_DIRTY_LOG_MIN_BYTES_PER_THREAD  (64 * GiB)
+#define KVM_DIRTY_LOG_MAX_THREADS           8
+
+typedef struct KVMDirtyLogSyncJob {
+    QemuThread thread;
+    unsigned long *bitmap;
+    ram_addr_t start;
+    ram_addr_t pages;
+} KVMDirtyLogSyncJob;
+
+static void *kvm_dirty_log_sync_thread(void *opaque)
+{
+    KVMDirtyLogSyncJob *job = opaque;
+
+    rcu_register_thread();
+    cpu_physical_memory_set_dirty_lebitmap(job->bitmap, job->start,
+                                           job->pages);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static int kvm_dirty_log_sync_nr_threads(KVMState *s, KVMSlot *slot)
+{
+    int max_threads = s->dirty_log_threads;
+    int n;
+
+    if (!max_threads) {
+        long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
+
+        max_threads = MIN(MAX(host_procs, 1), KVM_DIRTY_LOG_MAX_THREADS);
+    }
+
+    n = slot->memory_size / KVM_DIRTY_LOG_MIN_BYTES_PER_THREAD;
+    return MAX(MIN(n, max_threads), 1);
+}
+
+/*
+ * get kvm's dirty pages bitmap and update qemu's
+ *
+ * The ram_list bitmaps are updated with atomic operations, so for large
+ * slots several threads can each merge a part of the slot bitmap; the
+ * parts are a whole number of bitmap words.  The ioctls themselves are
+ * serialized by the kernel anyway.
+ */
 static void kvm_slot_sync_dirty_pages(KVMSlot *slot)
 {
     ram_addr_t start = slot->ram_start_offset;
     ram_addr_t pages = slot->memory_size / qemu_real_host_page_size;
+    ram_addr_t pages_per_thread;
+    KVMDirtyLogSyncJob *jobs;
+    int i, n;
 
-    cpu_physical_memory_set_dirty_lebitmap(slot->dirty_bmap, start, pages);
-}
+    n = kvm_dirty_log_sync_nr_threads(kvm_state, slot);
+    if (n == 1) {
+        cpu_physical_memory_set_dirty_lebitmap(slot->dirty_bmap, start, pages);
+        return;
+    }
 
-static void kvm_slot_reset_dirty_pages(KVMSlot *slot)
-{
-    memset(slot->dirty_bmap, 0, slot->dirty_bmap_size);
+    pages_per_thread = ROUND_UP(DIV_ROUND_UP(pages, n), BITS_PER_LONG);
+    n = DIV_ROUND_UP(pages, pages_per_thread);
+    jobs = g_new0(KVMDirtyLogSyncJob, n);
+    for (i = 0; i < n; i++) {
+        ram_addr_t first = i * pages_per_thread;
+
+        jobs[i].bitmap = slot->dirty_bmap + BIT_WORD(first);
+        jobs[i].start = start + first * qemu_real_host_page_size;
+        jobs[i].pages = MIN(pages_per_thread, pages - first);
+    }
+
+    /* The calling thread takes the first part itself */
+    for (i = 1; i < n; i++) {
+        qemu_thread_create(&jobs[i].thread, "kvm-dirty-sync",
+                           kvm_dirty_log_sync_thread, &jobs[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    cpu_physical_memory_set_dirty_lebitmap(jobs[0].bitmap, jobs[0].start,
+                                           jobs[0].pages);
+    for (i = 1; i < n; i++) {
+        qemu_thread_join(&jobs[i].thread);
+    }
+    g_free(jobs);
 }
 
 #define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
@@ -638,6 +772,11 @@ static void kvm_slot_init_dirty_bitmap(KVMSlot *mem)
         return;
     }
 
+    /* The dirty ring publishes the pages without going through the slot */
+    if (kvm_state->kvm_dirty_ring_size) {
+        return;
+    }
+
     /*
      * XXX bad kernel interface alert
      * For dirty bitmap, kernel allocates array of size aligned to
@@ -685,12 +824,23 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     return ret == 0;
 }
 
-/* Should be with all slots_lock held for the address spaces. */
+/* A dirty GFN fetched from a dirty ring, not yet published */
+typedef struct KVMDirtyGFN {
+    uint32_t slot;
+    uint64_t offset;
+} KVMDirtyGFN;
+
+/*
+ * Should be with all slots_lock held for the address spaces.  The page is
+ * marked dirty directly in the ram_list dirty bitmaps, so that a sync only
+ * costs as much as the number of pages dirtied since the last one.
+ */
 static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
                                      uint32_t slot_id, uint64_t offset)
 {
     KVMMemoryListener *kml;
     KVMSlot *mem;
+    uint8_t clients = DIRTY_CLIENTS_NOCODE;
 
     if (as_id >= s->nr_as) {
         return;
@@ -704,7 +854,12 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    if (!(global_dirty_tracking & GLOBAL_DIRTY_MIGRATION)) {
+        clients &= ~(1 << DIRTY_MEMORY_MIGRATION);
+    }
+    cpu_physical_memory_set_dirty_range(mem->ram_start_offset +
+                                        offset * qemu_real_host_page_size,
+                                        qemu_real_host_page_size, clients);
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -719,9 +874,11 @@ static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
 
 /*
  * Should be with all slots_lock held for the address spaces.  It returns the
- * dirty page we've collected on this dirty ring.
+ * dirty page we've collected on this dirty ring; the GFNs are appended to
+ * @gfns, to be published once they have been re-protected.
  */
-static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu,
+                                        GArray *gfns)
 {
     struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
     uint32_t ring_size = s->kvm_dirty_ring_size;
@@ -731,34 +888,47 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     trace_kvm_dirty_ring_reap_vcpu(cpu->cpu_index);
 
     while (true) {
+        KVMDirtyGFN gfn;
+
         cur = &dirty_gfns[fetch % ring_size];
         if (!dirty_gfn_is_dirtied(cur)) {
             break;
         }
-        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
-                                 cur->offset);
+        gfn.slot = cur->slot;
+        gfn.offset = cur->offset;
+        g_array_append_val(gfns, gfn);
         dirty_gfn_set_collected(cur);
         trace_kvm_dirty_ring_page(cpu->cpu_index, fetch, cur->offset);
         fetch++;
         count++;
     }
     cpu->kvm_fetch_index = fetch;
+    cpu->dirty_pages += count;
 
     return count;
 }
 
-/* Must be with slots_lock held */
-static uint64_t kvm_dirty_ring_reap_locked(KVMState *s)
+/*
+ * Must be with slots_lock held.  Only the ring of @cpu is collected, or the
+ * rings of all the vcpus if @cpu is NULL.
+ */
+static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState *cpu)
 {
-    int ret;
-    CPUState *cpu;
+    g_autoptr(GArray) gfns = g_array_new(false, false, sizeof(KVMDirtyGFN));
+    KVMDirtyGFN *gfn;
     uint64_t total = 0;
     int64_t stamp;
+    guint i;
+    int ret;
 
     stamp = get_clock();
 
-    CPU_FOREACH(cpu) {
-        total += kvm_dirty_ring_reap_one(s, cpu);
+    if (cpu) {
+        total = kvm_dirty_ring_reap_one(s, cpu, gfns);
+    } else {
+        CPU_FOREACH(cpu) {
+            total += kvm_dirty_ring_reap_one(s, cpu, gfns);
+        }
     }
 
     if (total) {
@@ -766,6 +936,16 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s)
         assert(ret == total);
     }
 
+    /*
+     * The pages are write protected again, it's now safe to let the other
+     * threads see them as dirty.
+     */
+    for (i = 0; i < gfns->len; i++) {
+        gfn = &g_array_index(gfns, KVMDirtyGFN, i);
+        kvm_dirty_ring_mark_page(s, gfn->slot >> 16, gfn->slot & 0xffff,
+                                 gfn->offset);
+    }
+
     stamp = get_clock() - stamp;
 
     if (total) {
@@ -778,8 +958,10 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s)
 /*
  * Currently for simplicity, we must hold BQL before calling this.  We can
  * consider to drop the BQL if we're clear with all the race conditions.
+ *
+ * If @cpu is not NULL, only the dirty ring of that vcpu is collected.
  */
-static uint64_t kvm_dirty_ring_reap(KVMState *s)
+static uint64_t kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
 {
     uint64_t total;
 
@@ -792,14 +974,14 @@ static uint64_t kvm_dirty_ring_reap(KVMState *s)
      *     once rather than once per page.  And more importantly,
      *
      * (2) We must _NOT_ publish dirty bits to the other threads
-     *     (e.g., the migration thread) via the kvm memory slot dirty
+     *     (e.g., the migration thread) via the ram_list dirty
      *     bitmaps before correctly re-protect those dirtied pages.
      *     Otherwise we can have potential risk of data corruption if
      *     the page data is read in the other thread before we do
      *     reset below.
      */
     kvm_slots_lock();
-    total = kvm_dirty_ring_reap_locked(s);
+    total = kvm_dirty_ring_reap_locked(s, cpu);
     kvm_slots_unlock();
 
     return total;
@@ -846,7 +1028,7 @@ static void kvm_dirty_ring_flush(void)
      * vcpus out in a synchronous way.
      */
     kvm_cpu_synchronize_kick_all();
-    kvm_dirty_ring_reap(kvm_state);
+    kvm_dirty_ring_reap(kvm_state, NULL);
     trace_kvm_dirty_ring_flush(1);
 }
 
@@ -1389,11 +1571,11 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                  * Not easy.  Let's cross the fingers until it's fixed.
                  */
                 if (kvm_state->kvm_dirty_ring_size) {
-                    kvm_dirty_ring_reap_locked(kvm_state);
+                    kvm_dirty_ring_reap_locked(kvm_state, NULL);
                 } else {
                     kvm_slot_get_dirty_log(kvm_state, mem);
+                    kvm_slot_sync_dirty_pages(mem);
                 }
-                kvm_slot_sync_dirty_pages(mem);
             }
 
             /* unregister the slot */
@@ -1461,7 +1643,7 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
         r->reaper_state = KVM_DIRTY_RING_REAPER_REAPING;
 
         qemu_mutex_lock_iothread();
-        kvm_dirty_ring_reap(s);
+        kvm_dirty_ring_reap(s, NULL);
         qemu_mutex_unlock_iothread();
 
         r->reaper_iteration++;
@@ -1513,34 +1695,22 @@ static void kvm_log_sync(MemoryListener *listener,
     kvm_slots_unlock();
 }
 
-static void kvm_log_sync_global(MemoryListener *l)
+static void kvm_log_sync_global(MemoryListener *l, bool last_stage)
 {
-    KVMMemoryListener *kml = container_of(l, KVMMemoryListener, listener);
-    KVMState *s = kvm_state;
-    KVMSlot *mem;
-    int i;
-
-    /* Flush all kernel dirty addresses into KVMSlot dirty bitmap */
-    kvm_dirty_ring_flush();
-
     /*
-     * TODO: make this faster when nr_slots is big while there are
-     * only a few used slots (small VMs).
+     * Reaping publishes the dirty pages straight into the ram_list dirty
+     * bitmaps, so there is no per-slot bitmap to walk here.
+     *
+     * Only the last sync needs every vcpu to be kicked out, so that the
+     * pages still sitting in the hardware buffers reach the rings.  The
+     * others collect what the rings hold right now and leave the rest
+     * for the next sync, without stopping the vcpus.
      */
-    kvm_slots_lock();
-    for (i = 0; i < s->nr_slots; i++) {
-        mem = &kml->slots[i];
-        if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-            kvm_slot_sync_dirty_pages(mem);
-            /*
-             * This is not needed by KVM_GET_DIRTY_LOG because the
-             * ioctl will unconditionally overwrite the whole region.
-             * However kvm dirty ring has no such side effect.
-             */
-            kvm_slot_reset_dirty_pages(mem);
-        }
+    if (last_stage) {
+        kvm_dirty_ring_flush();
+    } else {
+        kvm_dirty_ring_reap(kvm_state, NULL);
     }
-    kvm_slots_unlock();
 }
 
 static void kvm_log_clear(MemoryListener *listener,
@@ -1648,6 +1818,8 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
     kml->listener.region_del = kvm_region_del;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
+    kml->listener.log_global_start = kvm_log_global_update;
+    kml->listener.log_global_stop = kvm_log_global_update;
     kml->listener.priority = 10;
 
     if (s->kvm_dirty_ring_size) {
@@ -1696,6 +1868,7 @@ int kvm_set_irq(KVMState *s, int irq, int level)
 typedef struct KVMMSIRoute {
     struct kvm_irq_routing_entry kroute;
     QTAILQ_ENTRY(KVMMSIRoute) entry;
+    QTAILQ_ENTRY(KVMMSIRoute) lru;
 } KVMMSIRoute;
 
 static void set_gsi(KVMState *s, unsigned int gsi)
@@ -1721,11 +1894,14 @@ void kvm_init_irq_routing(KVMState *s)
 
     s->irq_routes = g_malloc0(sizeof(*s->irq_routes));
     s->nr_allocated_irq_routes = 0;
+    /* The first commit replaces the kernel's default routing */
+    s->irq_routes_dirty = true;
 
     if (!kvm_direct_msi_allowed) {
         for (i = 0; i < KVM_MSI_HASHTAB_SIZE; i++) {
             QTAILQ_INIT(&s->msi_hashtab[i]);
         }
+        QTAILQ_INIT(&s->msi_lru);
     }
 
     kvm_arch_init_irq_routing(s);
@@ -1743,10 +1919,20 @@ void kvm_irqchip_commit_routes(KVMState *s)
         return;
     }
 
+    /*
+     * KVM_SET_GSI_ROUTING replaces the whole table and waits for an RCU
+     * grace period in the kernel, so only issue it when something changed.
+     * Callers can update many routes and commit once.
+     */
+    if (!s->irq_routes_dirty) {
+        return;
+    }
+
     s->irq_routes->flags = 0;
     trace_kvm_irqchip_commit_routes();
     ret = kvm_vm_ioctl(s, KVM_SET_GSI_ROUTING, s->irq_routes);
     assert(ret == 0);
+    s->irq_routes_dirty = false;
 }
 
 static void kvm_add_routing_entry(KVMState *s,
@@ -1771,6 +1957,7 @@ static void kvm_add_routing_entry(KVMState *s,
     *new = *entry;
 
     set_gsi(s, entry->gsi);
+    s->irq_routes_dirty = true;
 }
 
 static int kvm_update_routing_entry(KVMState *s,
@@ -1790,6 +1977,7 @@ static int kvm_update_routing_entry(KVMState *s,
         }
 
         *entry = *new_entry;
+        s->irq_routes_dirty = true;
 
         return 0;
     }
@@ -1825,6 +2013,7 @@ void kvm_irqchip_release_virq(KVMState *s, int virq)
         if (e->gsi == virq) {
             s->irq_routes->nr--;
             *e = s->irq_routes->entries[s->irq_routes->nr];
+            s->irq_routes_dirty = true;
         }
     }
     clear_gsi(s, virq);
@@ -1854,18 +2043,27 @@ static unsigned int kvm_hash_msi(uint32_t data)
     return data & 0xff;
 }
 
-static void kvm_flush_dynamic_msi_routes(KVMState *s)
+/*
+ * Drop the least recently used dynamic MSI route, so that busy vectors
+ * keep their routes when the table fills up.  The freed entry reaches KVM
+ * with the next commit.
+ */
+static bool kvm_evict_dynamic_msi_route(KVMState *s)
 {
-    KVMMSIRoute *route, *next;
+    KVMMSIRoute *route = QTAILQ_FIRST(&s->msi_lru);
     unsigned int hash;
 
-    for (hash = 0; hash < KVM_MSI_HASHTAB_SIZE; hash++) {
-        QTAILQ_FOREACH_SAFE(route, &s->msi_hashtab[hash], entry, next) {
-            kvm_irqchip_release_virq(s, route->kroute.gsi);
-            QTAILQ_REMOVE(&s->msi_hashtab[hash], route, entry);
-            g_free(route);
-        }
+    if (!route) {
+        return false;
     }
+
+    trace_kvm_irqchip_evict_msi_route(route->kroute.gsi);
+    kvm_irqchip_release_virq(s, route->kroute.gsi);
+    hash = kvm_hash_msi(cpu_to_le32(route->kroute.u.msi.data));
+    QTAILQ_REMOVE(&s->msi_hashtab[hash], route, entry);
+    QTAILQ_REMOVE(&s->msi_lru, route, lru);
+    g_free(route);
+    return true;
 }
 
 static int kvm_irqchip_get_virq(KVMState *s)
@@ -1876,14 +2074,18 @@ static int kvm_irqchip_get_virq(KVMState *s)
      * PIC and IOAPIC share the first 16 GSI numbers, thus the available
      * GSI numbers are more than the number of IRQ route. Allocating a GSI
      * number can succeed even though a new route entry cannot be added.
-     * When this happens, flush dynamic MSI entries to free IRQ route entries.
+     * When this happens, evict dynamic MSI entries to free IRQ route entries.
      */
     if (!kvm_direct_msi_allowed && s->irq_routes->nr == s->gsi_count) {
-        kvm_flush_dynamic_msi_routes(s);
+        kvm_evict_dynamic_msi_route(s);
     }
 
     /* Return the lowest unused GSI in the bitmap */
     next_virq = find_first_zero_bit(s->used_gsi_bitmap, s->gsi_count);
+    if (next_virq >= s->gsi_count && !kvm_direct_msi_allowed &&
+        kvm_evict_dynamic_msi_route(s)) {
+        next_virq = find_first_zero_bit(s->used_gsi_bitmap, s->gsi_count);
+    }
     if (next_virq >= s->gsi_count) {
         return -ENOSPC;
     } else {
@@ -1922,7 +2124,11 @@ int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
     }
 
     route = kvm_lookup_msi_route(s, msg);
-    if (!route) {
+    if (route) {
+        s->msi_route_hits++;
+        QTAILQ_REMOVE(&s->msi_lru, route, lru);
+        QTAILQ_INSERT_TAIL(&s->msi_lru, route, lru);
+    } else {
         int virq;
 
         virq = kvm_irqchip_get_virq(s);
@@ -1930,6 +2136,10 @@ int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
             return virq;
         }
 
+        s->msi_route_misses++;
+        trace_kvm_irqchip_send_msi_miss(virq, s->msi_route_hits,
+                                        s->msi_route_misses);
+
         route = g_malloc0(sizeof(KVMMSIRoute));
         route->kroute.gsi = virq;
         route->kroute.type = KVM_IRQ_ROUTING_MSI;
@@ -1943,6 +2153,7 @@ int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
 
         QTAILQ_INSERT_TAIL(&s->msi_hashtab[kvm_hash_msi(msg.data)], route,
                            entry);
+        QTAILQ_INSERT_TAIL(&s->msi_lru, route, lru);
     }
 
     assert(route->kroute.type == KVM_IRQ_ROUTING_MSI);
@@ -2602,6 +2813,15 @@ static int kvm_init(MachineState *ms)
         }
     }
 
+    if (kvm_check_extension(s, KVM_CAP_BINARY_STATS_FD)) {
+        ret = kvm_vm_ioctl(s, KVM_GET_STATS_FD, NULL);
+        if (ret >= 0) {
+            s->vm_stats_fd = ret;
+            add_stats_callbacks(STATS_PROVIDER_KVM, query_stats_cb,
+                                query_stats_schemas_cb);
+        }
+    }
+
     return 0;
 
 err:
@@ -2921,7 +3141,7 @@ int kvm_cpu_exec(CPUState *cpu)
              */
             trace_kvm_dirty_ring_full(cpu->cpu_index);
             qemu_mutex_lock_iothread();
-            kvm_dirty_ring_reap(kvm_state);
+            kvm_dirty_ring_reap(kvm_state, cpu);
             qemu_mutex_unlock_iothread();
             ret = 0;
             break;
@@ -3137,6 +3357,16 @@ int kvm_has_intx_set_mask(void)
     return kvm_state->intx_set_mask;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return kvm_state && kvm_state->kvm_dirty_ring_size;
+}
+
+uint32_t kvm_dirty_ring_size(void)
+{
+    return kvm_state ? kvm_state->kvm_dirty_ring_size : 0;
+}
+
 bool kvm_arm_supports_user_irq(void)
 {
     return kvm_check_extension(kvm_state, KVM_CAP_ARM_USER_IRQ);
@@ -3603,12 +3833,42 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_log_threads(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->dirty_log_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_log_threads(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > KVM_DIRTY_LOG_MAX_THREADS) {
+        error_setg(errp, "dirty-log-threads must be at most %d",
+                   KVM_DIRTY_LOG_MAX_THREADS);
+        return;
+    }
+
+    s->dirty_log_threads = value;
+}
+
 static void kvm_accel_instance_init(Object *obj)
 {
     KVMState *s = KVM_STATE(obj);
 
     s->fd = -1;
     s->vmfd = -1;
+    s->vm_stats_fd = -1;
     s->kvm_shadow_mem = -1;
     s->kernel_irqchip_allowed = true;
     s->kernel_irqchip_split = ON_OFF_AUTO_AUTO;
@@ -3641,6 +3901,13 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
+
+    object_class_property_add(oc, "dirty-log-threads", "uint32",
+        kvm_get_dirty_log_threads, kvm_set_dirty_log_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-log-threads",
+        "Maximum number of threads merging a KVM dirty bitmap "
+        "(default: 0, i.e. automatic)");
 }
 
 static const TypeInfo kvm_accel_type = {
@@ -3657,3 +3924,309 @@ static void kvm_type_init(void)
 }
 
 type_init(kvm_type_init);
+
+typedef struct StatsDescriptors {
+    struct kvm_stats_header header;
+    struct kvm_stats_desc *kvm_stats_desc;
+} StatsDescriptors;
+
+/* The layout of the statistics is the same for all vCPUs of a VM */
+static StatsDescriptors kvm_stats_descriptors[STATS_TARGET__MAX];
+
+/*
+ * Return the descriptors of the statistics of @target, reading them from
+ * @stats_fd the first time.  Only the values need to be read on every
+ * query after that.
+ */
+static StatsDescriptors *find_stats_descriptors(StatsTarget target,
+                                                int stats_fd, Error **errp)
+{
+    StatsDescriptors *descriptors = &kvm_stats_descriptors[target];
+    struct kvm_stats_header *header = &descriptors->header;
+    struct kvm_stats_desc *kvm_stats_desc;
+    size_t size_desc;
+    ssize_t ret;
+
+    if (descriptors->kvm_stats_desc) {
+        return descriptors;
+    }
+
+    ret = pread(stats_fd, header, sizeof(*header), 0);
+    if (ret != sizeof(*header)) {
+        error_setg(errp, "KVM stats: failed to read stats header: "
+                   "expected %zu actual %zd", sizeof(*header), ret);
+        return NULL;
+    }
+    size_desc = sizeof(*kvm_stats_desc) + header->name_size;
+
+    kvm_stats_desc = g_malloc0_n(header->num_desc, size_desc);
+    ret = pread(stats_fd, kvm_stats_desc, size_desc * header->num_desc,
+                header->desc_offset);
+    if (ret != size_desc * header->num_desc) {
+        error_setg(errp, "KVM stats: failed to read stats descriptors: "
+                   "expected %zu actual %zd",
+                   size_desc * header->num_desc, ret);
+        g_free(kvm_stats_desc);
+        return NULL;
+    }
+    descriptors->kvm_stats_desc = kvm_stats_desc;
+    return descriptors;
+}
+
+static bool kvm_stats_type(struct kvm_stats_desc *pdesc, StatsType *type)
+{
+    switch (pdesc->flags & KVM_STATS_TYPE_MASK) {
+    case KVM_STATS_TYPE_CUMULATIVE:
+        *type = STATS_TYPE_CUMULATIVE;
+        return true;
+    case KVM_STATS_TYPE_INSTANT:
+        *type = STATS_TYPE_INSTANT;
+        return true;
+    case KVM_STATS_TYPE_PEAK:
+        *type = STATS_TYPE_PEAK;
+        return true;
+    case KVM_STATS_TYPE_LINEAR_HIST:
+        *type = STATS_TYPE_LINEAR_HISTOGRAM;
+        return true;
+    case KVM_STATS_TYPE_LOG_HIST:
+        *type = STATS_TYPE_LOG2_HISTOGRAM;
+        return true;
+    default:
+        /* Only report the statistics that we understand */
+        return false;
+    }
+}
+
+static StatsList *add_kvmstat_entry(struct kvm_stats_desc *pdesc,
+                                    uint64_t *stats_data,
+                                    StatsList *stats_list)
+{
+    Stats *stats;
+    StatsType type;
+    uint64List **tail;
+    int i;
+
+    if (!kvm_stats_type(pdesc, &type)) {
+        return stats_list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(pdesc->name);
+    stats->value = g_new0(StatsValue, 1);
+
+    if ((pdesc->flags & KVM_STATS_UNIT_MASK) == KVM_STATS_UNIT_BOOLEAN) {
+        stats->value->u.boolean = *stats_data;
+        stats->value->type = QTYPE_QBOOL;
+    } else if (pdesc->size == 1) {
+        stats->value->u.scalar = *stats_data;
+        stats->value->type = QTYPE_QNUM;
+    } else {
+        tail = &stats->value->u.histogram.buckets;
+        for (i = 0; i < pdesc->size; i++) {
+            QAPI_LIST_APPEND(tail, stats_data[i]);
+        }
+        stats->value->type = QTYPE_QDICT;
+    }
+
+    QAPI_LIST_PREPEND(stats_list, stats);
+    return stats_list;
+}
+
+static StatsSchemaValueList *add_kvmschema_entry(struct kvm_stats_desc *pdesc,
+                                                 StatsSchemaValueList *list)
+{
+    StatsSchemaValue *schema_entry;
+    StatsType type;
+
+    if (!kvm_stats_type(pdesc, &type)) {
+        return list;
+    }
+
+    schema_entry = g_new0(StatsSchemaValue, 1);
+    schema_entry->name = g_strdup(pdesc->name);
+    schema_entry->type = type;
+
+    switch (pdesc->flags & KVM_STATS_UNIT_MASK) {
+    case KVM_STATS_UNIT_NONE:
+        break;
+    case KVM_STATS_UNIT_BOOLEAN:
+        schema_entry->has_unit = true;
+        schema_entry->unit = STATS_UNIT_BOOLEAN;
+        break;
+    case KVM_STATS_UNIT_BYTES:
+        schema_entry->has_unit = true;
+        schema_entry->unit = STATS_UNIT_BYTES;
+        break;
+    case KVM_STATS_UNIT_CYCLES:
+        schema_entry->has_unit = true;
+        schema_entry->unit = STATS_UNIT_CYCLES;
+        break;
+    case KVM_STATS_UNIT_SECONDS:
+        schema_entry->has_unit = true;
+        schema_entry->unit = STATS_UNIT_SECONDS;
+        break;
+    default:
+        break;
+    }
+
+    schema_entry->exponent = pdesc->exponent;
+    if (pdesc->exponent) {
+        switch (pdesc->flags & KVM_STATS_BASE_MASK) {
+        case KVM_STATS_BASE_POW10:
+            schema_entry->has_base = true;
+            schema_entry->base = 10;
+            break;
+        case KVM_STATS_BASE_POW2:
+            schema_entry->has_base = true;
+            schema_entry->base = 2;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (type == STATS_TYPE_LINEAR_HISTOGRAM) {
+        schema_entry->has_bucket_size = true;
+        schema_entry->bucket_size = pdesc->bucket_size;
+    }
+
+    QAPI_LIST_PREPEND(list, schema_entry);
+    return list;
+}
+
+static bool query_stats(StatsResultList **result, StatsTarget target,
+                        strList *names, int stats_fd, const char *qom_path,
+                        Error **errp)
+{
+    StatsDescriptors *descriptors;
+    struct kvm_stats_header *header;
+    struct kvm_stats_desc *kvm_stats_desc, *pdesc;
+    g_autofree uint64_t *stats_data = NULL;
+    StatsList *stats_list = NULL;
+    size_t size_desc, size_data = 0;
+    ssize_t ret;
+    uint32_t i;
+
+    descriptors = find_stats_descriptors(target, stats_fd, errp);
+    if (!descriptors) {
+        return false;
+    }
+
+    header = &descriptors->header;
+    kvm_stats_desc = descriptors->kvm_stats_desc;
+    size_desc = sizeof(*kvm_stats_desc) + header->name_size;
+
+    /* Read the whole data block at once */
+    for (i = 0; i < header->num_desc; ++i) {
+        pdesc = (void *)kvm_stats_desc + i * size_desc;
+        size_data = MAX(size_data,
+                        pdesc->offset + pdesc->size * sizeof(*stats_data));
+    }
+
+    stats_data = g_malloc0(size_data);
+    ret = pread(stats_fd, stats_data, size_data, header->data_offset);
+    if (ret != size_data) {
+        error_setg(errp, "KVM stats: failed to read data: "
+                   "expected %zu actual %zd", size_data, ret);
+        return false;
+    }
+
+    for (i = 0; i < header->num_desc; ++i) {
+        pdesc = (void *)kvm_stats_desc + i * size_desc;
+        if (!apply_str_list_filter(pdesc->name, names)) {
+            continue;
+        }
+        stats_list = add_kvmstat_entry(pdesc,
+                                       (void *)stats_data + pdesc->offset,
+                                       stats_list);
+    }
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_KVM, qom_path, stats_list);
+    }
+    return true;
+}
+
+static void query_stats_schema(StatsSchemaList **result, StatsTarget target,
+                               int stats_fd, Error **errp)
+{
+    StatsDescriptors *descriptors;
+    struct kvm_stats_header *header;
+    struct kvm_stats_desc *kvm_stats_desc, *pdesc;
+    StatsSchemaValueList *stats_list = NULL;
+    size_t size_desc;
+    uint32_t i;
+
+    descriptors = find_stats_descriptors(target, stats_fd, errp);
+    if (!descriptors) {
+        return;
+    }
+
+    header = &descriptors->header;
+    kvm_stats_desc = descriptors->kvm_stats_desc;
+    size_desc = sizeof(*kvm_stats_desc) + header->name_size;
+
+    for (i = 0; i < header->num_desc; ++i) {
+        pdesc = (void *)kvm_stats_desc + i * size_desc;
+        stats_list = add_kvmschema_entry(pdesc, stats_list);
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_KVM, target, stats_list);
+}
+
+/*
+ * The stats file descriptors can be read from any thread, so there is no
+ * need to kick the vCPUs.  Called with the BQL held, which keeps vCPUs
+ * from going away under our feet.
+ */
+static void query_stats_cb(StatsResultList **result, StatsTarget target,
+                           strList *names, strList *targets, Error **errp)
+{
+    KVMState *s = kvm_state;
+    CPUState *cpu;
+
+    switch (target) {
+    case STATS_TARGET_VM:
+        query_stats(result, target, names, s->vm_stats_fd, NULL, errp);
+        break;
+    case STATS_TARGET_VCPU:
+        CPU_FOREACH(cpu) {
+            g_autofree char *qom_path = NULL;
+
+            if (cpu->kvm_vcpu_stats_fd < 0) {
+                continue;
+            }
+            qom_path = object_get_canonical_path(OBJECT(cpu));
+            if (!apply_str_list_filter(qom_path, targets)) {
+                continue;
+            }
+            if (!query_stats(result, target, names, cpu->kvm_vcpu_stats_fd,
+                             qom_path, errp)) {
+                return;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void query_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    KVMState *s = kvm_state;
+    CPUState *cpu;
+    ERRP_GUARD();
+
+    query_stats_schema(result, STATS_TARGET_VM, s->vm_stats_fd, errp);
+    if (*errp) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        if (cpu->kvm_vcpu_stats_fd >= 0) {
+            query_stats_schema(result, STATS_TARGET_VCPU,
+                               cpu->kvm_vcpu_stats_fd, errp);
+            break;
+        }
+    }
+}
@@ -49,6 +49,16 @@ int kvm_has_many_ioeventfds(void)
     return 0;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return false;
+}
+
+uint32_t kvm_dirty_ring_size(void)
+{
+    return 0;
+}
+
 int kvm_update_guest_debug(CPUState *cpu, unsigned long reinject_trap)
 {
     return -ENOSYS;
@@ -133,6 +143,18 @@ int kvm_irqchip_remove_irqfd_notifier_gsi(KVMState *s, EventNotifier *n,
     return -ENOSYS;
 }
 
+int kvm_irqchip_add_irqfd_notifier(KVMState *s, EventNotifier *n,
+                                   EventNotifier *rn, qemu_irq irq)
+{
+    return -ENOSYS;
+}
+
+int kvm_irqchip_remove_irqfd_notifier(KVMState *s, EventNotifier *n,
+                                      qemu_irq irq)
+{
+    return -ENOSYS;
+}
+
 bool kvm_has_free_slot(MachineState *ms)
 {
     return false;
@@ -167,6 +167,33 @@ uint32_t curr_cflags(CPUState *cpu)
     return cflags;
 }
 
+static inline bool tb_jmp_cache_match(CPUState *cpu, TranslationBlock *tb,
+                                      target_ulong pc, target_ulong cs_base,
+                                      uint32_t flags, uint32_t cflags)
+{
+    return tb &&
+           tb->pc == pc &&
+           tb->cs_base == cs_base &&
+           tb->flags == flags &&
+           tb->trace_vcpu_dstate == *cpu->trace_dstate &&
+           (tb_cflags(tb) & ~CF_TRACE) == cflags;
+}
+
+/*
+ * Install @tb in the jump cache, keeping the entry it displaces in the
+ * victim array so that two TBs whose PCs collide can both stay cached.
+ */
+static inline void tb_jmp_cache_insert(CPUState *cpu, uint32_t hash,
+                                       TranslationBlock *tb)
+{
+    TranslationBlock *old = qatomic_read(&cpu->tb_jmp_cache[hash]);
+
+    if (old) {
+        qatomic_set(&cpu->tb_jmp_victim[hash], old);
+    }
+    qatomic_set(&cpu->tb_jmp_cache[hash], tb);
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
                                           target_ulong cs_base,
@@ -181,19 +208,28 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
     hash = tb_jmp_cache_hash_func(pc);
     tb = qatomic_rcu_read(&cpu->tb_jmp_cache[hash]);
 
-    if (likely(tb &&
-               tb->pc == pc &&
-               tb->cs_base == cs_base &&
-               tb->flags == flags &&
-               tb->trace_vcpu_dstate == *cpu->trace_dstate &&
-               tb_cflags(tb) == cflags)) {
+    if (likely(tb_jmp_cache_match(cpu, tb, pc, cs_base, flags, cflags))) {
+        return tb;
+    }
+
+    /*
+     * Entries are only ever moved between the two arrays by this vCPU,
+     * and a TB invalidated meanwhile fails the cflags check above, so
+     * a plain swap is enough here.
+     */
+    tb = qatomic_rcu_read(&cpu->tb_jmp_victim[hash]);
+    if (tb_jmp_cache_match(cpu, tb, pc, cs_base, flags, cflags)) {
+        qatomic_set(&cpu->tb_jmp_victim_hits, cpu->tb_jmp_victim_hits + 1);
+        tb_jmp_cache_insert(cpu, hash, tb);
         return tb;
     }
+
+    qatomic_set(&cpu->tb_jmp_misses, cpu->tb_jmp_misses + 1);
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
     if (tb == NULL) {
         return NULL;
     }
-    qatomic_set(&cpu->tb_jmp_cache[hash], tb);
+    tb_jmp_cache_insert(cpu, hash, tb);
     return tb;
 }
 
@@ -491,7 +527,7 @@ static bool tb_lookup_cmp(const void *p, const void *d)
         tb->cs_base == desc->cs_base &&
         tb->flags == desc->flags &&
         tb->trace_vcpu_dstate == desc->trace_vcpu_dstate &&
-        tb_cflags(tb) == desc->cflags) {
+        (tb_cflags(tb) & ~CF_TRACE) == desc->cflags) {
         /* check next page if needed */
         if (tb->page_addr[1] == -1) {
             return true;
@@ -803,6 +839,30 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
     return false;
 }
 
+/*
+ * @tb became hot and exited before executing anything; replace it with
+ * a TB translated as a trace, which lookups for its pc will find instead.
+ */
+static void cpu_retranslate_hot_tb(CPUState *cpu, TranslationBlock *tb)
+{
+    uint32_t cflags = tb_cflags(tb);
+    TranslationBlock *trace;
+
+    /* Another vCPU may have got here first */
+    if (cflags & CF_INVALID) {
+        return;
+    }
+
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    trace = tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags,
+                        cflags | CF_TRACE);
+    mmap_unlock();
+    trace_exec_tb_hot(tb, trace, tb->pc);
+
+    qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(trace->pc)], trace);
+}
+
 static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
                                     TranslationBlock **last_tb, int *tb_exit)
 {
@@ -810,6 +870,11 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 
     trace_exec_tb(tb, tb->pc);
     tb = cpu_tb_exec(cpu, tb, tb_exit);
+    if (*tb_exit == TB_EXIT_HOT) {
+        *last_tb = NULL;
+        cpu_retranslate_hot_tb(cpu, tb);
+        return;
+    }
     if (*tb_exit != TB_EXIT_REQUESTED) {
         *last_tb = tb;
         return;
@@ -857,6 +922,10 @@ int cpu_exec(CPUState *cpu)
 {
     int ret;
     SyncClocks sc = { 0 };
+#ifdef CONFIG_PROFILER
+    /* Accounted here so that user-mode emulation gets it too */
+    int64_t ti;
+#endif
 
     /* replay_interrupt may need current_cpu */
     current_cpu = cpu;
@@ -865,6 +934,9 @@ int cpu_exec(CPUState *cpu)
         return EXCP_HALTED;
     }
 
+#ifdef CONFIG_PROFILER
+    ti = profile_getclock();
+#endif
     rcu_read_lock();
 
     cpu_exec_enter(cpu);
@@ -948,7 +1020,7 @@ int cpu_exec(CPUState *cpu)
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
                  */
-                qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+                tb_jmp_cache_insert(cpu, tb_jmp_cache_hash_func(pc), tb);
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -978,6 +1050,10 @@ int cpu_exec(CPUState *cpu)
     cpu_exec_exit(cpu);
     rcu_read_unlock();
 
+#ifdef CONFIG_PROFILER
+    qatomic_set(&tcg_ctx->prof.cpu_exec_time,
+                tcg_ctx->prof.cpu_exec_time + profile_getclock() - ti);
+#endif
     return ret;
 }
 
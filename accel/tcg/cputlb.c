@@ -104,6 +104,7 @@ static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
 
     for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
         qatomic_set(&cpu->tb_jmp_cache[i0 + i], NULL);
+        qatomic_set(&cpu->tb_jmp_victim[i0 + i], NULL);
     }
 }
 
@@ -236,8 +237,10 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->lindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->ltable, 0, sizeof(desc->ltable));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
@@ -339,6 +342,19 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+size_t tlb_large_page_fill_count(void)
+{
+    CPUState *cpu;
+    size_t count = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        count += qatomic_read(&env_tlb(env)->c.large_page_fill_count);
+    }
+    return count;
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -588,6 +604,9 @@ static void tlb_flush_page_by_mmuidx_async_2(CPUState *cpu,
     g_free(d);
 }
 
+static void tlb_flush_page_queue(CPUState *cpu, target_ulong addr,
+                                 uint16_t idxmap);
+
 void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
 {
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%" PRIx16 "\n", addr, idxmap);
@@ -597,22 +616,8 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-    } else if (idxmap < TARGET_PAGE_SIZE) {
-        /*
-         * Most targets have only a few mmu_idx.  In the case where
-         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
-         * allocating memory for this operation.
-         */
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
-
-        /* Otherwise allocate a structure, freed by the worker.  */
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(d));
+        tlb_flush_page_queue(cpu, addr, idxmap);
     }
 }
 
@@ -624,32 +629,16 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
 void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
                                        uint16_t idxmap)
 {
+    CPUState *dst_cpu;
+
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                TLBFlushPageByMMUIdxData *d
-                    = g_new(TLBFlushPageByMMUIdxData, 1);
-
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_flush_page_queue(dst_cpu, addr, idxmap);
         }
     }
 
@@ -665,36 +654,31 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               target_ulong addr,
                                               uint16_t idxmap)
 {
+    CPUState *dst_cpu;
+
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_flush_page_queue(dst_cpu, addr, idxmap);
+        }
+    }
+
     /*
      * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
+     * Most targets have only a few mmu_idx.  In the case where
+     * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
+     * allocating memory for this operation.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                               RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
@@ -757,13 +741,6 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
     }
 }
 
-typedef struct {
-    target_ulong addr;
-    target_ulong len;
-    uint16_t idxmap;
-    uint16_t bits;
-} TLBFlushRangeData;
-
 static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
                                               TLBFlushRangeData d)
 {
@@ -796,6 +773,81 @@ static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
     g_free(d);
 }
 
+/**
+ * tlb_flush_pending_async_work:
+ * @cpu: cpu on which to flush
+ *
+ * Perform all of the page and range flushes that other vCPUs have
+ * queued with tlb_flush_range_queue since the last time this ran.
+ */
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBCommon *c = &env_tlb(env)->c;
+    TLBFlushRangeData pending[CPU_TLB_PENDING_RANGES];
+    uint16_t overflow;
+    unsigned int i, n;
+
+    qemu_spin_lock(&c->lock);
+    n = c->n_pending;
+    memcpy(pending, c->pending, n * sizeof(pending[0]));
+    overflow = c->pending_overflow;
+    c->n_pending = 0;
+    c->pending_overflow = 0;
+    c->pending_queued = false;
+    qemu_spin_unlock(&c->lock);
+
+    if (overflow) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(overflow));
+    }
+    for (i = 0; i < n; i++) {
+        /* The full flush above already covers these mmu_idx */
+        pending[i].idxmap &= ~overflow;
+        if (pending[i].idxmap) {
+            tlb_flush_range_by_mmuidx_async_0(cpu, pending[i]);
+        }
+    }
+}
+
+/*
+ * Queue a flush of @d on another vCPU.  Requests that arrive before
+ * that vCPU got around to the previous ones are added to the same
+ * batch, so a storm of page invalidations costs one work item per
+ * destination rather than one per page, and no allocation.
+ */
+static void tlb_flush_range_queue(CPUState *cpu, const TLBFlushRangeData *d)
+{
+    CPUTLBCommon *c = &env_tlb((CPUArchState *)cpu->env_ptr)->c;
+    bool post;
+
+    qemu_spin_lock(&c->lock);
+    if (c->n_pending < CPU_TLB_PENDING_RANGES) {
+        c->pending[c->n_pending++] = *d;
+    } else {
+        c->pending_overflow |= d->idxmap;
+    }
+    post = !c->pending_queued;
+    c->pending_queued = true;
+    qemu_spin_unlock(&c->lock);
+
+    if (post) {
+        async_run_on_cpu(cpu, tlb_flush_pending_async_work, RUN_ON_CPU_NULL);
+    }
+}
+
+static void tlb_flush_page_queue(CPUState *cpu, target_ulong addr,
+                                 uint16_t idxmap)
+{
+    TLBFlushRangeData d = {
+        .addr = addr,
+        .len = TARGET_PAGE_SIZE,
+        .idxmap = idxmap,
+        .bits = TARGET_LONG_BITS,
+    };
+
+    tlb_flush_range_queue(cpu, &d);
+}
+
 void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
                                target_ulong len, uint16_t idxmap,
                                unsigned bits)
@@ -825,10 +877,7 @@ void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_range_by_mmuidx_async_0(cpu, d);
     } else {
-        /* Otherwise allocate a structure, freed by the worker.  */
-        TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
-                         RUN_ON_CPU_HOST_PTR(p));
+        tlb_flush_range_queue(cpu, &d);
     }
 }
 
@@ -865,13 +914,9 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
-            TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu,
-                             tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
+            tlb_flush_range_queue(dst_cpu, &d);
         }
     }
 
@@ -915,12 +960,9 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
+            tlb_flush_range_queue(dst_cpu, &d);
         }
     }
 
@@ -1086,9 +1128,52 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
 }
 
+/*
+ * Remember the whole of a large page translation, so that misses on
+ * its other pages can be refilled by tlb_fill_large_page.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_record_large_page_locked(CPUTLBDesc *desc, target_ulong vaddr,
+                                         hwaddr paddr, MemTxAttrs attrs,
+                                         int prot, target_ulong size)
+{
+    CPUTLBLargeEntry *le;
+    int i;
+
+    /*
+     * Writes to PAGE_WRITE_INV pages must call tlb_fill every time.
+     * Otherwise require a naturally aligned mapping, so that the
+     * offset into the page is the same for vaddr and paddr.
+     */
+    if ((prot & PAGE_WRITE_INV) || !is_power_of_2(size) ||
+        ((vaddr ^ paddr) & (size - 1))) {
+        return;
+    }
+
+    vaddr &= ~(size - 1);
+    paddr &= ~(hwaddr)(size - 1);
+
+    for (i = 0; i < CPU_TLB_LARGE_SIZE; i++) {
+        le = &desc->ltable[i];
+        if (le->size == size && le->vaddr == vaddr) {
+            break;
+        }
+    }
+    if (i == CPU_TLB_LARGE_SIZE) {
+        le = &desc->ltable[desc->lindex++ % CPU_TLB_LARGE_SIZE];
+    }
+
+    le->vaddr = vaddr;
+    le->size = size;
+    le->paddr = paddr;
+    le->attrs = attrs;
+    le->prot = prot;
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
- * supplied size is only used by tlb_flush_page.
+ * supplied size is used by tlb_flush_page and to refill other pages
+ * of the same large page from tlb_fill_large_page.
  *
  * Called from TCG-generated code, which is under an RCU read-side
  * critical section.
@@ -1119,6 +1204,9 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     } else {
         tlb_add_large_page(env, mmu_idx, vaddr, size);
         sz = size;
+        qemu_spin_lock(&tlb->c.lock);
+        tlb_record_large_page_locked(desc, vaddr, paddr, attrs, prot, size);
+        qemu_spin_unlock(&tlb->c.lock);
     }
     vaddr_page = vaddr & TARGET_PAGE_MASK;
     paddr_page = paddr & TARGET_PAGE_MASK;
@@ -1286,6 +1374,50 @@ static inline ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr)
     return ram_addr;
 }
 
+/*
+ * Refill the entry for @addr from a large page that the target has
+ * already translated, without calling back into the page walker.
+ * Only translations that already permit @access_type qualify, so that
+ * the target still sees the first access that needs e.g. a dirty bit
+ * set or a permission fault raised.
+ */
+static bool tlb_fill_large_page(CPUState *cpu, target_ulong addr,
+                                MMUAccessType access_type, int mmu_idx)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    int need, i;
+
+    switch (access_type) {
+    case MMU_DATA_LOAD:
+        need = PAGE_READ;
+        break;
+    case MMU_DATA_STORE:
+        need = PAGE_WRITE;
+        break;
+    case MMU_INST_FETCH:
+        need = PAGE_EXEC;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    for (i = 0; i < CPU_TLB_LARGE_SIZE; i++) {
+        CPUTLBLargeEntry *le = &desc->ltable[i];
+        target_ulong ofs = addr - le->vaddr;
+
+        if (ofs < le->size && (le->prot & need)) {
+            tlb_set_page_with_attrs(cpu, addr & TARGET_PAGE_MASK,
+                                    le->paddr + (ofs & TARGET_PAGE_MASK),
+                                    le->attrs, le->prot, mmu_idx, le->size);
+            qatomic_set(&env_tlb(env)->c.large_page_fill_count,
+                        env_tlb(env)->c.large_page_fill_count + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
 /*
  * Note: tlb_fill() can trigger a resize of the TLB. This means that all of the
  * caller's prior references to the TLB table (e.g. CPUTLBEntry pointers) must
@@ -1297,6 +1429,10 @@ static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
     CPUClass *cc = CPU_GET_CLASS(cpu);
     bool ok;
 
+    if (tlb_fill_large_page(cpu, addr, access_type, mmu_idx)) {
+        return;
+    }
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1352,7 +1488,7 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         cpu_io_recompile(cpu, retaddr);
     }
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         locked = true;
     }
@@ -1413,7 +1549,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
      */
     save_iotlb_data(cpu, iotlbentry->addr, section, mr_offset);
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         locked = true;
     }
@@ -1548,10 +1684,7 @@ static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
     trace_memory_notdirty_write_access(mem_vaddr, ram_addr, size);
 
     if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
-        struct page_collection *pages
-            = page_collection_lock(ram_addr, ram_addr + size);
-        tb_invalidate_phys_page_fast(pages, ram_addr, size, retaddr);
-        page_collection_unlock(pages);
+        tb_invalidate_phys_page_fast(ram_addr, size, retaddr);
     }
 
     /*
@@ -1599,7 +1732,8 @@ static int probe_access_internal(CPUArchState *env, target_ulong addr,
             CPUState *cs = env_cpu(env);
             CPUClass *cc = CPU_GET_CLASS(cs);
 
-            if (!cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
+            if (!tlb_fill_large_page(cs, addr, access_type, mmu_idx) &&
+                !cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
                                        mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
                 *phost = NULL;
@@ -1875,6 +2009,61 @@ load_memop(const void *haddr, MemOp op)
     }
 }
 
+/*
+ * Load @size bytes at @addr, which span two pages, the first of which
+ * was found to be plain RAM in the TLB.  If the second page is plain RAM
+ * too, read both parts directly instead of going through two full loads
+ * and their TLB lookups.  Return false if the slow path is needed.
+ */
+static bool __attribute__((noinline))
+load_helper_crosspage(CPUArchState *env, target_ulong addr, TCGMemOpIdx oi,
+                      uintptr_t retaddr, size_t size, bool big_endian,
+                      bool code_read, uint64_t *pval)
+{
+    uintptr_t mmu_idx = get_mmuidx(oi);
+    const size_t tlb_off = code_read ?
+        offsetof(CPUTLBEntry, addr_code) : offsetof(CPUTLBEntry, addr_read);
+    const MMUAccessType access_type =
+        code_read ? MMU_INST_FETCH : MMU_DATA_LOAD;
+    target_ulong page2 = (addr + size - 1) & TARGET_PAGE_MASK;
+    size_t size1 = page2 - addr;
+    uintptr_t index2 = tlb_index(env, mmu_idx, page2);
+    CPUTLBEntry *entry, *entry2 = tlb_entry(env, mmu_idx, page2);
+    target_ulong tlb_addr, tlb_addr2;
+    uint8_t buf[8];
+    uint64_t val = 0;
+    size_t i;
+
+    tlb_addr2 = code_read ? entry2->addr_code : entry2->addr_read;
+    if (!tlb_hit_page(tlb_addr2, page2)) {
+        if (!victim_tlb_hit(env, mmu_idx, index2, tlb_off, page2)) {
+            tlb_fill(env_cpu(env), page2, size - size1,
+                     access_type, mmu_idx, retaddr);
+            entry2 = tlb_entry(env, mmu_idx, page2);
+        }
+        tlb_addr2 = code_read ? entry2->addr_code : entry2->addr_read;
+        tlb_addr2 &= ~TLB_INVALID_MASK;
+    }
+
+    /* Filling the second page must not have evicted the first one.  */
+    entry = tlb_entry(env, mmu_idx, addr);
+    tlb_addr = code_read ? entry->addr_code : entry->addr_read;
+    if (unlikely(!tlb_hit(tlb_addr, addr)
+                 || (tlb_addr & ~TARGET_PAGE_MASK)
+                 || (tlb_addr2 & ~TARGET_PAGE_MASK))) {
+        return false;
+    }
+
+    memcpy(buf, (void *)((uintptr_t)addr + entry->addend), size1);
+    memcpy(buf + size1, (void *)((uintptr_t)page2 + entry2->addend),
+           size - size1);
+    for (i = 0; i < size; i++) {
+        val |= (uint64_t)buf[i] << (big_endian ? (size - 1 - i) * 8 : i * 8);
+    }
+    *pval = val;
+    return true;
+}
+
 static inline uint64_t QEMU_ALWAYS_INLINE
 load_helper(CPUArchState *env, target_ulong addr, TCGMemOpIdx oi,
             uintptr_t retaddr, MemOp op, bool code_read,
@@ -1959,6 +2148,13 @@ load_helper(CPUArchState *env, target_ulong addr, TCGMemOpIdx oi,
         target_ulong addr1, addr2;
         uint64_t r1, r2;
         unsigned shift;
+
+        /* Page crossing access to RAM, as opposed to unaligned I/O.  */
+        if (!(tlb_addr & ~TARGET_PAGE_MASK) &&
+            load_helper_crosspage(env, addr, oi, retaddr, size,
+                                  memop_big_endian(op), code_read, &res)) {
+            return res;
+        }
     do_unaligned_access:
         addr1 = addr & ~((target_ulong)size - 1);
         addr2 = addr1 + size;
@@ -2385,6 +2581,26 @@ store_helper_unaligned(CPUArchState *env, target_ulong addr, uint64_t val,
                              BP_MEM_WRITE, retaddr);
     }
 
+    /*
+     * If the access spans two pages of plain RAM, write both parts
+     * directly, in the forward direction as below.
+     */
+    if (likely(size2 > 0 && size2 < size
+               && tlb_hit(tlb_addr, addr)
+               && !(tlb_addr & ~TARGET_PAGE_MASK)
+               && !(tlb_addr2 & ~TARGET_PAGE_MASK))) {
+        size_t size1 = size - size2;
+        uint8_t buf[8];
+
+        for (i = 0; i < size; ++i) {
+            buf[i] = val >> (big_endian ? (size - 1 - i) * 8 : i * 8);
+        }
+        memcpy((void *)((uintptr_t)addr + entry->addend), buf, size1);
+        memcpy((void *)((uintptr_t)page2 + entry2->addend), buf + size1,
+               size2);
+        return;
+    }
+
     /*
      * XXX: not efficient, but simple.
      * This loop must go in the forward direction to avoid issues
@@ -73,6 +73,7 @@ enum plugin_gen_from {
 
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
+    PLUGIN_GEN_CB_UDATA_COND,
     PLUGIN_GEN_CB_INLINE,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
@@ -125,20 +126,59 @@ static void gen_empty_udata_cb(void)
 }
 
 /*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
+ * Compute into @ptr the address of the value of this vCPU: the
+ * pointer and the stride (the second operand of the multiplication)
+ * are overwritten later.  A stride of 0 addresses a single global
+ * value.
  */
-static void gen_empty_inline_cb(void)
+static void gen_empty_entry_ptr(TCGv_ptr ptr)
 {
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    TCGv_ptr cpu_offset = tcg_temp_new_ptr();
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_mul_i32(cpu_index, cpu_index, cpu_index);
+    tcg_gen_ext_i32_ptr(cpu_offset, cpu_index);
+    tcg_gen_add_ptr(ptr, ptr, cpu_offset);
+
+    tcg_temp_free_ptr(cpu_offset);
+    tcg_temp_free_i32(cpu_index);
+}
+
+static void gen_empty_cond_udata_cb(void)
+{
+    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
     TCGv_i64 val = tcg_temp_new_i64();
+    TCGLabel *after_cb = gen_new_label();
+
+    gen_empty_entry_ptr(ptr);
+    tcg_gen_ld_i64(val, ptr, 0);
+    /* condition and immediate are overwritten later */
+    tcg_gen_brcondi_i64(TCG_COND_EQ, val, 0xdeadface, after_cb);
+    gen_empty_udata_cb();
+    gen_set_label(after_cb);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * The same ops serve QEMU_PLUGIN_INLINE_ADD_U64, and STORE_U64 once
+ * the load is dropped and the addition turned into a move.
+ */
+static void gen_empty_inline_cb(void)
+{
     TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
+    TCGv_i64 val = tcg_temp_new_i64();
 
+    gen_empty_entry_ptr(ptr);
     tcg_gen_ld_i64(val, ptr, 0);
     /* pass an immediate != 0 so that it doesn't get optimized away */
     tcg_gen_addi_i64(val, val, 0xdeadface);
     tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
     tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
 }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
@@ -195,6 +235,7 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
         /* fall through */
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_UDATA_COND, gen_empty_cond_udata_cb);
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
         break;
     default:
@@ -371,6 +412,86 @@ static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
     return op;
 }
 
+static TCGOp *copy_mov_i64_imm(TCGOp **begin_op, TCGOp *op, uint64_t v)
+{
+    /* replace the addition of the template with a move of @v */
+    *begin_op = QTAILQ_NEXT(*begin_op, link);
+    tcg_debug_assert(*begin_op);
+    if (TCG_TARGET_REG_BITS == 32) {
+        tcg_debug_assert((*begin_op)->opc == INDEX_op_add2_i32);
+        op = tcg_op_insert_after(tcg_ctx, op, INDEX_op_mov_i32);
+        op->args[0] = (*begin_op)->args[0];
+        op->args[1] = tcgv_i32_arg(tcg_constant_i32(v));
+        op = tcg_op_insert_after(tcg_ctx, op, INDEX_op_mov_i32);
+        op->args[0] = (*begin_op)->args[1];
+        op->args[1] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
+    } else {
+        tcg_debug_assert((*begin_op)->opc == INDEX_op_add_i64);
+        op = tcg_op_insert_after(tcg_ctx, op, INDEX_op_mov_i64);
+        op->args[0] = (*begin_op)->args[0];
+        op->args[1] = tcgv_i64_arg(tcg_constant_i64(v));
+    }
+    return op;
+}
+
+static TCGOp *skip_ld_i64(TCGOp *begin_op)
+{
+    begin_op = QTAILQ_NEXT(begin_op, link);
+    if (TCG_TARGET_REG_BITS == 32) {
+        tcg_debug_assert(begin_op->opc == INDEX_op_ld_i32);
+        begin_op = QTAILQ_NEXT(begin_op, link);
+        tcg_debug_assert(begin_op->opc == INDEX_op_ld_i32);
+    } else {
+        tcg_debug_assert(begin_op->opc == INDEX_op_ld_i64);
+    }
+    return begin_op;
+}
+
+static TCGOp *copy_brcondi_i64(TCGOp **begin_op, TCGOp *op, TCGCond cond,
+                               uint64_t v, TCGLabel *l)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        op = copy_op(begin_op, op, INDEX_op_brcond2_i32);
+        op->args[2] = tcgv_i32_arg(tcg_constant_i32(v));
+        op->args[3] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
+        op->args[4] = cond;
+        op->args[5] = label_arg(l);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_brcond_i64);
+        op->args[1] = tcgv_i64_arg(tcg_constant_i64(v));
+        op->args[2] = cond;
+        op->args[3] = label_arg(l);
+    }
+    l->refs++;
+    return op;
+}
+
+static TCGOp *copy_set_label(TCGOp **begin_op, TCGOp *op, TCGLabel *l)
+{
+    op = copy_op(begin_op, op, INDEX_op_set_label);
+    op->args[0] = label_arg(l);
+    l->present = 1;
+    return op;
+}
+
+/* const_ptr, ld_i32, mul_i32, ext_i32_ptr, add_ptr */
+static TCGOp *copy_entry_ptr(TCGOp **begin_op, TCGOp *op, void *ptr,
+                             size_t stride)
+{
+    op = copy_const_ptr(begin_op, op, ptr);
+    op = copy_op(begin_op, op, INDEX_op_ld_i32);
+    op = copy_op(begin_op, op, INDEX_op_mul_i32);
+    op->args[2] = tcgv_i32_arg(tcg_constant_i32(stride));
+    if (UINTPTR_MAX == UINT32_MAX) {
+        op = copy_op(begin_op, op, INDEX_op_mov_i32);
+        op = copy_op(begin_op, op, INDEX_op_add_i32);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_ext_i32_i64);
+        op = copy_op(begin_op, op, INDEX_op_add_i64);
+    }
+    return op;
+}
+
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -443,18 +564,82 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
-static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
-                               TCGOp *begin_op, TCGOp *op,
-                               int *unused)
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
 {
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* ALWAYS and NEVER conditions are resolved at registration */
+        g_assert_not_reached();
+    }
+}
+
+static TCGOp *append_cond_udata_cb(const struct qemu_plugin_dyn_cb *cb,
+                                   TCGOp *begin_op, TCGOp *op, int *cb_idx)
+{
+    TCGLabel *after_cb = gen_new_label();
+    TCGCond cond = plugin_cond_to_tcgcond(cb->cond.cond);
+
+    op = copy_entry_ptr(&begin_op, op, cb->cond.ptr, cb->cond.stride);
 
     /* ld_i64 */
     op = copy_ld_i64(&begin_op, op);
 
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+    /* brcond_i64, skipping the call unless the condition holds */
+    op = copy_brcondi_i64(&begin_op, op, tcg_invert_cond(cond),
+                          cb->cond.imm, after_cb);
+
+    /* const_ptr */
+    op = copy_const_ptr(&begin_op, op, cb->userp);
+
+    /*
+     * ld_i32: unlike append_udata_cb, copy it for every callback since
+     * each one is in its own basic block.
+     */
+    op = copy_op(&begin_op, op, INDEX_op_ld_i32);
+
+    /* call */
+    op = copy_call(&begin_op, op, HELPER(plugin_vcpu_udata_cb),
+                   cb->f.vcpu_udata, cb_idx);
+
+    /* set_label */
+    op = copy_set_label(&begin_op, op, after_cb);
+
+    return op;
+}
+
+static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
+                               TCGOp *begin_op, TCGOp *op,
+                               int *unused)
+{
+    op = copy_entry_ptr(&begin_op, op, cb->userp, cb->inline_insn.stride);
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        /* ld_i64 */
+        op = copy_ld_i64(&begin_op, op);
+        /* add_i64 */
+        op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        begin_op = skip_ld_i64(begin_op);
+        /* add_i64 becomes mov_i64 */
+        op = copy_mov_i64_imm(&begin_op, op, cb->inline_insn.imm);
+        break;
+    default:
+        g_assert_not_reached();
+    }
 
     /* st_i64 */
     op = copy_st_i64(&begin_op, op);
@@ -547,6 +732,12 @@ inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_udata_cb, op_ok);
 }
 
+static void
+inject_cond_udata_cb(const GArray *cbs, TCGOp *begin_op)
+{
+    inject_cb_type(cbs, begin_op, append_cond_udata_cb, op_ok);
+}
+
 static void
 inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
 {
@@ -654,6 +845,12 @@ static void plugin_gen_tb_udata(const struct qemu_plugin_tb *ptb,
     inject_udata_cb(ptb->cbs[PLUGIN_CB_REGULAR], begin_op);
 }
 
+static void plugin_gen_tb_cond_udata(const struct qemu_plugin_tb *ptb,
+                                     TCGOp *begin_op)
+{
+    inject_cond_udata_cb(ptb->cbs[PLUGIN_CB_REGULAR_COND], begin_op);
+}
+
 static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
                                  TCGOp *begin_op)
 {
@@ -668,6 +865,15 @@ static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
     inject_udata_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_REGULAR], begin_op);
 }
 
+static void plugin_gen_insn_cond_udata(const struct qemu_plugin_tb *ptb,
+                                       TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+
+    inject_cond_udata_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_REGULAR_COND],
+                         begin_op);
+}
+
 static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
@@ -719,6 +925,9 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
         case PLUGIN_GEN_CB_UDATA:
             plugin_gen_tb_udata(ptb, begin_op);
             return;
+        case PLUGIN_GEN_CB_UDATA_COND:
+            plugin_gen_tb_cond_udata(ptb, begin_op);
+            return;
         case PLUGIN_GEN_CB_INLINE:
             plugin_gen_tb_inline(ptb, begin_op);
             return;
@@ -730,6 +939,9 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
         case PLUGIN_GEN_CB_UDATA:
             plugin_gen_insn_udata(ptb, begin_op, insn_idx);
             return;
+        case PLUGIN_GEN_CB_UDATA_COND:
+            plugin_gen_insn_cond_udata(ptb, begin_op, insn_idx);
+            return;
         case PLUGIN_GEN_CB_INLINE:
             plugin_gen_insn_inline(ptb, begin_op, insn_idx);
             return;
@@ -795,6 +1007,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_UDATA:
                 type = "udata";
                 break;
+            case PLUGIN_GEN_CB_UDATA_COND:
+                type = "udata cond";
+                break;
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
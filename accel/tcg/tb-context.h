@@ -35,6 +35,10 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+    unsigned tb_evict_count;
+    /* writes to pages with code, and those that overlapped a TB */
+    size_t smc_write_count;
+    size_t smc_invalidate_count;
 };
 
 extern TBContext tb_ctx;
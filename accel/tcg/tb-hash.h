@@ -63,6 +63,8 @@ static inline
 uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc, uint32_t flags,
                       uint32_t cf_mask, uint32_t trace_vcpu_dstate)
 {
+    /* A trace replaces the TB it was built from, so it hashes the same */
+    cf_mask &= ~CF_TRACE;
     return qemu_xxhash7(phys_pc, pc, flags, cf_mask, trace_vcpu_dstate);
 }
 
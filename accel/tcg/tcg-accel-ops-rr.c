@@ -58,6 +58,18 @@ void rr_kick_vcpu_thread(CPUState *unused)
  */
 
 static QEMUTimer *rr_kick_vcpu_timer;
+
+/* Called with the BQL held, which protects the CPU list */
+static int rr_cpu_count(void)
+{
+    CPUState *cpu;
+    int cpu_count = 0;
+
+    CPU_FOREACH(cpu) {
+        ++cpu_count;
+    }
+    return cpu_count;
+}
 static CPUState *rr_current_cpu;
 
 #define TCG_KICK_PERIOD (NANOSECONDS_PER_SECOND / 10)
@@ -178,6 +190,9 @@ static void *rr_cpu_thread_fn(void *arg)
     cpu->exit_request = 1;
 
     while (1) {
+        /* Only used for icount_enabled() */
+        int cpu_count = rr_cpu_count();
+
         qemu_mutex_unlock_iothread();
         replay_mutex_lock();
         qemu_mutex_lock_iothread();
@@ -199,6 +214,8 @@ static void *rr_cpu_thread_fn(void *arg)
         }
 
         while (cpu && cpu_work_list_empty(cpu) && !cpu->exit_request) {
+            /* Only used for icount_enabled() */
+            int64_t cpu_budget = 0;
 
             qatomic_mb_set(&rr_current_cpu, cpu);
             current_cpu = cpu;
@@ -209,9 +226,12 @@ static void *rr_cpu_thread_fn(void *arg)
             if (cpu_can_run(cpu)) {
                 int r;
 
+                if (icount_enabled()) {
+                    cpu_budget = icount_percpu_budget(cpu_count);
+                }
                 qemu_mutex_unlock_iothread();
                 if (icount_enabled()) {
-                    icount_prepare_for_run(cpu);
+                    icount_prepare_for_run(cpu, cpu_budget);
                 }
                 r = tcg_cpus_exec(cpu);
                 if (icount_enabled()) {
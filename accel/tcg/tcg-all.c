@@ -44,6 +44,7 @@ struct TCGState {
     bool mttcg_enabled;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t trace_threshold;
 };
 typedef struct TCGState TCGState;
 
@@ -121,6 +122,7 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    tb_trace_threshold = s->trace_threshold;
 
     page_init();
     tb_htable_init();
@@ -196,6 +198,34 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_trace_threshold(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->trace_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_trace_threshold(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > INT32_MAX) {
+        error_setg(errp, "trace-threshold must not exceed %d", INT32_MAX);
+        return;
+    }
+
+    s->trace_threshold = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -225,6 +255,12 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "trace-threshold", "int",
+        tcg_get_trace_threshold, tcg_set_trace_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "trace-threshold",
+        "Executions after which a TB is retranslated as a trace (0 = off)");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
@@ -1532,3 +1532,22 @@ void HELPER(gvec_bitsel)(void *d, void *a, void *b, void *c, uint32_t desc)
     }
     clear_high(d, oprsz, desc);
 }
+
+void HELPER(gvec_tbl)(void *d, void *a, void *b, uint32_t desc)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+    intptr_t i, j;
+
+    for (i = 0; i < oprsz; i += 16) {
+        uint8_t tbl[16], res[16];
+
+        /* D may overlap either input.  */
+        memcpy(tbl, a + i, 16);
+        for (j = 0; j < 16; j++) {
+            uint8_t idx = *(uint8_t *)(b + i + j);
+            res[j] = idx < 16 ? tbl[idx] : 0;
+        }
+        memcpy(d + i, res, 16);
+    }
+    clear_high(d, oprsz, desc);
+}
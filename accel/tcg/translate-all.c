@@ -220,6 +220,8 @@ static void *l1_map[V_L1_MAX_SIZE];
 
 TBContext tb_ctx;
 
+uint32_t tb_trace_threshold;
+
 static void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -1017,6 +1019,53 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+static void tb_evict_one(TranslationBlock *tb)
+{
+    tb_phys_invalidate(tb, -1);
+}
+
+/*
+ * Make room in a full code buffer by evicting the oldest full region,
+ * rather than flushing every TB.  TBs in other regions stay valid, so
+ * a workload whose hot code outlives the buffer does not have to
+ * retranslate all of it.  When no region can be evicted, e.g. because
+ * there is only one, fall back to a full flush.
+ */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    bool did_evict;
+
+    mmap_lock();
+    /* A flush since the request has already made room */
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+    qemu_thread_jit_write();
+    did_evict = tcg_region_evict(tb_evict_one);
+    qemu_thread_jit_execute();
+    if (did_evict) {
+        qatomic_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    }
+    mmap_unlock();
+
+    if (!did_evict) {
+        do_tb_flush(cpu, tb_flush_count);
+    }
+}
+
+static void tb_evict_or_flush(CPUState *cpu)
+{
+    unsigned tb_flush_count = qatomic_mb_read(&tb_ctx.tb_flush_count);
+
+    if (cpu_in_exclusive_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(tb_flush_count));
+    }
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1210,6 +1259,9 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
         if (qatomic_read(&cpu->tb_jmp_cache[h]) == tb) {
             qatomic_set(&cpu->tb_jmp_cache[h], NULL);
         }
+        if (qatomic_read(&cpu->tb_jmp_victim[h]) == tb) {
+            qatomic_set(&cpu->tb_jmp_victim[h], NULL);
+        }
     }
 
     /* suppress this TB from the two jump lists */
@@ -1435,8 +1487,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* eviction or flush must be done */
+        tb_evict_or_flush(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1450,6 +1502,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->hot_count = tb_trace_threshold;
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -1488,6 +1541,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
 #ifdef CONFIG_PROFILER
     qatomic_set(&prof->tb_count, prof->tb_count + 1);
+    qatomic_set(&prof->guest_insn_count, prof->guest_insn_count + tb->icount);
     qatomic_set(&prof->interm_time,
                 prof->interm_time + profile_getclock() - ti);
     ti = profile_getclock();
@@ -1833,12 +1887,15 @@ void tb_invalidate_phys_range(target_ulong start, target_ulong end)
  * Called via softmmu_template.h when code areas are written to with
  * iothread mutex not held.
  *
- * Call with all @pages in the range [@start, @start + len[ locked.
+ * Only the lock of the written page is taken to check the code bitmap,
+ * so that writes next to code, which is what JITs in the guest mostly
+ * do, neither build a page collection nor serialize with the pages of
+ * unrelated TBs.  The collection is only locked to invalidate TBs.
  */
-void tb_invalidate_phys_page_fast(struct page_collection *pages,
-                                  tb_page_addr_t start, int len,
+void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len,
                                   uintptr_t retaddr)
 {
+    struct page_collection *pages;
     PageDesc *p;
 
     assert_memory_lock();
@@ -1848,7 +1905,8 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
         return;
     }
 
-    assert_page_locked(p);
+    qatomic_inc(&tb_ctx.smc_write_count);
+    page_lock(p);
     if (!p->code_bitmap &&
         ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
         build_page_bitmap(p);
@@ -1859,14 +1917,22 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
 
         nr = start & ~TARGET_PAGE_MASK;
         b = p->code_bitmap[BIT_WORD(nr)] >> (nr & (BITS_PER_LONG - 1));
-        if (b & ((1 << len) - 1)) {
-            goto do_invalidate;
+        if (!(b & ((1 << len) - 1))) {
+            page_unlock(p);
+            return;
         }
-    } else {
-    do_invalidate:
-        tb_invalidate_phys_page_range__locked(pages, p, start, start + len,
-                                              retaddr);
     }
+    page_unlock(p);
+
+    /*
+     * The TBs of the page may have changed meanwhile; that is fine,
+     * since the invalidation walks the list of the page again.
+     */
+    qatomic_inc(&tb_ctx.smc_invalidate_count);
+    pages = page_collection_lock(start, start + len);
+    tb_invalidate_phys_page_range__locked(pages, p, start, start + len,
+                                          retaddr);
+    page_collection_unlock(pages);
 }
 #else
 /* Called with mmap_lock held. If pc is not 0 then it indicates the
@@ -2084,11 +2150,25 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+static void tb_jmp_cache_counts(size_t *pvictim, size_t *pmiss)
+{
+    CPUState *cpu;
+    size_t victim = 0, miss = 0;
+
+    CPU_FOREACH(cpu) {
+        victim += qatomic_read(&cpu->tb_jmp_victim_hits);
+        miss += qatomic_read(&cpu->tb_jmp_misses);
+    }
+    *pvictim = victim;
+    *pmiss = miss;
+}
+
 void dump_exec_info(void)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t jmp_victim, jmp_miss;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2125,11 +2205,21 @@ void dump_exec_info(void)
                 qatomic_read(&tb_ctx.tb_flush_count));
     qemu_printf("TB invalidate count %u\n",
                 qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    qemu_printf("TB evict count      %u\n",
+                qatomic_read(&tb_ctx.tb_evict_count));
+    qemu_printf("SMC write count     %zu (%zu invalidating)\n",
+                qatomic_read(&tb_ctx.smc_write_count),
+                qatomic_read(&tb_ctx.smc_invalidate_count));
+
+    tb_jmp_cache_counts(&jmp_victim, &jmp_miss);
+    qemu_printf("TB jmp cache victim hits %zu\n", jmp_victim);
+    qemu_printf("TB jmp cache misses      %zu\n", jmp_miss);
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
     qemu_printf("TLB elided flushes  %zu\n", flush_elide);
+    qemu_printf("TLB large page refills %zu\n", tlb_large_page_fill_count());
     tcg_dump_info();
 }
 
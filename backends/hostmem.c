@@ -19,6 +19,7 @@
 #include "qemu/config-file.h"
 #include "qom/object_interfaces.h"
 #include "qemu/mmap-alloc.h"
+#include "qemu/thread-context.h"
 
 #ifdef CONFIG_NUMA
 #include <numaif.h>
@@ -231,7 +232,8 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
         void *ptr = memory_region_get_ram_ptr(&backend->mr);
         uint64_t sz = memory_region_size(&backend->mr);
 
-        os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads, &local_err);
+        os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads,
+                        backend->prealloc_context, false, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -390,10 +392,17 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
         /* Preallocate memory after the NUMA policy has been instantiated.
          * This is necessary to guarantee memory is allocated with
          * specified NUMA policy in place.
+         *
+         * Backends created on the command line are preallocated
+         * concurrently and in the background while the machine is
+         * created; qemu_machine_creation_done() waits for them.
          */
         if (backend->prealloc) {
+            bool async = !phase_check(PHASE_LATE_BACKENDS_CREATED);
+
             os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
-                            backend->prealloc_threads, &local_err);
+                            backend->prealloc_threads,
+                            backend->prealloc_context, async, &local_err);
             if (local_err) {
                 goto out;
             }
@@ -501,6 +510,11 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "prealloc-threads",
         "Number of CPU threads to use for prealloc");
+    object_class_property_add_link(oc, "prealloc-context",
+        TYPE_THREAD_CONTEXT, offsetof(HostMemoryBackend, prealloc_context),
+        object_property_allow_set_link, OBJ_PROP_LINK_STRONG);
+    object_class_property_set_description(oc, "prealloc-context",
+        "Context to use for creating CPU threads for preallocation");
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
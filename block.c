@@ -400,6 +400,7 @@ BlockDriverState *bdrv_new(void)
     bs->aio_context = qemu_get_aio_context();
 
     qemu_co_queue_init(&bs->flush_queue);
+    qemu_spin_init(&bs->block_status_cache_lock);
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
@@ -1382,6 +1383,7 @@ static void bdrv_child_cb_attach(BdrvChild *child)
     if (child->role & BDRV_CHILD_COW) {
         bdrv_backing_attach(child);
     }
+    bdrv_block_status_cache_invalidate(bs);
 
     bdrv_apply_subtree_drain(child, bs);
 }
@@ -1393,6 +1395,7 @@ static void bdrv_child_cb_detach(BdrvChild *child)
     if (child->role & BDRV_CHILD_COW) {
         bdrv_backing_detach(child);
     }
+    bdrv_block_status_cache_invalidate(bs);
 
     bdrv_unapply_subtree_drain(child, bs);
 }
@@ -4612,6 +4615,7 @@ static void bdrv_reopen_commit(BDRVReopenState *reopen_state)
     if (drv->bdrv_reopen_commit) {
         drv->bdrv_reopen_commit(reopen_state);
     }
+    bdrv_block_status_cache_invalidate(bs);
 
     /* set BDS specific flags now */
     qobject_unref(bs->explicit_options);
@@ -5441,6 +5445,24 @@ int64_t bdrv_get_allocated_file_size(BlockDriverState *bs)
     }
 }
 
+/**
+ * Return a file descriptor for reading the data of @bs directly, see
+ * BlockDriver.bdrv_get_host_fd, or a negative errno value if @bs cannot
+ * provide one.
+ */
+int bdrv_get_host_fd(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (!drv) {
+        return -ENOMEDIUM;
+    }
+    if (!drv->bdrv_get_host_fd) {
+        return -ENOTSUP;
+    }
+    return drv->bdrv_get_host_fd(bs);
+}
+
 /*
  * bdrv_measure:
  * @drv: Format driver
@@ -6214,6 +6236,7 @@ int coroutine_fn bdrv_co_invalidate_cache(BlockDriverState *bs, Error **errp)
             return ret;
         }
 
+        bdrv_block_status_cache_invalidate(bs);
         if (bs->drv->bdrv_co_invalidate_cache) {
             bs->drv->bdrv_co_invalidate_cache(bs, &local_err);
             if (local_err) {
@@ -6712,6 +6735,22 @@ AioContext *bdrv_get_aio_context(BlockDriverState *bs)
     return bs ? bs->aio_context : qemu_get_aio_context();
 }
 
+bool bdrv_supports_multi_context(BlockDriverState *bs)
+{
+    BdrvChild *child;
+
+    if (!bs->drv || !bs->drv->supports_multi_context) {
+        return false;
+    }
+
+    QLIST_FOREACH(child, &bs->children, next) {
+        if (!bdrv_supports_multi_context(child->bs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 AioContext *coroutine_fn bdrv_co_enter(BlockDriverState *bs)
 {
     Coroutine *self = qemu_coroutine_self();
@@ -34,12 +34,39 @@
 
 #include "block/backup-top.h"
 
+/* A copy-before-write operation waiting to be batched */
+typedef struct BackupTopCBWReq {
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+    Coroutine *co;
+    QSIMPLEQ_ENTRY(BackupTopCBWReq) next;
+} BackupTopCBWReq;
+
 typedef struct BDRVBackupTopState {
     BlockCopyState *bcs;
     BdrvChild *target;
     int64_t cluster_size;
+
+    /*
+     * With cbw_batching, the copy-before-write operations submitted until
+     * the next event loop iteration are collected in @cbw_reqs and copied
+     * together by a BH.  All of this happens in the AioContext of the node.
+     */
+    bool cbw_batching;
+    bool cbw_bh_scheduled;
+    QSIMPLEQ_HEAD(, BackupTopCBWReq) cbw_reqs;
 } BDRVBackupTopState;
 
+/* Adjacent copy-before-write operations that are copied together */
+typedef struct BackupTopCBWBatch {
+    BDRVBackupTopState *s;
+    int64_t offset;
+    int64_t bytes;
+    BackupTopCBWReq **reqs;
+    int nb_reqs;
+} BackupTopCBWBatch;
+
 static coroutine_fn int backup_top_co_preadv(
         BlockDriverState *bs, uint64_t offset, uint64_t bytes,
         QEMUIOVector *qiov, int flags)
@@ -47,6 +74,106 @@ static coroutine_fn int backup_top_co_preadv(
     return bdrv_co_preadv(bs->backing, offset, bytes, qiov, flags);
 }
 
+static void coroutine_fn backup_top_cbw_batch_entry(void *opaque)
+{
+    BackupTopCBWBatch *batch = opaque;
+    int ret;
+    int i;
+
+    ret = block_copy(batch->s->bcs, batch->offset, batch->bytes, true);
+
+    for (i = 0; i < batch->nb_reqs; i++) {
+        batch->reqs[i]->ret = ret;
+        aio_co_wake(batch->reqs[i]->co);
+    }
+    g_free(batch->reqs);
+    g_free(batch);
+}
+
+static int backup_top_cbw_req_cmp(const void *a, const void *b)
+{
+    const BackupTopCBWReq *req_a = *(BackupTopCBWReq * const *)a;
+    const BackupTopCBWReq *req_b = *(BackupTopCBWReq * const *)b;
+
+    if (req_a->offset != req_b->offset) {
+        return req_a->offset < req_b->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Sort the collected copy-before-write operations and start one block_copy()
+ * for every run of overlapping or adjacent areas, so that block-copy can
+ * merge their clusters into larger requests.  Operations that are not
+ * adjacent are still copied in parallel and only wait for their own run.
+ */
+static void backup_top_cbw_bh(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVBackupTopState *s = bs->opaque;
+    g_autofree BackupTopCBWReq **reqs = NULL;
+    BackupTopCBWReq *req;
+    int nb_reqs = 0;
+    int i, first;
+
+    s->cbw_bh_scheduled = false;
+
+    QSIMPLEQ_FOREACH(req, &s->cbw_reqs, next) {
+        nb_reqs++;
+    }
+    reqs = g_new(BackupTopCBWReq *, nb_reqs);
+    i = 0;
+    while ((req = QSIMPLEQ_FIRST(&s->cbw_reqs))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->cbw_reqs, next);
+        reqs[i++] = req;
+    }
+    qsort(reqs, nb_reqs, sizeof(reqs[0]), backup_top_cbw_req_cmp);
+
+    for (first = 0; first < nb_reqs; first = i) {
+        BackupTopCBWBatch *batch;
+        int64_t end = reqs[first]->offset + reqs[first]->bytes;
+        Coroutine *co;
+
+        for (i = first + 1; i < nb_reqs && reqs[i]->offset <= end; i++) {
+            end = MAX(end, reqs[i]->offset + reqs[i]->bytes);
+        }
+
+        batch = g_new(BackupTopCBWBatch, 1);
+        *batch = (BackupTopCBWBatch) {
+            .s = s,
+            .offset = reqs[first]->offset,
+            .bytes = end - reqs[first]->offset,
+            .reqs = g_memdup(&reqs[first], (i - first) * sizeof(reqs[0])),
+            .nb_reqs = i - first,
+        };
+        co = qemu_coroutine_create(backup_top_cbw_batch_entry, batch);
+        qemu_coroutine_enter(co);
+    }
+}
+
+static coroutine_fn int backup_top_cbw_batched(BlockDriverState *bs,
+                                               int64_t offset, int64_t bytes)
+{
+    BDRVBackupTopState *s = bs->opaque;
+    BackupTopCBWReq req = {
+        .offset = offset,
+        .bytes = bytes,
+        .co = qemu_coroutine_self(),
+    };
+
+    QSIMPLEQ_INSERT_TAIL(&s->cbw_reqs, &req, next);
+    if (!s->cbw_bh_scheduled) {
+        s->cbw_bh_scheduled = true;
+        aio_bh_schedule_oneshot(bdrv_get_aio_context(bs), backup_top_cbw_bh,
+                                bs);
+    }
+
+    /* Woken up by backup_top_cbw_batch_entry() */
+    qemu_coroutine_yield();
+
+    return req.ret;
+}
+
 static coroutine_fn int backup_top_cbw(BlockDriverState *bs, uint64_t offset,
                                        uint64_t bytes, BdrvRequestFlags flags)
 {
@@ -60,6 +187,10 @@ static coroutine_fn int backup_top_cbw(BlockDriverState *bs, uint64_t offset,
     off = QEMU_ALIGN_DOWN(offset, s->cluster_size);
     end = QEMU_ALIGN_UP(offset + bytes, s->cluster_size);
 
+    if (s->cbw_batching) {
+        return backup_top_cbw_batched(bs, off, end - off);
+    }
+
     return block_copy(s->bcs, off, end - off, true);
 }
 
@@ -216,6 +347,8 @@ BlockDriverState *bdrv_backup_top_append(BlockDriverState *source,
     appended = true;
 
     state->cluster_size = cluster_size;
+    state->cbw_batching = perf->cbw_batching;
+    QSIMPLEQ_INIT(&state->cbw_reqs);
     state->bcs = block_copy_state_new(top->backing, state->target,
                                       cluster_size, perf->use_copy_range,
                                       write_flags, errp);
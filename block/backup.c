@@ -26,6 +26,7 @@
 #include "sysemu/block-backend.h"
 #include "qemu/bitmap.h"
 #include "qemu/error-report.h"
+#include "sysemu/iothread.h"
 
 #include "block/backup-top.h"
 
@@ -46,6 +47,10 @@ typedef struct BackupBlockJob {
     uint64_t len;
     int64_t cluster_size;
     BackupPerf perf;
+    /* IOThreads for the background copying, see BackupPerf.iothreads */
+    IOThread **iothreads;
+    AioContext **iothread_ctxs;
+    int nb_iothreads;
 
     BlockCopyState *bcs;
 
@@ -100,11 +105,24 @@ static void backup_abort(Job *job)
     }
 }
 
+static void backup_free_iothreads(IOThread **iothreads,
+                                  AioContext **iothread_ctxs, int nb_iothreads)
+{
+    iothread_unref_list(iothreads, nb_iothreads);
+    g_free(iothread_ctxs);
+}
+
 static void backup_clean(Job *job)
 {
     BackupBlockJob *s = container_of(job, BackupBlockJob, common.job);
     block_job_remove_all_bdrv(&s->common);
     bdrv_backup_top_drop(s->backup_top);
+    /* Freed together with the filter */
+    s->bcs = NULL;
+    backup_free_iothreads(s->iothreads, s->iothread_ctxs, s->nb_iothreads);
+    s->iothreads = NULL;
+    s->iothread_ctxs = NULL;
+    s->nb_iothreads = 0;
 }
 
 void backup_do_checkpoint(BlockJob *job, Error **errp)
@@ -158,6 +176,7 @@ static int coroutine_fn backup_loop(BackupBlockJob *job)
         job->bg_bcs_call = s = block_copy_async(job->bcs, 0,
                 QEMU_ALIGN_UP(job->len, job->cluster_size),
                 job->perf.max_workers, job->perf.max_chunk,
+                job->iothread_ctxs, job->nb_iothreads,
                 backup_block_copy_callback, job);
 
         while (!block_copy_call_finished(s) &&
@@ -338,6 +357,26 @@ static void backup_cancel(Job *job, bool force)
     bdrv_cancel_in_flight(s->target_bs);
 }
 
+static void backup_query(Job *job, JobInfo *info)
+{
+    BackupBlockJob *s = container_of(job, BackupBlockJob, common.job);
+    BlockCopyStats stats;
+
+    if (!s->perf.adaptive || !s->bcs) {
+        return;
+    }
+
+    block_copy_get_stats(s->bcs, &stats);
+    info->has_block_copy = true;
+    info->block_copy = g_new(JobInfoBlockCopy, 1);
+    *info->block_copy = (JobInfoBlockCopy) {
+        .chunk_size = stats.chunk_size,
+        .workers = stats.workers,
+        .throughput = stats.throughput,
+        .latency = stats.latency_ns,
+    };
+}
+
 static const BlockJobDriver backup_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(BackupBlockJob),
@@ -350,6 +389,7 @@ static const BlockJobDriver backup_job_driver = {
         .clean                  = backup_clean,
         .pause                  = backup_pause,
         .cancel                 = backup_cancel,
+        .query                  = backup_query,
     },
     .set_speed = backup_set_speed,
 };
@@ -410,6 +450,9 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     BdrvRequestFlags write_flags;
     BlockDriverState *backup_top = NULL;
     BlockCopyState *bcs = NULL;
+    IOThread **iothreads = NULL;
+    AioContext **iothread_ctxs = NULL;
+    int nb_iothreads = 0;
 
     assert(bs);
     assert(target);
@@ -471,6 +514,25 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         return NULL;
     }
 
+    if (perf->has_iothreads && perf->iothreads) {
+        if (!bdrv_supports_multi_context(bs) ||
+            !bdrv_supports_multi_context(target)) {
+            error_setg(errp, "Source and target must support requests from "
+                       "several AioContexts to use iothreads");
+            return NULL;
+        }
+        size_t n;
+        int i;
+
+        if (!iothread_ref_list(perf->iothreads, &iothreads, &n, errp)) {
+            return NULL;
+        }
+        nb_iothreads = n;
+        iothread_ctxs = g_new0(AioContext *, nb_iothreads);
+        for (i = 0; i < nb_iothreads; i++) {
+            iothread_ctxs[i] = iothread_get_aio_context(iothreads[i]);
+        }
+    }
 
     if (sync_bitmap) {
         /* If we need to write to this bitmap, check that we can: */
@@ -548,9 +610,16 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     job->cluster_size = cluster_size;
     job->len = len;
     job->perf = *perf;
+    /* The list belongs to the caller, the job only needs the IOThreads */
+    job->perf.has_iothreads = false;
+    job->perf.iothreads = NULL;
+    job->iothreads = iothreads;
+    job->iothread_ctxs = iothread_ctxs;
+    job->nb_iothreads = nb_iothreads;
 
     block_copy_set_progress_meter(bcs, &job->common.job.progress);
     block_copy_set_speed(bcs, speed);
+    block_copy_set_adaptive(bcs, perf->adaptive);
 
     /* Required permissions are already taken by backup-top target */
     block_job_add_bdrv(&job->common, "target", target, 0, BLK_PERM_ALL,
@@ -565,6 +634,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     if (backup_top) {
         bdrv_backup_top_drop(backup_top);
     }
+    backup_free_iothreads(iothreads, iothread_ctxs, nb_iothreads);
 
     return NULL;
 }
@@ -82,9 +82,17 @@ struct BlockBackend {
     QLIST_HEAD(, BlockBackendAioNotifier) aio_notifiers;
 
     int quiesce_counter;
+    /* queued_requests_lock protects queued_requests */
+    QemuMutex queued_requests_lock;
     CoQueue queued_requests;
     bool disable_request_queuing;
 
+    /*
+     * Run the AIO requests in the AioContext of the caller rather than
+     * in blk->ctx, see blk_set_multi_context().
+     */
+    bool multi_context;
+
     VMChangeStateEntry *vmsh;
     bool force_allow_inactivate;
 
@@ -354,6 +362,7 @@ BlockBackend *blk_new(AioContext *ctx, uint64_t perm, uint64_t shared_perm)
 
     block_acct_init(&blk->stats);
 
+    qemu_mutex_init(&blk->queued_requests_lock);
     qemu_co_queue_init(&blk->queued_requests);
     notifier_list_init(&blk->remove_bs_notifiers);
     notifier_list_init(&blk->insert_bs_notifiers);
@@ -470,6 +479,7 @@ static void blk_delete(BlockBackend *blk)
     QTAILQ_REMOVE(&block_backends, blk, link);
     drive_info_del(blk->legacy_dinfo);
     block_acct_cleanup(&blk->stats);
+    qemu_mutex_destroy(&blk->queued_requests_lock);
     g_free(blk);
 }
 
@@ -1152,6 +1162,34 @@ void blk_set_disable_request_queuing(BlockBackend *blk, bool disable)
     blk->disable_request_queuing = disable;
 }
 
+/*
+ * Let the AIO requests of @blk run in the AioContext of the thread that
+ * submits them, instead of having them moved into the AioContext of the
+ * BlockBackend.  The caller still has to hold the AioContext lock of the
+ * BlockBackend when submitting, but the requests themselves then proceed
+ * and complete in its own AioContext, in parallel with the other ones.
+ *
+ * This only takes effect while every node of the graph supports it and
+ * I/O throttling is off; otherwise the requests are moved as before.
+ */
+void blk_set_multi_context(BlockBackend *blk, bool enable)
+{
+    blk->multi_context = enable;
+}
+
+/*
+ * Whether the requests of @blk currently run in the AioContext of their
+ * submitter, see blk_set_multi_context().
+ */
+bool blk_multi_context_active(BlockBackend *blk)
+{
+    BlockDriverState *bs = blk_bs(blk);
+
+    return blk->multi_context && bs &&
+           !blk->public.throttle_group_member.throttle_state &&
+           bdrv_supports_multi_context(bs);
+}
+
 static int blk_check_byte_request(BlockBackend *blk, int64_t offset,
                                   size_t size)
 {
@@ -1189,12 +1227,25 @@ static void coroutine_fn blk_wait_while_drained(BlockBackend *blk)
     assert(blk->in_flight > 0);
 
     if (blk->quiesce_counter && !blk->disable_request_queuing) {
+        /* Requests of a multi-context BlockBackend can come from anywhere */
+        QEMU_LOCK_GUARD(&blk->queued_requests_lock);
         blk_dec_in_flight(blk);
-        qemu_co_queue_wait(&blk->queued_requests, NULL);
+        qemu_co_queue_wait(&blk->queued_requests, &blk->queued_requests_lock);
         blk_inc_in_flight(blk);
     }
 }
 
+/*
+ * Count a request that accesses the node of @blk directly rather than
+ * through the I/O functions of @blk, after waiting while @blk is drained like
+ * they do.  The caller must end the request with blk_dec_in_flight().
+ */
+void coroutine_fn blk_co_start_request(BlockBackend *blk)
+{
+    blk_inc_in_flight(blk);
+    blk_wait_while_drained(blk);
+}
+
 /* To be called between exactly one pair of blk_inc/dec_in_flight() */
 static int coroutine_fn
 blk_do_preadv(BlockBackend *blk, int64_t offset, unsigned int bytes,
@@ -1406,13 +1457,15 @@ typedef struct BlkAioEmAIOCB {
     BlkRwCo rwco;
     int bytes;
     bool has_returned;
+    /* where the request runs and completes */
+    AioContext *ctx;
 } BlkAioEmAIOCB;
 
 static AioContext *blk_aio_em_aiocb_get_aio_context(BlockAIOCB *acb_)
 {
     BlkAioEmAIOCB *acb = container_of(acb_, BlkAioEmAIOCB, common);
 
-    return blk_get_aio_context(acb->rwco.blk);
+    return acb->ctx;
 }
 
 static const AIOCBInfo blk_aio_em_aiocb_info = {
@@ -1456,13 +1509,31 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset, int bytes,
     acb->bytes = bytes;
     acb->has_returned = false;
 
-    co = qemu_coroutine_create(co_entry, acb);
-    bdrv_coroutine_enter(blk_bs(blk), co);
+    if (qemu_in_coroutine() &&
+        (blk_multi_context_active(blk) ||
+         qemu_get_current_aio_context() == blk_get_aio_context(blk))) {
+        /*
+         * The caller already runs in a coroutine in the right AioContext, so
+         * run the request in it instead of creating and entering another
+         * one.  The caller waits for the request like with blk_co_*(); the
+         * completion callback is still deferred to a BH below.
+         */
+        acb->ctx = qemu_get_current_aio_context();
+        co_entry(acb);
+    } else {
+        co = qemu_coroutine_create(co_entry, acb);
+        if (blk_multi_context_active(blk)) {
+            acb->ctx = qemu_get_current_aio_context();
+            aio_co_enter(acb->ctx, co);
+        } else {
+            acb->ctx = blk_get_aio_context(blk);
+            bdrv_coroutine_enter(blk_bs(blk), co);
+        }
+    }
 
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
-                                         blk_aio_complete_bh, acb);
+        replay_bh_schedule_oneshot_event(acb->ctx, blk_aio_complete_bh, acb);
     }
 
     return &acb->common;
@@ -2170,11 +2241,22 @@ void blk_add_insert_bs_notifier(BlockBackend *blk, Notifier *notify)
     notifier_list_add(&blk->insert_bs_notifiers, notify);
 }
 
+/*
+ * Plugging is tracked per node, not per thread, so it is only done by the
+ * BlockBackend's own AioContext; with a multi-context BlockBackend the
+ * other AioContexts submit their requests unplugged.
+ */
+static bool blk_can_plug(BlockBackend *blk)
+{
+    return !blk_multi_context_active(blk) ||
+           qemu_get_current_aio_context() == blk_get_aio_context(blk);
+}
+
 void blk_io_plug(BlockBackend *blk)
 {
     BlockDriverState *bs = blk_bs(blk);
 
-    if (bs) {
+    if (bs && blk_can_plug(blk)) {
         bdrv_io_plug(bs);
     }
 }
@@ -2183,7 +2265,7 @@ void blk_io_unplug(BlockBackend *blk)
 {
     BlockDriverState *bs = blk_bs(blk);
 
-    if (bs) {
+    if (bs && blk_can_plug(blk)) {
         bdrv_io_unplug(bs);
     }
 }
@@ -2420,9 +2502,12 @@ static void blk_root_drained_end(BdrvChild *child, int *drained_end_counter)
         if (blk->dev_ops && blk->dev_ops->drained_end) {
             blk->dev_ops->drained_end(blk->dev_opaque);
         }
-        while (qemu_co_enter_next(&blk->queued_requests, NULL)) {
+        qemu_mutex_lock(&blk->queued_requests_lock);
+        while (qemu_co_enter_next(&blk->queued_requests,
+                                  &blk->queued_requests_lock)) {
             /* Resume all queued requests */
         }
+        qemu_mutex_unlock(&blk->queued_requests_lock);
     }
 }
 
@@ -28,6 +28,11 @@
 #define BLOCK_COPY_MAX_WORKERS 64
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 
+/* Limits and measurement window of the adaptive mode */
+#define BLOCK_COPY_ADAPTIVE_MAX_CHUNK (32 * MiB)
+#define BLOCK_COPY_ADAPTIVE_START_WORKERS 8
+#define BLOCK_COPY_TUNE_WINDOW 200000000LL /* ns */
+
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
     COPY_READ_WRITE,
@@ -45,6 +50,11 @@ typedef struct BlockCopyCallState {
     int64_t bytes;
     int max_workers;
     int64_t max_chunk;
+    /* Started by block_copy_async(), i.e. not a copy-before-write call */
+    bool background;
+    /* AioContexts to run the tasks in, see block_copy_async() */
+    AioContext **worker_ctxs;
+    int nb_worker_ctxs;
     bool ignore_ratelimit;
     BlockCopyAsyncCallbackFunc cb;
     void *cb_opaque;
@@ -55,6 +65,8 @@ typedef struct BlockCopyCallState {
     bool finished; /* atomic */
     QemuCoSleep sleep; /* TODO: protect API with a lock */
     bool cancelled; /* atomic */
+    /* Index of the worker AioContext for the next task */
+    int next_worker_ctx;
     /* To reference all call states from BlockCopyState */
     QLIST_ENTRY(BlockCopyCallState) list;
 
@@ -90,6 +102,13 @@ typedef struct BlockCopyTask {
      * iteration.
      */
     BlockCopyMethod method;
+    /*
+     * AioContext in which to copy the data, or NULL to run in the
+     * AioContext of the block-copy call.  Set together with @method.
+     */
+    AioContext *ctx;
+    /* When the task was created, to measure its latency */
+    int64_t start_ns;
 
     /*
      * Fields whose state changes throughout the execution
@@ -136,6 +155,28 @@ typedef struct BlockCopyState {
     BlockCopyMethod method;
     QLIST_HEAD(, BlockCopyTask) tasks; /* All tasks from all block-copy calls */
     QLIST_HEAD(, BlockCopyCallState) calls;
+    /*
+     * Request length and number of parallel requests of background calls,
+     * and what was measured for them in the last window.  With @adaptive,
+     * the limits are tuned from these measurements, see block_copy_tune().
+     * Also read without lock by block_copy_get_stats().
+     */
+    bool adaptive;
+    int64_t tune_chunk;
+    int tune_workers;
+    int64_t tune_max_chunk;
+    int tune_max_workers;
+    uint64_t tune_throughput;
+    uint64_t tune_latency_ns;
+    /* State of the search, see block_copy_tune() */
+    bool tune_chunk_knob;
+    bool tune_up;
+    uint64_t tune_min_latency_per_mb;
+    /* Measurements of the current window */
+    int64_t window_start_ns;
+    int64_t window_bytes;
+    int64_t window_latency_ns;
+    int window_tasks;
     /*
      * skip_unallocated:
      *
@@ -225,7 +266,13 @@ block_copy_task_create(BlockCopyState *s, BlockCopyCallState *call_state,
     int64_t max_chunk;
 
     QEMU_LOCK_GUARD(&s->lock);
-    max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+    if (call_state->background && s->adaptive &&
+        s->method != COPY_READ_WRITE_CLUSTER) {
+        max_chunk = MIN(s->tune_chunk, s->max_transfer);
+    } else {
+        max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s),
+                                 call_state->max_chunk);
+    }
     if (!bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap,
                                            offset, offset + bytes,
                                            max_chunk, &offset, &bytes))
@@ -250,6 +297,7 @@ block_copy_task_create(BlockCopyState *s, BlockCopyCallState *call_state,
         .offset = offset,
         .bytes = bytes,
         .method = s->method,
+        .start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
     };
     qemu_co_queue_init(&task->wait_queue);
     QLIST_INSERT_HEAD(&s->tasks, task, list);
@@ -502,15 +550,126 @@ static int coroutine_fn block_copy_do_copy(BlockCopyState *s,
     return ret;
 }
 
+/*
+ * Take one step in the search for the request length and the number of
+ * parallel requests with the highest throughput, which works much like TCP
+ * congestion control: keep changing one of them (doubling or halving the
+ * request length, adding a worker or halving the workers) as long as the
+ * throughput grows, go back if it shrinks and try the other one once it
+ * doesn't change any more.  A sharp rise of the latency per byte means the
+ * target is congested, so that always halves the workers.
+ *
+ * Called with lock held.
+ */
+static void block_copy_tune(BlockCopyState *s, uint64_t throughput,
+                            uint64_t latency_per_mb)
+{
+    uint64_t last = s->tune_throughput;
+    int64_t chunk = s->tune_chunk;
+    int workers = s->tune_workers;
+
+    if (!s->tune_min_latency_per_mb ||
+        latency_per_mb < s->tune_min_latency_per_mb) {
+        s->tune_min_latency_per_mb = latency_per_mb;
+    }
+
+    if (workers > 1 && latency_per_mb > 4 * s->tune_min_latency_per_mb) {
+        s->tune_chunk_knob = false;
+        s->tune_up = false;
+    } else if (last && throughput < last - last / 20) {
+        s->tune_up = !s->tune_up;
+    } else if (last && throughput <= last + last / 20) {
+        s->tune_chunk_knob = !s->tune_chunk_knob;
+        s->tune_up = true;
+    }
+
+    if (s->tune_chunk_knob) {
+        chunk = s->tune_up ? chunk * 2 : chunk / 2;
+        chunk = QEMU_ALIGN_DOWN(MIN(chunk, s->tune_max_chunk),
+                                s->cluster_size);
+        chunk = MAX(chunk, s->cluster_size);
+    } else {
+        workers = s->tune_up ? workers + 1 : workers / 2;
+        workers = MAX(MIN(workers, s->tune_max_workers), 1);
+    }
+
+    if (chunk == s->tune_chunk && workers == s->tune_workers) {
+        /* Hit a limit, try the other one next time */
+        s->tune_chunk_knob = !s->tune_chunk_knob;
+        s->tune_up = true;
+    }
+
+    trace_block_copy_tune(s, throughput, latency_per_mb, chunk, workers);
+    qatomic_set_i64(&s->tune_chunk, chunk);
+    qatomic_set(&s->tune_workers, workers);
+}
+
+/*
+ * Account a finished background task.  At the end of each measurement
+ * window, update the statistics and, in adaptive mode, the limits.
+ *
+ * Called with lock held.
+ */
+static void block_copy_account_task(BlockCopyState *s, BlockCopyTask *t)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed;
+    uint64_t throughput, latency, latency_per_mb;
+
+    if (!s->window_start_ns) {
+        s->window_start_ns = t->start_ns;
+    }
+    s->window_bytes += t->bytes;
+    s->window_latency_ns += now - t->start_ns;
+    s->window_tasks++;
+
+    elapsed = now - s->window_start_ns;
+    if (elapsed < BLOCK_COPY_TUNE_WINDOW || s->window_tasks < s->tune_workers) {
+        return;
+    }
+
+    /*
+     * A window much longer than planned spans a pause or rate limiting,
+     * so it says nothing about the performance of the limits.
+     */
+    if (elapsed <= 10 * BLOCK_COPY_TUNE_WINDOW) {
+        throughput = s->window_bytes * NANOSECONDS_PER_SECOND / elapsed;
+        latency = s->window_latency_ns / s->window_tasks;
+        latency_per_mb = latency * MiB / (s->window_bytes / s->window_tasks);
+
+        if (s->adaptive) {
+            block_copy_tune(s, throughput, latency_per_mb);
+        }
+        qatomic_set_u64(&s->tune_throughput, throughput);
+        qatomic_set_u64(&s->tune_latency_ns, latency);
+    }
+
+    s->window_start_ns = now;
+    s->window_bytes = 0;
+    s->window_latency_ns = 0;
+    s->window_tasks = 0;
+}
+
 static coroutine_fn int block_copy_task_entry(AioTask *task)
 {
     BlockCopyTask *t = container_of(task, BlockCopyTask, task);
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    AioContext *home_ctx = qemu_get_current_aio_context();
     int ret;
 
+    /*
+     * Only the copying itself runs in the worker AioContext, the task
+     * pool and the call state are left to the AioContext of the call.
+     */
+    if (t->ctx && t->ctx != home_ctx) {
+        aio_co_reschedule_self(t->ctx);
+    }
     ret = block_copy_do_copy(s, t->offset, t->bytes, &method, &error_is_read);
+    if (t->ctx && t->ctx != home_ctx) {
+        aio_co_reschedule_self(home_ctx);
+    }
 
     WITH_QEMU_LOCK_GUARD(&s->lock) {
         if (s->method == t->method) {
@@ -524,6 +683,9 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
             }
         } else {
             progress_work_done(s->progress, t->bytes);
+            if (t->call_state->background) {
+                block_copy_account_task(s, t);
+            }
         }
     }
     co_put_to_shres(s->mem, t->bytes);
@@ -701,6 +863,11 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         }
         if (ret & BDRV_BLOCK_ZERO) {
             task->method = COPY_WRITE_ZEROES;
+        } else if (call_state->nb_worker_ctxs) {
+            /* Zeroes are cheap and not worth a context switch */
+            task->ctx = call_state->worker_ctxs[call_state->next_worker_ctx];
+            call_state->next_worker_ctx = (call_state->next_worker_ctx + 1) %
+                                          call_state->nb_worker_ctxs;
         }
 
         if (!call_state->ignore_ratelimit) {
@@ -726,6 +893,10 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         if (!aio && bytes) {
             aio = aio_task_pool_new(call_state->max_workers);
         }
+        if (aio && call_state->background && s->adaptive) {
+            aio_task_pool_set_max_busy_tasks(aio,
+                                             qatomic_read(&s->tune_workers));
+        }
 
         ret = block_copy_task_run(aio, task);
         if (ret < 0) {
@@ -759,6 +930,51 @@ void block_copy_kick(BlockCopyCallState *call_state)
     qemu_co_sleep_wake(&call_state->sleep);
 }
 
+/*
+ * Set the limits of the background requests from the parameters of a new
+ * background call.  Limits that were already tuned are only clamped, so
+ * that a call started again after an error or a pause continues with them.
+ *
+ * Called with lock held.
+ */
+static void block_copy_init_tuning(BlockCopyState *s,
+                                   BlockCopyCallState *call_state)
+{
+    int64_t chunk, max_chunk;
+    int workers;
+
+    chunk = MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+    if (!s->adaptive) {
+        qatomic_set_i64(&s->tune_chunk, chunk);
+        qatomic_set(&s->tune_workers, call_state->max_workers);
+        return;
+    }
+
+    max_chunk = MIN_NON_ZERO(call_state->max_chunk,
+                             BLOCK_COPY_ADAPTIVE_MAX_CHUNK);
+    s->tune_max_chunk = MAX(QEMU_ALIGN_DOWN(MIN(max_chunk, s->max_transfer),
+                                            s->cluster_size),
+                            s->cluster_size);
+    s->tune_max_workers = call_state->max_workers;
+
+    if (s->tune_chunk) {
+        chunk = MIN(s->tune_chunk, s->tune_max_chunk);
+        workers = MIN(s->tune_workers, s->tune_max_workers);
+    } else {
+        chunk = MIN(chunk, s->tune_max_chunk);
+        workers = MIN(call_state->max_workers,
+                      BLOCK_COPY_ADAPTIVE_START_WORKERS);
+        s->tune_chunk_knob = true;
+        s->tune_up = true;
+    }
+    qatomic_set_i64(&s->tune_chunk, chunk);
+    qatomic_set(&s->tune_workers, workers);
+    s->window_start_ns = 0;
+    s->window_bytes = 0;
+    s->window_latency_ns = 0;
+    s->window_tasks = 0;
+}
+
 /*
  * block_copy_common
  *
@@ -775,6 +991,9 @@ static int coroutine_fn block_copy_common(BlockCopyCallState *call_state)
 
     qemu_co_mutex_lock(&s->lock);
     QLIST_INSERT_HEAD(&s->calls, call_state, list);
+    if (call_state->background) {
+        block_copy_init_tuning(s, call_state);
+    }
     qemu_co_mutex_unlock(&s->lock);
 
     do {
@@ -853,6 +1072,8 @@ static void coroutine_fn block_copy_async_co_entry(void *opaque)
 BlockCopyCallState *block_copy_async(BlockCopyState *s,
                                      int64_t offset, int64_t bytes,
                                      int max_workers, int64_t max_chunk,
+                                     AioContext **worker_ctxs,
+                                     int nb_worker_ctxs,
                                      BlockCopyAsyncCallbackFunc cb,
                                      void *cb_opaque)
 {
@@ -864,6 +1085,9 @@ BlockCopyCallState *block_copy_async(BlockCopyState *s,
         .bytes = bytes,
         .max_workers = max_workers,
         .max_chunk = max_chunk,
+        .background = true,
+        .worker_ctxs = worker_ctxs,
+        .nb_worker_ctxs = nb_worker_ctxs,
         .cb = cb,
         .cb_opaque = cb_opaque,
 
@@ -933,6 +1157,22 @@ BdrvDirtyBitmap *block_copy_dirty_bitmap(BlockCopyState *s)
     return s->copy_bitmap;
 }
 
+/* Only set before running the job, no need for locking. */
+void block_copy_set_adaptive(BlockCopyState *s, bool adaptive)
+{
+    s->adaptive = adaptive;
+}
+
+void block_copy_get_stats(BlockCopyState *s, BlockCopyStats *stats)
+{
+    *stats = (BlockCopyStats) {
+        .chunk_size = qatomic_read_i64(&s->tune_chunk),
+        .workers = qatomic_read(&s->tune_workers),
+        .throughput = qatomic_read_u64(&s->tune_throughput),
+        .latency_ns = qatomic_read_u64(&s->tune_latency_ns),
+    };
+}
+
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
 {
     qatomic_set(&s->skip_unallocated, skip);
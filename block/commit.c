@@ -21,6 +21,7 @@
 #include "qapi/qmp/qerror.h"
 #include "qemu/ratelimit.h"
 #include "sysemu/block-backend.h"
+#include "block/aio_task.h"
 
 enum {
     /*
@@ -29,8 +30,20 @@ enum {
      * contiguous regions of the image is efficient.
      */
     COMMIT_BUFFER_SIZE = 512 * 1024, /* in bytes */
+
+    /* Chunks copied in parallel */
+    COMMIT_MAX_WORKERS = 8,
 };
 
+/* A chunk that could not be copied, to be retried by the job coroutine */
+typedef struct CommitFailure {
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+    bool error_in_source;
+    QSIMPLEQ_ENTRY(CommitFailure) next;
+} CommitFailure;
+
 typedef struct CommitBlockJob {
     BlockJob common;
     BlockDriverState *commit_top_bs;
@@ -42,8 +55,16 @@ typedef struct CommitBlockJob {
     bool base_read_only;
     bool chain_frozen;
     char *backing_file_str;
+    QSIMPLEQ_HEAD(, CommitFailure) failures;
 } CommitBlockJob;
 
+typedef struct CommitTask {
+    AioTask task;
+    CommitBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} CommitTask;
+
 static int commit_prepare(Job *job)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
@@ -112,15 +133,106 @@ static void commit_clean(Job *job)
     blk_unref(s->top);
 }
 
+static int coroutine_fn commit_copy(CommitBlockJob *s, int64_t offset,
+                                    int64_t bytes, bool *error_in_source)
+{
+    QEMU_AUTO_VFREE void *buf = blk_blockalign(s->top, bytes);
+    int ret;
+
+    assert(bytes < SIZE_MAX);
+
+    *error_in_source = true;
+    ret = blk_co_pread(s->top, offset, bytes, buf, 0);
+    if (ret >= 0) {
+        ret = blk_co_pwrite(s->base, offset, bytes, buf, 0);
+        if (ret < 0) {
+            *error_in_source = false;
+        }
+    }
+
+    return ret;
+}
+
+static int coroutine_fn commit_task_entry(AioTask *task)
+{
+    CommitTask *t = container_of(task, CommitTask, task);
+    CommitBlockJob *s = t->s;
+    bool error_in_source;
+    int ret;
+
+    ret = commit_copy(s, t->offset, t->bytes, &error_in_source);
+    if (ret < 0) {
+        CommitFailure *f = g_new(CommitFailure, 1);
+
+        *f = (CommitFailure) {
+            .offset = t->offset,
+            .bytes = t->bytes,
+            .ret = ret,
+            .error_in_source = error_in_source,
+        };
+        QSIMPLEQ_INSERT_TAIL(&s->failures, f, next);
+    } else {
+        job_progress_update(&s->common.job, t->bytes);
+    }
+
+    /* Errors are handled by commit_retry_failures() */
+    return 0;
+}
+
+/*
+ * Retry the chunks that could not be copied, one by one in the job
+ * coroutine, so that stopping on errors works as in a sequential copy.
+ * Returns the error to fail the job with, or 0.
+ */
+static int coroutine_fn commit_retry_failures(CommitBlockJob *s,
+                                              AioTaskPool *aio)
+{
+    CommitFailure *f;
+
+    if (QSIMPLEQ_EMPTY(&s->failures)) {
+        return 0;
+    }
+    aio_task_pool_wait_all(aio);
+
+    while ((f = QSIMPLEQ_FIRST(&s->failures)) != NULL) {
+        BlockErrorAction action =
+            block_job_error_action(&s->common, s->on_error,
+                                   f->error_in_source, -f->ret);
+
+        if (action == BLOCK_ERROR_ACTION_REPORT) {
+            return f->ret;
+        }
+
+        job_sleep_ns(&s->common.job, 0);
+        if (job_is_cancelled(&s->common.job)) {
+            return 0;
+        }
+        f->ret = commit_copy(s, f->offset, f->bytes, &f->error_in_source);
+        if (f->ret < 0) {
+            continue;
+        }
+
+        job_progress_update(&s->common.job, f->bytes);
+        QSIMPLEQ_REMOVE_HEAD(&s->failures, next);
+        g_free(f);
+    }
+
+    return 0;
+}
+
 static int coroutine_fn commit_run(Job *job, Error **errp)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
+    AioTaskPool *aio;
+    CommitFailure *f;
     int64_t offset;
     uint64_t delay_ns = 0;
     int ret = 0;
     int64_t n = 0; /* bytes */
-    QEMU_AUTO_VFREE void *buf = NULL;
     int64_t len, base_len;
+    /* Result of the last allocation query, which may span many chunks */
+    int64_t status_end = 0;
+    bool status_copy = false;
 
     len = blk_getlength(s->top);
     if (len < 0) {
@@ -140,41 +252,61 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         }
     }
 
-    buf = blk_blockalign(s->top, COMMIT_BUFFER_SIZE);
+    QSIMPLEQ_INIT(&s->failures);
+    aio = aio_task_pool_new(COMMIT_MAX_WORKERS);
 
     for (offset = 0; offset < len; offset += n) {
         bool copy;
-        bool error_in_source = true;
 
-        /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+        /*
+         * Note that even when no rate limit is applied we need to yield
+         * here so that bdrv_drain_all() returns.  Requests that are still
+         * in flight are waited for by the drain.
          */
         job_sleep_ns(&s->common.job, delay_ns);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
-        /* Copy if allocated above the base */
-        ret = bdrv_is_allocated_above(blk_bs(s->top), s->base_overlay, true,
-                                      offset, COMMIT_BUFFER_SIZE, &n);
-        copy = (ret > 0);
-        trace_commit_one_iteration(s, offset, n, ret);
-        if (copy) {
-            assert(n < SIZE_MAX);
 
-            ret = blk_co_pread(s->top, offset, n, buf, 0);
+        ret = commit_retry_failures(s, aio);
+        if (ret < 0 || job_is_cancelled(&s->common.job)) {
+            break;
+        }
+
+        /* Copy if allocated above the base */
+        if (offset < status_end) {
+            ret = status_copy;
+            n = status_end - offset;
+        } else {
+            ret = bdrv_is_allocated_above(blk_bs(s->top), s->base_overlay,
+                                          true, offset, len - offset, &n);
+            trace_commit_one_iteration(s, offset, n, ret);
             if (ret >= 0) {
-                ret = blk_co_pwrite(s->base, offset, n, buf, 0);
-                if (ret < 0) {
-                    error_in_source = false;
-                }
+                status_end = offset + n;
+                status_copy = ret > 0;
             }
         }
+
+        copy = (ret > 0);
+        if (copy) {
+            CommitTask *t = g_new(CommitTask, 1);
+
+            n = MIN(n, COMMIT_BUFFER_SIZE);
+            *t = (CommitTask) {
+                .task.func = commit_task_entry,
+                .s = s,
+                .offset = offset,
+                .bytes = n,
+            };
+            aio_task_pool_start_task(aio, &t->task);
+            delay_ns = block_job_ratelimit_get_delay(&s->common, n);
+            continue;
+        }
         if (ret < 0) {
             BlockErrorAction action =
-                block_job_error_action(&s->common, s->on_error,
-                                       error_in_source, -ret);
+                block_job_error_action(&s->common, s->on_error, true, -ret);
             if (action == BLOCK_ERROR_ACTION_REPORT) {
-                return ret;
+                break;
             } else {
                 n = 0;
                 continue;
@@ -182,15 +314,21 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         }
         /* Publish progress */
         job_progress_update(&s->common.job, n);
+        delay_ns = 0;
+    }
 
-        if (copy) {
-            delay_ns = block_job_ratelimit_get_delay(&s->common, n);
-        } else {
-            delay_ns = 0;
-        }
+    aio_task_pool_wait_all(aio);
+    if (ret >= 0 && !job_is_cancelled(&s->common.job)) {
+        ret = commit_retry_failures(s, aio);
     }
+    aio_task_pool_free(aio);
 
-    return 0;
+    while ((f = QSIMPLEQ_FIRST(&s->failures)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failures, next);
+        g_free(f);
+    }
+
+    return ret < 0 ? ret : 0;
 }
 
 static const BlockJobDriver commit_job_driver = {
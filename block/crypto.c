@@ -21,7 +21,9 @@
 #include "qemu/osdep.h"
 
 #include "block/block_int.h"
+#include "block/aio_task.h"
 #include "block/qdict.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -35,9 +37,23 @@
 
 typedef struct BlockCrypto BlockCrypto;
 
+/*
+ * Number of ciphers of a QCryptoBlock, and thus the number of chunks that
+ * can be encrypted or decrypted at the same time.
+ */
+#define BLOCK_CRYPTO_MAX_THREADS 4
+
+/* Smallest chunk that is worth sending to a worker thread */
+#define BLOCK_CRYPTO_MIN_TASK_SIZE (64 * 1024)
+
 struct BlockCrypto {
     QCryptoBlock *block;
     bool updating_keys;
+
+    /* Limits the users of the ciphers to BLOCK_CRYPTO_MAX_THREADS */
+    CoMutex lock;
+    CoQueue thread_task_queue;
+    int nb_threads;
 };
 
 
@@ -274,6 +290,9 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
     bs->supported_write_flags = BDRV_REQ_FUA &
         bs->file->bs->supported_write_flags;
 
+    qemu_co_mutex_init(&crypto->lock);
+    qemu_co_queue_init(&crypto->thread_task_queue);
+
     opts = qemu_opts_create(opts_spec, NULL, 0, &error_abort);
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
         goto cleanup;
@@ -294,7 +313,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
-                                       1,
+                                       BLOCK_CRYPTO_MAX_THREADS,
                                        errp);
 
     if (!crypto->block) {
@@ -396,6 +415,135 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+typedef int (*BlockCryptoEncDecFunc)(QCryptoBlock *block, uint64_t offset,
+                                     uint8_t *buf, size_t len, Error **errp);
+
+typedef struct BlockCryptoEncDecData {
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    BlockCryptoEncDecFunc func;
+} BlockCryptoEncDecData;
+
+static int block_crypto_encdec_func(void *opaque)
+{
+    BlockCryptoEncDecData *data = opaque;
+
+    if (data->func(data->block, data->offset, data->buf, data->len,
+                   NULL) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+/*
+ * Encrypt or decrypt a chunk with one of the ciphers of the QCryptoBlock,
+ * optionally in a worker thread.
+ */
+static int coroutine_fn
+block_crypto_co_encdec_one(BlockDriverState *bs, BlockCryptoEncDecData *data,
+                           bool offload)
+{
+    BlockCrypto *crypto = bs->opaque;
+    int ret;
+
+    qemu_co_mutex_lock(&crypto->lock);
+    while (crypto->nb_threads >= BLOCK_CRYPTO_MAX_THREADS) {
+        qemu_co_queue_wait(&crypto->thread_task_queue, &crypto->lock);
+    }
+    crypto->nb_threads++;
+    qemu_co_mutex_unlock(&crypto->lock);
+
+    if (offload) {
+        /* Not necessarily bs's AioContext, see blk_set_multi_context() */
+        ThreadPool *pool =
+            aio_get_thread_pool(qemu_get_current_aio_context());
+
+        ret = thread_pool_submit_co(pool, block_crypto_encdec_func, data);
+    } else {
+        ret = block_crypto_encdec_func(data);
+    }
+
+    qemu_co_mutex_lock(&crypto->lock);
+    crypto->nb_threads--;
+    qemu_co_queue_next(&crypto->thread_task_queue);
+    qemu_co_mutex_unlock(&crypto->lock);
+
+    return ret;
+}
+
+typedef struct BlockCryptoTask {
+    AioTask task;
+    BlockDriverState *bs;
+    BlockCryptoEncDecData data;
+} BlockCryptoTask;
+
+static coroutine_fn int block_crypto_task_entry(AioTask *task)
+{
+    BlockCryptoTask *t = container_of(task, BlockCryptoTask, task);
+
+    return block_crypto_co_encdec_one(t->bs, &t->data, true);
+}
+
+/*
+ * Encrypt or decrypt @len bytes at @buf, which correspond to guest offset
+ * @offset.  Large buffers are split in chunks that are processed in
+ * parallel by the thread pool, while small ones are processed in the
+ * calling coroutine, where doing so is cheaper than a round trip to a
+ * worker thread.
+ */
+static int coroutine_fn
+block_crypto_co_encdec(BlockDriverState *bs, uint64_t offset, uint8_t *buf,
+                       size_t len, BlockCryptoEncDecFunc func)
+{
+    BlockCrypto *crypto = bs->opaque;
+    uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
+    AioTaskPool *pool;
+    size_t task_size, done;
+    int ret;
+
+    if (len < 2 * BLOCK_CRYPTO_MIN_TASK_SIZE) {
+        BlockCryptoEncDecData data = {
+            .block = crypto->block,
+            .offset = offset,
+            .buf = buf,
+            .len = len,
+            .func = func,
+        };
+
+        return block_crypto_co_encdec_one(bs, &data, false);
+    }
+
+    task_size = DIV_ROUND_UP(len, BLOCK_CRYPTO_MAX_THREADS);
+    task_size = ROUND_UP(MAX(task_size, BLOCK_CRYPTO_MIN_TASK_SIZE),
+                         sector_size);
+
+    pool = aio_task_pool_new(BLOCK_CRYPTO_MAX_THREADS);
+    for (done = 0; done < len && aio_task_pool_status(pool) == 0;
+         done += task_size) {
+        BlockCryptoTask *t = g_new(BlockCryptoTask, 1);
+
+        *t = (BlockCryptoTask) {
+            .task.func = block_crypto_task_entry,
+            .bs = bs,
+            .data = {
+                .block = crypto->block,
+                .offset = offset + done,
+                .buf = buf + done,
+                .len = MIN(task_size, len - done),
+                .func = func,
+            },
+        };
+        aio_task_pool_start_task(pool, &t->task);
+    }
+    aio_task_pool_wait_all(pool);
+    ret = aio_task_pool_status(pool);
+    aio_task_pool_free(pool);
+
+    return ret;
+}
+
 static coroutine_fn int
 block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                        QEMUIOVector *qiov, int flags)
@@ -404,6 +552,7 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     uint64_t cur_bytes; /* number of bytes in current iteration */
     uint64_t bytes_done = 0;
     uint8_t *cipher_data = NULL;
+    size_t cipher_size = MIN(BLOCK_CRYPTO_MAX_IO_SIZE, qiov->size);
     QEMUIOVector hd_qiov;
     int ret = 0;
     uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
@@ -419,9 +568,7 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     /* Bounce buffer because we don't wish to expose cipher text
      * in qiov which points to guest memory.
      */
-    cipher_data =
-        qemu_try_blockalign(bs->file->bs, MIN(BLOCK_CRYPTO_MAX_IO_SIZE,
-                                              qiov->size));
+    cipher_data = qemu_try_bounce_buf(bs->file->bs, cipher_size);
     if (cipher_data == NULL) {
         ret = -ENOMEM;
         goto cleanup;
@@ -439,9 +586,9 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done, cipher_data,
+                                     cur_bytes, qcrypto_block_decrypt);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -453,7 +600,7 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
  cleanup:
     qemu_iovec_destroy(&hd_qiov);
-    qemu_vfree(cipher_data);
+    qemu_bounce_buf_free(bs->file->bs, cipher_data, cipher_size);
 
     return ret;
 }
@@ -467,6 +614,7 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     uint64_t cur_bytes; /* number of bytes in current iteration */
     uint64_t bytes_done = 0;
     uint8_t *cipher_data = NULL;
+    size_t cipher_size = MIN(BLOCK_CRYPTO_MAX_IO_SIZE, qiov->size);
     QEMUIOVector hd_qiov;
     int ret = 0;
     uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
@@ -482,9 +630,7 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     /* Bounce buffer because we're not permitted to touch
      * contents of qiov - it points to guest memory.
      */
-    cipher_data =
-        qemu_try_blockalign(bs->file->bs, MIN(BLOCK_CRYPTO_MAX_IO_SIZE,
-                                              qiov->size));
+    cipher_data = qemu_try_bounce_buf(bs->file->bs, cipher_size);
     if (cipher_data == NULL) {
         ret = -ENOMEM;
         goto cleanup;
@@ -495,9 +641,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done, cipher_data,
+                                     cur_bytes, qcrypto_block_encrypt);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -516,7 +662,7 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
  cleanup:
     qemu_iovec_destroy(&hd_qiov);
-    qemu_vfree(cipher_data);
+    qemu_bounce_buf_free(bs->file->bs, cipher_data, cipher_size);
 
     return ret;
 }
@@ -40,9 +40,19 @@
 #define PROTOCOLS (CURLPROTO_HTTP | CURLPROTO_HTTPS | \
                    CURLPROTO_FTP | CURLPROTO_FTPS)
 
-#define CURL_NUM_STATES 8
 #define CURL_NUM_ACB    8
 #define CURL_TIMEOUT_MAX 10000
+#define CURL_MAX_CONNECTIONS 64
+
+/* Granularity of the block cache */
+#define CURL_CACHE_BLOCK_SIZE (64 * 1024)
+
+/*
+ * Number of back-to-back sequential reads after which data is prefetched,
+ * and how many readahead windows past the last read are kept in flight.
+ */
+#define CURL_SEQ_THRESHOLD 4
+#define CURL_PREFETCH_WINDOWS 4
 
 #define CURL_BLOCK_OPT_URL       "url"
 #define CURL_BLOCK_OPT_READAHEAD "readahead"
@@ -54,10 +64,13 @@
 #define CURL_BLOCK_OPT_PASSWORD_SECRET "password-secret"
 #define CURL_BLOCK_OPT_PROXY_USERNAME "proxy-username"
 #define CURL_BLOCK_OPT_PROXY_PASSWORD_SECRET "proxy-password-secret"
+#define CURL_BLOCK_OPT_CONNECTIONS "connections"
+#define CURL_BLOCK_OPT_CACHE_SIZE "cache-size"
 
 #define CURL_BLOCK_OPT_READAHEAD_DEFAULT (256 * 1024)
 #define CURL_BLOCK_OPT_SSLVERIFY_DEFAULT true
 #define CURL_BLOCK_OPT_TIMEOUT_DEFAULT 5
+#define CURL_BLOCK_OPT_CONNECTIONS_DEFAULT 8
 
 struct BDRVCURLState;
 struct CURLState;
@@ -95,11 +108,19 @@ typedef struct CURLState
     char in_use;
 } CURLState;
 
+typedef struct CURLCacheBlock {
+    uint64_t index;                     /* offset / CURL_CACHE_BLOCK_SIZE */
+    size_t len;
+    QTAILQ_ENTRY(CURLCacheBlock) next;
+    char data[];
+} CURLCacheBlock;
+
 typedef struct BDRVCURLState {
     CURLM *multi;
     QEMUTimer timer;
     uint64_t len;
-    CURLState states[CURL_NUM_STATES];
+    CURLState *states;
+    int num_states;
     GHashTable *sockets; /* GINT_TO_POINTER(fd) -> socket */
     char *url;
     size_t readahead_size;
@@ -114,6 +135,16 @@ typedef struct BDRVCURLState {
     char *password;
     char *proxyusername;
     char *proxypassword;
+
+    /* LRU cache of fetched data, NULL if disabled */
+    GHashTable *cache;                  /* &block->index -> block */
+    QTAILQ_HEAD(, CURLCacheBlock) cache_lru;
+    uint64_t cache_size;
+    uint64_t cache_used;
+
+    /* Sequential access detection */
+    uint64_t seq_next;
+    unsigned int seq_count;
 } BDRVCURLState;
 
 static void curl_clean_state(CURLState *s);
@@ -260,6 +291,116 @@ read_end:
     return size * nmemb;
 }
 
+/* Called with s->mutex held.  */
+static void curl_cache_evict(BDRVCURLState *s)
+{
+    CURLCacheBlock *block = QTAILQ_LAST(&s->cache_lru);
+
+    QTAILQ_REMOVE(&s->cache_lru, block, next);
+    s->cache_used -= block->len;
+    g_hash_table_remove(s->cache, &block->index);
+}
+
+/*
+ * Add the blocks that [start, start + len) covers completely to the cache.
+ * Called with s->mutex held.
+ */
+static void curl_cache_insert(BDRVCURLState *s, uint64_t start,
+                              const char *buf, size_t len)
+{
+    uint64_t end = start + len;
+    uint64_t index;
+
+    if (!s->cache) {
+        return;
+    }
+
+    for (index = DIV_ROUND_UP(start, CURL_CACHE_BLOCK_SIZE);
+         index * CURL_CACHE_BLOCK_SIZE < end; index++) {
+        uint64_t block_start = index * CURL_CACHE_BLOCK_SIZE;
+        size_t block_len = MIN(CURL_CACHE_BLOCK_SIZE, s->len - block_start);
+        CURLCacheBlock *block;
+
+        if (block_start + block_len > end) {
+            break;
+        }
+
+        block = g_hash_table_lookup(s->cache, &index);
+        if (block) {
+            QTAILQ_REMOVE(&s->cache_lru, block, next);
+            QTAILQ_INSERT_HEAD(&s->cache_lru, block, next);
+            continue;
+        }
+
+        while (s->cache_used + block_len > s->cache_size) {
+            curl_cache_evict(s);
+        }
+
+        block = g_malloc(sizeof(*block) + block_len);
+        block->index = index;
+        block->len = block_len;
+        memcpy(block->data, buf + (block_start - start), block_len);
+        g_hash_table_insert(s->cache, &block->index, block);
+        QTAILQ_INSERT_HEAD(&s->cache_lru, block, next);
+        s->cache_used += block_len;
+    }
+}
+
+/*
+ * Complete @acb from the cache if every block it needs is there.
+ * Called with s->mutex held.
+ */
+static bool curl_cache_read(BDRVCURLState *s, uint64_t start, uint64_t len,
+                            CURLAIOCB *acb)
+{
+    uint64_t clamped_end = MIN(start + len, s->len);
+    uint64_t first, last, index;
+
+    if (!s->cache || start >= clamped_end) {
+        return false;
+    }
+
+    first = start / CURL_CACHE_BLOCK_SIZE;
+    last = (clamped_end - 1) / CURL_CACHE_BLOCK_SIZE;
+    for (index = first; index <= last; index++) {
+        if (!g_hash_table_contains(s->cache, &index)) {
+            return false;
+        }
+    }
+
+    for (index = first; index <= last; index++) {
+        CURLCacheBlock *block = g_hash_table_lookup(s->cache, &index);
+        uint64_t block_start = index * CURL_CACHE_BLOCK_SIZE;
+        uint64_t from = MAX(start, block_start);
+        uint64_t to = MIN(clamped_end, block_start + block->len);
+
+        qemu_iovec_from_buf(acb->qiov, from - start,
+                            block->data + (from - block_start), to - from);
+        QTAILQ_REMOVE(&s->cache_lru, block, next);
+        QTAILQ_INSERT_HEAD(&s->cache_lru, block, next);
+    }
+    if (clamped_end - start < len) {
+        qemu_iovec_memset(acb->qiov, clamped_end - start, 0,
+                          len - (clamped_end - start));
+    }
+
+    trace_curl_cache_hit(start, len);
+    acb->ret = 0;
+    return true;
+}
+
+static void curl_cache_clear(BDRVCURLState *s)
+{
+    if (!s->cache) {
+        return;
+    }
+
+    g_hash_table_destroy(s->cache);
+    QTAILQ_INIT(&s->cache_lru);
+    s->cache = NULL;
+    s->cache_used = 0;
+}
+
 /* Called with s->mutex held.  */
 static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
                           CURLAIOCB *acb)
@@ -269,7 +410,11 @@ static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
     uint64_t clamped_end = MIN(end, s->len);
     uint64_t clamped_len = clamped_end - start;
 
-    for (i=0; i<CURL_NUM_STATES; i++) {
+    if (curl_cache_read(s, start, len, acb)) {
+        return true;
+    }
+
+    for (i = 0; i < s->num_states; i++) {
         CURLState *state = &s->states[i];
         uint64_t buf_end = (state->buf_start + state->buf_off);
         uint64_t buf_fend = (state->buf_start + state->buf_len);
@@ -342,6 +487,11 @@ static void curl_multi_check_completion(BDRVCURLState *s)
             curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
                               (char **)&state);
 
+            if (!error) {
+                curl_cache_insert(s, state->buf_start, state->orig_buf,
+                                  state->buf_off);
+            }
+
             if (error) {
                 static int errcount = 100;
 
@@ -440,7 +590,7 @@ static CURLState *curl_find_state(BDRVCURLState *s)
     CURLState *state = NULL;
     int i;
 
-    for (i = 0; i < CURL_NUM_STATES; i++) {
+    for (i = 0; i < s->num_states; i++) {
         if (!s->states[i].in_use) {
             state = &s->states[i];
             state->in_use = 1;
@@ -450,6 +600,17 @@ static CURLState *curl_find_state(BDRVCURLState *s)
     return state;
 }
 
+/* Called with s->mutex held.  */
+static int curl_num_free_states(BDRVCURLState *s)
+{
+    int i, n = 0;
+
+    for (i = 0; i < s->num_states; i++) {
+        n += !s->states[i].in_use;
+    }
+    return n;
+}
+
 static int curl_init_state(BDRVCURLState *s, CURLState *state)
 {
     if (!state->curl) {
@@ -476,6 +637,17 @@ static int curl_init_state(BDRVCURLState *s, CURLState *state)
         curl_easy_setopt(state->curl, CURLOPT_ERRORBUFFER, state->errmsg);
         curl_easy_setopt(state->curl, CURLOPT_FAILONERROR, 1);
 
+#if LIBCURL_VERSION_NUM >= 0x072f00
+        /*
+         * Prefer HTTP/2 for https URLs, and wait for an existing connection
+         * rather than open a new one, so that parallel range requests are
+         * multiplexed over as few connections as possible.
+         */
+        curl_easy_setopt(state->curl, CURLOPT_HTTP_VERSION,
+                         (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(state->curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+
         if (s->username) {
             curl_easy_setopt(state->curl, CURLOPT_USERNAME, s->username);
         }
@@ -541,7 +713,7 @@ static void curl_detach_aio_context(BlockDriverState *bs)
 
     WITH_QEMU_LOCK_GUARD(&s->mutex) {
         curl_drop_all_sockets(s->sockets);
-        for (i = 0; i < CURL_NUM_STATES; i++) {
+        for (i = 0; i < s->num_states; i++) {
             if (s->states[i].in_use) {
                 curl_clean_state(&s->states[i]);
             }
@@ -576,6 +748,9 @@ static void curl_attach_aio_context(BlockDriverState *bs,
     curl_multi_setopt(s->multi, CURLMOPT_SOCKETFUNCTION, curl_sock_cb);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERDATA, s);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERFUNCTION, curl_timer_cb);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    curl_multi_setopt(s->multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+#endif
 }
 
 static QemuOptsList runtime_opts = {
@@ -632,6 +807,16 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "ID of secret used as password for HTTP proxy auth",
         },
+        {
+            .name = CURL_BLOCK_OPT_CONNECTIONS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of concurrent transfers"
+        },
+        {
+            .name = CURL_BLOCK_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of the cache of fetched data (0 to disable)"
+        },
         { /* end of list */ }
     },
 };
@@ -687,6 +872,21 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
         goto out_noclean;
     }
 
+    s->num_states = qemu_opt_get_number(opts, CURL_BLOCK_OPT_CONNECTIONS,
+                                        CURL_BLOCK_OPT_CONNECTIONS_DEFAULT);
+    if (s->num_states < 1 || s->num_states > CURL_MAX_CONNECTIONS) {
+        error_setg(errp, "connections must be between 1 and %d",
+                   CURL_MAX_CONNECTIONS);
+        goto out_noclean;
+    }
+
+    s->cache_size = qemu_opt_get_size(opts, CURL_BLOCK_OPT_CACHE_SIZE, 0);
+    if (s->cache_size && s->cache_size < CURL_CACHE_BLOCK_SIZE) {
+        error_setg(errp, "cache-size must be 0 or at least %d",
+                   CURL_CACHE_BLOCK_SIZE);
+        goto out_noclean;
+    }
+
     s->sslverify = qemu_opt_get_bool(opts, CURL_BLOCK_OPT_SSLVERIFY,
                                      CURL_BLOCK_OPT_SSLVERIFY_DEFAULT);
 
@@ -748,6 +948,12 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
     s->aio_context = bdrv_get_aio_context(bs);
     s->url = g_strdup(file);
     s->sockets = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    s->states = g_new0(CURLState, s->num_states);
+    if (s->cache_size) {
+        s->cache = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                         NULL, g_free);
+        QTAILQ_INIT(&s->cache_lru);
+    }
     qemu_mutex_lock(&s->mutex);
     state = curl_find_state(s);
     qemu_mutex_unlock(&s->mutex);
@@ -821,24 +1027,134 @@ out_noclean:
     g_free(s->username);
     g_free(s->proxyusername);
     g_free(s->proxypassword);
-    curl_drop_all_sockets(s->sockets);
-    g_hash_table_destroy(s->sockets);
+    if (s->sockets) {
+        curl_drop_all_sockets(s->sockets);
+        g_hash_table_destroy(s->sockets);
+    }
+    curl_cache_clear(s);
+    g_free(s->states);
     qemu_opts_del(opts);
     return -EINVAL;
 }
 
+/*
+ * Start fetching [start, start + len) into a fresh buffer of @state.
+ * Called with s->mutex held.
+ */
+static int curl_start_transfer(BDRVCURLState *s, CURLState *state,
+                               uint64_t start, uint64_t len)
+{
+    int running;
+
+    state->buf_off = 0;
+    g_free(state->orig_buf);
+    state->buf_start = start;
+    state->buf_len = len;
+    state->orig_buf = g_try_malloc(state->buf_len);
+    if (state->buf_len && state->orig_buf == NULL) {
+        return -ENOMEM;
+    }
+
+    snprintf(state->range, 127, "%" PRIu64 "-%" PRIu64,
+             start, start + len - 1);
+    curl_easy_setopt(state->curl, CURLOPT_RANGE, state->range);
+
+    if (curl_multi_add_handle(s->multi, state->curl) != CURLM_OK) {
+        return -EIO;
+    }
+
+    /* Tell curl it needs to kick things off */
+    curl_multi_socket_action(s->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    return 0;
+}
+
+/*
+ * Return the end of the data at @pos that is cached or being fetched,
+ * or @pos if there is none.  Called with s->mutex held.
+ */
+static uint64_t curl_covered_until(BDRVCURLState *s, uint64_t pos)
+{
+    uint64_t index = pos / CURL_CACHE_BLOCK_SIZE;
+    CURLCacheBlock *block;
+    int i;
+
+    for (i = 0; i < s->num_states; i++) {
+        CURLState *state = &s->states[i];
+        uint64_t buf_end = state->buf_start +
+                           (state->in_use ? state->buf_len : state->buf_off);
+
+        if (state->orig_buf && pos >= state->buf_start && pos < buf_end) {
+            return buf_end;
+        }
+    }
+
+    block = s->cache ? g_hash_table_lookup(s->cache, &index) : NULL;
+    if (block) {
+        return index * CURL_CACHE_BLOCK_SIZE + block->len;
+    }
+
+    return pos;
+}
+
+/*
+ * Keep CURL_PREFETCH_WINDOWS readahead windows past the last sequential
+ * read in flight.  Prefetching never waits for a connection and always
+ * leaves one free for demand reads.  Called with s->mutex held.
+ */
+static void curl_prefetch(BDRVCURLState *s)
+{
+    uint64_t window = MAX(s->readahead_size, CURL_CACHE_BLOCK_SIZE);
+    uint64_t limit = MIN(s->len, s->seq_next + CURL_PREFETCH_WINDOWS * window);
+    uint64_t pos = s->seq_next;
+
+    while (pos < limit) {
+        uint64_t covered = curl_covered_until(s, pos);
+        CURLState *state;
+        uint64_t len;
+
+        if (covered > pos) {
+            pos = covered;
+            continue;
+        }
+
+        if (curl_num_free_states(s) < 2) {
+            return;
+        }
+
+        state = curl_find_state(s);
+        if (curl_init_state(s, state) < 0) {
+            curl_clean_state(state);
+            return;
+        }
+
+        len = MIN(window, s->len - pos);
+        trace_curl_prefetch(pos, len);
+        if (curl_start_transfer(s, state, pos, len) < 0) {
+            curl_clean_state(state);
+            return;
+        }
+        pos += len;
+    }
+}
+
 static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
 {
     CURLState *state;
-    int running;
+    int ret;
 
     BDRVCURLState *s = bs->opaque;
 
     uint64_t start = acb->offset;
-    uint64_t end;
 
     qemu_mutex_lock(&s->mutex);
 
+    if (start == s->seq_next) {
+        s->seq_count = MIN(s->seq_count + 1, CURL_SEQ_THRESHOLD);
+    } else {
+        s->seq_count = 0;
+    }
+    s->seq_next = start + acb->bytes;
+
     // In case we have the requested data already (e.g. read-ahead),
     // we can just call the callback and be done.
     if (curl_find_buf(s, start, acb->bytes, acb)) {
@@ -863,35 +1179,23 @@ static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
     acb->start = 0;
     acb->end = MIN(acb->bytes, s->len - start);
 
-    state->buf_off = 0;
-    g_free(state->orig_buf);
-    state->buf_start = start;
-    state->buf_len = MIN(acb->end + s->readahead_size, s->len - start);
-    end = start + state->buf_len - 1;
-    state->orig_buf = g_try_malloc(state->buf_len);
-    if (state->buf_len && state->orig_buf == NULL) {
-        curl_clean_state(state);
-        acb->ret = -ENOMEM;
-        goto out;
-    }
     state->acb[0] = acb;
-
-    snprintf(state->range, 127, "%" PRIu64 "-%" PRIu64, start, end);
+    ret = curl_start_transfer(s, state, start,
+                              MIN(acb->end + s->readahead_size,
+                                  s->len - start));
     trace_curl_setup_preadv(acb->bytes, start, state->range);
-    curl_easy_setopt(state->curl, CURLOPT_RANGE, state->range);
-
-    if (curl_multi_add_handle(s->multi, state->curl) != CURLM_OK) {
+    if (ret < 0) {
         state->acb[0] = NULL;
-        acb->ret = -EIO;
+        acb->ret = ret;
 
         curl_clean_state(state);
         goto out;
     }
 
-    /* Tell curl it needs to kick things off */
-    curl_multi_socket_action(s->multi, CURL_SOCKET_TIMEOUT, 0, &running);
-
 out:
+    if (s->seq_count >= CURL_SEQ_THRESHOLD) {
+        curl_prefetch(s);
+    }
     qemu_mutex_unlock(&s->mutex);
 }
 
@@ -921,6 +1225,8 @@ static void curl_close(BlockDriverState *bs)
     curl_detach_aio_context(bs);
     qemu_mutex_destroy(&s->mutex);
 
+    curl_cache_clear(s);
+    g_free(s->states);
     g_hash_table_destroy(s->sockets);
     g_free(s->cookie);
     g_free(s->url);
@@ -939,8 +1245,10 @@ static void curl_refresh_filename(BlockDriverState *bs)
 {
     BDRVCURLState *s = bs->opaque;
 
-    /* "readahead" and "timeout" do not change the guest-visible data,
-     * so ignore them */
+    /*
+     * "readahead", "timeout", "connections" and "cache-size" do not
+     * change the guest-visible data, so ignore them
+     */
     if (s->sslverify != CURL_BLOCK_OPT_SSLVERIFY_DEFAULT ||
         s->cookie || s->username || s->password || s->proxyusername ||
         s->proxypassword)
@@ -27,6 +27,7 @@
 #include "block/block_int.h"
 #include "block/blockjob.h"
 #include "qemu/main-loop.h"
+#include "qemu/processor.h"
 
 struct BdrvDirtyBitmap {
     BlockDriverState *bs;
@@ -62,10 +63,22 @@ struct BdrvDirtyBitmapIter {
 static inline void bdrv_dirty_bitmaps_lock(BlockDriverState *bs)
 {
     qemu_mutex_lock(&bs->dirty_bitmap_mutex);
+
+    /*
+     * Wait for bdrv_set_dirty() callers that went lock-free.  New ones see
+     * dirty_bitmap_locked and fall back to the mutex; this pairs with the
+     * implicit barrier of qatomic_inc() in bdrv_set_dirty().
+     */
+    qatomic_set(&bs->dirty_bitmap_locked, true);
+    smp_mb(); /* order the store above before reading the setter count */
+    while (qatomic_read(&bs->dirty_bitmap_setters)) {
+        cpu_relax();
+    }
 }
 
 static inline void bdrv_dirty_bitmaps_unlock(BlockDriverState *bs)
 {
+    qatomic_store_release(&bs->dirty_bitmap_locked, false);
     qemu_mutex_unlock(&bs->dirty_bitmap_mutex);
 }
 
@@ -742,6 +755,28 @@ void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes)
         return;
     }
 
+#ifdef CONFIG_ATOMIC64
+    /*
+     * Guest writes only race with each other here, and setting bits is
+     * safe to do concurrently with hbitmap_set_atomic().  Anything else
+     * that touches the bitmaps (or the list) holds dirty_bitmap_mutex and
+     * waits for us in bdrv_dirty_bitmaps_lock().
+     */
+    qatomic_inc(&bs->dirty_bitmap_setters);
+    if (!qatomic_load_acquire(&bs->dirty_bitmap_locked)) {
+        QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+            if (!bdrv_dirty_bitmap_enabled(bitmap)) {
+                continue;
+            }
+            assert(!bdrv_dirty_bitmap_readonly(bitmap));
+            hbitmap_set_atomic(bitmap->bitmap, offset, bytes);
+        }
+        qatomic_dec(&bs->dirty_bitmap_setters);
+        return;
+    }
+    qatomic_dec(&bs->dirty_bitmap_setters);
+#endif
+
     bdrv_dirty_bitmaps_lock(bs);
     QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
         if (!bdrv_dirty_bitmap_enabled(bitmap)) {
@@ -24,9 +24,11 @@
 #include "block/export.h"
 #include "block/fuse.h"
 #include "block/qapi.h"
+#include "block/thread-pool.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 
 #include <fuse.h>
 #include <fuse_lowlevel.h>
@@ -36,23 +38,53 @@
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
 
-typedef struct FuseExport {
+typedef struct FuseExport FuseExport;
+
+/*
+ * An AioContext that reads requests from the FUSE session and handles
+ * them.  Several of them read from the same session fd, and the kernel
+ * hands each request to one of them.
+ */
+typedef struct FuseQueue {
+    FuseExport *exp;
+    AioContext *ctx;
+
+    /*
+     * Receive buffer.  Its memory is handed over to the request coroutine,
+     * so the next request is received into a new one.
+     */
+    struct fuse_buf fuse_buf;
+} FuseQueue;
+
+struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
     bool mounted, fd_handler_set_up;
 
+    /*
+     * One queue per IOThread in request-iothreads, or a single one in the
+     * export's AioContext
+     */
+    FuseQueue *queues;
+    size_t num_queues;
+    IOThread **iothreads;
+    size_t num_iothreads;
+
+    /* Reply to reads by splicing from the image file where possible */
+    bool splice_read;
+
     char *mountpoint;
     bool writable;
     bool growable;
     /* Whether allow_other was used as a mount option or not */
     bool allow_other;
 
+    /* Only accessed in the export's AioContext, see fuse_co_enter_export() */
     mode_t st_mode;
     uid_t st_uid;
     gid_t st_gid;
-} FuseExport;
+};
 
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
@@ -68,6 +100,8 @@ static void read_from_fuse_export(void *opaque);
 
 static bool is_regular_file(const char *path, Error **errp);
 
+static const BlockDevOps fuse_block_ops;
+
 
 static int fuse_export_create(BlockExport *blk_exp,
                               BlockExportOptions *blk_exp_args,
@@ -75,6 +109,7 @@ static int fuse_export_create(BlockExport *blk_exp,
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
     BlockExportOptionsFuse *args = &blk_exp_args->u.fuse;
+    size_t i;
     int ret;
 
     assert(blk_exp_args->type == BLOCK_EXPORT_TYPE_FUSE);
@@ -120,9 +155,31 @@ static int fuse_export_create(BlockExport *blk_exp,
         goto fail;
     }
 
+    if (!iothread_ref_list(args->request_iothreads, &exp->iothreads,
+                           &exp->num_iothreads, errp)) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    exp->num_queues = MAX(exp->num_iothreads, 1);
+    exp->queues = g_new0(FuseQueue, exp->num_queues);
+    for (i = 0; i < exp->num_queues; i++) {
+        exp->queues[i] = (FuseQueue) {
+            .exp = exp,
+            .ctx = exp->num_iothreads ?
+                   iothread_get_aio_context(exp->iothreads[i]) :
+                   exp->common.ctx,
+        };
+    }
+    if (exp->num_iothreads) {
+        blk_set_multi_context(exp->common.blk, true);
+        blk_set_dev_ops(exp->common.blk, &fuse_block_ops, exp);
+    }
+
     exp->mountpoint = g_strdup(args->mountpoint);
     exp->writable = blk_exp_args->writable;
     exp->growable = args->growable;
+    exp->splice_read = args->splice_read;
 
     /* set default */
     if (!args->has_allow_other) {
@@ -179,6 +236,7 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
     const char *fuse_argv[4];
     char *mount_opts;
     struct fuse_args fuse_args;
+    size_t i;
     int ret;
 
     /*
@@ -214,9 +272,15 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
 
     g_hash_table_insert(exports, g_strdup(mountpoint), NULL);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session), true,
-                       read_from_fuse_export, NULL, NULL, exp);
+    /* Several queues may read from the fd, so only one of them gets data */
+    qemu_set_nonblock(fuse_session_fd(exp->fuse_session));
+
+    for (i = 0; i < exp->num_queues; i++) {
+        aio_set_fd_handler(exp->queues[i].ctx,
+                           fuse_session_fd(exp->fuse_session), true,
+                           read_from_fuse_export, NULL, NULL,
+                           &exp->queues[i]);
+    }
     exp->fd_handler_set_up = true;
 
     return 0;
@@ -226,30 +290,103 @@ fail:
     return ret;
 }
 
+/**
+ * Handle the request that has just been received on @opaque (a FuseQueue).
+ * The handlers may yield, so the request coroutine takes over the receive
+ * buffer.
+ */
+static void coroutine_fn fuse_co_process_request(void *opaque)
+{
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
+    struct fuse_buf buf = q->fuse_buf;
+
+    q->fuse_buf.mem = NULL;
+
+    fuse_session_process_buf(exp->fuse_session, &buf);
+
+    free(buf.mem);
+    blk_exp_unref(&exp->common);
+}
+
 /**
  * Callback to be invoked when the FUSE session FD can be read from.
  * (This is basically the FUSE event loop.)
  */
 static void read_from_fuse_export(void *opaque)
 {
-    FuseExport *exp = opaque;
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
+    Coroutine *co;
     int ret;
 
     blk_exp_ref(&exp->common);
 
     do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
+        ret = fuse_session_receive_buf(exp->fuse_session, &q->fuse_buf);
     } while (ret == -EINTR);
     if (ret < 0) {
-        goto out;
+        /* -EAGAIN if another queue took the request */
+        blk_exp_unref(&exp->common);
+        return;
     }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
+    /* The coroutine drops the reference */
+    co = qemu_coroutine_create(fuse_co_process_request, q);
+    qemu_coroutine_enter(co);
+}
 
-out:
-    blk_exp_unref(&exp->common);
+/**
+ * Continue handling the current request in the export's AioContext.  This
+ * is where requests that change the export itself (its attributes, the size
+ * or the permissions of its node) run, so that they are serialized.
+ */
+static void coroutine_fn fuse_co_enter_export(FuseExport *exp)
+{
+    aio_co_reschedule_self(blk_get_aio_context(exp->common.blk));
+}
+
+/**
+ * Prepare for submitting I/O requests to the export's node: requests can
+ * be submitted from the AioContext of the queue only while all nodes below
+ * the export support that.
+ */
+static void coroutine_fn fuse_co_enter_io(FuseExport *exp)
+{
+    if (!blk_multi_context_active(exp->common.blk)) {
+        fuse_co_enter_export(exp);
+    }
+}
+
+/*
+ * The drained section of the export's node only disables the external
+ * handlers of its own AioContext, so do the same for the queue IOThreads.
+ */
+static void fuse_drained_begin(void *opaque)
+{
+    FuseExport *exp = opaque;
+    size_t i;
+
+    for (i = 0; i < exp->num_iothreads; i++) {
+        aio_disable_external(iothread_get_aio_context(exp->iothreads[i]));
+    }
+}
+
+static void fuse_drained_end(void *opaque)
+{
+    FuseExport *exp = opaque;
+    size_t i;
+
+    for (i = 0; i < exp->num_iothreads; i++) {
+        aio_enable_external(iothread_get_aio_context(exp->iothreads[i]));
+    }
 }
 
+static const BlockDevOps fuse_block_ops = {
+    .drained_begin = fuse_drained_begin,
+    .drained_end   = fuse_drained_end,
+};
+
 static void fuse_export_shutdown(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
@@ -258,9 +395,13 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
         fuse_session_exit(exp->fuse_session);
 
         if (exp->fd_handler_set_up) {
-            aio_set_fd_handler(exp->common.ctx,
-                               fuse_session_fd(exp->fuse_session), true,
-                               NULL, NULL, NULL, NULL);
+            size_t i;
+
+            for (i = 0; i < exp->num_queues; i++) {
+                aio_set_fd_handler(exp->queues[i].ctx,
+                                   fuse_session_fd(exp->fuse_session), true,
+                                   NULL, NULL, NULL, NULL);
+            }
             exp->fd_handler_set_up = false;
         }
     }
@@ -277,6 +418,7 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
 static void fuse_export_delete(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    size_t i;
 
     if (exp->fuse_session) {
         if (exp->mounted) {
@@ -286,7 +428,17 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    for (i = 0; i < exp->num_queues; i++) {
+        free(exp->queues[i].fuse_buf.mem);
+    }
+    g_free(exp->queues);
+
+    if (exp->num_iothreads) {
+        blk_set_dev_ops(exp->common.blk, NULL, NULL);
+        blk_set_multi_context(exp->common.blk, false);
+    }
+    iothread_unref_list(exp->iothreads, exp->num_iothreads);
+
     g_free(exp->mountpoint);
 }
 
@@ -318,6 +470,8 @@ static bool is_regular_file(const char *path, Error **errp)
  */
 static void fuse_init(void *userdata, struct fuse_conn_info *conn)
 {
+    FuseExport *exp = userdata;
+
     /*
      * MIN_NON_ZERO() would not be wrong here, but what we set here
      * must equal what has been passed to fuse_session_new().
@@ -328,6 +482,13 @@ static void fuse_init(void *userdata, struct fuse_conn_info *conn)
     conn->max_read = FUSE_MAX_BOUNCE_BYTES;
 
     conn->max_write = MIN_NON_ZERO(BDRV_REQUEST_MAX_BYTES, conn->max_write);
+
+    if (exp->splice_read && (conn->capable & FUSE_CAP_SPLICE_WRITE)) {
+        conn->want |= FUSE_CAP_SPLICE_WRITE;
+        if (conn->capable & FUSE_CAP_SPLICE_MOVE) {
+            conn->want |= FUSE_CAP_SPLICE_MOVE;
+        }
+    }
 }
 
 /**
@@ -350,6 +511,8 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
     time_t now = time(NULL);
     FuseExport *exp = fuse_req_userdata(req);
 
+    fuse_co_enter_export(exp);
+
     length = blk_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
@@ -428,6 +591,8 @@ static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
     int supported_attrs;
     int ret;
 
+    fuse_co_enter_export(exp);
+
     supported_attrs = FUSE_SET_ATTR_SIZE | FUSE_SET_ATTR_MODE;
     if (exp->allow_other) {
         supported_attrs |= FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID;
@@ -498,6 +663,75 @@ static void fuse_open(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_open(req, fi);
 }
 
+typedef struct FuseSpliceRead {
+    fuse_req_t req;
+    int fd;
+    int64_t offset;
+    size_t size;
+} FuseSpliceRead;
+
+static int fuse_splice_read_worker(void *opaque)
+{
+    FuseSpliceRead *sr = opaque;
+    struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(sr->size);
+
+    bufv.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    bufv.buf[0].fd = sr->fd;
+    bufv.buf[0].pos = sr->offset;
+
+    /* Falls back to reading into a buffer if the fd cannot be spliced */
+    return fuse_reply_data(sr->req, &bufv, FUSE_BUF_SPLICE_MOVE);
+}
+
+/**
+ * Try to reply to a read by splicing the data from the file that stores it
+ * into the FUSE device, which saves copying it into and out of a bounce
+ * buffer.  This is possible if the whole range is stored contiguously and
+ * in plain text in a file that file-posix accesses through the page cache.
+ *
+ * Returns true if the request has been replied to.
+ */
+static bool coroutine_fn fuse_co_splice_read(FuseExport *exp, fuse_req_t req,
+                                             size_t size, off_t offset)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    BlockDriverState *file;
+    FuseSpliceRead sr;
+    int64_t pnum, map;
+    int ret;
+
+    /* Keep the mapping and the fd valid until the data is in the device */
+    blk_co_start_request(exp->common.blk);
+
+    ret = bdrv_block_status_above(blk_bs(exp->common.blk), NULL, offset, size,
+                                  &pnum, &map, &file);
+    if (ret < 0 || pnum < size ||
+        (ret & (BDRV_BLOCK_DATA | BDRV_BLOCK_ZERO | BDRV_BLOCK_OFFSET_VALID))
+        != (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID))
+    {
+        blk_dec_in_flight(exp->common.blk);
+        return false;
+    }
+
+    sr = (FuseSpliceRead) {
+        .req    = req,
+        .fd     = bdrv_get_host_fd(file),
+        .offset = map,
+        .size   = size,
+    };
+    if (sr.fd < 0) {
+        blk_dec_in_flight(exp->common.blk);
+        return false;
+    }
+
+    /* The splice may have to wait for the disk */
+    thread_pool_submit_co(aio_get_thread_pool(ctx), fuse_splice_read_worker,
+                          &sr);
+
+    blk_dec_in_flight(exp->common.blk);
+    return true;
+}
+
 /**
  * Handle client reads from the exported image.
  */
@@ -515,6 +749,8 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
         return;
     }
 
+    fuse_co_enter_io(exp);
+
     /**
      * Clients will expect short reads at EOF, so we have to limit
      * offset+size to the image length.
@@ -529,13 +765,19 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
         size = length - offset;
     }
 
+    if (exp->splice_read && size &&
+        fuse_co_splice_read(exp, req, size, offset))
+    {
+        return;
+    }
+
     buf = qemu_try_blockalign(blk_bs(exp->common.blk), size);
     if (!buf) {
         fuse_reply_err(req, ENOMEM);
         return;
     }
 
-    ret = blk_pread(exp->common.blk, offset, buf, size);
+    ret = blk_co_pread(exp->common.blk, offset, size, buf, 0);
     if (ret >= 0) {
         fuse_reply_buf(req, buf, size);
     } else {
@@ -578,6 +820,7 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
 
     if (offset + size > length) {
         if (exp->growable) {
+            fuse_co_enter_export(exp);
             ret = fuse_do_truncate(exp, offset + size, true, PREALLOC_MODE_OFF);
             if (ret < 0) {
                 fuse_reply_err(req, -ret);
@@ -588,7 +831,8 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
         }
     }
 
-    ret = blk_pwrite(exp->common.blk, offset, buf, size, 0);
+    fuse_co_enter_io(exp);
+    ret = blk_co_pwrite(exp->common.blk, offset, size, (void *)buf, 0);
     if (ret >= 0) {
         fuse_reply_write(req, size);
     } else {
@@ -612,6 +856,9 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         return;
     }
 
+    /* May resize the node */
+    fuse_co_enter_export(exp);
+
     blk_len = blk_getlength(exp->common.blk);
     if (blk_len < 0) {
         fuse_reply_err(req, -blk_len);
@@ -692,7 +939,8 @@ static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
     FuseExport *exp = fuse_req_userdata(req);
     int ret;
 
-    ret = blk_flush(exp->common.blk);
+    fuse_co_enter_io(exp);
+    ret = blk_co_flush(exp->common.blk);
     fuse_reply_err(req, ret < 0 ? -ret : 0);
 }
 
@@ -720,6 +968,8 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
         return;
     }
 
+    fuse_co_enter_io(exp);
+
     while (true) {
         int64_t pnum;
         int ret;
@@ -780,6 +1030,10 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
 }
 #endif
 
+/*
+ * All of these run in a request coroutine, see fuse_co_process_request(),
+ * which starts in the AioContext of the queue that received the request.
+ */
 static const struct fuse_lowlevel_ops fuse_ops = {
     .init       = fuse_init,
     .lookup     = fuse_lookup,
@@ -162,8 +162,16 @@ typedef struct BDRVRawState {
     bool discard_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+    bool use_linux_io_uring_iopoll:1;
+#ifdef CONFIG_LINUX_IO_URING
+    /* io_uring of the node's AioContext, where fd is a fixed file */
+    LuringState *luring_fixed_ring;
+    int luring_fixed_file;
+#endif
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
+    /* Cleared from the thread pool if the filesystem can't share extents */
+    bool has_clone_range;
     bool needs_alignment;
     bool drop_cache;
     bool check_cache_dropped;
@@ -193,6 +201,39 @@ static int fd_open(BlockDriverState *bs)
     return -EIO;
 }
 
+/*
+ * Register s->fd as a fixed file with the io_uring of the node's
+ * AioContext (this does nothing unless the ring was set up with fixed
+ * files), and drop the registration again.  The fd must be unregistered
+ * before it is closed or the node moves to another AioContext.
+ */
+static void raw_luring_register_fd(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    assert(!s->luring_fixed_ring);
+    if (s->use_linux_io_uring && s->fd >= 0) {
+        s->luring_fixed_ring = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        s->luring_fixed_file = luring_register_file(s->luring_fixed_ring,
+                                                    s->fd);
+    }
+#endif
+}
+
+static void raw_luring_unregister_fd(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->luring_fixed_ring) {
+        luring_unregister_file(s->luring_fixed_ring, s->luring_fixed_file);
+        s->luring_fixed_ring = NULL;
+        s->luring_fixed_file = -1;
+    }
+#endif
+}
+
 static int64_t raw_getlength(BlockDriverState *bs);
 
 typedef struct RawPosixAIOData {
@@ -530,6 +571,13 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "host AIO implementation (threads, native, io_uring)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "aio-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll for io_uring completions (default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -607,6 +655,13 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->use_linux_io_uring_iopoll = qemu_opt_get_bool(opts, "aio-iopoll",
+                                                     false);
+    if (s->use_linux_io_uring_iopoll && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-iopoll requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
 #endif
 
     locking = qapi_enum_parse(&OnOffAuto_lookup,
@@ -708,6 +763,20 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
             goto fail;
         }
     }
+    if (s->use_linux_io_uring_iopoll) {
+        /* Polled completions only work for O_DIRECT reads and writes */
+        if (!(s->open_flags & O_DIRECT)) {
+            error_setg(errp, "aio-iopoll requires cache.direct=on");
+            ret = -EINVAL;
+            goto fail;
+        }
+        if (!aio_setup_linux_io_uring_iopoll(bdrv_get_aio_context(bs),
+                                             errp)) {
+            error_prepend(errp, "Unable to use io_uring with polled "
+                          "completions: ");
+            goto fail;
+        }
+    }
 #else
     if (s->use_linux_io_uring) {
         error_setg(errp, "aio=io_uring was specified, but is not supported "
@@ -719,6 +788,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->has_discard = true;
     s->has_write_zeroes = true;
+    s->has_clone_range = true;
     if ((bs->open_flags & BDRV_O_NOCACHE) != 0 && !dio_byte_aligned(s->fd)) {
         s->needs_alignment = true;
     }
@@ -790,6 +860,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+    raw_luring_register_fd(bs);
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -1547,7 +1618,7 @@ static int handle_aiocb_rw(void *opaque)
      * Ok, we have to do it the hard way, copy all segments into
      * a single aligned buffer.
      */
-    buf = qemu_try_blockalign(aiocb->bs, aiocb->aio_nbytes);
+    buf = qemu_try_bounce_buf(aiocb->bs, aiocb->aio_nbytes);
     if (buf == NULL) {
         nbytes = -ENOMEM;
         goto out;
@@ -1582,7 +1653,7 @@ static int handle_aiocb_rw(void *opaque)
         }
         assert(count == 0);
     }
-    qemu_vfree(buf);
+    qemu_bounce_buf_free(aiocb->bs, buf, aiocb->aio_nbytes);
 
 out:
     if (nbytes == aiocb->aio_nbytes) {
@@ -1770,6 +1841,52 @@ static off_t copy_file_range(int in_fd, off_t *in_off, int out_fd,
 }
 #endif
 
+/*
+ * Make the target share the source's extents (a reflink) instead of
+ * copying the data, e.g. on XFS and btrfs.  Returns -ENOTSUP if this
+ * request can't be served like that.
+ */
+static int raw_clone_range(RawPosixAIOData *aiocb)
+{
+#ifdef FICLONERANGE
+    BDRVRawState *s = aiocb->bs->opaque;
+    struct file_clone_range range = {
+        .src_fd         = aiocb->aio_fildes,
+        .src_offset     = aiocb->aio_offset,
+        .src_length     = aiocb->aio_nbytes,
+        .dest_offset    = aiocb->copy_range.aio_offset2,
+    };
+    int ret;
+
+    if (!qatomic_read(&s->has_clone_range)) {
+        return -ENOTSUP;
+    }
+
+    ret = ioctl(aiocb->copy_range.aio_fd2, FICLONERANGE, &range);
+    trace_file_clone_range(aiocb->bs, aiocb->aio_fildes, aiocb->aio_offset,
+                           aiocb->copy_range.aio_fd2,
+                           aiocb->copy_range.aio_offset2, aiocb->aio_nbytes,
+                           ret < 0 ? -errno : 0);
+    if (ret == 0) {
+        return 0;
+    }
+    switch (errno) {
+    case ENOTSUP:
+    case ENOTTY:
+        /* The filesystem can't do this at all */
+        qatomic_set(&s->has_clone_range, false);
+        break;
+    default:
+        /*
+         * Different filesystems, or a range that is not aligned to the
+         * filesystem block size: copying may still work.
+         */
+        break;
+    }
+#endif
+    return -ENOTSUP;
+}
+
 static int handle_aiocb_copy_range(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -1777,6 +1894,10 @@ static int handle_aiocb_copy_range(void *opaque)
     off_t in_off = aiocb->aio_offset;
     off_t out_off = aiocb->copy_range.aio_offset2;
 
+    if (raw_clone_range(aiocb) == 0) {
+        return 0;
+    }
+
     while (bytes) {
         ssize_t ret = copy_file_range(aiocb->aio_fildes, &in_off,
                                       aiocb->copy_range.aio_fd2, &out_off,
@@ -2022,14 +2143,47 @@ out:
     return result;
 }
 
+/*
+ * The requests are submitted to the AIO engines of the AioContext the
+ * coroutine runs in.  That is the AioContext of @bs, except for
+ * multi-context BlockBackends, whose requests run where they come from.
+ */
 static int coroutine_fn raw_thread_pool_submit(BlockDriverState *bs,
                                                ThreadPoolFunc func, void *arg)
 {
-    /* @bs can be NULL, bdrv_get_aio_context() returns the main context then */
-    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    ThreadPool *pool = aio_get_thread_pool(qemu_get_current_aio_context());
     return thread_pool_submit_co(pool, func, arg);
 }
 
+#ifdef CONFIG_LINUX_AIO
+/* Returns NULL if the AioContext can't get a native AIO context */
+static LinuxAioState *raw_get_linux_aio(void)
+{
+    return aio_setup_linux_aio(qemu_get_current_aio_context(), NULL);
+}
+#endif
+
+#ifdef CONFIG_LINUX_IO_URING
+/* Returns NULL if the AioContext can't get an io_uring */
+static LuringState *raw_get_linux_io_uring(void)
+{
+    return aio_setup_linux_io_uring(qemu_get_current_aio_context(), NULL);
+}
+
+/* Returns NULL if the AioContext can't get an io_uring with IOPOLL */
+static LuringState *raw_get_linux_io_uring_iopoll(void)
+{
+    return aio_setup_linux_io_uring_iopoll(qemu_get_current_aio_context(),
+                                           NULL);
+}
+
+/* Slot of s->fd in the fixed file table of @aio, or -1 */
+static int raw_luring_fixed_file(BDRVRawState *s, LuringState *aio)
+{
+    return aio == s->luring_fixed_ring ? s->luring_fixed_file : -1;
+}
+#endif
+
 static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
                                    uint64_t bytes, QEMUIOVector *qiov, int type)
 {
@@ -2047,17 +2201,36 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
      */
     if (s->needs_alignment && !bdrv_qiov_is_aligned(bs, qiov)) {
         type |= QEMU_AIO_MISALIGNED;
+    } else {
 #ifdef CONFIG_LINUX_IO_URING
-    } else if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        assert(qiov->size == bytes);
-        return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
+        if (s->use_linux_io_uring) {
+            LuringState *aio = NULL;
+
+            /* Without O_DIRECT (e.g. after a reopen), use the normal ring */
+            if (s->use_linux_io_uring_iopoll && (s->open_flags & O_DIRECT)) {
+                aio = raw_get_linux_io_uring_iopoll();
+            }
+            if (!aio) {
+                aio = raw_get_linux_io_uring();
+            }
+
+            if (aio) {
+                assert(qiov->size == bytes);
+                return luring_co_submit(bs, aio, s->fd,
+                                        raw_luring_fixed_file(s, aio),
+                                        offset, qiov, type);
+            }
+        }
 #endif
 #ifdef CONFIG_LINUX_AIO
-    } else if (s->use_linux_aio) {
-        LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
-        assert(qiov->size == bytes);
-        return laio_co_submit(bs, aio, s->fd, offset, qiov, type);
+        if (s->use_linux_aio) {
+            LinuxAioState *aio = raw_get_linux_aio();
+
+            if (aio) {
+                assert(qiov->size == bytes);
+                return laio_co_submit(bs, aio, s->fd, offset, qiov, type);
+            }
+        }
 #endif
     }
 
@@ -2145,8 +2318,12 @@ static int raw_co_flush_to_disk(BlockDriverState *bs)
 
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        LuringState *aio = raw_get_linux_io_uring();
+        if (aio) {
+            return luring_co_submit(bs, aio, s->fd,
+                                    raw_luring_fixed_file(s, aio),
+                                    0, NULL, QEMU_AIO_FLUSH);
+        }
     }
 #endif
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
@@ -2173,15 +2350,32 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
             error_reportf_err(local_err, "Unable to use linux io_uring, "
                                          "falling back to thread pool: ");
             s->use_linux_io_uring = false;
+            s->use_linux_io_uring_iopoll = false;
+        }
+    }
+    if (s->use_linux_io_uring_iopoll) {
+        Error *local_err = NULL;
+        if (!aio_setup_linux_io_uring_iopoll(new_context, &local_err)) {
+            error_reportf_err(local_err, "Unable to poll for io_uring "
+                                         "completions, falling back to "
+                                         "interrupts: ");
+            s->use_linux_io_uring_iopoll = false;
         }
     }
 #endif
+    raw_luring_register_fd(bs);
+}
+
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+    raw_luring_unregister_fd(bs);
 }
 
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+    raw_luring_unregister_fd(bs);
     if (s->fd >= 0) {
         qemu_close(s->fd);
         s->fd = -1;
@@ -2435,6 +2629,17 @@ static int64_t raw_get_allocated_file_size(BlockDriverState *bs)
     return (int64_t)st.st_blocks * 512;
 }
 
+static int raw_get_host_fd(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    /* Reading around O_DIRECT through the page cache is not coherent */
+    if (s->open_flags & O_DIRECT) {
+        return -ENOTSUP;
+    }
+    return s->fd;
+}
+
 static int coroutine_fn
 raw_co_create(BlockdevCreateOptions *options, Error **errp)
 {
@@ -3176,9 +3381,11 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+        raw_luring_unregister_fd(bs);
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
+        raw_luring_register_fd(bs);
     }
     s->perm_change_fd = 0;
 
@@ -3253,6 +3460,7 @@ BlockDriver bdrv_file = {
     .protocol_name = "file",
     .instance_size = sizeof(BDRVRawState),
     .bdrv_needs_filename = true,
+    .supports_multi_context = true,
     .bdrv_probe = NULL, /* no probe for protocols */
     .bdrv_parse_filename = raw_parse_filename,
     .bdrv_file_open = raw_open,
@@ -3278,12 +3486,14 @@ BlockDriver bdrv_file = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate = raw_co_truncate,
     .bdrv_getlength = raw_getlength,
     .bdrv_get_info = raw_get_info,
     .bdrv_get_allocated_file_size
                         = raw_get_allocated_file_size,
+    .bdrv_get_host_fd   = raw_get_host_fd,
     .bdrv_get_specific_stats = raw_get_specific_stats,
     .bdrv_check_perm = raw_check_perm,
     .bdrv_set_perm   = raw_set_perm,
@@ -3621,6 +3831,7 @@ static BlockDriver bdrv_host_device = {
     .protocol_name        = "host_device",
     .instance_size      = sizeof(BDRVRawState),
     .bdrv_needs_filename = true,
+    .supports_multi_context = true,
     .bdrv_probe_device  = hdev_probe_device,
     .bdrv_parse_filename = hdev_parse_filename,
     .bdrv_file_open     = hdev_open,
@@ -3644,12 +3855,14 @@ static BlockDriver bdrv_host_device = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate       = raw_co_truncate,
     .bdrv_getlength	= raw_getlength,
     .bdrv_get_info = raw_get_info,
     .bdrv_get_allocated_file_size
                         = raw_get_allocated_file_size,
+    .bdrv_get_host_fd   = raw_get_host_fd,
     .bdrv_get_specific_stats = hdev_get_specific_stats,
     .bdrv_check_perm = raw_check_perm,
     .bdrv_set_perm   = raw_set_perm,
@@ -3768,6 +3981,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -3898,6 +4112,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -36,10 +36,14 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "sysemu/replay.h"
+#include "qemu/bounce-pool.h"
 
 /* Maximum bounce buffer for copy-on-read and write zeroes, in bytes */
 #define MAX_BOUNCE_BUFFER (32768 << BDRV_SECTOR_BITS)
 
+/* Smallest zero range that detect-zeroes splits out of a write */
+#define DETECT_ZEROES_MIN_GRANULARITY 4096
+
 static void bdrv_parent_cb_resize(BlockDriverState *bs);
 static int coroutine_fn bdrv_co_do_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int64_t bytes, BdrvRequestFlags flags);
@@ -173,6 +177,7 @@ void bdrv_refresh_limits(BlockDriverState *bs, Transaction *tran, Error **errp)
     }
 
     memset(&bs->bl, 0, sizeof(bs->bl));
+    bdrv_block_status_cache_invalidate(bs);
 
     if (!drv) {
         return;
@@ -739,10 +744,22 @@ static void tracked_request_end(BdrvTrackedRequest *req)
 
     qemu_co_mutex_lock(&req->bs->reqs_lock);
     QLIST_REMOVE(req, list);
+    interval_tree_remove(&req->node, &req->bs->tracked_request_tree);
     qemu_co_queue_restart_all(&req->wait_queue);
     qemu_co_mutex_unlock(&req->bs->reqs_lock);
 }
 
+/*
+ * Set the interval of the tree node to the overlap range.  Requests of
+ * zero bytes get one byte, which only makes the tree return a superset
+ * of the requests that tracked_request_overlaps() accepts.
+ */
+static void tracked_request_set_node(BdrvTrackedRequest *req)
+{
+    req->node.start = req->overlap_offset;
+    req->node.last = req->overlap_offset + MAX(req->overlap_bytes, 1) - 1;
+}
+
 /**
  * Add an active request to the tracked requests list
  */
@@ -766,9 +783,11 @@ static void tracked_request_begin(BdrvTrackedRequest *req,
     };
 
     qemu_co_queue_init(&req->wait_queue);
+    tracked_request_set_node(req);
 
     qemu_co_mutex_lock(&bs->reqs_lock);
     QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
+    interval_tree_insert(&req->node, &bs->tracked_request_tree);
     qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
@@ -792,9 +811,14 @@ static bool tracked_request_overlaps(BdrvTrackedRequest *req,
 static BdrvTrackedRequest *
 bdrv_find_conflicting_request(BdrvTrackedRequest *self)
 {
+    IntervalTreeRoot *root = &self->bs->tracked_request_tree;
+    uint64_t start = self->node.start, last = self->node.last;
+    IntervalTreeNode *node;
     BdrvTrackedRequest *req;
 
-    QLIST_FOREACH(req, &self->bs->tracked_requests, list) {
+    for (node = interval_tree_iter_first(root, start, last); node;
+         node = interval_tree_iter_next(root, node, start, last)) {
+        req = container_of(node, BdrvTrackedRequest, node);
         if (req == self || (!req->serialising && !self->serialising)) {
             continue;
         }
@@ -854,8 +878,16 @@ static void tracked_request_set_serialising(BdrvTrackedRequest *req,
         req->serialising = true;
     }
 
-    req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
-    req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    overlap_offset = MIN(req->overlap_offset, overlap_offset);
+    overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    if (overlap_offset != req->overlap_offset ||
+        overlap_bytes != req->overlap_bytes) {
+        interval_tree_remove(&req->node, &req->bs->tracked_request_tree);
+        req->overlap_offset = overlap_offset;
+        req->overlap_bytes = overlap_bytes;
+        tracked_request_set_node(req);
+        interval_tree_insert(&req->node, &req->bs->tracked_request_tree);
+    }
 }
 
 /**
@@ -1355,6 +1387,7 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
      * where anything might happen inside guest memory.
      */
     void *bounce_buffer = NULL;
+    int64_t bounce_buffer_len = 0;
 
     BlockDriver *drv = bs->drv;
     int64_t cluster_offset;
@@ -1433,9 +1466,9 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
             if (!bounce_buffer) {
                 int64_t max_we_need = MAX(pnum, cluster_bytes - pnum);
                 int64_t max_allowed = MIN(max_transfer, MAX_BOUNCE_BUFFER);
-                int64_t bounce_buffer_len = MIN(max_we_need, max_allowed);
 
-                bounce_buffer = qemu_try_blockalign(bs, bounce_buffer_len);
+                bounce_buffer_len = MIN(max_we_need, max_allowed);
+                bounce_buffer = qemu_try_bounce_buf(bs, bounce_buffer_len);
                 if (!bounce_buffer) {
                     ret = -ENOMEM;
                     goto err;
@@ -1498,7 +1531,7 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
     ret = 0;
 
 err:
-    qemu_vfree(bounce_buffer);
+    qemu_bounce_buf_free(bs, bounce_buffer, bounce_buffer_len);
     return ret;
 }
 
@@ -2046,9 +2079,18 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
         (req->type == BDRV_TRACKED_TRUNCATE ||
          end_sector > bs->total_sectors) &&
         req->type != BDRV_TRACKED_DISCARD) {
-        bs->total_sectors = end_sector;
-        bdrv_parent_cb_resize(bs);
-        bdrv_dirty_bitmap_truncate(bs, end_sector << BDRV_SECTOR_BITS);
+        /*
+         * Writes past EOF can complete concurrently in several AioContexts,
+         * make sure the size only grows (truncate is serialising anyway).
+         */
+        qemu_co_mutex_lock(&bs->reqs_lock);
+        if (req->type == BDRV_TRACKED_TRUNCATE ||
+            end_sector > bs->total_sectors) {
+            bs->total_sectors = end_sector;
+            bdrv_parent_cb_resize(bs);
+            bdrv_dirty_bitmap_truncate(bs, end_sector << BDRV_SECTOR_BITS);
+        }
+        qemu_co_mutex_unlock(&bs->reqs_lock);
     }
     if (req->bytes) {
         switch (req->type) {
@@ -2064,6 +2106,131 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
     }
 }
 
+/*
+ * Write data to the driver in pieces of at most max_transfer bytes.
+ */
+static int coroutine_fn bdrv_driver_pwritev_fragmented(BlockDriverState *bs,
+    int64_t offset, int64_t bytes, int64_t max_transfer,
+    QEMUIOVector *qiov, size_t qiov_offset, int flags)
+{
+    int64_t bytes_remaining = bytes;
+    int ret = 0;
+
+    bdrv_debug_event(bs, BLKDBG_PWRITEV);
+    if (bytes <= max_transfer) {
+        return bdrv_driver_pwritev(bs, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    }
+
+    while (bytes_remaining) {
+        int num = MIN(bytes_remaining, max_transfer);
+        int local_flags = flags;
+
+        assert(num);
+        if (num < bytes_remaining && (flags & BDRV_REQ_FUA) &&
+            !(bs->supported_write_flags & BDRV_REQ_FUA)) {
+            /*
+             * If FUA is going to be emulated by flush, we only
+             * need to flush on the last iteration
+             */
+            local_flags &= ~BDRV_REQ_FUA;
+        }
+
+        ret = bdrv_driver_pwritev(bs, offset + bytes - bytes_remaining,
+                                  num, qiov,
+                                  qiov_offset + bytes - bytes_remaining,
+                                  local_flags);
+        if (ret < 0) {
+            break;
+        }
+        bytes_remaining -= num;
+    }
+    return ret;
+}
+
+/*
+ * Granularity at which detect-zeroes looks for zero ranges inside a write
+ * that is not zero as a whole, or 0 if such writes are not split.  Only
+ * drivers that advertise pwrite_zeroes_alignment, usually their cluster
+ * size, gain anything from zeroing part of a request.
+ */
+static int64_t bdrv_detect_zeroes_granularity(BlockDriverState *bs)
+{
+    uint32_t align = bs->bl.pwrite_zeroes_alignment;
+
+    if (!align) {
+        return 0;
+    }
+    return QEMU_ALIGN_UP(DETECT_ZEROES_MIN_GRANULARITY, align);
+}
+
+/*
+ * Write a request for which detect-zeroes is enabled, turning each zero
+ * range of full @granularity blocks into a zero write and the rest into
+ * data writes.  If the request has no such zero range, nothing is written
+ * and *@split is set to false.
+ */
+static int coroutine_fn bdrv_co_pwritev_detect_zero_ranges(
+    BlockDriverState *bs, int64_t offset, int64_t bytes, int64_t granularity,
+    int64_t max_transfer, QEMUIOVector *qiov, size_t qiov_offset, int flags,
+    bool *split)
+{
+    int64_t end = offset + bytes;
+    int64_t pos = offset;
+    int ret = 0;
+
+    while (pos < end) {
+        int64_t start = pos;
+        bool zero = false;
+
+        /*
+         * Find the longest run starting at @pos of either zero
+         * granules, or data up to the next zero granule.
+         */
+        while (pos < end) {
+            int64_t next = MIN(QEMU_ALIGN_DOWN(pos, granularity) + granularity,
+                               end);
+            bool chunk_zero = (pos % granularity) == 0 &&
+                              next - pos == granularity &&
+                              qemu_iovec_is_zero(qiov,
+                                                 qiov_offset + pos - offset,
+                                                 granularity);
+
+            if (pos == start) {
+                zero = chunk_zero;
+            } else if (chunk_zero != zero) {
+                break;
+            }
+            pos = next;
+        }
+
+        if (zero) {
+            int zero_flags = flags | BDRV_REQ_ZERO_WRITE;
+
+            if (bs->detect_zeroes == BLOCKDEV_DETECT_ZEROES_OPTIONS_UNMAP) {
+                zero_flags |= BDRV_REQ_MAY_UNMAP;
+            }
+            bdrv_debug_event(bs, BLKDBG_PWRITEV_ZERO);
+            ret = bdrv_co_do_pwrite_zeroes(bs, start, pos - start,
+                                           zero_flags);
+        } else if (start == offset && pos == end) {
+            /* No zero range at all, let the caller write the request */
+            *split = false;
+            return 0;
+        } else {
+            ret = bdrv_driver_pwritev_fragmented(bs, start, pos - start,
+                                                 max_transfer, qiov,
+                                                 qiov_offset + start - offset,
+                                                 flags);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    *split = true;
+    return 0;
+}
+
 /*
  * Forwards an already correctly aligned write request to the BlockDriver,
  * after possibly fragmenting it.
@@ -2076,8 +2243,8 @@ static int coroutine_fn bdrv_aligned_pwritev(BdrvChild *child,
     BlockDriver *drv = bs->drv;
     int ret;
 
-    int64_t bytes_remaining = bytes;
     int max_transfer;
+    int64_t zero_granularity = 0;
 
     bdrv_check_qiov_request(offset, bytes, qiov, qiov_offset, &error_abort);
 
@@ -2098,11 +2265,17 @@ static int coroutine_fn bdrv_aligned_pwritev(BdrvChild *child,
     ret = bdrv_co_write_req_prepare(child, offset, bytes, req, flags);
 
     if (!ret && bs->detect_zeroes != BLOCKDEV_DETECT_ZEROES_OPTIONS_OFF &&
-        !(flags & BDRV_REQ_ZERO_WRITE) && drv->bdrv_co_pwrite_zeroes &&
-        qemu_iovec_is_zero(qiov, qiov_offset, bytes)) {
-        flags |= BDRV_REQ_ZERO_WRITE;
-        if (bs->detect_zeroes == BLOCKDEV_DETECT_ZEROES_OPTIONS_UNMAP) {
-            flags |= BDRV_REQ_MAY_UNMAP;
+        !(flags & BDRV_REQ_ZERO_WRITE) && drv->bdrv_co_pwrite_zeroes) {
+        if (qemu_iovec_is_zero(qiov, qiov_offset, bytes)) {
+            flags |= BDRV_REQ_ZERO_WRITE;
+            if (bs->detect_zeroes == BLOCKDEV_DETECT_ZEROES_OPTIONS_UNMAP) {
+                flags |= BDRV_REQ_MAY_UNMAP;
+            }
+        } else {
+            zero_granularity = bdrv_detect_zeroes_granularity(bs);
+            if (bytes <= zero_granularity) {
+                zero_granularity = 0;
+            }
         }
     }
 
@@ -2114,31 +2287,20 @@ static int coroutine_fn bdrv_aligned_pwritev(BdrvChild *child,
     } else if (flags & BDRV_REQ_WRITE_COMPRESSED) {
         ret = bdrv_driver_pwritev_compressed(bs, offset, bytes,
                                              qiov, qiov_offset);
-    } else if (bytes <= max_transfer) {
-        bdrv_debug_event(bs, BLKDBG_PWRITEV);
-        ret = bdrv_driver_pwritev(bs, offset, bytes, qiov, qiov_offset, flags);
     } else {
-        bdrv_debug_event(bs, BLKDBG_PWRITEV);
-        while (bytes_remaining) {
-            int num = MIN(bytes_remaining, max_transfer);
-            int local_flags = flags;
+        bool split = false;
 
-            assert(num);
-            if (num < bytes_remaining && (flags & BDRV_REQ_FUA) &&
-                !(bs->supported_write_flags & BDRV_REQ_FUA)) {
-                /* If FUA is going to be emulated by flush, we only
-                 * need to flush on the last iteration */
-                local_flags &= ~BDRV_REQ_FUA;
-            }
-
-            ret = bdrv_driver_pwritev(bs, offset + bytes - bytes_remaining,
-                                      num, qiov,
-                                      qiov_offset + bytes - bytes_remaining,
-                                      local_flags);
-            if (ret < 0) {
-                break;
-            }
-            bytes_remaining -= num;
+        if (zero_granularity) {
+            ret = bdrv_co_pwritev_detect_zero_ranges(bs, offset, bytes,
+                                                     zero_granularity,
+                                                     max_transfer, qiov,
+                                                     qiov_offset, flags,
+                                                     &split);
+        }
+        if (!split && ret >= 0) {
+            ret = bdrv_driver_pwritev_fragmented(bs, offset, bytes,
+                                                 max_transfer, qiov,
+                                                 qiov_offset, flags);
         }
     }
     bdrv_debug_event(bs, BLKDBG_PWRITEV_DONE);
@@ -2358,6 +2520,83 @@ int bdrv_flush_all(void)
     return result;
 }
 
+void bdrv_block_status_cache_invalidate(BlockDriverState *bs)
+{
+    qemu_spin_lock(&bs->block_status_cache_lock);
+    bs->block_status_cache.valid = false;
+    qemu_spin_unlock(&bs->block_status_cache_lock);
+}
+
+/*
+ * Only nodes without writers are cached: unlike the active layer, their
+ * allocation does not change under the guest's feet, so a chain walk
+ * that goes over the same range again can be answered from memory.
+ * Writes that happen anyway bump write_gen, which voids the entry.
+ */
+static bool bdrv_block_status_cacheable(BlockDriverState *bs)
+{
+    uint64_t perm, shared_perm;
+
+    bdrv_get_cumulative_perm(bs, &perm, &shared_perm);
+    return !(perm & BLK_PERM_WRITE);
+}
+
+static bool bdrv_block_status_cache_lookup(BlockDriverState *bs,
+                                           bool want_zero, int64_t offset,
+                                           int64_t *pnum, int64_t *map,
+                                           BlockDriverState **file,
+                                           int *ret)
+{
+    BdrvBlockStatusCache *c = &bs->block_status_cache;
+    bool hit;
+
+    qemu_spin_lock(&bs->block_status_cache_lock);
+    /* A want_zero result is precise enough for any query, not vice versa */
+    hit = c->valid && (!want_zero || c->want_zero) &&
+        c->write_gen == qatomic_read(&bs->write_gen) &&
+        offset >= c->offset && offset < c->offset + c->bytes;
+    if (hit) {
+        *ret = c->ret;
+        *pnum = c->offset + c->bytes - offset;
+        *map = c->map + (offset - c->offset);
+        *file = c->file;
+    }
+    qemu_spin_unlock(&bs->block_status_cache_lock);
+
+    if (hit && !bdrv_block_status_cacheable(bs)) {
+        bdrv_block_status_cache_invalidate(bs);
+        return false;
+    }
+    return hit;
+}
+
+static void bdrv_block_status_cache_fill(BlockDriverState *bs,
+                                         bool want_zero, unsigned int write_gen,
+                                         int64_t offset, int64_t pnum,
+                                         int64_t map, BlockDriverState *file,
+                                         int ret)
+{
+    BdrvBlockStatusCache *c = &bs->block_status_cache;
+
+    if (write_gen != qatomic_read(&bs->write_gen) ||
+        !bdrv_block_status_cacheable(bs)) {
+        return;
+    }
+
+    qemu_spin_lock(&bs->block_status_cache_lock);
+    *c = (BdrvBlockStatusCache) {
+        .valid = true,
+        .want_zero = want_zero,
+        .write_gen = write_gen,
+        .ret = ret,
+        .offset = offset,
+        .bytes = pnum,
+        .map = map,
+        .file = file,
+    };
+    qemu_spin_unlock(&bs->block_status_cache_lock);
+}
+
 /*
  * Returns the allocation status of the specified sectors.
  * Drivers not implementing the functionality are assumed to not support
@@ -2446,10 +2685,20 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
     aligned_offset = QEMU_ALIGN_DOWN(offset, align);
     aligned_bytes = ROUND_UP(offset + bytes, align) - aligned_offset;
 
-    if (bs->drv->bdrv_co_block_status) {
+    if (bdrv_block_status_cache_lookup(bs, want_zero, aligned_offset, pnum,
+                                       &local_map, &local_file, &ret)) {
+        /* The range past aligned_bytes is clamped below */
+    } else if (bs->drv->bdrv_co_block_status) {
+        unsigned int write_gen = qatomic_read(&bs->write_gen);
+
         ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
                                             aligned_bytes, pnum, &local_map,
                                             &local_file);
+        if (ret >= 0) {
+            bdrv_block_status_cache_fill(bs, want_zero, write_gen,
+                                         aligned_offset, *pnum, local_map,
+                                         local_file, ret);
+        }
     } else {
         /* Default code for filters */
 
@@ -3150,6 +3399,33 @@ void *qemu_try_blockalign0(BlockDriverState *bs, size_t size)
     return mem;
 }
 
+/*
+ * Like qemu_try_blockalign(), but large buffers come from a pool of the
+ * AioContext of @bs.  The buffer must be freed with qemu_bounce_buf_free()
+ * and the same @size.  This is meant for short-lived bounce buffers on
+ * the I/O path.
+ */
+void *qemu_try_bounce_buf(BlockDriverState *bs, size_t size)
+{
+    BouncePool *pool = aio_get_bounce_pool(bdrv_get_aio_context(bs));
+    size_t align = bdrv_opt_mem_align(bs);
+
+    /* Ensure that NULL is never returned on success */
+    assert(align > 0);
+    if (size == 0) {
+        size = align;
+    }
+
+    return bounce_pool_try_alloc(pool, size, align);
+}
+
+void qemu_bounce_buf_free(BlockDriverState *bs, void *buf, size_t size)
+{
+    BouncePool *pool = aio_get_bounce_pool(bdrv_get_aio_context(bs));
+
+    bounce_pool_release(pool, buf, size ?: bdrv_opt_mem_align(bs));
+}
+
 /*
  * Check if all memory in this vector is sector aligned.
  */
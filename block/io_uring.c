@@ -16,12 +16,29 @@
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
+#include "exec/ramlist.h"
 #include "qapi/error.h"
 #include "trace.h"
 
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of slots in the fixed file table */
+#define MAX_FIXED_FILES 64
+
+/*
+ * The kernel limits the number of fixed buffers and the size of each of
+ * them, so guest RAM is registered in chunks of at most 1 GiB.
+ */
+#define MAX_FIXED_BUFS 1024
+#define FIXED_BUF_MAX_SIZE (1 * GiB)
+
+/* Milliseconds of inactivity before the SQPOLL kernel thread goes to sleep */
+#define SQPOLL_IDLE_MS 1000
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -56,6 +73,43 @@ typedef struct LuringState {
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /*
+     * Completions are polled (IORING_SETUP_IOPOLL) rather than signalled,
+     * see luring_reap_iopoll()
+     */
+    bool iopoll;
+
+    /* Register guest RAM and image files with the ring? */
+    bool fixed;
+
+    /* fd registered in each slot of the fixed file table, or -1 */
+    int fixed_files[MAX_FIXED_FILES];
+    bool fixed_files_registered;
+
+    /*
+     * Guest RAM regions (struct iovec), maintained by ram_notifier in the
+     * main loop.  Protected by ram_lock; ram_regions_gen changes whenever
+     * the regions do.
+     */
+    RAMBlockNotifier ram_notifier;
+    bool ram_notifier_added;
+    QemuMutex ram_lock;
+    GArray *ram_regions;
+    unsigned ram_regions_gen;
+
+    /*
+     * Fixed buffers registered with the ring, sorted by address.  Only
+     * used in the AioContext of the ring.  They are replaced with the
+     * current ram_regions only while no request is queued or in flight,
+     * because the buffer indexes of those requests refer to this set.
+     * Until then, new requests do not use them, since they may cover
+     * memory that is no longer guest RAM.
+     */
+    struct iovec *fixed_bufs;
+    unsigned nb_fixed_bufs;
+    unsigned fixed_bufs_gen;
+    bool fixed_bufs_failed;
 } LuringState;
 
 /**
@@ -103,13 +157,35 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
                       remaining);
 
     /* Update sqe */
-    luringcb->sqeq.off = nread;
-    luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
-    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* The buffer is still within the same fixed buffer */
+        luringcb->sqeq.off += nread;
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len -= nread;
+    } else {
+        luringcb->sqeq.off = nread;
+        luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    }
 
     luring_resubmit(s, luringcb);
 }
 
+/**
+ * luring_reap_iopoll:
+ *
+ * Completions of a ring with IORING_SETUP_IOPOLL only show up when the
+ * kernel is entered with IORING_ENTER_GETEVENTS, which polls the device.
+ * With nothing to submit, io_uring_submit() does exactly that on such a
+ * ring.  (With SQPOLL the kernel thread reaps them on its own.)
+ */
+static void luring_reap_iopoll(LuringState *s)
+{
+    if (s->iopoll && s->io_q.in_flight) {
+        io_uring_submit(&s->ring);
+    }
+}
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -144,6 +220,8 @@ static void luring_process_completions(LuringState *s)
      */
     qemu_bh_schedule(s->completion_bh);
 
+    luring_reap_iopoll(s);
+
     while (io_uring_peek_cqe(&s->ring, &cqes) == 0) {
         LuringAIOCB *luringcb;
         int ret;
@@ -218,7 +296,15 @@ end:
             aio_co_wake(luringcb->co);
         }
     }
-    qemu_bh_cancel(s->completion_bh);
+
+    /*
+     * Nothing signals the completion of polled requests, so keep the BH
+     * scheduled while they are in flight.  This keeps the event loop from
+     * blocking and makes it poll the ring instead.
+     */
+    if (!s->iopoll || !s->io_q.in_flight) {
+        qemu_bh_cancel(s->completion_bh);
+    }
 }
 
 static int ioq_submit(LuringState *s)
@@ -292,6 +378,8 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
+    luring_reap_iopoll(s);
+
     if (io_uring_cq_ready(&s->ring)) {
         luring_process_completions_and_submit(s);
         return true;
@@ -326,9 +414,220 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+static void luring_ram_block_added(RAMBlockNotifier *n, void *host,
+                                   size_t size, size_t max_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+    struct iovec iov = { .iov_base = host, .iov_len = size };
+
+    QEMU_LOCK_GUARD(&s->ram_lock);
+    g_array_append_val(s->ram_regions, iov);
+    qatomic_set(&s->ram_regions_gen, s->ram_regions_gen + 1);
+}
+
+static void luring_ram_block_removed(RAMBlockNotifier *n, void *host,
+                                     size_t size, size_t max_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+    unsigned i;
+
+    QEMU_LOCK_GUARD(&s->ram_lock);
+    for (i = 0; i < s->ram_regions->len; i++) {
+        if (g_array_index(s->ram_regions, struct iovec, i).iov_base == host) {
+            g_array_remove_index_fast(s->ram_regions, i);
+            qatomic_set(&s->ram_regions_gen, s->ram_regions_gen + 1);
+            break;
+        }
+    }
+}
+
+static void luring_ram_block_resized(RAMBlockNotifier *n, void *host,
+                                     size_t old_size, size_t new_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+    unsigned i;
+
+    QEMU_LOCK_GUARD(&s->ram_lock);
+    for (i = 0; i < s->ram_regions->len; i++) {
+        struct iovec *iov = &g_array_index(s->ram_regions, struct iovec, i);
+
+        if (iov->iov_base == host) {
+            iov->iov_len = new_size;
+            qatomic_set(&s->ram_regions_gen, s->ram_regions_gen + 1);
+            break;
+        }
+    }
+}
+
+static int luring_compare_bufs(const void *a, const void *b)
+{
+    const struct iovec *iov_a = a;
+    const struct iovec *iov_b = b;
+
+    return iov_a->iov_base < iov_b->iov_base ? -1 :
+           iov_a->iov_base > iov_b->iov_base;
+}
+
+/*
+ * Replace the fixed buffers of the ring with the current guest RAM
+ * regions.  Must only be called when no request is queued or in flight.
+ */
+static void luring_update_fixed_bufs(LuringState *s)
+{
+    g_autofree struct iovec *bufs = g_new(struct iovec, MAX_FIXED_BUFS);
+    unsigned nb_bufs = 0;
+    unsigned i;
+    int ret;
+
+    assert(!s->io_q.in_flight && !s->io_q.in_queue);
+
+    WITH_QEMU_LOCK_GUARD(&s->ram_lock) {
+        s->fixed_bufs_gen = s->ram_regions_gen;
+        for (i = 0; i < s->ram_regions->len; i++) {
+            struct iovec *iov = &g_array_index(s->ram_regions,
+                                               struct iovec, i);
+            size_t done;
+
+            for (done = 0; done < iov->iov_len && nb_bufs < MAX_FIXED_BUFS;
+                 done += FIXED_BUF_MAX_SIZE) {
+                bufs[nb_bufs].iov_base = iov->iov_base + done;
+                bufs[nb_bufs].iov_len = MIN(iov->iov_len - done,
+                                            FIXED_BUF_MAX_SIZE);
+                nb_bufs++;
+            }
+        }
+    }
+
+    if (s->nb_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+        g_free(s->fixed_bufs);
+        s->fixed_bufs = NULL;
+        s->nb_fixed_bufs = 0;
+    }
+
+    if (!nb_bufs) {
+        return;
+    }
+
+    qsort(bufs, nb_bufs, sizeof(bufs[0]), luring_compare_bufs);
+    ret = io_uring_register_buffers(&s->ring, bufs, nb_bufs);
+    trace_luring_update_fixed_bufs(s, nb_bufs, ret);
+    if (ret < 0) {
+        /* Most likely RLIMIT_MEMLOCK is too low to pin guest RAM */
+        warn_report("io_uring: cannot register guest RAM as fixed buffers, "
+                    "using normal buffers: %s", strerror(-ret));
+        s->fixed_bufs_failed = true;
+        return;
+    }
+
+    s->fixed_bufs = g_steal_pointer(&bufs);
+    s->nb_fixed_bufs = nb_bufs;
+}
+
+/* Returns the index of the fixed buffer that contains @iov, or -1 */
+static int luring_find_fixed_buf(LuringState *s, const struct iovec *iov)
+{
+    int lo = 0, hi = s->nb_fixed_bufs - 1;
+
+    /* Find the last buffer that starts at or before iov */
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (s->fixed_bufs[mid].iov_base <= iov->iov_base) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if (hi >= 0 &&
+        iov->iov_base + iov->iov_len <=
+        s->fixed_bufs[hi].iov_base + s->fixed_bufs[hi].iov_len) {
+        return hi;
+    }
+    return -1;
+}
+
+/*
+ * Prepare a read or write of a single buffer that lies in guest RAM as a
+ * fixed buffer operation, which saves the kernel from mapping the pages
+ * for each request.
+ *
+ * Returns true if the sqe was prepared.
+ */
+static bool luring_prep_fixed_rw(LuringState *s, struct io_uring_sqe *sqes,
+                                 int fd, QEMUIOVector *qiov, uint64_t offset,
+                                 bool is_read)
+{
+    struct iovec *iov = qiov->iov;
+    int index;
+
+    if (!s->nb_fixed_bufs || qiov->niov != 1 ||
+        qatomic_read(&s->ram_regions_gen) != s->fixed_bufs_gen) {
+        return false;
+    }
+
+    index = luring_find_fixed_buf(s, iov);
+    if (index < 0) {
+        return false;
+    }
+
+    if (is_read) {
+        io_uring_prep_read_fixed(sqes, fd, iov->iov_base, iov->iov_len,
+                                 offset, index);
+    } else {
+        io_uring_prep_write_fixed(sqes, fd, iov->iov_base, iov->iov_len,
+                                  offset, index);
+    }
+    return true;
+}
+
+int luring_register_file(LuringState *s, int fd)
+{
+    int slot;
+    int ret;
+
+    if (!s->fixed_files_registered) {
+        return -1;
+    }
+
+    for (slot = 0; slot < MAX_FIXED_FILES; slot++) {
+        if (s->fixed_files[slot] == -1) {
+            break;
+        }
+    }
+    if (slot == MAX_FIXED_FILES) {
+        return -1;
+    }
+
+    ret = io_uring_register_files_update(&s->ring, slot, &fd, 1);
+    trace_luring_register_file(s, fd, slot, ret);
+    if (ret < 0) {
+        return -1;
+    }
+
+    s->fixed_files[slot] = fd;
+    return slot;
+}
+
+void luring_unregister_file(LuringState *s, int slot)
+{
+    int fd = -1;
+
+    if (slot < 0) {
+        return;
+    }
+
+    assert(slot < MAX_FIXED_FILES && s->fixed_files[slot] != -1);
+    trace_luring_unregister_file(s, s->fixed_files[slot], slot);
+    io_uring_register_files_update(&s->ring, slot, &fd, 1);
+    s->fixed_files[slot] = -1;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
+ * @fixed_file: slot of @fd in the fixed file table, or -1
  * @luringcb: AIO control block
  * @s: AIO state
  * @offset: offset for request
@@ -337,22 +636,40 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type)
+static int luring_do_submit(int fd, int fixed_file, LuringAIOCB *luringcb,
+                            LuringState *s, uint64_t offset, int type)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
+    if (fixed_file >= 0) {
+        fd = fixed_file;
+    }
+
+    if (s->fixed && !s->fixed_bufs_failed &&
+        qatomic_read(&s->ram_regions_gen) != s->fixed_bufs_gen &&
+        !s->io_q.in_flight && !s->io_q.in_queue) {
+        luring_update_fixed_bufs(s);
+    }
+
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (!luring_prep_fixed_rw(s, sqes, fd, luringcb->qiov, offset,
+                                  false)) {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (!luring_prep_fixed_rw(s, sqes, fd, luringcb->qiov, offset,
+                                  true)) {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
+        /* IOPOLL rings only support reads and writes */
+        assert(!s->iopoll);
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
         break;
     default:
@@ -360,6 +677,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fixed_file >= 0) {
+        io_uring_sqe_set_flags(sqes, IOSQE_FIXED_FILE);
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -377,7 +697,8 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 }
 
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
-                                  uint64_t offset, QEMUIOVector *qiov, int type)
+                                  int fixed_file, uint64_t offset,
+                                  QEMUIOVector *qiov, int type)
 {
     int ret;
     LuringAIOCB luringcb = {
@@ -388,7 +709,7 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    ret = luring_do_submit(fd, fixed_file, &luringcb, s, offset, type);
 
     if (ret < 0) {
         return ret;
@@ -416,15 +737,58 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_completion_cb, NULL, qemu_luring_poll_cb, s);
 }
 
-LuringState *luring_init(Error **errp)
+static void luring_init_fixed(LuringState *s)
+{
+    int i;
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        s->fixed_files[i] = -1;
+    }
+    /* A table of empty slots, filled by luring_register_file() */
+    s->fixed_files_registered =
+        io_uring_register_files(&s->ring, s->fixed_files,
+                                MAX_FIXED_FILES) == 0;
+
+    qemu_mutex_init(&s->ram_lock);
+    s->ram_regions = g_array_new(false, false, sizeof(struct iovec));
+
+    /*
+     * RAM block notifiers can only be added with the BQL held; rings that
+     * are set up from an IOThread do without fixed buffers.
+     */
+    if (qemu_mutex_iothread_locked()) {
+        s->ram_notifier = (RAMBlockNotifier) {
+            .ram_block_added = luring_ram_block_added,
+            .ram_block_removed = luring_ram_block_removed,
+            .ram_block_resized = luring_ram_block_resized,
+        };
+        ram_block_notifier_add(&s->ram_notifier);
+        s->ram_notifier_added = true;
+    }
+}
+
+LuringState *luring_init(bool sqpoll, bool fixed, bool iopoll, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    unsigned flags = iopoll ? IORING_SETUP_IOPOLL : 0;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (sqpoll) {
+        params.flags = flags | IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = SQPOLL_IDLE_MS;
+        rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
+        if (rc < 0) {
+            warn_report("io_uring: submission queue polling is not "
+                        "available, continuing without: %s", strerror(-rc));
+            rc = io_uring_queue_init(MAX_ENTRIES, ring, flags);
+        }
+    } else {
+        rc = io_uring_queue_init(MAX_ENTRIES, ring, flags);
+    }
     if (rc < 0) {
         error_setg_errno(errp, errno, "failed to init linux io_uring ring");
         g_free(s);
@@ -432,12 +796,26 @@ LuringState *luring_init(Error **errp)
     }
 
     ioq_init(&s->io_q);
+    s->iopoll = iopoll;
+
+    s->fixed = fixed;
+    if (fixed) {
+        luring_init_fixed(s);
+    }
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    if (s->fixed) {
+        if (s->ram_notifier_added) {
+            ram_block_notifier_remove(&s->ram_notifier);
+        }
+        g_array_free(s->ram_regions, true);
+        qemu_mutex_destroy(&s->ram_lock);
+        g_free(s->fixed_bufs);
+    }
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
     g_free(s);
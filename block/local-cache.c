@@ -0,0 +1,1143 @@
+/*
+ * Local cache filter driver
+ *
+ * Keeps a copy of the clusters read from a (slow, usually remote) image in
+ * a sparse local file, so that later reads of the same data, also across
+ * restarts, are served locally.  The cache file starts with a header and a
+ * bitmap of the cached clusters, followed by the cached data at the same
+ * offsets as in the image.
+ *
+ * The bitmap is only written when the node is closed or inactivated; while
+ * the node is active the header is marked in use, and a cache that was not
+ * closed cleanly is discarded when it is opened again.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qapi/qapi-types-block-core.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/bitmap.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+#define LOCAL_CACHE_MAGIC           0x51454d554c434143ULL /* "QEMULCAC" */
+#define LOCAL_CACHE_VERSION         1
+#define LOCAL_CACHE_FLAG_IN_USE     (1U << 0)
+
+#define LOCAL_CACHE_HEADER_SIZE     4096
+#define LOCAL_CACHE_BITMAP_OFFSET   LOCAL_CACHE_HEADER_SIZE
+#define LOCAL_CACHE_MAX_BITMAP_SIZE (1 * GiB)
+
+#define LOCAL_CACHE_DEFAULT_CLUSTER_SIZE (64 * KiB)
+#define LOCAL_CACHE_MIN_CLUSTER_SIZE     (4 * KiB)
+#define LOCAL_CACHE_MAX_CLUSTER_SIZE     (2 * MiB)
+
+/* Largest read that is copied into the cache in one go */
+#define LOCAL_CACHE_MAX_FILL        (4 * MiB)
+
+typedef struct QEMU_PACKED LocalCacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint64_t image_size;
+    uint32_t cluster_size;
+    uint32_t source_len;
+    uint64_t bitmap_offset;
+    uint64_t data_offset;
+    /* followed by source_len bytes naming the cached image */
+} LocalCacheHeader;
+
+#define LOCAL_CACHE_MAX_SOURCE_LEN \
+    (LOCAL_CACHE_HEADER_SIZE - sizeof(LocalCacheHeader))
+
+typedef struct BDRVLocalCacheState {
+    BdrvChild *cache;
+
+    LocalCacheWritePolicy write_policy;
+    int cluster_bits;
+    uint64_t cluster_size;
+    /* Maximum number of cached clusters, 0 if unlimited */
+    int64_t max_clusters;
+
+    int64_t image_size;
+    int64_t nb_clusters;
+    int64_t bitmap_size;
+    int64_t data_offset;
+    char *source;
+
+    /* Whether the cache file is marked in use and can be written */
+    bool active;
+
+    /*
+     * @cached says which clusters have a valid copy in the cache file;
+     * @dirty which of them have not been written to the image yet (only
+     * with the writeback policy); @referenced which of them have been
+     * read since the last pass of the eviction clock.
+     */
+    unsigned long *cached;
+    unsigned long *dirty;
+    unsigned long *referenced;
+    int64_t nb_cached;
+    int64_t nb_dirty;
+    /* Clusters that are being brought into the cache */
+    int64_t nb_reserved;
+    int64_t evict_hand;
+
+    /*
+     * Writes to the image bump @write_gen when they start and when they
+     * finish, so that a read that overlapped with a write does not put
+     * data that may be stale into the cache.
+     */
+    uint64_t write_gen;
+    int writes_in_flight;
+
+    /*
+     * Taken shared to access cached clusters and exclusively to drop
+     * clusters from the cache, which also discards their data.
+     */
+    CoRwlock lock;
+    /* Serializes bringing clusters into the cache and writing them back */
+    CoMutex fill_lock;
+} BDRVLocalCacheState;
+
+#define LOCAL_CACHE_OPT_CLUSTER_SIZE "cluster-size"
+#define LOCAL_CACHE_OPT_MAX_SIZE "max-size"
+#define LOCAL_CACHE_OPT_WRITE_POLICY "write-policy"
+static QemuOptsList runtime_opts = {
+    .name = "local-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = LOCAL_CACHE_OPT_CLUSTER_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "granularity of the cache, default 64k",
+        },
+        {
+            .name = LOCAL_CACHE_OPT_MAX_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "maximum amount of cached data, default unlimited",
+        },
+        {
+            .name = LOCAL_CACHE_OPT_WRITE_POLICY,
+            .type = QEMU_OPT_STRING,
+            .help = "writethrough or writeback, default writethrough",
+        },
+        { /* end of list */ }
+    },
+};
+
+static inline int64_t local_cache_end_cluster(BDRVLocalCacheState *s,
+                                              int64_t offset, int64_t bytes)
+{
+    return DIV_ROUND_UP(offset + bytes, s->cluster_size);
+}
+
+static int local_cache_write_header(BlockDriverState *bs, bool in_use)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    g_autofree uint8_t *buf = g_malloc0(LOCAL_CACHE_HEADER_SIZE);
+    LocalCacheHeader *h = (LocalCacheHeader *)buf;
+    size_t source_len = strlen(s->source);
+    int ret;
+
+    h->magic = cpu_to_be64(LOCAL_CACHE_MAGIC);
+    h->version = cpu_to_be32(LOCAL_CACHE_VERSION);
+    h->flags = cpu_to_be32(in_use ? LOCAL_CACHE_FLAG_IN_USE : 0);
+    h->image_size = cpu_to_be64(s->image_size);
+    h->cluster_size = cpu_to_be32(s->cluster_size);
+    h->source_len = cpu_to_be32(source_len);
+    h->bitmap_offset = cpu_to_be64(LOCAL_CACHE_BITMAP_OFFSET);
+    h->data_offset = cpu_to_be64(s->data_offset);
+    memcpy(buf + sizeof(*h), s->source, source_len);
+
+    ret = bdrv_pwrite(s->cache, 0, buf, LOCAL_CACHE_HEADER_SIZE);
+    if (ret < 0) {
+        return ret;
+    }
+    return bdrv_flush(s->cache->bs);
+}
+
+/*
+ * Forget about everything in the cache; the space is released when the
+ * cache is activated.
+ */
+static void local_cache_reset(BlockDriverState *bs, const char *reason)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+
+    trace_local_cache_reset(bs, reason);
+
+    bitmap_zero(s->cached, s->nb_clusters);
+    bitmap_zero(s->dirty, s->nb_clusters);
+    bitmap_zero(s->referenced, s->nb_clusters);
+    s->nb_cached = 0;
+    s->nb_dirty = 0;
+    s->evict_hand = 0;
+}
+
+/* Mark the cache file in use before anything is cached in it */
+static int local_cache_activate(BlockDriverState *bs, Error **errp)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t len, min_len;
+    int ret;
+
+    len = bdrv_getlength(s->cache->bs);
+    if (len < 0) {
+        error_setg_errno(errp, -len, "Could not get cache file size");
+        return len;
+    }
+
+    if (!s->nb_cached && len > s->data_offset) {
+        /* Only reclaims space, so errors do not matter */
+        bdrv_pdiscard(s->cache, s->data_offset, len - s->data_offset);
+    }
+
+    min_len = s->data_offset + s->nb_clusters * s->cluster_size;
+    if (len < min_len) {
+        ret = bdrv_truncate(s->cache, min_len, false, PREALLOC_MODE_OFF, 0,
+                            errp);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    ret = local_cache_write_header(bs, true);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write cache file header");
+        return ret;
+    }
+    s->active = true;
+    return 0;
+}
+
+/* Store the bitmap of cached clusters and mark the cache file clean */
+static int local_cache_deactivate(BlockDriverState *bs)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    g_autofree unsigned long *buf = NULL;
+    int ret;
+
+    if (!s->active) {
+        return 0;
+    }
+
+    if (s->nb_dirty) {
+        /* Leave the header marked in use so that the cache is discarded */
+        error_report("local-cache: %" PRId64 " clusters could not be "
+                     "written back to '%s'", s->nb_dirty, s->source);
+        s->active = false;
+        return -EIO;
+    }
+
+    buf = g_malloc0(s->bitmap_size);
+    bitmap_to_le(buf, s->cached, s->nb_clusters);
+    ret = bdrv_pwrite(s->cache, LOCAL_CACHE_BITMAP_OFFSET, buf,
+                      s->bitmap_size);
+    if (ret >= 0) {
+        ret = bdrv_flush(s->cache->bs);
+    }
+    if (ret >= 0) {
+        ret = local_cache_write_header(bs, false);
+    }
+
+    s->active = false;
+    return ret < 0 ? ret : 0;
+}
+
+static int local_cache_load(BlockDriverState *bs, Error **errp)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    g_autofree uint8_t *buf = g_malloc0(LOCAL_CACHE_HEADER_SIZE);
+    LocalCacheHeader *h = (LocalCacheHeader *)buf;
+    const char *reset_reason = NULL;
+    int64_t len;
+    int ret;
+
+    len = bdrv_getlength(s->cache->bs);
+    if (len < 0) {
+        error_setg_errno(errp, -len, "Could not get cache file size");
+        return len;
+    }
+
+    if (len == 0) {
+        reset_reason = "new cache file";
+    } else if (len < LOCAL_CACHE_HEADER_SIZE) {
+        error_setg(errp, "Cache file is too small to be a local-cache file");
+        return -EINVAL;
+    } else {
+        ret = bdrv_pread(s->cache, 0, buf, LOCAL_CACHE_HEADER_SIZE);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not read cache file header");
+            return ret;
+        }
+
+        if (h->magic == 0) {
+            reset_reason = "new cache file";
+        } else if (be64_to_cpu(h->magic) != LOCAL_CACHE_MAGIC) {
+            error_setg(errp, "Cache file is not a local-cache file");
+            return -EINVAL;
+        } else if (be32_to_cpu(h->version) != LOCAL_CACHE_VERSION) {
+            error_setg(errp, "Unsupported local-cache version %" PRIu32,
+                       be32_to_cpu(h->version));
+            return -ENOTSUP;
+        } else if (be32_to_cpu(h->flags) & LOCAL_CACHE_FLAG_IN_USE) {
+            reset_reason = "cache file was not closed cleanly";
+        } else if (be64_to_cpu(h->image_size) != s->image_size ||
+                   be32_to_cpu(h->cluster_size) != s->cluster_size ||
+                   be64_to_cpu(h->bitmap_offset) !=
+                   LOCAL_CACHE_BITMAP_OFFSET ||
+                   be64_to_cpu(h->data_offset) != s->data_offset ||
+                   be32_to_cpu(h->source_len) != strlen(s->source) ||
+                   memcmp(buf + sizeof(*h), s->source,
+                          strlen(s->source)) != 0) {
+            reset_reason = "cache file belongs to a different image";
+        }
+    }
+
+    if (reset_reason) {
+        local_cache_reset(bs, reset_reason);
+    } else {
+        g_autofree unsigned long *bitmap = g_malloc0(s->bitmap_size);
+
+        ret = bdrv_pread(s->cache, LOCAL_CACHE_BITMAP_OFFSET, bitmap,
+                         s->bitmap_size);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not read cache bitmap");
+            return ret;
+        }
+        bitmap_from_le(s->cached, bitmap, s->nb_clusters);
+        s->nb_cached = bitmap_count_one(s->cached, s->nb_clusters);
+    }
+
+    return 0;
+}
+
+/*
+ * Drop the clusters [@first, @first + @nb) from the cache.  Dirty clusters
+ * are kept if @keep_dirty is true.
+ */
+static void coroutine_fn local_cache_drop(BlockDriverState *bs, int64_t first,
+                                          int64_t nb, bool keep_dirty)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t end = first + nb;
+    int64_t cluster = first;
+
+    qemu_co_rwlock_wrlock(&s->lock);
+    while ((cluster = find_next_bit(s->cached, end, cluster)) < end) {
+        int64_t run_end = find_next_zero_bit(s->cached, end, cluster);
+        int64_t i;
+
+        if (keep_dirty) {
+            run_end = MIN(run_end, find_next_bit(s->dirty, run_end, cluster));
+            if (run_end == cluster) {
+                cluster++;
+                continue;
+            }
+        }
+
+        for (i = cluster; i < run_end; i++) {
+            if (test_and_clear_bit(i, s->dirty)) {
+                s->nb_dirty--;
+            }
+        }
+        bitmap_clear(s->cached, cluster, run_end - cluster);
+        bitmap_clear(s->referenced, cluster, run_end - cluster);
+        s->nb_cached -= run_end - cluster;
+
+        bdrv_co_pdiscard(s->cache, s->data_offset + cluster * s->cluster_size,
+                         (run_end - cluster) * s->cluster_size);
+        cluster = run_end;
+    }
+    qemu_co_rwlock_unlock(&s->lock);
+}
+
+/*
+ * Make room for @needed more clusters.  This is a clock algorithm: clean
+ * clusters that were read since the hand last passed them get a second
+ * chance, the others are dropped.  A little more than needed is freed so
+ * that the next few fills do not have to evict again.
+ */
+static void coroutine_fn local_cache_evict(BlockDriverState *bs,
+                                           int64_t needed)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t target = needed + s->max_clusters / 16;
+    int64_t visits = 2 * s->nb_cached;
+    int64_t run_start = -1, run_len = 0;
+    int64_t freed = 0;
+
+    qemu_co_rwlock_wrlock(&s->lock);
+    while (freed < target && visits-- > 0 && s->nb_cached > s->nb_dirty) {
+        int64_t hand = find_next_bit(s->cached, s->nb_clusters,
+                                     s->evict_hand);
+
+        if (hand >= s->nb_clusters) {
+            s->evict_hand = 0;
+            continue;
+        }
+        s->evict_hand = hand + 1;
+
+        if (test_bit(hand, s->dirty)) {
+            continue;
+        }
+        if (test_and_clear_bit(hand, s->referenced)) {
+            continue;
+        }
+
+        clear_bit(hand, s->cached);
+        s->nb_cached--;
+        freed++;
+
+        if (run_start >= 0 && run_start + run_len == hand) {
+            run_len++;
+            continue;
+        }
+        if (run_start >= 0) {
+            bdrv_co_pdiscard(s->cache,
+                             s->data_offset + run_start * s->cluster_size,
+                             run_len * s->cluster_size);
+        }
+        run_start = hand;
+        run_len = 1;
+    }
+    if (run_start >= 0) {
+        bdrv_co_pdiscard(s->cache,
+                         s->data_offset + run_start * s->cluster_size,
+                         run_len * s->cluster_size);
+    }
+    qemu_co_rwlock_unlock(&s->lock);
+
+    trace_local_cache_evict(bs, needed, freed);
+}
+
+/*
+ * Reserve room for @nb clusters that are about to be brought into the
+ * cache, evicting if needed.  Must be called with fill_lock held.
+ */
+static bool coroutine_fn local_cache_reserve(BlockDriverState *bs, int64_t nb)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+
+    if (s->max_clusters) {
+        if (s->nb_cached + s->nb_reserved + nb > s->max_clusters) {
+            local_cache_evict(bs, s->nb_cached + s->nb_reserved + nb -
+                              s->max_clusters);
+        }
+        if (s->nb_cached + s->nb_reserved + nb > s->max_clusters) {
+            return false;
+        }
+    }
+    s->nb_reserved += nb;
+    return true;
+}
+
+/*
+ * Copy @buf, which holds the cluster-aligned range at @offset as read from
+ * the image when the write generation was @gen, into the cache.
+ */
+static void coroutine_fn local_cache_fill(BlockDriverState *bs,
+                                          int64_t offset, int64_t bytes,
+                                          void *buf, uint64_t gen)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t first = offset >> s->cluster_bits;
+    int64_t end = local_cache_end_cluster(s, offset, bytes);
+    int64_t i;
+    int ret;
+
+    qemu_co_mutex_lock(&s->fill_lock);
+    if (s->write_gen != gen || s->writes_in_flight ||
+        find_next_bit(s->cached, end, first) < end ||
+        !local_cache_reserve(bs, end - first)) {
+        qemu_co_mutex_unlock(&s->fill_lock);
+        return;
+    }
+
+    qemu_co_rwlock_rdlock(&s->lock);
+    ret = bdrv_co_pwrite(s->cache, s->data_offset + offset, bytes, buf, 0);
+    if (ret == 0 && s->write_gen == gen) {
+        for (i = first; i < end; i++) {
+            set_bit(i, s->cached);
+        }
+        s->nb_cached += end - first;
+        trace_local_cache_fill(bs, offset, bytes);
+    }
+    qemu_co_rwlock_unlock(&s->lock);
+
+    s->nb_reserved -= end - first;
+    qemu_co_mutex_unlock(&s->fill_lock);
+}
+
+static int coroutine_fn local_cache_read_uncached(BlockDriverState *bs,
+                                                  int64_t offset,
+                                                  int64_t bytes,
+                                                  QEMUIOVector *qiov,
+                                                  size_t qiov_offset)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t start = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+    int64_t end = MIN(QEMU_ALIGN_UP(offset + bytes, s->cluster_size),
+                      s->image_size);
+    uint64_t gen = s->write_gen;
+    uint8_t *buf;
+    int ret;
+
+    if (s->writes_in_flight || offset + bytes > end) {
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   0);
+    }
+
+    buf = qemu_try_blockalign(bs, end - start);
+    if (!buf) {
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   0);
+    }
+
+    ret = bdrv_co_pread(bs->file, start, end - start, buf, 0);
+    if (ret < 0) {
+        goto out;
+    }
+    qemu_iovec_from_buf(qiov, qiov_offset, buf + (offset - start), bytes);
+
+    local_cache_fill(bs, start, end - start, buf, gen);
+
+out:
+    qemu_vfree(buf);
+    return ret;
+}
+
+static int coroutine_fn local_cache_read_cached(BlockDriverState *bs,
+                                                int64_t offset, int64_t bytes,
+                                                QEMUIOVector *qiov,
+                                                size_t qiov_offset)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t first = offset >> s->cluster_bits;
+    int64_t end = local_cache_end_cluster(s, offset, bytes);
+    int ret;
+
+    qemu_co_rwlock_rdlock(&s->lock);
+    if (find_next_zero_bit(s->cached, end, first) < end) {
+        /* Evicted while we were waiting for the lock */
+        qemu_co_rwlock_unlock(&s->lock);
+        return local_cache_read_uncached(bs, offset, bytes, qiov, qiov_offset);
+    }
+
+    bitmap_set(s->referenced, first, end - first);
+    ret = bdrv_co_preadv_part(s->cache, s->data_offset + offset, bytes, qiov,
+                              qiov_offset, 0);
+    qemu_co_rwlock_unlock(&s->lock);
+
+    if (ret < 0 && find_next_bit(s->dirty, end, first) >= end) {
+        /* The image still has the data, so use it and drop the copy */
+        trace_local_cache_read_error(bs, offset, bytes, ret);
+        local_cache_drop(bs, first, end - first, true);
+        ret = bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                  0);
+    }
+    return ret;
+}
+
+static int coroutine_fn local_cache_co_preadv_part(BlockDriverState *bs,
+                                                   uint64_t offset,
+                                                   uint64_t bytes,
+                                                   QEMUIOVector *qiov,
+                                                   size_t qiov_offset,
+                                                   int flags)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int ret;
+
+    if (!s->active) {
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   0);
+    }
+
+    while (bytes) {
+        int64_t cluster = offset >> s->cluster_bits;
+        int64_t end = local_cache_end_cluster(s, offset, bytes);
+        bool cached = test_bit(cluster, s->cached);
+        int64_t next = cached ? find_next_zero_bit(s->cached, end, cluster)
+                              : find_next_bit(s->cached, end, cluster);
+        uint64_t n = MIN(next << s->cluster_bits, offset + bytes) - offset;
+
+        if (cached) {
+            ret = local_cache_read_cached(bs, offset, n, qiov, qiov_offset);
+        } else {
+            n = MIN(n, LOCAL_CACHE_MAX_FILL);
+            ret = local_cache_read_uncached(bs, offset, n, qiov, qiov_offset);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+
+        offset += n;
+        qiov_offset += n;
+        bytes -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Apply a write that has reached the image to the clusters that are
+ * cached.  A NULL @qiov stands for a write of zeroes.
+ */
+static int coroutine_fn local_cache_update(BlockDriverState *bs,
+                                           int64_t offset, int64_t bytes,
+                                           QEMUIOVector *qiov,
+                                           size_t qiov_offset)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t first = offset >> s->cluster_bits;
+    int64_t end = local_cache_end_cluster(s, offset, bytes);
+    int64_t cluster = first;
+    int ret = 0;
+
+    if (!s->nb_cached) {
+        return 0;
+    }
+
+    qemu_co_rwlock_rdlock(&s->lock);
+    while ((cluster = find_next_bit(s->cached, end, cluster)) < end) {
+        int64_t run_end = find_next_zero_bit(s->cached, end, cluster);
+        int64_t a = MAX(cluster << s->cluster_bits, offset);
+        int64_t b = MIN(run_end << s->cluster_bits, offset + bytes);
+
+        if (qiov) {
+            ret = bdrv_co_pwritev_part(s->cache, s->data_offset + a, b - a,
+                                       qiov, qiov_offset + (a - offset), 0);
+        } else {
+            ret = bdrv_co_pwrite_zeroes(s->cache, s->data_offset + a, b - a,
+                                        BDRV_REQ_MAY_UNMAP);
+        }
+        if (ret < 0) {
+            break;
+        }
+        cluster = run_end;
+    }
+    qemu_co_rwlock_unlock(&s->lock);
+
+    if (ret < 0) {
+        if (find_next_bit(s->dirty, end, first) < end) {
+            return ret;
+        }
+        local_cache_drop(bs, first, end - first, true);
+    }
+    return 0;
+}
+
+static int coroutine_fn local_cache_write_through(BlockDriverState *bs,
+                                                  int64_t offset,
+                                                  int64_t bytes,
+                                                  QEMUIOVector *qiov,
+                                                  size_t qiov_offset,
+                                                  BdrvRequestFlags flags)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int ret;
+
+    s->write_gen++;
+    s->writes_in_flight++;
+
+    if (qiov) {
+        ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    } else {
+        ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    }
+
+    if (ret < 0) {
+        /* Nobody knows what the image contains now */
+        local_cache_drop(bs, offset >> s->cluster_bits,
+                         local_cache_end_cluster(s, offset, bytes) -
+                         (offset >> s->cluster_bits), true);
+    } else {
+        ret = local_cache_update(bs, offset, bytes, qiov, qiov_offset);
+    }
+
+    s->writes_in_flight--;
+    s->write_gen++;
+    return ret;
+}
+
+/*
+ * Read cluster @cluster as the guest sees it into @buf.  Called with the
+ * lock held shared.
+ */
+static int coroutine_fn local_cache_read_cluster(BlockDriverState *bs,
+                                                 int64_t cluster, void *buf)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t offset = cluster << s->cluster_bits;
+    int64_t bytes = MIN(s->cluster_size, s->image_size - offset);
+
+    if (test_bit(cluster, s->cached)) {
+        return bdrv_co_pread(s->cache, s->data_offset + offset, bytes, buf, 0);
+    }
+    return bdrv_co_pread(bs->file, offset, bytes, buf, 0);
+}
+
+/*
+ * Write into the cache only and leave it to local_cache_writeback() to
+ * update the image.  Called with fill_lock held; returns -ENOSPC if the
+ * clusters do not fit in the cache.
+ */
+static int coroutine_fn local_cache_write_back(BlockDriverState *bs,
+                                               int64_t offset, int64_t bytes,
+                                               QEMUIOVector *qiov,
+                                               size_t qiov_offset)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t first = offset >> s->cluster_bits;
+    int64_t end = local_cache_end_cluster(s, offset, bytes);
+    int64_t start = first << s->cluster_bits;
+    int64_t end_offset = MIN(end << s->cluster_bits, s->image_size);
+    int64_t nb_new = (end - first) -
+        bitmap_count_one_with_offset(s->cached, first, end - first);
+    uint8_t *buf = NULL;
+    int64_t i;
+    int ret;
+
+    if (offset + bytes > s->image_size || !local_cache_reserve(bs, nb_new)) {
+        return -ENOSPC;
+    }
+
+    s->write_gen++;
+    s->writes_in_flight++;
+    qemu_co_rwlock_rdlock(&s->lock);
+
+    if (offset == start && offset + bytes == end_offset) {
+        ret = bdrv_co_pwritev_part(s->cache, s->data_offset + offset, bytes,
+                                   qiov, qiov_offset, 0);
+    } else {
+        /* Merge the partially written clusters with their old contents */
+        buf = qemu_try_blockalign(bs, end_offset - start);
+        if (!buf) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        if (offset != start) {
+            ret = local_cache_read_cluster(bs, first, buf);
+            if (ret < 0) {
+                goto out;
+            }
+        }
+        if (offset + bytes != end_offset &&
+            (end - 1 != first || offset == start)) {
+            ret = local_cache_read_cluster(bs, end - 1,
+                                           buf + ((end - 1 - first) <<
+                                                  s->cluster_bits));
+            if (ret < 0) {
+                goto out;
+            }
+        }
+        qemu_iovec_to_buf(qiov, qiov_offset, buf + (offset - start), bytes);
+        ret = bdrv_co_pwrite(s->cache, s->data_offset + start,
+                             end_offset - start, buf, 0);
+    }
+
+    if (ret == 0) {
+        for (i = first; i < end; i++) {
+            if (!test_and_set_bit(i, s->cached)) {
+                s->nb_cached++;
+            }
+            if (!test_and_set_bit(i, s->dirty)) {
+                s->nb_dirty++;
+            }
+        }
+        bitmap_set(s->referenced, first, end - first);
+    }
+
+out:
+    qemu_co_rwlock_unlock(&s->lock);
+    s->nb_reserved -= nb_new;
+    s->writes_in_flight--;
+    s->write_gen++;
+    qemu_vfree(buf);
+    return ret;
+}
+
+/* Write all dirty clusters to the image */
+static int coroutine_fn local_cache_writeback(BlockDriverState *bs)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t chunk = MAX(LOCAL_CACHE_MAX_FILL >> s->cluster_bits, 1);
+    int64_t cluster = 0;
+    uint8_t *buf;
+    int ret = 0;
+
+    if (!s->nb_dirty) {
+        return 0;
+    }
+
+    buf = qemu_try_blockalign(bs, chunk << s->cluster_bits);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    qemu_co_mutex_lock(&s->fill_lock);
+    while ((cluster = find_next_bit(s->dirty, s->nb_clusters, cluster)) <
+           s->nb_clusters)
+    {
+        int64_t end = find_next_zero_bit(s->dirty,
+                                         MIN(cluster + chunk, s->nb_clusters),
+                                         cluster);
+        int64_t offset = cluster << s->cluster_bits;
+        int64_t bytes = MIN(end << s->cluster_bits, s->image_size) - offset;
+
+        ret = bdrv_co_pread(s->cache, s->data_offset + offset, bytes, buf, 0);
+        if (ret < 0) {
+            break;
+        }
+        ret = bdrv_co_pwrite(bs->file, offset, bytes, buf, 0);
+        if (ret < 0) {
+            break;
+        }
+
+        trace_local_cache_writeback(bs, offset, bytes);
+        bitmap_clear(s->dirty, cluster, end - cluster);
+        s->nb_dirty -= end - cluster;
+        cluster = end;
+    }
+    qemu_co_mutex_unlock(&s->fill_lock);
+
+    qemu_vfree(buf);
+    return ret;
+}
+
+static int coroutine_fn local_cache_co_pwritev_part(BlockDriverState *bs,
+                                                    uint64_t offset,
+                                                    uint64_t bytes,
+                                                    QEMUIOVector *qiov,
+                                                    size_t qiov_offset,
+                                                    int flags)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int ret;
+
+    if (s->write_policy != LOCAL_CACHE_WRITE_POLICY_WRITEBACK) {
+        return local_cache_write_through(bs, offset, bytes, qiov, qiov_offset,
+                                         flags);
+    }
+
+    qemu_co_mutex_lock(&s->fill_lock);
+    ret = -ENOSPC;
+    if (!(flags & BDRV_REQ_FUA)) {
+        ret = local_cache_write_back(bs, offset, bytes, qiov, qiov_offset);
+    }
+    if (ret == -ENOSPC) {
+        ret = local_cache_write_through(bs, offset, bytes, qiov, qiov_offset,
+                                        flags);
+    }
+    qemu_co_mutex_unlock(&s->fill_lock);
+
+    return ret;
+}
+
+static int coroutine_fn local_cache_co_pwrite_zeroes(BlockDriverState *bs,
+                                                     int64_t offset, int bytes,
+                                                     BdrvRequestFlags flags)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int ret;
+
+    /* Serialize against write-back of the clusters that are zeroed */
+    qemu_co_mutex_lock(&s->fill_lock);
+    ret = local_cache_write_through(bs, offset, bytes, NULL, 0, flags);
+    qemu_co_mutex_unlock(&s->fill_lock);
+
+    return ret;
+}
+
+static int coroutine_fn local_cache_co_pdiscard(BlockDriverState *bs,
+                                                int64_t offset, int bytes)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int64_t first = DIV_ROUND_UP(offset, s->cluster_size);
+    int64_t end = offset + bytes >= s->image_size ?
+        s->nb_clusters : (offset + bytes) >> s->cluster_bits;
+    int ret;
+
+    qemu_co_mutex_lock(&s->fill_lock);
+    s->write_gen++;
+    s->writes_in_flight++;
+
+    ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+
+    /* Partially discarded clusters may keep their old contents */
+    if (end > first) {
+        local_cache_drop(bs, first, end - first, false);
+    }
+
+    s->writes_in_flight--;
+    s->write_gen++;
+    qemu_co_mutex_unlock(&s->fill_lock);
+
+    return ret;
+}
+
+static int coroutine_fn local_cache_co_flush(BlockDriverState *bs)
+{
+    int ret;
+
+    /*
+     * The cache file is not flushed: it is thrown away anyway if QEMU
+     * goes away without closing it.
+     */
+    ret = local_cache_writeback(bs);
+    if (ret < 0) {
+        return ret;
+    }
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static int64_t local_cache_getlength(BlockDriverState *bs)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+
+    return s->image_size;
+}
+
+static int local_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                            Error **errp)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    QemuOpts *opts;
+    const char *policy;
+    uint64_t max_size;
+    int64_t bitmap_size;
+    int write_policy;
+    int ret;
+
+    qemu_co_rwlock_init(&s->lock);
+    qemu_co_mutex_init(&s->fill_lock);
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    bs->file = bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
+                               BDRV_CHILD_FILTERED | BDRV_CHILD_PRIMARY,
+                               false, errp);
+    if (!bs->file) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    /* The cache is written even if the image is only read */
+    if (!qdict_haskey(options, "cache-file")) {
+        qdict_set_default_str(options, "cache-file." BDRV_OPT_READ_ONLY,
+                              "off");
+    }
+    s->cache = bdrv_open_child(NULL, options, "cache-file", bs, &child_of_bds,
+                               BDRV_CHILD_METADATA, false, errp);
+    if (!s->cache) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    s->cluster_size = qemu_opt_get_size(opts, LOCAL_CACHE_OPT_CLUSTER_SIZE,
+                                        LOCAL_CACHE_DEFAULT_CLUSTER_SIZE);
+    if (!is_power_of_2(s->cluster_size) ||
+        s->cluster_size < LOCAL_CACHE_MIN_CLUSTER_SIZE ||
+        s->cluster_size > LOCAL_CACHE_MAX_CLUSTER_SIZE) {
+        error_setg(errp, "cluster-size must be a power of two between "
+                   "%d and %d", LOCAL_CACHE_MIN_CLUSTER_SIZE,
+                   LOCAL_CACHE_MAX_CLUSTER_SIZE);
+        ret = -EINVAL;
+        goto fail_cache;
+    }
+    s->cluster_bits = ctz64(s->cluster_size);
+
+    max_size = qemu_opt_get_size(opts, LOCAL_CACHE_OPT_MAX_SIZE, 0);
+    s->max_clusters = max_size >> s->cluster_bits;
+    if (max_size && !s->max_clusters) {
+        error_setg(errp, "max-size must be at least cluster-size");
+        ret = -EINVAL;
+        goto fail_cache;
+    }
+
+    policy = qemu_opt_get(opts, LOCAL_CACHE_OPT_WRITE_POLICY);
+    write_policy = qapi_enum_parse(&LocalCacheWritePolicy_lookup, policy,
+                                   LOCAL_CACHE_WRITE_POLICY_WRITETHROUGH,
+                                   errp);
+    if (write_policy < 0) {
+        ret = -EINVAL;
+        goto fail_cache;
+    }
+    s->write_policy = write_policy;
+
+    s->image_size = bdrv_getlength(bs->file->bs);
+    if (s->image_size < 0) {
+        ret = s->image_size;
+        error_setg_errno(errp, -ret, "Could not get image size");
+        goto fail_cache;
+    }
+    s->nb_clusters = DIV_ROUND_UP(s->image_size, s->cluster_size);
+
+    bitmap_size = ROUND_UP(DIV_ROUND_UP(s->nb_clusters, BITS_PER_BYTE),
+                           LOCAL_CACHE_HEADER_SIZE);
+    if (bitmap_size > LOCAL_CACHE_MAX_BITMAP_SIZE) {
+        error_setg(errp, "Image is too large for a cluster size of %" PRIu64,
+                   s->cluster_size);
+        ret = -EFBIG;
+        goto fail_cache;
+    }
+    s->bitmap_size = bitmap_size;
+    s->data_offset = ROUND_UP(LOCAL_CACHE_BITMAP_OFFSET + bitmap_size,
+                              MAX(1 * MiB, s->cluster_size));
+
+    s->source = g_strdup(bs->file->bs->filename);
+    if (strlen(s->source) > LOCAL_CACHE_MAX_SOURCE_LEN) {
+        error_setg(errp, "Image name is too long to be stored in the cache");
+        ret = -EINVAL;
+        goto fail_cache;
+    }
+
+    s->cached = bitmap_new(s->nb_clusters);
+    s->dirty = bitmap_new(s->nb_clusters);
+    s->referenced = bitmap_new(s->nb_clusters);
+
+    ret = local_cache_load(bs, errp);
+    if (ret < 0) {
+        goto fail_cache;
+    }
+
+    if (!(flags & BDRV_O_INACTIVE)) {
+        ret = local_cache_activate(bs, errp);
+        if (ret < 0) {
+            goto fail_cache;
+        }
+    }
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    ret = 0;
+fail_cache:
+    if (ret < 0) {
+        g_free(s->cached);
+        g_free(s->dirty);
+        g_free(s->referenced);
+        g_free(s->source);
+        bdrv_unref_child(bs, s->cache);
+        s->cache = NULL;
+    }
+fail:
+    if (ret < 0) {
+        bdrv_unref_child(bs, bs->file);
+        bs->file = NULL;
+    }
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void local_cache_close(BlockDriverState *bs)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+
+    local_cache_deactivate(bs);
+
+    bdrv_unref_child(bs, s->cache);
+    s->cache = NULL;
+
+    g_free(s->cached);
+    g_free(s->dirty);
+    g_free(s->referenced);
+    g_free(s->source);
+}
+
+static int local_cache_inactivate(BlockDriverState *bs)
+{
+    return local_cache_deactivate(bs);
+}
+
+static void coroutine_fn local_cache_co_invalidate_cache(BlockDriverState *bs,
+                                                         Error **errp)
+{
+    /*
+     * Whoever had the image open before us may have written to it, so
+     * nothing that was cached here can be trusted anymore.
+     */
+    local_cache_reset(bs, "image was used elsewhere");
+    local_cache_activate(bs, errp);
+}
+
+static int local_cache_reopen_prepare(BDRVReopenState *reopen_state,
+                                      BlockReopenQueue *queue, Error **errp)
+{
+    /* Options cannot be changed, but the read-only state can */
+    return 0;
+}
+
+static void local_cache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                   BdrvChildRole role,
+                                   BlockReopenQueue *reopen_queue,
+                                   uint64_t perm, uint64_t shared,
+                                   uint64_t *nperm, uint64_t *nshared)
+{
+    if (role & BDRV_CHILD_FILTERED) {
+        bdrv_default_perms(bs, c, role, reopen_queue, perm, shared,
+                           nperm, nshared);
+
+        /* Writes that bypass us would make the cache stale */
+        *nshared &= ~BLK_PERM_WRITE;
+        return;
+    }
+
+    /* The cache file is ours alone */
+    *nperm = BLK_PERM_CONSISTENT_READ;
+    if (!(bs->open_flags & BDRV_O_INACTIVE)) {
+        *nperm |= BLK_PERM_WRITE | BLK_PERM_RESIZE;
+    }
+    *nshared = BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE_UNCHANGED;
+}
+
+static BlockDriver bdrv_local_cache = {
+    .format_name                        = "local-cache",
+    .instance_size                      = sizeof(BDRVLocalCacheState),
+
+    .bdrv_open                          = local_cache_open,
+    .bdrv_close                         = local_cache_close,
+    .bdrv_reopen_prepare                = local_cache_reopen_prepare,
+    .bdrv_child_perm                    = local_cache_child_perm,
+
+    .bdrv_getlength                     = local_cache_getlength,
+
+    .bdrv_co_preadv_part                = local_cache_co_preadv_part,
+    .bdrv_co_pwritev_part               = local_cache_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes              = local_cache_co_pwrite_zeroes,
+    .bdrv_co_pdiscard                   = local_cache_co_pdiscard,
+    .bdrv_co_flush                      = local_cache_co_flush,
+
+    .bdrv_inactivate                    = local_cache_inactivate,
+    .bdrv_co_invalidate_cache           = local_cache_co_invalidate_cache,
+
+    .is_filter                          = true,
+};
+
+static void bdrv_local_cache_init(void)
+{
+    bdrv_register(&bdrv_local_cache);
+}
+
+block_init(bdrv_local_cache_init);
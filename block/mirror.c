@@ -55,6 +55,11 @@ typedef struct MirrorBlockJob {
     /* Whether the target image requires explicit zero-initialization */
     bool zero_target;
     MirrorCopyMode copy_mode;
+    /*
+     * Dirty bytes above which MIRROR_COPY_MODE_WRITE_BLOCKING_ON_BACKLOG
+     * makes guest writes synchronous
+     */
+    int64_t write_blocking_threshold;
     BlockdevOnError on_source_error, on_target_error;
     bool synced;
     /* Set when the target is synced (dirty bitmap is clean, nothing
@@ -1041,7 +1046,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
                  */
                 job_transition_to_ready(&s->common.job);
                 s->synced = true;
-                if (s->copy_mode != MIRROR_COPY_MODE_BACKGROUND) {
+                if (s->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING) {
                     s->actively_synced = true;
                 }
             }
@@ -1400,17 +1405,53 @@ static int coroutine_fn bdrv_mirror_top_preadv(BlockDriverState *bs,
     return bdrv_co_preadv(bs->backing, offset, bytes, qiov, flags);
 }
 
+/*
+ * Whether a guest write must be written to the target synchronously.
+ *
+ * In write-blocking-on-backlog mode, this is only the case while the backlog
+ * of dirty data is above the threshold, and only for writes that would grow
+ * it: once the background copying has fallen behind, letting the guest dirty
+ * areas that were already copied could keep it from ever converging.  Writes
+ * that only touch dirty areas don't add to the backlog, so they can still
+ * complete without waiting for the target.
+ */
+static bool mirror_copy_to_target(MirrorBlockJob *job, uint64_t offset,
+                                  uint64_t bytes)
+{
+    int64_t start, end;
+
+    if (job->ret < 0) {
+        return false;
+    }
+
+    switch (job->copy_mode) {
+    case MIRROR_COPY_MODE_BACKGROUND:
+        return false;
+    case MIRROR_COPY_MODE_WRITE_BLOCKING:
+        return true;
+    case MIRROR_COPY_MODE_WRITE_BLOCKING_ON_BACKLOG:
+        if (bdrv_get_dirty_count(job->dirty_bitmap) <=
+            job->write_blocking_threshold) {
+            return false;
+        }
+        start = QEMU_ALIGN_DOWN(offset, job->granularity);
+        end = MIN(QEMU_ALIGN_UP(offset + bytes, job->granularity),
+                  job->bdev_length);
+        return start < end &&
+               bdrv_dirty_bitmap_next_zero(job->dirty_bitmap, start,
+                                           end - start) >= 0;
+    default:
+        abort();
+    }
+}
+
 static int coroutine_fn bdrv_mirror_top_do_write(BlockDriverState *bs,
-    MirrorMethod method, uint64_t offset, uint64_t bytes, QEMUIOVector *qiov,
-    int flags)
+    MirrorMethod method, bool copy_to_target, uint64_t offset, uint64_t bytes,
+    QEMUIOVector *qiov, int flags)
 {
     MirrorOp *op = NULL;
     MirrorBDSOpaque *s = bs->opaque;
     int ret = 0;
-    bool copy_to_target;
-
-    copy_to_target = s->job->ret >= 0 &&
-                     s->job->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING;
 
     if (copy_to_target) {
         op = active_write_prepare(s->job, offset, bytes);
@@ -1457,8 +1498,7 @@ static int coroutine_fn bdrv_mirror_top_pwritev(BlockDriverState *bs,
     int ret = 0;
     bool copy_to_target;
 
-    copy_to_target = s->job->ret >= 0 &&
-                     s->job->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING;
+    copy_to_target = mirror_copy_to_target(s->job, offset, bytes);
 
     if (copy_to_target) {
         /* The guest might concurrently modify the data to write; but
@@ -1473,8 +1513,8 @@ static int coroutine_fn bdrv_mirror_top_pwritev(BlockDriverState *bs,
         qiov = &bounce_qiov;
     }
 
-    ret = bdrv_mirror_top_do_write(bs, MIRROR_METHOD_COPY, offset, bytes, qiov,
-                                   flags);
+    ret = bdrv_mirror_top_do_write(bs, MIRROR_METHOD_COPY, copy_to_target,
+                                   offset, bytes, qiov, flags);
 
     if (copy_to_target) {
         qemu_iovec_destroy(&bounce_qiov);
@@ -1496,15 +1536,23 @@ static int coroutine_fn bdrv_mirror_top_flush(BlockDriverState *bs)
 static int coroutine_fn bdrv_mirror_top_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int bytes, BdrvRequestFlags flags)
 {
-    return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_ZERO, offset, bytes, NULL,
-                                    flags);
+    MirrorBDSOpaque *s = bs->opaque;
+
+    return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_ZERO,
+                                    mirror_copy_to_target(s->job, offset,
+                                                          bytes),
+                                    offset, bytes, NULL, flags);
 }
 
 static int coroutine_fn bdrv_mirror_top_pdiscard(BlockDriverState *bs,
     int64_t offset, int bytes)
 {
-    return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_DISCARD, offset, bytes,
-                                    NULL, 0);
+    MirrorBDSOpaque *s = bs->opaque;
+
+    return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_DISCARD,
+                                    mirror_copy_to_target(s->job, offset,
+                                                          bytes),
+                                    offset, bytes, NULL, 0);
 }
 
 static void bdrv_mirror_top_refresh_filename(BlockDriverState *bs)
@@ -1590,6 +1638,7 @@ static BlockJob *mirror_start_job(
                              bool is_none_mode, BlockDriverState *base,
                              bool auto_complete, const char *filter_node_name,
                              bool is_mirror, MirrorCopyMode copy_mode,
+                             int64_t write_blocking_threshold,
                              Error **errp)
 {
     MirrorBlockJob *s;
@@ -1744,10 +1793,14 @@ static BlockJob *mirror_start_job(
     s->backing_mode = backing_mode;
     s->zero_target = zero_target;
     s->copy_mode = copy_mode;
+    s->write_blocking_threshold = write_blocking_threshold;
     s->base = base;
     s->base_overlay = bdrv_find_overlay(bs, base);
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
+    if (!s->write_blocking_threshold) {
+        s->write_blocking_threshold = 16 * s->buf_size;
+    }
     s->unmap = unmap;
     if (auto_complete) {
         s->should_complete = true;
@@ -1860,7 +1913,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp)
+                  MirrorCopyMode copy_mode, int64_t write_blocking_threshold,
+                  Error **errp)
 {
     bool is_none_mode;
     BlockDriverState *base;
@@ -1877,7 +1931,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                      speed, granularity, buf_size, backing_mode, zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
-                     filter_node_name, true, copy_mode, errp);
+                     filter_node_name, true, copy_mode,
+                     write_blocking_threshold, errp);
 }
 
 BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
@@ -1903,7 +1958,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                      MIRROR_LEAVE_BACKING_CHAIN, false,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
-                     filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
+                     filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND, 0,
                      errp);
     if (!job) {
         goto error_restore_flags;
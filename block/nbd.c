@@ -35,6 +35,7 @@
 #include "qemu/option.h"
 #include "qemu/cutils.h"
 #include "qemu/main-loop.h"
+#include "qemu/units.h"
 #include "qemu/atomic.h"
 
 #include "qapi/qapi-visit-sockets.h"
@@ -50,9 +51,12 @@
 
 #define EN_OPTSTR ":exportname="
 #define MAX_NBD_REQUESTS    16
+#define MAX_MULTI_CONN      16
+/* Most extents kept from one block status reply */
+#define NBD_BSC_MAX_EXTENTS 16384
 
-#define HANDLE_TO_INDEX(bs, handle) ((handle) ^ (uint64_t)(intptr_t)(bs))
-#define INDEX_TO_HANDLE(bs, index)  ((index)  ^ (uint64_t)(intptr_t)(bs))
+#define HANDLE_TO_INDEX(cs, handle) ((handle) ^ (uint64_t)(intptr_t)(cs))
+#define INDEX_TO_HANDLE(cs, index)  ((index)  ^ (uint64_t)(intptr_t)(cs))
 
 typedef struct {
     Coroutine *coroutine;
@@ -67,7 +71,33 @@ typedef enum NBDClientState {
     NBD_CLIENT_QUIT
 } NBDClientState;
 
-typedef struct BDRVNBDState {
+typedef struct BDRVNBDState BDRVNBDState;
+
+typedef struct NBDCachedExtent {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t flags;
+} NBDCachedExtent;
+
+/*
+ * Block status extents prefetched from the server, sorted by offset and
+ * without gaps.  @gen is bumped whenever our own requests may change the
+ * status, so that replies to block status requests sent earlier are not
+ * cached.
+ */
+typedef struct NBDBlockStatusCache {
+    NBDCachedExtent *extents;
+    unsigned int nb_extents;
+    uint64_t gen;
+} NBDBlockStatusCache;
+
+/*
+ * One connection to the server.  Each connection has its own socket, request
+ * table and connection_co, and reconnects on its own.
+ */
+typedef struct NBDConnState {
+    BDRVNBDState *s;
+
     QIOChannel *ioc; /* The current I/O channel */
     NBDExportInfo info;
 
@@ -76,7 +106,6 @@ typedef struct BDRVNBDState {
     Coroutine *connection_co;
     Coroutine *teardown_co;
     QemuCoSleep reconnect_sleep;
-    bool drained;
     bool wait_drained_end;
     int in_flight;
     NBDClientState state;
@@ -86,6 +115,20 @@ typedef struct BDRVNBDState {
 
     NBDClientRequest requests[MAX_NBD_REQUESTS];
     NBDReply reply;
+
+    NBDClientConnection *conn;
+} NBDConnState;
+
+struct BDRVNBDState {
+    /* Requests are striped over the connections, see nbd_get_conn() */
+    NBDConnState *conns[MAX_MULTI_CONN];
+    uint32_t multi_conn;
+    uint32_t next_conn;
+
+    bool bsc_enabled;
+    NBDBlockStatusCache bsc;
+
+    bool drained;
     BlockDriverState *bs;
 
     /* Connection parameters */
@@ -96,18 +139,32 @@ typedef struct BDRVNBDState {
     const char *hostname;
     char *x_dirty_bitmap;
     bool alloc_depth;
-
-    NBDClientConnection *conn;
-} BDRVNBDState;
+};
 
 static void nbd_yank(void *opaque);
 
+/* Free the connections from index @first on, which have no channel */
+static void nbd_free_conns(BDRVNBDState *s, uint32_t first)
+{
+    uint32_t i;
+
+    for (i = first; i < s->multi_conn; i++) {
+        assert(!s->conns[i]->ioc);
+        nbd_client_connection_release(s->conns[i]->conn);
+        g_free(s->conns[i]);
+        s->conns[i] = NULL;
+    }
+    s->multi_conn = MIN(s->multi_conn, first);
+}
+
 static void nbd_clear_bdrvstate(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
 
-    nbd_client_connection_release(s->conn);
-    s->conn = NULL;
+    nbd_free_conns(s, 0);
+    g_free(s->bsc.extents);
+    s->bsc.extents = NULL;
+    s->bsc.nb_extents = 0;
 
     yank_unregister_instance(BLOCKDEV_YANK_INSTANCE(bs->node_name));
 
@@ -122,32 +179,81 @@ static void nbd_clear_bdrvstate(BlockDriverState *bs)
     s->x_dirty_bitmap = NULL;
 }
 
-static bool nbd_client_connected(BDRVNBDState *s)
+static void nbd_bsc_invalidate(BDRVNBDState *s)
+{
+    s->bsc.gen++;
+    g_free(s->bsc.extents);
+    s->bsc.extents = NULL;
+    s->bsc.nb_extents = 0;
+}
+
+/* Replace the cache with @nb_extents extents starting at @offset */
+static void nbd_bsc_store(BDRVNBDState *s, uint64_t offset,
+                          NBDExtent *extents, unsigned int nb_extents)
+{
+    uint64_t start = offset;
+    unsigned int i;
+
+    nbd_bsc_invalidate(s);
+    s->bsc.extents = g_new(NBDCachedExtent, nb_extents);
+    for (i = 0; i < nb_extents; i++) {
+        s->bsc.extents[i] = (NBDCachedExtent) {
+            .offset = offset,
+            .length = extents[i].length,
+            .flags = extents[i].flags,
+        };
+        offset += extents[i].length;
+    }
+    s->bsc.nb_extents = nb_extents;
+    trace_nbd_bsc_store(start, offset - start, nb_extents);
+}
+
+/* Look up the cached extent that contains @offset */
+static NBDCachedExtent *nbd_bsc_lookup(BDRVNBDState *s, uint64_t offset)
 {
-    return qatomic_load_acquire(&s->state) == NBD_CLIENT_CONNECTED;
+    unsigned int lo = 0, hi = s->bsc.nb_extents;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        NBDCachedExtent *extent = &s->bsc.extents[mid];
+
+        if (offset < extent->offset) {
+            hi = mid;
+        } else if (offset - extent->offset >= extent->length) {
+            lo = mid + 1;
+        } else {
+            return extent;
+        }
+    }
+    return NULL;
 }
 
-static void nbd_channel_error(BDRVNBDState *s, int ret)
+static bool nbd_client_connected(NBDConnState *cs)
+{
+    return qatomic_load_acquire(&cs->state) == NBD_CLIENT_CONNECTED;
+}
+
+static void nbd_channel_error(NBDConnState *cs, int ret)
 {
     if (ret == -EIO) {
-        if (nbd_client_connected(s)) {
-            s->state = s->reconnect_delay ? NBD_CLIENT_CONNECTING_WAIT :
-                                            NBD_CLIENT_CONNECTING_NOWAIT;
+        if (nbd_client_connected(cs)) {
+            cs->state = cs->s->reconnect_delay ? NBD_CLIENT_CONNECTING_WAIT :
+                                                 NBD_CLIENT_CONNECTING_NOWAIT;
         }
     } else {
-        if (nbd_client_connected(s)) {
-            qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        if (nbd_client_connected(cs)) {
+            qio_channel_shutdown(cs->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
         }
-        s->state = NBD_CLIENT_QUIT;
+        cs->state = NBD_CLIENT_QUIT;
     }
 }
 
-static void nbd_recv_coroutines_wake_all(BDRVNBDState *s)
+static void nbd_recv_coroutines_wake_all(NBDConnState *cs)
 {
     int i;
 
     for (i = 0; i < MAX_NBD_REQUESTS; i++) {
-        NBDClientRequest *req = &s->requests[i];
+        NBDClientRequest *req = &cs->requests[i];
 
         if (req->coroutine && req->receiving) {
             req->receiving = false;
@@ -156,55 +262,61 @@ static void nbd_recv_coroutines_wake_all(BDRVNBDState *s)
     }
 }
 
-static void reconnect_delay_timer_del(BDRVNBDState *s)
+static void reconnect_delay_timer_del(NBDConnState *cs)
 {
-    if (s->reconnect_delay_timer) {
-        timer_free(s->reconnect_delay_timer);
-        s->reconnect_delay_timer = NULL;
+    if (cs->reconnect_delay_timer) {
+        timer_free(cs->reconnect_delay_timer);
+        cs->reconnect_delay_timer = NULL;
     }
 }
 
 static void reconnect_delay_timer_cb(void *opaque)
 {
-    BDRVNBDState *s = opaque;
+    NBDConnState *cs = opaque;
 
-    if (qatomic_load_acquire(&s->state) == NBD_CLIENT_CONNECTING_WAIT) {
-        s->state = NBD_CLIENT_CONNECTING_NOWAIT;
-        while (qemu_co_enter_next(&s->free_sema, NULL)) {
+    if (qatomic_load_acquire(&cs->state) == NBD_CLIENT_CONNECTING_WAIT) {
+        cs->state = NBD_CLIENT_CONNECTING_NOWAIT;
+        while (qemu_co_enter_next(&cs->free_sema, NULL)) {
             /* Resume all queued requests */
         }
     }
 
-    reconnect_delay_timer_del(s);
+    reconnect_delay_timer_del(cs);
 }
 
-static void reconnect_delay_timer_init(BDRVNBDState *s, uint64_t expire_time_ns)
+static void reconnect_delay_timer_init(NBDConnState *cs,
+                                       uint64_t expire_time_ns)
 {
-    if (qatomic_load_acquire(&s->state) != NBD_CLIENT_CONNECTING_WAIT) {
+    if (qatomic_load_acquire(&cs->state) != NBD_CLIENT_CONNECTING_WAIT) {
         return;
     }
 
-    assert(!s->reconnect_delay_timer);
-    s->reconnect_delay_timer = aio_timer_new(bdrv_get_aio_context(s->bs),
-                                             QEMU_CLOCK_REALTIME,
-                                             SCALE_NS,
-                                             reconnect_delay_timer_cb, s);
-    timer_mod(s->reconnect_delay_timer, expire_time_ns);
+    assert(!cs->reconnect_delay_timer);
+    cs->reconnect_delay_timer = aio_timer_new(bdrv_get_aio_context(cs->s->bs),
+                                              QEMU_CLOCK_REALTIME,
+                                              SCALE_NS,
+                                              reconnect_delay_timer_cb, cs);
+    timer_mod(cs->reconnect_delay_timer, expire_time_ns);
 }
 
 static void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    uint32_t i;
 
-    /* Timer is deleted in nbd_client_co_drain_begin() */
-    assert(!s->reconnect_delay_timer);
-    /*
-     * If reconnect is in progress we may have no ->ioc.  It will be
-     * re-instantiated in the proper aio context once the connection is
-     * reestablished.
-     */
-    if (s->ioc) {
-        qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
+    for (i = 0; i < s->multi_conn; i++) {
+        NBDConnState *cs = s->conns[i];
+
+        /* Timer is deleted in nbd_client_co_drain_begin() */
+        assert(!cs->reconnect_delay_timer);
+        /*
+         * If reconnect is in progress we may have no ->ioc.  It will be
+         * re-instantiated in the proper aio context once the connection is
+         * reestablished.
+         */
+        if (cs->ioc) {
+            qio_channel_detach_aio_context(QIO_CHANNEL(cs->ioc));
+        }
     }
 }
 
@@ -212,15 +324,20 @@ static void nbd_client_attach_aio_context_bh(void *opaque)
 {
     BlockDriverState *bs = opaque;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    uint32_t i;
 
-    if (s->connection_co) {
-        /*
-         * The node is still drained, so we know the coroutine has yielded in
-         * nbd_read_eof(), the only place where bs->in_flight can reach 0, or
-         * it is entered for the first time. Both places are safe for entering
-         * the coroutine.
-         */
-        qemu_aio_coroutine_enter(bs->aio_context, s->connection_co);
+    for (i = 0; i < s->multi_conn; i++) {
+        NBDConnState *cs = s->conns[i];
+
+        if (cs->connection_co) {
+            /*
+             * The node is still drained, so we know the coroutine has yielded
+             * in nbd_read_eof(), the only place where bs->in_flight can reach
+             * 0, or it is entered for the first time. Both places are safe for
+             * entering the coroutine.
+             */
+            qemu_aio_coroutine_enter(bs->aio_context, cs->connection_co);
+        }
     }
     bdrv_dec_in_flight(bs);
 }
@@ -229,13 +346,18 @@ static void nbd_client_attach_aio_context(BlockDriverState *bs,
                                           AioContext *new_context)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    uint32_t i;
 
     /*
-     * s->connection_co is either yielded from nbd_receive_reply or from
+     * cs->connection_co is either yielded from nbd_receive_reply or from
      * nbd_co_reconnect_loop()
      */
-    if (nbd_client_connected(s)) {
-        qio_channel_attach_aio_context(QIO_CHANNEL(s->ioc), new_context);
+    for (i = 0; i < s->multi_conn; i++) {
+        NBDConnState *cs = s->conns[i];
+
+        if (nbd_client_connected(cs)) {
+            qio_channel_attach_aio_context(QIO_CHANNEL(cs->ioc), new_context);
+        }
     }
 
     bdrv_inc_in_flight(bs);
@@ -250,28 +372,38 @@ static void nbd_client_attach_aio_context(BlockDriverState *bs,
 static void coroutine_fn nbd_client_co_drain_begin(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    uint32_t i;
 
     s->drained = true;
-    qemu_co_sleep_wake(&s->reconnect_sleep);
+    for (i = 0; i < s->multi_conn; i++) {
+        NBDConnState *cs = s->conns[i];
+
+        qemu_co_sleep_wake(&cs->reconnect_sleep);
 
-    nbd_co_establish_connection_cancel(s->conn);
+        nbd_co_establish_connection_cancel(cs->conn);
 
-    reconnect_delay_timer_del(s);
+        reconnect_delay_timer_del(cs);
 
-    if (qatomic_load_acquire(&s->state) == NBD_CLIENT_CONNECTING_WAIT) {
-        s->state = NBD_CLIENT_CONNECTING_NOWAIT;
-        qemu_co_queue_restart_all(&s->free_sema);
+        if (qatomic_load_acquire(&cs->state) == NBD_CLIENT_CONNECTING_WAIT) {
+            cs->state = NBD_CLIENT_CONNECTING_NOWAIT;
+            qemu_co_queue_restart_all(&cs->free_sema);
+        }
     }
 }
 
 static void coroutine_fn nbd_client_co_drain_end(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    uint32_t i;
 
     s->drained = false;
-    if (s->wait_drained_end) {
-        s->wait_drained_end = false;
-        aio_co_wake(s->connection_co);
+    for (i = 0; i < s->multi_conn; i++) {
+        NBDConnState *cs = s->conns[i];
+
+        if (cs->wait_drained_end) {
+            cs->wait_drained_end = false;
+            aio_co_wake(cs->connection_co);
+        }
     }
 }
 
@@ -279,52 +411,72 @@ static void coroutine_fn nbd_client_co_drain_end(BlockDriverState *bs)
 static void nbd_teardown_connection(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    uint32_t i;
 
-    if (s->ioc) {
-        /* finish any pending coroutines */
-        qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
-    }
+    for (i = 0; i < s->multi_conn; i++) {
+        NBDConnState *cs = s->conns[i];
 
-    s->state = NBD_CLIENT_QUIT;
-    if (s->connection_co) {
-        qemu_co_sleep_wake(&s->reconnect_sleep);
-        nbd_co_establish_connection_cancel(s->conn);
+        if (cs->ioc) {
+            /* finish any pending coroutines */
+            qio_channel_shutdown(cs->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        }
+
+        cs->state = NBD_CLIENT_QUIT;
+        if (cs->connection_co) {
+            qemu_co_sleep_wake(&cs->reconnect_sleep);
+            nbd_co_establish_connection_cancel(cs->conn);
+        }
     }
-    if (qemu_in_coroutine()) {
-        s->teardown_co = qemu_coroutine_self();
-        /* connection_co resumes us when it terminates */
-        qemu_coroutine_yield();
-        s->teardown_co = NULL;
-    } else {
-        BDRV_POLL_WHILE(bs, s->connection_co);
+    for (i = 0; i < s->multi_conn; i++) {
+        NBDConnState *cs = s->conns[i];
+
+        if (qemu_in_coroutine()) {
+            if (cs->connection_co) {
+                cs->teardown_co = qemu_coroutine_self();
+                /* connection_co resumes us when it terminates */
+                qemu_coroutine_yield();
+                cs->teardown_co = NULL;
+            }
+        } else {
+            BDRV_POLL_WHILE(bs, cs->connection_co);
+        }
+        assert(!cs->connection_co);
     }
-    assert(!s->connection_co);
 }
 
-static bool nbd_client_connecting(BDRVNBDState *s)
+static bool nbd_client_connecting(NBDConnState *cs)
 {
-    NBDClientState state = qatomic_load_acquire(&s->state);
+    NBDClientState state = qatomic_load_acquire(&cs->state);
     return state == NBD_CLIENT_CONNECTING_WAIT ||
         state == NBD_CLIENT_CONNECTING_NOWAIT;
 }
 
-static bool nbd_client_connecting_wait(BDRVNBDState *s)
+static bool nbd_client_connecting_wait(NBDConnState *cs)
 {
-    return qatomic_load_acquire(&s->state) == NBD_CLIENT_CONNECTING_WAIT;
+    return qatomic_load_acquire(&cs->state) == NBD_CLIENT_CONNECTING_WAIT;
 }
 
 /*
- * Update @bs with information learned during a completed negotiation process.
- * Return failure if the server's advertised options are incompatible with the
- * client's needs.
+ * Update @bs with information learned during a completed negotiation process
+ * on @cs.  Return failure if the server's advertised options are incompatible
+ * with the client's needs.
  */
-static int nbd_handle_updated_info(BlockDriverState *bs, Error **errp)
+static int nbd_handle_updated_info(NBDConnState *cs, Error **errp)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = cs->s;
+    BlockDriverState *bs = s->bs;
+    NBDConnState *first = s->conns[0];
     int ret;
 
+    if (cs != first && (cs->info.size != first->info.size ||
+                        cs->info.flags != first->info.flags)) {
+        error_setg(errp, "Server exports a different image on a new "
+                   "connection");
+        return -EINVAL;
+    }
+
     if (s->x_dirty_bitmap) {
-        if (!s->info.base_allocation) {
+        if (!cs->info.base_allocation) {
             error_setg(errp, "requested x-dirty-bitmap %s not found",
                        s->x_dirty_bitmap);
             return -EINVAL;
@@ -334,21 +486,21 @@ static int nbd_handle_updated_info(BlockDriverState *bs, Error **errp)
         }
     }
 
-    if (s->info.flags & NBD_FLAG_READ_ONLY) {
+    if (cs->info.flags & NBD_FLAG_READ_ONLY) {
         ret = bdrv_apply_auto_read_only(bs, "NBD export is read-only", errp);
         if (ret < 0) {
             return ret;
         }
     }
 
-    if (s->info.flags & NBD_FLAG_SEND_FUA) {
+    if (cs->info.flags & NBD_FLAG_SEND_FUA) {
         bs->supported_write_flags = BDRV_REQ_FUA;
         bs->supported_zero_flags |= BDRV_REQ_FUA;
     }
 
-    if (s->info.flags & NBD_FLAG_SEND_WRITE_ZEROES) {
+    if (cs->info.flags & NBD_FLAG_SEND_WRITE_ZEROES) {
         bs->supported_zero_flags |= BDRV_REQ_MAY_UNMAP;
-        if (s->info.flags & NBD_FLAG_SEND_FAST_ZERO) {
+        if (cs->info.flags & NBD_FLAG_SEND_FAST_ZERO) {
             bs->supported_zero_flags |= BDRV_REQ_NO_FALLBACK;
         }
     }
@@ -358,23 +510,32 @@ static int nbd_handle_updated_info(BlockDriverState *bs, Error **errp)
     return 0;
 }
 
-int coroutine_fn nbd_co_do_establish_connection(BlockDriverState *bs,
-                                                Error **errp)
+/* Drop the channel of @cs while nobody is using it */
+static void nbd_conn_release_channel(NBDConnState *cs)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    qio_channel_detach_aio_context(QIO_CHANNEL(cs->ioc));
+    yank_unregister_function(BLOCKDEV_YANK_INSTANCE(cs->s->bs->node_name),
+                             nbd_yank, cs);
+    object_unref(OBJECT(cs->ioc));
+    cs->ioc = NULL;
+}
+
+static int coroutine_fn nbd_co_establish_conn(NBDConnState *cs, Error **errp)
+{
+    BlockDriverState *bs = cs->s->bs;
     int ret;
 
-    assert(!s->ioc);
+    assert(!cs->ioc);
 
-    s->ioc = nbd_co_establish_connection(s->conn, &s->info, true, errp);
-    if (!s->ioc) {
+    cs->ioc = nbd_co_establish_connection(cs->conn, &cs->info, true, errp);
+    if (!cs->ioc) {
         return -ECONNREFUSED;
     }
 
-    yank_register_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name), nbd_yank,
-                           bs);
+    yank_register_function(BLOCKDEV_YANK_INSTANCE(bs->node_name), nbd_yank,
+                           cs);
 
-    ret = nbd_handle_updated_info(s->bs, NULL);
+    ret = nbd_handle_updated_info(cs, errp);
     if (ret < 0) {
         /*
          * We have connected, but must fail for other reasons.
@@ -382,48 +543,89 @@ int coroutine_fn nbd_co_do_establish_connection(BlockDriverState *bs,
          */
         NBDRequest request = { .type = NBD_CMD_DISC };
 
-        nbd_send_request(s->ioc, &request);
+        nbd_send_request(cs->ioc, &request);
 
-        yank_unregister_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name),
-                                 nbd_yank, bs);
-        object_unref(OBJECT(s->ioc));
-        s->ioc = NULL;
+        yank_unregister_function(BLOCKDEV_YANK_INSTANCE(bs->node_name),
+                                 nbd_yank, cs);
+        object_unref(OBJECT(cs->ioc));
+        cs->ioc = NULL;
 
         return ret;
     }
 
-    qio_channel_set_blocking(s->ioc, false, NULL);
-    qio_channel_attach_aio_context(s->ioc, bdrv_get_aio_context(bs));
+    qio_channel_set_blocking(cs->ioc, false, NULL);
+    qio_channel_attach_aio_context(cs->ioc, bdrv_get_aio_context(bs));
+
+    /* The image may have changed while we were disconnected */
+    nbd_bsc_invalidate(cs->s);
 
     /* successfully connected */
-    s->state = NBD_CLIENT_CONNECTED;
-    qemu_co_queue_restart_all(&s->free_sema);
+    cs->state = NBD_CLIENT_CONNECTED;
+    qemu_co_queue_restart_all(&cs->free_sema);
 
     return 0;
 }
 
-static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
+/*
+ * Connect all connections of @bs.  The first one tells whether the server
+ * allows more than one; if it does not, only the first one is kept.
+ */
+int coroutine_fn nbd_co_do_establish_connection(BlockDriverState *bs,
+                                                Error **errp)
 {
-    if (!nbd_client_connecting(s)) {
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDRequest request = { .type = NBD_CMD_DISC };
+    uint32_t i;
+    int ret;
+
+    ret = nbd_co_establish_conn(s->conns[0], errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (s->multi_conn > 1 &&
+        !(s->conns[0]->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        trace_nbd_client_multi_conn_unsupported(s->export, s->multi_conn);
+        nbd_free_conns(s, 1);
+    }
+
+    for (i = 1; i < s->multi_conn; i++) {
+        ret = nbd_co_establish_conn(s->conns[i], errp);
+        if (ret < 0) {
+            while (i-- > 0) {
+                nbd_send_request(s->conns[i]->ioc, &request);
+                nbd_conn_release_channel(s->conns[i]);
+                s->conns[i]->state = NBD_CLIENT_QUIT;
+            }
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static coroutine_fn void nbd_reconnect_attempt(NBDConnState *cs)
+{
+    if (!nbd_client_connecting(cs)) {
         return;
     }
 
     /* Wait for completion of all in-flight requests */
 
-    qemu_co_mutex_lock(&s->send_mutex);
+    qemu_co_mutex_lock(&cs->send_mutex);
 
-    while (s->in_flight > 0) {
-        qemu_co_mutex_unlock(&s->send_mutex);
-        nbd_recv_coroutines_wake_all(s);
-        s->wait_in_flight = true;
+    while (cs->in_flight > 0) {
+        qemu_co_mutex_unlock(&cs->send_mutex);
+        nbd_recv_coroutines_wake_all(cs);
+        cs->wait_in_flight = true;
         qemu_coroutine_yield();
-        s->wait_in_flight = false;
-        qemu_co_mutex_lock(&s->send_mutex);
+        cs->wait_in_flight = false;
+        qemu_co_mutex_lock(&cs->send_mutex);
     }
 
-    qemu_co_mutex_unlock(&s->send_mutex);
+    qemu_co_mutex_unlock(&cs->send_mutex);
 
-    if (!nbd_client_connecting(s)) {
+    if (!nbd_client_connecting(cs)) {
         return;
     }
 
@@ -433,45 +635,43 @@ static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
      */
 
     /* Finalize previous connection if any */
-    if (s->ioc) {
-        qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
-        yank_unregister_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name),
-                                 nbd_yank, s->bs);
-        object_unref(OBJECT(s->ioc));
-        s->ioc = NULL;
+    if (cs->ioc) {
+        nbd_conn_release_channel(cs);
     }
 
-    nbd_co_do_establish_connection(s->bs, NULL);
+    nbd_co_establish_conn(cs, NULL);
 }
 
-static coroutine_fn void nbd_co_reconnect_loop(BDRVNBDState *s)
+static coroutine_fn void nbd_co_reconnect_loop(NBDConnState *cs)
 {
     uint64_t timeout = 1 * NANOSECONDS_PER_SECOND;
     uint64_t max_timeout = 16 * NANOSECONDS_PER_SECOND;
 
-    if (qatomic_load_acquire(&s->state) == NBD_CLIENT_CONNECTING_WAIT) {
-        reconnect_delay_timer_init(s, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
-                                   s->reconnect_delay * NANOSECONDS_PER_SECOND);
+    if (qatomic_load_acquire(&cs->state) == NBD_CLIENT_CONNECTING_WAIT) {
+        uint64_t delay = cs->s->reconnect_delay * NANOSECONDS_PER_SECOND;
+
+        reconnect_delay_timer_init(cs, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                                   delay);
     }
 
-    nbd_reconnect_attempt(s);
+    nbd_reconnect_attempt(cs);
 
-    while (nbd_client_connecting(s)) {
-        if (s->drained) {
-            bdrv_dec_in_flight(s->bs);
-            s->wait_drained_end = true;
-            while (s->drained) {
+    while (nbd_client_connecting(cs)) {
+        if (cs->s->drained) {
+            bdrv_dec_in_flight(cs->s->bs);
+            cs->wait_drained_end = true;
+            while (cs->s->drained) {
                 /*
                  * We may be entered once from nbd_client_attach_aio_context_bh
                  * and then from nbd_client_co_drain_end. So here is a loop.
                  */
                 qemu_coroutine_yield();
             }
-            bdrv_inc_in_flight(s->bs);
+            bdrv_inc_in_flight(cs->s->bs);
         } else {
-            qemu_co_sleep_ns_wakeable(&s->reconnect_sleep,
+            qemu_co_sleep_ns_wakeable(&cs->reconnect_sleep,
                                       QEMU_CLOCK_REALTIME, timeout);
-            if (s->drained) {
+            if (cs->s->drained) {
                 continue;
             }
             if (timeout < max_timeout) {
@@ -479,20 +679,20 @@ static coroutine_fn void nbd_co_reconnect_loop(BDRVNBDState *s)
             }
         }
 
-        nbd_reconnect_attempt(s);
+        nbd_reconnect_attempt(cs);
     }
 
-    reconnect_delay_timer_del(s);
+    reconnect_delay_timer_del(cs);
 }
 
 static coroutine_fn void nbd_connection_entry(void *opaque)
 {
-    BDRVNBDState *s = opaque;
+    NBDConnState *cs = opaque;
     uint64_t i;
     int ret = 0;
     Error *local_err = NULL;
 
-    while (qatomic_load_acquire(&s->state) != NBD_CLIENT_QUIT) {
+    while (qatomic_load_acquire(&cs->state) != NBD_CLIENT_QUIT) {
         /*
          * The NBD client can only really be considered idle when it has
          * yielded from qio_channel_readv_all_eof(), waiting for data. This is
@@ -503,16 +703,16 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
          * only drop it temporarily here.
          */
 
-        if (nbd_client_connecting(s)) {
-            nbd_co_reconnect_loop(s);
+        if (nbd_client_connecting(cs)) {
+            nbd_co_reconnect_loop(cs);
         }
 
-        if (!nbd_client_connected(s)) {
+        if (!nbd_client_connected(cs)) {
             continue;
         }
 
-        assert(s->reply.handle == 0);
-        ret = nbd_receive_reply(s->bs, s->ioc, &s->reply, &local_err);
+        assert(cs->reply.handle == 0);
+        ret = nbd_receive_reply(cs->s->bs, cs->ioc, &cs->reply, &local_err);
 
         if (local_err) {
             trace_nbd_read_reply_entry_fail(ret, error_get_pretty(local_err));
@@ -520,7 +720,7 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
             local_err = NULL;
         }
         if (ret <= 0) {
-            nbd_channel_error(s, ret ? ret : -EIO);
+            nbd_channel_error(cs, ret ? ret : -EIO);
             continue;
         }
 
@@ -529,13 +729,13 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
          * handler acts as a synchronization point and ensures that only
          * one coroutine is called until the reply finishes.
          */
-        i = HANDLE_TO_INDEX(s, s->reply.handle);
+        i = HANDLE_TO_INDEX(cs, cs->reply.handle);
         if (i >= MAX_NBD_REQUESTS ||
-            !s->requests[i].coroutine ||
-            !s->requests[i].receiving ||
-            (nbd_reply_is_structured(&s->reply) && !s->info.structured_reply))
+            !cs->requests[i].coroutine ||
+            !cs->requests[i].receiving ||
+            (nbd_reply_is_structured(&cs->reply) && !cs->info.structured_reply))
         {
-            nbd_channel_error(s, -EINVAL);
+            nbd_channel_error(cs, -EINVAL);
             continue;
         }
 
@@ -551,51 +751,47 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
          *   connection_co happens through a bottom half, which can only
          *   run after we yield.
          */
-        s->requests[i].receiving = false;
-        aio_co_wake(s->requests[i].coroutine);
+        cs->requests[i].receiving = false;
+        aio_co_wake(cs->requests[i].coroutine);
         qemu_coroutine_yield();
     }
 
-    qemu_co_queue_restart_all(&s->free_sema);
-    nbd_recv_coroutines_wake_all(s);
-    bdrv_dec_in_flight(s->bs);
+    qemu_co_queue_restart_all(&cs->free_sema);
+    nbd_recv_coroutines_wake_all(cs);
+    bdrv_dec_in_flight(cs->s->bs);
 
-    s->connection_co = NULL;
-    if (s->ioc) {
-        qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
-        yank_unregister_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name),
-                                 nbd_yank, s->bs);
-        object_unref(OBJECT(s->ioc));
-        s->ioc = NULL;
+    cs->connection_co = NULL;
+    if (cs->ioc) {
+        nbd_conn_release_channel(cs);
     }
 
-    if (s->teardown_co) {
-        aio_co_wake(s->teardown_co);
+    if (cs->teardown_co) {
+        aio_co_wake(cs->teardown_co);
     }
     aio_wait_kick();
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+static int nbd_co_send_request(NBDConnState *cs,
                                NBDRequest *request,
                                QEMUIOVector *qiov)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     int rc, i = -1;
 
-    qemu_co_mutex_lock(&s->send_mutex);
-    while (s->in_flight == MAX_NBD_REQUESTS || nbd_client_connecting_wait(s)) {
-        qemu_co_queue_wait(&s->free_sema, &s->send_mutex);
+    qemu_co_mutex_lock(&cs->send_mutex);
+    while (cs->in_flight == MAX_NBD_REQUESTS ||
+           nbd_client_connecting_wait(cs)) {
+        qemu_co_queue_wait(&cs->free_sema, &cs->send_mutex);
     }
 
-    if (!nbd_client_connected(s)) {
+    if (!nbd_client_connected(cs)) {
         rc = -EIO;
         goto err;
     }
 
-    s->in_flight++;
+    cs->in_flight++;
 
     for (i = 0; i < MAX_NBD_REQUESTS; i++) {
-        if (s->requests[i].coroutine == NULL) {
+        if (cs->requests[i].coroutine == NULL) {
             break;
         }
     }
@@ -603,44 +799,47 @@ static int nbd_co_send_request(BlockDriverState *bs,
     g_assert(qemu_in_coroutine());
     assert(i < MAX_NBD_REQUESTS);
 
-    s->requests[i].coroutine = qemu_coroutine_self();
-    s->requests[i].offset = request->from;
-    s->requests[i].receiving = false;
+    cs->requests[i].coroutine = qemu_coroutine_self();
+    cs->requests[i].offset = request->from;
+    cs->requests[i].receiving = false;
 
-    request->handle = INDEX_TO_HANDLE(s, i);
+    request->handle = INDEX_TO_HANDLE(cs, i);
 
-    assert(s->ioc);
+    assert(cs->ioc);
 
     if (qiov) {
-        qio_channel_set_cork(s->ioc, true);
-        rc = nbd_send_request(s->ioc, request);
-        if (nbd_client_connected(s) && rc >= 0) {
-            if (qio_channel_writev_all(s->ioc, qiov->iov, qiov->niov,
+        /* Send the header and the payload with a single writev */
+        qio_channel_queue_writes(cs->ioc);
+        rc = nbd_send_request(cs->ioc, request);
+        if (nbd_client_connected(cs) && rc >= 0) {
+            if (qio_channel_writev_all(cs->ioc, qiov->iov, qiov->niov,
                                        NULL) < 0) {
                 rc = -EIO;
             }
         } else if (rc >= 0) {
             rc = -EIO;
         }
-        qio_channel_set_cork(s->ioc, false);
+        if (qio_channel_flush_queued_writes(cs->ioc, NULL) < 0 && rc >= 0) {
+            rc = -EIO;
+        }
     } else {
-        rc = nbd_send_request(s->ioc, request);
+        rc = nbd_send_request(cs->ioc, request);
     }
 
 err:
     if (rc < 0) {
-        nbd_channel_error(s, rc);
+        nbd_channel_error(cs, rc);
         if (i != -1) {
-            s->requests[i].coroutine = NULL;
-            s->in_flight--;
+            cs->requests[i].coroutine = NULL;
+            cs->in_flight--;
         }
-        if (s->in_flight == 0 && s->wait_in_flight) {
-            aio_co_wake(s->connection_co);
+        if (cs->in_flight == 0 && cs->wait_in_flight) {
+            aio_co_wake(cs->connection_co);
         } else {
-            qemu_co_queue_next(&s->free_sema);
+            qemu_co_queue_next(&cs->free_sema);
         }
     }
-    qemu_co_mutex_unlock(&s->send_mutex);
+    qemu_co_mutex_unlock(&cs->send_mutex);
     return rc;
 }
 
@@ -662,7 +861,7 @@ static inline uint64_t payload_advance64(uint8_t **payload)
     return ldq_be_p(*payload - 8);
 }
 
-static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
+static int nbd_parse_offset_hole_payload(NBDConnState *cs,
                                          NBDStructuredReplyChunk *chunk,
                                          uint8_t *payload, uint64_t orig_offset,
                                          QEMUIOVector *qiov, Error **errp)
@@ -685,8 +884,8 @@ static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
                          " region");
         return -EINVAL;
     }
-    if (s->info.min_block &&
-        !QEMU_IS_ALIGNED(hole_size, s->info.min_block)) {
+    if (cs->info.min_block &&
+        !QEMU_IS_ALIGNED(hole_size, cs->info.min_block)) {
         trace_nbd_structured_read_compliance("hole");
     }
 
@@ -697,91 +896,112 @@ static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
 
 /*
  * nbd_parse_blockstatus_payload
- * Based on our request, we expect only one extent in reply, for the
- * base:allocation context.
+ * Parse up to @max_extents extents for the base:allocation context from a
+ * reply to a request of @orig_length bytes.  With @max_extents == 1, we
+ * sent NBD_CMD_FLAG_REQ_ONE and expect only one extent.
  */
-static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
+static int nbd_parse_blockstatus_payload(NBDConnState *cs,
                                          NBDStructuredReplyChunk *chunk,
                                          uint8_t *payload, uint64_t orig_length,
-                                         NBDExtent *extent, Error **errp)
+                                         NBDExtent *extents,
+                                         unsigned int *nb_extents,
+                                         unsigned int max_extents,
+                                         Error **errp)
 {
     uint32_t context_id;
+    uint64_t total = 0;
+    unsigned int count, i;
+    bool unaligned = false;
 
     /* The server succeeded, so it must have sent [at least] one extent */
-    if (chunk->length < sizeof(context_id) + sizeof(*extent)) {
+    if (chunk->length < sizeof(context_id) + sizeof(*extents)) {
         error_setg(errp, "Protocol error: invalid payload for "
                          "NBD_REPLY_TYPE_BLOCK_STATUS");
         return -EINVAL;
     }
 
     context_id = payload_advance32(&payload);
-    if (s->info.context_id != context_id) {
+    if (cs->info.context_id != context_id) {
         error_setg(errp, "Protocol error: unexpected context id %d for "
                          "NBD_REPLY_TYPE_BLOCK_STATUS, when negotiated context "
                          "id is %d", context_id,
-                         s->info.context_id);
+                         cs->info.context_id);
         return -EINVAL;
     }
 
-    extent->length = payload_advance32(&payload);
-    extent->flags = payload_advance32(&payload);
-
-    if (extent->length == 0) {
-        error_setg(errp, "Protocol error: server sent status chunk with "
-                   "zero length");
-        return -EINVAL;
-    }
-
-    /*
-     * A server sending unaligned block status is in violation of the
-     * protocol, but as qemu-nbd 3.1 is such a server (at least for
-     * POSIX files that are not a multiple of 512 bytes, since qemu
-     * rounds files up to 512-byte multiples but lseek(SEEK_HOLE)
-     * still sees an implicit hole beyond the real EOF), it's nicer to
-     * work around the misbehaving server. If the request included
-     * more than the final unaligned block, truncate it back to an
-     * aligned result; if the request was only the final block, round
-     * up to the full block and change the status to fully-allocated
-     * (always a safe status, even if it loses information).
-     */
-    if (s->info.min_block && !QEMU_IS_ALIGNED(extent->length,
-                                                   s->info.min_block)) {
-        trace_nbd_parse_blockstatus_compliance("extent length is unaligned");
-        if (extent->length > s->info.min_block) {
-            extent->length = QEMU_ALIGN_DOWN(extent->length,
-                                             s->info.min_block);
-        } else {
-            extent->length = s->info.min_block;
-            extent->flags = 0;
-        }
-    }
-
     /*
-     * We used NBD_CMD_FLAG_REQ_ONE, so the server should not have
-     * sent us any more than one extent, nor should it have included
-     * status beyond our request in that extent. However, it's easy
-     * enough to ignore the server's noncompliance without killing the
-     * connection; just ignore trailing extents, and clamp things to
-     * the length of our request.
+     * With NBD_CMD_FLAG_REQ_ONE, the server should not have sent us any
+     * more than one extent, nor should it have included status beyond our
+     * request in that extent. However, it's easy enough to ignore the
+     * server's noncompliance without killing the connection; just ignore
+     * trailing extents, and clamp things to the length of our request.
      */
-    if (chunk->length > sizeof(context_id) + sizeof(*extent)) {
+    count = (chunk->length - sizeof(context_id)) / sizeof(*extents);
+    if (max_extents == 1 && count > 1) {
         trace_nbd_parse_blockstatus_compliance("more than one extent");
     }
-    if (extent->length > orig_length) {
-        extent->length = orig_length;
-        trace_nbd_parse_blockstatus_compliance("extent length too large");
-    }
+    count = MIN(count, max_extents);
 
-    /*
-     * HACK: if we are using x-dirty-bitmaps to access
-     * qemu:allocation-depth, treat all depths > 2 the same as 2,
-     * since nbd_client_co_block_status is only expecting the low two
-     * bits to be set.
-     */
-    if (s->alloc_depth && extent->flags > 2) {
-        extent->flags = 2;
+    for (i = 0; i < count && total < orig_length && !unaligned; i++) {
+        NBDExtent *extent = &extents[i];
+
+        extent->length = payload_advance32(&payload);
+        extent->flags = payload_advance32(&payload);
+
+        if (extent->length == 0) {
+            error_setg(errp, "Protocol error: server sent status chunk with "
+                       "zero length");
+            return -EINVAL;
+        }
+
+        /*
+         * A server sending unaligned block status is in violation of the
+         * protocol, but as qemu-nbd 3.1 is such a server (at least for
+         * POSIX files that are not a multiple of 512 bytes, since qemu
+         * rounds files up to 512-byte multiples but lseek(SEEK_HOLE)
+         * still sees an implicit hole beyond the real EOF), it's nicer to
+         * work around the misbehaving server. If the extent is more than
+         * the final unaligned block, truncate it back to an aligned
+         * result; if it was only the final block, round up to the full
+         * block and change the status to fully-allocated (always a safe
+         * status, even if it loses information).  Following extents would
+         * be misaligned, so drop them.
+         */
+        if (cs->info.min_block && !QEMU_IS_ALIGNED(extent->length,
+                                                   cs->info.min_block)) {
+            trace_nbd_parse_blockstatus_compliance("extent length is "
+                                                   "unaligned");
+            unaligned = true;
+            if (extent->length > cs->info.min_block) {
+                extent->length = QEMU_ALIGN_DOWN(extent->length,
+                                                 cs->info.min_block);
+            } else if (i == 0) {
+                extent->length = cs->info.min_block;
+                extent->flags = 0;
+            } else {
+                break;
+            }
+        }
+
+        if (extent->length > orig_length - total) {
+            extent->length = orig_length - total;
+            trace_nbd_parse_blockstatus_compliance("extent length too large");
+        }
+
+        /*
+         * HACK: if we are using x-dirty-bitmaps to access
+         * qemu:allocation-depth, treat all depths > 2 the same as 2,
+         * since nbd_client_co_block_status is only expecting the low two
+         * bits to be set.
+         */
+        if (cs->s->alloc_depth && extent->flags > 2) {
+            extent->flags = 2;
+        }
+
+        total += extent->length;
     }
 
+    *nb_extents = i;
     return 0;
 }
 
@@ -827,7 +1047,7 @@ static int nbd_parse_error_payload(NBDStructuredReplyChunk *chunk,
     return 0;
 }
 
-static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
+static int nbd_co_receive_offset_data_payload(NBDConnState *cs,
                                               uint64_t orig_offset,
                                               QEMUIOVector *qiov, Error **errp)
 {
@@ -835,9 +1055,9 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
     uint64_t offset;
     size_t data_size;
     int ret;
-    NBDStructuredReplyChunk *chunk = &s->reply.structured;
+    NBDStructuredReplyChunk *chunk = &cs->reply.structured;
 
-    assert(nbd_reply_is_structured(&s->reply));
+    assert(nbd_reply_is_structured(&cs->reply));
 
     /* The NBD spec requires at least one byte of payload */
     if (chunk->length <= sizeof(offset)) {
@@ -846,7 +1066,7 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
         return -EINVAL;
     }
 
-    if (nbd_read64(s->ioc, &offset, "OFFSET_DATA offset", errp) < 0) {
+    if (nbd_read64(cs->ioc, &offset, "OFFSET_DATA offset", errp) < 0) {
         return -EIO;
     }
 
@@ -858,28 +1078,30 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
                          " region");
         return -EINVAL;
     }
-    if (s->info.min_block && !QEMU_IS_ALIGNED(data_size, s->info.min_block)) {
+    if (cs->info.min_block && !QEMU_IS_ALIGNED(data_size, cs->info.min_block)) {
         trace_nbd_structured_read_compliance("data");
     }
 
     qemu_iovec_init(&sub_qiov, qiov->niov);
     qemu_iovec_concat(&sub_qiov, qiov, offset - orig_offset, data_size);
-    ret = qio_channel_readv_all(s->ioc, sub_qiov.iov, sub_qiov.niov, errp);
+    ret = qio_channel_readv_all(cs->ioc, sub_qiov.iov, sub_qiov.niov, errp);
     qemu_iovec_destroy(&sub_qiov);
 
     return ret < 0 ? -EIO : 0;
 }
 
 #define NBD_MAX_MALLOC_PAYLOAD 1000
+/* qemu-nbd sends up to 1 MiB of extents in one chunk */
+#define NBD_MAX_BLOCK_STATUS_PAYLOAD (sizeof(uint32_t) + 1 * MiB)
 static coroutine_fn int nbd_co_receive_structured_payload(
-        BDRVNBDState *s, void **payload, Error **errp)
+        NBDConnState *cs, void **payload, Error **errp)
 {
     int ret;
     uint32_t len;
 
-    assert(nbd_reply_is_structured(&s->reply));
+    assert(nbd_reply_is_structured(&cs->reply));
 
-    len = s->reply.structured.length;
+    len = cs->reply.structured.length;
 
     if (len == 0) {
         return 0;
@@ -890,13 +1112,15 @@ static coroutine_fn int nbd_co_receive_structured_payload(
         return -EINVAL;
     }
 
-    if (len > NBD_MAX_MALLOC_PAYLOAD) {
+    if (len > NBD_MAX_MALLOC_PAYLOAD &&
+        (cs->reply.structured.type != NBD_REPLY_TYPE_BLOCK_STATUS ||
+         len > NBD_MAX_BLOCK_STATUS_PAYLOAD)) {
         error_setg(errp, "Payload too large");
         return -EINVAL;
     }
 
     *payload = g_new(char, len);
-    ret = nbd_read(s->ioc, *payload, len, "structured payload", errp);
+    ret = nbd_read(cs->ioc, *payload, len, "structured payload", errp);
     if (ret < 0) {
         g_free(*payload);
         *payload = NULL;
@@ -922,11 +1146,11 @@ static coroutine_fn int nbd_co_receive_structured_payload(
  * corresponding to the server's error reply), and errp is unchanged.
  */
 static coroutine_fn int nbd_co_do_receive_one_chunk(
-        BDRVNBDState *s, uint64_t handle, bool only_structured,
+        NBDConnState *cs, uint64_t handle, bool only_structured,
         int *request_ret, QEMUIOVector *qiov, void **payload, Error **errp)
 {
     int ret;
-    int i = HANDLE_TO_INDEX(s, handle);
+    int i = HANDLE_TO_INDEX(cs, handle);
     void *local_payload = NULL;
     NBDStructuredReplyChunk *chunk;
 
@@ -936,36 +1160,36 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
     *request_ret = 0;
 
     /* Wait until we're woken up by nbd_connection_entry.  */
-    s->requests[i].receiving = true;
+    cs->requests[i].receiving = true;
     qemu_coroutine_yield();
-    assert(!s->requests[i].receiving);
-    if (!nbd_client_connected(s)) {
+    assert(!cs->requests[i].receiving);
+    if (!nbd_client_connected(cs)) {
         error_setg(errp, "Connection closed");
         return -EIO;
     }
-    assert(s->ioc);
+    assert(cs->ioc);
 
-    assert(s->reply.handle == handle);
+    assert(cs->reply.handle == handle);
 
-    if (nbd_reply_is_simple(&s->reply)) {
+    if (nbd_reply_is_simple(&cs->reply)) {
         if (only_structured) {
             error_setg(errp, "Protocol error: simple reply when structured "
                              "reply chunk was expected");
             return -EINVAL;
         }
 
-        *request_ret = -nbd_errno_to_system_errno(s->reply.simple.error);
+        *request_ret = -nbd_errno_to_system_errno(cs->reply.simple.error);
         if (*request_ret < 0 || !qiov) {
             return 0;
         }
 
-        return qio_channel_readv_all(s->ioc, qiov->iov, qiov->niov,
+        return qio_channel_readv_all(cs->ioc, qiov->iov, qiov->niov,
                                      errp) < 0 ? -EIO : 0;
     }
 
     /* handle structured reply chunk */
-    assert(s->info.structured_reply);
-    chunk = &s->reply.structured;
+    assert(cs->info.structured_reply);
+    chunk = &cs->reply.structured;
 
     if (chunk->type == NBD_REPLY_TYPE_NONE) {
         if (!(chunk->flags & NBD_REPLY_FLAG_DONE)) {
@@ -987,7 +1211,7 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
             return -EINVAL;
         }
 
-        return nbd_co_receive_offset_data_payload(s, s->requests[i].offset,
+        return nbd_co_receive_offset_data_payload(cs, cs->requests[i].offset,
                                                   qiov, errp);
     }
 
@@ -995,7 +1219,7 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
         payload = &local_payload;
     }
 
-    ret = nbd_co_receive_structured_payload(s, payload, errp);
+    ret = nbd_co_receive_structured_payload(cs, payload, errp);
     if (ret < 0) {
         return ret;
     }
@@ -1015,29 +1239,29 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
  * Return value is a fatal error code or normal nbd reply error code
  */
 static coroutine_fn int nbd_co_receive_one_chunk(
-        BDRVNBDState *s, uint64_t handle, bool only_structured,
+        NBDConnState *cs, uint64_t handle, bool only_structured,
         int *request_ret, QEMUIOVector *qiov, NBDReply *reply, void **payload,
         Error **errp)
 {
-    int ret = nbd_co_do_receive_one_chunk(s, handle, only_structured,
+    int ret = nbd_co_do_receive_one_chunk(cs, handle, only_structured,
                                           request_ret, qiov, payload, errp);
 
     if (ret < 0) {
         memset(reply, 0, sizeof(*reply));
-        nbd_channel_error(s, ret);
+        nbd_channel_error(cs, ret);
     } else {
         /* For assert at loop start in nbd_connection_entry */
-        *reply = s->reply;
+        *reply = cs->reply;
     }
-    s->reply.handle = 0;
+    cs->reply.handle = 0;
 
-    if (s->connection_co && !s->wait_in_flight) {
+    if (cs->connection_co && !cs->wait_in_flight) {
         /*
-         * We must check s->wait_in_flight, because we may entered by
+         * We must check cs->wait_in_flight, because we may entered by
          * nbd_recv_coroutines_wake_all(), in this case we should not
          * wake connection_co here, it will woken by last request.
          */
-        aio_co_wake(s->connection_co);
+        aio_co_wake(cs->connection_co);
     }
 
     return ret;
@@ -1079,16 +1303,16 @@ static void nbd_iter_request_error(NBDReplyChunkIter *iter, int ret)
  * NBD_FOREACH_REPLY_CHUNK
  * The pointer stored in @payload requires g_free() to free it.
  */
-#define NBD_FOREACH_REPLY_CHUNK(s, iter, handle, structured, \
+#define NBD_FOREACH_REPLY_CHUNK(cs, iter, handle, structured, \
                                 qiov, reply, payload) \
     for (iter = (NBDReplyChunkIter) { .only_structured = structured }; \
-         nbd_reply_chunk_iter_receive(s, &iter, handle, qiov, reply, payload);)
+         nbd_reply_chunk_iter_receive(cs, &iter, handle, qiov, reply, payload);)
 
 /*
  * nbd_reply_chunk_iter_receive
  * The pointer stored in @payload requires g_free() to free it.
  */
-static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
+static bool nbd_reply_chunk_iter_receive(NBDConnState *cs,
                                          NBDReplyChunkIter *iter,
                                          uint64_t handle,
                                          QEMUIOVector *qiov, NBDReply *reply,
@@ -1098,7 +1322,7 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
     NBDReply local_reply;
     NBDStructuredReplyChunk *chunk;
     Error *local_err = NULL;
-    if (!nbd_client_connected(s)) {
+    if (!nbd_client_connected(cs)) {
         error_setg(&local_err, "Connection closed");
         nbd_iter_channel_error(iter, -EIO, &local_err);
         goto break_loop;
@@ -1113,7 +1337,7 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
         reply = &local_reply;
     }
 
-    ret = nbd_co_receive_one_chunk(s, handle, iter->only_structured,
+    ret = nbd_co_receive_one_chunk(cs, handle, iter->only_structured,
                                    &request_ret, qiov, reply, payload,
                                    &local_err);
     if (ret < 0) {
@@ -1123,7 +1347,7 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
     }
 
     /* Do not execute the body of NBD_FOREACH_REPLY_CHUNK for simple reply. */
-    if (nbd_reply_is_simple(reply) || !nbd_client_connected(s)) {
+    if (nbd_reply_is_simple(reply) || !nbd_client_connected(cs)) {
         goto break_loop;
     }
 
@@ -1145,26 +1369,26 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
     return true;
 
 break_loop:
-    s->requests[HANDLE_TO_INDEX(s, handle)].coroutine = NULL;
+    cs->requests[HANDLE_TO_INDEX(cs, handle)].coroutine = NULL;
 
-    qemu_co_mutex_lock(&s->send_mutex);
-    s->in_flight--;
-    if (s->in_flight == 0 && s->wait_in_flight) {
-        aio_co_wake(s->connection_co);
+    qemu_co_mutex_lock(&cs->send_mutex);
+    cs->in_flight--;
+    if (cs->in_flight == 0 && cs->wait_in_flight) {
+        aio_co_wake(cs->connection_co);
     } else {
-        qemu_co_queue_next(&s->free_sema);
+        qemu_co_queue_next(&cs->free_sema);
     }
-    qemu_co_mutex_unlock(&s->send_mutex);
+    qemu_co_mutex_unlock(&cs->send_mutex);
 
     return false;
 }
 
-static int nbd_co_receive_return_code(BDRVNBDState *s, uint64_t handle,
+static int nbd_co_receive_return_code(NBDConnState *cs, uint64_t handle,
                                       int *request_ret, Error **errp)
 {
     NBDReplyChunkIter iter;
 
-    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, false, NULL, NULL, NULL) {
+    NBD_FOREACH_REPLY_CHUNK(cs, iter, handle, false, NULL, NULL, NULL) {
         /* nbd_reply_chunk_iter_receive does all the work */
     }
 
@@ -1173,7 +1397,7 @@ static int nbd_co_receive_return_code(BDRVNBDState *s, uint64_t handle,
     return iter.ret;
 }
 
-static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
+static int nbd_co_receive_cmdread_reply(NBDConnState *cs, uint64_t handle,
                                         uint64_t offset, QEMUIOVector *qiov,
                                         int *request_ret, Error **errp)
 {
@@ -1182,7 +1406,7 @@ static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
     void *payload = NULL;
     Error *local_err = NULL;
 
-    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, s->info.structured_reply,
+    NBD_FOREACH_REPLY_CHUNK(cs, iter, handle, cs->info.structured_reply,
                             qiov, &reply, &payload)
     {
         int ret;
@@ -1198,17 +1422,17 @@ static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
              */
             break;
         case NBD_REPLY_TYPE_OFFSET_HOLE:
-            ret = nbd_parse_offset_hole_payload(s, &reply.structured, payload,
+            ret = nbd_parse_offset_hole_payload(cs, &reply.structured, payload,
                                                 offset, qiov, &local_err);
             if (ret < 0) {
-                nbd_channel_error(s, ret);
+                nbd_channel_error(cs, ret);
                 nbd_iter_channel_error(&iter, ret, &local_err);
             }
             break;
         default:
             if (!nbd_reply_type_is_error(chunk->type)) {
                 /* not allowed reply type */
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(cs, -EINVAL);
                 error_setg(&local_err,
                            "Unexpected reply type: %d (%s) for CMD_READ",
                            chunk->type, nbd_reply_type_lookup(chunk->type));
@@ -1225,9 +1449,11 @@ static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
     return iter.ret;
 }
 
-static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
+static int nbd_co_receive_blockstatus_reply(NBDConnState *cs,
                                             uint64_t handle, uint64_t length,
-                                            NBDExtent *extent,
+                                            NBDExtent *extents,
+                                            unsigned int *nb_extents,
+                                            unsigned int max_extents,
                                             int *request_ret, Error **errp)
 {
     NBDReplyChunkIter iter;
@@ -1236,8 +1462,8 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
     Error *local_err = NULL;
     bool received = false;
 
-    assert(!extent->length);
-    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, false, NULL, &reply, &payload) {
+    *nb_extents = 0;
+    NBD_FOREACH_REPLY_CHUNK(cs, iter, handle, false, NULL, &reply, &payload) {
         int ret;
         NBDStructuredReplyChunk *chunk = &reply.structured;
 
@@ -1246,23 +1472,24 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
         switch (chunk->type) {
         case NBD_REPLY_TYPE_BLOCK_STATUS:
             if (received) {
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(cs, -EINVAL);
                 error_setg(&local_err, "Several BLOCK_STATUS chunks in reply");
                 nbd_iter_channel_error(&iter, -EINVAL, &local_err);
             }
             received = true;
 
-            ret = nbd_parse_blockstatus_payload(s, &reply.structured,
-                                                payload, length, extent,
+            ret = nbd_parse_blockstatus_payload(cs, &reply.structured,
+                                                payload, length, extents,
+                                                nb_extents, max_extents,
                                                 &local_err);
             if (ret < 0) {
-                nbd_channel_error(s, ret);
+                nbd_channel_error(cs, ret);
                 nbd_iter_channel_error(&iter, ret, &local_err);
             }
             break;
         default:
             if (!nbd_reply_type_is_error(chunk->type)) {
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(cs, -EINVAL);
                 error_setg(&local_err,
                            "Unexpected reply type: %d (%s) "
                            "for CMD_BLOCK_STATUS",
@@ -1275,7 +1502,7 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
         payload = NULL;
     }
 
-    if (!extent->length && !iter.request_ret) {
+    if (!*nb_extents && !iter.request_ret) {
         error_setg(&local_err, "Server did not reply with any status extents");
         nbd_iter_channel_error(&iter, -EIO, &local_err);
     }
@@ -1285,12 +1512,59 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
     return iter.ret;
 }
 
+/*
+ * Pick the connection for a new request: spread requests over the connected
+ * ones, or wait for a reconnecting one if none is connected.
+ */
+static NBDConnState *nbd_get_conn(BDRVNBDState *s)
+{
+    NBDConnState *cs;
+    uint32_t i;
+
+    for (i = 0; i < s->multi_conn; i++) {
+        cs = s->conns[s->next_conn++ % s->multi_conn];
+        if (nbd_client_connected(cs)) {
+            return cs;
+        }
+    }
+    for (i = 0; i < s->multi_conn; i++) {
+        if (nbd_client_connecting_wait(s->conns[i])) {
+            return s->conns[i];
+        }
+    }
+    return s->conns[0];
+}
+
+/* Whether a request that failed on @cs can be resent */
+static bool nbd_client_can_retry(NBDConnState *cs)
+{
+    BDRVNBDState *s = cs->s;
+    uint32_t i;
+
+    if (nbd_client_connecting_wait(cs)) {
+        return true;
+    }
+    if (!nbd_client_connecting(cs)) {
+        return false;
+    }
+    for (i = 0; i < s->multi_conn; i++) {
+        if (nbd_client_connected(s->conns[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
                           QEMUIOVector *write_qiov)
 {
     int ret, request_ret;
     Error *local_err = NULL;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs;
+    bool changes_status = request->type == NBD_CMD_WRITE ||
+                          request->type == NBD_CMD_WRITE_ZEROES ||
+                          request->type == NBD_CMD_TRIM;
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -1300,13 +1574,22 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
         assert(request->type != NBD_CMD_WRITE);
     }
 
+    /*
+     * Block status sent before the request completes may or may not see
+     * it, so drop the cache on both ends.
+     */
+    if (changes_status) {
+        nbd_bsc_invalidate(s);
+    }
+
     do {
-        ret = nbd_co_send_request(bs, request, write_qiov);
+        cs = nbd_get_conn(s);
+        ret = nbd_co_send_request(cs, request, write_qiov);
         if (ret < 0) {
             continue;
         }
 
-        ret = nbd_co_receive_return_code(s, request->handle,
+        ret = nbd_co_receive_return_code(cs, request->handle,
                                          &request_ret, &local_err);
         if (local_err) {
             trace_nbd_co_request_fail(request->from, request->len,
@@ -1317,7 +1600,11 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
             error_free(local_err);
             local_err = NULL;
         }
-    } while (ret < 0 && nbd_client_connecting_wait(s));
+    } while (ret < 0 && nbd_client_can_retry(cs));
+
+    if (changes_status) {
+        nbd_bsc_invalidate(s);
+    }
 
     return ret ? ret : request_ret;
 }
@@ -1328,6 +1615,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     int ret, request_ret;
     Error *local_err = NULL;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs;
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -1346,13 +1634,13 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
      * advertised size because the block layer rounded size up, then
      * truncate the request to the server and tail-pad with zero.
      */
-    if (offset >= s->info.size) {
+    if (offset >= s->conns[0]->info.size) {
         assert(bytes < BDRV_SECTOR_SIZE);
         qemu_iovec_memset(qiov, 0, 0, bytes);
         return 0;
     }
-    if (offset + bytes > s->info.size) {
-        uint64_t slop = offset + bytes - s->info.size;
+    if (offset + bytes > s->conns[0]->info.size) {
+        uint64_t slop = offset + bytes - s->conns[0]->info.size;
 
         assert(slop < BDRV_SECTOR_SIZE);
         qemu_iovec_memset(qiov, bytes - slop, 0, slop);
@@ -1360,12 +1648,13 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     }
 
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        cs = nbd_get_conn(s);
+        ret = nbd_co_send_request(cs, &request, NULL);
         if (ret < 0) {
             continue;
         }
 
-        ret = nbd_co_receive_cmdread_reply(s, request.handle, offset, qiov,
+        ret = nbd_co_receive_cmdread_reply(cs, request.handle, offset, qiov,
                                            &request_ret, &local_err);
         if (local_err) {
             trace_nbd_co_request_fail(request.from, request.len, request.handle,
@@ -1375,7 +1664,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
             error_free(local_err);
             local_err = NULL;
         }
-    } while (ret < 0 && nbd_client_connecting_wait(s));
+    } while (ret < 0 && nbd_client_can_retry(cs));
 
     return ret ? ret : request_ret;
 }
@@ -1390,9 +1679,9 @@ static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
         .len = bytes,
     };
 
-    assert(!(s->info.flags & NBD_FLAG_READ_ONLY));
+    assert(!(s->conns[0]->info.flags & NBD_FLAG_READ_ONLY));
     if (flags & BDRV_REQ_FUA) {
-        assert(s->info.flags & NBD_FLAG_SEND_FUA);
+        assert(s->conns[0]->info.flags & NBD_FLAG_SEND_FUA);
         request.flags |= NBD_CMD_FLAG_FUA;
     }
 
@@ -1414,20 +1703,20 @@ static int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
         .len = bytes,
     };
 
-    assert(!(s->info.flags & NBD_FLAG_READ_ONLY));
-    if (!(s->info.flags & NBD_FLAG_SEND_WRITE_ZEROES)) {
+    assert(!(s->conns[0]->info.flags & NBD_FLAG_READ_ONLY));
+    if (!(s->conns[0]->info.flags & NBD_FLAG_SEND_WRITE_ZEROES)) {
         return -ENOTSUP;
     }
 
     if (flags & BDRV_REQ_FUA) {
-        assert(s->info.flags & NBD_FLAG_SEND_FUA);
+        assert(s->conns[0]->info.flags & NBD_FLAG_SEND_FUA);
         request.flags |= NBD_CMD_FLAG_FUA;
     }
     if (!(flags & BDRV_REQ_MAY_UNMAP)) {
         request.flags |= NBD_CMD_FLAG_NO_HOLE;
     }
     if (flags & BDRV_REQ_NO_FALLBACK) {
-        assert(s->info.flags & NBD_FLAG_SEND_FAST_ZERO);
+        assert(s->conns[0]->info.flags & NBD_FLAG_SEND_FAST_ZERO);
         request.flags |= NBD_CMD_FLAG_FAST_ZERO;
     }
 
@@ -1442,7 +1731,7 @@ static int nbd_client_co_flush(BlockDriverState *bs)
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     NBDRequest request = { .type = NBD_CMD_FLUSH };
 
-    if (!(s->info.flags & NBD_FLAG_SEND_FLUSH)) {
+    if (!(s->conns[0]->info.flags & NBD_FLAG_SEND_FLUSH)) {
         return 0;
     }
 
@@ -1462,8 +1751,8 @@ static int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset,
         .len = bytes,
     };
 
-    assert(!(s->info.flags & NBD_FLAG_READ_ONLY));
-    if (!(s->info.flags & NBD_FLAG_SEND_TRIM) || !bytes) {
+    assert(!(s->conns[0]->info.flags & NBD_FLAG_READ_ONLY));
+    if (!(s->conns[0]->info.flags & NBD_FLAG_SEND_TRIM) || !bytes) {
         return 0;
     }
 
@@ -1475,19 +1764,24 @@ static int coroutine_fn nbd_client_co_block_status(
         int64_t *pnum, int64_t *map, BlockDriverState **file)
 {
     int ret, request_ret;
-    NBDExtent extent = { 0 };
+    g_autofree NBDExtent *extents = NULL;
+    unsigned int nb_extents = 0, max_extents;
+    uint32_t length, flags;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDCachedExtent *cached;
+    NBDConnState *cs;
     Error *local_err = NULL;
+    uint64_t gen;
 
     NBDRequest request = {
         .type = NBD_CMD_BLOCK_STATUS,
         .from = offset,
         .len = MIN(QEMU_ALIGN_DOWN(INT_MAX, bs->bl.request_alignment),
-                   MIN(bytes, s->info.size - offset)),
+                   MIN(bytes, s->conns[0]->info.size - offset)),
         .flags = NBD_CMD_FLAG_REQ_ONE,
     };
 
-    if (!s->info.base_allocation) {
+    if (!s->conns[0]->info.base_allocation) {
         *pnum = bytes;
         *map = offset;
         *file = bs;
@@ -1501,25 +1795,49 @@ static int coroutine_fn nbd_client_co_block_status(
      * up, we truncated the request to the server (above), or are
      * called on just the hole.
      */
-    if (offset >= s->info.size) {
+    if (offset >= s->conns[0]->info.size) {
         *pnum = bytes;
         assert(bytes < BDRV_SECTOR_SIZE);
         /* Intentionally don't report offset_valid for the hole */
         return BDRV_BLOCK_ZERO;
     }
 
-    if (s->info.min_block) {
-        assert(QEMU_IS_ALIGNED(request.len, s->info.min_block));
+    cached = s->bsc_enabled ? nbd_bsc_lookup(s, offset) : NULL;
+    if (cached) {
+        length = cached->offset + cached->length - offset;
+        flags = cached->flags;
+        goto done;
+    }
+
+    /*
+     * Without NBD_CMD_FLAG_REQ_ONE, the server describes as much of the
+     * image after @offset as fits in one reply; keep it for later calls.
+     */
+    if (s->bsc_enabled) {
+        request.len = MIN(QEMU_ALIGN_DOWN(INT_MAX, bs->bl.request_alignment),
+                          s->conns[0]->info.size - offset);
+        request.flags = 0;
+        max_extents = NBD_BSC_MAX_EXTENTS;
+    } else {
+        max_extents = 1;
+    }
+    extents = g_new(NBDExtent, max_extents);
+    gen = s->bsc.gen;
+
+    if (s->conns[0]->info.min_block) {
+        assert(QEMU_IS_ALIGNED(request.len, s->conns[0]->info.min_block));
     }
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        cs = nbd_get_conn(s);
+        ret = nbd_co_send_request(cs, &request, NULL);
         if (ret < 0) {
             continue;
         }
 
-        ret = nbd_co_receive_blockstatus_reply(s, request.handle, bytes,
-                                               &extent, &request_ret,
-                                               &local_err);
+        ret = nbd_co_receive_blockstatus_reply(cs, request.handle,
+                                               request.len, extents,
+                                               &nb_extents, max_extents,
+                                               &request_ret, &local_err);
         if (local_err) {
             trace_nbd_co_request_fail(request.from, request.len, request.handle,
                                       request.flags, request.type,
@@ -1528,18 +1846,25 @@ static int coroutine_fn nbd_client_co_block_status(
             error_free(local_err);
             local_err = NULL;
         }
-    } while (ret < 0 && nbd_client_connecting_wait(s));
+    } while (ret < 0 && nbd_client_can_retry(cs));
 
     if (ret < 0 || request_ret < 0) {
         return ret ? ret : request_ret;
     }
 
-    assert(extent.length);
-    *pnum = extent.length;
+    assert(nb_extents);
+    if (s->bsc_enabled && gen == s->bsc.gen) {
+        nbd_bsc_store(s, offset, extents, nb_extents);
+    }
+    length = extents[0].length;
+    flags = extents[0].flags;
+
+done:
+    *pnum = MIN(length, bytes);
     *map = offset;
     *file = bs;
-    return (extent.flags & NBD_STATE_HOLE ? 0 : BDRV_BLOCK_DATA) |
-        (extent.flags & NBD_STATE_ZERO ? BDRV_BLOCK_ZERO : 0) |
+    return (flags & NBD_STATE_HOLE ? 0 : BDRV_BLOCK_DATA) |
+        (flags & NBD_STATE_ZERO ? BDRV_BLOCK_ZERO : 0) |
         BDRV_BLOCK_OFFSET_VALID;
 }
 
@@ -1548,7 +1873,8 @@ static int nbd_client_reopen_prepare(BDRVReopenState *state,
 {
     BDRVNBDState *s = (BDRVNBDState *)state->bs->opaque;
 
-    if ((state->flags & BDRV_O_RDWR) && (s->info.flags & NBD_FLAG_READ_ONLY)) {
+    if ((state->flags & BDRV_O_RDWR) &&
+        (s->conns[0]->info.flags & NBD_FLAG_READ_ONLY)) {
         error_setg(errp, "Can't reopen read-only NBD mount as read/write");
         return -EACCES;
     }
@@ -1557,20 +1883,22 @@ static int nbd_client_reopen_prepare(BDRVReopenState *state,
 
 static void nbd_yank(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs = opaque;
 
-    qatomic_store_release(&s->state, NBD_CLIENT_QUIT);
-    qio_channel_shutdown(QIO_CHANNEL(s->ioc), QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+    qatomic_store_release(&cs->state, NBD_CLIENT_QUIT);
+    qio_channel_shutdown(QIO_CHANNEL(cs->ioc), QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
 }
 
 static void nbd_client_close(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     NBDRequest request = { .type = NBD_CMD_DISC };
+    uint32_t i;
 
-    if (s->ioc) {
-        nbd_send_request(s->ioc, &request);
+    for (i = 0; i < s->multi_conn; i++) {
+        if (s->conns[i]->ioc) {
+            nbd_send_request(s->conns[i]->ioc, &request);
+        }
     }
 
     nbd_teardown_connection(bs);
@@ -1897,6 +2225,18 @@ static QemuOptsList nbd_runtime_opts = {
                     "future requests before a successful reconnect will "
                     "immediately fail. Default 0",
         },
+        {
+            .name = "multi-conn",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to the server that requests are "
+                    "spread over, if the server allows it. Default 1",
+        },
+        {
+            .name = "block-status-cache",
+            .type = QEMU_OPT_BOOL,
+            .help = "Prefetch block status of large ranges and keep it until "
+                    "the range is written by this client. Default on",
+        },
         { /* end of list */ }
     },
 };
@@ -1906,6 +2246,7 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 {
     BDRVNBDState *s = bs->opaque;
     QemuOpts *opts;
+    uint64_t multi_conn;
     int ret = -EINVAL;
 
     opts = qemu_opts_create(&nbd_runtime_opts, NULL, 0, &error_abort);
@@ -1953,6 +2294,16 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
 
+    multi_conn = qemu_opt_get_number(opts, "multi-conn", 1);
+    if (multi_conn < 1 || multi_conn > MAX_MULTI_CONN) {
+        error_setg(errp, "multi-conn must be between 1 and %d",
+                   MAX_MULTI_CONN);
+        goto error;
+    }
+    s->multi_conn = multi_conn;
+
+    s->bsc_enabled = qemu_opt_get_bool(opts, "block-status-cache", true);
+
     ret = 0;
 
  error:
@@ -1964,11 +2315,10 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
     int ret;
+    uint32_t i;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
 
     s->bs = bs;
-    qemu_co_mutex_init(&s->send_mutex);
-    qemu_co_queue_init(&s->free_sema);
 
     if (!yank_register_instance(BLOCKDEV_YANK_INSTANCE(bs->node_name), errp)) {
         return -EEXIST;
@@ -1979,8 +2329,16 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
-    s->conn = nbd_client_connection_new(s->saddr, true, s->export,
-                                        s->x_dirty_bitmap, s->tlscreds);
+    for (i = 0; i < s->multi_conn; i++) {
+        NBDConnState *cs = g_new0(NBDConnState, 1);
+
+        cs->s = s;
+        qemu_co_mutex_init(&cs->send_mutex);
+        qemu_co_queue_init(&cs->free_sema);
+        cs->conn = nbd_client_connection_new(s->saddr, true, s->export,
+                                             s->x_dirty_bitmap, s->tlscreds);
+        s->conns[i] = cs;
+    }
 
     /* TODO: Configurable retry-until-timeout behaviour. */
     ret = nbd_do_establish_connection(bs, errp);
@@ -1988,9 +2346,13 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
-    s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
-    bdrv_inc_in_flight(bs);
-    aio_co_schedule(bdrv_get_aio_context(bs), s->connection_co);
+    for (i = 0; i < s->multi_conn; i++) {
+        NBDConnState *cs = s->conns[i];
+
+        cs->connection_co = qemu_coroutine_create(nbd_connection_entry, cs);
+        bdrv_inc_in_flight(bs);
+        aio_co_schedule(bdrv_get_aio_context(bs), cs->connection_co);
+    }
 
     return 0;
 
@@ -2007,8 +2369,9 @@ static int nbd_co_flush(BlockDriverState *bs)
 static void nbd_refresh_limits(BlockDriverState *bs, Error **errp)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-    uint32_t min = s->info.min_block;
-    uint32_t max = MIN_NON_ZERO(NBD_MAX_BUFFER_SIZE, s->info.max_block);
+    uint32_t min = s->conns[0]->info.min_block;
+    uint32_t max = MIN_NON_ZERO(NBD_MAX_BUFFER_SIZE,
+                                s->conns[0]->info.max_block);
 
     /*
      * If the server did not advertise an alignment:
@@ -2023,8 +2386,8 @@ static void nbd_refresh_limits(BlockDriverState *bs, Error **errp)
      *   sub-sector requests
      */
     if (!min) {
-        min = (!QEMU_IS_ALIGNED(s->info.size, BDRV_SECTOR_SIZE) ||
-               s->info.base_allocation) ? 1 : BDRV_SECTOR_SIZE;
+        min = (!QEMU_IS_ALIGNED(s->conns[0]->info.size, BDRV_SECTOR_SIZE) ||
+               s->conns[0]->info.base_allocation) ? 1 : BDRV_SECTOR_SIZE;
     }
 
     bs->bl.request_alignment = min;
@@ -2032,9 +2395,9 @@ static void nbd_refresh_limits(BlockDriverState *bs, Error **errp)
     bs->bl.max_pwrite_zeroes = max;
     bs->bl.max_transfer = max;
 
-    if (s->info.opt_block &&
-        s->info.opt_block > bs->bl.opt_transfer) {
-        bs->bl.opt_transfer = s->info.opt_block;
+    if (s->conns[0]->info.opt_block &&
+        s->conns[0]->info.opt_block > bs->bl.opt_transfer) {
+        bs->bl.opt_transfer = s->conns[0]->info.opt_block;
     }
 }
 
@@ -2058,12 +2421,12 @@ static int coroutine_fn nbd_co_truncate(BlockDriverState *bs, int64_t offset,
 {
     BDRVNBDState *s = bs->opaque;
 
-    if (offset != s->info.size && exact) {
+    if (offset != s->conns[0]->info.size && exact) {
         error_setg(errp, "Cannot resize NBD nodes");
         return -ENOTSUP;
     }
 
-    if (offset > s->info.size) {
+    if (offset > s->conns[0]->info.size) {
         error_setg(errp, "Cannot grow NBD nodes");
         return -EINVAL;
     }
@@ -2075,7 +2438,7 @@ static int64_t nbd_getlength(BlockDriverState *bs)
 {
     BDRVNBDState *s = bs->opaque;
 
-    return s->info.size;
+    return s->conns[0]->info.size;
 }
 
 static void nbd_refresh_filename(BlockDriverState *bs)
@@ -2129,6 +2492,7 @@ static const char *const nbd_strong_runtime_opts[] = {
     "port",
     "export",
     "tls-creds",
+    "multi-conn",
     "server.",
 
     NULL
@@ -2138,11 +2502,17 @@ static void nbd_cancel_in_flight(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
 
-    reconnect_delay_timer_del(s);
+    uint32_t i;
 
-    if (s->state == NBD_CLIENT_CONNECTING_WAIT) {
-        s->state = NBD_CLIENT_CONNECTING_NOWAIT;
-        qemu_co_queue_restart_all(&s->free_sema);
+    for (i = 0; i < s->multi_conn; i++) {
+        NBDConnState *cs = s->conns[i];
+
+        reconnect_delay_timer_del(cs);
+
+        if (cs->state == NBD_CLIENT_CONNECTING_WAIT) {
+            cs->state = NBD_CLIENT_CONNECTING_NOWAIT;
+            qemu_co_queue_restart_all(&cs->free_sema);
+        }
     }
 }
 
@@ -21,6 +21,7 @@
 #include "qemu/module.h"
 #include "qemu/cutils.h"
 #include "qemu/option.h"
+#include "qemu/stats64.h"
 #include "qemu/vfio-helpers.h"
 #include "block/block_int.h"
 #include "sysemu/replay.h"
@@ -45,12 +46,23 @@ typedef struct BDRVNVMeState BDRVNVMeState;
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
-/* This driver shares a single MSIX IRQ for the admin and I/O queues */
+#define NVME_MAX_IO_QUEUES 64
+
+/*
+ * The admin queue uses the shared MSIX IRQ.  Each I/O queue gets the IRQ
+ * of its own index if the device has enough vectors, and shares the IRQ
+ * with the admin queue otherwise.
+ */
 enum {
     MSIX_SHARED_IRQ_IDX = 0,
-    MSIX_IRQ_COUNT = 1
 };
 
+typedef struct {
+    EventNotifier notifier;
+    BDRVNVMeState *s;
+    unsigned index;
+} NVMeIrq;
+
 typedef struct {
     int32_t  head, tail;
     uint8_t  *queue;
@@ -74,6 +86,13 @@ typedef struct {
     /* Read from I/O code path, initialized under BQL */
     BDRVNVMeState   *s;
     int             index;
+    unsigned        irq_index;
+
+    /*
+     * The AioContext that processes completions, set under s->queue_lock.
+     * NULL while the queue is not bound to any AioContext.
+     */
+    AioContext      *aio_context;
 
     /* Fields protected by BQL */
     uint8_t     *prp_list_pages;
@@ -110,7 +129,12 @@ struct BDRVNVMeState {
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
     bool write_cache_supported;
-    EventNotifier irq_notifier[MSIX_IRQ_COUNT];
+    NVMeIrq *irqs;
+    unsigned irq_count;
+
+    /* Binds I/O queues to the AioContexts that submit requests */
+    QemuMutex queue_lock;
+    unsigned next_shared_queue;
 
     uint64_t nsze; /* Namespace size reported by identify command */
     int nsid;      /* The namespace id to read/write data. */
@@ -131,15 +155,17 @@ struct BDRVNVMeState {
     /* PCI address (required for nvme_refresh_filename()) */
     char *device;
 
+    /* Updated from every AioContext that submits requests */
     struct {
-        uint64_t completion_errors;
-        uint64_t aligned_accesses;
-        uint64_t unaligned_accesses;
+        Stat64 completion_errors;
+        Stat64 aligned_accesses;
+        Stat64 unaligned_accesses;
     } stats;
 };
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_NUM_QUEUES "num-queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -157,6 +183,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_NUM_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of I/O queues (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -184,12 +215,46 @@ static bool nvme_init_queue(BDRVNVMeState *s, NVMeQueue *q,
     return true;
 }
 
+static void nvme_handle_event(EventNotifier *n);
+static bool nvme_poll_cb(void *opaque);
+
+/* Called with s->queue_lock held, or from the node's AioContext */
+static void nvme_queue_attach_aio_context(NVMeQueuePair *q, AioContext *ctx)
+{
+    BDRVNVMeState *s = q->s;
+
+    assert(!q->aio_context);
+    q->completion_bh = aio_bh_new(ctx, nvme_process_completion_bh, q);
+    if (q->irq_index != MSIX_SHARED_IRQ_IDX) {
+        aio_set_event_notifier(ctx, &s->irqs[q->irq_index].notifier,
+                               false, nvme_handle_event, nvme_poll_cb);
+    }
+    trace_nvme_queue_attach_aio_context(s, q->index, ctx);
+    qatomic_store_release(&q->aio_context, ctx);
+}
+
+/* The queue must be idle */
+static void nvme_queue_detach_aio_context(NVMeQueuePair *q)
+{
+    BDRVNVMeState *s = q->s;
+
+    if (!q->aio_context) {
+        return;
+    }
+    if (q->irq_index != MSIX_SHARED_IRQ_IDX) {
+        aio_set_event_notifier(q->aio_context,
+                               &s->irqs[q->irq_index].notifier,
+                               false, NULL, NULL);
+    }
+    qemu_bh_delete(q->completion_bh);
+    q->completion_bh = NULL;
+    qatomic_set(&q->aio_context, NULL);
+}
+
 static void nvme_free_queue_pair(NVMeQueuePair *q)
 {
     trace_nvme_free_queue_pair(q->index, q);
-    if (q->completion_bh) {
-        qemu_bh_delete(q->completion_bh);
-    }
+    nvme_queue_detach_aio_context(q);
     qemu_vfree(q->prp_list_pages);
     qemu_vfree(q->sq.queue);
     qemu_vfree(q->cq.queue);
@@ -222,8 +287,10 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
     if (!q) {
         return NULL;
     }
+    q->irq_index = idx < s->irq_count ? idx : MSIX_SHARED_IRQ_IDX;
     trace_nvme_create_queue_pair(idx, q, size, aio_context,
-                                 event_notifier_get_fd(s->irq_notifier));
+                                 event_notifier_get_fd(
+                                     &s->irqs[q->irq_index].notifier));
     bytes = QEMU_ALIGN_UP(s->page_size * NVME_NUM_REQS,
                           qemu_real_host_page_size);
     q->prp_list_pages = qemu_try_memalign(qemu_real_host_page_size, bytes);
@@ -235,7 +302,6 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
     q->s = s;
     q->index = idx;
     qemu_co_queue_init(&q->free_req_queue);
-    q->completion_bh = aio_bh_new(aio_context, nvme_process_completion_bh, q);
     r = qemu_vfio_dma_map(s->vfio, q->prp_list_pages, bytes,
                           false, &prp_list_iova);
     if (r) {
@@ -261,18 +327,30 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
     }
     q->cq.doorbell = &s->doorbells[idx * s->doorbell_scale].cq_head;
 
+    if (aio_context) {
+        nvme_queue_attach_aio_context(q, aio_context);
+    }
     return q;
 fail:
     nvme_free_queue_pair(q);
     return NULL;
 }
 
+/*
+ * Only the node's AioContext plugs, so queues bound to other AioContexts
+ * keep submitting and completing requests while it is plugged.
+ */
+static bool nvme_queue_plugged(NVMeQueuePair *q)
+{
+    return q->s->plugged && q->aio_context == q->s->aio_context;
+}
+
 /* With q->lock */
 static void nvme_kick(NVMeQueuePair *q)
 {
     BDRVNVMeState *s = q->s;
 
-    if (s->plugged || !q->need_kick) {
+    if (nvme_queue_plugged(q) || !q->need_kick) {
         return;
     }
     trace_nvme_kick(s, q->index);
@@ -323,7 +401,7 @@ static void nvme_put_free_req_locked(NVMeQueuePair *q, NVMeRequest *req)
 static void nvme_wake_free_req_locked(NVMeQueuePair *q)
 {
     if (!qemu_co_queue_empty(&q->free_req_queue)) {
-        replay_bh_schedule_oneshot_event(q->s->aio_context,
+        replay_bh_schedule_oneshot_event(q->aio_context,
                 nvme_free_req_queue_cb, q);
     }
 }
@@ -369,7 +447,7 @@ static bool nvme_process_completion(NVMeQueuePair *q)
     NvmeCqe *c;
 
     trace_nvme_process_completion(s, q->index, q->inflight);
-    if (s->plugged) {
+    if (nvme_queue_plugged(q)) {
         trace_nvme_process_completion_queue_plugged(s, q->index);
         return false;
     }
@@ -395,7 +473,7 @@ static bool nvme_process_completion(NVMeQueuePair *q)
         }
         ret = nvme_translate_error(c);
         if (ret) {
-            s->stats.completion_errors++;
+            stat64_add(&s->stats.completion_errors, 1);
         }
         q->cq.head = (q->cq.head + 1) % NVME_QUEUE_SIZE;
         if (!q->cq.head) {
@@ -608,8 +686,8 @@ static bool nvme_poll_queue(NVMeQueuePair *q)
     trace_nvme_poll_queue(q->s, q->index);
     /*
      * Do an early check for completions. q->lock isn't needed because
-     * nvme_process_completion() only runs in the event loop thread and
-     * cannot race with itself.
+     * this only peeks at the queue; a stale result is corrected by the
+     * next poll or interrupt.
      */
     if ((le16_to_cpu(cqe->status) & 0x1) == q->cq_phase) {
         return false;
@@ -625,13 +703,19 @@ static bool nvme_poll_queue(NVMeQueuePair *q)
     return progress;
 }
 
-static bool nvme_poll_queues(BDRVNVMeState *s)
+/* Poll the queues that signal completions through @irq */
+static bool nvme_poll_irq(NVMeIrq *irq)
 {
+    BDRVNVMeState *s = irq->s;
     bool progress = false;
     int i;
 
+    if (irq->index != MSIX_SHARED_IRQ_IDX) {
+        return nvme_poll_queue(s->queues[irq->index]);
+    }
     for (i = 0; i < s->queue_count; i++) {
-        if (nvme_poll_queue(s->queues[i])) {
+        if (s->queues[i]->irq_index == MSIX_SHARED_IRQ_IDX &&
+            nvme_poll_queue(s->queues[i])) {
             progress = true;
         }
     }
@@ -640,15 +724,19 @@ static bool nvme_poll_queues(BDRVNVMeState *s)
 
 static void nvme_handle_event(EventNotifier *n)
 {
-    BDRVNVMeState *s = container_of(n, BDRVNVMeState,
-                                    irq_notifier[MSIX_SHARED_IRQ_IDX]);
+    NVMeIrq *irq = container_of(n, NVMeIrq, notifier);
 
-    trace_nvme_handle_event(s);
+    trace_nvme_handle_event(irq->s, irq->index);
     event_notifier_test_and_clear(n);
-    nvme_poll_queues(s);
+    nvme_poll_irq(irq);
 }
 
-static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
+/*
+ * Only the first I/O queue is bound to the node's AioContext from the
+ * start, the others are bound when a new AioContext starts submitting.
+ */
+static bool nvme_add_io_queue(BlockDriverState *bs, AioContext *aio_context,
+                              Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     unsigned n = s->queue_count;
@@ -657,8 +745,7 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     unsigned queue_size = NVME_QUEUE_SIZE;
 
     assert(n <= UINT16_MAX);
-    q = nvme_create_queue_pair(s, bdrv_get_aio_context(bs),
-                               n, queue_size, errp);
+    q = nvme_create_queue_pair(s, aio_context, n, queue_size, errp);
     if (!q) {
         return false;
     }
@@ -666,7 +753,7 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
         .opcode = NVME_ADM_CMD_CREATE_CQ,
         .dptr.prp1 = cpu_to_le64(q->cq.iova),
         .cdw10 = cpu_to_le32(((queue_size - 1) << 16) | n),
-        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC),
+        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC | (q->irq_index << 16)),
     };
     if (nvme_admin_cmd_sync(bs, &cmd)) {
         error_setg(errp, "Failed to create CQ io queue [%u]", n);
@@ -694,14 +781,49 @@ out_error:
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
-    BDRVNVMeState *s = container_of(e, BDRVNVMeState,
-                                    irq_notifier[MSIX_SHARED_IRQ_IDX]);
+    NVMeIrq *irq = container_of(e, NVMeIrq, notifier);
 
-    return nvme_poll_queues(s);
+    return nvme_poll_irq(irq);
+}
+
+/*
+ * Ask the controller for @num_queues I/O queues and create as many as it
+ * grants.  The first one is required, running short of the others is not
+ * an error.
+ */
+static bool nvme_add_io_queues(BlockDriverState *bs, unsigned num_queues,
+                               Error **errp)
+{
+    BDRVNVMeState *s = bs->opaque;
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((num_queues - 1) << 16) | (num_queues - 1)),
+    };
+
+    if (num_queues > 1 && nvme_admin_cmd_sync(bs, &cmd)) {
+        warn_report("NVMe controller refused %u I/O queues, using one",
+                    num_queues);
+        num_queues = 1;
+    }
+
+    if (!nvme_add_io_queue(bs, bdrv_get_aio_context(bs), errp)) {
+        return false;
+    }
+    while (s->queue_count < INDEX_IO(num_queues)) {
+        Error *local_err = NULL;
+
+        if (!nvme_add_io_queue(bs, NULL, &local_err)) {
+            warn_reportf_err(local_err, "Using %u of %u NVMe I/O queues: ",
+                             s->queue_count - 1, num_queues);
+            break;
+        }
+    }
+    return true;
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned num_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
@@ -712,17 +834,15 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     uint64_t timeout_ms;
     uint64_t deadline, now;
     volatile NvmeBar *regs = NULL;
+    g_autofree EventNotifier **notifiers = NULL;
+    int irq_count;
 
     qemu_co_mutex_init(&s->dma_map_lock);
     qemu_co_queue_init(&s->dma_flush_queue);
+    qemu_mutex_init(&s->queue_lock);
     s->device = g_strdup(device);
     s->nsid = namespace;
     s->aio_context = bdrv_get_aio_context(bs);
-    ret = event_notifier_init(&s->irq_notifier[MSIX_SHARED_IRQ_IDX], 0);
-    if (ret) {
-        error_setg(errp, "Failed to init event notifier");
-        return ret;
-    }
 
     s->vfio = qemu_vfio_open_pci(device, errp);
     if (!s->vfio) {
@@ -730,6 +850,30 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         goto out;
     }
 
+    irq_count = qemu_vfio_pci_get_irq_count(s->vfio, VFIO_PCI_MSIX_IRQ_INDEX,
+                                            errp);
+    if (irq_count <= 0) {
+        if (!irq_count) {
+            error_setg(errp, "Device has no MSIX interrupt vectors");
+        }
+        ret = -EINVAL;
+        goto out;
+    }
+    s->irqs = g_new0(NVMeIrq, MIN(irq_count, INDEX_IO(num_queues)));
+    notifiers = g_new(EventNotifier *, MIN(irq_count, INDEX_IO(num_queues)));
+    while (s->irq_count < MIN(irq_count, INDEX_IO(num_queues))) {
+        NVMeIrq *irq = &s->irqs[s->irq_count];
+
+        ret = event_notifier_init(&irq->notifier, 0);
+        if (ret) {
+            error_setg(errp, "Failed to init event notifier");
+            goto out;
+        }
+        irq->s = s;
+        irq->index = s->irq_count;
+        notifiers[s->irq_count++] = &irq->notifier;
+    }
+
     regs = qemu_vfio_pci_map_bar(s->vfio, 0, 0, sizeof(NvmeBar),
                                  PROT_READ | PROT_WRITE, errp);
     if (!regs) {
@@ -825,13 +969,13 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         }
     }
 
-    ret = qemu_vfio_pci_init_irq(s->vfio, s->irq_notifier,
-                                 VFIO_PCI_MSIX_IRQ_INDEX, errp);
+    ret = qemu_vfio_pci_init_irqs(s->vfio, notifiers, s->irq_count,
+                                  VFIO_PCI_MSIX_IRQ_INDEX, errp);
     if (ret) {
         goto out;
     }
     aio_set_event_notifier(bdrv_get_aio_context(bs),
-                           &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
+                           &s->irqs[MSIX_SHARED_IRQ_IDX].notifier,
                            false, nvme_handle_event, nvme_poll_cb);
 
     if (!nvme_identify(bs, namespace, errp)) {
@@ -840,7 +984,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
+    if (!nvme_add_io_queues(bs, num_queues, errp)) {
         ret = -EIO;
     }
 out:
@@ -915,10 +1059,16 @@ static void nvme_close(BlockDriverState *bs)
         nvme_free_queue_pair(s->queues[i]);
     }
     g_free(s->queues);
-    aio_set_event_notifier(bdrv_get_aio_context(bs),
-                           &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
-                           false, NULL, NULL);
-    event_notifier_cleanup(&s->irq_notifier[MSIX_SHARED_IRQ_IDX]);
+    if (s->irq_count) {
+        aio_set_event_notifier(bdrv_get_aio_context(bs),
+                               &s->irqs[MSIX_SHARED_IRQ_IDX].notifier,
+                               false, NULL, NULL);
+    }
+    for (unsigned i = 0; i < s->irq_count; ++i) {
+        event_notifier_cleanup(&s->irqs[i].notifier);
+    }
+    g_free(s->irqs);
+    qemu_mutex_destroy(&s->queue_lock);
     qemu_vfio_pci_unmap_bar(s->vfio, 0, s->bar0_wo_map,
                             0, sizeof(NvmeBar) + NVME_DOORBELL_SIZE);
     qemu_vfio_close(s->vfio);
@@ -932,6 +1082,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t num_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -947,7 +1098,14 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    num_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NUM_QUEUES, 1);
+    if (num_queues < 1 || num_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_NUM_QUEUES "' must be between "
+                   "1 and %d", NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, num_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1114,6 +1272,12 @@ typedef struct {
     Coroutine *co;
     int ret;
     AioContext *ctx;
+    /*
+     * The completion runs in another thread if the queue is bound to
+     * another AioContext.  Whichever of nvme_rw_cb() and nvme_co_wait()
+     * sets this second knows that the other side is done.
+     */
+    bool handoff;
 } NVMeCoData;
 
 static void nvme_rw_cb_bh(void *opaque)
@@ -1126,13 +1290,58 @@ static void nvme_rw_cb(void *opaque, int ret)
 {
     NVMeCoData *data = opaque;
     data->ret = ret;
-    if (!data->co) {
+    if (!qatomic_xchg(&data->handoff, true)) {
         /* The rw coroutine hasn't yielded, don't try to enter. */
         return;
     }
     replay_bh_schedule_oneshot_event(data->ctx, nvme_rw_cb_bh, data);
 }
 
+/* Wait for the command submitted with @data to complete */
+static coroutine_fn int nvme_co_wait(NVMeCoData *data)
+{
+    if (!qatomic_xchg(&data->handoff, true)) {
+        qemu_coroutine_yield();
+    }
+    return data->ret;
+}
+
+/*
+ * Pick the I/O queue for a request from the current AioContext.  Each
+ * AioContext gets a queue of its own while unbound queues are left; the
+ * AioContexts that come after that share the other AioContexts' queues.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    NVMeQueuePair *q = NULL;
+    unsigned i;
+
+    if (ctx == s->aio_context || s->queue_count == INDEX_IO(1)) {
+        return s->queues[INDEX_IO(0)];
+    }
+    for (i = INDEX_IO(1); i < s->queue_count; i++) {
+        if (qatomic_load_acquire(&s->queues[i]->aio_context) == ctx) {
+            return s->queues[i];
+        }
+    }
+
+    qemu_mutex_lock(&s->queue_lock);
+    for (i = INDEX_IO(1); i < s->queue_count; i++) {
+        if (!s->queues[i]->aio_context) {
+            q = s->queues[i];
+            nvme_queue_attach_aio_context(q, ctx);
+            break;
+        }
+    }
+    if (!q) {
+        i = s->next_shared_queue++ % (s->queue_count - 1);
+        q = s->queues[INDEX_IO(i)];
+    }
+    qemu_mutex_unlock(&s->queue_lock);
+    return q;
+}
+
 static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
                                             uint64_t offset, uint64_t bytes,
                                             QEMUIOVector *qiov,
@@ -1141,7 +1350,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1154,12 +1363,14 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         .cdw12 = cpu_to_le32(cdw12),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
     trace_nvme_prw_aligned(s, is_write, offset, bytes, flags, qiov->niov);
     assert(s->queue_count > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
@@ -1171,11 +1382,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         return r;
     }
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
-
-    data.co = qemu_coroutine_self();
-    while (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    nvme_co_wait(&data);
 
     qemu_co_mutex_lock(&s->dma_map_lock);
     r = nvme_cmd_unmap_qiov(bs, qiov);
@@ -1218,10 +1425,10 @@ static int nvme_co_prw(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     assert(QEMU_IS_ALIGNED(bytes, s->page_size));
     assert(bytes <= s->max_transfer);
     if (nvme_qiov_aligned(bs, qiov)) {
-        s->stats.aligned_accesses++;
+        stat64_add(&s->stats.aligned_accesses, 1);
         return nvme_co_prw_aligned(bs, offset, bytes, qiov, is_write, flags);
     }
-    s->stats.unaligned_accesses++;
+    stat64_add(&s->stats.unaligned_accesses, 1);
     trace_nvme_prw_buffered(s, offset, bytes, qiov->niov, is_write);
     buf = qemu_try_memalign(qemu_real_host_page_size, len);
 
@@ -1259,28 +1466,25 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
         .nsid = cpu_to_le32(s->nsid),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
     assert(s->queue_count > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
 
-    data.co = qemu_coroutine_self();
-    if (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
-
-    return data.ret;
+    return nvme_co_wait(&data);
 }
 
 
@@ -1290,7 +1494,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
 
     uint32_t cdw12 = ((bytes >> s->blkshift) - 1) & 0xFFFF;
@@ -1307,7 +1511,8 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1323,15 +1528,12 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
 
     trace_nvme_write_zeroes(s, offset, bytes, flags);
     assert(s->queue_count > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
-
-    data.co = qemu_coroutine_self();
-    while (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    nvme_co_wait(&data);
 
     trace_nvme_rw_done(s, true, offset, bytes, data.ret);
     return data.ret;
@@ -1343,7 +1545,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     NvmeDsmRange *buf;
     QEMUIOVector local_qiov;
@@ -1357,7 +1559,8 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1379,6 +1582,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     qemu_iovec_init(&local_qiov, 1);
     qemu_iovec_add(&local_qiov, buf, 4096);
 
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
@@ -1394,11 +1598,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     trace_nvme_dsm(s, offset, bytes);
 
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
-
-    data.co = qemu_coroutine_self();
-    while (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    nvme_co_wait(&data);
 
     qemu_co_mutex_lock(&s->dma_map_lock);
     ret = nvme_cmd_unmap_qiov(bs, &local_qiov);
@@ -1469,14 +1669,11 @@ static void nvme_detach_aio_context(BlockDriverState *bs)
     BDRVNVMeState *s = bs->opaque;
 
     for (unsigned i = 0; i < s->queue_count; i++) {
-        NVMeQueuePair *q = s->queues[i];
-
-        qemu_bh_delete(q->completion_bh);
-        q->completion_bh = NULL;
+        nvme_queue_detach_aio_context(s->queues[i]);
     }
 
     aio_set_event_notifier(bdrv_get_aio_context(bs),
-                           &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
+                           &s->irqs[MSIX_SHARED_IRQ_IDX].notifier,
                            false, NULL, NULL);
 }
 
@@ -1486,15 +1683,35 @@ static void nvme_attach_aio_context(BlockDriverState *bs,
     BDRVNVMeState *s = bs->opaque;
 
     s->aio_context = new_context;
-    aio_set_event_notifier(new_context, &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
+    aio_set_event_notifier(new_context,
+                           &s->irqs[MSIX_SHARED_IRQ_IDX].notifier,
                            false, nvme_handle_event, nvme_poll_cb);
 
-    for (unsigned i = 0; i < s->queue_count; i++) {
+    /* The other I/O queues are bound again when they are needed */
+    nvme_queue_attach_aio_context(s->queues[INDEX_ADMIN], new_context);
+    nvme_queue_attach_aio_context(s->queues[INDEX_IO(0)], new_context);
+}
+
+/*
+ * Unbind the I/O queues of other AioContexts, so that no queue keeps a
+ * reference to an AioContext that goes away while the node is open.  They
+ * are idle because the node was drained.
+ */
+static void coroutine_fn nvme_co_drain_end(BlockDriverState *bs)
+{
+    BDRVNVMeState *s = bs->opaque;
+
+    qemu_mutex_lock(&s->queue_lock);
+    for (unsigned i = INDEX_IO(1); i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
 
-        q->completion_bh =
-            aio_bh_new(new_context, nvme_process_completion_bh, q);
+        qemu_mutex_lock(&q->lock);
+        if (!q->inflight && !q->need_kick) {
+            nvme_queue_detach_aio_context(q);
+        }
+        qemu_mutex_unlock(&q->lock);
     }
+    qemu_mutex_unlock(&s->queue_lock);
 }
 
 static void nvme_aio_plug(BlockDriverState *bs)
@@ -1511,6 +1728,9 @@ static void nvme_aio_unplug(BlockDriverState *bs)
     s->plugged = false;
     for (unsigned i = INDEX_IO(0); i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
+        if (qatomic_read(&q->aio_context) != s->aio_context) {
+            continue;
+        }
         qemu_mutex_lock(&q->lock);
         nvme_kick(q);
         nvme_process_completion(q);
@@ -1546,9 +1766,9 @@ static BlockStatsSpecific *nvme_get_specific_stats(BlockDriverState *bs)
 
     stats->driver = BLOCKDEV_DRIVER_NVME;
     stats->u.nvme = (BlockStatsSpecificNvme) {
-        .completion_errors = s->stats.completion_errors,
-        .aligned_accesses = s->stats.aligned_accesses,
-        .unaligned_accesses = s->stats.unaligned_accesses,
+        .completion_errors = stat64_get(&s->stats.completion_errors),
+        .aligned_accesses = stat64_get(&s->stats.aligned_accesses),
+        .unaligned_accesses = stat64_get(&s->stats.unaligned_accesses),
     };
 
     return stats;
@@ -1557,6 +1777,7 @@ static BlockStatsSpecific *nvme_get_specific_stats(BlockDriverState *bs)
 static const char *const nvme_strong_runtime_opts[] = {
     NVME_BLOCK_OPT_DEVICE,
     NVME_BLOCK_OPT_NAMESPACE,
+    NVME_BLOCK_OPT_NUM_QUEUES,
 
     NULL
 };
@@ -1565,6 +1786,7 @@ static BlockDriver bdrv_nvme = {
     .format_name              = "nvme",
     .protocol_name            = "nvme",
     .instance_size            = sizeof(BDRVNVMeState),
+    .supports_multi_context   = true,
 
     .bdrv_co_create_opts      = bdrv_co_create_opts_simple,
     .create_opts              = &bdrv_create_opts_simple,
@@ -1592,6 +1814,7 @@ static BlockDriver bdrv_nvme = {
 
     .bdrv_detach_aio_context  = nvme_detach_aio_context,
     .bdrv_attach_aio_context  = nvme_attach_aio_context,
+    .bdrv_co_drain_end        = nvme_co_drain_end,
 
     .bdrv_io_plug             = nvme_aio_plug,
     .bdrv_io_unplug           = nvme_aio_unplug,
@@ -36,6 +36,8 @@
 typedef struct PreallocateOpts {
     int64_t prealloc_size;
     int64_t prealloc_align;
+    bool prealloc_async;
+    int64_t prealloc_watermark;
 } PreallocateOpts;
 
 typedef struct BDRVPreallocateState {
@@ -74,10 +76,24 @@ typedef struct BDRVPreallocateState {
      * be invalid (< 0) when we don't have both exclusive BLK_PERM_RESIZE and
      * BLK_PERM_WRITE permissions on file child.
      */
+
+    /*
+     * A preallocating write-zeroes request is in flight, either in the
+     * background or on behalf of a write beyond @file_end. Nobody else
+     * preallocates, truncates or drops permissions until it is done, and
+     * writes beyond @file_end wait for it in @prealloc_queue.
+     */
+    bool prealloc_in_flight;
+    CoQueue prealloc_queue;
+
+    /* Statistics, see BlockStatsSpecificPreallocate */
+    BlockStatsSpecificPreallocate stats;
 } BDRVPreallocateState;
 
 #define PREALLOCATE_OPT_PREALLOC_ALIGN "prealloc-align"
 #define PREALLOCATE_OPT_PREALLOC_SIZE "prealloc-size"
+#define PREALLOCATE_OPT_PREALLOC_ASYNC "prealloc-async"
+#define PREALLOCATE_OPT_PREALLOC_WATERMARK "prealloc-watermark"
 static QemuOptsList runtime_opts = {
     .name = "preallocate",
     .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
@@ -93,6 +109,18 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_SIZE,
             .help = "how much to preallocate, default 128M",
         },
+        {
+            .name = PREALLOCATE_OPT_PREALLOC_ASYNC,
+            .type = QEMU_OPT_BOOL,
+            .help = "preallocate in the background, ahead of the writes, "
+                "default off",
+        },
+        {
+            .name = PREALLOCATE_OPT_PREALLOC_WATERMARK,
+            .type = QEMU_OPT_SIZE,
+            .help = "with prealloc-async, preallocate more when less than this "
+                "number of bytes is left, default half of prealloc-size",
+        },
         { /* end of list */ }
     },
 };
@@ -110,9 +138,20 @@ static bool preallocate_absorb_opts(PreallocateOpts *dest, QDict *options,
         qemu_opt_get_size(opts, PREALLOCATE_OPT_PREALLOC_ALIGN, 1 * MiB);
     dest->prealloc_size =
         qemu_opt_get_size(opts, PREALLOCATE_OPT_PREALLOC_SIZE, 128 * MiB);
+    dest->prealloc_async =
+        qemu_opt_get_bool(opts, PREALLOCATE_OPT_PREALLOC_ASYNC, false);
+    dest->prealloc_watermark =
+        qemu_opt_get_size(opts, PREALLOCATE_OPT_PREALLOC_WATERMARK,
+                          dest->prealloc_size / 2);
 
     qemu_opts_del(opts);
 
+    if (dest->prealloc_watermark > dest->prealloc_size) {
+        error_setg(errp, "prealloc-watermark parameter of preallocate filter "
+                   "must not exceed prealloc-size");
+        return false;
+    }
+
     if (!QEMU_IS_ALIGNED(dest->prealloc_align, BDRV_SECTOR_SIZE)) {
         error_setg(errp, "prealloc-align parameter of preallocate filter "
                    "is not aligned to %llu", BDRV_SECTOR_SIZE);
@@ -140,6 +179,7 @@ static int preallocate_open(BlockDriverState *bs, QDict *options, int flags,
      * For this to work, mark them invalid.
      */
     s->file_end = s->zero_start = s->data_end = -EINVAL;
+    qemu_co_queue_init(&s->prealloc_queue);
 
     bs->file = bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
                                BDRV_CHILD_FILTERED | BDRV_CHILD_PRIMARY,
@@ -240,6 +280,90 @@ static int coroutine_fn preallocate_co_pdiscard(BlockDriverState *bs,
     return bdrv_co_pdiscard(bs->file, offset, bytes);
 }
 
+/* Wait until the preallocating request in flight, if any, is done */
+static void preallocate_wait(BlockDriverState *bs)
+{
+    BDRVPreallocateState *s = bs->opaque;
+
+    if (qemu_in_coroutine()) {
+        while (s->prealloc_in_flight) {
+            qemu_co_queue_wait(&s->prealloc_queue, NULL);
+        }
+    } else {
+        BDRV_POLL_WHILE(bs, s->prealloc_in_flight);
+    }
+}
+
+/*
+ * Preallocate [@start, @end) and move s->file_end to @end. Must be called with
+ * s->prealloc_in_flight set, which this function clears.
+ */
+static int coroutine_fn preallocate_co_extend(BlockDriverState *bs,
+                                              int64_t start, int64_t end)
+{
+    BDRVPreallocateState *s = bs->opaque;
+    int ret;
+
+    assert(s->prealloc_in_flight);
+
+    ret = bdrv_co_pwrite_zeroes(
+            bs->file, start, end - start,
+            BDRV_REQ_NO_FALLBACK | BDRV_REQ_SERIALISING | BDRV_REQ_NO_WAIT);
+    if (ret < 0) {
+        s->stats.failed_nb++;
+        s->file_end = ret;
+    } else {
+        s->stats.bytes += end - MAX(start, s->file_end);
+        s->file_end = end;
+    }
+
+    s->prealloc_in_flight = false;
+    qemu_co_queue_restart_all(&s->prealloc_queue);
+    return ret;
+}
+
+static void coroutine_fn preallocate_co_background(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVPreallocateState *s = bs->opaque;
+    int64_t end;
+
+    /* Nothing can invalidate the state while s->prealloc_in_flight is set */
+    assert(s->data_end >= 0 && s->file_end >= 0);
+
+    end = QEMU_ALIGN_UP(s->data_end + s->opts.prealloc_size,
+                        s->opts.prealloc_align);
+    if (end > s->file_end) {
+        s->stats.background_nb++;
+        preallocate_co_extend(bs, s->file_end, end);
+    } else {
+        s->prealloc_in_flight = false;
+        qemu_co_queue_restart_all(&s->prealloc_queue);
+    }
+
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * With prealloc-async, start preallocating in the background once a write
+ * ending at @end gets within prealloc-watermark of s->file_end.
+ */
+static void preallocate_kick(BlockDriverState *bs, int64_t end)
+{
+    BDRVPreallocateState *s = bs->opaque;
+    Coroutine *co;
+
+    if (!s->opts.prealloc_async || s->prealloc_in_flight ||
+        s->file_end - end >= s->opts.prealloc_watermark) {
+        return;
+    }
+
+    s->prealloc_in_flight = true;
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(preallocate_co_background, bs);
+    aio_co_enter(bdrv_get_aio_context(bs), co);
+}
+
 static bool can_write_resize(uint64_t perm)
 {
     return (perm & BLK_PERM_WRITE) && (perm & BLK_PERM_RESIZE);
@@ -313,8 +437,18 @@ static bool coroutine_fn handle_write(BlockDriverState *bs, int64_t offset,
 
     /* Now s->data_end, s->zero_start and s->file_end are valid. */
 
+    if (end > s->file_end && s->prealloc_in_flight) {
+        /* Preallocation is late, it is likely to cover this request. */
+        s->stats.waited_nb++;
+        preallocate_wait(bs);
+        if (s->file_end < 0) {
+            return false;
+        }
+    }
+
     if (end <= s->file_end) {
         /* No preallocation needed. */
+        preallocate_kick(bs, end);
         return want_merge_zero && offset >= s->zero_start;
     }
 
@@ -324,15 +458,13 @@ static bool coroutine_fn handle_write(BlockDriverState *bs, int64_t offset,
     prealloc_end = QEMU_ALIGN_UP(end + s->opts.prealloc_size,
                                  s->opts.prealloc_align);
 
-    ret = bdrv_co_pwrite_zeroes(
-            bs->file, prealloc_start, prealloc_end - prealloc_start,
-            BDRV_REQ_NO_FALLBACK | BDRV_REQ_SERIALISING | BDRV_REQ_NO_WAIT);
+    s->prealloc_in_flight = true;
+    s->stats.sync_nb++;
+    ret = preallocate_co_extend(bs, prealloc_start, prealloc_end);
     if (ret < 0) {
-        s->file_end = ret;
         return false;
     }
 
-    s->file_end = prealloc_end;
     return want_merge_zero;
 }
 
@@ -370,6 +502,8 @@ preallocate_co_truncate(BlockDriverState *bs, int64_t offset,
     BDRVPreallocateState *s = bs->opaque;
     int ret;
 
+    preallocate_wait(bs);
+
     if (s->data_end >= 0 && offset > s->data_end) {
         if (s->file_end < 0) {
             s->file_end = bdrv_getlength(bs->file->bs);
@@ -451,12 +585,26 @@ static int64_t preallocate_getlength(BlockDriverState *bs)
     return ret;
 }
 
+static BlockStatsSpecific *preallocate_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVPreallocateState *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_PREALLOCATE;
+    stats->u.preallocate = s->stats;
+
+    return stats;
+}
+
 static int preallocate_check_perm(BlockDriverState *bs,
                                   uint64_t perm, uint64_t shared, Error **errp)
 {
     BDRVPreallocateState *s = bs->opaque;
 
     if (s->data_end >= 0 && !can_write_resize(perm)) {
+        /* Background preallocation must not move s->file_end after this */
+        preallocate_wait(bs);
+
         /*
          * Lose permissions.
          * We should truncate in check_perm, as in set_perm bs->file->perm will
@@ -543,6 +691,8 @@ BlockDriver bdrv_preallocate_filter = {
     .bdrv_co_flush = preallocate_co_flush,
     .bdrv_co_truncate = preallocate_co_truncate,
 
+    .bdrv_get_specific_stats = preallocate_get_specific_stats,
+
     .bdrv_check_perm = preallocate_check_perm,
     .bdrv_set_perm = preallocate_set_perm,
     .bdrv_child_perm = preallocate_child_perm,
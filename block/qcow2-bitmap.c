@@ -28,6 +28,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "block/aio_task.h"
 
 #include "qcow2.h"
 
@@ -278,19 +279,51 @@ static int free_bitmap_clusters(BlockDriverState *bs, Qcow2BitmapTable *tb)
     return 0;
 }
 
-/* load_bitmap_data
+typedef struct Qcow2BitmapLoadTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+    uint64_t data_offset;
+    uint64_t offset;
+    uint64_t count;
+} Qcow2BitmapLoadTask;
+
+static coroutine_fn int load_bitmap_cluster_task_entry(AioTask *task)
+{
+    Qcow2BitmapLoadTask *t = container_of(task, Qcow2BitmapLoadTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+    uint8_t *buf = g_malloc(s->cluster_size);
+    int ret;
+
+    ret = bdrv_co_pread(t->bs->file, t->data_offset, s->cluster_size, buf, 0);
+    if (ret >= 0) {
+        bdrv_dirty_bitmap_deserialize_part(t->bitmap, buf, t->offset,
+                                           t->count, false);
+    }
+    g_free(buf);
+
+    return ret < 0 ? ret : 0;
+}
+
+/*
+ * load_bitmap_data
  * @bitmap_table entries must satisfy specification constraints.
- * @bitmap must be cleared */
-static int load_bitmap_data(BlockDriverState *bs,
-                            const uint64_t *bitmap_table,
-                            uint32_t bitmap_table_size,
-                            BdrvDirtyBitmap *bitmap)
+ * @bitmap must be cleared
+ *
+ * The clusters of the bitmap are read in parallel, which makes a big
+ * difference for large images when the file has a high latency.
+ */
+static int coroutine_fn load_bitmap_data(BlockDriverState *bs,
+                                         const uint64_t *bitmap_table,
+                                         uint32_t bitmap_table_size,
+                                         BdrvDirtyBitmap *bitmap)
 {
     int ret = 0;
     BDRVQcow2State *s = bs->opaque;
     uint64_t offset, limit;
     uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
-    uint8_t *buf = NULL;
+    AioTaskPool *aio;
     uint64_t i, tab_size =
             size_to_clusters(s,
                 bdrv_dirty_bitmap_serialization_size(bitmap, 0, bm_size));
@@ -299,9 +332,10 @@ static int load_bitmap_data(BlockDriverState *bs,
         return -EINVAL;
     }
 
-    buf = g_malloc(s->cluster_size);
+    aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
     limit = bdrv_dirty_bitmap_serialization_coverage(s->cluster_size, bitmap);
-    for (i = 0, offset = 0; i < tab_size; ++i, offset += limit) {
+    for (i = 0, offset = 0; i < tab_size && aio_task_pool_status(aio) == 0;
+         ++i, offset += limit) {
         uint64_t count = MIN(bm_size - offset, limit);
         uint64_t entry = bitmap_table[i];
         uint64_t data_offset = entry & BME_TABLE_ENTRY_OFFSET_MASK;
@@ -317,26 +351,35 @@ static int load_bitmap_data(BlockDriverState *bs,
                  * already cleared */
             }
         } else {
-            ret = bdrv_pread(bs->file, data_offset, buf, s->cluster_size);
-            if (ret < 0) {
-                goto finish;
-            }
-            bdrv_dirty_bitmap_deserialize_part(bitmap, buf, offset, count,
-                                               false);
+            Qcow2BitmapLoadTask *t = g_new(Qcow2BitmapLoadTask, 1);
+
+            *t = (Qcow2BitmapLoadTask) {
+                .task.func = load_bitmap_cluster_task_entry,
+                .bs = bs,
+                .bitmap = bitmap,
+                .data_offset = data_offset,
+                .offset = offset,
+                .count = count,
+            };
+            aio_task_pool_start_task(aio, &t->task);
         }
     }
-    ret = 0;
 
-    bdrv_dirty_bitmap_deserialize_finish(bitmap);
+    aio_task_pool_wait_all(aio);
+    ret = aio_task_pool_status(aio);
+    aio_task_pool_free(aio);
+    if (ret < 0) {
+        return ret;
+    }
 
-finish:
-    g_free(buf);
+    bdrv_dirty_bitmap_deserialize_finish(bitmap);
 
-    return ret;
+    return 0;
 }
 
-static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
-                                    Qcow2Bitmap *bm, Error **errp)
+static BdrvDirtyBitmap *coroutine_fn load_bitmap(BlockDriverState *bs,
+                                                 Qcow2Bitmap *bm,
+                                                 Error **errp)
 {
     int ret;
     uint64_t *bitmap_table = NULL;
@@ -955,8 +998,8 @@ static void set_readonly_helper(gpointer bitmap, gpointer value)
  * If header_updated is not NULL then it is set appropriately regardless of
  * the return value.
  */
-bool qcow2_load_dirty_bitmaps(BlockDriverState *bs, bool *header_updated,
-                              Error **errp)
+bool coroutine_fn qcow2_load_dirty_bitmaps(BlockDriverState *bs,
+                                           bool *header_updated, Error **errp)
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2BitmapList *bm_list;
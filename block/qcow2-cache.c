@@ -24,13 +24,21 @@
 
 #include "qemu/osdep.h"
 #include "qcow2.h"
+#include "block/coroutines.h"
 #include "trace.h"
 
+/* Maximum number of adjacent tables that are written with one request */
+#define QCOW2_CACHE_MAX_MERGE 64
+
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
     int      ref;
+    /* Next entry in the same hash bucket, or -1 */
+    int      next;
     bool     dirty;
+    /* CLOCK reference bit, set when the last reference is dropped */
+    bool     referenced;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -42,6 +50,22 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /*
+     * Index of the cached tables by offset: buckets[] holds the first
+     * entry of each hash chain (or -1), which continues through
+     * Qcow2CachedTable.next.  Only entries with a non-zero offset are
+     * linked.
+     */
+    int                    *buckets;
+    unsigned                hash_mask;
+
+    /* Next entry considered for replacement by the CLOCK algorithm */
+    int                     clock_hand;
+
+    uint64_t                hits;
+    uint64_t                misses;
+    uint64_t                evictions;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -69,6 +93,82 @@ static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
     }
 }
 
+static inline unsigned qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    return (offset / c->table_size) & c->hash_mask;
+}
+
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i;
+
+    for (i = c->buckets[qcow2_cache_hash(c, offset)]; i >= 0;
+         i = c->entries[i].next) {
+        if (c->entries[i].offset == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Change the offset of entry @i, keeping the hash index up to date */
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, uint64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (t->offset) {
+        int *p = &c->buckets[qcow2_cache_hash(c, t->offset)];
+
+        while (*p != i) {
+            assert(*p >= 0);
+            p = &c->entries[*p].next;
+        }
+        *p = t->next;
+        t->next = -1;
+    }
+
+    t->offset = offset;
+    t->referenced = false;
+
+    if (offset) {
+        unsigned h = qcow2_cache_hash(c, offset);
+
+        t->next = c->buckets[h];
+        c->buckets[h] = i;
+    }
+}
+
+/*
+ * Pick the entry to replace on a cache miss.  The clock hand sweeps
+ * over the entries, giving every entry that was used since the last
+ * sweep a second chance; free entries are taken right away.
+ *
+ * Returns the index of the entry, or -1 if all entries are in use.
+ */
+static int qcow2_cache_find_victim(Qcow2Cache *c)
+{
+    int scanned;
+
+    for (scanned = 0; scanned < 2 * c->size; scanned++) {
+        int i = c->clock_hand;
+        Qcow2CachedTable *t = &c->entries[i];
+
+        if (++c->clock_hand == c->size) {
+            c->clock_hand = 0;
+        }
+        if (t->ref) {
+            continue;
+        }
+        if (t->offset && t->referenced) {
+            t->referenced = false;
+            continue;
+        }
+        return i;
+    }
+
+    return -1;
+}
+
 static void qcow2_cache_table_release(Qcow2Cache *c, int i, int num_tables)
 {
 /* Using MADV_DONTNEED to discard memory is a Linux-specific feature */
@@ -104,7 +204,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_set_offset(c, i, 0);
             c->entries[i].lru_counter = 0;
             i++;
             to_clean++;
@@ -123,6 +223,7 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -132,15 +233,25 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c = g_new0(Qcow2Cache, 1);
     c->size = num_tables;
     c->table_size = table_size;
+    c->hash_mask = pow2ceil(num_tables) - 1;
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
+    c->buckets = g_try_new(int, c->hash_mask + 1);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->buckets || !c->table_array) {
         qemu_vfree(c->table_array);
+        g_free(c->buckets);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].next = -1;
+    }
+    for (i = 0; i <= c->hash_mask; i++) {
+        c->buckets[i] = -1;
     }
 
     return c;
@@ -155,6 +266,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_free(c->buckets);
     g_free(c->entries);
     g_free(c);
 
@@ -176,18 +288,27 @@ static int qcow2_cache_flush_dependency(BlockDriverState *bs, Qcow2Cache *c)
     return 0;
 }
 
-static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
+/*
+ * Write back the @n dirty entries listed in @idx, which must cover a
+ * contiguous range of the image file in this order, with a single request.
+ */
+static int qcow2_cache_entries_flush(BlockDriverState *bs, Qcow2Cache *c,
+                                     const int *idx, int n)
 {
     BDRVQcow2State *s = bs->opaque;
+    int64_t offset = c->entries[idx[0]].offset;
+    uint64_t bytes = (uint64_t) n * c->table_size;
+    QEMUIOVector qiov;
     int ret = 0;
+    int i;
 
-    if (!c->entries[i].dirty || !c->entries[i].offset) {
-        return 0;
+    for (i = 0; i < n; i++) {
+        assert(c->entries[idx[i]].dirty);
+        assert(c->entries[idx[i]].offset == offset + i * c->table_size);
+        trace_qcow2_cache_entry_flush(qemu_coroutine_self(),
+                                      c == s->l2_table_cache, idx[i]);
     }
 
-    trace_qcow2_cache_entry_flush(qemu_coroutine_self(),
-                                  c == s->l2_table_cache, i);
-
     if (c->depends) {
         ret = qcow2_cache_flush_dependency(bs, c);
     } else if (c->depends_on_flush) {
@@ -203,47 +324,98 @@ static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
 
     if (c == s->refcount_block_cache) {
         ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_REFCOUNT_BLOCK,
-                c->entries[i].offset, c->table_size, false);
+                offset, bytes, false);
     } else if (c == s->l2_table_cache) {
         ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_ACTIVE_L2,
-                c->entries[i].offset, c->table_size, false);
+                offset, bytes, false);
     } else {
         ret = qcow2_pre_write_overlap_check(bs, 0,
-                c->entries[i].offset, c->table_size, false);
+                offset, bytes, false);
     }
 
     if (ret < 0) {
         return ret;
     }
 
-    if (c == s->refcount_block_cache) {
-        BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_UPDATE_PART);
-    } else if (c == s->l2_table_cache) {
-        BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE);
+    qemu_iovec_init(&qiov, n);
+    for (i = 0; i < n; i++) {
+        if (c == s->refcount_block_cache) {
+            BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_UPDATE_PART);
+        } else if (c == s->l2_table_cache) {
+            BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE);
+        }
+        qemu_iovec_add(&qiov, qcow2_cache_get_table_addr(c, idx[i]),
+                       c->table_size);
     }
 
-    ret = bdrv_pwrite(bs->file, c->entries[i].offset,
-                      qcow2_cache_get_table_addr(c, i), c->table_size);
+    ret = bdrv_pwritev(bs->file, offset, bytes, &qiov, 0);
+    qemu_iovec_destroy(&qiov);
     if (ret < 0) {
         return ret;
     }
 
-    c->entries[i].dirty = false;
+    for (i = 0; i < n; i++) {
+        c->entries[idx[i]].dirty = false;
+    }
 
     return 0;
 }
 
+static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
+{
+    if (!c->entries[i].dirty || !c->entries[i].offset) {
+        return 0;
+    }
+
+    return qcow2_cache_entries_flush(bs, c, &i, 1);
+}
+
+static gint qcow2_cache_compare_offset(gconstpointer a, gconstpointer b,
+                                       gpointer opaque)
+{
+    Qcow2Cache *c = opaque;
+    int64_t offset_a = c->entries[*(const int *) a].offset;
+    int64_t offset_b = c->entries[*(const int *) b].offset;
+
+    return offset_a < offset_b ? -1 : offset_a > offset_b;
+}
+
 int qcow2_cache_write(BlockDriverState *bs, Qcow2Cache *c)
 {
     BDRVQcow2State *s = bs->opaque;
+    g_autofree int *dirty = NULL;
+    int nb_dirty = 0;
     int result = 0;
     int ret;
-    int i;
+    int i, j;
 
     trace_qcow2_cache_flush(qemu_coroutine_self(), c == s->l2_table_cache);
 
+    dirty = g_new(int, c->size);
     for (i = 0; i < c->size; i++) {
-        ret = qcow2_cache_entry_flush(bs, c, i);
+        if (c->entries[i].dirty && c->entries[i].offset) {
+            dirty[nb_dirty++] = i;
+        }
+    }
+
+    /*
+     * Write the dirty tables in the order of their offsets, merging runs
+     * of tables that are adjacent in the image file (e.g. the slices of
+     * one L2 table, or refcount blocks allocated one after another) into
+     * a single request.
+     */
+    g_qsort_with_data(dirty, nb_dirty, sizeof(int),
+                      qcow2_cache_compare_offset, c);
+
+    for (i = 0; i < nb_dirty; i = j) {
+        for (j = i + 1; j < nb_dirty && j - i < QCOW2_CACHE_MAX_MERGE; j++) {
+            if (c->entries[dirty[j]].offset !=
+                c->entries[dirty[j - 1]].offset + c->table_size) {
+                break;
+            }
+        }
+
+        ret = qcow2_cache_entries_flush(bs, c, &dirty[i], j - i);
         if (ret < 0 && result != -ENOSPC) {
             result = ret;
         }
@@ -305,13 +477,14 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
+        qcow2_cache_set_offset(c, i, 0);
         c->entries[i].lru_counter = 0;
     }
 
     qcow2_cache_table_release(c, 0, c->size);
 
     c->lru_counter = 0;
+    c->clock_hand = 0;
 
     return 0;
 }
@@ -322,9 +495,6 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -339,29 +509,24 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    i = qcow2_cache_lookup(c, offset);
+    if (i >= 0) {
+        c->hits++;
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    i = qcow2_cache_find_victim(c);
+    if (i < 0) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    c->misses++;
+    if (c->entries[i].offset) {
+        c->evictions++;
+    }
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -372,7 +537,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -386,7 +551,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
@@ -420,6 +585,7 @@ void qcow2_cache_put(Qcow2Cache *c, void **table)
 
     if (c->entries[i].ref == 0) {
         c->entries[i].lru_counter = ++c->lru_counter;
+        c->entries[i].referenced = true;
     }
 
     assert(c->entries[i].ref >= 0);
@@ -434,14 +600,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -450,9 +611,23 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     c->entries[i].lru_counter = 0;
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+Qcow2MetadataCacheStats *qcow2_cache_get_stats(Qcow2Cache *c)
+{
+    Qcow2MetadataCacheStats *stats = g_new(Qcow2MetadataCacheStats, 1);
+
+    *stats = (Qcow2MetadataCacheStats) {
+        .entries = c->size,
+        .hits = c->hits,
+        .misses = c->misses,
+        .evictions = c->evictions,
+    };
+
+    return stats;
+}
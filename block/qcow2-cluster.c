@@ -547,6 +547,77 @@ static int coroutine_fn do_perform_cow_write(BlockDriverState *bs,
     return 0;
 }
 
+/*
+ * Copy the COW region @r of @m with copy offloading, without reading it
+ * into memory.  Data in the backing file or in another cluster of the
+ * data file is copied with bdrv_co_copy_range(), which can use reflinks,
+ * and zero data becomes a write_zeroes request.  Returns -ENOTSUP if
+ * some part of the region cannot be offloaded, but the protocol driver
+ * may fail with other errors, e.g. -EXDEV, as well.
+ */
+static int coroutine_fn do_perform_cow_copy(BlockDriverState *bs,
+                                            QCowL2Meta *m,
+                                            Qcow2COWRegion *r)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (r->nb_bytes == 0) {
+        return 0;
+    }
+
+    if (!bs->drv) {
+        return -ENOMEDIUM;
+    }
+
+    ret = qcow2_pre_write_overlap_check(bs, 0, m->alloc_offset + r->offset,
+                                        r->nb_bytes, true);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Like do_perform_cow_read(), bypass the request tracking of @bs */
+    BLKDBG_EVENT(bs->file, BLKDBG_COW_WRITE);
+    return bs->drv->bdrv_co_copy_range_from(bs, NULL, m->offset + r->offset,
+                                            s->data_file,
+                                            m->alloc_offset + r->offset,
+                                            r->nb_bytes, 0, 0);
+}
+
+/*
+ * Perform the COW for @m with do_perform_cow_copy(), and write the guest
+ * data if it was merged into @m.  Called with s->lock unlocked.
+ */
+static int coroutine_fn perform_cow_offload(BlockDriverState *bs,
+                                            QCowL2Meta *m)
+{
+    Qcow2COWRegion *start = &m->cow_start;
+    Qcow2COWRegion *end = &m->cow_end;
+    unsigned data_offset = start->offset + start->nb_bytes;
+    unsigned data_bytes = end->offset - data_offset;
+    QEMUIOVector qiov;
+    int ret;
+
+    ret = do_perform_cow_copy(bs, m, start);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = do_perform_cow_copy(bs, m, end);
+    if (ret < 0 || !m->data_qiov) {
+        return ret;
+    }
+
+    qemu_iovec_init(&qiov, qemu_iovec_subvec_niov(m->data_qiov,
+                                                  m->data_qiov_offset,
+                                                  data_bytes));
+    qemu_iovec_concat(&qiov, m->data_qiov, m->data_qiov_offset, data_bytes);
+    BLKDBG_EVENT(bs->file, BLKDBG_WRITE_AIO);
+    ret = do_perform_cow_write(bs, m->alloc_offset, data_offset, &qiov);
+    qemu_iovec_destroy(&qiov);
+    return ret;
+}
+
 
 /*
  * get_host_offset
@@ -844,6 +915,9 @@ int qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
         return cluster_offset;
     }
 
+    /* The space may have held another compressed cluster before */
+    qcow2_decompressed_cache_invalidate(bs, cluster_offset, compressed_size);
+
     nb_csectors =
         (cluster_offset + compressed_size - 1) / QCOW2_COMPRESSED_SECTOR_SIZE -
         (cluster_offset / QCOW2_COMPRESSED_SECTOR_SIZE);
@@ -891,6 +965,25 @@ static int perform_cow(BlockDriverState *bs, QCowL2Meta *m)
         return 0;
     }
 
+    /*
+     * Avoid the bounce buffer if the data file can offload copies.  For
+     * large clusters this saves reading and writing most of a cluster
+     * through memory for each small write.  Fall back to the buffer if
+     * offloading fails for any reason, e.g. for compressed clusters or
+     * when the backing file does not support it; nothing has been linked
+     * into the L2 table yet, so the whole COW can simply be redone.
+     */
+    if (!bs->encrypted && s->data_file->bs->drv &&
+        s->data_file->bs->drv->bdrv_co_copy_range_to) {
+        qemu_co_mutex_unlock(&s->lock);
+        ret = perform_cow_offload(bs, m);
+        qemu_co_mutex_lock(&s->lock);
+        if (ret == 0) {
+            qcow2_cache_depends_on_flush(s->l2_table_cache);
+            return 0;
+        }
+    }
+
     /* If we have to read both the start and end COW regions and the
      * middle region is not too large then perform just one read
      * operation */
@@ -910,7 +1003,7 @@ static int perform_cow(BlockDriverState *bs, QCowL2Meta *m)
 
     /* Reserve a buffer large enough to store all the data that we're
      * going to read */
-    start_buffer = qemu_try_blockalign(bs, buffer_size);
+    start_buffer = qemu_try_bounce_buf(bs, buffer_size);
     if (start_buffer == NULL) {
         return -ENOMEM;
     }
@@ -1006,7 +1099,7 @@ fail:
         qcow2_cache_depends_on_flush(s->l2_table_cache);
     }
 
-    qemu_vfree(start_buffer);
+    qemu_bounce_buf_free(bs, start_buffer, buffer_size);
     qemu_iovec_destroy(&qiov);
     return ret;
 }
@@ -1545,6 +1638,44 @@ out:
     return ret;
 }
 
+/*
+ * Hand out up to *nb_clusters clusters from the start of the reserved data
+ * extent.  Both the host offset and the number of clusters are returned.
+ */
+static void take_data_extent(BlockDriverState *bs, uint64_t *host_offset,
+                             uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t n = MIN(*nb_clusters, s->data_extent_clusters);
+
+    *host_offset = s->data_extent_offset;
+    *nb_clusters = n;
+    s->data_extent_offset += n << s->cluster_bits;
+    s->data_extent_clusters -= n;
+}
+
+/*
+ * Free the host clusters that are still reserved for guest data.  This
+ * must be called before the refcount structures are walked or rebuilt,
+ * and before the image is closed.
+ */
+void qcow2_release_data_extent(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->data_extent_clusters) {
+        return;
+    }
+
+    trace_qcow2_data_extent_release(bs, s->data_extent_offset,
+                                    s->data_extent_clusters);
+    qcow2_free_clusters(bs, s->data_extent_offset,
+                        s->data_extent_clusters << s->cluster_bits,
+                        QCOW2_DISCARD_NEVER);
+    s->data_extent_offset = 0;
+    s->data_extent_clusters = 0;
+}
+
 /*
  * Allocates new clusters for the given guest_offset.
  *
@@ -1581,8 +1712,36 @@ static int do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
+    if (s->data_extent_clusters &&
+        (*host_offset == INV_OFFSET || *host_offset == s->data_extent_offset))
+    {
+        take_data_extent(bs, host_offset, nb_clusters);
+        return 0;
+    }
+
     if (*host_offset == INV_OFFSET) {
-        int64_t cluster_offset =
+        uint64_t extent_clusters = QCOW2_DATA_EXTENT_SIZE >> s->cluster_bits;
+        int64_t cluster_offset;
+
+        /*
+         * Small allocations reserve a whole extent, so that the next ones
+         * can be served without touching the refcounts.  If that fails
+         * (e.g. close to the maximum image size), allocate just what is
+         * needed.
+         */
+        if (extent_clusters > *nb_clusters) {
+            cluster_offset = qcow2_alloc_clusters(bs, QCOW2_DATA_EXTENT_SIZE);
+            if (cluster_offset >= 0) {
+                trace_qcow2_data_extent_reserve(bs, cluster_offset,
+                                                extent_clusters);
+                s->data_extent_offset = cluster_offset;
+                s->data_extent_clusters = extent_clusters;
+                take_data_extent(bs, host_offset, nb_clusters);
+                return 0;
+            }
+        }
+
+        cluster_offset =
             qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
         if (cluster_offset < 0) {
             return cluster_offset;
@@ -25,6 +25,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qcow2.h"
+#include "block/aio_task.h"
 #include "qemu/range.h"
 #include "qemu/bswap.h"
 #include "qemu/cutils.h"
@@ -1246,6 +1247,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     uint64_t *l1_table, *l2_slice, l2_offset, entry, l1_size2, refcount;
     bool l1_allocated = false;
     int64_t old_entry, old_l2_offset;
+    uint64_t run_start, run_end;
     unsigned slice, slice_size2, n_slices;
     int i, j, l1_modified = 0, nb_csectors;
     int ret;
@@ -1307,6 +1309,13 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                     goto fail;
                 }
 
+                /*
+                 * When taking a snapshot, the refcounts of the data
+                 * clusters are only incremented, so they can be updated
+                 * for whole runs of contiguous clusters at once.
+                 */
+                run_start = run_end = 0;
+
                 for (j = 0; j < s->l2_slice_size; j++) {
                     uint64_t cluster_index;
                     uint64_t offset;
@@ -1353,6 +1362,22 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
 
                         cluster_index = offset >> s->cluster_bits;
                         assert(cluster_index);
+                        if (addend > 0) {
+                            if (offset != run_end) {
+                                ret = update_refcount(bs, run_start,
+                                                      run_end - run_start, 1,
+                                                      false,
+                                                      QCOW2_DISCARD_SNAPSHOT);
+                                if (ret < 0) {
+                                    goto fail;
+                                }
+                                run_start = offset;
+                            }
+                            run_end = offset + s->cluster_size;
+                            /* Shared with the snapshot now */
+                            refcount = 2;
+                            break;
+                        }
                         if (addend != 0) {
                             ret = qcow2_update_cluster_refcount(
                                 bs, cluster_index, abs(addend), addend < 0,
@@ -1391,6 +1416,12 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                     }
                 }
 
+                ret = update_refcount(bs, run_start, run_end - run_start, 1,
+                                      false, QCOW2_DISCARD_SNAPSHOT);
+                if (ret < 0) {
+                    goto fail;
+                }
+
                 qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
             }
 
@@ -1587,10 +1618,104 @@ enum {
     CHECK_FRAG_INFO = 0x2,      /* update BlockFragInfo counters */
 };
 
+/* Memory used for reading L2 tables ahead while checking an image */
+#define CHECK_L2_READAHEAD_SIZE (16 * MiB)
+#define CHECK_L2_READAHEAD_MAX_TABLES 64
+
+typedef struct CheckL2ReadTask {
+    AioTask task;
+    BlockDriverState *bs;
+    uint64_t offset;
+    void *buf;
+    int *ret;
+} CheckL2ReadTask;
+
+static int coroutine_fn check_l2_read_task_entry(AioTask *task)
+{
+    CheckL2ReadTask *t = container_of(task, CheckL2ReadTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+
+    *t->ret = bdrv_co_pread(t->bs->file, t->offset,
+                            s->l2_size * l2_entry_size(s), t->buf, 0);
+    /* Errors are reported for each table by the caller */
+    return 0;
+}
+
+/*
+ * Returns how many L2 tables are read in one go by check_read_l2_tables()
+ * and allocates a buffer for them in *buf.
+ */
+static int check_alloc_l2_tables(BlockDriverState *bs, uint64_t **buf)
+{
+    BDRVQcow2State *s = bs->opaque;
+    size_t l2_size = s->l2_size * l2_entry_size(s);
+    int n = MIN(MAX(CHECK_L2_READAHEAD_SIZE / l2_size, 1),
+                CHECK_L2_READAHEAD_MAX_TABLES);
+
+    *buf = qemu_try_blockalign(bs->file->bs, n * l2_size);
+    if (!*buf) {
+        n = 1;
+        *buf = qemu_try_blockalign(bs->file->bs, l2_size);
+    }
+    return *buf ? n : -ENOMEM;
+}
+
+/*
+ * Reads the L2 tables at the @n offsets in @l2_offsets (0 for none) into
+ * consecutive L2 table sized slots of @buf and stores the result of each
+ * read in @rets.
+ *
+ * Checking an image is dominated by the latency of reading its L2 tables,
+ * so in coroutine context the tables are read in parallel.
+ */
+static void check_read_l2_tables(BlockDriverState *bs,
+                                 const uint64_t *l2_offsets, int n,
+                                 uint64_t *buf, int *rets)
+{
+    BDRVQcow2State *s = bs->opaque;
+    size_t l2_size = s->l2_size * l2_entry_size(s);
+    AioTaskPool *pool = NULL;
+    int i;
+
+    if (qemu_in_coroutine()) {
+        pool = aio_task_pool_new(QCOW2_MAX_WORKERS);
+    }
+
+    for (i = 0; i < n; i++) {
+        void *table = (uint8_t *)buf + i * l2_size;
+        CheckL2ReadTask *t;
+
+        rets[i] = 0;
+        if (!l2_offsets[i]) {
+            continue;
+        }
+
+        if (!pool) {
+            rets[i] = bdrv_pread(bs->file, l2_offsets[i], table, l2_size);
+            continue;
+        }
+
+        t = g_new(CheckL2ReadTask, 1);
+        *t = (CheckL2ReadTask) {
+            .task.func = check_l2_read_task_entry,
+            .bs = bs,
+            .offset = l2_offsets[i],
+            .buf = table,
+            .ret = &rets[i],
+        };
+        aio_task_pool_start_task(pool, &t->task);
+    }
+
+    if (pool) {
+        aio_task_pool_wait_all(pool);
+        aio_task_pool_free(pool);
+    }
+}
+
 /*
  * Increases the refcount in the given refcount table for the all clusters
- * referenced in the L2 table. While doing so, performs some checks on L2
- * entries.
+ * referenced in the L2 table, which has been read from @l2_offset into
+ * @l2_table. While doing so, performs some checks on L2 entries.
  *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
@@ -1598,23 +1723,13 @@ enum {
 static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                               void **refcount_table,
                               int64_t *refcount_table_size, int64_t l2_offset,
-                              int flags, BdrvCheckMode fix, bool active)
+                              uint64_t *l2_table, int flags, BdrvCheckMode fix,
+                              bool active)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l2_table, l2_entry;
+    uint64_t l2_entry;
     uint64_t next_contiguous_offset = 0;
-    int i, l2_size, nb_csectors, ret;
-
-    /* Read L2 table from disk */
-    l2_size = s->l2_size * l2_entry_size(s);
-    l2_table = g_malloc(l2_size);
-
-    ret = bdrv_pread(bs->file, l2_offset, l2_table, l2_size);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        goto fail;
-    }
+    int i, nb_csectors, ret;
 
     /* Do the actual checks */
     for(i = 0; i < s->l2_size; i++) {
@@ -1647,7 +1762,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                 l2_entry & QCOW2_COMPRESSED_SECTOR_MASK,
                 nb_csectors * QCOW2_COMPRESSED_SECTOR_SIZE);
             if (ret < 0) {
-                goto fail;
+                return ret;
             }
 
             if (flags & CHECK_FRAG_INFO) {
@@ -1702,7 +1817,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                             res->check_errors++;
                             /* Something is seriously wrong, so abort checking
                              * this L2 table */
-                            goto fail;
+                            return ret;
                         }
 
                         ret = bdrv_pwrite_sync(bs->file, l2e_offset,
@@ -1743,7 +1858,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                                                refcount_table_size,
                                                offset, s->cluster_size);
                 if (ret < 0) {
-                    goto fail;
+                    return ret;
                 }
             }
             break;
@@ -1758,12 +1873,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
-    g_free(l2_table);
     return 0;
-
-fail:
-    g_free(l2_table);
-    return ret;
 }
 
 /*
@@ -1782,8 +1892,11 @@ static int check_refcounts_l1(BlockDriverState *bs,
                               int flags, BdrvCheckMode fix, bool active)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l1_table = NULL, l2_offset, l1_size2;
-    int i, ret;
+    uint64_t *l1_table = NULL, *l2_tables = NULL, l2_offset, l1_size2;
+    size_t l2_size = s->l2_size * l2_entry_size(s);
+    g_autofree uint64_t *l2_offsets = NULL;
+    g_autofree int *rets = NULL;
+    int i, j, n, batch, ret;
 
     l1_size2 = l1_size * L1E_SIZE;
 
@@ -1812,12 +1925,30 @@ static int check_refcounts_l1(BlockDriverState *bs,
             be64_to_cpus(&l1_table[i]);
     }
 
+    batch = check_alloc_l2_tables(bs, &l2_tables);
+    if (batch < 0) {
+        ret = batch;
+        res->check_errors++;
+        goto fail;
+    }
+    l2_offsets = g_new(uint64_t, batch);
+    rets = g_new(int, batch);
+
     /* Do the actual checks */
-    for(i = 0; i < l1_size; i++) {
-        l2_offset = l1_table[i];
-        if (l2_offset) {
+    for (i = 0; i < l1_size; i += n) {
+        n = MIN(batch, l1_size - i);
+        for (j = 0; j < n; j++) {
+            l2_offsets[j] = l1_table[i + j] & L1E_OFFSET_MASK;
+        }
+        check_read_l2_tables(bs, l2_offsets, n, l2_tables, rets);
+
+        for (j = 0; j < n; j++) {
+            l2_offset = l2_offsets[j];
+            if (!l2_offset) {
+                continue;
+            }
+
             /* Mark L2 table as used */
-            l2_offset &= L1E_OFFSET_MASK;
             ret = qcow2_inc_refcounts_imrt(bs, res,
                                            refcount_table, refcount_table_size,
                                            l2_offset, s->cluster_size);
@@ -1832,19 +1963,30 @@ static int check_refcounts_l1(BlockDriverState *bs,
                 res->corruptions++;
             }
 
+            if (rets[j] < 0) {
+                fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+                res->check_errors++;
+                ret = rets[j];
+                goto fail;
+            }
+
             /* Process and check L2 entries */
             ret = check_refcounts_l2(bs, res, refcount_table,
-                                     refcount_table_size, l2_offset, flags,
-                                     fix, active);
+                                     refcount_table_size, l2_offset,
+                                     (uint64_t *)((uint8_t *)l2_tables +
+                                                  j * l2_size),
+                                     flags, fix, active);
             if (ret < 0) {
                 goto fail;
             }
         }
     }
+    qemu_vfree(l2_tables);
     g_free(l1_table);
     return 0;
 
 fail:
+    qemu_vfree(l2_tables);
     g_free(l1_table);
     return ret;
 }
@@ -1861,10 +2003,13 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
                               BdrvCheckMode fix)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l2_table = qemu_blockalign(bs, s->cluster_size);
+    size_t l2_size = s->l2_size * l2_entry_size(s);
+    uint64_t *l2_tables = NULL, *l2_table;
+    g_autofree uint64_t *l2_offsets = NULL;
+    g_autofree int *rets = NULL;
     int ret;
     uint64_t refcount;
-    int i, j;
+    int i, j, k, n, batch;
     bool repair;
 
     if (fix & BDRV_FIX_ERRORS) {
@@ -1879,11 +2024,30 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
         repair = false;
     }
 
-    for (i = 0; i < s->l1_size; i++) {
+    batch = check_alloc_l2_tables(bs, &l2_tables);
+    if (batch < 0) {
+        res->check_errors++;
+        return batch;
+    }
+    l2_offsets = g_new(uint64_t, batch);
+    rets = g_new(int, batch);
+
+    for (i = 0, k = 0, n = 0; i < s->l1_size; i++, k++) {
         uint64_t l1_entry = s->l1_table[i];
         uint64_t l2_offset = l1_entry & L1E_OFFSET_MASK;
         int l2_dirty = 0;
 
+        if (k == n) {
+            /* Read the next batch of L2 tables */
+            n = MIN(batch, s->l1_size - i);
+            for (k = 0; k < n; k++) {
+                l2_offsets[k] = s->l1_table[i + k] & L1E_OFFSET_MASK;
+            }
+            check_read_l2_tables(bs, l2_offsets, n, l2_tables, rets);
+            k = 0;
+        }
+        l2_table = (uint64_t *)((uint8_t *)l2_tables + k * l2_size);
+
         if (!l2_offset) {
             continue;
         }
@@ -1913,8 +2077,7 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
             }
         }
 
-        ret = bdrv_pread(bs->file, l2_offset, l2_table,
-                         s->l2_size * l2_entry_size(s));
+        ret = rets[k];
         if (ret < 0) {
             fprintf(stderr, "ERROR: Could not read L2 table: %s\n",
                     strerror(-ret));
@@ -1977,13 +2140,21 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
             }
             res->corruptions -= l2_dirty;
             res->corruptions_fixed += l2_dirty;
+
+            /* Tables that were read ahead must not miss the repair */
+            for (j = k + 1; j < n; j++) {
+                if (l2_offsets[j] == l2_offset && rets[j] >= 0) {
+                    memcpy((uint8_t *)l2_tables + j * l2_size, l2_table,
+                           l2_size);
+                }
+            }
         }
     }
 
     ret = 0;
 
 fail:
-    qemu_vfree(l2_table);
+    qemu_vfree(l2_tables);
     return ret;
 }
 
@@ -611,6 +611,9 @@ static int coroutine_fn qcow2_co_check_locked(BlockDriverState *bs,
 
     memset(result, 0, sizeof(*result));
 
+    /* Reserved clusters would otherwise be reported as leaked */
+    qcow2_release_data_extent(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -697,6 +700,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_COMPRESSED_CACHE_SIZE,
     NULL
 };
 
@@ -808,6 +812,11 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_COMPRESSED_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum size of the cache of decompressed clusters",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -826,14 +835,32 @@ static const char *overlap_bool_option_names[QCOW2_OL_MAX_BITNR] = {
     [QCOW2_OL_BITMAP_DIRECTORY_BITNR] = QCOW2_OPT_OVERLAP_BITMAP_DIRECTORY,
 };
 
-static void cache_clean_timer_cb(void *opaque)
+/*
+ * Requests can run in other AioContexts than the one of the timer (see
+ * blk_set_multi_context()), so the caches are only touched with s->lock
+ * held.  Draining waits for the cleaning thanks to the in-flight count.
+ */
+static void coroutine_fn cache_clean_co(void *opaque)
 {
     BlockDriverState *bs = opaque;
     BDRVQcow2State *s = bs->opaque;
+
+    qemu_co_mutex_lock(&s->lock);
     qcow2_cache_clean_unused(s->l2_table_cache);
     qcow2_cache_clean_unused(s->refcount_block_cache);
+    qemu_co_mutex_unlock(&s->lock);
     timer_mod(s->cache_clean_timer, qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL) +
               (int64_t) s->cache_clean_interval * 1000);
+    bdrv_dec_in_flight(bs);
+}
+
+static void cache_clean_timer_cb(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    Coroutine *co = qemu_coroutine_create(cache_clean_co, bs);
+
+    bdrv_inc_in_flight(bs);
+    aio_co_enter(bdrv_get_aio_context(bs), co);
 }
 
 static void cache_clean_timer_init(BlockDriverState *bs, AioContext *context)
@@ -961,6 +988,122 @@ static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     return true;
 }
 
+/*
+ * Cache of decompressed clusters, so that reading a compressed cluster in
+ * small chunks does not decompress the whole cluster for each of them.
+ * Entries are looked up by the host offset of the compressed data, which
+ * does not change until the compressed cluster is freed and its space
+ * is allocated again; qcow2_alloc_compressed_cluster_offset() drops the
+ * entries that overlap a new allocation.
+ *
+ * Lookups and updates do not yield, so they need no lock.
+ */
+struct Qcow2DecompressedCluster {
+    uint64_t coffset; /* 0 if the entry is unused */
+    int csize;
+    uint64_t lru_counter;
+    uint8_t *buf;
+};
+
+static void qcow2_decompressed_cache_free(BDRVQcow2State *s)
+{
+    int i;
+
+    if (!s->decompressed_cache) {
+        return;
+    }
+
+    for (i = 0; i < s->decompressed_cache_entries; i++) {
+        qemu_vfree(s->decompressed_cache[i].buf);
+    }
+    g_free(s->decompressed_cache);
+    s->decompressed_cache = NULL;
+}
+
+static Qcow2DecompressedCluster *
+qcow2_decompressed_cache_find(BDRVQcow2State *s, uint64_t coffset, int csize)
+{
+    int i;
+
+    if (!s->decompressed_cache) {
+        return NULL;
+    }
+
+    for (i = 0; i < s->decompressed_cache_entries; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed_cache[i];
+
+        if (c->coffset == coffset && c->csize == csize) {
+            c->lru_counter = ++s->decompressed_cache_lru_counter;
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Store the decompressed data in *buf in the cache.  The cache takes
+ * ownership of *buf, and *buf is replaced with a buffer that the caller
+ * must free (possibly the same buffer, possibly NULL).
+ */
+static void qcow2_decompressed_cache_insert(BlockDriverState *bs,
+                                            uint64_t coffset, int csize,
+                                            uint8_t **buf)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *victim = NULL;
+    uint8_t *old_buf;
+    int i;
+
+    if (!s->decompressed_cache_entries ||
+        qcow2_decompressed_cache_find(s, coffset, csize)) {
+        return;
+    }
+
+    if (!s->decompressed_cache) {
+        s->decompressed_cache = g_new0(Qcow2DecompressedCluster,
+                                       s->decompressed_cache_entries);
+    }
+
+    for (i = 0; i < s->decompressed_cache_entries; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed_cache[i];
+
+        if (!victim || c->lru_counter < victim->lru_counter) {
+            victim = c;
+        }
+    }
+
+    old_buf = victim->buf;
+    *victim = (Qcow2DecompressedCluster) {
+        .coffset = coffset,
+        .csize = csize,
+        .lru_counter = ++s->decompressed_cache_lru_counter,
+        .buf = *buf,
+    };
+    *buf = old_buf;
+}
+
+void qcow2_decompressed_cache_invalidate(BlockDriverState *bs,
+                                         uint64_t offset, uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+
+    if (!s->decompressed_cache) {
+        return;
+    }
+
+    for (i = 0; i < s->decompressed_cache_entries; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed_cache[i];
+
+        if (c->coffset && c->coffset < offset + bytes &&
+            offset < c->coffset + c->csize) {
+            c->coffset = 0;
+            c->lru_counter = 0;
+        }
+    }
+}
+
 typedef struct Qcow2ReopenState {
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
@@ -969,6 +1112,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    int decompressed_cache_entries;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -982,6 +1126,7 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t compressed_cache_size;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1070,6 +1215,18 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    compressed_cache_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_COMPRESSED_CACHE_SIZE,
+                          DEFAULT_COMPRESSED_CACHE_SIZE);
+    compressed_cache_size = DIV_ROUND_UP(compressed_cache_size,
+                                         s->cluster_size);
+    if (compressed_cache_size > INT_MAX) {
+        error_setg(errp, "Compressed cluster cache size too big");
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->decompressed_cache_entries = compressed_cache_size;
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1225,6 +1382,11 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    if (s->decompressed_cache_entries != r->decompressed_cache_entries) {
+        qcow2_decompressed_cache_free(s);
+        s->decompressed_cache_entries = r->decompressed_cache_entries;
+    }
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1946,6 +2108,9 @@ static int qcow2_reopen_prepare(BDRVReopenState *state,
             goto fail;
         }
 
+        /* Return the reserved data clusters before the image is clean */
+        qcow2_release_data_extent(state->bs);
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -2176,7 +2341,7 @@ qcow2_co_preadv_encrypted(BlockDriverState *bs,
      * encrypted nature of the virtual disk.
      */
 
-    buf = qemu_try_blockalign(s->data_file->bs, bytes);
+    buf = qemu_try_bounce_buf(s->data_file->bs, bytes);
     if (buf == NULL) {
         return -ENOMEM;
     }
@@ -2195,7 +2360,7 @@ qcow2_co_preadv_encrypted(BlockDriverState *bs,
     qemu_iovec_from_buf(qiov, qiov_offset, buf, bytes);
 
 fail:
-    qemu_vfree(buf);
+    qemu_bounce_buf_free(s->data_file->bs, buf, bytes);
 
     return ret;
 }
@@ -2528,7 +2693,7 @@ static coroutine_fn int qcow2_co_pwritev_task(BlockDriverState *bs,
     if (bs->encrypted) {
         assert(s->crypto);
         assert(bytes <= QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
-        crypt_buf = qemu_try_blockalign(bs->file->bs, bytes);
+        crypt_buf = qemu_try_bounce_buf(bs->file->bs, bytes);
         if (crypt_buf == NULL) {
             ret = -ENOMEM;
             goto out_unlocked;
@@ -2579,7 +2744,7 @@ out_locked:
     qcow2_handle_l2meta(bs, &l2meta, false);
     qemu_co_mutex_unlock(&s->lock);
 
-    qemu_vfree(crypt_buf);
+    qemu_bounce_buf_free(bs->file->bs, crypt_buf, bytes);
 
     return ret;
 }
@@ -2683,6 +2848,8 @@ static int qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    qcow2_release_data_extent(bs);
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2726,6 +2893,7 @@ static void qcow2_close(BlockDriverState *bs)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qcow2_decompressed_cache_free(s);
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -4228,6 +4396,9 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
             goto fail;
         }
 
+        /* Don't keep clusters at the end of the file allocated */
+        qcow2_release_data_extent(bs);
+
         ret = qcow2_cluster_discard(bs, ROUND_UP(offset, s->cluster_size),
                                     old_length - ROUND_UP(offset,
                                                           s->cluster_size),
@@ -4550,78 +4721,163 @@ fail:
     return ret;
 }
 
+/*
+ * Compressed writes are processed in batches of at most this many bytes: all
+ * clusters of a batch are compressed concurrently, then host space for all of
+ * them is allocated in a single pass under s->lock, which packs them back to
+ * back, and finally every contiguous run of compressed data is written with a
+ * single request.
+ */
+#define QCOW2_COMPRESS_BATCH_SIZE (8 * MiB)
+
+typedef struct Qcow2CompressedCluster {
+    uint64_t offset;
+    uint64_t bytes;
+    size_t qiov_offset;
+    uint8_t *out_buf;
+    ssize_t out_len; /* -ENOMEM if the data does not compress */
+    uint64_t host_offset;
+} Qcow2CompressedCluster;
+
+typedef struct Qcow2CompressTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    QEMUIOVector *qiov;
+    Qcow2CompressedCluster *cluster;
+} Qcow2CompressTask;
+
 static coroutine_fn int
-qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
-                                 uint64_t offset, uint64_t bytes,
-                                 QEMUIOVector *qiov, size_t qiov_offset)
+qcow2_co_compress_cluster(BlockDriverState *bs, QEMUIOVector *qiov,
+                          Qcow2CompressedCluster *c)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret;
-    ssize_t out_len;
-    uint8_t *buf, *out_buf;
-    uint64_t cluster_offset;
+    uint8_t *buf;
 
-    assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
-           (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
+    assert(c->bytes == s->cluster_size || (c->bytes < s->cluster_size &&
+           (c->offset + c->bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
 
     buf = qemu_blockalign(bs, s->cluster_size);
-    if (bytes < s->cluster_size) {
+    if (c->bytes < s->cluster_size) {
         /* Zero-pad last write if image size is not cluster aligned */
-        memset(buf + bytes, 0, s->cluster_size - bytes);
+        memset(buf + c->bytes, 0, s->cluster_size - c->bytes);
     }
-    qemu_iovec_to_buf(qiov, qiov_offset, buf, bytes);
+    qemu_iovec_to_buf(qiov, c->qiov_offset, buf, c->bytes);
 
-    out_buf = g_malloc(s->cluster_size);
+    c->out_buf = g_malloc(s->cluster_size);
+    c->out_len = qcow2_co_compress(bs, c->out_buf, s->cluster_size - 1,
+                                   buf, s->cluster_size);
+    qemu_vfree(buf);
 
-    out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
-                                buf, s->cluster_size);
-    if (out_len == -ENOMEM) {
-        /* could not compress: write normal cluster */
-        ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
-        if (ret < 0) {
-            goto fail;
-        }
-        goto success;
-    } else if (out_len < 0) {
-        ret = -EINVAL;
-        goto fail;
+    if (c->out_len < 0 && c->out_len != -ENOMEM) {
+        return -EINVAL;
     }
+    return 0;
+}
 
-    qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
-                                                &cluster_offset);
+static coroutine_fn int qcow2_co_compress_task_entry(AioTask *task)
+{
+    Qcow2CompressTask *t = container_of(task, Qcow2CompressTask, task);
+
+    return qcow2_co_compress_cluster(t->bs, t->qiov, t->cluster);
+}
+
+static coroutine_fn int
+qcow2_co_pwritev_compressed_batch(BlockDriverState *bs,
+                                  Qcow2CompressedCluster *clusters,
+                                  int nb_clusters, QEMUIOVector *qiov)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QEMUIOVector run;
+    uint64_t run_offset, run_bytes;
+    int i, ret;
+
+    if (nb_clusters == 1) {
+        ret = qcow2_co_compress_cluster(bs, qiov, &clusters[0]);
+    } else {
+        AioTaskPool *aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+
+        for (i = 0; i < nb_clusters && aio_task_pool_status(aio) == 0; i++) {
+            Qcow2CompressTask *t = g_new(Qcow2CompressTask, 1);
+
+            *t = (Qcow2CompressTask) {
+                .task.func = qcow2_co_compress_task_entry,
+                .bs = bs,
+                .qiov = qiov,
+                .cluster = &clusters[i],
+            };
+            aio_task_pool_start_task(aio, &t->task);
+        }
+
+        aio_task_pool_wait_all(aio);
+        ret = aio_task_pool_status(aio);
+        g_free(aio);
+    }
     if (ret < 0) {
-        qemu_co_mutex_unlock(&s->lock);
-        goto fail;
+        return ret;
     }
 
-    ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
+    qemu_co_mutex_lock(&s->lock);
+    for (i = 0; i < nb_clusters; i++) {
+        Qcow2CompressedCluster *c = &clusters[i];
+
+        if (c->out_len < 0) {
+            continue;
+        }
+
+        ret = qcow2_alloc_compressed_cluster_offset(bs, c->offset, c->out_len,
+                                                    &c->host_offset);
+        if (ret < 0) {
+            break;
+        }
+
+        ret = qcow2_pre_write_overlap_check(bs, 0, c->host_offset, c->out_len,
+                                            true);
+        if (ret < 0) {
+            break;
+        }
+    }
     qemu_co_mutex_unlock(&s->lock);
     if (ret < 0) {
-        goto fail;
+        return ret;
     }
 
-    BLKDBG_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
-    ret = bdrv_co_pwrite(s->data_file, cluster_offset, out_len, out_buf, 0);
-    if (ret < 0) {
-        goto fail;
-    }
-success:
-    ret = 0;
-fail:
-    qemu_vfree(buf);
-    g_free(out_buf);
-    return ret;
-}
+    i = 0;
+    while (i < nb_clusters) {
+        Qcow2CompressedCluster *c = &clusters[i];
 
-static coroutine_fn int qcow2_co_pwritev_compressed_task_entry(AioTask *task)
-{
-    Qcow2AioTask *t = container_of(task, Qcow2AioTask, task);
+        if (c->out_len < 0) {
+            /* could not compress: write normal cluster */
+            ret = qcow2_co_pwritev_part(bs, c->offset, c->bytes, qiov,
+                                        c->qiov_offset, 0);
+            if (ret < 0) {
+                return ret;
+            }
+            i++;
+            continue;
+        }
+
+        qemu_iovec_init(&run, nb_clusters - i);
+        run_offset = c->host_offset;
+        run_bytes = 0;
+        for (; i < nb_clusters; i++) {
+            c = &clusters[i];
+            if (c->out_len < 0 || c->host_offset != run_offset + run_bytes) {
+                break;
+            }
+            qemu_iovec_add(&run, c->out_buf, c->out_len);
+            run_bytes += c->out_len;
+        }
 
-    assert(!t->subcluster_type && !t->l2meta);
+        BLKDBG_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
+        ret = bdrv_co_pwritev(s->data_file, run_offset, run_bytes, &run, 0);
+        qemu_iovec_destroy(&run);
+        if (ret < 0) {
+            return ret;
+        }
+    }
 
-    return qcow2_co_pwritev_compressed_task(t->bs, t->offset, t->bytes, t->qiov,
-                                            t->qiov_offset);
+    return 0;
 }
 
 /*
@@ -4634,7 +4890,8 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
                                  QEMUIOVector *qiov, size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
-    AioTaskPool *aio = NULL;
+    Qcow2CompressedCluster *clusters;
+    int i, max_clusters;
     int ret = 0;
 
     if (has_data_file(bs)) {
@@ -4663,31 +4920,35 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         return -EINVAL;
     }
 
-    while (bytes && aio_task_pool_status(aio) == 0) {
-        uint64_t chunk_size = MIN(bytes, s->cluster_size);
+    max_clusters = MAX(QCOW2_COMPRESS_BATCH_SIZE >> s->cluster_bits, 1);
+    clusters = g_new(Qcow2CompressedCluster,
+                     MIN(size_to_clusters(s, bytes), max_clusters));
 
-        if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
-        }
+    while (bytes && ret == 0) {
+        int nb_clusters = 0;
 
-        ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
-                             0, 0, offset, chunk_size, qiov, qiov_offset, NULL);
-        if (ret < 0) {
-            break;
+        while (bytes && nb_clusters < max_clusters) {
+            uint64_t chunk_size = MIN(bytes, s->cluster_size);
+
+            clusters[nb_clusters++] = (Qcow2CompressedCluster) {
+                .offset = offset,
+                .bytes = chunk_size,
+                .qiov_offset = qiov_offset,
+            };
+            qiov_offset += chunk_size;
+            offset += chunk_size;
+            bytes -= chunk_size;
         }
-        qiov_offset += chunk_size;
-        offset += chunk_size;
-        bytes -= chunk_size;
-    }
 
-    if (aio) {
-        aio_task_pool_wait_all(aio);
-        if (ret == 0) {
-            ret = aio_task_pool_status(aio);
+        ret = qcow2_co_pwritev_compressed_batch(bs, clusters, nb_clusters,
+                                                qiov);
+
+        for (i = 0; i < nb_clusters; i++) {
+            g_free(clusters[i].out_buf);
         }
-        g_free(aio);
     }
 
+    g_free(clusters);
     return ret;
 }
 
@@ -4700,6 +4961,7 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
                            size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *cached;
     int ret = 0, csize, nb_csectors;
     uint64_t coffset;
     uint8_t *buf, *out_buf;
@@ -4710,6 +4972,13 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
     csize = nb_csectors * QCOW2_COMPRESSED_SECTOR_SIZE -
         (coffset & ~QCOW2_COMPRESSED_SECTOR_MASK);
 
+    cached = qcow2_decompressed_cache_find(s, coffset, csize);
+    if (cached) {
+        qemu_iovec_from_buf(qiov, qiov_offset,
+                            cached->buf + offset_in_cluster, bytes);
+        return 0;
+    }
+
     buf = g_try_malloc(csize);
     if (!buf) {
         return -ENOMEM;
@@ -4729,6 +4998,7 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
     }
 
     qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
+    qcow2_decompressed_cache_insert(bs, coffset, csize, &out_buf);
 
 fail:
     qemu_vfree(out_buf);
@@ -4895,6 +5165,9 @@ static int qcow2_make_empty(BlockDriverState *bs)
     int step = QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size);
     int l1_clusters, ret = 0;
 
+    /* make_completely_empty() rebuilds the refcounts from scratch */
+    qcow2_release_data_extent(bs);
+
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
@@ -5203,6 +5476,20 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2 = (BlockStatsSpecificQcow2) {
+        .l2_cache = qcow2_cache_get_stats(s->l2_table_cache),
+        .refcount_cache = qcow2_cache_get_stats(s->refcount_block_cache),
+    };
+
+    return stats;
+}
+
 static int qcow2_has_zero_init(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -5489,6 +5776,9 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
     Qcow2AmendHelperCBInfo helper_cb_info;
     bool encryption_update = false;
 
+    /* Changing the refcount order or the version rewrites the refcounts */
+    qcow2_release_data_extent(bs);
+
     while (desc && desc->name) {
         if (!qemu_opt_find(opts, desc->name)) {
             /* only change explicitly defined options */
@@ -5931,6 +6221,7 @@ static const char *const qcow2_strong_runtime_opts[] = {
 BlockDriver bdrv_qcow2 = {
     .format_name        = "qcow2",
     .instance_size      = sizeof(BDRVQcow2State),
+    .supports_multi_context = true,
     .bdrv_probe         = qcow2_probe,
     .bdrv_open          = qcow2_open,
     .bdrv_close         = qcow2_close,
@@ -5965,6 +6256,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
@@ -71,6 +71,12 @@
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
+/*
+ * Size of the runs of host clusters that are reserved at once for guest
+ * data, see BDRVQcow2State.data_extent_offset
+ */
+#define QCOW2_DATA_EXTENT_SIZE (1 * MiB)
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -129,6 +135,8 @@
 
 #define DEFAULT_CLUSTER_SIZE 65536
 
+#define DEFAULT_COMPRESSED_CACHE_SIZE (1 * MiB)
+
 #define QCOW2_OPT_DATA_FILE "data-file"
 #define QCOW2_OPT_LAZY_REFCOUNTS "lazy-refcounts"
 #define QCOW2_OPT_DISCARD_REQUEST "pass-discard-request"
@@ -150,6 +158,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_COMPRESSED_CACHE_SIZE "compressed-cache-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -230,6 +239,7 @@ typedef struct QCowSnapshot {
 
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
+typedef struct Qcow2DecompressedCluster Qcow2DecompressedCluster;
 
 typedef struct Qcow2CryptoHeaderExtension {
     uint64_t offset;
@@ -348,6 +358,14 @@ typedef struct BDRVQcow2State {
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
+    /*
+     * Recently decompressed clusters, allocated on the first read of a
+     * compressed cluster
+     */
+    Qcow2DecompressedCluster *decompressed_cache;
+    int decompressed_cache_entries;
+    uint64_t decompressed_cache_lru_counter;
+
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -357,6 +375,18 @@ typedef struct BDRVQcow2State {
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
 
+    /*
+     * Host clusters that have been allocated in the refcount structures
+     * but are not referenced by any L2 entry yet.  Data cluster
+     * allocations are served from this run, so that most writes to
+     * unallocated areas do not have to search and update refcount
+     * blocks while holding s->lock.  The clusters are given back by
+     * qcow2_release_data_extent() before anything that walks or rebuilds
+     * the refcounts; if QEMU dies they show up as leaked clusters.
+     */
+    uint64_t data_extent_offset;
+    uint64_t data_extent_clusters;
+
     CoMutex lock;
 
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
@@ -843,6 +873,8 @@ int qcow2_validate_table(BlockDriverState *bs, uint64_t offset,
                          uint64_t entries, size_t entry_len,
                          int64_t max_size_bytes, const char *table_name,
                          Error **errp);
+void qcow2_decompressed_cache_invalidate(BlockDriverState *bs,
+                                         uint64_t offset, uint64_t bytes);
 
 /* qcow2-refcount.c functions */
 int qcow2_refcount_init(BlockDriverState *bs);
@@ -917,6 +949,7 @@ int qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
 
 int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m);
 void qcow2_alloc_cluster_abort(BlockDriverState *bs, QCowL2Meta *m);
+void qcow2_release_data_extent(BlockDriverState *bs);
 int qcow2_cluster_discard(BlockDriverState *bs, uint64_t offset,
                           uint64_t bytes, enum qcow2_discard_type type,
                           bool full_discard);
@@ -973,13 +1006,14 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+Qcow2MetadataCacheStats *qcow2_cache_get_stats(Qcow2Cache *c);
 
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
                                   void **refcount_table,
                                   int64_t *refcount_table_size);
-bool qcow2_load_dirty_bitmaps(BlockDriverState *bs, bool *header_updated,
-                              Error **errp);
+bool coroutine_fn qcow2_load_dirty_bitmaps(BlockDriverState *bs,
+                                           bool *header_updated, Error **errp);
 bool qcow2_get_bitmap_info_list(BlockDriverState *bs,
                                 Qcow2BitmapInfoList **info_list, Error **errp);
 int qcow2_reopen_bitmaps_rw(BlockDriverState *bs, Error **errp);
@@ -22,6 +22,7 @@
 #include "block/qdict.h"
 #include "crypto/secret.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "sysemu/replay.h"
 #include "qapi/qmp/qstring.h"
 #include "qapi/qmp/qdict.h"
@@ -61,6 +62,18 @@
 
 #define RBD_ENCRYPTION_LUKS_HEADER_VERIFICATION_LEN 8
 
+/* Returned by the rbd_diff_iterate2 callback to stop the iteration early */
+#define QEMU_RBD_EXIT_DIFF_ITERATE2 -9000
+
+/*
+ * Minimum range scanned by a block status query.  Looking ahead of the
+ * request is cheap with fast-diff, and lets later queries of a
+ * sequential scan be answered from the cached extent.
+ */
+#define QEMU_RBD_BLOCK_STATUS_LOOKAHEAD (1 * GiB)
+
+#define QEMU_RBD_MAX_IMAGE_HANDLES 16
+
 static const char rbd_luks_header_verification[
         RBD_ENCRYPTION_LUKS_HEADER_VERIFICATION_LEN] = {
     'L', 'U', 'K', 'S', 0xBA, 0xBE, 0, 1
@@ -79,23 +92,46 @@ typedef enum {
     RBD_AIO_WRITE_ZEROES
 } RBDAIOCmd;
 
+typedef struct RBDTask RBDTask;
+
 typedef struct BDRVRBDState {
     rados_t cluster;
     rados_ioctx_t io_ctx;
     rbd_image_t image;
+    /*
+     * Additional handles of the same image, used to spread reads over
+     * more than one librbd dispatch queue.  Everything else goes through
+     * @image, so only reads that fit in @extra_size may use them.
+     */
+    rbd_image_t *extra_images;
+    unsigned int nb_extra_images;
+    unsigned int next_image;
+    uint64_t extra_size;
+    bool rbd_cache;
     char *image_name;
     char *snap;
     char *namespace;
     uint64_t image_size;
     uint64_t object_size;
+
+    /* Last extent found by qemu_rbd_co_block_status, if bytes != 0 */
+    struct {
+        uint64_t offs;
+        uint64_t bytes;
+        bool exists;
+    } status_cache;
+
+    /* Tasks completed by librbd, waiting for qemu_rbd_finish_bh */
+    QSLIST_HEAD(, RBDTask) completed;
 } BDRVRBDState;
 
-typedef struct RBDTask {
+struct RBDTask {
     BlockDriverState *bs;
     Coroutine *co;
     bool complete;
     int64_t ret;
-} RBDTask;
+    QSLIST_ENTRY(RBDTask) next;
+};
 
 static int qemu_rbd_connect(rados_t *cluster, rados_ioctx_t *io_ctx,
                             BlockdevOptionsRbd *opts, bool cache,
@@ -888,6 +924,60 @@ static int qemu_rbd_attempt_legacy_options(QDict *options,
     return r;
 }
 
+static void qemu_rbd_close_extra_images(BDRVRBDState *s)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->nb_extra_images; i++) {
+        rbd_close(s->extra_images[i]);
+    }
+    g_free(s->extra_images);
+    s->extra_images = NULL;
+    s->nb_extra_images = 0;
+}
+
+static int qemu_rbd_open_extra_images(BDRVRBDState *s,
+                                      BlockdevOptionsRbd *opts, Error **errp)
+{
+    unsigned int n = opts->has_image_handles ? opts->image_handles : 1;
+    int r;
+
+    if (n == 0 || n > QEMU_RBD_MAX_IMAGE_HANDLES) {
+        error_setg(errp, "image-handles must be between 1 and %d",
+                   QEMU_RBD_MAX_IMAGE_HANDLES);
+        return -EINVAL;
+    }
+
+    s->extra_images = g_new(rbd_image_t, n - 1);
+    s->extra_size = s->image_size;
+    while (s->nb_extra_images < n - 1) {
+        rbd_image_t *image = &s->extra_images[s->nb_extra_images];
+
+        r = rbd_open(s->io_ctx, s->image_name, image, s->snap);
+        if (r < 0) {
+            error_setg_errno(errp, -r, "error opening additional handle "
+                             "for %s", s->image_name);
+            goto fail;
+        }
+        s->nb_extra_images++;
+
+#ifdef LIBRBD_SUPPORTS_ENCRYPTION
+        if (opts->has_encrypt) {
+            r = qemu_rbd_encryption_load(*image, opts->encrypt, errp);
+            if (r < 0) {
+                goto fail;
+            }
+        }
+#endif
+    }
+
+    return 0;
+
+fail:
+    qemu_rbd_close_extra_images(s);
+    return r;
+}
+
 static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
                          Error **errp)
 {
@@ -983,6 +1073,22 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
     s->image_size = info.size;
     s->object_size = info.obj_size;
 
+    r = qemu_rbd_open_extra_images(s, opts, errp);
+    if (r < 0) {
+        goto failed_post_open;
+    }
+    s->rbd_cache = !(flags & BDRV_O_NOCACHE);
+    if (s->nb_extra_images && s->rbd_cache && (flags & BDRV_O_RDWR)) {
+        /*
+         * Each handle has its own cache, so reads through the extra
+         * handles would miss data that is only in the cache of @image.
+         */
+        error_setg(errp, "image-handles greater than 1 requires "
+                   "cache.direct=on for writable images");
+        r = -EINVAL;
+        goto failed_post_open;
+    }
+
     /* If we are using an rbd snapshot, we must be r/o, otherwise
      * leave as-is */
     if (s->snap != NULL) {
@@ -1003,6 +1109,7 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
     goto out;
 
 failed_post_open:
+    qemu_rbd_close_extra_images(s);
     rbd_close(s->image);
 failed_open:
     rados_ioctx_destroy(s->io_ctx);
@@ -1040,6 +1147,7 @@ static void qemu_rbd_close(BlockDriverState *bs)
 {
     BDRVRBDState *s = bs->opaque;
 
+    qemu_rbd_close_extra_images(s);
     rbd_close(s->image);
     rados_ioctx_destroy(s->io_ctx);
     g_free(s->snap);
@@ -1059,15 +1167,23 @@ static int qemu_rbd_resize(BlockDriverState *bs, uint64_t size)
     }
 
     s->image_size = size;
+    s->extra_size = MIN(s->extra_size, size);
+    s->status_cache.bytes = 0;
 
     return 0;
 }
 
 static void qemu_rbd_finish_bh(void *opaque)
 {
-    RBDTask *task = opaque;
-    task->complete = true;
-    aio_co_wake(task->co);
+    BDRVRBDState *s = opaque;
+    QSLIST_HEAD(, RBDTask) completed;
+    RBDTask *task, *next;
+
+    QSLIST_MOVE_ATOMIC(&completed, &s->completed);
+    QSLIST_FOREACH_SAFE(task, &completed, next, next) {
+        task->complete = true;
+        aio_co_wake(task->co);
+    }
 }
 
 /*
@@ -1081,10 +1197,40 @@ static void qemu_rbd_finish_bh(void *opaque)
  */
 static void qemu_rbd_completion_cb(rbd_completion_t c, RBDTask *task)
 {
+    BDRVRBDState *s = task->bs->opaque;
+
     task->ret = rbd_aio_get_return_value(c);
     rbd_aio_release(c);
-    aio_bh_schedule_oneshot(bdrv_get_aio_context(task->bs),
-                            qemu_rbd_finish_bh, task);
+
+    /*
+     * Completions that arrive before the BH runs are handled by the same
+     * BH, so only schedule it if the list was empty.
+     */
+    QSLIST_INSERT_HEAD_ATOMIC(&s->completed, task, next);
+    if (!QSLIST_NEXT(task, next)) {
+        aio_bh_schedule_oneshot(bdrv_get_aio_context(task->bs),
+                                qemu_rbd_finish_bh, s);
+    }
+}
+
+/*
+ * Pick the image handle for a read.  The extra handles do not share the
+ * librbd cache of s->image, so they are only used when that cache is
+ * disabled or the image cannot be written.
+ */
+static rbd_image_t qemu_rbd_read_image(BlockDriverState *bs,
+                                       uint64_t offset, uint64_t bytes)
+{
+    BDRVRBDState *s = bs->opaque;
+    unsigned int i;
+
+    if (!s->nb_extra_images || offset + bytes > s->extra_size ||
+        (s->rbd_cache && !bdrv_is_read_only(bs))) {
+        return s->image;
+    }
+
+    i = s->next_image++ % (s->nb_extra_images + 1);
+    return i ? s->extra_images[i - 1] : s->image;
 }
 
 static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
@@ -1101,6 +1247,10 @@ static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
 
     assert(!qiov || qiov->size == bytes);
 
+    if (cmd != RBD_AIO_READ && cmd != RBD_AIO_FLUSH) {
+        s->status_cache.bytes = 0;
+    }
+
     r = rbd_aio_create_completion(&task,
                                   (rbd_callback_t) qemu_rbd_completion_cb, &c);
     if (r < 0) {
@@ -1109,7 +1259,8 @@ static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
 
     switch (cmd) {
     case RBD_AIO_READ:
-        r = rbd_aio_readv(s->image, qiov->iov, qiov->niov, offset, c);
+        r = rbd_aio_readv(qemu_rbd_read_image(bs, offset, bytes),
+                          qiov->iov, qiov->niov, offset, c);
         break;
     case RBD_AIO_WRITE:
         r = rbd_aio_writev(s->image, qiov->iov, qiov->niov, offset, c);
@@ -1148,6 +1299,11 @@ static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
         qemu_coroutine_yield();
     }
 
+    /* A block status query may have run while the request was in flight */
+    if (cmd != RBD_AIO_READ && cmd != RBD_AIO_FLUSH) {
+        s->status_cache.bytes = 0;
+    }
+
     if (task.ret < 0) {
         error_report("rbd request failed: cmd %d offset %" PRIu64 " bytes %"
                      PRIu64 " flags %d task.ret %" PRIi64 " (%s)", cmd, offset,
@@ -1212,6 +1368,115 @@ coroutine_fn qemu_rbd_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
 }
 #endif
 
+typedef struct RBDDiffIterateReq {
+    uint64_t offs;
+    uint64_t bytes;
+    bool exists;
+} RBDDiffIterateReq;
+
+/*
+ * Callback of rbd_diff_iterate2.  Without a snapshot to diff against,
+ * it is only called for allocated extents, in increasing order.
+ */
+static int qemu_rbd_diff_iterate_cb(uint64_t offs, size_t len,
+                                    int exists, void *opaque)
+{
+    RBDDiffIterateReq *req = opaque;
+
+    assert(req->offs + req->bytes <= offs);
+    assert(exists);
+
+    if (!req->exists && offs > req->offs) {
+        /*
+         * We started in a hole and found the first allocated extent;
+         * the hole ends here.
+         */
+        req->bytes = offs - req->offs;
+        return QEMU_RBD_EXIT_DIFF_ITERATE2;
+    }
+
+    if (req->exists && offs > req->offs + req->bytes) {
+        /*
+         * We started in an allocated extent and skipped over a hole;
+         * req->bytes already covers the allocated part.
+         */
+        return QEMU_RBD_EXIT_DIFF_ITERATE2;
+    }
+
+    req->bytes += len;
+    req->exists = true;
+
+    return 0;
+}
+
+static int coroutine_fn qemu_rbd_co_block_status(BlockDriverState *bs,
+                                                 bool want_zero, int64_t offset,
+                                                 int64_t bytes, int64_t *pnum,
+                                                 int64_t *map,
+                                                 BlockDriverState **file)
+{
+    BDRVRBDState *s = bs->opaque;
+    RBDDiffIterateReq req = { .offs = offset };
+    uint64_t features, flags, scan;
+    int status, r;
+
+    assert(offset + bytes <= s->image_size);
+
+    /* default to all sectors allocated */
+    status = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+    *map = offset;
+    *file = bs;
+    *pnum = bytes;
+
+    if (s->status_cache.bytes &&
+        offset >= s->status_cache.offs &&
+        offset < s->status_cache.offs + s->status_cache.bytes) {
+        req.exists = s->status_cache.exists;
+        req.bytes = s->status_cache.offs + s->status_cache.bytes - offset;
+        goto out;
+    }
+
+    /* check if RBD image supports fast-diff */
+    r = rbd_get_features(s->image, &features);
+    if (r < 0 || !(features & RBD_FEATURE_FAST_DIFF)) {
+        return status;
+    }
+
+    /* check if RBD fast-diff result is valid */
+    r = rbd_get_flags(s->image, &flags);
+    if (r < 0 || (flags & RBD_FLAG_FAST_DIFF_INVALID)) {
+        return status;
+    }
+
+    scan = MIN(MAX(bytes, QEMU_RBD_BLOCK_STATUS_LOOKAHEAD),
+               s->image_size - offset);
+    r = rbd_diff_iterate2(s->image, NULL, offset, scan, true, true,
+                          qemu_rbd_diff_iterate_cb, &req);
+    if (r < 0 && r != QEMU_RBD_EXIT_DIFF_ITERATE2) {
+        return status;
+    }
+    assert(req.bytes <= scan);
+    if (!req.exists && r == 0) {
+        /*
+         * rbd_diff_iterate2 does not invoke the callback for holes, so
+         * no callback at all means that the whole range is a hole.
+         */
+        assert(req.bytes == 0);
+        req.bytes = scan;
+    }
+
+    s->status_cache.offs = req.offs;
+    s->status_cache.bytes = req.bytes;
+    s->status_cache.exists = req.exists;
+
+out:
+    if (!req.exists) {
+        status = BDRV_BLOCK_ZERO | BDRV_BLOCK_OFFSET_VALID;
+    }
+    *pnum = MIN(req.bytes, bytes);
+    return status;
+}
+
 static int qemu_rbd_getinfo(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
     BDRVRBDState *s = bs->opaque;
@@ -1362,6 +1627,7 @@ static int qemu_rbd_snap_rollback(BlockDriverState *bs,
 {
     BDRVRBDState *s = bs->opaque;
 
+    s->status_cache.bytes = 0;
     return rbd_snap_rollback(s->image, snapshot_name);
 }
 
@@ -1412,7 +1678,10 @@ static void coroutine_fn qemu_rbd_co_invalidate_cache(BlockDriverState *bs,
                                                       Error **errp)
 {
     BDRVRBDState *s = bs->opaque;
-    int r = rbd_invalidate_cache(s->image);
+    int r;
+
+    s->status_cache.bytes = 0;
+    r = rbd_invalidate_cache(s->image);
     if (r < 0) {
         error_setg_errno(errp, -r, "Failed to invalidate the cache");
     }
@@ -1491,6 +1760,7 @@ static BlockDriver bdrv_rbd = {
     .bdrv_co_pwritev        = qemu_rbd_co_pwritev,
     .bdrv_co_flush_to_disk  = qemu_rbd_co_flush,
     .bdrv_co_pdiscard       = qemu_rbd_co_pdiscard,
+    .bdrv_co_block_status   = qemu_rbd_co_block_status,
 #ifdef LIBRBD_SUPPORTS_WRITE_ZEROES
     .bdrv_co_pwrite_zeroes  = qemu_rbd_co_pwrite_zeroes,
 #endif
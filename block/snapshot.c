@@ -250,6 +250,7 @@ int bdrv_snapshot_goto(BlockDriverState *bs,
         return -EBUSY;
     }
 
+    bdrv_block_status_cache_invalidate(bs);
     if (drv->bdrv_snapshot_goto) {
         ret = drv->bdrv_snapshot_goto(bs, snapshot_id);
         if (ret < 0) {
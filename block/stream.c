@@ -21,6 +21,7 @@
 #include "qemu/ratelimit.h"
 #include "sysemu/block-backend.h"
 #include "block/copy-on-read.h"
+#include "block/aio_task.h"
 
 enum {
     /*
@@ -29,8 +30,19 @@ enum {
      * that populating contiguous regions of the image is efficient.
      */
     STREAM_CHUNK = 512 * 1024, /* in bytes */
+
+    /* Chunks copied in parallel */
+    STREAM_MAX_WORKERS = 8,
 };
 
+/* A chunk that could not be copied, to be retried by the job coroutine */
+typedef struct StreamFailure {
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+    QSIMPLEQ_ENTRY(StreamFailure) next;
+} StreamFailure;
+
 typedef struct StreamBlockJob {
     BlockJob common;
     BlockDriverState *base_overlay; /* COW overlay (stream from this) */
@@ -40,8 +52,16 @@ typedef struct StreamBlockJob {
     BlockdevOnError on_error;
     char *backing_file_str;
     bool bs_read_only;
+    QSIMPLEQ_HEAD(, StreamFailure) failures;
 } StreamBlockJob;
 
+typedef struct StreamTask {
+    AioTask task;
+    StreamBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} StreamTask;
+
 static int coroutine_fn stream_populate(BlockBackend *blk,
                                         int64_t offset, uint64_t bytes)
 {
@@ -102,16 +122,124 @@ static void stream_clean(Job *job)
     g_free(s->backing_file_str);
 }
 
+static int coroutine_fn stream_task_entry(AioTask *task)
+{
+    StreamTask *t = container_of(task, StreamTask, task);
+    StreamBlockJob *s = t->s;
+    int ret;
+
+    ret = stream_populate(s->common.blk, t->offset, t->bytes);
+    if (ret < 0) {
+        StreamFailure *f = g_new(StreamFailure, 1);
+
+        *f = (StreamFailure) {
+            .offset = t->offset,
+            .bytes = t->bytes,
+            .ret = ret,
+        };
+        QSIMPLEQ_INSERT_TAIL(&s->failures, f, next);
+    } else {
+        job_progress_update(&s->common.job, t->bytes);
+    }
+
+    /* Errors are handled by stream_retry_failures() */
+    return 0;
+}
+
+/*
+ * Handle the chunks that could not be copied, one by one in the job
+ * coroutine, so that stopping on errors works as in a sequential copy.
+ * Returns the error to fail the job with, or 0.
+ */
+static int coroutine_fn stream_retry_failures(StreamBlockJob *s,
+                                              AioTaskPool *aio, int *error)
+{
+    StreamFailure *f;
+
+    if (QSIMPLEQ_EMPTY(&s->failures)) {
+        return 0;
+    }
+    aio_task_pool_wait_all(aio);
+
+    while ((f = QSIMPLEQ_FIRST(&s->failures)) != NULL) {
+        BlockErrorAction action =
+            block_job_error_action(&s->common, s->on_error, true, -f->ret);
+
+        if (action == BLOCK_ERROR_ACTION_STOP) {
+            job_sleep_ns(&s->common.job, 0);
+            if (job_is_cancelled(&s->common.job)) {
+                return 0;
+            }
+            f->ret = stream_populate(s->common.blk, f->offset, f->bytes);
+            if (f->ret < 0) {
+                continue;
+            }
+        } else {
+            if (*error == 0) {
+                *error = f->ret;
+            }
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                return f->ret;
+            }
+        }
+
+        job_progress_update(&s->common.job, f->bytes);
+        QSIMPLEQ_REMOVE_HEAD(&s->failures, next);
+        g_free(f);
+    }
+
+    return 0;
+}
+
+/*
+ * Find out whether [offset, offset + *pnum) has to be copied, with *pnum
+ * as large as possible.  Returns 1 if it has to, 0 if not, or a negative
+ * errno value.
+ */
+static int coroutine_fn stream_block_status(StreamBlockJob *s,
+                                            BlockDriverState *unfiltered_bs,
+                                            int64_t offset, int64_t len,
+                                            int64_t *pnum)
+{
+    int ret;
+
+    ret = bdrv_is_allocated(unfiltered_bs, offset, len - offset, pnum);
+    if (ret == 1) {
+        /* Allocated in the top, no need to copy.  */
+        return 0;
+    } else if (ret < 0) {
+        return ret;
+    }
+
+    /*
+     * Copy if allocated in the intermediate images.  Limit to the
+     * known-unallocated area [offset, offset + *pnum).
+     */
+    ret = bdrv_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
+                                  s->base_overlay, true,
+                                  offset, *pnum, pnum);
+    /* Finish early if end of backing file has been reached */
+    if (ret == 0 && *pnum == 0) {
+        *pnum = len - offset;
+    }
+
+    return ret > 0 ? 1 : ret;
+}
+
 static int coroutine_fn stream_run(Job *job, Error **errp)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
-    BlockBackend *blk = s->common.blk;
     BlockDriverState *unfiltered_bs = bdrv_skip_filters(s->target_bs);
+    AioTaskPool *aio;
+    StreamFailure *f;
     int64_t len;
     int64_t offset = 0;
     uint64_t delay_ns = 0;
     int error = 0;
     int64_t n = 0; /* bytes */
+    /* Result of the last allocation query, which may span many chunks */
+    int64_t status_end = 0;
+    bool status_copy = false;
 
     if (unfiltered_bs == s->base_overlay) {
         /* Nothing to stream */
@@ -124,39 +252,54 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     }
     job_progress_set_remaining(&s->common.job, len);
 
+    QSIMPLEQ_INIT(&s->failures);
+    aio = aio_task_pool_new(STREAM_MAX_WORKERS);
+
     for ( ; offset < len; offset += n) {
         bool copy;
         int ret;
 
-        /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+        /*
+         * Note that even when no rate limit is applied we need to yield
+         * here so that bdrv_drain_all() returns.  Requests that are still
+         * in flight are waited for by the drain.
          */
         job_sleep_ns(&s->common.job, delay_ns);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
 
-        copy = false;
-
-        ret = bdrv_is_allocated(unfiltered_bs, offset, STREAM_CHUNK, &n);
-        if (ret == 1) {
-            /* Allocated in the top, no need to copy.  */
-        } else if (ret >= 0) {
-            /* Copy if allocated in the intermediate images.  Limit to the
-             * known-unallocated area [offset, offset+n*BDRV_SECTOR_SIZE).  */
-            ret = bdrv_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
-                                          s->base_overlay, true,
-                                          offset, n, &n);
-            /* Finish early if end of backing file has been reached */
-            if (ret == 0 && n == 0) {
-                n = len - offset;
-            }
+        if (stream_retry_failures(s, aio, &error) < 0 ||
+            job_is_cancelled(&s->common.job)) {
+            break;
+        }
 
-            copy = (ret > 0);
+        if (offset < status_end) {
+            ret = status_copy;
+            n = status_end - offset;
+        } else {
+            ret = stream_block_status(s, unfiltered_bs, offset, len, &n);
+            trace_stream_one_iteration(s, offset, n, ret);
+            if (ret >= 0) {
+                status_end = offset + n;
+                status_copy = ret;
+            }
         }
-        trace_stream_one_iteration(s, offset, n, ret);
+
+        copy = ret > 0;
         if (copy) {
-            ret = stream_populate(blk, offset, n);
+            StreamTask *t = g_new(StreamTask, 1);
+
+            n = MIN(n, STREAM_CHUNK);
+            *t = (StreamTask) {
+                .task.func = stream_task_entry,
+                .s = s,
+                .offset = offset,
+                .bytes = n,
+            };
+            aio_task_pool_start_task(aio, &t->task);
+            delay_ns = block_job_ratelimit_get_delay(&s->common, n);
+            continue;
         }
         if (ret < 0) {
             BlockErrorAction action =
@@ -175,11 +318,21 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
 
         /* Publish progress */
         job_progress_update(&s->common.job, n);
-        if (copy) {
-            delay_ns = block_job_ratelimit_get_delay(&s->common, n);
-        } else {
-            delay_ns = 0;
+        delay_ns = 0;
+    }
+
+    aio_task_pool_wait_all(aio);
+    if (!job_is_cancelled(&s->common.job) && offset >= len) {
+        stream_retry_failures(s, aio, &error);
+    }
+    aio_task_pool_free(aio);
+
+    while ((f = QSIMPLEQ_FIRST(&s->failures)) != NULL) {
+        if (error == 0) {
+            error = f->ret;
         }
+        QSIMPLEQ_REMOVE_HEAD(&s->failures, next);
+        g_free(f);
     }
 
     /* Do not remove the backing file if an error was there but ignored. */
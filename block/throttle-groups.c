@@ -70,11 +70,13 @@ struct ThrottleGroup {
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    QemuMutex lock; /* This lock protects the following five fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[2];
     bool any_timer_armed[2];
+    /* Virtual time of the last request that was started */
+    uint64_t vtime[2];
     QEMUClockType clock_type;
 
     /* This field is protected by the global QEMU mutex */
@@ -206,8 +208,27 @@ static inline bool tgm_has_pending_reqs(ThrottleGroupMember *tgm,
     return tgm->pending_reqs[is_write];
 }
 
-/* Return the next ThrottleGroupMember in the round-robin sequence with pending
- * I/O requests.
+/*
+ * Return whether the next request of @a should be served before the one
+ * of @b: members with a higher priority always go first, members with
+ * the same priority share the group in proportion to their weights
+ * (start-time fair queuing on the vtime of each member).
+ *
+ * This assumes that tg->lock is held.
+ */
+static inline bool tgm_precedes(ThrottleGroupMember *a, ThrottleGroupMember *b,
+                                bool is_write)
+{
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    return a->vtime[is_write] < b->vtime[is_write];
+}
+
+/*
+ * Return the next ThrottleGroupMember with pending I/O requests.  Members
+ * are visited in round-robin order starting after the current token, so
+ * that members with the same priority and vtime take turns.
  *
  * This assumes that tg->lock is held.
  *
@@ -221,7 +242,7 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    ThrottleGroupMember *token, *start;
+    ThrottleGroupMember *token, *start, *best = NULL;
 
     /* If this member has its I/O limits disabled then it means that
      * it's being drained. Skip the round-robin search and return tgm
@@ -234,19 +255,20 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
 
     start = token = tg->tokens[is_write];
 
-    /* get next bs round in round robin style */
-    token = throttle_group_next_tgm(token);
-    while (token != start && !tgm_has_pending_reqs(token, is_write)) {
+    do {
         token = throttle_group_next_tgm(token);
-    }
+        if (tgm_has_pending_reqs(token, is_write) &&
+            (!best || tgm_precedes(token, best, is_write))) {
+            best = token;
+        }
+    } while (token != start);
 
-    /* If no IO are queued for scheduling on the next round robin token
-     * then decide the token is the current tgm because chances are
-     * the current tgm got the current request queued.
+    /*
+     * If no IO are queued for scheduling then decide the token is the
+     * current tgm because chances are the current tgm got the current
+     * request queued.
      */
-    if (token == start && !tgm_has_pending_reqs(token, is_write)) {
-        token = tgm;
-    }
+    token = best ? best : tgm;
 
     /* Either we return the original TGM, or one with pending requests */
     assert(token == tgm || tgm_has_pending_reqs(token, is_write));
@@ -369,6 +391,11 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     qemu_mutex_lock(&tg->lock);
 
+    /* A member does not earn credit while it has nothing to do */
+    if (!tgm->pending_reqs[is_write]) {
+        tgm->vtime[is_write] = MAX(tgm->vtime[is_write], tg->vtime[is_write]);
+    }
+
     /* First we check if this I/O has to be throttled. */
     token = next_throttle_token(tgm, is_write);
     must_wait = throttle_group_schedule_timer(token, is_write);
@@ -388,6 +415,14 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* The I/O will be executed, so do the accounting */
     throttle_account(tgm->throttle_state, is_write, bytes);
 
+    /*
+     * Requests smaller than a page are charged as a page, so that members
+     * that issue small requests also get their share of an IOPS limit
+     */
+    tg->vtime[is_write] = tgm->vtime[is_write];
+    tgm->vtime[is_write] += MAX(bytes, 4096) * THROTTLE_GROUP_MAX_WEIGHT /
+                            tgm->weight;
+
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
 
@@ -550,6 +585,12 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     qatomic_set(&tgm->restart_pending, 0);
 
     QEMU_LOCK_GUARD(&tg->lock);
+    if (!tgm->weight) {
+        tgm->weight = THROTTLE_GROUP_DEFAULT_WEIGHT;
+    }
+    tgm->vtime[0] = tg->vtime[0];
+    tgm->vtime[1] = tg->vtime[1];
+
     /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
     for (i = 0; i < 2; i++) {
         if (!tg->tokens[i]) {
@@ -619,6 +660,31 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
     tgm->throttle_state = NULL;
 }
 
+/*
+ * Set the share of the group's I/O that a ThrottleGroupMember gets while
+ * the group is busy.  Members with a higher @priority are always served
+ * first; among members with the same priority, each one gets a share of
+ * the group that is proportional to its @weight.
+ *
+ * The share is kept if the member moves to a different group.
+ *
+ * @tgm:      a ThrottleGroupMember
+ * @weight:   the weight, between 1 and THROTTLE_GROUP_MAX_WEIGHT
+ * @priority: the priority, between 0 and THROTTLE_GROUP_MAX_PRIORITY
+ */
+void throttle_group_set_share(ThrottleGroupMember *tgm, unsigned weight,
+                              unsigned priority)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    assert(weight >= 1 && weight <= THROTTLE_GROUP_MAX_WEIGHT);
+    assert(priority <= THROTTLE_GROUP_MAX_PRIORITY);
+
+    QEMU_LOCK_GUARD(&tg->lock);
+    tgm->weight = weight;
+    tgm->priority = priority;
+}
+
 void throttle_group_attach_aio_context(ThrottleGroupMember *tgm,
                                        AioContext *new_context)
 {
@@ -33,19 +33,37 @@ static QemuOptsList throttle_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Name of the throttle group",
         },
+        {
+            .name = QEMU_OPT_THROTTLE_WEIGHT,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Share of the group's I/O (1-10000, default 100)",
+        },
+        {
+            .name = QEMU_OPT_THROTTLE_PRIORITY,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Priority within the group (0-7, default 0)",
+        },
         { /* end of list */ }
     },
 };
 
+typedef struct ThrottleOptions {
+    char *group;
+    unsigned weight;
+    unsigned priority;
+} ThrottleOptions;
+
 /*
  * If this function succeeds then the throttle group name is stored in
- * @group and must be freed by the caller.
- * If there's an error then @group remains unmodified.
+ * @to->group and must be freed by the caller.
+ * If there's an error then @to remains unmodified.
  */
-static int throttle_parse_options(QDict *options, char **group, Error **errp)
+static int throttle_parse_options(QDict *options, ThrottleOptions *to,
+                                  Error **errp)
 {
     int ret;
     const char *group_name;
+    uint64_t weight, priority;
     QemuOpts *opts = qemu_opts_create(&throttle_opts, NULL, 0, &error_abort);
 
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
@@ -64,7 +82,26 @@ static int throttle_parse_options(QDict *options, char **group, Error **errp)
         goto fin;
     }
 
-    *group = g_strdup(group_name);
+    weight = qemu_opt_get_number(opts, QEMU_OPT_THROTTLE_WEIGHT,
+                                 THROTTLE_GROUP_DEFAULT_WEIGHT);
+    if (weight < 1 || weight > THROTTLE_GROUP_MAX_WEIGHT) {
+        error_setg(errp, "weight must be between 1 and %d",
+                   THROTTLE_GROUP_MAX_WEIGHT);
+        ret = -EINVAL;
+        goto fin;
+    }
+
+    priority = qemu_opt_get_number(opts, QEMU_OPT_THROTTLE_PRIORITY, 0);
+    if (priority > THROTTLE_GROUP_MAX_PRIORITY) {
+        error_setg(errp, "priority must be between 0 and %d",
+                   THROTTLE_GROUP_MAX_PRIORITY);
+        ret = -EINVAL;
+        goto fin;
+    }
+
+    to->group = g_strdup(group_name);
+    to->weight = weight;
+    to->priority = priority;
     ret = 0;
 fin:
     qemu_opts_del(opts);
@@ -75,7 +112,7 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
                          int flags, Error **errp)
 {
     ThrottleGroupMember *tgm = bs->opaque;
-    char *group;
+    ThrottleOptions to;
     int ret;
 
     bs->file = bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
@@ -89,11 +126,12 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
     bs->supported_zero_flags = bs->file->bs->supported_zero_flags |
                                BDRV_REQ_WRITE_UNCHANGED;
 
-    ret = throttle_parse_options(options, &group, errp);
+    ret = throttle_parse_options(options, &to, errp);
     if (ret == 0) {
         /* Register membership to group with name group_name */
-        throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
-        g_free(group);
+        throttle_group_register_tgm(tgm, to.group, bdrv_get_aio_context(bs));
+        throttle_group_set_share(tgm, to.weight, to.priority);
+        g_free(to.group);
     }
 
     return ret;
@@ -182,13 +220,17 @@ static int throttle_reopen_prepare(BDRVReopenState *reopen_state,
                                    BlockReopenQueue *queue, Error **errp)
 {
     int ret;
-    char *group = NULL;
+    ThrottleOptions *to = g_new0(ThrottleOptions, 1);
 
     assert(reopen_state != NULL);
     assert(reopen_state->bs != NULL);
 
-    ret = throttle_parse_options(reopen_state->options, &group, errp);
-    reopen_state->opaque = group;
+    ret = throttle_parse_options(reopen_state->options, to, errp);
+    if (ret < 0) {
+        g_free(to);
+        to = NULL;
+    }
+    reopen_state->opaque = to;
     return ret;
 }
 
@@ -196,21 +238,28 @@ static void throttle_reopen_commit(BDRVReopenState *reopen_state)
 {
     BlockDriverState *bs = reopen_state->bs;
     ThrottleGroupMember *tgm = bs->opaque;
-    char *group = reopen_state->opaque;
+    ThrottleOptions *to = reopen_state->opaque;
 
-    assert(group);
+    assert(to);
 
-    if (strcmp(group, throttle_group_get_name(tgm))) {
+    if (strcmp(to->group, throttle_group_get_name(tgm))) {
         throttle_group_unregister_tgm(tgm);
-        throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
+        throttle_group_register_tgm(tgm, to->group, bdrv_get_aio_context(bs));
     }
-    g_free(reopen_state->opaque);
+    throttle_group_set_share(tgm, to->weight, to->priority);
+    g_free(to->group);
+    g_free(to);
     reopen_state->opaque = NULL;
 }
 
 static void throttle_reopen_abort(BDRVReopenState *reopen_state)
 {
-    g_free(reopen_state->opaque);
+    ThrottleOptions *to = reopen_state->opaque;
+
+    if (to) {
+        g_free(to->group);
+        g_free(to);
+    }
     reopen_state->opaque = NULL;
 }
 
@@ -1167,6 +1167,71 @@ static int vhdx_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 }
 
 
+/*
+ * All of the BAT is kept in memory, so the state of any number of payload
+ * blocks can be reported at once: consecutive blocks in the same state are
+ * merged, as long as they are contiguous in the file if they hold data.
+ */
+static int coroutine_fn vhdx_co_block_status(BlockDriverState *bs,
+                                             bool want_zero,
+                                             int64_t offset, int64_t bytes,
+                                             int64_t *pnum, int64_t *map,
+                                             BlockDriverState **file)
+{
+    BDRVVHDXState *s = bs->opaque;
+    uint64_t file_offset = 0;
+    int64_t n = 0;
+    int ret = 0;
+
+    if (s->params.data_bits & VHDX_PARAMS_HAS_PARENT) {
+        /* Differencing files are not supported yet */
+        *pnum = bytes;
+        return BDRV_BLOCK_DATA;
+    }
+
+    while (n < bytes) {
+        uint64_t block_idx = (offset + n) / s->block_size;
+        uint64_t bat_idx = block_idx + (block_idx >> s->chunk_ratio_bits);
+        uint64_t block_offset = (offset + n) % s->block_size;
+        uint64_t bat_offset = s->bat[bat_idx] & VHDX_BAT_FILE_OFF_MASK;
+        int status;
+
+        switch (s->bat[bat_idx] & VHDX_BAT_STATE_BIT_MASK) {
+        case PAYLOAD_BLOCK_NOT_PRESENT: /* fall through */
+        case PAYLOAD_BLOCK_UNDEFINED:
+        case PAYLOAD_BLOCK_UNMAPPED:
+        case PAYLOAD_BLOCK_UNMAPPED_v095:
+        case PAYLOAD_BLOCK_ZERO:
+            /* vhdx_co_readv() returns zeroes */
+            status = BDRV_BLOCK_ZERO;
+            break;
+        case PAYLOAD_BLOCK_FULLY_PRESENT:
+            status = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+            break;
+        default:
+            /* Reading fails, but there might be data */
+            status = BDRV_BLOCK_DATA;
+            break;
+        }
+
+        if (n == 0) {
+            ret = status;
+            file_offset = bat_offset + block_offset;
+        } else if (status != ret || ((status & BDRV_BLOCK_OFFSET_VALID) &&
+                                     bat_offset != file_offset + n)) {
+            break;
+        }
+        n += MIN(s->block_size - block_offset, bytes - n);
+    }
+
+    *pnum = n;
+    if (ret & BDRV_BLOCK_OFFSET_VALID) {
+        *map = file_offset;
+        *file = bs->file->bs;
+    }
+    return ret;
+}
+
 static coroutine_fn int vhdx_co_readv(BlockDriverState *bs, int64_t sector_num,
                                       int nb_sectors, QEMUIOVector *qiov)
 {
@@ -2240,6 +2305,7 @@ static BlockDriver bdrv_vhdx = {
     .bdrv_child_perm        = bdrv_default_perms,
     .bdrv_co_readv          = vhdx_co_readv,
     .bdrv_co_writev         = vhdx_co_writev,
+    .bdrv_co_block_status   = vhdx_co_block_status,
     .bdrv_co_create         = vhdx_co_create,
     .bdrv_co_create_opts    = vhdx_co_create_opts,
     .bdrv_get_info          = vhdx_get_info,
@@ -1708,9 +1708,39 @@ static int coroutine_fn vmdk_co_block_status(BlockDriverState *bs,
     qemu_co_mutex_lock(&s->lock);
     ret = get_cluster_offset(bs, extent, NULL, offset, false, &cluster_offset,
                              0, 0);
-    qemu_co_mutex_unlock(&s->lock);
 
     index_in_cluster = vmdk_find_offset_in_cluster(extent, offset);
+    n = extent->cluster_sectors * BDRV_SECTOR_SIZE - index_in_cluster;
+
+    /*
+     * Merge the following grains of the extent that have the same status
+     * (and, with an offset, are contiguous in the file), so that callers
+     * such as qemu-img convert need not query every grain on its own.
+     * This matters most for stream-optimized images, whose small grains
+     * are all compressed.
+     */
+    if (!extent->flat && ret != VMDK_ERROR) {
+        int64_t end = MIN(offset + bytes,
+                          extent->end_sector * BDRV_SECTOR_SIZE);
+
+        while (offset + n < end) {
+            uint64_t next_offset;
+            int next_ret;
+
+            next_ret = get_cluster_offset(bs, extent, NULL, offset + n, false,
+                                          &next_offset, 0, 0);
+            if (next_ret != ret) {
+                break;
+            }
+            if (ret == VMDK_OK && !extent->compressed &&
+                next_offset != cluster_offset + index_in_cluster + n) {
+                break;
+            }
+            n += extent->cluster_sectors * BDRV_SECTOR_SIZE;
+        }
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
     switch (ret) {
     case VMDK_ERROR:
         ret = -EIO;
@@ -1734,7 +1764,6 @@ static int coroutine_fn vmdk_co_block_status(BlockDriverState *bs,
         break;
     }
 
-    n = extent->cluster_sectors * BDRV_SECTOR_SIZE - index_in_cluster;
     *pnum = MIN(n, bytes);
     return ret;
 }
@@ -1928,8 +1957,10 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
                 /* qcow2 emits this on bs->file instead of bs->backing */
                 BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
+                qemu_co_mutex_unlock(&s->lock);
                 ret = bdrv_co_preadv(bs->backing, offset, n_bytes,
                                      &local_qiov, 0);
+                qemu_co_mutex_lock(&s->lock);
                 if (ret < 0) {
                     goto fail;
                 }
@@ -1940,8 +1971,14 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             qemu_iovec_reset(&local_qiov);
             qemu_iovec_concat(&local_qiov, qiov, bytes_done, n_bytes);
 
+            /*
+             * Grains are never moved or freed, so the data can be read
+             * without holding the lock, in parallel with other requests
+             */
+            qemu_co_mutex_unlock(&s->lock);
             ret = vmdk_read_extent(extent, cluster_offset, offset_in_cluster,
                                    &local_qiov, n_bytes);
+            qemu_co_mutex_lock(&s->lock);
             if (ret) {
                 goto fail;
             }
@@ -2836,6 +2836,16 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         if (backup->x_perf->has_max_chunk) {
             perf.max_chunk = backup->x_perf->max_chunk;
         }
+        if (backup->x_perf->has_iothreads) {
+            perf.has_iothreads = true;
+            perf.iothreads = backup->x_perf->iothreads;
+        }
+        if (backup->x_perf->has_cbw_batching) {
+            perf.cbw_batching = backup->x_perf->cbw_batching;
+        }
+        if (backup->x_perf->has_adaptive) {
+            perf.adaptive = backup->x_perf->adaptive;
+        }
     }
 
     if ((backup->sync == MIRROR_SYNC_MODE_BITMAP) ||
@@ -2970,6 +2980,8 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                                    bool has_filter_node_name,
                                    const char *filter_node_name,
                                    bool has_copy_mode, MirrorCopyMode copy_mode,
+                                   bool has_write_blocking_threshold,
+                                   uint64_t write_blocking_threshold,
                                    bool has_auto_finalize, bool auto_finalize,
                                    bool has_auto_dismiss, bool auto_dismiss,
                                    Error **errp)
@@ -3001,6 +3013,16 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
     if (!has_copy_mode) {
         copy_mode = MIRROR_COPY_MODE_BACKGROUND;
     }
+    if (!has_write_blocking_threshold) {
+        write_blocking_threshold = 0;
+    } else if (copy_mode != MIRROR_COPY_MODE_WRITE_BLOCKING_ON_BACKLOG) {
+        error_setg(errp, "write-blocking-threshold requires copy-mode "
+                   "'write-blocking-on-backlog'");
+        return;
+    } else if (write_blocking_threshold > INT64_MAX) {
+        error_setg(errp, "Invalid parameter 'write-blocking-threshold'");
+        return;
+    }
     if (has_auto_finalize && !auto_finalize) {
         job_flags |= JOB_MANUAL_FINALIZE;
     }
@@ -3079,7 +3101,7 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                  has_replaces ? replaces : NULL, job_flags,
                  speed, granularity, buf_size, sync, backing_mode, zero_target,
                  on_source_error, on_target_error, unmap, filter_node_name,
-                 copy_mode, errp);
+                 copy_mode, write_blocking_threshold, errp);
 }
 
 void qmp_drive_mirror(DriveMirror *arg, Error **errp)
@@ -3231,6 +3253,8 @@ void qmp_drive_mirror(DriveMirror *arg, Error **errp)
                            arg->has_unmap, arg->unmap,
                            false, NULL,
                            arg->has_copy_mode, arg->copy_mode,
+                           arg->has_write_blocking_threshold,
+                           arg->write_blocking_threshold,
                            arg->has_auto_finalize, arg->auto_finalize,
                            arg->has_auto_dismiss, arg->auto_dismiss,
                            errp);
@@ -3253,6 +3277,8 @@ void qmp_blockdev_mirror(bool has_job_id, const char *job_id,
                          bool has_filter_node_name,
                          const char *filter_node_name,
                          bool has_copy_mode, MirrorCopyMode copy_mode,
+                         bool has_write_blocking_threshold,
+                         uint64_t write_blocking_threshold,
                          bool has_auto_finalize, bool auto_finalize,
                          bool has_auto_dismiss, bool auto_dismiss,
                          Error **errp)
@@ -3301,6 +3327,8 @@ void qmp_blockdev_mirror(bool has_job_id, const char *job_id,
                            true, true,
                            has_filter_node_name, filter_node_name,
                            has_copy_mode, copy_mode,
+                           has_write_blocking_threshold,
+                           write_blocking_threshold,
                            has_auto_finalize, auto_finalize,
                            has_auto_dismiss, auto_dismiss,
                            errp);
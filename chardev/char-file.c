@@ -94,6 +94,10 @@ static void qmp_chardev_open_file(Chardev *chr,
 
     qemu_chr_open_fd(chr, in, out);
 #endif
+
+    if (file->has_flush_interval && file->flush_interval) {
+        qemu_chr_set_write_buffering(chr, file->flush_interval);
+    }
 }
 
 static void qemu_chr_parse_file_out(QemuOpts *opts, ChardevBackend *backend,
@@ -113,6 +117,14 @@ static void qemu_chr_parse_file_out(QemuOpts *opts, ChardevBackend *backend,
 
     file->has_append = true;
     file->append = qemu_opt_get_bool(opts, "append", false);
+    file->has_flush_interval = true;
+    file->flush_interval = qemu_opt_get_number(opts, "flush-interval", 0);
+}
+
+static void char_file_finalize(Object *obj)
+{
+    /* Flush buffered output before the parent class closes the file */
+    qemu_chr_set_write_buffering(CHARDEV(obj), 0);
 }
 
 static void char_file_class_init(ObjectClass *oc, void *data)
@@ -130,6 +142,7 @@ static const TypeInfo char_file_type_info = {
 #else
     .parent = TYPE_CHARDEV_FD,
 #endif
+    .instance_finalize = char_file_finalize,
     .class_init = char_file_class_init,
 };
 
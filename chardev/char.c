@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "monitor/monitor.h"
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
@@ -107,6 +108,70 @@ static void qemu_chr_write_log(Chardev *s, const uint8_t *buf, size_t len)
     }
 }
 
+/* Buffered output is flushed early when it reaches this size */
+#define CHR_WRITE_BUF_SIZE (64 * KiB)
+
+static void qemu_chr_flush_write_buf_locked(Chardev *s)
+{
+    ChardevClass *cc = CHARDEV_GET_CLASS(s);
+    guint done = 0;
+    int res;
+
+    while (done < s->write_buf->len) {
+        res = cc->chr_write(s, s->write_buf->data + done,
+                            s->write_buf->len - done);
+        if (res < 0 && errno == EAGAIN) {
+            g_usleep(100);
+            continue;
+        }
+        if (res <= 0) {
+            /* Drop the data, as an unbuffered write would have */
+            break;
+        }
+        done += res;
+    }
+    g_byte_array_set_size(s->write_buf, 0);
+}
+
+static gboolean qemu_chr_write_buf_timeout(gpointer opaque)
+{
+    Chardev *s = opaque;
+
+    qemu_mutex_lock(&s->chr_write_lock);
+    if (s->write_buf) {
+        qemu_chr_flush_write_buf_locked(s);
+    }
+    /* Unless qemu_chr_set_write_buffering() got rid of it meanwhile */
+    if (s->write_buf_source == g_main_current_source()) {
+        g_source_unref(s->write_buf_source);
+        s->write_buf_source = NULL;
+    }
+    qemu_mutex_unlock(&s->chr_write_lock);
+
+    return G_SOURCE_REMOVE;
+}
+
+void qemu_chr_set_write_buffering(Chardev *s, unsigned interval_ms)
+{
+    qemu_mutex_lock(&s->chr_write_lock);
+    if (s->write_buf_source) {
+        g_source_destroy(s->write_buf_source);
+        g_source_unref(s->write_buf_source);
+        s->write_buf_source = NULL;
+    }
+    if (s->write_buf) {
+        qemu_chr_flush_write_buf_locked(s);
+        if (!interval_ms) {
+            g_byte_array_free(s->write_buf, true);
+            s->write_buf = NULL;
+        }
+    } else if (interval_ms) {
+        s->write_buf = g_byte_array_sized_new(CHR_WRITE_BUF_SIZE);
+    }
+    s->write_buf_interval_ms = interval_ms;
+    qemu_mutex_unlock(&s->chr_write_lock);
+}
+
 static int qemu_chr_write_buffer(Chardev *s,
                                  const uint8_t *buf, int len,
                                  int *offset, bool write_all)
@@ -116,6 +181,21 @@ static int qemu_chr_write_buffer(Chardev *s,
     *offset = 0;
 
     qemu_mutex_lock(&s->chr_write_lock);
+    if (s->write_buf) {
+        g_byte_array_append(s->write_buf, buf, len);
+        if (s->write_buf->len >= CHR_WRITE_BUF_SIZE) {
+            qemu_chr_flush_write_buf_locked(s);
+        } else if (!s->write_buf_source) {
+            s->write_buf_source =
+                qemu_chr_timeout_add_ms(s, s->write_buf_interval_ms,
+                                        qemu_chr_write_buf_timeout, s);
+        }
+        qemu_chr_write_log(s, buf, len);
+        qemu_mutex_unlock(&s->chr_write_lock);
+        *offset = len;
+        return len;
+    }
+
     while (*offset < len) {
     retry:
         res = cc->chr_write(s, buf + *offset, len - *offset);
@@ -305,6 +385,8 @@ static void char_finalize(Object *obj)
     if (chr->logfd != -1) {
         close(chr->logfd);
     }
+    /* The backend must have flushed and disabled buffering already */
+    assert(!chr->write_buf);
     qemu_mutex_destroy(&chr->chr_write_lock);
 }
 
@@ -925,6 +1007,9 @@ QemuOptsList qemu_chardev_opts = {
         },{
             .name = "append",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "flush-interval",
+            .type = QEMU_OPT_NUMBER,
         },{
             .name = "logfile",
             .type = QEMU_OPT_STRING,
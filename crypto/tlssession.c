@@ -90,6 +90,27 @@ qcrypto_tls_session_pull(void *opaque, void *buf, size_t len)
     return session->readFunc(buf, len, session->opaque);
 }
 
+/*
+ * gnutls can only hand the record layer to the kernel if it knows the
+ * socket, i.e. if the transport is set with gnutls_transport_set_int().
+ */
+#if defined(CONFIG_LINUX) && GNUTLS_VERSION_NUMBER >= 0x030703
+#define QCRYPTO_TLS_SESSION_KTLS
+
+static ssize_t
+qcrypto_tls_session_push_fd(void *opaque, const void *buf, size_t len)
+{
+    return send((int)(intptr_t)opaque, buf, len, 0);
+}
+
+
+static ssize_t
+qcrypto_tls_session_pull_fd(void *opaque, void *buf, size_t len)
+{
+    return recv((int)(intptr_t)opaque, buf, len, 0);
+}
+#endif
+
 #define TLS_PRIORITY_ADDITIONAL_ANON "+ANON-DH"
 #define TLS_PRIORITY_ADDITIONAL_PSK "+ECDHE-PSK:+DHE-PSK:+PSK"
 
@@ -549,6 +570,38 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 }
 
 
+bool
+qcrypto_tls_session_set_socket(QCryptoTLSSession *session, int fd)
+{
+#ifdef QCRYPTO_TLS_SESSION_KTLS
+    if (!session->creds->ktls) {
+        return false;
+    }
+
+    gnutls_transport_set_int(session->handle, fd);
+    gnutls_transport_set_push_function(session->handle,
+                                       qcrypto_tls_session_push_fd);
+    gnutls_transport_set_pull_function(session->handle,
+                                       qcrypto_tls_session_pull_fd);
+    trace_qcrypto_tls_session_set_socket(session, fd);
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+bool
+qcrypto_tls_session_has_ktls_send(QCryptoTLSSession *session)
+{
+#ifdef QCRYPTO_TLS_SESSION_KTLS
+    return gnutls_transport_is_ktls_enabled(session->handle) & GNUTLS_KTLS_SEND;
+#else
+    return false;
+#endif
+}
+
+
 #else /* ! CONFIG_GNUTLS */
 
 
@@ -640,4 +693,18 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
     return NULL;
 }
 
+
+bool
+qcrypto_tls_session_set_socket(QCryptoTLSSession *sess, int fd)
+{
+    return false;
+}
+
+
+bool
+qcrypto_tls_session_has_ktls_send(QCryptoTLSSession *sess)
+{
+    return false;
+}
+
 #endif
@@ -99,6 +99,57 @@ static inline void xts_tweak_encdec(const void *ctx,
 }
 
 
+/* Number of blocks passed to the cipher function at once */
+#define XTS_BATCH_BLOCKS 8
+
+/**
+ * xts_tweak_encdec_blocks:
+ * @param ctxt: the cipher context
+ * @param func: the cipher function
+ * @src: buffer providing the input text of @nblocks * XTS_BLOCK_SIZE bytes
+ * @dst: buffer to output the output text of @nblocks * XTS_BLOCK_SIZE bytes
+ * @iv: the initialization vector tweak of XTS_BLOCK_SIZE bytes
+ * @nblocks: the number of blocks
+ *
+ * Encrypt/decrypt full blocks with a tweak.  The tweaks of a batch of
+ * blocks are computed up front, so that the cipher function can work on
+ * all of them in a single call; cipher implementations can then keep
+ * several blocks in flight, which single-block calls do not allow.
+ */
+static void xts_tweak_encdec_blocks(const void *ctx,
+                                    xts_cipher_func *func,
+                                    const uint8_t *src,
+                                    uint8_t *dst,
+                                    xts_uint128 *iv,
+                                    unsigned long nblocks)
+{
+    xts_uint128 tweak[XTS_BATCH_BLOCKS];
+    xts_uint128 buf[XTS_BATCH_BLOCKS];
+
+    while (nblocks) {
+        unsigned long i, n = MIN(nblocks, XTS_BATCH_BLOCKS);
+
+        memcpy(buf, src, n * XTS_BLOCK_SIZE);
+        for (i = 0; i < n; i++) {
+            tweak[i] = *iv;
+            xts_uint128_xor(&buf[i], &buf[i], iv);
+            xts_mult_x(iv);
+        }
+
+        func(ctx, n * XTS_BLOCK_SIZE, buf[0].b, buf[0].b);
+
+        for (i = 0; i < n; i++) {
+            xts_uint128_xor(&buf[i], &buf[i], &tweak[i]);
+        }
+        memcpy(dst, buf, n * XTS_BLOCK_SIZE);
+
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
+        nblocks -= n;
+    }
+}
+
+
 void xts_decrypt(const void *datactx,
                  const void *tweakctx,
                  xts_cipher_func *encfunc,
@@ -127,24 +178,9 @@ void xts_decrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, decfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, decfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-            src += XTS_BLOCK_SIZE;
-            dst += XTS_BLOCK_SIZE;
-        }
-    }
+    xts_tweak_encdec_blocks(datactx, decfunc, src, dst, &T, lim);
+    src += lim * XTS_BLOCK_SIZE;
+    dst += lim * XTS_BLOCK_SIZE;
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
     if (mo > 0) {
@@ -203,25 +239,9 @@ void xts_encrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, encfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, encfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-
-            dst += XTS_BLOCK_SIZE;
-            src += XTS_BLOCK_SIZE;
-        }
-    }
+    xts_tweak_encdec_blocks(datactx, encfunc, src, dst, &T, lim);
+    src += lim * XTS_BLOCK_SIZE;
+    dst += lim * XTS_BLOCK_SIZE;
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
     if (mo > 0) {
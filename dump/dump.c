@@ -14,6 +14,8 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
+#include "qemu/thread.h"
 #include "elf.h"
 #include "exec/hwaddr.h"
 #include "monitor/monitor.h"
@@ -41,6 +43,9 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
@@ -846,6 +851,11 @@ static void create_header32(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -958,6 +968,11 @@ static void create_header64(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1285,6 +1300,11 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
     }
     return 0;
 }
@@ -1297,20 +1317,179 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
+/* Guest memory handed to the compression threads at once */
+#define DUMP_COMPRESS_BATCH_SIZE    (8 * MiB)
+#define DUMP_COMPRESS_THREADS_MAX   8
+
+typedef struct DumpCompressPage {
+    uint8_t *buf;               /* the guest page */
+    uint8_t *buf_out;           /* its compressed data, if flags != 0 */
+    size_t size_out;            /* size of the data to write, 0 if zero */
+    uint32_t flags;             /* DUMP_DH_COMPRESSED_*, 0 for plain text */
+} DumpCompressPage;
+
+/* Per-thread compression state */
+typedef struct DumpCompressor {
+    DumpState *s;
+    size_t len_buf_out;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+} DumpCompressor;
+
+typedef struct DumpCompressThread {
+    QemuThread thread;
+    QemuSemaphore sem;          /* posted when pages are ready or on quit */
+    QemuSemaphore *done;        /* posted after compressing them */
+    DumpCompressor comp;
+    DumpCompressPage *pages;
+    size_t num_pages;
+    bool quit;
+} DumpCompressThread;
+
+static void dump_compressor_init(DumpCompressor *comp, DumpState *s,
+                                 size_t len_buf_out)
+{
+    comp->s = s;
+    comp->len_buf_out = len_buf_out;
+#ifdef CONFIG_LZO
+    comp->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+#ifdef CONFIG_ZSTD
+    comp->zstd = ZSTD_createCCtx();
+#endif
+}
+
+static void dump_compressor_cleanup(DumpCompressor *comp)
+{
+#ifdef CONFIG_LZO
+    g_free(comp->wrkmem);
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(comp->zstd);
+#endif
+}
+
+/*
+ * Check whether the page is a zero page and, if it is not, compress it.
+ * Only one compression format is set in s->flag_compress.  When
+ * compression fails to work, we fall back to save in plaintext.
+ */
+static void dump_compress_page(DumpCompressor *comp, DumpCompressPage *page)
+{
+    DumpState *s = comp->s;
+    size_t page_size = s->dump_info.page_size;
+    size_t size_out = comp->len_buf_out;
+
+    page->flags = 0;
+    if (is_zero_page(page->buf, page_size)) {
+        page->size_out = 0;
+        return;
+    }
+
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+        (compress2(page->buf_out, (uLongf *)&size_out, page->buf,
+                   page_size, Z_BEST_SPEED) == Z_OK) &&
+        (size_out < page_size)) {
+        page->flags = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+               (lzo1x_1_compress(page->buf, page_size, page->buf_out,
+                                 (lzo_uint *)&size_out,
+                                 comp->wrkmem) == LZO_E_OK) &&
+               (size_out < page_size)) {
+        page->flags = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+               (snappy_compress((char *)page->buf, page_size,
+                                (char *)page->buf_out,
+                                &size_out) == SNAPPY_OK) &&
+               (size_out < page_size)) {
+        page->flags = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+#ifdef CONFIG_ZSTD
+    } else if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        size_out = ZSTD_compressCCtx(comp->zstd, page->buf_out, size_out,
+                                     page->buf, page_size, 1);
+        if (!ZSTD_isError(size_out) && size_out < page_size) {
+            page->flags = DUMP_DH_COMPRESSED_ZSTD;
+        }
+#endif
+    }
+
+    page->size_out = page->flags ? size_out : page_size;
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressThread *t = opaque;
+    size_t i;
+
+    for (;;) {
+        qemu_sem_wait(&t->sem);
+        if (t->quit) {
+            break;
+        }
+        for (i = 0; i < t->num_pages; i++) {
+            dump_compress_page(&t->comp, &t->pages[i]);
+        }
+        qemu_sem_post(t->done);
+    }
+    return NULL;
+}
+
+/*
+ * Compress a batch of pages, splitting it among the threads; without
+ * threads the calling thread does the work.
+ */
+static void dump_compress_pages(DumpCompressor *comp,
+                                DumpCompressThread *threads, int nthreads,
+                                QemuSemaphore *done,
+                                DumpCompressPage *pages, size_t num_pages)
+{
+    size_t i, first = 0, per_thread;
+
+    if (!nthreads) {
+        for (i = 0; i < num_pages; i++) {
+            dump_compress_page(comp, &pages[i]);
+        }
+        return;
+    }
+
+    per_thread = DIV_ROUND_UP(num_pages, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        threads[i].pages = &pages[first];
+        threads[i].num_pages = MIN(per_thread, num_pages - first);
+        first += threads[i].num_pages;
+        qemu_sem_post(&threads[i].sem);
+    }
+    for (i = 0; i < nthreads; i++) {
+        qemu_sem_wait(done);
+    }
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    size_t len_buf_out, page_size = s->dump_info.page_size;
     off_t offset_desc, offset_data;
     PageDescriptor pd, pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
+    DumpCompressor comp;
+    DumpCompressThread *threads = NULL;
+    QemuSemaphore done;
+    DumpCompressPage *pages;
+    uint8_t *bufs_out;
+    size_t i, num_pages, batch_pages;
+    bool more = true;
+    int nthreads;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1320,128 +1499,109 @@ static void write_dump_pages(DumpState *s, Error **errp)
     prepare_data_cache(&page_data, s, offset_data);
 
     /* prepare buffer to store compressed data */
-    len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
+    len_buf_out = get_len_buf_out(page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    /*
+     * Compression dominates the time it takes to write the dump, so
+     * spread it over threads; the pages are still written in order.
+     */
+    nthreads = MIN(g_get_num_processors(), DUMP_COMPRESS_THREADS_MAX);
+    if (nthreads == 1) {
+        nthreads = 0;
+    }
+    batch_pages = MAX(DUMP_COMPRESS_BATCH_SIZE / page_size, nthreads + 1);
+
+    pages = g_new(DumpCompressPage, batch_pages);
+    bufs_out = g_malloc(batch_pages * len_buf_out);
+    for (i = 0; i < batch_pages; i++) {
+        pages[i].buf_out = bufs_out + i * len_buf_out;
+    }
+
+    dump_compressor_init(&comp, s, len_buf_out);
+    qemu_sem_init(&done, 0);
+    if (nthreads) {
+        threads = g_new0(DumpCompressThread, nthreads);
+        for (i = 0; i < nthreads; i++) {
+            qemu_sem_init(&threads[i].sem, 0);
+            threads[i].done = &done;
+            dump_compressor_init(&threads[i].comp, s, len_buf_out);
+            qemu_thread_create(&threads[i].thread, "dump-compress",
+                               dump_compress_thread, &threads[i],
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
 
     /*
      * init zero page's page_desc and page_data, because every zero page
      * uses the same page_data
      */
-    pd_zero.size = cpu_to_dump32(s, s->dump_info.page_size);
+    pd_zero.size = cpu_to_dump32(s, page_size);
     pd_zero.flags = cpu_to_dump32(s, 0);
     pd_zero.offset = cpu_to_dump64(s, offset_data);
     pd_zero.page_flags = cpu_to_dump64(s, 0);
-    buf = g_malloc0(s->dump_info.page_size);
-    ret = write_cache(&page_data, buf, s->dump_info.page_size, false);
+    buf = g_malloc0(page_size);
+    ret = write_cache(&page_data, buf, page_size, false);
     g_free(buf);
     if (ret < 0) {
         error_setg(errp, "dump: failed to write page data (zero page)");
         goto out;
     }
 
-    offset_data += s->dump_info.page_size;
+    offset_data += page_size;
 
     /*
-     * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * dump memory to vmcore a batch of pages at a time. zero page will all
+     * be resided in the first page of page section
      */
-    while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
-        /* check zero page */
-        if (is_zero_page(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+    while (more) {
+        for (num_pages = 0; num_pages < batch_pages; num_pages++) {
+            more = get_next_page(&block_iter, &pfn_iter, &buf, s);
+            if (!more) {
+                break;
             }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
+            pages[num_pages].buf = buf;
+        }
+
+        dump_compress_pages(&comp, threads, nthreads, &done,
+                            pages, num_pages);
+
+        for (i = 0; i < num_pages; i++) {
+            DumpCompressPage *page = &pages[i];
+
+            if (!page->size_out) {
+                ret = write_cache(&page_desc, &pd_zero,
+                                  sizeof(PageDescriptor), false);
                 if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
+                    error_setg(errp, "dump: failed to write page desc");
                     goto out;
                 }
+                s->written_size += page_size;
+                continue;
+            }
+
+            ret = write_cache(&page_data,
+                              page->flags ? page->buf_out : page->buf,
+                              page->size_out, false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                goto out;
             }
 
             /* get and write page desc here */
+            pd.flags = cpu_to_dump32(s, page->flags);
+            pd.size = cpu_to_dump32(s, page->size_out);
             pd.page_flags = cpu_to_dump64(s, 0);
             pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+            offset_data += page->size_out;
 
             ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
             if (ret < 0) {
                 error_setg(errp, "dump: failed to write page desc");
                 goto out;
             }
+            s->written_size += page_size;
         }
-        s->written_size += s->dump_info.page_size;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1459,11 +1619,19 @@ out:
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
 
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
+    for (i = 0; i < nthreads; i++) {
+        threads[i].quit = true;
+        qemu_sem_post(&threads[i].sem);
+        qemu_thread_join(&threads[i].thread);
+        qemu_sem_destroy(&threads[i].sem);
+        dump_compressor_cleanup(&threads[i].comp);
+    }
+    g_free(threads);
+    qemu_sem_destroy(&done);
+    dump_compressor_cleanup(&comp);
 
-    g_free(buf_out);
+    g_free(pages);
+    g_free(bufs_out);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1804,6 +1972,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -1961,7 +2133,7 @@ void qmp_dump_guest_memory(bool paging, const char *file,
         detach_p = detach;
     }
 
-    /* check whether lzo/snappy is supported */
+    /* check whether lzo/snappy/zstd is supported */
 #ifndef CONFIG_LZO
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_LZO) {
         error_setg(errp, "kdump-lzo is not available now");
@@ -1976,6 +2148,13 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
 #ifndef TARGET_X86_64
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP) {
         error_setg(errp, "Windows dump is only available for x86-64");
@@ -2049,6 +2228,11 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY);
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD);
+#endif
+
     /* Windows dump is available only if target is x86_64 */
 #ifdef TARGET_X86_64
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_WIN_DMP);
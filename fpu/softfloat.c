@@ -232,6 +232,16 @@ GEN_INPUT_FLUSH3(float64_input_flush3, float64)
 # define QEMU_SOFTFLOAT_ATTR QEMU_FLATTEN __attribute__((noinline))
 #endif
 
+/*
+ * Comparisons and min/max are exact and never depend on the inexact flag,
+ * so they can use the host FPU even for targets that clear the flags.
+ */
+#if defined(__FAST_MATH__)
+# define QEMU_NO_HARDFLOAT_EXACT 1
+#else
+# define QEMU_NO_HARDFLOAT_EXACT 0
+#endif
+
 static inline bool can_use_fpu(const float_status *s)
 {
     if (QEMU_NO_HARDFLOAT) {
@@ -2693,7 +2703,8 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(&p, s, fmt);
 }
 
-float32 float64_to_float32(float64 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_float64_to_float32(float64 a, float_status *s)
 {
     FloatParts64 p;
 
@@ -2702,6 +2713,24 @@ float32 float64_to_float32(float64 a, float_status *s)
     return float32_round_pack_canonical(&p, s);
 }
 
+float32 float64_to_float32(float64 a, float_status *s)
+{
+    if (likely(float64_is_normal(a)) && can_use_fpu(s)) {
+        union_float64 ud;
+        union_float32 uf;
+
+        ud.s = a;
+        uf.h = ud.h;
+        /* Leave overflow and possible underflow to softfloat */
+        if (likely(!isinf(uf.h) && fabsf(uf.h) > FLT_MIN)) {
+            return uf.s;
+        }
+    } else if (float64_is_zero(a)) {
+        return float32_set_sign(float32_zero, float64_is_neg(a));
+    }
+    return soft_float64_to_float32(a, s);
+}
+
 float32 bfloat16_to_float32(bfloat16 a, float_status *s)
 {
     FloatParts64 p;
@@ -2858,7 +2887,8 @@ float16 float16_round_to_int(float16 a, float_status *s)
     return float16_round_pack_canonical(&p, s);
 }
 
-float32 float32_round_to_int(float32 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_f32_round_to_int(float32 a, float_status *s)
 {
     FloatParts64 p;
 
@@ -2867,7 +2897,21 @@ float32 float32_round_to_int(float32 a, float_status *s)
     return float32_round_pack_canonical(&p, s);
 }
 
-float64 float64_round_to_int(float64 a, float_status *s)
+float32 float32_round_to_int(float32 a, float_status *s)
+{
+    /* The result of rounding a normal number is an integer or zero */
+    if (likely(float32_is_normal(a)) && can_use_fpu(s)) {
+        union_float32 ua;
+
+        ua.s = a;
+        ua.h = rintf(ua.h);
+        return ua.s;
+    }
+    return soft_f32_round_to_int(a, s);
+}
+
+static float64 QEMU_SOFTFLOAT_ATTR
+soft_f64_round_to_int(float64 a, float_status *s)
 {
     FloatParts64 p;
 
@@ -2876,6 +2920,18 @@ float64 float64_round_to_int(float64 a, float_status *s)
     return float64_round_pack_canonical(&p, s);
 }
 
+float64 float64_round_to_int(float64 a, float_status *s)
+{
+    if (likely(float64_is_normal(a)) && can_use_fpu(s)) {
+        union_float64 ua;
+
+        ua.s = a;
+        ua.h = rint(ua.h);
+        return ua.s;
+    }
+    return soft_f64_round_to_int(a, s);
+}
+
 bfloat16 bfloat16_round_to_int(bfloat16 a, float_status *s)
 {
     FloatParts64 p;
@@ -2956,10 +3012,47 @@ int16_t float32_to_int16_scalbn(float32 a, FloatRoundMode rmode, int scale,
     return parts_float_to_sint(&p, rmode, scale, INT16_MIN, INT16_MAX, s);
 }
 
+/*
+ * Hardfloat conversion of a zero or normal @d to a signed integer in
+ * [@min, -@min).  The host gives us truncation, and rint() which rounds
+ * to nearest-even in the host's default mode; other rounding modes and
+ * out-of-range values are left to softfloat, which raises invalid.  As
+ * for arithmetic, inexact must be already set.
+ */
+static inline bool hard_to_sint(double d, FloatRoundMode rmode, int scale,
+                                double min, const float_status *s,
+                                int64_t *ret)
+{
+    if (QEMU_NO_HARDFLOAT || scale != 0 ||
+        !(s->float_exception_flags & float_flag_inexact)) {
+        return false;
+    }
+    if (rmode == float_round_to_zero) {
+        d = trunc(d);
+    } else if (rmode == float_round_nearest_even) {
+        d = rint(d);
+    } else {
+        return false;
+    }
+    if (!(d >= min && d < -min)) {
+        return false;
+    }
+    *ret = d;
+    return true;
+}
+
 int32_t float32_to_int32_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    union_float32 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float32_is_zero_or_normal(a) &&
+        hard_to_sint(ua.h, rmode, scale, INT32_MIN, s, &r)) {
+        return r;
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
@@ -2969,6 +3062,14 @@ int64_t float32_to_int64_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    union_float32 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float32_is_zero_or_normal(a) &&
+        hard_to_sint(ua.h, rmode, scale, INT64_MIN, s, &r)) {
+        return r;
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
@@ -2987,6 +3088,14 @@ int32_t float64_to_int32_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    union_float64 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float64_is_zero_or_normal(a) &&
+        hard_to_sint(ua.h, rmode, scale, INT32_MIN, s, &r)) {
+        return r;
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
@@ -2996,6 +3105,14 @@ int64_t float64_to_int64_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    union_float64 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float64_is_zero_or_normal(a) &&
+        hard_to_sint(ua.h, rmode, scale, INT64_MIN, s, &r)) {
+        return r;
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
@@ -3888,7 +4005,8 @@ static bfloat16 bfloat16_minmax(bfloat16 a, bfloat16 b,
     return bfloat16_round_pack_canonical(pr, s);
 }
 
-static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_f32_minmax(float32 a, float32 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
@@ -3899,7 +4017,42 @@ static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
     return float32_round_pack_canonical(pr, s);
 }
 
-static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
+/*
+ * Zero or normal inputs that compare unequal need neither NaN handling nor
+ * flags, and the result is one of the inputs.  Equal inputs are left to
+ * softfloat, which knows how to order zeroes of different sign.
+ */
+static float32 QEMU_FLATTEN
+float32_minmax(float32 a, float32 b, float_status *s, int flags)
+{
+    union_float32 ua, ub;
+    float ha, hb;
+
+    ua.s = a;
+    ub.s = b;
+    if (QEMU_NO_HARDFLOAT_EXACT || !f32_is_zon2(ua, ub)) {
+        goto soft;
+    }
+
+    ha = ua.h;
+    hb = ub.h;
+    if (flags & minmax_ismag) {
+        ha = fabsf(ha);
+        hb = fabsf(hb);
+    }
+    if (isless(ha, hb)) {
+        return flags & minmax_ismin ? a : b;
+    }
+    if (isgreater(ha, hb)) {
+        return flags & minmax_ismin ? b : a;
+    }
+
+ soft:
+    return soft_f32_minmax(a, b, s, flags);
+}
+
+static float64 QEMU_SOFTFLOAT_ATTR
+soft_f64_minmax(float64 a, float64 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
@@ -3910,6 +4063,35 @@ static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
     return float64_round_pack_canonical(pr, s);
 }
 
+static float64 QEMU_FLATTEN
+float64_minmax(float64 a, float64 b, float_status *s, int flags)
+{
+    union_float64 ua, ub;
+    double ha, hb;
+
+    ua.s = a;
+    ub.s = b;
+    if (QEMU_NO_HARDFLOAT_EXACT || !f64_is_zon2(ua, ub)) {
+        goto soft;
+    }
+
+    ha = ua.h;
+    hb = ub.h;
+    if (flags & minmax_ismag) {
+        ha = fabs(ha);
+        hb = fabs(hb);
+    }
+    if (isless(ha, hb)) {
+        return flags & minmax_ismin ? a : b;
+    }
+    if (isgreater(ha, hb)) {
+        return flags & minmax_ismin ? b : a;
+    }
+
+ soft:
+    return soft_f64_minmax(a, b, s, flags);
+}
+
 static float128 float128_minmax(float128 a, float128 b,
                                 float_status *s, int flags)
 {
@@ -3985,7 +4167,7 @@ float32_hs_compare(float32 xa, float32 xb, float_status *s, bool is_quiet)
     ua.s = xa;
     ub.s = xb;
 
-    if (QEMU_NO_HARDFLOAT) {
+    if (QEMU_NO_HARDFLOAT_EXACT) {
         goto soft;
     }
 
@@ -4035,7 +4217,7 @@ float64_hs_compare(float64 xa, float64 xb, float_status *s, bool is_quiet)
     ua.s = xa;
     ub.s = xb;
 
-    if (QEMU_NO_HARDFLOAT) {
+    if (QEMU_NO_HARDFLOAT_EXACT) {
         goto soft;
     }
 
@@ -298,28 +298,36 @@ ERST
 
     {
         .name       = "sync-profile",
-        .args_type  = "mean:-m,no_coalesce:-n,max:i?",
-        .params     = "[-m] [-n] [max]",
+        .args_type  = "mean:-m,contended:-c,no_coalesce:-n,max:i?",
+        .params     = "[-m] [-c] [-n] [max]",
         .help       = "show synchronization profiling info, up to max entries "
                       "(default: 10), sorted by total wait time. (-m: sort by "
-                      "mean wait time; -n: do not coalesce objects with the "
+                      "mean wait time; -c: sort by number of contended "
+                      "acquisitions; -n: do not coalesce objects with the "
                       "same call site)",
         .cmd        = hmp_info_sync_profile,
     },
 
 SRST
-  ``info sync-profile [-m|-n]`` [*max*]
+  ``info sync-profile [-m|-c|-n]`` [*max*]
     Show synchronization profiling info, up to *max* entries (default: 10),
     sorted by total wait time.
 
     ``-m``
       sort by mean wait time
+    ``-c``
+      sort by number of contended acquisitions
     ``-n``
       do not coalesce objects with the same call site
 
     When different objects that share the same call site are coalesced,
     the "Object" field shows---enclosed in brackets---the number of objects
     being coalesced.
+
+    The "Contended" field counts the acquisitions that could not take the
+    lock straight away, and "p99 (us)" is the power-of-two upper bound of
+    the 99th percentile of their wait times.  Spinlocks only report their
+    contended acquisitions.
 ERST
 
     {
@@ -877,3 +885,16 @@ SRST
   ``info dirty_rate``
     Display the vcpu dirty rate information.
 ERST
+
+    {
+        .name       = "vcpu_dirty_limit",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show dirty page limit information of all vCPU",
+        .cmd        = hmp_info_vcpu_dirty_limit,
+    },
+
+SRST
+  ``info vcpu_dirty_limit``
+    Display the vcpu dirty page limit information.
+ERST
@@ -21,6 +21,8 @@
 #include "qemu/osdep.h"
 #include "hw/acpi/bios-linker-loader.h"
 #include "hw/nvram/fw_cfg.h"
+#include "hw/loader.h"
+#include "qapi/error.h"
 
 #include "qemu/bswap.h"
 
@@ -349,3 +351,135 @@ void bios_linker_loader_write_pointer(BIOSLinker *linker,
 
     g_array_append_vals(linker->cmd_blob, &entry, sizeof entry);
 }
+
+static int bios_linker_run_find(const BIOSLinker *linker, const char *name,
+                                hwaddr *addrs, Error **errp)
+{
+    const BiosLinkerFileEntry *file = bios_linker_find_file(linker, name);
+    int i;
+
+    if (!file) {
+        error_setg(errp, "linker: unknown file '%s'", name);
+        return -1;
+    }
+    i = file - &g_array_index(linker->file_list, BiosLinkerFileEntry, 0);
+    if (addrs && !addrs[i]) {
+        error_setg(errp, "linker: file '%s' used before allocation", name);
+        return -1;
+    }
+    return i;
+}
+
+/*
+ * bios_linker_loader_run: do in QEMU what guest firmware does with the
+ * linker commands, for machines that boot without firmware.
+ *
+ * The files are placed one after another from @base, regardless of the
+ * zone they ask for.  The pointers and checksums are then patched in a
+ * copy of the files, which is added as ROM blobs, so that it is loaded
+ * into guest memory on reset.  WRITE_POINTER commands, which need the
+ * guest to write back to fw_cfg, are not supported.
+ *
+ * @linker: linker object instance
+ * @base: guest physical address of the memory reserved for the files
+ * @size: size of the memory at @base
+ * @file_name: name of the file whose address is returned in @addr
+ * @addr: where to store the address of @file_name
+ * @errp: pointer to error object
+ */
+bool bios_linker_loader_run(const BIOSLinker *linker, hwaddr base,
+                            hwaddr size, const char *file_name,
+                            hwaddr *addr, Error **errp)
+{
+    const BiosLinkerLoaderEntry *entry;
+    const BiosLinkerFileEntry *file;
+    unsigned nfiles = linker->file_list->len;
+    g_autofree hwaddr *addrs = g_new0(hwaddr, nfiles);
+    uint8_t **data = g_new0(uint8_t *, nfiles);
+    hwaddr next = base;
+    bool ok = false;
+    unsigned i;
+    int dst, src;
+
+    for (i = 0; i < linker->cmd_blob->len / sizeof(*entry); i++) {
+        entry = &g_array_index(linker->cmd_blob, BiosLinkerLoaderEntry, i);
+
+        switch (le32_to_cpu(entry->command)) {
+        case BIOS_LINKER_LOADER_COMMAND_ALLOCATE: {
+            dst = bios_linker_run_find(linker, entry->alloc.file, NULL, errp);
+            if (dst < 0) {
+                goto out;
+            }
+            file = &g_array_index(linker->file_list, BiosLinkerFileEntry, dst);
+            next = ROUND_UP(next, MAX(le32_to_cpu(entry->alloc.align), 1));
+            if (next + file->blob->len > base + size) {
+                error_setg(errp, "linker: no room for file '%s'", file->name);
+                goto out;
+            }
+            addrs[dst] = next;
+            data[dst] = g_memdup(file->blob->data, file->blob->len);
+            next += file->blob->len;
+            break;
+        }
+        case BIOS_LINKER_LOADER_COMMAND_ADD_POINTER: {
+            uint32_t offset = le32_to_cpu(entry->pointer.offset);
+            uint64_t pointer = 0;
+
+            dst = bios_linker_run_find(linker, entry->pointer.dest_file,
+                                       addrs, errp);
+            src = bios_linker_run_find(linker, entry->pointer.src_file,
+                                       addrs, errp);
+            if (dst < 0 || src < 0) {
+                goto out;
+            }
+            memcpy(&pointer, data[dst] + offset, entry->pointer.size);
+            pointer = cpu_to_le64(le64_to_cpu(pointer) + addrs[src]);
+            memcpy(data[dst] + offset, &pointer, entry->pointer.size);
+            break;
+        }
+        case BIOS_LINKER_LOADER_COMMAND_ADD_CHECKSUM: {
+            uint32_t start = le32_to_cpu(entry->cksum.start);
+            uint32_t length = le32_to_cpu(entry->cksum.length);
+            uint8_t sum = 0;
+            uint32_t j;
+
+            dst = bios_linker_run_find(linker, entry->cksum.file, addrs, errp);
+            if (dst < 0) {
+                goto out;
+            }
+            for (j = start; j < start + length; j++) {
+                sum += data[dst][j];
+            }
+            data[dst][le32_to_cpu(entry->cksum.offset)] -= sum;
+            break;
+        }
+        case BIOS_LINKER_LOADER_COMMAND_WRITE_POINTER:
+            error_setg(errp, "linker: WRITE_POINTER needs guest firmware");
+            goto out;
+        default:
+            /* Like firmware, skip unknown commands */
+            break;
+        }
+    }
+
+    src = bios_linker_run_find(linker, file_name, addrs, errp);
+    if (src < 0) {
+        goto out;
+    }
+    *addr = addrs[src];
+
+    for (i = 0; i < nfiles; i++) {
+        file = &g_array_index(linker->file_list, BiosLinkerFileEntry, i);
+        if (data[i]) {
+            rom_add_blob_fixed(file->name, data[i], file->blob->len, addrs[i]);
+        }
+    }
+    ok = true;
+
+out:
+    for (i = 0; i < nfiles; i++) {
+        g_free(data[i]);
+    }
+    g_free(data);
+    return ok;
+}
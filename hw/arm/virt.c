@@ -933,7 +933,7 @@ static void create_gpio_devices(const VirtMachineState *vms, int gpio,
     }
 }
 
-static void create_virtio_devices(const VirtMachineState *vms)
+static void create_virtio_devices(VirtMachineState *vms)
 {
     int i;
     hwaddr size = vms->memmap[VIRT_MMIO].size;
@@ -970,8 +970,18 @@ static void create_virtio_devices(const VirtMachineState *vms)
         int irq = vms->irqmap[VIRT_MMIO] + i;
         hwaddr base = vms->memmap[VIRT_MMIO].base + i * size;
 
-        sysbus_create_simple("virtio-mmio", base,
-                             qdev_get_gpio_in(vms->gic, irq));
+        DeviceState *dev = qdev_new("virtio-mmio");
+
+        /*
+         * The device tree describes the lines as edge-triggered, but the
+         * ACPI tables say level-triggered; only let KVM inject the queue
+         * interrupts directly if the guest is bound to see the former.
+         */
+        qdev_prop_set_bit(dev, "irqfd", !virt_is_acpi_enabled(vms));
+        sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
+        sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, base);
+        sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0,
+                           qdev_get_gpio_in(vms->gic, irq));
     }
 
     /* We add dtb nodes in reverse order so that they appear in the finished
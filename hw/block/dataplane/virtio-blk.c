@@ -43,13 +43,23 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /*
+     * With iothread-vq-mapping the virtqueues are spread round-robin over
+     * these IOThreads.  The BlockBackend stays in the AioContext of the
+     * first one (ctx), the others only process their virtqueues.
+     */
+    IOThread **iothreads;
+    unsigned num_iothreads;
+    AioContext **vq_aio_context;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
 void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
 {
     if (s->batch_notifications) {
-        set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
+        /* Completions of several IOThreads may race here */
+        set_bit_atomic(virtio_get_queue_index(vq), s->batch_notify_vqs);
         qemu_bh_schedule(s->bh);
     } else {
         virtio_notify_irqfd(s->vdev, vq);
@@ -60,14 +70,12 @@ static void notify_guest_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
     unsigned nvqs = s->conf->num_queues;
-    unsigned long bitmap[BITS_TO_LONGS(nvqs)];
     unsigned j;
 
-    memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
-    memset(s->batch_notify_vqs, 0, sizeof(bitmap));
-
     for (j = 0; j < nvqs; j += BITS_PER_LONG) {
-        unsigned long bits = bitmap[j / BITS_PER_LONG];
+        /* Bits set after the exchange schedule the BH again */
+        unsigned long bits = qatomic_xchg(&s->batch_notify_vqs[BIT_WORD(j)],
+                                          0);
 
         while (bits != 0) {
             unsigned i = j + ctzl(bits);
@@ -88,10 +96,19 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    IOThread **iothreads = NULL;
+    unsigned num_iothreads = 0;
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread && conf->iothread_vq_mapping) {
+        error_setg(errp, "iothread and iothread-vq-mapping properties "
+                   "cannot be set at the same time");
+        return false;
+    }
+
+    if (conf->iothread || conf->iothread_vq_mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -111,6 +128,13 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
             return false;
         }
     }
+    if (conf->iothread_vq_mapping) {
+        iothreads = iothread_parse_vq_mapping(conf->iothread_vq_mapping,
+                                              &num_iothreads, errp);
+        if (!iothreads) {
+            return false;
+        }
+    }
     /* Don't try if transport does not support notifiers. */
     if (!virtio_device_ioeventfd_enabled(vdev)) {
         return false;
@@ -124,9 +148,22 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
         s->iothread = conf->iothread;
         object_ref(OBJECT(s->iothread));
         s->ctx = iothread_get_aio_context(s->iothread);
+    } else if (iothreads) {
+        s->iothreads = iothreads;
+        s->num_iothreads = num_iothreads;
+        for (i = 0; i < num_iothreads; i++) {
+            object_ref(OBJECT(iothreads[i]));
+        }
+        s->ctx = iothread_get_aio_context(iothreads[0]);
     } else {
         s->ctx = qemu_get_aio_context();
     }
+
+    s->vq_aio_context = g_new(AioContext *, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        s->vq_aio_context[i] = iothreads ?
+            iothread_get_aio_context(iothreads[i % num_iothreads]) : s->ctx;
+    }
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
@@ -139,6 +176,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -151,6 +189,11 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
+    }
+    g_free(s->iothreads);
+    g_free(s->vq_aio_context);
     g_free(s);
 }
 
@@ -165,6 +208,31 @@ static bool virtio_blk_data_plane_handle_output(VirtIODevice *vdev,
     return virtio_blk_handle_vq(s, vq);
 }
 
+/*
+ * Only the AioContext of the BlockBackend is quiesced by a drained
+ * section, keep the other IOThreads from submitting new requests too.
+ *
+ * Context: QEMU global mutex held
+ */
+void virtio_blk_data_plane_drained_begin(VirtIOBlockDataPlane *s)
+{
+    unsigned i;
+
+    for (i = 1; i < s->num_iothreads; i++) {
+        aio_disable_external(iothread_get_aio_context(s->iothreads[i]));
+    }
+}
+
+/* Context: QEMU global mutex held */
+void virtio_blk_data_plane_drained_end(VirtIOBlockDataPlane *s)
+{
+    unsigned i;
+
+    for (i = 1; i < s->num_iothreads; i++) {
+        aio_enable_external(iothread_get_aio_context(s->iothreads[i]));
+    }
+}
+
 /* Context: QEMU global mutex held */
 int virtio_blk_data_plane_start(VirtIODevice *vdev)
 {
@@ -243,6 +311,11 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
         goto fail_aio_context;
     }
 
+    /* Let each IOThread run its requests itself */
+    if (s->num_iothreads > 1) {
+        blk_set_multi_context(s->conf->conf.blk, true);
+    }
+
     /* Process queued requests before the ones in vring */
     virtio_blk_process_queued_requests(vblk, false);
 
@@ -254,14 +327,15 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(ctx);
+        virtio_queue_aio_set_host_notifier_handler(vq, ctx,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_aio_context:
@@ -290,19 +364,24 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     return -ENOSYS;
 }
 
-/* Stop notifications for new requests from guest.
+/*
+ * Stop notifications for new requests from guest, for the virtqueues
+ * processed by the current IOThread.
  *
  * Context: BH in IOThread
  */
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        if (s->vq_aio_context[i] == ctx) {
+            virtio_queue_aio_set_host_notifier_handler(vq, ctx, NULL);
+        }
     }
 }
 
@@ -329,9 +408,19 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    for (i = 1; i < s->num_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->iothreads[i]);
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_bh, s);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
     aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
+    blk_set_multi_context(s->conf->conf.blk, false);
+
     /* Drain and try to switch bs back to the QEMU main loop. If other users
      * keep the BlockBackend in the iothread, that's ok */
     blk_set_aio_context(s->conf->conf.blk, qemu_get_aio_context(), NULL);
@@ -62,6 +62,7 @@ struct XenBlockDataPlane {
     QEMUBH *bh;
     IOThread *iothread;
     AioContext *ctx;
+    bool owns_blk_context;
 };
 
 static int xen_block_send_response(XenBlockRequest *request);
@@ -613,13 +614,15 @@ static bool xen_block_dataplane_event(void *opaque)
 XenBlockDataPlane *xen_block_dataplane_create(XenDevice *xendev,
                                               BlockBackend *blk,
                                               unsigned int sector_size,
-                                              IOThread *iothread)
+                                              IOThread *iothread,
+                                              bool owns_blk_context)
 {
     XenBlockDataPlane *dataplane = g_new0(XenBlockDataPlane, 1);
 
     dataplane->xendev = xendev;
     dataplane->blk = blk;
     dataplane->sector_size = sector_size;
+    dataplane->owns_blk_context = owns_blk_context;
 
     QLIST_INIT(&dataplane->inflight);
     QLIST_INIT(&dataplane->freelist);
@@ -678,8 +681,11 @@ void xen_block_dataplane_stop(XenBlockDataPlane *dataplane)
                                              qemu_get_aio_context(),
                                              &error_abort);
     }
-    /* Xen doesn't have multiple users for nodes, so this can't fail */
-    blk_set_aio_context(dataplane->blk, qemu_get_aio_context(), &error_abort);
+    if (dataplane->owns_blk_context) {
+        /* Xen doesn't have multiple users for nodes, so this can't fail */
+        blk_set_aio_context(dataplane->blk, qemu_get_aio_context(),
+                            &error_abort);
+    }
     aio_context_release(dataplane->ctx);
 
     /*
@@ -760,12 +766,6 @@ void xen_block_dataplane_start(XenBlockDataPlane *dataplane,
         return;
     }
 
-    xen_device_set_max_grant_refs(xendev, dataplane->nr_ring_ref,
-                                  errp);
-    if (*errp) {
-        goto stop;
-    }
-
     dataplane->sring = xen_device_map_grant_refs(xendev,
                                               dataplane->ring_ref,
                                               dataplane->nr_ring_ref,
@@ -809,11 +809,13 @@ void xen_block_dataplane_start(XenBlockDataPlane *dataplane,
         goto stop;
     }
 
-    old_context = blk_get_aio_context(dataplane->blk);
-    aio_context_acquire(old_context);
-    /* If other users keep the BlockBackend in the iothread, that's ok */
-    blk_set_aio_context(dataplane->blk, dataplane->ctx, NULL);
-    aio_context_release(old_context);
+    if (dataplane->owns_blk_context) {
+        old_context = blk_get_aio_context(dataplane->blk);
+        aio_context_acquire(old_context);
+        /* If other users keep the BlockBackend in the iothread, that's ok */
+        blk_set_aio_context(dataplane->blk, dataplane->ctx, NULL);
+        aio_context_release(old_context);
+    }
 
     /* Only reason for failure is a NULL channel */
     aio_context_acquire(dataplane->ctx);
@@ -14,10 +14,18 @@
 
 typedef struct XenBlockDataPlane XenBlockDataPlane;
 
+/*
+ * Each dataplane serves one ring.  When several rings of a device share
+ * @blk, all of them must use the same @iothread and only the one started
+ * first and stopped last may have @owns_blk_context set; it moves @blk
+ * to and from the iothread.  The caller sets the maximum number of grant
+ * mappings of @xendev to cover the rings of all dataplanes.
+ */
 XenBlockDataPlane *xen_block_dataplane_create(XenDevice *xendev,
                                               BlockBackend *blk,
                                               unsigned int sector_size,
-                                              IOThread *iothread);
+                                              IOThread *iothread,
+                                              bool owns_blk_context);
 void xen_block_dataplane_destroy(XenBlockDataPlane *dataplane);
 void xen_block_dataplane_start(XenBlockDataPlane *dataplane,
                                const unsigned int ring_ref[],
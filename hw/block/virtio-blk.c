@@ -253,14 +253,20 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
+/* Number of requests pulled off the virtqueue at a time */
+#define VIRTIO_BLK_POP_BATCH 32
+
+static unsigned int virtio_blk_get_requests(VirtIOBlock *s, VirtQueue *vq,
+                                            VirtIOBlockReq **reqs,
+                                            unsigned int max)
 {
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
+    unsigned int i, n;
 
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
+    n = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq), (void **)reqs, max);
+    for (i = 0; i < n; i++) {
+        virtio_blk_init_request(s, vq, reqs[i]);
     }
-    return req;
+    return n;
 }
 
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
@@ -769,7 +775,8 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
 bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtIOBlockReq *reqs[VIRTIO_BLK_POP_BATCH];
+    unsigned int i, n;
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
     bool progress = false;
@@ -782,11 +789,19 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
+        while ((n = virtio_blk_get_requests(s, vq, reqs, ARRAY_SIZE(reqs)))) {
             progress = true;
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
+            for (i = 0; i < n; i++) {
+                if (virtio_blk_handle_request(reqs[i], &mrb)) {
+                    break;
+                }
+            }
+            if (i < n) {
+                /* The device is broken, drop the rest of the batch too */
+                for (; i < n; i++) {
+                    virtqueue_detach_element(reqs[i]->vq, &reqs[i]->elem, 0);
+                    virtio_blk_free_request(reqs[i]);
+                }
                 break;
             }
         }
@@ -1138,8 +1153,28 @@ static void virtio_blk_resize(void *opaque)
     aio_bh_schedule_oneshot(qemu_get_aio_context(), virtio_resize_cb, vdev);
 }
 
+static void virtio_blk_drained_begin(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+
+    if (s->dataplane) {
+        virtio_blk_data_plane_drained_begin(s->dataplane);
+    }
+}
+
+static void virtio_blk_drained_end(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+
+    if (s->dataplane) {
+        virtio_blk_data_plane_drained_end(s->dataplane);
+    }
+}
+
 static const BlockDevOps virtio_block_ops = {
     .resize_cb = virtio_blk_resize,
+    .drained_begin = virtio_blk_drained_begin,
+    .drained_end = virtio_blk_drained_end,
 };
 
 static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
@@ -1238,6 +1273,9 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
 
     blk_iostatus_enable(s->blk);
 
+    /* Each in-flight request can hold a coroutine */
+    qemu_coroutine_inc_pool_size(conf->num_queues * conf->queue_size / 2);
+
     add_boot_device_lchs(dev, "/disk@0,0",
                          conf->conf.lcyls,
                          conf->conf.lheads,
@@ -1252,6 +1290,7 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
     unsigned i;
 
     blk_drain(s->blk);
+    qemu_coroutine_dec_pool_size(conf->num_queues * conf->queue_size / 2);
     del_boot_device_lchs(dev, "/disk@0,0");
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
@@ -1280,6 +1319,12 @@ static const VMStateDescription vmstate_virtio_blk = {
         VMSTATE_VIRTIO_DEVICE,
         VMSTATE_END_OF_LIST()
     },
+    /*
+     * Dataplane is stopped and the requests drained with the VM, so the
+     * list of failed requests that virtio_blk_save_device() walks is
+     * stable.
+     */
+    .parallel_save = true,
 };
 
 static Property virtio_blk_properties[] = {
@@ -1301,6 +1346,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_BOOL("seg-max-adjust", VirtIOBlock, conf.seg_max_adjust, true),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_STRING("iothread-vq-mapping", VirtIOBlock,
+                       conf.iothread_vq_mapping),
     DEFINE_PROP_BIT64("discard", VirtIOBlock, host_features,
                       VIRTIO_BLK_F_DISCARD, true),
     DEFINE_PROP_BOOL("report-discard-granularity", VirtIOBlock,
@@ -43,20 +43,65 @@ static void xen_block_disconnect(XenDevice *xendev, Error **errp)
     XenBlockDevice *blockdev = XEN_BLOCK_DEVICE(xendev);
     const char *type = object_get_typename(OBJECT(blockdev));
     XenBlockVdev *vdev = &blockdev->props.vdev;
+    unsigned int i;
 
     trace_xen_block_disconnect(type, vdev->disk, vdev->partition);
 
-    xen_block_dataplane_stop(blockdev->dataplane);
+    if (!blockdev->dataplanes) {
+        return;
+    }
+
+    /* Queue 0 moves the BlockBackend, so it must be stopped last */
+    for (i = blockdev->props.max_queues; i-- > 0;) {
+        xen_block_dataplane_stop(blockdev->dataplanes[i]);
+    }
+}
+
+/*
+ * Read the ring references and the event channel of one queue, whose
+ * keys are found under @prefix in the frontend area.
+ */
+static bool xen_block_read_queue(XenDevice *xendev, const char *prefix,
+                                 bool has_order, unsigned int nr_ring_ref,
+                                 unsigned int *ring_ref,
+                                 unsigned int *event_channel, Error **errp)
+{
+    g_autofree char *event_key = g_strdup_printf("%sevent-channel", prefix);
+    unsigned int i;
+
+    for (i = 0; i < nr_ring_ref; i++) {
+        g_autofree char *key = has_order ?
+            g_strdup_printf("%sring-ref%u", prefix, i) :
+            g_strdup_printf("%sring-ref", prefix);
+
+        if (xen_device_frontend_scanf(xendev, key, "%u",
+                                      &ring_ref[i]) != 1) {
+            error_setg(errp, "failed to read %s", key);
+            return false;
+        }
+    }
+
+    if (xen_device_frontend_scanf(xendev, event_key, "%u",
+                                  event_channel) != 1) {
+        error_setg(errp, "failed to read %s", event_key);
+        return false;
+    }
+
+    return true;
 }
 
 static void xen_block_connect(XenDevice *xendev, Error **errp)
 {
+    ERRP_GUARD();
     XenBlockDevice *blockdev = XEN_BLOCK_DEVICE(xendev);
     const char *type = object_get_typename(OBJECT(blockdev));
     XenBlockVdev *vdev = &blockdev->props.vdev;
     BlockConf *conf = &blockdev->props.conf;
     unsigned int feature_large_sector_size;
-    unsigned int order, nr_ring_ref, *ring_ref, event_channel, protocol;
+    unsigned int order, nr_ring_ref, event_channel, protocol;
+    unsigned int nr_queues, i;
+    g_autofree unsigned int *ring_ref = NULL;
+    bool has_order;
     char *str;
 
     trace_xen_block_connect(type, vdev->disk, vdev->partition);
@@ -73,45 +118,22 @@ static void xen_block_connect(XenDevice *xendev, Error **errp)
         return;
     }
 
-    if (xen_device_frontend_scanf(xendev, "ring-page-order", "%u",
-                                  &order) != 1) {
+    has_order = xen_device_frontend_scanf(xendev, "ring-page-order", "%u",
+                                          &order) == 1;
+    if (!has_order) {
         nr_ring_ref = 1;
-        ring_ref = g_new(unsigned int, nr_ring_ref);
-
-        if (xen_device_frontend_scanf(xendev, "ring-ref", "%u",
-                                      &ring_ref[0]) != 1) {
-            error_setg(errp, "failed to read ring-ref");
-            g_free(ring_ref);
-            return;
-        }
     } else if (order <= blockdev->props.max_ring_page_order) {
-        unsigned int i;
-
         nr_ring_ref = 1 << order;
-        ring_ref = g_new(unsigned int, nr_ring_ref);
-
-        for (i = 0; i < nr_ring_ref; i++) {
-            const char *key = g_strdup_printf("ring-ref%u", i);
-
-            if (xen_device_frontend_scanf(xendev, key, "%u",
-                                          &ring_ref[i]) != 1) {
-                error_setg(errp, "failed to read %s", key);
-                g_free((gpointer)key);
-                g_free(ring_ref);
-                return;
-            }
-
-            g_free((gpointer)key);
-        }
     } else {
         error_setg(errp, "invalid ring-page-order (%d)", order);
         return;
     }
 
-    if (xen_device_frontend_scanf(xendev, "event-channel", "%u",
-                                  &event_channel) != 1) {
-        error_setg(errp, "failed to read event-channel");
-        g_free(ring_ref);
+    if (xen_device_frontend_scanf(xendev, "multi-queue-num-queues", "%u",
+                                  &nr_queues) != 1) {
+        nr_queues = 1;
+    } else if (nr_queues == 0 || nr_queues > blockdev->props.max_queues) {
+        error_setg(errp, "invalid multi-queue-num-queues (%u)", nr_queues);
         return;
     }
 
@@ -130,10 +152,31 @@ static void xen_block_connect(XenDevice *xendev, Error **errp)
         free(str);
     }
 
-    xen_block_dataplane_start(blockdev->dataplane, ring_ref, nr_ring_ref,
-                              event_channel, protocol, errp);
+    xen_device_set_max_grant_refs(xendev, nr_queues * nr_ring_ref, errp);
+    if (*errp) {
+        return;
+    }
+
+    ring_ref = g_new(unsigned int, nr_ring_ref);
+    for (i = 0; i < nr_queues; i++) {
+        g_autofree char *prefix = nr_queues > 1 ?
+            g_strdup_printf("queue-%u/", i) : g_strdup("");
+
+        if (!xen_block_read_queue(xendev, prefix, has_order, nr_ring_ref,
+                                  ring_ref, &event_channel, errp)) {
+            break;
+        }
+
+        xen_block_dataplane_start(blockdev->dataplanes[i], ring_ref,
+                                  nr_ring_ref, event_channel, protocol, errp);
+        if (*errp) {
+            break;
+        }
+    }
 
-    g_free(ring_ref);
+    if (*errp) {
+        xen_block_disconnect(xendev, NULL);
+    }
 }
 
 static void xen_block_unrealize(XenDevice *xendev)
@@ -153,8 +196,15 @@ static void xen_block_unrealize(XenDevice *xendev)
     /* Disconnect from the frontend in case this has not already happened */
     xen_block_disconnect(xendev, NULL);
 
-    xen_block_dataplane_destroy(blockdev->dataplane);
-    blockdev->dataplane = NULL;
+    if (blockdev->dataplanes) {
+        unsigned int i;
+
+        for (i = 0; i < blockdev->props.max_queues; i++) {
+            xen_block_dataplane_destroy(blockdev->dataplanes[i]);
+        }
+        g_free(blockdev->dataplanes);
+        blockdev->dataplanes = NULL;
+    }
 
     if (blockdev_class->unrealize) {
         blockdev_class->unrealize(blockdev);
@@ -203,12 +253,18 @@ static void xen_block_realize(XenDevice *xendev, Error **errp)
     XenBlockVdev *vdev = &blockdev->props.vdev;
     BlockConf *conf = &blockdev->props.conf;
     BlockBackend *blk = conf->blk;
+    unsigned int i;
 
     if (vdev->type == XEN_BLOCK_VDEV_TYPE_INVALID) {
         error_setg(errp, "vdev property not set");
         return;
     }
 
+    if (blockdev->props.max_queues == 0) {
+        error_setg(errp, "max-queues must be at least 1");
+        return;
+    }
+
     trace_xen_block_realize(type, vdev->disk, vdev->partition);
 
     if (blockdev_class->realize) {
@@ -259,6 +315,10 @@ static void xen_block_realize(XenDevice *xendev, Error **errp)
     xen_device_backend_printf(xendev, "feature-flush-cache", "%u", 1);
     xen_device_backend_printf(xendev, "max-ring-page-order", "%u",
                               blockdev->props.max_ring_page_order);
+    if (blockdev->props.max_queues > 1) {
+        xen_device_backend_printf(xendev, "multi-queue-max-queues", "%u",
+                                  blockdev->props.max_queues);
+    }
     xen_device_backend_printf(xendev, "info", "%u", blockdev->info);
 
     xen_device_frontend_printf(xendev, "virtual-device", "%lu",
@@ -271,9 +331,13 @@ static void xen_block_realize(XenDevice *xendev, Error **errp)
 
     xen_block_set_size(blockdev);
 
-    blockdev->dataplane =
-        xen_block_dataplane_create(xendev, blk, conf->logical_block_size,
-                                   blockdev->props.iothread);
+    blockdev->dataplanes = g_new(XenBlockDataPlane *,
+                                 blockdev->props.max_queues);
+    for (i = 0; i < blockdev->props.max_queues; i++) {
+        blockdev->dataplanes[i] =
+            xen_block_dataplane_create(xendev, blk, conf->logical_block_size,
+                                       blockdev->props.iothread, i == 0);
+    }
 }
 
 static void xen_block_frontend_changed(XenDevice *xendev,
@@ -521,6 +585,7 @@ static Property xen_block_props[] = {
     DEFINE_BLOCK_PROPERTIES(XenBlockDevice, props.conf),
     DEFINE_PROP_UINT32("max-ring-page-order", XenBlockDevice,
                        props.max_ring_page_order, 4),
+    DEFINE_PROP_UINT32("max-queues", XenBlockDevice, props.max_queues, 1),
     DEFINE_PROP_LINK("iothread", XenBlockDevice, props.iothread,
                      TYPE_IOTHREAD, IOThread *),
     DEFINE_PROP_END_OF_LIST()
@@ -20,6 +20,7 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "hw/core/cpu.h"
 #include "sysemu/hw_accel.h"
 #include "qemu/notify.h"
@@ -34,6 +35,7 @@
 #include "hw/qdev-properties.h"
 #include "trace/trace-root.h"
 #include "qemu/plugin.h"
+#include "qemu/thread-context.h"
 
 CPUState *cpu_by_arch_id(int64_t id)
 {
@@ -249,9 +251,72 @@ static void cpu_common_finalize(Object *obj)
 {
     CPUState *cpu = CPU(obj);
 
+    if (cpu->thread_context) {
+        object_unref(OBJECT(cpu->thread_context));
+    }
     qemu_mutex_destroy(&cpu->work_mutex);
 }
 
+#ifndef CONFIG_USER_ONLY
+static void cpu_get_thread_context(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    CPUState *cpu = CPU(obj);
+    g_autofree char *path = NULL;
+
+    path = cpu->thread_context ?
+           object_get_canonical_path(OBJECT(cpu->thread_context)) :
+           g_strdup("");
+    visit_type_str(v, name, &path, errp);
+}
+
+/*
+ * Unlike a plain link, this can be changed at any time: once the vCPU
+ * thread exists, setting it moves the thread to the CPUs of the context.
+ * Management can thus pin each vCPU while the machine is still stopped
+ * with -S, without looking up thread IDs.
+ */
+static void cpu_set_thread_context(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    CPUState *cpu = CPU(obj);
+    g_autofree char *path = NULL;
+    ThreadContext *tc = NULL;
+
+    if (!visit_type_str(v, name, &path, errp)) {
+        return;
+    }
+
+    if (*path) {
+        tc = (ThreadContext *)object_resolve_path_type(path,
+                                                      TYPE_THREAD_CONTEXT,
+                                                      NULL);
+        if (!tc) {
+            error_setg(errp, "'%s' is not a thread-context object", path);
+            return;
+        }
+    }
+
+    if (tc && cpu->created) {
+        int ret = thread_context_set_thread_affinity(tc, cpu->thread);
+
+        if (ret) {
+            error_setg(errp, "Setting vCPU thread affinity failed: %s",
+                       strerror(ret));
+            return;
+        }
+    }
+
+    if (tc) {
+        object_ref(OBJECT(tc));
+    }
+    if (cpu->thread_context) {
+        object_unref(OBJECT(cpu->thread_context));
+    }
+    cpu->thread_context = tc;
+}
+#endif
+
 static int64_t cpu_common_get_arch_id(CPUState *cpu)
 {
     return cpu->cpu_index;
@@ -287,6 +352,12 @@ static void cpu_class_init(ObjectClass *klass, void *data)
     dc->unrealize = cpu_common_unrealizefn;
     dc->reset = cpu_common_reset;
     device_class_set_props(dc, cpu_common_props);
+#ifndef CONFIG_USER_ONLY
+    object_class_property_add(klass, "thread-context", "link<"
+                              TYPE_THREAD_CONTEXT ">",
+                              cpu_get_thread_context, cpu_set_thread_context,
+                              NULL, NULL);
+#endif
     /*
      * Reason: CPUs still need special care by board code: wiring up
      * IRQs, adding reset handlers, halting non-first CPUs, ...
@@ -698,6 +698,19 @@ char *qdev_get_dev_path(DeviceState *dev)
     return NULL;
 }
 
+/* Microseconds since QEMU started */
+static int64_t startup_time_us;
+
+static void __attribute__((constructor)) init_startup_time(void)
+{
+    startup_time_us = g_get_monotonic_time();
+}
+
+static int64_t get_startup_clock_us(void)
+{
+    return g_get_monotonic_time() - startup_time_us;
+}
+
 static bool device_get_realized(Object *obj, Error **errp)
 {
     DeviceState *dev = DEVICE(obj);
@@ -757,12 +770,16 @@ static void device_set_realized(Object *obj, bool value, Error **errp)
             }
         }
 
+        dev->realize_start_us = get_startup_clock_us();
         if (dc->realize) {
             dc->realize(dev, &local_err);
             if (local_err != NULL) {
                 goto fail;
             }
         }
+        dev->realize_us = get_startup_clock_us() - dev->realize_start_us;
+        trace_qdev_realize_done(dev, object_get_typename(obj),
+                                dev->realize_us);
 
         DEVICE_LISTENER_CALL(realize, Forward, dev);
 
@@ -1138,6 +1155,7 @@ Object *qdev_get_machine(void)
 }
 
 static MachineInitPhase machine_phase;
+static int64_t machine_phase_time_us[PHASE_MACHINE_READY + 1];
 
 bool phase_check(MachineInitPhase phase)
 {
@@ -1148,6 +1166,14 @@ void phase_advance(MachineInitPhase phase)
 {
     assert(machine_phase == phase - 1);
     machine_phase = phase;
+    machine_phase_time_us[phase] = get_startup_clock_us();
+    trace_machine_phase_advance(phase, machine_phase_time_us[phase]);
+}
+
+int64_t phase_get_time_us(MachineInitPhase phase)
+{
+    assert(phase_check(phase));
+    return machine_phase_time_us[phase];
 }
 
 static const TypeInfo device_type_info = {
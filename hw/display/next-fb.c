@@ -74,6 +74,7 @@ static void nextfb_update(void *opaque)
     int src_width;
     int first = 0;
     int last  = 0;
+    int invalidate = s->invalidate;
     DisplaySurface *surface = qemu_console_surface(s->con);
 
     src_width = s->cols / 4 + 8;
@@ -85,11 +86,14 @@ static void nextfb_update(void *opaque)
         s->invalidate = 0;
     }
 
+    /* Only redraw, and report, the lines that the guest wrote to */
     framebuffer_update_display(surface, &s->fbsection, s->cols, s->rows,
-                               src_width, dest_width, 0, 1, nextfb_draw_line,
-                               s, &first, &last);
+                               src_width, dest_width, 0, invalidate,
+                               nextfb_draw_line, s, &first, &last);
 
-    dpy_gfx_update(s->con, 0, 0, s->cols, s->rows);
+    if (first >= 0) {
+        dpy_gfx_update(s->con, 0, first, s->cols, last - first + 1);
+    }
 }
 
 static void nextfb_invalidate(void *opaque)
@@ -134,7 +134,12 @@ void virtio_gpu_init_udmabuf(struct virtio_gpu_simple_resource *res)
 
     res->dmabuf_fd = -1;
     if (res->iov_cnt == 1) {
+        /*
+         * The memory is contiguous in QEMU and needs no remapping, but a
+         * dmabuf is still needed for GL displays to scan it out directly.
+         */
         pdata = res->iov[0].iov_base;
+        virtio_gpu_create_udmabuf(res);
     } else {
         virtio_gpu_create_udmabuf(res);
         if (res->dmabuf_fd < 0) {
@@ -152,9 +157,7 @@ void virtio_gpu_init_udmabuf(struct virtio_gpu_simple_resource *res)
 
 void virtio_gpu_fini_udmabuf(struct virtio_gpu_simple_resource *res)
 {
-    if (res->remapped) {
-        virtio_gpu_destroy_udmabuf(res);
-    }
+    virtio_gpu_destroy_udmabuf(res);
 }
 
 static void virtio_gpu_free_dmabuf(VirtIOGPU *g, VGPUDMABuf *dmabuf)
@@ -515,8 +515,19 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
             scanout = &g->parent_obj.scanout[i];
             if (scanout->resource_id == res->resource_id &&
                 console_has_gl(scanout->con)) {
-                dpy_gl_update(scanout->con, 0, 0, scanout->width,
-                              scanout->height);
+                /* Only the damaged part needs to be read back or redrawn */
+                uint32_t x1 = MAX(rf.r.x, scanout->x);
+                uint32_t y1 = MAX(rf.r.y, scanout->y);
+                uint64_t x2 = MIN((uint64_t)rf.r.x + rf.r.width,
+                                  (uint64_t)scanout->x + scanout->width);
+                uint64_t y2 = MIN((uint64_t)rf.r.y + rf.r.height,
+                                  (uint64_t)scanout->y + scanout->height);
+
+                if (x2 > x1 && y2 > y1) {
+                    dpy_gl_update(scanout->con,
+                                  x1 - scanout->x, y1 - scanout->y,
+                                  x2 - x1, y2 - y1);
+                }
                 return;
             }
         }
@@ -638,10 +649,16 @@ static void virtio_gpu_do_set_scanout(VirtIOGPU *g,
         data = (uint8_t *)pixman_image_get_data(res->image);
     }
 
-    /* create a surface for this scanout */
-    if ((res->blob && !console_has_gl(scanout->con)) ||
-        !scanout->ds ||
+    /*
+     * Create a surface for this scanout.  Blob surfaces point straight
+     * into guest memory, so if the guest flips back to a buffer that is
+     * already shown, there is no need to replace the surface and make the
+     * UI redraw the whole screen.
+     */
+    if (!scanout->ds ||
         surface_data(scanout->ds) != data + fb->offset ||
+        surface_stride(scanout->ds) != fb->stride ||
+        surface_format(scanout->ds) != fb->format ||
         scanout->width != r->width ||
         scanout->height != r->height) {
         pixman_image_t *rect;
@@ -247,6 +247,15 @@ void acpi_setup_microvm(MicrovmMachineState *mms)
     acpi_build_tables_init(&tables);
     acpi_build_microvm(&tables, mms);
 
+    if (mms->direct_boot) {
+        /* There is no firmware to run the linker, do it here */
+        bios_linker_loader_run(tables.linker, MICROVM_BOOT_ACPI_BASE,
+                               MICROVM_BOOT_ACPI_SIZE, ACPI_BUILD_RSDP_FILE,
+                               &mms->rsdp_addr, &error_fatal);
+        acpi_build_tables_cleanup(&tables, true);
+        return;
+    }
+
     /* Now expose it all to Guest */
     acpi_add_rom_blob(acpi_build_no_update, NULL, tables.table_data,
                       ACPI_BUILD_TABLE_FILE);
@@ -230,6 +230,99 @@ static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
              (entry->gfn == gfn_tlb));
 }
 
+static inline unsigned int vtd_iotlb_cache_index(hwaddr addr,
+                                                 unsigned int shift)
+{
+    uint64_t pfn = addr >> shift;
+
+    /* Mix in the shift so that the first pages of each size differ */
+    return ((pfn + shift) * 0x9e3779b97f4a7c15ULL) >>
+           (64 - ctz32(VTD_AS_IOTLB_CACHE_SIZE));
+}
+
+/*
+ * Look @addr up in the translations cached by @vtd_as, without taking
+ * the IOMMU lock.  Returns true and fills @entry on a hit.
+ */
+static bool vtd_iotlb_cache_lookup(VTDAddressSpace *vtd_as, hwaddr addr,
+                                   IOMMUTLBEntry *entry)
+{
+    uint32_t gen = qatomic_read(&vtd_as->iommu_state->iotlb_cache_gen);
+    VTDIOTLBCacheEntry *cached;
+    unsigned int idx;
+    uint32_t level;
+
+    RCU_READ_LOCK_GUARD();
+    for (level = VTD_SL_PT_LEVEL; level < VTD_SL_PML4_LEVEL; level++) {
+        idx = vtd_iotlb_cache_index(addr, vtd_slpt_level_shift(level));
+        cached = qatomic_rcu_read(&vtd_as->iotlb_cache[idx]);
+        if (cached && cached->gen == gen &&
+            (addr & ~cached->addr_mask) == cached->iova) {
+            entry->iova = cached->iova;
+            entry->translated_addr = cached->translated_addr;
+            entry->addr_mask = cached->addr_mask;
+            entry->perm = cached->perm;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Must be called with IOMMU lock held */
+static void vtd_iotlb_cache_insert_locked(VTDAddressSpace *vtd_as,
+                                          const IOMMUTLBEntry *entry)
+{
+    VTDIOTLBCacheEntry *cached = g_new(VTDIOTLBCacheEntry, 1);
+    unsigned int idx = vtd_iotlb_cache_index(entry->iova,
+                                             ctz64(~entry->addr_mask));
+
+    cached->gen = vtd_as->iommu_state->iotlb_cache_gen;
+    cached->iova = entry->iova;
+    cached->translated_addr = entry->translated_addr;
+    cached->addr_mask = entry->addr_mask;
+    cached->perm = entry->perm;
+    cached = qatomic_xchg(&vtd_as->iotlb_cache[idx], cached);
+    if (cached) {
+        g_free_rcu(cached, rcu);
+    }
+}
+
+/*
+ * Make all the translations cached by the VTDAddressSpaces obsolete.
+ * Must be called with IOMMU lock held.
+ */
+static void vtd_iotlb_cache_invalidate_locked(IntelIOMMUState *s)
+{
+    uint32_t gen = s->iotlb_cache_gen + 1;
+    VTDAddressSpace *vtd_as;
+    VTDBus *vtd_bus;
+    GHashTableIter bus_it;
+    uint32_t devfn_it;
+    VTDIOTLBCacheEntry *cached;
+    unsigned int i;
+
+    if (!gen) {
+        /* Drop the entries, so that none becomes valid again on wrap */
+        g_hash_table_iter_init(&bus_it, s->vtd_as_by_busptr);
+        while (g_hash_table_iter_next(&bus_it, NULL, (void **)&vtd_bus)) {
+            for (devfn_it = 0; devfn_it < PCI_DEVFN_MAX; ++devfn_it) {
+                vtd_as = vtd_bus->dev_as[devfn_it];
+                if (!vtd_as) {
+                    continue;
+                }
+                for (i = 0; i < VTD_AS_IOTLB_CACHE_SIZE; i++) {
+                    cached = qatomic_xchg(&vtd_as->iotlb_cache[i], NULL);
+                    if (cached) {
+                        g_free_rcu(cached, rcu);
+                    }
+                }
+            }
+        }
+        gen = 1;
+    }
+    qatomic_set(&s->iotlb_cache_gen, gen);
+}
+
 /* Reset all the gen of VTDAddressSpace to zero and set the gen of
  * IntelIOMMUState to 1.  Must be called with IOMMU lock held.
  */
@@ -254,6 +347,7 @@ static void vtd_reset_context_cache_locked(IntelIOMMUState *s)
         }
     }
     s->context_cache_gen = 1;
+    vtd_iotlb_cache_invalidate_locked(s);
 }
 
 /* Must be called with IOMMU lock held. */
@@ -261,6 +355,7 @@ static void vtd_reset_iotlb_locked(IntelIOMMUState *s)
 {
     assert(s->iotlb);
     g_hash_table_remove_all(s->iotlb);
+    vtd_iotlb_cache_invalidate_locked(s);
 }
 
 static void vtd_reset_iotlb(IntelIOMMUState *s)
@@ -1018,6 +1113,7 @@ static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
 {
     dma_addr_t addr = vtd_get_iova_pgtbl_base(s, ce);
     uint32_t level = vtd_get_iova_level(s, ce);
+    int ret, flush_ret;
     uint32_t offset;
     uint64_t slpte;
     uint64_t access_right_check;
@@ -1075,7 +1171,7 @@ static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
 typedef int (*vtd_page_walk_hook)(IOMMUTLBEvent *event, void *private);
 
 /**
- * Constant information used during page walking
+ * Information used during page walking
  *
  * @hook_fn: hook func to be called when detected page
  * @private: private data to be passed into hook func
@@ -1083,6 +1179,8 @@ typedef int (*vtd_page_walk_hook)(IOMMUTLBEvent *event, void *private);
  * @as: VT-d address space of the device
  * @aw: maximum address width
  * @domain: domain ID of the page walk
+ * @pending: contiguous pages found so far, notified at once
+ * @has_pending: whether @pending is valid
  */
 typedef struct {
     VTDAddressSpace *as;
@@ -1091,13 +1189,138 @@ typedef struct {
     bool notify_unmap;
     uint8_t aw;
     uint16_t domain_id;
+    DMAMap pending;
+    bool has_pending;
 } vtd_page_walk_info;
 
+static int vtd_page_walk_notify(vtd_page_walk_info *info, const DMAMap *map,
+                                IOMMUNotifierFlag type)
+{
+    IOMMUTLBEvent event = {
+        .type = type,
+        .entry = {
+            .target_as = &address_space_memory,
+            .iova = map->iova,
+            .translated_addr = map->translated_addr,
+            .addr_mask = map->size,
+            .perm = type == IOMMU_NOTIFIER_MAP ? map->perm : IOMMU_NONE,
+        },
+    };
+
+    assert(info->hook_fn);
+    trace_vtd_page_walk_one(info->domain_id, event.entry.iova,
+                            event.entry.translated_addr,
+                            event.entry.addr_mask, event.entry.perm);
+    return info->hook_fn(&event, info->private);
+}
+
+/*
+ * Drop the mappings that overlap @target and map again the parts of
+ * them that are outside it.  Notifiers such as VFIO cannot unmap only
+ * part of a range that was mapped at once, so a mapping is always
+ * unmapped as a whole.
+ *
+ * Normally translations do not change, but it can happen with buggy
+ * guest OSes.  Note that there will be a small window that we don't
+ * have map at all.  But that's the best effort we can do: vfio has no
+ * interface to modify a mapping atomically.
+ */
+static int vtd_page_walk_unmap_overlaps(vtd_page_walk_info *info,
+                                        DMAMap *target)
+{
+    IOVATree *tree = info->as->iova_tree;
+    hwaddr target_end = target->iova + target->size;
+    DMAMap *overlap;
+    DMAMap map, rest;
+    int ret;
+
+    while ((overlap = iova_tree_find(tree, target))) {
+        map = *overlap;
+        iova_tree_remove(tree, &map);
+        ret = vtd_page_walk_notify(info, &map, IOMMU_NOTIFIER_UNMAP);
+        if (ret) {
+            return ret;
+        }
+
+        if (map.iova < target->iova) {
+            rest = map;
+            rest.size = target->iova - map.iova - 1;
+            iova_tree_insert(tree, &rest);
+            ret = vtd_page_walk_notify(info, &rest, IOMMU_NOTIFIER_MAP);
+            if (ret) {
+                return ret;
+            }
+        }
+        if (map.iova + map.size > target_end) {
+            rest = map;
+            rest.iova = target_end + 1;
+            rest.translated_addr += rest.iova - map.iova;
+            rest.size = map.iova + map.size - rest.iova;
+            iova_tree_insert(tree, &rest);
+            ret = vtd_page_walk_notify(info, &rest, IOMMU_NOTIFIER_MAP);
+            if (ret) {
+                return ret;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Notify the pages that were merged in info->pending */
+static int vtd_page_walk_flush(vtd_page_walk_info *info)
+{
+    DMAMap *pending = &info->pending;
+    int ret;
+
+    if (!info->has_pending) {
+        return 0;
+    }
+    info->has_pending = false;
+
+    ret = vtd_page_walk_unmap_overlaps(info, pending);
+    if (ret || pending->perm == IOMMU_NONE) {
+        return ret;
+    }
+
+    iova_tree_insert(info->as->iova_tree, pending);
+    return vtd_page_walk_notify(info, pending, IOMMU_NOTIFIER_MAP);
+}
+
+/* Which side of the interrupt range @iova is on, or 1 if inside it */
+static inline int vtd_iova_side(hwaddr iova)
+{
+    return (iova >= VTD_INTERRUPT_ADDR_FIRST) +
+           (iova > VTD_INTERRUPT_ADDR_LAST);
+}
+
+static bool vtd_page_walk_can_merge(const DMAMap *pending,
+                                    const DMAMap *target)
+{
+    if (target->iova != pending->iova + pending->size + 1 ||
+        target->perm != pending->perm) {
+        return false;
+    }
+    if (target->perm != IOMMU_NONE &&
+        target->translated_addr !=
+        pending->translated_addr + pending->size + 1) {
+        return false;
+    }
+    /*
+     * The interrupt range splits the IOMMU region in two sections, and
+     * notifiers are registered for each of them separately.
+     */
+    return vtd_iova_side(pending->iova) == vtd_iova_side(target->iova);
+}
+
+/*
+ * Add the page (or huge page) of @event to the pages to be notified.
+ * Consecutive pages with contiguous translations are notified at once,
+ * for example in a single VFIO_IOMMU_MAP_DMA ioctl rather than one for
+ * each page.
+ */
 static int vtd_page_walk_one(IOMMUTLBEvent *event, vtd_page_walk_info *info)
 {
-    VTDAddressSpace *as = info->as;
-    vtd_page_walk_hook hook_fn = info->hook_fn;
-    void *private = info->private;
     IOMMUTLBEntry *entry = &event->entry;
     DMAMap target = {
         .iova = entry->iova,
@@ -1105,74 +1328,52 @@ static int vtd_page_walk_one(IOMMUTLBEvent *event, vtd_page_walk_info *info)
         .translated_addr = entry->translated_addr,
         .perm = entry->perm,
     };
-    DMAMap *mapped = iova_tree_find(as->iova_tree, &target);
+    DMAMap *mapped;
+    int ret;
 
     if (event->type == IOMMU_NOTIFIER_UNMAP && !info->notify_unmap) {
         trace_vtd_page_walk_one_skip_unmap(entry->iova, entry->addr_mask);
         return 0;
     }
 
-    assert(hook_fn);
+    if (event->type == IOMMU_NOTIFIER_UNMAP) {
+        target.translated_addr = 0;
+        target.perm = IOMMU_NONE;
+    }
 
-    /* Update local IOVA mapped ranges */
-    if (event->type == IOMMU_NOTIFIER_MAP) {
-        if (mapped) {
-            /* If it's exactly the same translation, skip */
-            if (!memcmp(mapped, &target, sizeof(target))) {
-                trace_vtd_page_walk_one_skip_map(entry->iova, entry->addr_mask,
-                                                 entry->translated_addr);
-                return 0;
-            } else {
-                /*
-                 * Translation changed.  Normally this should not
-                 * happen, but it can happen when with buggy guest
-                 * OSes.  Note that there will be a small window that
-                 * we don't have map at all.  But that's the best
-                 * effort we can do.  The ideal way to emulate this is
-                 * atomically modify the PTE to follow what has
-                 * changed, but we can't.  One example is that vfio
-                 * driver only has VFIO_IOMMU_[UN]MAP_DMA but no
-                 * interface to modify a mapping (meanwhile it seems
-                 * meaningless to even provide one).  Anyway, let's
-                 * mark this as a TODO in case one day we'll have
-                 * a better solution.
-                 */
-                IOMMUAccessFlags cache_perm = entry->perm;
-                int ret;
-
-                /* Emulate an UNMAP */
-                event->type = IOMMU_NOTIFIER_UNMAP;
-                entry->perm = IOMMU_NONE;
-                trace_vtd_page_walk_one(info->domain_id,
-                                        entry->iova,
-                                        entry->translated_addr,
-                                        entry->addr_mask,
-                                        entry->perm);
-                ret = hook_fn(event, private);
-                if (ret) {
-                    return ret;
-                }
-                /* Drop any existing mapping */
-                iova_tree_remove(as->iova_tree, &target);
-                /* Recover the correct type */
-                event->type = IOMMU_NOTIFIER_MAP;
-                entry->perm = cache_perm;
-            }
+    if (info->has_pending &&
+        !vtd_page_walk_can_merge(&info->pending, &target)) {
+        ret = vtd_page_walk_flush(info);
+        if (ret) {
+            return ret;
         }
-        iova_tree_insert(as->iova_tree, &target);
-    } else {
-        if (!mapped) {
-            /* Skip since we didn't map this range at all */
-            trace_vtd_page_walk_one_skip_unmap(entry->iova, entry->addr_mask);
+    }
+
+    mapped = iova_tree_find(info->as->iova_tree, &target);
+    if (event->type == IOMMU_NOTIFIER_MAP) {
+        /* If it's exactly the same translation, skip */
+        if (mapped && mapped->perm == target.perm &&
+            mapped->iova <= target.iova &&
+            mapped->iova + mapped->size >= target.iova + target.size &&
+            mapped->translated_addr + (target.iova - mapped->iova) ==
+            target.translated_addr) {
+            trace_vtd_page_walk_one_skip_map(entry->iova, entry->addr_mask,
+                                             entry->translated_addr);
             return 0;
         }
-        iova_tree_remove(as->iova_tree, &target);
+    } else if (!mapped) {
+        /* Skip since we didn't map this range at all */
+        trace_vtd_page_walk_one_skip_unmap(entry->iova, entry->addr_mask);
+        return 0;
     }
 
-    trace_vtd_page_walk_one(info->domain_id, entry->iova,
-                            entry->translated_addr, entry->addr_mask,
-                            entry->perm);
-    return hook_fn(event, private);
+    if (info->has_pending) {
+        info->pending.size += target.size + 1;
+    } else {
+        info->pending = target;
+        info->has_pending = true;
+    }
+    return 0;
 }
 
 /**
@@ -1294,7 +1495,9 @@ static int vtd_page_walk(IntelIOMMUState *s, VTDContextEntry *ce,
         end = vtd_iova_limit(s, ce, info->aw);
     }
 
-    return vtd_page_walk_level(addr, start, end, level, true, true, info);
+    ret = vtd_page_walk_level(addr, start, end, level, true, true, info);
+    flush_ret = vtd_page_walk_flush(info);
+    return ret ? ret : flush_ret;
 }
 
 static int vtd_root_entry_rsvd_bits_check(IntelIOMMUState *s,
@@ -1704,6 +1907,10 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
      */
     assert(!vtd_is_interrupt_addr(addr));
 
+    if (vtd_iotlb_cache_lookup(vtd_as, addr, entry)) {
+        return true;
+    }
+
     vtd_iommu_lock(s);
 
     cc_entry = &vtd_as->context_cache_entry;
@@ -1779,11 +1986,12 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
     vtd_update_iotlb(s, source_id, vtd_get_domain_id(s, &ce), addr, slpte,
                      access_flags, level);
 out:
-    vtd_iommu_unlock(s);
     entry->iova = addr & page_mask;
     entry->translated_addr = vtd_get_slpte_addr(slpte, s->aw_bits) & page_mask;
     entry->addr_mask = ~page_mask;
     entry->perm = access_flags;
+    vtd_iotlb_cache_insert_locked(vtd_as, entry);
+    vtd_iommu_unlock(s);
     return true;
 
 error:
@@ -1843,6 +2051,7 @@ static void vtd_context_global_invalidate(IntelIOMMUState *s)
     if (s->context_cache_gen == VTD_CONTEXT_CACHE_GEN_MAX) {
         vtd_reset_context_cache_locked(s);
     }
+    vtd_iotlb_cache_invalidate_locked(s);
     vtd_iommu_unlock(s);
     vtd_address_space_refresh_all(s);
     /*
@@ -1899,6 +2108,7 @@ static void vtd_context_device_invalidate(IntelIOMMUState *s,
                                              VTD_PCI_FUNC(devfn_it));
                 vtd_iommu_lock(s);
                 vtd_as->context_cache_entry.context_cache_gen = 0;
+                vtd_iotlb_cache_invalidate_locked(s);
                 vtd_iommu_unlock(s);
                 /*
                  * Do switch address space when needed, in case if the
@@ -1966,6 +2176,7 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
     vtd_iommu_lock(s);
     g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_domain,
                                 &domain_id);
+    vtd_iotlb_cache_invalidate_locked(s);
     vtd_iommu_unlock(s);
 
     QLIST_FOREACH(vtd_as, &s->vtd_as_with_notifiers, next) {
@@ -1979,12 +2190,12 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
 
 static void vtd_iotlb_page_invalidate_notify(IntelIOMMUState *s,
                                            uint16_t domain_id, hwaddr addr,
-                                           uint8_t am)
+                                           hwaddr size)
 {
     VTDAddressSpace *vtd_as;
     VTDContextEntry ce;
+    hwaddr iova, chunk, end = addr + size;
     int ret;
-    hwaddr size = (1 << am) * VTD_PAGE_SIZE;
 
     QLIST_FOREACH(vtd_as, &(s->vtd_as_with_notifiers), next) {
         ret = vtd_dev_to_context_entry(s, pci_bus_num(vtd_as->bus),
@@ -2001,28 +2212,47 @@ static void vtd_iotlb_page_invalidate_notify(IntelIOMMUState *s,
                 /*
                  * For UNMAP-only notifiers, we don't need to walk the
                  * page tables.  We just deliver the PSI down to
-                 * invalidate caches.
+                 * invalidate caches, split in naturally aligned chunks
+                 * if several of them were merged.
                  */
                 IOMMUTLBEvent event = {
                     .type = IOMMU_NOTIFIER_UNMAP,
                     .entry = {
                         .target_as = &address_space_memory,
-                        .iova = addr,
                         .translated_addr = 0,
-                        .addr_mask = size - 1,
                         .perm = IOMMU_NONE,
                     },
                 };
-                memory_region_notify_iommu(&vtd_as->iommu, 0, event);
+
+                for (iova = addr; iova < end; iova += chunk) {
+                    chunk = pow2floor(end - iova);
+                    if (iova) {
+                        chunk = MIN(chunk, iova & -iova);
+                    }
+                    event.entry.iova = iova;
+                    event.entry.addr_mask = chunk - 1;
+                    memory_region_notify_iommu(&vtd_as->iommu, 0, event);
+                }
             }
         }
     }
 }
 
+/* Deliver the page-selective invalidation deferred while processing QI */
+static void vtd_iotlb_page_invalidate_flush(IntelIOMMUState *s)
+{
+    if (s->psi_pending) {
+        s->psi_pending = false;
+        vtd_iotlb_page_invalidate_notify(s, s->psi_domain_id, s->psi_addr,
+                                         s->psi_size);
+    }
+}
+
 static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
                                       hwaddr addr, uint8_t am)
 {
     VTDIOTLBPageInvInfo info;
+    hwaddr size = (1 << am) * VTD_PAGE_SIZE;
 
     trace_vtd_inv_desc_iotlb_pages(domain_id, addr, am);
 
@@ -2032,8 +2262,27 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
     info.mask = ~((1 << am) - 1);
     vtd_iommu_lock(s);
     g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
+    vtd_iotlb_cache_invalidate_locked(s);
     vtd_iommu_unlock(s);
-    vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am);
+
+    if (!s->qi_processing) {
+        vtd_iotlb_page_invalidate_notify(s, domain_id, addr, size);
+        return;
+    }
+    /*
+     * Guests tend to queue one descriptor per page when unmapping a
+     * buffer; merge consecutive ones and walk the page tables once.
+     */
+    if (s->psi_pending && s->psi_domain_id == domain_id &&
+        s->psi_addr + s->psi_size == addr) {
+        s->psi_size += size;
+        return;
+    }
+    vtd_iotlb_page_invalidate_flush(s);
+    s->psi_pending = true;
+    s->psi_domain_id = domain_id;
+    s->psi_addr = addr;
+    s->psi_size = size;
 }
 
 /* Flush IOTLB
@@ -2500,6 +2749,11 @@ static bool vtd_process_inv_desc(IntelIOMMUState *s)
     /* FIXME: should update at first or at last? */
     s->iq_last_desc_type = desc_type;
 
+    /* Only page-selective IOTLB invalidations are merged */
+    if (desc_type != VTD_INV_DESC_IOTLB) {
+        vtd_iotlb_page_invalidate_flush(s);
+    }
+
     switch (desc_type) {
     case VTD_INV_DESC_CC:
         trace_vtd_inv_desc("context-cache", inv_desc.hi, inv_desc.lo);
@@ -2578,9 +2832,11 @@ static void vtd_fetch_inv_desc(IntelIOMMUState *s)
         vtd_handle_inv_queue_error(s);
         return;
     }
+    s->qi_processing = true;
     while (s->iq_head != s->iq_tail) {
         if (!vtd_process_inv_desc(s)) {
             /* Invalidation Queue Errors */
+            vtd_iotlb_page_invalidate_flush(s);
             vtd_handle_inv_queue_error(s);
             break;
         }
@@ -2589,6 +2845,8 @@ static void vtd_fetch_inv_desc(IntelIOMMUState *s)
                          (((uint64_t)(s->iq_head)) << qi_shift) &
                          VTD_IQH_QH_MASK);
     }
+    vtd_iotlb_page_invalidate_flush(s);
+    s->qi_processing = false;
 }
 
 /* Handle write to Invalidation Queue Tail Register */
@@ -3838,6 +4096,7 @@ static void vtd_realize(DeviceState *dev, Error **errp)
     /* No corresponding destroy */
     s->iotlb = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
                                      g_free, g_free);
+    s->iotlb_cache_gen = 1;
     s->vtd_as_by_busptr = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
                                               g_free, g_free);
     vtd_init(s);
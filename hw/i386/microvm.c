@@ -274,12 +274,73 @@ static void microvm_devices_init(MicrovmMachineState *mms)
         serial_hds_isa_init(isa_bus, 0, 1);
     }
 
+    if (mms->direct_boot) {
+        return;
+    }
+
     default_firmware = x86_machine_is_acpi_enabled(x86ms)
             ? MICROVM_BIOS_FILENAME
             : MICROVM_QBOOT_FILENAME;
     x86_bios_rom_init(MACHINE(mms), default_firmware, get_system_memory(), true);
 }
 
+/*
+ * Load the kernel and the initrd straight to their place in guest RAM,
+ * for booting without firmware.  The initrd is not copied: its ROM
+ * blob refers to the mapped file, and is copied to RAM on reset.
+ */
+static void microvm_load_kernel_direct(MicrovmMachineState *mms)
+{
+    MachineState *machine = MACHINE(mms);
+    X86MachineState *x86ms = X86_MACHINE(mms);
+    uint8_t header[sizeof(Elf64_Ehdr)] = { 0 };
+    uint64_t kernel_low, kernel_high;
+    GMappedFile *mapped_file;
+    GError *gerr = NULL;
+    FILE *f;
+
+    f = fopen(machine->kernel_filename, "rb");
+    if (!f || fread(header, 1, sizeof(header), f) != sizeof(header)) {
+        error_report("could not read kernel '%s': %s",
+                     machine->kernel_filename, strerror(errno));
+        exit(1);
+    }
+    fclose(f);
+
+    if (!x86_load_elf_pvh(machine->kernel_filename, header, &mms->pvh_entry,
+                          &kernel_low, &kernel_high)) {
+        error_report("direct-boot needs an uncompressed (ELF) kernel with "
+                     "a PVH ELF note");
+        exit(1);
+    }
+
+    if (!machine->initrd_filename) {
+        return;
+    }
+
+    mapped_file = g_mapped_file_new(machine->initrd_filename, false, &gerr);
+    if (!mapped_file) {
+        error_report("could not read initrd '%s': %s",
+                     machine->initrd_filename, gerr->message);
+        exit(1);
+    }
+    mms->initrd_size = g_mapped_file_get_length(mapped_file);
+    if (mms->initrd_size > x86ms->below_4g_mem_size - kernel_high) {
+        error_report("initrd is too large (max: %" PRIu64 ", need %"
+                     HWADDR_PRIu ")",
+                     (uint64_t)x86ms->below_4g_mem_size - kernel_high,
+                     mms->initrd_size);
+        exit(1);
+    }
+    mms->initrd_addr = (x86ms->below_4g_mem_size - mms->initrd_size) &
+                       ~(hwaddr)4095;
+    rom_add_elf_program("initrd", mapped_file,
+                        g_mapped_file_get_contents(mapped_file),
+                        mms->initrd_size, mms->initrd_size,
+                        mms->initrd_addr, NULL);
+    g_mapped_file_unref(mapped_file);
+}
+
 static void microvm_memory_init(MicrovmMachineState *mms)
 {
     MachineState *machine = MACHINE(mms);
@@ -330,11 +391,13 @@ static void microvm_memory_init(MicrovmMachineState *mms)
 
     rom_set_fw(fw_cfg);
 
-    if (machine->kernel_filename != NULL) {
+    if (mms->direct_boot) {
+        microvm_load_kernel_direct(mms);
+    } else if (machine->kernel_filename != NULL) {
         x86_load_linux(x86ms, fw_cfg, 0, true, true);
     }
 
-    if (mms->option_roms) {
+    if (mms->option_roms && !mms->direct_boot) {
         for (i = 0; i < nb_option_roms; i++) {
             rom_add_option(option_rom[i].name, option_rom[i].bootindex);
         }
@@ -373,9 +436,8 @@ static gchar *microvm_get_mmio_cmdline(gchar *name, uint32_t virtio_irq_base)
     return cmdline;
 }
 
-static void microvm_fix_kernel_cmdline(MachineState *machine)
+static char *microvm_build_kernel_cmdline(MachineState *machine)
 {
-    X86MachineState *x86ms = X86_MACHINE(machine);
     MicrovmMachineState *mms = MICROVM_MACHINE(machine);
     BusState *bus;
     BusChild *kid;
@@ -412,12 +474,122 @@ static void microvm_fix_kernel_cmdline(MachineState *machine)
         }
     }
 
+    return cmdline;
+}
+
+static void microvm_fix_kernel_cmdline(MachineState *machine)
+{
+    X86MachineState *x86ms = X86_MACHINE(machine);
+    char *cmdline = microvm_build_kernel_cmdline(machine);
+
     fw_cfg_modify_i32(x86ms->fw_cfg, FW_CFG_CMDLINE_SIZE, strlen(cmdline) + 1);
     fw_cfg_modify_string(x86ms->fw_cfg, FW_CFG_CMDLINE_DATA, cmdline);
 
     g_free(cmdline);
 }
 
+/*
+ * Build what the PVH boot ABI passes to the kernel: the start info,
+ * the initrd as a module, the memory map and the command line.
+ */
+static void microvm_setup_boot_info(MicrovmMachineState *mms)
+{
+    MachineState *machine = MACHINE(mms);
+    g_autofree uint8_t *info = g_malloc0(MICROVM_BOOT_INFO_SIZE);
+    g_autofree char *cmdline = NULL;
+    struct hvm_start_info *start_info = (struct hvm_start_info *)info;
+    struct hvm_modlist_entry *mod = (struct hvm_modlist_entry *)
+                                    (start_info + 1);
+    struct hvm_memmap_table_entry *memmap =
+        (struct hvm_memmap_table_entry *)(mod + 1);
+    const hwaddr resv_start = MICROVM_BOOT_INFO_BASE;
+    const hwaddr resv_end = 0x100000;
+    uint32_t n = 0;
+    size_t len;
+    int i;
+
+    for (i = 0; i < e820_get_num_entries(); i++) {
+        uint64_t addr = le64_to_cpu(e820_table[i].address);
+        uint64_t end = addr + le64_to_cpu(e820_table[i].length);
+        uint32_t type = le32_to_cpu(e820_table[i].type);
+
+        if (type == E820_RAM && addr < resv_end && end > resv_start) {
+            /* Carve the boot information and ACPI tables out of RAM */
+            if (addr < resv_start) {
+                memmap[n].addr = cpu_to_le64(addr);
+                memmap[n].size = cpu_to_le64(resv_start - addr);
+                memmap[n++].type = cpu_to_le32(E820_RAM);
+            }
+            memmap[n].addr = cpu_to_le64(resv_start);
+            memmap[n].size = cpu_to_le64(resv_end - resv_start);
+            memmap[n++].type = cpu_to_le32(E820_RESERVED);
+            addr = resv_end;
+            if (end <= addr) {
+                continue;
+            }
+        }
+        memmap[n].addr = cpu_to_le64(addr);
+        memmap[n].size = cpu_to_le64(end - addr);
+        memmap[n++].type = cpu_to_le32(type);
+    }
+
+    if (!x86_machine_is_acpi_enabled(X86_MACHINE(mms)) &&
+        mms->auto_kernel_cmdline) {
+        cmdline = microvm_build_kernel_cmdline(machine);
+    } else {
+        cmdline = g_strdup(machine->kernel_cmdline);
+    }
+    len = (uint8_t *)&memmap[n] - info;
+    if (len + strlen(cmdline) + 1 > MICROVM_BOOT_INFO_SIZE) {
+        error_report("kernel command line is too long");
+        exit(1);
+    }
+    strcpy((char *)info + len, cmdline);
+
+    start_info->magic = cpu_to_le32(XEN_HVM_START_MAGIC_VALUE);
+    start_info->version = cpu_to_le32(1);
+    start_info->cmdline_paddr = cpu_to_le64(MICROVM_BOOT_INFO_BASE + len);
+    start_info->rsdp_paddr = cpu_to_le64(mms->rsdp_addr);
+    start_info->memmap_paddr = cpu_to_le64(MICROVM_BOOT_INFO_BASE +
+                                           ((uint8_t *)memmap - info));
+    start_info->memmap_entries = cpu_to_le32(n);
+    if (mms->initrd_size) {
+        start_info->nr_modules = cpu_to_le32(1);
+        start_info->modlist_paddr = cpu_to_le64(MICROVM_BOOT_INFO_BASE +
+                                                ((uint8_t *)mod - info));
+        mod->paddr = cpu_to_le64(mms->initrd_addr);
+        mod->size = cpu_to_le64(mms->initrd_size);
+    }
+
+    rom_add_blob_fixed("pvh-start-info", info, len + strlen(cmdline) + 1,
+                       MICROVM_BOOT_INFO_BASE);
+}
+
+/*
+ * Start the boot CPU at the PVH entry point, in 32-bit protected mode
+ * with paging disabled and %ebx pointing to the start info, as
+ * firmware would.
+ */
+static void microvm_reset_cpu_direct(MicrovmMachineState *mms, X86CPU *cpu)
+{
+    CPUX86State *env = &cpu->env;
+    const uint32_t code = DESC_P_MASK | DESC_S_MASK | DESC_CS_MASK |
+                          DESC_R_MASK | DESC_A_MASK | DESC_G_MASK |
+                          DESC_B_MASK;
+    const uint32_t data = DESC_P_MASK | DESC_S_MASK | DESC_W_MASK |
+                          DESC_A_MASK | DESC_G_MASK | DESC_B_MASK;
+
+    cpu_x86_update_cr0(env, CR0_PE_MASK | CR0_ET_MASK);
+    cpu_x86_load_seg_cache(env, R_CS, 0x08, 0, 0xffffffff, code);
+    cpu_x86_load_seg_cache(env, R_DS, 0x10, 0, 0xffffffff, data);
+    cpu_x86_load_seg_cache(env, R_ES, 0x10, 0, 0xffffffff, data);
+    cpu_x86_load_seg_cache(env, R_SS, 0x10, 0, 0xffffffff, data);
+    cpu_x86_load_seg_cache(env, R_FS, 0x10, 0, 0xffffffff, data);
+    cpu_x86_load_seg_cache(env, R_GS, 0x10, 0, 0xffffffff, data);
+    env->regs[R_EBX] = MICROVM_BOOT_INFO_BASE;
+    env->eip = mms->pvh_entry;
+}
+
 static void microvm_device_pre_plug_cb(HotplugHandler *hotplug_dev,
                                        DeviceState *dev, Error **errp)
 {
@@ -460,6 +632,22 @@ static void microvm_machine_state_init(MachineState *machine)
     X86MachineState *x86ms = X86_MACHINE(machine);
     Error *local_err = NULL;
 
+    if (mms->direct_boot) {
+        if (!machine->kernel_filename) {
+            error_report("direct-boot needs a kernel");
+            exit(1);
+        }
+        if (machine->firmware) {
+            error_report("direct-boot cannot be used with a firmware");
+            exit(1);
+        }
+        /* Without ACPI, secondary CPUs are described by firmware */
+        if (!x86_machine_is_acpi_enabled(x86ms) && machine->smp.cpus > 1) {
+            error_report("direct-boot with acpi=off supports only one CPU");
+            exit(1);
+        }
+    }
+
     microvm_memory_init(mms);
 
     x86_cpus_init(x86ms, CPU_VERSION_LATEST);
@@ -478,7 +666,7 @@ static void microvm_machine_reset(MachineState *machine)
     X86CPU *cpu;
 
     if (!x86_machine_is_acpi_enabled(X86_MACHINE(machine)) &&
-        machine->kernel_filename != NULL &&
+        machine->kernel_filename != NULL && !mms->direct_boot &&
         mms->auto_kernel_cmdline && !mms->kernel_cmdline_fixed) {
         microvm_fix_kernel_cmdline(machine);
         mms->kernel_cmdline_fixed = true;
@@ -493,6 +681,10 @@ static void microvm_machine_reset(MachineState *machine)
             device_legacy_reset(cpu->apic_state);
         }
     }
+
+    if (mms->direct_boot) {
+        microvm_reset_cpu_direct(mms, X86_CPU(first_cpu));
+    }
 }
 
 static void microvm_machine_get_pic(Object *obj, Visitor *v, const char *name,
@@ -625,12 +817,30 @@ static void microvm_machine_set_auto_kernel_cmdline(Object *obj, bool value,
     mms->auto_kernel_cmdline = value;
 }
 
+static bool microvm_machine_get_direct_boot(Object *obj, Error **errp)
+{
+    MicrovmMachineState *mms = MICROVM_MACHINE(obj);
+
+    return mms->direct_boot;
+}
+
+static void microvm_machine_set_direct_boot(Object *obj, bool value,
+                                            Error **errp)
+{
+    MicrovmMachineState *mms = MICROVM_MACHINE(obj);
+
+    mms->direct_boot = value;
+}
+
 static void microvm_machine_done(Notifier *notifier, void *data)
 {
     MicrovmMachineState *mms = container_of(notifier, MicrovmMachineState,
                                             machine_done);
 
     acpi_setup_microvm(mms);
+    if (mms->direct_boot) {
+        microvm_setup_boot_info(mms);
+    }
 }
 
 static void microvm_powerdown_req(Notifier *notifier, void *data)
@@ -660,6 +870,7 @@ static void microvm_machine_initfn(Object *obj)
     mms->isa_serial = true;
     mms->option_roms = true;
     mms->auto_kernel_cmdline = true;
+    mms->direct_boot = false;
 
     /* State */
     mms->kernel_cmdline_fixed = false;
@@ -756,6 +967,12 @@ static void microvm_class_init(ObjectClass *oc, void *data)
         MICROVM_MACHINE_AUTO_KERNEL_CMDLINE,
         "Set off to disable adding virtio-mmio devices to the kernel cmdline");
 
+    object_class_property_add_bool(oc, MICROVM_MACHINE_DIRECT_BOOT,
+                                   microvm_machine_get_direct_boot,
+                                   microvm_machine_set_direct_boot);
+    object_class_property_set_description(oc, MICROVM_MACHINE_DIRECT_BOOT,
+        "Set on to start the kernel at its PVH entry point without firmware");
+
     machine_class_allow_dynamic_sysbus_dev(mc, TYPE_RAMFB_DEVICE);
 }
 
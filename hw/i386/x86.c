@@ -708,17 +708,11 @@ static uint64_t read_pvh_start_addr(void *arg1, void *arg2, bool is64)
     return pvh_start_addr;
 }
 
-static bool load_elfboot(const char *kernel_filename,
-                         int kernel_file_size,
-                         uint8_t *header,
-                         size_t pvh_xen_start_addr,
-                         FWCfgState *fw_cfg)
+bool x86_load_elf_pvh(const char *kernel_filename, uint8_t *header,
+                      uint32_t *pvh_entry, uint64_t *low, uint64_t *high)
 {
     uint32_t flags = 0;
-    uint32_t mh_load_addr = 0;
-    uint32_t elf_kernel_size = 0;
     uint64_t elf_entry;
-    uint64_t elf_low, elf_high;
     int kernel_size;
 
     if (ldl_p(header) != 0x464c457f) {
@@ -737,21 +731,41 @@ static bool load_elfboot(const char *kernel_filename,
     uint64_t elf_note_type = XEN_ELFNOTE_PHYS32_ENTRY;
     kernel_size = load_elf(kernel_filename, read_pvh_start_addr,
                            NULL, &elf_note_type, &elf_entry,
-                           &elf_low, &elf_high, NULL, 0, I386_ELF_MACHINE,
+                           low, high, NULL, 0, I386_ELF_MACHINE,
                            0, 0);
 
     if (kernel_size < 0) {
         error_report("Error while loading elf kernel");
         exit(1);
     }
-    mh_load_addr = elf_low;
-    elf_kernel_size = elf_high - elf_low;
 
     if (pvh_start_addr == 0) {
         error_report("Error loading uncompressed kernel without PVH ELF Note");
         exit(1);
     }
-    fw_cfg_add_i32(fw_cfg, FW_CFG_KERNEL_ENTRY, pvh_start_addr);
+    *pvh_entry = pvh_start_addr;
+    return true;
+}
+
+static bool load_elfboot(const char *kernel_filename,
+                         int kernel_file_size,
+                         uint8_t *header,
+                         size_t pvh_xen_start_addr,
+                         FWCfgState *fw_cfg)
+{
+    uint32_t pvh_entry;
+    uint32_t mh_load_addr = 0;
+    uint32_t elf_kernel_size = 0;
+    uint64_t elf_low, elf_high;
+
+    if (!x86_load_elf_pvh(kernel_filename, header, &pvh_entry,
+                          &elf_low, &elf_high)) {
+        return false; /* no elfboot */
+    }
+    mh_load_addr = elf_low;
+    elf_kernel_size = elf_high - elf_low;
+
+    fw_cfg_add_i32(fw_cfg, FW_CFG_KERNEL_ENTRY, pvh_entry);
     fw_cfg_add_i32(fw_cfg, FW_CFG_KERNEL_ADDR, mh_load_addr);
     fw_cfg_add_i32(fw_cfg, FW_CFG_KERNEL_SIZE, elf_kernel_size);
 
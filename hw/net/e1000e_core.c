@@ -52,6 +52,7 @@
 #define E1000E_MIN_XITR     (500) /* No more then 7813 interrupts per
                                      second according to spec 10.2.4.2 */
 #define E1000E_MAX_TX_FRAGS (64)
+#define E1000E_TX_DESC_BATCH (32) /* TX descriptors fetched per DMA read */
 
 static inline void
 e1000e_set_interrupt_cause(E1000ECore *core, uint32_t val);
@@ -767,9 +768,14 @@ e1000e_rx_wb_interrupt_cause(E1000ECore *core, int queue_idx,
     return (queue_idx == 0) ? E1000_ICR_RXQ0 : E1000_ICR_RXQ1;
 }
 
+/*
+ * Set DD in the local copy of the descriptor if the driver asked for it;
+ * the caller writes it back.  Returns 0 if the descriptor needs no
+ * writeback.
+ */
 static uint32_t
-e1000e_txdesc_writeback(E1000ECore *core, dma_addr_t base,
-                        struct e1000_tx_desc *dp, bool *ide, int queue_idx)
+e1000e_txdesc_writeback(E1000ECore *core, struct e1000_tx_desc *dp,
+                        bool *ide, int queue_idx)
 {
     uint32_t txd_upper, txd_lower = le32_to_cpu(dp->lower.data);
 
@@ -783,8 +789,6 @@ e1000e_txdesc_writeback(E1000ECore *core, dma_addr_t base,
     txd_upper = le32_to_cpu(dp->upper.data) | E1000_TXD_STAT_DD;
 
     dp->upper.data = cpu_to_le32(txd_upper);
-    pci_dma_write(core->owner, base + ((char *)&dp->upper - (char *)dp),
-                  &dp->upper, sizeof(dp->upper));
     return e1000e_tx_wb_interrupt_cause(core, queue_idx);
 }
 
@@ -829,6 +833,22 @@ e1000e_ring_advance(E1000ECore *core, const E1000E_RingInfo *r, uint32_t count)
     }
 }
 
+/* Number of descriptors from the head up to the tail or the end of the ring */
+static inline uint32_t
+e1000e_ring_contig_descr_num(E1000ECore *core, const E1000E_RingInfo *r)
+{
+    uint32_t size = core->mac[r->dlen] / E1000_RING_DESC_LEN;
+
+    if (core->mac[r->dh] < core->mac[r->dt]) {
+        return core->mac[r->dt] - core->mac[r->dh];
+    }
+    if (core->mac[r->dh] < size) {
+        return size - core->mac[r->dh];
+    }
+    /* The head is past the end; e1000e_ring_advance() will wrap it */
+    return 1;
+}
+
 static inline uint32_t
 e1000e_ring_free_descr_num(E1000ECore *core, const E1000E_RingInfo *r)
 {
@@ -902,11 +922,35 @@ e1000e_rx_ring_init(E1000ECore *core, E1000E_RxRing *rxr, int idx)
     rxr->i      = &i[idx];
 }
 
+/* Write back descriptors [first, last) of a batch read from @base */
+static void
+e1000e_txdesc_writeback_range(E1000ECore *core, dma_addr_t base,
+                              struct e1000_tx_desc *desc,
+                              uint32_t first, uint32_t last)
+{
+    size_t offset = offsetof(struct e1000_tx_desc, upper);
+
+    if (first == last) {
+        return;
+    }
+
+    /*
+     * Consecutive descriptors are written with a single DMA, starting at
+     * the status field of the first one.  The other fields hold what was
+     * read from the guest; the driver does not modify descriptors that
+     * it has handed to the device.
+     */
+    pci_dma_write(core->owner, base + first * sizeof(desc[0]) + offset,
+                  (uint8_t *)&desc[first] + offset,
+                  (last - first) * sizeof(desc[0]) - offset);
+}
+
 static void
 e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 {
     dma_addr_t base;
-    struct e1000_tx_desc desc;
+    struct e1000_tx_desc desc[E1000E_TX_DESC_BATCH];
+    uint32_t i, n, wb_first;
     bool ide = false;
     const E1000E_RingInfo *txi = txr->i;
     uint32_t cause = E1000_ICS_TXQE;
@@ -918,16 +962,29 @@ e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 
     while (!e1000e_ring_empty(core, txi)) {
         base = e1000e_ring_head_descr(core, txi);
+        n = MIN(e1000e_ring_contig_descr_num(core, txi), ARRAY_SIZE(desc));
 
-        pci_dma_read(core->owner, base, &desc, sizeof(desc));
+        pci_dma_read(core->owner, base, desc, n * sizeof(desc[0]));
 
-        trace_e1000e_tx_descr((void *)(intptr_t)desc.buffer_addr,
-                              desc.lower.data, desc.upper.data);
+        wb_first = 0;
+        for (i = 0; i < n; i++) {
+            uint32_t wb_cause;
 
-        e1000e_process_tx_desc(core, txr->tx, &desc, txi->idx);
-        cause |= e1000e_txdesc_writeback(core, base, &desc, &ide, txi->idx);
+            trace_e1000e_tx_descr((void *)(intptr_t)desc[i].buffer_addr,
+                                  desc[i].lower.data, desc[i].upper.data);
 
-        e1000e_ring_advance(core, txi, 1);
+            e1000e_process_tx_desc(core, txr->tx, &desc[i], txi->idx);
+            wb_cause = e1000e_txdesc_writeback(core, &desc[i], &ide,
+                                               txi->idx);
+            if (!wb_cause) {
+                e1000e_txdesc_writeback_range(core, base, desc, wb_first, i);
+                wb_first = i + 1;
+            }
+            cause |= wb_cause;
+
+            e1000e_ring_advance(core, txi, 1);
+        }
+        e1000e_txdesc_writeback_range(core, base, desc, wb_first, n);
     }
 
     if (!ide || !e1000e_intrmgr_delay_tx_causes(core, &cause)) {
@@ -145,6 +145,7 @@ typedef enum {
 *
 * @pkt:            packet
 * @type:           RSS hash type
+* @key:            RSS key, NET_TOEPLITZ_KEY_SIZE bytes
 *
 * Return:  Toeplitz RSS hash.
 *
@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/atomic.h"
+#include "block/aio-wait.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
@@ -350,14 +351,30 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+/*
+ * Data queues may be processed in an IOThread, which must inject the
+ * interrupt through the irqfd.
+ */
+static void virtio_net_notify(VirtIONet *n, VirtQueue *vq)
+{
+    if (n->iothreads_started) {
+        virtio_notify_irqfd(VIRTIO_DEVICE(n), vq);
+    } else {
+        virtio_notify(VIRTIO_DEVICE(n), vq);
+    }
+}
+
 static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(VIRTIO_NET(vdev), vq);
     }
 }
 
+static void virtio_net_iothreads_start(VirtIONet *n, uint8_t status);
+static void virtio_net_iothreads_stop(VirtIONet *n);
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -365,6 +382,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     int i;
     uint8_t queue_status;
 
+    virtio_net_iothreads_stop(n);
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
@@ -413,6 +431,8 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+
+    virtio_net_iothreads_start(n, status);
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -885,12 +905,35 @@ static void failover_add_primary(VirtIONet *n, Error **errp)
     error_propagate(errp, err);
 }
 
+
+/*
+ * Segment coalescing is done for the Windows RSC extension, or, when
+ * requested with the "gro" property, for any guest that accepts TSO and
+ * checksum offload; then the backend's header must be passed through to
+ * the guest unchanged.
+ */
+static void virtio_net_update_rsc(VirtIONet *n, uint64_t features)
+{
+    bool rsc_ext = virtio_has_feature(features, VIRTIO_NET_F_RSC_EXT);
+    bool gro = !rsc_ext && n->gro &&
+               virtio_has_feature(features, VIRTIO_NET_F_GUEST_CSUM) &&
+               n->host_hdr_len == n->guest_hdr_len;
+
+    n->rsc4_enabled = (rsc_ext || gro) &&
+        virtio_has_feature(features, VIRTIO_NET_F_GUEST_TSO4);
+    n->rsc6_enabled = (rsc_ext || gro) &&
+        virtio_has_feature(features, VIRTIO_NET_F_GUEST_TSO6);
+    n->gro_enabled = gro;
+}
+
 static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     Error *err = NULL;
     int i;
 
+    virtio_net_iothreads_stop(n);
+
     if (n->mtu_bypass_backend &&
             !virtio_has_feature(vdev->backend_features, VIRTIO_NET_F_MTU)) {
         features &= ~(1ULL << VIRTIO_NET_F_MTU);
@@ -908,10 +951,7 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
                                virtio_has_feature(features,
                                                   VIRTIO_NET_F_HASH_REPORT));
 
-    n->rsc4_enabled = virtio_has_feature(features, VIRTIO_NET_F_RSC_EXT) &&
-        virtio_has_feature(features, VIRTIO_NET_F_GUEST_TSO4);
-    n->rsc6_enabled = virtio_has_feature(features, VIRTIO_NET_F_RSC_EXT) &&
-        virtio_has_feature(features, VIRTIO_NET_F_GUEST_TSO6);
+    virtio_net_update_rsc(n, features);
     n->rss_data.redirect = virtio_has_feature(features, VIRTIO_NET_F_RSS);
 
     if (n->has_vnet_hdr) {
@@ -943,6 +983,8 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
             warn_report_err(err);
         }
     }
+
+    virtio_net_iothreads_start(n, vdev->status);
 }
 
 static int virtio_net_handle_rx_mode(VirtIONet *n, uint8_t cmd,
@@ -1003,10 +1045,7 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
             return VIRTIO_NET_ERR;
         }
 
-        n->rsc4_enabled = virtio_has_feature(offloads, VIRTIO_NET_F_RSC_EXT) &&
-            virtio_has_feature(offloads, VIRTIO_NET_F_GUEST_TSO4);
-        n->rsc6_enabled = virtio_has_feature(offloads, VIRTIO_NET_F_RSC_EXT) &&
-            virtio_has_feature(offloads, VIRTIO_NET_F_GUEST_TSO6);
+        virtio_net_update_rsc(n, offloads);
         virtio_clear_feature(&offloads, VIRTIO_NET_F_RSC_EXT);
 
         supported_offloads = virtio_net_supported_guest_offloads(n);
@@ -1435,6 +1474,9 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
     struct iovec *iov, *iov2;
     unsigned int iov_cnt;
 
+    /* Commands change state that the data queues use without locking */
+    virtio_net_iothreads_stop(n);
+
     for (;;) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
@@ -1476,6 +1518,8 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         g_free(iov2);
         g_free(elem);
     }
+
+    virtio_net_iothreads_start(n, vdev->status);
 }
 
 /* RX */
@@ -1759,6 +1803,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
         int index = virtio_net_process_rss(nc, buf, size);
         if (index >= 0) {
             NetClientState *nc2 = qemu_get_subqueue(n->nic, index);
+            virtio_net_get_subqueue(nc2)->rx_steered++;
             return virtio_net_receive_rcu(nc2, buf, size, true);
         }
     }
@@ -1852,7 +1897,8 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    virtio_net_notify(n, q->rx_vq);
+    q->rx_packets++;
 
     return size;
 }
@@ -1901,6 +1947,32 @@ static void virtio_net_rsc_extract_unit6(VirtioNetRscChain *chain,
     unit->payload = htons(*unit->ip_plen) - unit->tcp_hdrlen;
 }
 
+/*
+ * A coalesced GRO buffer keeps the backend's header, which marked every
+ * segment's checksum as valid, and tells the guest how to resegment it.
+ */
+static void virtio_net_gro_finish_seg(VirtioNetRscChain *chain,
+                                      VirtioNetRscSeg *seg)
+{
+    struct virtio_net_hdr *h = (struct virtio_net_hdr *)seg->buf;
+    VirtioNetRscUnit *unit = &seg->unit;
+
+    if (!seg->is_coalesced) {
+        return;
+    }
+
+    if (chain->proto == ETH_P_IP) {
+        eth_fix_ip4_checksum(unit->ip, sizeof(struct ip_header));
+    }
+
+    if (seg->gso_size && unit->payload > seg->gso_size) {
+        h->gso_type = chain->gso_type;
+        h->hdr_len = (uint8_t *)unit->tcp + unit->tcp_hdrlen -
+                     ((uint8_t *)seg->buf + chain->n->guest_hdr_len);
+        h->gso_size = seg->gso_size;
+    }
+}
+
 static size_t virtio_net_rsc_drain_seg(VirtioNetRscChain *chain,
                                        VirtioNetRscSeg *seg)
 {
@@ -1908,17 +1980,21 @@ static size_t virtio_net_rsc_drain_seg(VirtioNetRscChain *chain,
     struct virtio_net_hdr_v1 *h;
 
     h = (struct virtio_net_hdr_v1 *)seg->buf;
-    h->flags = 0;
-    h->gso_type = VIRTIO_NET_HDR_GSO_NONE;
-
-    if (seg->is_coalesced) {
-        h->rsc.segments = seg->packets;
-        h->rsc.dup_acks = seg->dup_ack;
-        h->flags = VIRTIO_NET_HDR_F_RSC_INFO;
-        if (chain->proto == ETH_P_IP) {
-            h->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
-        } else {
-            h->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+    if (chain->n->gro_enabled) {
+        virtio_net_gro_finish_seg(chain, seg);
+    } else {
+        h->flags = 0;
+        h->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+
+        if (seg->is_coalesced) {
+            h->rsc.segments = seg->packets;
+            h->rsc.dup_acks = seg->dup_ack;
+            h->flags = VIRTIO_NET_HDR_F_RSC_INFO;
+            if (chain->proto == ETH_P_IP) {
+                h->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+            } else {
+                h->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+            }
         }
     }
 
@@ -1962,6 +2038,7 @@ static void virtio_net_rsc_cleanup(VirtIONet *n)
         }
 
         timer_free(chain->drain_timer);
+        qemu_bh_delete(chain->drain_bh);
         QTAILQ_REMOVE(&n->rsc_chains, chain, next);
         g_free(chain);
     }
@@ -1998,6 +2075,28 @@ static void virtio_net_rsc_cache_buf(VirtioNetRscChain *chain,
     default:
         g_assert_not_reached();
     }
+    seg->gso_size = seg->unit.payload;
+}
+
+/*
+ * The guest must be able to split a GRO buffer back into the original
+ * segments: all of them carry the same TCP options, and only the last one
+ * may be shorter than the first.
+ */
+static bool virtio_net_gro_can_merge(VirtioNetRscSeg *seg,
+                                     VirtioNetRscUnit *n_unit)
+{
+    VirtioNetRscUnit *o_unit = &seg->unit;
+
+    if (n_unit->tcp_hdrlen < sizeof(struct tcp_header) ||
+        n_unit->tcp_hdrlen != o_unit->tcp_hdrlen ||
+        memcmp(o_unit->tcp + 1, n_unit->tcp + 1,
+               n_unit->tcp_hdrlen - sizeof(struct tcp_header))) {
+        return false;
+    }
+
+    return !seg->gso_size || (n_unit->payload <= seg->gso_size &&
+                              o_unit->payload % seg->gso_size == 0);
 }
 
 static int32_t virtio_net_rsc_handle_ack(VirtioNetRscChain *chain,
@@ -2023,6 +2122,10 @@ static int32_t virtio_net_rsc_handle_ack(VirtioNetRscChain *chain,
             /* duplicated ack, add dup ack count due to whql test up to 1 */
             chain->stat.dup_ack++;
             return RSC_FINAL;
+        } else if (chain->n->gro_enabled) {
+            /* A rewritten window would leave the TCP checksum stale */
+            chain->stat.pure_ack++;
+            return RSC_FINAL;
         } else {
             /* Coalesce window update */
             o_tcp->th_win = n_tcp->th_win;
@@ -2078,6 +2181,16 @@ coalesce:
             return RSC_FINAL;
         }
 
+        if (chain->n->gro_enabled) {
+            if (!virtio_net_gro_can_merge(seg, n_unit)) {
+                chain->stat.tcp_option++;
+                return RSC_FINAL;
+            }
+            if (!seg->gso_size) {
+                seg->gso_size = n_unit->payload;
+            }
+        }
+
         /* Here comes the right data, the payload length in v4/v6 is different,
            so use the field value to update and record the new data len */
         o_unit->payload += n_unit->payload; /* update new data len */
@@ -2161,7 +2274,8 @@ static int virtio_net_rsc_tcp_ctrl_check(VirtioNetRscChain *chain,
         return RSC_FINAL;
     }
 
-    if (tcp_hdr > sizeof(struct tcp_header)) {
+    /* GRO compares the options when merging instead */
+    if (tcp_hdr > sizeof(struct tcp_header) && !chain->n->gro_enabled) {
         chain->stat.tcp_all_opt++;
         return RSC_FINAL;
     }
@@ -2169,6 +2283,17 @@ static int virtio_net_rsc_tcp_ctrl_check(VirtioNetRscChain *chain,
     return RSC_CANDIDATE;
 }
 
+static void virtio_net_rsc_schedule_drain(VirtioNetRscChain *chain)
+{
+    if (chain->n->gro_enabled) {
+        /* Flush once the backend has delivered everything it had ready */
+        qemu_bh_schedule(chain->drain_bh);
+    } else {
+        timer_mod(chain->drain_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_HOST) + chain->n->rsc_timeout);
+    }
+}
+
 static size_t virtio_net_rsc_do_coalesce(VirtioNetRscChain *chain,
                                          NetClientState *nc,
                                          const uint8_t *buf, size_t size,
@@ -2180,8 +2305,7 @@ static size_t virtio_net_rsc_do_coalesce(VirtioNetRscChain *chain,
     if (QTAILQ_EMPTY(&chain->buffers)) {
         chain->stat.empty_cache++;
         virtio_net_rsc_cache_buf(chain, nc, buf, size);
-        timer_mod(chain->drain_timer,
-              qemu_clock_get_ns(QEMU_CLOCK_HOST) + chain->n->rsc_timeout);
+        virtio_net_rsc_schedule_drain(chain);
         return size;
     }
 
@@ -2421,6 +2545,7 @@ static VirtioNetRscChain *virtio_net_rsc_lookup_chain(VirtIONet *n,
     }
     chain->drain_timer = timer_new_ns(QEMU_CLOCK_HOST,
                                       virtio_net_rsc_purge, chain);
+    chain->drain_bh = qemu_bh_new(virtio_net_rsc_purge, chain);
     memset(&chain->stat, 0, sizeof(chain->stat));
 
     QTAILQ_INIT(&chain->buffers);
@@ -2429,6 +2554,18 @@ static VirtioNetRscChain *virtio_net_rsc_lookup_chain(VirtIONet *n,
     return chain;
 }
 
+/*
+ * Only segments whose checksum the backend already verified can be
+ * merged, because the guest is told not to check the result.
+ */
+static bool virtio_net_gro_candidate(const uint8_t *buf)
+{
+    const struct virtio_net_hdr *h = (const struct virtio_net_hdr *)buf;
+
+    return h->gso_type == VIRTIO_NET_HDR_GSO_NONE &&
+           h->flags == VIRTIO_NET_HDR_F_DATA_VALID;
+}
+
 static ssize_t virtio_net_rsc_receive(NetClientState *nc,
                                       const uint8_t *buf,
                                       size_t size)
@@ -2447,6 +2584,12 @@ static ssize_t virtio_net_rsc_receive(NetClientState *nc,
     proto = htons(eth->h_proto);
 
     chain = virtio_net_rsc_lookup_chain(n, nc, proto);
+    if (chain && n->gro_enabled && !virtio_net_gro_candidate(buf)) {
+        /* Keep ordering with segments of the same flow already cached */
+        chain->stat.gro_bypass++;
+        virtio_net_rsc_purge(chain);
+        return virtio_net_do_receive(nc, buf, size);
+    }
     if (chain) {
         chain->stat.received++;
         if (proto == (uint16_t)ETH_P_IP && n->rsc4_enabled) {
@@ -2475,10 +2618,10 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(n, q->tx_vq);
+    q->tx_packets++;
 
     g_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
@@ -2488,11 +2631,36 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+
+/* Number of sent packets returned to the guest with a single notification */
+#define VIRTIO_NET_TX_PUSH_BATCH 64
+
+static void virtio_net_tx_push_batch(VirtIONetQueue *q,
+                                     VirtQueueElement **elems,
+                                     unsigned int *num)
+{
+    static const unsigned int lens[VIRTIO_NET_TX_PUSH_BATCH];
+    unsigned int i;
+
+    if (!*num) {
+        return;
+    }
+
+    virtqueue_push_batch(q->tx_vq, elems, lens, *num);
+    virtio_net_notify(q->n, q->tx_vq);
+    for (i = 0; i < *num; i++) {
+        g_free(elems[i]);
+    }
+    *num = 0;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *done[VIRTIO_NET_TX_PUSH_BATCH];
+    unsigned int num_done = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -2521,6 +2689,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             virtio_error(vdev, "virtio-net header not in first element");
             virtqueue_detach_element(q->tx_vq, elem, 0);
             g_free(elem);
+            virtio_net_tx_push_batch(q, done, &num_done);
             return -EINVAL;
         }
 
@@ -2530,6 +2699,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 virtio_error(vdev, "virtio-net header incorrect");
                 virtqueue_detach_element(q->tx_vq, elem, 0);
                 g_free(elem);
+                virtio_net_tx_push_batch(q, done, &num_done);
                 return -EINVAL;
             }
             if (n->needs_vnet_hdr_swap) {
@@ -2568,18 +2738,22 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
+            virtio_net_tx_push_batch(q, done, &num_done);
             return -EBUSY;
         }
+        q->tx_packets++;
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        done[num_done++] = elem;
+        if (num_done == ARRAY_SIZE(done)) {
+            virtio_net_tx_push_batch(q, done, &num_done);
+        }
 
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+    virtio_net_tx_push_batch(q, done, &num_done);
     return num_packets;
 }
 
@@ -2708,6 +2882,241 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+/* Context: IOThread of the queue pair */
+static bool virtio_net_handle_rx_aio(VirtIODevice *vdev, VirtQueue *vq)
+{
+    virtio_net_handle_rx(vdev, vq);
+    return false;
+}
+
+/* Context: IOThread of the queue pair */
+static bool virtio_net_handle_tx_aio(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+    bool waiting = q->tx_waiting;
+
+    virtio_net_handle_tx_bh(vdev, vq);
+    return !waiting && q->tx_waiting;
+}
+
+/*
+ * The data path of a queue pair only runs in its IOThread if nothing else
+ * touches the queue pair from the main loop: RSC uses main loop timers,
+ * software RSS steers packets across queue pairs, and the backend must be
+ * able to move its fd handlers.
+ */
+static const char *virtio_net_iothreads_unusable(VirtIONet *n, int queues)
+{
+    int i;
+
+    if (n->rsc4_enabled || n->rsc6_enabled) {
+        return "receive segment coalescing is enabled";
+    }
+    if (n->rss_data.enabled && n->rss_data.enabled_software_rss) {
+        return "RSS is done in software";
+    }
+    for (i = 0; i < queues; i++) {
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        if (!peer || !peer->info->set_aio_context) {
+            return "backend cannot be moved to an IOThread";
+        }
+        if (!QTAILQ_EMPTY(&peer->filters)) {
+            return "backend has filters";
+        }
+    }
+    return NULL;
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_iothreads_start(VirtIONet *n, uint8_t status)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    const char *reason;
+    int i, r;
+
+    if (!n->num_iothreads || n->iothreads_started || n->vhost_started ||
+        !virtio_net_started(n, status)) {
+        return;
+    }
+
+    reason = virtio_net_iothreads_unusable(n, queues);
+    if (reason) {
+        trace_virtio_net_iothreads_unusable(n, reason);
+        return;
+    }
+
+    r = virtio_device_grab_ioeventfd(vdev);
+    if (r < 0) {
+        trace_virtio_net_iothreads_unusable(n, "ioeventfd not available");
+        return;
+    }
+
+    r = k->set_guest_notifiers(qbus->parent, queues * 2, true);
+    if (r < 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "falling back on the main loop", r);
+        goto fail_guest_notifiers;
+    }
+
+    /*
+     * Batch all the host notifiers in a single transaction to avoid
+     * quadratic time complexity in address_space_update_ioeventfds().
+     */
+    memory_region_transaction_begin();
+    for (i = 0; i < queues * 2; i++) {
+        r = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, true);
+        if (r < 0) {
+            int j = i;
+
+            error_report("virtio-net failed to set host notifier (%d), "
+                         "falling back on the main loop", r);
+            while (i--) {
+                virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+            }
+            memory_region_transaction_commit();
+            while (j--) {
+                virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), j);
+            }
+            goto fail_host_notifiers;
+        }
+    }
+    memory_region_transaction_commit();
+
+    /* Nothing schedules the BHs until the handlers are installed below */
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = aio_bh_new(q->ctx, virtio_net_tx_bh, q);
+    }
+
+    n->iothreads_started = true;
+    trace_virtio_net_iothreads_start(n, queues);
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+        bool moved;
+
+        aio_context_acquire(q->ctx);
+        moved = qemu_net_client_set_aio_context(peer, q->ctx);
+        if (moved) {
+            virtio_queue_aio_set_host_notifier_handler(q->rx_vq, q->ctx,
+                    virtio_net_handle_rx_aio);
+            virtio_queue_aio_set_host_notifier_handler(q->tx_vq, q->ctx,
+                    virtio_net_handle_tx_aio);
+        }
+        aio_context_release(q->ctx);
+
+        if (!moved) {
+            trace_virtio_net_iothreads_unusable(n,
+                    "backend cannot be moved to an IOThread");
+            virtio_net_iothreads_stop(n);
+            return;
+        }
+    }
+
+    /* Kick right away to process what is already in the rings */
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (q->tx_waiting) {
+            qemu_bh_schedule(q->tx_bh);
+        }
+        event_notifier_set(virtio_queue_get_host_notifier(q->rx_vq));
+        event_notifier_set(virtio_queue_get_host_notifier(q->tx_vq));
+    }
+    return;
+
+  fail_host_notifiers:
+    k->set_guest_notifiers(qbus->parent, queues * 2, false);
+  fail_guest_notifiers:
+    virtio_device_release_ioeventfd(vdev);
+}
+
+/*
+ * Detach the queue pairs of the current IOThread from the guest and move
+ * their backends back to the main loop.
+ *
+ * Context: BH in IOThread
+ */
+static void virtio_net_iothreads_stop_bh(void *opaque)
+{
+    VirtIONet *n = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int i;
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        if (q->ctx != ctx) {
+            continue;
+        }
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, ctx, NULL);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, ctx, NULL);
+        qemu_bh_cancel(q->tx_bh);
+        if (peer && peer->aio_context) {
+            qemu_net_client_set_aio_context(peer, NULL);
+        }
+    }
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_iothreads_stop(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    unsigned t;
+    int i;
+
+    if (!n->iothreads_started) {
+        return;
+    }
+    trace_virtio_net_iothreads_stop(n);
+
+    for (t = 0; t < n->num_iothreads; t++) {
+        AioContext *ctx = iothread_get_aio_context(n->iothreads[t]);
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_net_iothreads_stop_bh, n);
+        aio_context_release(ctx);
+    }
+    n->iothreads_started = false;
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = qemu_bh_new(virtio_net_tx_bh, q);
+        if (q->tx_waiting) {
+            qemu_bh_schedule(q->tx_bh);
+        }
+    }
+
+    memory_region_transaction_begin();
+    for (i = 0; i < queues * 2; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+    }
+    memory_region_transaction_commit();
+    for (i = 0; i < queues * 2; i++) {
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+
+    k->set_guest_notifiers(qbus->parent, queues * 2, false);
+
+    /* Requests that were kicked meanwhile are picked up by the main loop */
+    virtio_device_release_ioeventfd(vdev);
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -3296,6 +3705,37 @@ static bool failover_hide_primary_device(DeviceListener *listener,
     return qatomic_read(&n->failover_primary_hidden);
 }
 
+static const char *const virtio_net_queue_stats[] = {
+    "x-rxq%d-packets", "x-rxq%d-steered", "x-txq%d-packets",
+};
+
+static void virtio_net_add_queue_stats(VirtIONet *n, int index)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+    uint64_t *counters[] = { &q->rx_packets, &q->rx_steered, &q->tx_packets };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(virtio_net_queue_stats); i++) {
+        g_autofree char *name = g_strdup_printf(virtio_net_queue_stats[i],
+                                                index);
+
+        object_property_add_uint64_ptr(OBJECT(n), name, counters[i],
+                                       OBJ_PROP_FLAG_READ);
+    }
+}
+
+static void virtio_net_del_queue_stats(VirtIONet *n, int index)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(virtio_net_queue_stats); i++) {
+        g_autofree char *name = g_strdup_printf(virtio_net_queue_stats[i],
+                                                index);
+
+        object_property_del(OBJECT(n), name);
+    }
+}
+
 static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -3380,6 +3820,38 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     n->curr_queues = 1;
     n->tx_timeout = n->net_conf.txtimer;
 
+    if (n->net_conf.iothread_vq_mapping) {
+        BusState *qbus = qdev_get_parent_bus(dev);
+        VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+
+        if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+            error_setg(errp, "iothread-vq-mapping requires tx=bh");
+            goto fail_iothreads;
+        }
+        if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+            error_setg(errp,
+                       "device is incompatible with iothread "
+                       "(transport does not support notifiers)");
+            goto fail_iothreads;
+        }
+        if (!virtio_device_ioeventfd_enabled(vdev)) {
+            error_setg(errp, "ioeventfd is required for iothread");
+            goto fail_iothreads;
+        }
+        n->iothreads = iothread_parse_vq_mapping(
+                n->net_conf.iothread_vq_mapping, &n->num_iothreads, errp);
+        if (!n->iothreads) {
+            goto fail_iothreads;
+        }
+        for (i = 0; i < n->num_iothreads; i++) {
+            object_ref(OBJECT(n->iothreads[i]));
+        }
+        for (i = 0; i < n->max_queues; i++) {
+            n->vqs[i].ctx = iothread_get_aio_context(
+                    n->iothreads[i % n->num_iothreads]);
+        }
+    }
+
     if (n->net_conf.tx && strcmp(n->net_conf.tx, "timer")
                        && strcmp(n->net_conf.tx, "bh")) {
         warn_report("virtio-net: "
@@ -3393,6 +3865,7 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 
     for (i = 0; i < n->max_queues; i++) {
         virtio_net_add_queue(n, i);
+        virtio_net_add_queue_stats(n, i);
     }
 
     n->ctrl_vq = virtio_add_queue(vdev, 64, virtio_net_handle_ctrl);
@@ -3457,6 +3930,12 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS)) {
         virtio_net_load_ebpf(n);
     }
+    return;
+
+fail_iothreads:
+    g_free(n->vqs);
+    n->vqs = NULL;
+    virtio_cleanup(vdev);
 }
 
 static void virtio_net_device_unrealize(DeviceState *dev)
@@ -3492,7 +3971,16 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     /* delete also control vq */
     virtio_del_queue(vdev, max_queues * 2);
     qemu_announce_timer_del(&n->announce_timer, false);
+    for (i = 0; i < n->max_queues; i++) {
+        virtio_net_del_queue_stats(n, i);
+    }
     g_free(n->vqs);
+    for (i = 0; i < n->num_iothreads; i++) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
+    n->num_iothreads = 0;
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
@@ -3559,6 +4047,11 @@ static const VMStateDescription vmstate_virtio_net = {
     },
     .pre_save = virtio_net_pre_save,
     .dev_unplug_pending = dev_unplug_pending,
+    /*
+     * With the VM stopped the backend is stopped too (see pre_save), and
+     * saving only reads the state of this device and its transport.
+     */
+    .parallel_save = true,
 };
 
 static Property virtio_net_properties[] = {
@@ -3610,11 +4103,14 @@ static Property virtio_net_properties[] = {
                     VIRTIO_NET_F_RSC_EXT, false),
     DEFINE_PROP_UINT32("rsc_interval", VirtIONet, rsc_timeout,
                        VIRTIO_NET_RSC_DEFAULT_INTERVAL),
+    DEFINE_PROP_BOOL("gro", VirtIONet, gro, false),
     DEFINE_NIC_PROPERTIES(VirtIONet, nic_conf),
     DEFINE_PROP_UINT32("x-txtimer", VirtIONet, net_conf.txtimer,
                        TX_TIMER_INTERVAL),
     DEFINE_PROP_INT32("x-txburst", VirtIONet, net_conf.txburst, TX_BURST),
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
+    DEFINE_PROP_STRING("iothread-vq-mapping", VirtIONet,
+                       net_conf.iothread_vq_mapping),
     DEFINE_PROP_UINT16("rx_queue_size", VirtIONet, net_conf.rx_queue_size,
                        VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE),
     DEFINE_PROP_UINT16("tx_queue_size", VirtIONet, net_conf.tx_queue_size,
@@ -78,6 +78,9 @@
 /* Number of interrupt vectors for non-MSIx modes */
 #define VMXNET3_MAX_NMSIX_INTRS   (1)
 
+/* TX descriptors fetched from the guest at once */
+#define VMXNET3_TX_DESC_BATCH     (32)
+
 /* Macros for rings descriptors access */
 #define VMXNET3_READ_TX_QUEUE_DESCR8(_d, dpa, field) \
     (vmw_shmem_ld8(_d, dpa + offsetof(struct Vmxnet3_TxQueueDesc, field)))
@@ -576,37 +579,53 @@ vmxnet3_on_rx_done_update_stats(VMXNET3State *s,
 }
 
 static inline void
-vmxnet3_ring_read_curr_txdesc(PCIDevice *pcidev, Vmxnet3Ring *ring,
-                              struct Vmxnet3_TxDesc *txd)
+vmxnet3_ring_read_curr_txdescs(PCIDevice *pcidev, Vmxnet3Ring *ring,
+                               struct Vmxnet3_TxDesc *txd, uint32_t num)
 {
-    vmxnet3_ring_read_curr_cell(pcidev, ring, txd);
-    txd->addr = le64_to_cpu(txd->addr);
-    txd->val1 = le32_to_cpu(txd->val1);
-    txd->val2 = le32_to_cpu(txd->val2);
+    uint32_t i;
+
+    vmw_shmem_read(pcidev, vmxnet3_ring_curr_cell_pa(ring), txd,
+                   num * sizeof(*txd));
+    for (i = 0; i < num; i++) {
+        txd[i].addr = le64_to_cpu(txd[i].addr);
+        txd[i].val1 = le32_to_cpu(txd[i].val1);
+        txd[i].val2 = le32_to_cpu(txd[i].val2);
+    }
 }
 
-static inline bool
-vmxnet3_pop_next_tx_descr(VMXNET3State *s,
-                          int qidx,
-                          struct Vmxnet3_TxDesc *txd,
-                          uint32_t *descr_idx)
+/*
+ * Read up to @max descriptors that the driver handed to the device,
+ * starting at the current position of the TX ring, and return how many
+ * there are.  The ring position is left unchanged.
+ */
+static uint32_t
+vmxnet3_peek_tx_descrs(VMXNET3State *s, int qidx,
+                       struct Vmxnet3_TxDesc *txd, uint32_t max)
 {
     Vmxnet3Ring *ring = &s->txq_descr[qidx].tx_ring;
     PCIDevice *d = PCI_DEVICE(s);
+    uint32_t i, num;
+
+    /* The generation changes when the ring wraps, so stop at its end */
+    num = MIN(max, ring->size - vmxnet3_ring_curr_cell_idx(ring));
+    if (!num) {
+        return 0;
+    }
 
-    vmxnet3_ring_read_curr_txdesc(d, ring, txd);
-    if (txd->gen == vmxnet3_ring_curr_gen(ring)) {
+    vmxnet3_ring_read_curr_txdescs(d, ring, txd, num);
+    for (i = 0; i < num; i++) {
+        if (txd[i].gen != vmxnet3_ring_curr_gen(ring)) {
+            break;
+        }
+    }
+
+    if (i) {
         /* Only read after generation field verification */
         smp_rmb();
         /* Re-read to be sure we got the latest version */
-        vmxnet3_ring_read_curr_txdesc(d, ring, txd);
-        VMXNET3_RING_DUMP(VMW_RIPRN, "TX", qidx, ring);
-        *descr_idx = vmxnet3_ring_curr_cell_idx(ring);
-        vmxnet3_inc_tx_consumption_counter(s, qidx);
-        return true;
+        vmxnet3_ring_read_curr_txdescs(d, ring, txd, i);
     }
-
-    return false;
+    return i;
 }
 
 static bool
@@ -633,52 +652,63 @@ func_exit:
     return (status == VMXNET3_PKT_STATUS_OK);
 }
 
-static void vmxnet3_process_tx_queue(VMXNET3State *s, int qidx)
+static void vmxnet3_process_tx_descr(VMXNET3State *s, int qidx,
+                                     struct Vmxnet3_TxDesc *txd,
+                                     uint32_t txd_idx)
 {
-    struct Vmxnet3_TxDesc txd;
-    uint32_t txd_idx;
     uint32_t data_len;
     hwaddr data_pa;
 
-    for (;;) {
-        if (!vmxnet3_pop_next_tx_descr(s, qidx, &txd, &txd_idx)) {
-            break;
-        }
+    vmxnet3_dump_tx_descr(txd);
 
-        vmxnet3_dump_tx_descr(&txd);
+    if (!s->skip_current_tx_pkt) {
+        data_len = (txd->len > 0) ? txd->len : VMXNET3_MAX_TX_BUF_SIZE;
+        data_pa = txd->addr;
 
-        if (!s->skip_current_tx_pkt) {
-            data_len = (txd.len > 0) ? txd.len : VMXNET3_MAX_TX_BUF_SIZE;
-            data_pa = txd.addr;
+        if (!net_tx_pkt_add_raw_fragment(s->tx_pkt,
+                                            data_pa,
+                                            data_len)) {
+            s->skip_current_tx_pkt = true;
+        }
+    }
 
-            if (!net_tx_pkt_add_raw_fragment(s->tx_pkt,
-                                                data_pa,
-                                                data_len)) {
-                s->skip_current_tx_pkt = true;
+    if (s->tx_sop) {
+        vmxnet3_tx_retrieve_metadata(s, txd);
+        s->tx_sop = false;
+    }
+
+    if (txd->eop) {
+        if (!s->skip_current_tx_pkt && net_tx_pkt_parse(s->tx_pkt)) {
+            if (s->needs_vlan) {
+                net_tx_pkt_setup_vlan_header(s->tx_pkt, s->tci);
             }
-        }
 
-        if (s->tx_sop) {
-            vmxnet3_tx_retrieve_metadata(s, &txd);
-            s->tx_sop = false;
+            vmxnet3_send_packet(s, qidx);
+        } else {
+            vmxnet3_on_tx_done_update_stats(s, qidx,
+                                            VMXNET3_PKT_STATUS_ERROR);
         }
 
-        if (txd.eop) {
-            if (!s->skip_current_tx_pkt && net_tx_pkt_parse(s->tx_pkt)) {
-                if (s->needs_vlan) {
-                    net_tx_pkt_setup_vlan_header(s->tx_pkt, s->tci);
-                }
+        vmxnet3_complete_packet(s, qidx, txd_idx);
+        s->tx_sop = true;
+        s->skip_current_tx_pkt = false;
+        net_tx_pkt_reset(s->tx_pkt);
+    }
+}
 
-                vmxnet3_send_packet(s, qidx);
-            } else {
-                vmxnet3_on_tx_done_update_stats(s, qidx,
-                                                VMXNET3_PKT_STATUS_ERROR);
-            }
+static void vmxnet3_process_tx_queue(VMXNET3State *s, int qidx)
+{
+    Vmxnet3Ring *ring = &s->txq_descr[qidx].tx_ring;
+    struct Vmxnet3_TxDesc txd[VMXNET3_TX_DESC_BATCH];
+    uint32_t i, num, txd_idx;
+
+    while ((num = vmxnet3_peek_tx_descrs(s, qidx, txd, ARRAY_SIZE(txd)))) {
+        for (i = 0; i < num; i++) {
+            VMXNET3_RING_DUMP(VMW_RIPRN, "TX", qidx, ring);
+            txd_idx = vmxnet3_ring_curr_cell_idx(ring);
+            vmxnet3_inc_tx_consumption_counter(s, qidx);
 
-            vmxnet3_complete_packet(s, qidx, txd_idx);
-            s->tx_sop = true;
-            s->skip_current_tx_pkt = false;
-            net_tx_pkt_reset(s->tx_pkt);
+            vmxnet3_process_tx_descr(s, qidx, &txd[i], txd_idx);
         }
     }
 }
@@ -35,6 +35,8 @@
  *              mdts=<N[optional]>,vsl=<N[optional]>, \
  *              zoned.zasl=<N[optional]>, \
  *              zoned.auto_transition=<on|off[optional]>, \
+ *              ioeventfd=<on|off[optional]>, \
+ *              intc-adaptive=<on|off[optional]>, \
  *              subsys=<subsys_id>
  *      -device nvme-ns,drive=<drive_id>,bus=<bus_name>,nsid=<nsid>,\
  *              zoned=<true|false[optional]>, \
@@ -106,6 +108,16 @@
  *   transitioned to zone state closed for resource management purposes.
  *   Defaults to 'on'.
  *
+ * - `ioeventfd`
+ *   Handle I/O queue doorbell writes through an ioeventfd instead of an MMIO
+ *   exit, once the host has set up shadow doorbells with the Doorbell Buffer
+ *   Config command. Defaults to 'off'.
+ *
+ * - `intc-adaptive`
+ *   While the host has not set an aggregation time with the Interrupt
+ *   Coalescing feature, hold back I/O completion interrupts for up to 100us
+ *   as long as more commands are in flight on the queue. Defaults to 'off'.
+ *
  * nvme namespace device parameters
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * - `shared`
@@ -147,12 +159,18 @@
  *
  *     zoned.cross_read=<enable RAZB, default: false>
  *         Setting this property to true enables Read Across Zone Boundaries.
+ *
+ *     zoned.pstate=<drive id>
+ *         Persist the zone state (and zone descriptor extensions) on the
+ *         given drive, which must be at least 4KiB plus 64B and the extension
+ *         size per zone in size. A blank drive is initialized on first use.
  */
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
 #include "qemu/units.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
@@ -203,6 +221,8 @@ static const uint32_t nvme_feature_cap[NVME_FID_MAX] = {
     [NVME_ERROR_RECOVERY]           = NVME_FEAT_CAP_CHANGE | NVME_FEAT_CAP_NS,
     [NVME_VOLATILE_WRITE_CACHE]     = NVME_FEAT_CAP_CHANGE,
     [NVME_NUMBER_OF_QUEUES]         = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_COALESCING]     = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_VECTOR_CONF]    = NVME_FEAT_CAP_CHANGE,
     [NVME_ASYNCHRONOUS_EVENT_CONF]  = NVME_FEAT_CAP_CHANGE,
     [NVME_TIMESTAMP]                = NVME_FEAT_CAP_CHANGE,
     [NVME_COMMAND_SET_PROFILE]      = NVME_FEAT_CAP_CHANGE,
@@ -220,6 +240,7 @@ static const uint32_t nvme_cse_acs[256] = {
     [NVME_ADM_CMD_GET_FEATURES]     = NVME_CMD_EFF_CSUPP,
     [NVME_ADM_CMD_ASYNC_EV_REQ]     = NVME_CMD_EFF_CSUPP,
     [NVME_ADM_CMD_NS_ATTACHMENT]    = NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_NIC,
+    [NVME_ADM_CMD_DBBUF_CONFIG]     = NVME_CMD_EFF_CSUPP,
     [NVME_ADM_CMD_FORMAT_NVM]       = NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_LBCC,
 };
 
@@ -468,6 +489,75 @@ static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+/* Aggregation Time of the Interrupt Coalescing feature is in 100us units */
+#define NVME_INTC_TIME_UNIT_NS  (100 * SCALE_US)
+
+/* Completions aggregated per interrupt by the adaptive mode */
+#define NVME_INTC_ADAPTIVE_THR  16
+
+static bool nvme_cq_busy(NvmeCQueue *cq)
+{
+    NvmeSQueue *sq;
+
+    QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+        if (!QTAILQ_EMPTY(&sq->out_req_list)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Signal @posted new completion queue entries, aggregating interrupts as
+ * configured with the Interrupt Coalescing feature.  In adaptive mode,
+ * which only applies while the host has not configured an aggregation
+ * time, the interrupt is held back for up to one aggregation time unit
+ * as long as more completions are expected.
+ */
+static void nvme_cq_irq(NvmeCtrl *n, NvmeCQueue *cq, uint32_t posted)
+{
+    uint32_t intc = n->features.int_coalescing;
+    uint32_t thr = NVME_INTC_THR(intc) + 1;
+    int64_t delay = NVME_INTC_TIME(intc) * NVME_INTC_TIME_UNIT_NS;
+
+    if (!delay && n->params.intc_adaptive) {
+        thr = nvme_cq_busy(cq) ? NVME_INTC_ADAPTIVE_THR : 1;
+        delay = NVME_INTC_TIME_UNIT_NS;
+    }
+
+    /* The admin completion queue is never coalesced */
+    if (!delay || !cq->cqid || !cq->irq_enabled ||
+        test_bit(cq->vector, n->features.int_vc_cd)) {
+        nvme_irq_assert(n, cq);
+        return;
+    }
+
+    if (!posted) {
+        return;
+    }
+
+    cq->coalesced += posted;
+    if (cq->coalesced >= thr) {
+        timer_del(cq->irq_timer);
+        cq->coalesced = 0;
+        nvme_irq_assert(n, cq);
+    } else if (!timer_pending(cq->irq_timer)) {
+        timer_mod(cq->irq_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + delay);
+    }
+}
+
+static void nvme_cq_irq_timer(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    cq->coalesced = 0;
+    if (cq->tail != cq->head) {
+        nvme_irq_assert(cq->ctrl, cq);
+    }
+}
+
 static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
 {
     if (cq->irq_enabled) {
@@ -570,6 +660,47 @@ static void nvme_sg_split(NvmeSg *sg, NvmeNamespace *ns, NvmeSg *data,
     }
 }
 
+/*
+ * PRPs and SGLs usually describe physically contiguous memory as a series of
+ * page sized chunks; merging them keeps the number of mappings (and of
+ * dma_memory_map() calls when the transfer is done) down to the number of
+ * discontiguous ranges.
+ */
+static void nvme_iovec_add(QEMUIOVector *iov, void *base, size_t len)
+{
+    if (iov->niov) {
+        struct iovec *last = &iov->iov[iov->niov - 1];
+
+        if (last->iov_base + last->iov_len == base) {
+            last->iov_len += len;
+            iov->size += len;
+            return;
+        }
+    }
+
+    qemu_iovec_add(iov, base, len);
+}
+
+static bool nvme_sglist_extend(QEMUSGList *qsg, dma_addr_t base,
+                               dma_addr_t len)
+{
+    ScatterGatherEntry *last;
+
+    if (!qsg->nsg) {
+        return false;
+    }
+
+    last = &qsg->sg[qsg->nsg - 1];
+    if (last->base + last->len != base) {
+        return false;
+    }
+
+    last->len += len;
+    qsg->size += len;
+
+    return true;
+}
+
 static uint16_t nvme_map_addr_cmb(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
                                   size_t len)
 {
@@ -583,7 +714,7 @@ static uint16_t nvme_map_addr_cmb(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
         return NVME_DATA_TRAS_ERROR;
     }
 
-    qemu_iovec_add(iov, nvme_addr_to_cmb(n, addr), len);
+    nvme_iovec_add(iov, nvme_addr_to_cmb(n, addr), len);
 
     return NVME_SUCCESS;
 }
@@ -599,7 +730,7 @@ static uint16_t nvme_map_addr_pmr(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
         return NVME_DATA_TRAS_ERROR;
     }
 
-    qemu_iovec_add(iov, nvme_addr_to_pmr(n, addr), len);
+    nvme_iovec_add(iov, nvme_addr_to_pmr(n, addr), len);
 
     return NVME_SUCCESS;
 }
@@ -640,6 +771,10 @@ static uint16_t nvme_map_addr(NvmeCtrl *n, NvmeSg *sg, hwaddr addr, size_t len)
         return NVME_INVALID_USE_OF_CMB | NVME_DNR;
     }
 
+    if (nvme_sglist_extend(&sg->qsg, addr, len)) {
+        return NVME_SUCCESS;
+    }
+
     if (sg->qsg.nsg + 1 > IOV_MAX) {
         goto max_mappings_exceeded;
     }
@@ -1265,18 +1400,83 @@ static inline void nvme_blk_write(BlockBackend *blk, int64_t offset,
     }
 }
 
+/*
+ * Shadow doorbells (Doorbell Buffer Config) are only used for I/O queues;
+ * the values are ignored if they are out of range for the queue.
+ */
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    uint32_t v;
+
+    pci_dma_read(&cq->ctrl->parent_obj, cq->db_addr, &v, sizeof(v));
+    v = le32_to_cpu(v);
+    if (v < cq->size) {
+        cq->head = v;
+    }
+}
+
+static void nvme_update_cq_eventidx(const NvmeCQueue *cq)
+{
+    uint32_t v = cpu_to_le32(cq->head);
+
+    pci_dma_write(&cq->ctrl->parent_obj, cq->ei_addr, &v, sizeof(v));
+}
+
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    uint32_t v;
+
+    pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &v, sizeof(v));
+    v = le32_to_cpu(v);
+    if (v < sq->size) {
+        sq->tail = v;
+    }
+}
+
+static void nvme_update_sq_eventidx(const NvmeSQueue *sq)
+{
+    uint32_t v = cpu_to_le32(sq->tail);
+
+    pci_dma_write(&sq->ctrl->parent_obj, sq->ei_addr, &v, sizeof(v));
+}
+
+/*
+ * With shadow doorbells the host only rings the doorbell when the tail
+ * passes the EventIdx.  A submission queue that stopped because all of its
+ * requests were in flight may have had entries added since without a
+ * doorbell write, so look at the shadow tails whenever requests are
+ * returned to the submission queues.
+ */
+static void nvme_poll_sqs(NvmeCQueue *cq)
+{
+    NvmeSQueue *sq;
+
+    QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+        nvme_update_sq_tail(sq);
+        if (!nvme_sq_empty(sq)) {
+            timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        }
+    }
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
     bool pending = cq->head != cq->tail;
+    uint32_t posted = 0;
     int ret;
 
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
 
+        if (n->dbbuf_enabled && cq->cqid) {
+            nvme_update_cq_eventidx(cq);
+            nvme_update_cq_head(cq);
+        }
+
         if (nvme_cq_full(cq)) {
             break;
         }
@@ -1298,13 +1498,17 @@ static void nvme_post_cqes(void *opaque)
         nvme_inc_cq_tail(cq);
         nvme_sg_unmap(&req->sg);
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
+        posted++;
+    }
+    if (posted && n->dbbuf_enabled && cq->cqid) {
+        nvme_poll_sqs(cq);
     }
     if (cq->tail != cq->head) {
         if (cq->irq_enabled && !pending) {
             n->cq_pending++;
         }
 
-        nvme_irq_assert(n, cq);
+        nvme_cq_irq(n, cq, posted);
     }
 }
 
@@ -3925,7 +4129,15 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeRequest *req)
 
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
+    uint16_t offset = sq->sqid << 3;
+
     n->sq[sq->sqid] = NULL;
+    if (sq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, 0x1000 + offset, 4, false, 0,
+                                  &sq->notifier);
+        event_notifier_set_handler(&sq->notifier, NULL);
+        event_notifier_cleanup(&sq->notifier);
+    }
     timer_free(sq->timer);
     g_free(sq->io_req);
     if (sq->sqid) {
@@ -3974,6 +4186,51 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
     return NVME_SUCCESS;
 }
 
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    nvme_process_sq(sq);
+}
+
+/*
+ * An ioeventfd only tells that the doorbell was written, so it can only be
+ * used once the new tail value can be read from the shadow doorbell.
+ */
+static void nvme_init_sq_ioeventfd(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+    uint16_t offset = sq->sqid << 3;
+
+    if (event_notifier_init(&sq->notifier, 0) < 0) {
+        return;
+    }
+
+    event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    memory_region_add_eventfd(&n->iomem, 0x1000 + offset, 4, false, 0,
+                              &sq->notifier);
+    sq->ioeventfd_enabled = true;
+}
+
+static void nvme_init_sq_dbbuf(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+    uint32_t v = cpu_to_le32(sq->tail);
+
+    /* Submission queue tail pointer location, 2 * QID * stride */
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+    pci_dma_write(&n->parent_obj, sq->db_addr, &v, sizeof(v));
+
+    if (n->params.ioeventfd && !sq->ioeventfd_enabled) {
+        nvme_init_sq_ioeventfd(sq);
+    }
+}
+
 static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
                          uint16_t sqid, uint16_t cqid, uint16_t size)
 {
@@ -3986,6 +4243,7 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
     sq->size = size;
     sq->cqid = cqid;
     sq->head = sq->tail = 0;
+    sq->ioeventfd_enabled = false;
     sq->io_req = g_new0(NvmeRequest, sq->size);
 
     QTAILQ_INIT(&sq->req_list);
@@ -4000,6 +4258,10 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
     cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
+
+    if (n->dbbuf_enabled && sqid) {
+        nvme_init_sq_dbbuf(sq);
+    }
 }
 
 static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeRequest *req)
@@ -4293,8 +4555,17 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
 
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
+    uint16_t offset = (cq->cqid << 3) + (1 << 2);
+
     n->cq[cq->cqid] = NULL;
+    if (cq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, 0x1000 + offset, 4, false, 0,
+                                  &cq->notifier);
+        event_notifier_set_handler(&cq->notifier, NULL);
+        event_notifier_cleanup(&cq->notifier);
+    }
     timer_free(cq->timer);
+    timer_free(cq->irq_timer);
     if (msix_enabled(&n->parent_obj)) {
         msix_vector_unuse(&n->parent_obj, cq->vector);
     }
@@ -4330,6 +4601,72 @@ static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeRequest *req)
     return NVME_SUCCESS;
 }
 
+static void nvme_cq_head_updated(NvmeCtrl *n, NvmeCQueue *cq, bool was_full)
+{
+    if (was_full) {
+        NvmeSQueue *sq;
+        QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+            timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        }
+        timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    }
+
+    if (cq->tail == cq->head) {
+        if (cq->irq_enabled) {
+            n->cq_pending--;
+        }
+
+        /* The host caught up, a coalesced interrupt is not needed */
+        timer_del(cq->irq_timer);
+        cq->coalesced = 0;
+        nvme_irq_deassert(n, cq);
+    }
+}
+
+static void nvme_cq_notifier(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, notifier);
+    bool was_full;
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    was_full = nvme_cq_full(cq);
+    nvme_update_cq_head(cq);
+    nvme_cq_head_updated(cq->ctrl, cq, was_full);
+}
+
+static void nvme_init_cq_ioeventfd(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+    uint16_t offset = (cq->cqid << 3) + (1 << 2);
+
+    if (event_notifier_init(&cq->notifier, 0) < 0) {
+        return;
+    }
+
+    event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+    memory_region_add_eventfd(&n->iomem, 0x1000 + offset, 4, false, 0,
+                              &cq->notifier);
+    cq->ioeventfd_enabled = true;
+}
+
+static void nvme_init_cq_dbbuf(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+    uint32_t v = cpu_to_le32(cq->head);
+
+    /* Completion queue head pointer location, (2 * QID + 1) * stride */
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + (1 << 2);
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + (1 << 2);
+    pci_dma_write(&n->parent_obj, cq->db_addr, &v, sizeof(v));
+
+    if (n->params.ioeventfd && !cq->ioeventfd_enabled) {
+        nvme_init_cq_ioeventfd(cq);
+    }
+}
+
 static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
                          uint16_t cqid, uint16_t vector, uint16_t size,
                          uint16_t irq_enabled)
@@ -4348,10 +4685,17 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     cq->irq_enabled = irq_enabled;
     cq->vector = vector;
     cq->head = cq->tail = 0;
+    cq->ioeventfd_enabled = false;
+    cq->coalesced = 0;
     QTAILQ_INIT(&cq->req_list);
     QTAILQ_INIT(&cq->sq_list);
     n->cq[cqid] = cq;
     cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    cq->irq_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_cq_irq_timer, cq);
+
+    if (n->dbbuf_enabled && cqid) {
+        nvme_init_cq_dbbuf(cq);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -4922,6 +5266,21 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeRequest *req)
         }
         trace_pci_nvme_getfeat_vwcache(result ? "enabled" : "disabled");
         goto out;
+    case NVME_INTERRUPT_COALESCING:
+        result = n->features.int_coalescing;
+        goto out;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->params.max_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        result = iv;
+        if (iv == n->admin_cq.vector ||
+            test_bit(iv, n->features.int_vc_cd)) {
+            result |= NVME_INTVC_NOCOALESCING;
+        }
+        goto out;
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         result = n->features.async_config;
         goto out;
@@ -5112,6 +5471,20 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
         req->cqe.result = cpu_to_le32((n->params.max_ioqpairs - 1) |
                                       ((n->params.max_ioqpairs - 1) << 16));
         break;
+    case NVME_INTERRUPT_COALESCING:
+        n->features.int_coalescing = dw11 & 0xffff;
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        if ((dw11 & 0xffff) >= n->params.max_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        if (dw11 & NVME_INTVC_NOCOALESCING) {
+            set_bit(dw11 & 0xffff, n->features.int_vc_cd);
+        } else {
+            clear_bit(dw11 & 0xffff, n->features.int_vc_cd);
+        }
+        break;
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         n->features.async_config = dw11;
         break;
@@ -5451,6 +5824,37 @@ out:
     return status;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
+{
+    uint64_t dbs_addr = le64_to_cpu(req->cmd.dptr.prp1);
+    uint64_t eis_addr = le64_to_cpu(req->cmd.dptr.prp2);
+    int i;
+
+    /* Both buffers must be page aligned */
+    if ((dbs_addr | eis_addr) & (n->page_size - 1)) {
+        trace_pci_nvme_err_invalid_dbbuf(dbs_addr, eis_addr);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    trace_pci_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    /* Save the buffer addresses for queues created later */
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+    n->dbbuf_enabled = true;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        if (n->sq[i]) {
+            nvme_init_sq_dbbuf(n->sq[i]);
+        }
+        if (n->cq[i]) {
+            nvme_init_cq_dbbuf(n->cq[i]);
+        }
+    }
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
 {
     trace_pci_nvme_admin_cmd(nvme_cid(req), nvme_sqid(req), req->cmd.opcode,
@@ -5489,6 +5893,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
         return nvme_aer(n, req);
     case NVME_ADM_CMD_NS_ATTACHMENT:
         return nvme_ns_attachment(n, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, req);
     case NVME_ADM_CMD_FORMAT_NVM:
         return nvme_format(n, req);
     default:
@@ -5509,6 +5915,10 @@ static void nvme_process_sq(void *opaque)
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    if (n->dbbuf_enabled && sq->sqid) {
+        nvme_update_sq_tail(sq);
+    }
+
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
         addr = sq->dma_addr + sq->head * n->sqe_size;
         if (nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd))) {
@@ -5532,6 +5942,12 @@ static void nvme_process_sq(void *opaque)
             req->status = status;
             nvme_enqueue_req_completion(cq, req);
         }
+
+        if (n->dbbuf_enabled && sq->sqid) {
+            /* Ask to be notified past this tail, then look again */
+            nvme_update_sq_eventidx(sq);
+            nvme_update_sq_tail(sq);
+        }
     }
 }
 
@@ -5569,6 +5985,10 @@ static void nvme_ctrl_reset(NvmeCtrl *n)
     n->aer_queued = 0;
     n->outstanding_aers = 0;
     n->qs_created = false;
+
+    n->dbbuf_dbs = 0;
+    n->dbbuf_eis = 0;
+    n->dbbuf_enabled = false;
 }
 
 static void nvme_ctrl_shutdown(NvmeCtrl *n)
@@ -6086,21 +6506,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         start_sqs = nvme_cq_full(cq) ? 1 : 0;
         cq->head = new_head;
-        if (start_sqs) {
-            NvmeSQueue *sq;
-            QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
-                timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
-            }
-            timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
-        }
-
-        if (cq->tail == cq->head) {
-            if (cq->irq_enabled) {
-                n->cq_pending--;
-            }
-
-            nvme_irq_deassert(n, cq);
-        }
+        nvme_cq_head_updated(n, cq, start_sqs);
     } else {
         /* Submission queue doorbell write */
 
@@ -6268,6 +6674,8 @@ static void nvme_init_state(NvmeCtrl *n)
     n->features.temp_thresh_hi = NVME_TEMPERATURE_WARNING;
     n->starttime_ms = qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL);
     n->aer_reqs = g_new0(NvmeRequest *, n->params.aerl + 1);
+    n->features.int_vc_cd = bitmap_new(MAX(n->params.msix_qsize,
+                                           n->params.max_ioqpairs + 1));
 }
 
 static void nvme_init_cmb(NvmeCtrl *n, PCIDevice *pci_dev)
@@ -6420,7 +6828,8 @@ static void nvme_init_ctrl(NvmeCtrl *n, PCIDevice *pci_dev)
 
     id->mdts = n->params.mdts;
     id->ver = cpu_to_le32(NVME_SPEC_VER);
-    id->oacs = cpu_to_le16(NVME_OACS_NS_MGMT | NVME_OACS_FORMAT);
+    id->oacs = cpu_to_le16(NVME_OACS_NS_MGMT | NVME_OACS_FORMAT |
+                           NVME_OACS_DBBUF);
     id->cntrltype = 0x1;
 
     /*
@@ -6579,6 +6988,7 @@ static void nvme_exit(PCIDevice *pci_dev)
     g_free(n->cq);
     g_free(n->sq);
     g_free(n->aer_reqs);
+    g_free(n->features.int_vc_cd);
 
     if (n->params.cmb_size_mb) {
         g_free(n->cmb.buf);
@@ -6608,6 +7018,8 @@ static Property nvme_props[] = {
     DEFINE_PROP_UINT8("vsl", NvmeCtrl, params.vsl, 7),
     DEFINE_PROP_BOOL("use-intel-id", NvmeCtrl, params.use_intel_id, false),
     DEFINE_PROP_BOOL("legacy-cmb", NvmeCtrl, params.legacy_cmb, false),
+    DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
+    DEFINE_PROP_BOOL("intc-adaptive", NvmeCtrl, params.intc_adaptive, false),
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
                      params.auto_transition_zones, true),
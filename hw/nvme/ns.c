@@ -25,6 +25,25 @@
 #define MIN_DISCARD_GRANULARITY (4 * KiB)
 #define NVME_DEFAULT_ZONE_SIZE   (128 * MiB)
 
+/*
+ * Layout of the zone state drive: a header, followed (at
+ * NVME_ZONE_PSTATE_OFFSET) by the zone descriptors of all zones and then by
+ * the zone descriptor extensions of all zones. All fields are little endian.
+ */
+#define NVME_ZONE_PSTATE_MAGIC   0x535a564e /* "NVZS" */
+#define NVME_ZONE_PSTATE_VERSION 1
+#define NVME_ZONE_PSTATE_OFFSET  (4 * KiB)
+
+typedef struct QEMU_PACKED NvmeZonePstateHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_zones;
+    uint64_t zone_size;
+    uint64_t zone_capacity;
+    uint32_t lbasz;
+    uint32_t zd_extension_size;
+} NvmeZonePstateHeader;
+
 void nvme_ns_init_format(NvmeNamespace *ns)
 {
     NvmeIdNs *id_ns = &ns->id_ns;
@@ -346,6 +365,234 @@ static void nvme_zoned_ns_shutdown(NvmeNamespace *ns)
     assert(ns->nr_open_zones == 0);
 }
 
+static void nvme_ns_zoned_pstate_header(NvmeNamespace *ns,
+                                        NvmeZonePstateHeader *hdr)
+{
+    hdr->magic = cpu_to_le32(NVME_ZONE_PSTATE_MAGIC);
+    hdr->version = cpu_to_le32(NVME_ZONE_PSTATE_VERSION);
+    hdr->num_zones = cpu_to_le64(ns->num_zones);
+    hdr->zone_size = cpu_to_le64(ns->zone_size);
+    hdr->zone_capacity = cpu_to_le64(ns->zone_capacity);
+    hdr->lbasz = cpu_to_le32(ns->lbasz);
+    hdr->zd_extension_size = cpu_to_le32(ns->params.zd_extension_size);
+}
+
+static int nvme_ns_zoned_write_pstate(NvmeNamespace *ns, uint32_t idx,
+                                      uint32_t nr)
+{
+    size_t zd_ext_size = ns->params.zd_extension_size;
+    int64_t offset = NVME_ZONE_PSTATE_OFFSET +
+        (int64_t)idx * sizeof(NvmeZoneDescr);
+    int ret;
+
+    ret = blk_pwrite(ns->pstate.blk, offset, &ns->pstate.zd[idx],
+                     nr * sizeof(NvmeZoneDescr), 0);
+    if (ret < 0 || !zd_ext_size) {
+        return ret;
+    }
+
+    offset = NVME_ZONE_PSTATE_OFFSET +
+        (int64_t)ns->num_zones * sizeof(NvmeZoneDescr) +
+        (int64_t)idx * zd_ext_size;
+
+    return blk_pwrite(ns->pstate.blk, offset,
+                      &ns->pstate.zd_ext[idx * zd_ext_size],
+                      nr * zd_ext_size, 0);
+}
+
+/*
+ * Write back the descriptors (and extensions) of the zones that changed since
+ * the zone state was last loaded or saved, coalescing runs of adjacent zones
+ * into a single write.
+ */
+static int nvme_ns_zoned_save_pstate(NvmeNamespace *ns)
+{
+    size_t zd_ext_size = ns->params.zd_extension_size;
+    uint32_t i, start = 0, nr = 0;
+    int ret;
+
+    for (i = 0; i < ns->num_zones; i++) {
+        NvmeZone *zone = &ns->zone_array[i];
+        NvmeZoneDescr zd = {
+            .zt = zone->d.zt,
+            .zs = zone->d.zs,
+            .za = zone->d.za,
+            .zcap = cpu_to_le64(zone->d.zcap),
+            .zslba = cpu_to_le64(zone->d.zslba),
+            .wp = cpu_to_le64(zone->d.wp),
+        };
+        uint8_t *zd_ext = NULL;
+        bool dirty;
+
+        dirty = !!memcmp(&zd, &ns->pstate.zd[i], sizeof(zd));
+
+        if (zd_ext_size) {
+            zd_ext = nvme_get_zd_extension(ns, i);
+            dirty |= !!memcmp(zd_ext, &ns->pstate.zd_ext[i * zd_ext_size],
+                              zd_ext_size);
+        }
+
+        if (dirty) {
+            ns->pstate.zd[i] = zd;
+            if (zd_ext) {
+                memcpy(&ns->pstate.zd_ext[i * zd_ext_size], zd_ext,
+                       zd_ext_size);
+            }
+
+            if (!nr++) {
+                start = i;
+            }
+
+            continue;
+        }
+
+        if (nr) {
+            ret = nvme_ns_zoned_write_pstate(ns, start, nr);
+            if (ret < 0) {
+                return ret;
+            }
+
+            nr = 0;
+        }
+    }
+
+    if (nr) {
+        ret = nvme_ns_zoned_write_pstate(ns, start, nr);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return blk_flush(ns->pstate.blk);
+}
+
+static int nvme_ns_zoned_load_pstate(NvmeNamespace *ns, Error **errp)
+{
+    BlockBackend *blk = ns->pstate.blk;
+    size_t zd_ext_size = ns->params.zd_extension_size;
+    size_t zd_len = (size_t)ns->num_zones * sizeof(NvmeZoneDescr);
+    size_t zd_ext_len = (size_t)ns->num_zones * zd_ext_size;
+    int64_t min_len = NVME_ZONE_PSTATE_OFFSET + zd_len + zd_ext_len;
+    NvmeZonePstateHeader hdr, expected;
+    NvmeZone *zone;
+    int64_t len;
+    uint32_t i;
+    int ret;
+
+    ret = blk_set_perm(blk, BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE,
+                       BLK_PERM_ALL, errp);
+    if (ret < 0) {
+        return -1;
+    }
+
+    len = blk_getlength(blk);
+    if (len < 0) {
+        error_setg_errno(errp, -len, "could not get zone state size");
+        return -1;
+    }
+
+    if (len < min_len) {
+        error_setg(errp, "zone state drive too small, must be at least "
+                   "%"PRId64" bytes", min_len);
+        return -1;
+    }
+
+    ns->pstate.zd = g_malloc0(zd_len);
+    if (zd_ext_size) {
+        ns->pstate.zd_ext = g_malloc0(zd_ext_len);
+    }
+
+    nvme_ns_zoned_pstate_header(ns, &expected);
+
+    ret = blk_pread(blk, 0, &hdr, sizeof(hdr));
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "could not read zone state header");
+        return -1;
+    }
+
+    if (!hdr.magic) {
+        /* blank drive; initialize it with the state of all zones */
+        ret = blk_pwrite(blk, 0, &expected, sizeof(expected), 0);
+        if (ret >= 0) {
+            ret = nvme_ns_zoned_save_pstate(ns);
+        }
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "could not initialize zone state");
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if (memcmp(&hdr, &expected, sizeof(hdr))) {
+        error_setg(errp, "zone state drive does not match the zone geometry "
+                   "of the namespace");
+        return -1;
+    }
+
+    ret = blk_pread(blk, NVME_ZONE_PSTATE_OFFSET, ns->pstate.zd, zd_len);
+    if (ret >= 0 && zd_ext_size) {
+        ret = blk_pread(blk, NVME_ZONE_PSTATE_OFFSET + zd_len,
+                        ns->pstate.zd_ext, zd_ext_len);
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "could not read zone state");
+        return -1;
+    }
+
+    zone = ns->zone_array;
+    for (i = 0; i < ns->num_zones; i++, zone++) {
+        NvmeZoneDescr *zd = &ns->pstate.zd[i];
+        uint64_t wp = le64_to_cpu(zd->wp);
+
+        if (le64_to_cpu(zd->zslba) != zone->d.zslba ||
+            wp < zone->d.zslba || wp > nvme_zone_wr_boundary(zone)) {
+            error_setg(errp, "invalid zone state for zone %u", i);
+            return -1;
+        }
+
+        zone->d.zs = zd->zs;
+        zone->d.za = zd->za;
+        zone->d.wp = wp;
+        zone->w_ptr = wp;
+
+        switch (nvme_get_zone_state(zone)) {
+        case NVME_ZONE_STATE_FULL:
+            QTAILQ_INSERT_TAIL(&ns->full_zones, zone, entry);
+            break;
+
+        case NVME_ZONE_STATE_READ_ONLY:
+        case NVME_ZONE_STATE_OFFLINE:
+            break;
+
+        case NVME_ZONE_STATE_EMPTY:
+        case NVME_ZONE_STATE_IMPLICITLY_OPEN:
+        case NVME_ZONE_STATE_EXPLICITLY_OPEN:
+        case NVME_ZONE_STATE_CLOSED:
+            if (ns->params.max_active_zones &&
+                ns->nr_active_zones == ns->params.max_active_zones &&
+                (wp != zone->d.zslba || (zone->d.za & NVME_ZA_ZD_EXT_VALID))) {
+                error_setg(errp, "zone state has more than %u active zones",
+                           ns->params.max_active_zones);
+                return -1;
+            }
+
+            nvme_clear_zone(ns, zone);
+            break;
+
+        default:
+            error_setg(errp, "invalid zone state for zone %u", i);
+            return -1;
+        }
+    }
+
+    if (zd_ext_size) {
+        memcpy(ns->zd_extensions, ns->pstate.zd_ext, zd_ext_len);
+    }
+
+    return 0;
+}
+
 static int nvme_ns_check_constraints(NvmeNamespace *ns, Error **errp)
 {
     if (!ns->blkconf.blk) {
@@ -391,6 +638,9 @@ static int nvme_ns_check_constraints(NvmeNamespace *ns, Error **errp)
                 return -1;
             }
         }
+    } else if (ns->pstate.blk) {
+        error_setg(errp, "zoned.pstate requires zoned=on");
+        return -1;
     }
 
     return 0;
@@ -414,6 +664,10 @@ int nvme_ns_setup(NvmeNamespace *ns, Error **errp)
             return -1;
         }
         nvme_ns_init_zoned(ns);
+
+        if (ns->pstate.blk && nvme_ns_zoned_load_pstate(ns, errp)) {
+            return -1;
+        }
     }
 
     return 0;
@@ -429,6 +683,14 @@ void nvme_ns_shutdown(NvmeNamespace *ns)
     blk_flush(ns->blkconf.blk);
     if (ns->params.zoned) {
         nvme_zoned_ns_shutdown(ns);
+
+        if (ns->pstate.blk) {
+            int ret = nvme_ns_zoned_save_pstate(ns);
+            if (ret < 0) {
+                warn_report("nvme-ns: could not save zone state: %s",
+                            strerror(-ret));
+            }
+        }
     }
 }
 
@@ -438,6 +700,8 @@ void nvme_ns_cleanup(NvmeNamespace *ns)
         g_free(ns->id_ns_zoned);
         g_free(ns->zone_array);
         g_free(ns->zd_extensions);
+        g_free(ns->pstate.zd);
+        g_free(ns->pstate.zd_ext);
     }
 }
 
@@ -556,6 +820,7 @@ static Property nvme_ns_props[] = {
                        params.max_open_zones, 0),
     DEFINE_PROP_UINT32("zoned.descr_ext_size", NvmeNamespace,
                        params.zd_extension_size, 0),
+    DEFINE_PROP_DRIVE("zoned.pstate", NvmeNamespace, pstate.blk),
     DEFINE_PROP_BOOL("eui64-default", NvmeNamespace, params.eui64_default,
                      true),
     DEFINE_PROP_END_OF_LIST(),
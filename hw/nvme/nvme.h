@@ -19,6 +19,7 @@
 #define HW_NVME_INTERNAL_H
 
 #include "qemu/uuid.h"
+#include "qemu/event_notifier.h"
 #include "hw/pci/pci.h"
 #include "hw/block/block.h"
 
@@ -146,6 +147,13 @@ typedef struct NvmeNamespace {
     int32_t         nr_open_zones;
     int32_t         nr_active_zones;
 
+    struct {
+        BlockBackend  *blk;
+        /* little endian copies of what was last written to blk */
+        NvmeZoneDescr *zd;
+        uint8_t       *zd_ext;
+    } pstate;
+
     NvmeNamespaceParams params;
 
     struct {
@@ -351,7 +359,11 @@ typedef struct NvmeSQueue {
     uint32_t    tail;
     uint32_t    size;
     uint64_t    dma_addr;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
     QEMUTimer   *timer;
+    EventNotifier notifier;
+    bool        ioeventfd_enabled;
     NvmeRequest *io_req;
     QTAILQ_HEAD(, NvmeRequest) req_list;
     QTAILQ_HEAD(, NvmeRequest) out_req_list;
@@ -368,7 +380,13 @@ typedef struct NvmeCQueue {
     uint32_t    vector;
     uint32_t    size;
     uint64_t    dma_addr;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
     QEMUTimer   *timer;
+    QEMUTimer   *irq_timer;
+    uint32_t    coalesced;
+    EventNotifier notifier;
+    bool        ioeventfd_enabled;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
@@ -391,6 +409,8 @@ typedef struct NvmeParams {
     uint8_t  zasl;
     bool     auto_transition_zones;
     bool     legacy_cmb;
+    bool     ioeventfd;
+    bool     intc_adaptive;
 } NvmeParams;
 
 typedef struct NvmeCtrl {
@@ -417,6 +437,9 @@ typedef struct NvmeCtrl {
     uint64_t    timestamp_set_qemu_clock_ms;    /* QEMU clock time */
     uint64_t    starttime_ms;
     uint16_t    temperature;
+    uint64_t    dbbuf_dbs;
+    uint64_t    dbbuf_eis;
+    bool        dbbuf_enabled;
     uint8_t     smart_critical_warning;
 
     struct {
@@ -459,6 +482,8 @@ typedef struct NvmeCtrl {
             uint16_t temp_thresh_low;
         };
         uint32_t    async_config;
+        uint32_t    int_coalescing;
+        unsigned long *int_vc_cd;   /* per-vector Coalescing Disable */
     } features;
 } NvmeCtrl;
 
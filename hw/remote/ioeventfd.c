@@ -0,0 +1,233 @@
+/*
+ * ioeventfds of remote devices
+ *
+ * Device models register ioeventfds on their BARs as usual.  They are
+ * passed on to the proxy, which registers them on its own copy of the
+ * BARs, so that KVM signals them directly when the guest writes to them
+ * and the write never goes through the proxy object.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+
+#include "exec/address-spaces.h"
+#include "hw/remote/ioeventfd.h"
+#include "hw/remote/machine.h"
+#include "hw/remote/mpqemu-link.h"
+#include "qapi/error.h"
+#include "trace.h"
+
+struct RemoteIoeventfd {
+    PCIDevice *dev;
+    IoeventfdMsg msg;
+    EventNotifier *e;
+    QTAILQ_ENTRY(RemoteIoeventfd) next;
+};
+
+typedef struct RemoteIoeventfdLookup {
+    hwaddr addr;
+    hwaddr size;
+    bool memory;
+    PCIDevice *dev;
+    int bar;
+} RemoteIoeventfdLookup;
+
+static void remote_ioeventfd_find_bar(PCIBus *bus, PCIDevice *dev,
+                                      void *opaque)
+{
+    RemoteIoeventfdLookup *lookup = opaque;
+    int i;
+
+    for (i = 0; i < PCI_NUM_REGIONS && !lookup->dev; i++) {
+        PCIIORegion *r = &dev->io_regions[i];
+        bool memory = !(r->type & PCI_BASE_ADDRESS_SPACE_IO);
+
+        if (r->size && r->addr != PCI_BAR_UNMAPPED &&
+            memory == lookup->memory && lookup->addr >= r->addr &&
+            lookup->addr + lookup->size <= r->addr + r->size) {
+            lookup->dev = dev;
+            lookup->bar = i;
+        }
+    }
+}
+
+static void remote_ioeventfd_add(RemoteIoeventfdState *state, bool memory,
+                                 MemoryRegionSection *section,
+                                 bool match_data, uint64_t data,
+                                 EventNotifier *e)
+{
+    RemoteIoeventfdLookup lookup = {
+        .addr = section->offset_within_address_space,
+        .size = int128_get64(section->size),
+        .memory = memory,
+    };
+    RemoteIoeventfd *ioeventfd;
+
+    pci_for_each_device(state->bus, pci_bus_num(state->bus),
+                        remote_ioeventfd_find_bar, &lookup);
+    if (!lookup.dev) {
+        /* Not on a BAR, so the guest cannot write to it */
+        return;
+    }
+
+    ioeventfd = g_new0(RemoteIoeventfd, 1);
+    ioeventfd->dev = lookup.dev;
+    ioeventfd->e = e;
+    ioeventfd->msg = (IoeventfdMsg) {
+        .bar = lookup.bar,
+        .offset = lookup.addr - lookup.dev->io_regions[lookup.bar].addr,
+        .size = lookup.size,
+        .match_data = match_data,
+        .data = data,
+        .assign = true,
+    };
+    QTAILQ_INSERT_TAIL(&state->active, ioeventfd, next);
+    QTAILQ_INSERT_TAIL(&state->pending, g_memdup(ioeventfd, sizeof(*ioeventfd)),
+                       next);
+}
+
+static void remote_ioeventfd_del(RemoteIoeventfdState *state,
+                                 EventNotifier *e)
+{
+    RemoteIoeventfd *ioeventfd, *pending;
+
+    QTAILQ_FOREACH(ioeventfd, &state->active, next) {
+        if (ioeventfd->e == e) {
+            break;
+        }
+    }
+    if (!ioeventfd) {
+        return;
+    }
+    QTAILQ_REMOVE(&state->active, ioeventfd, next);
+
+    /*
+     * If the proxy has not seen the ioeventfd yet, just drop it; the
+     * notifier may not be around anymore when sending it.
+     */
+    QTAILQ_FOREACH(pending, &state->pending, next) {
+        if (pending->e == e && pending->msg.assign) {
+            QTAILQ_REMOVE(&state->pending, pending, next);
+            g_free(pending);
+            g_free(ioeventfd);
+            return;
+        }
+    }
+
+    ioeventfd->msg.assign = false;
+    ioeventfd->e = NULL;
+    QTAILQ_INSERT_TAIL(&state->pending, ioeventfd, next);
+}
+
+static void remote_ioeventfd_mem_add(MemoryListener *listener,
+                                     MemoryRegionSection *section,
+                                     bool match_data, uint64_t data,
+                                     EventNotifier *e)
+{
+    RemoteIoeventfdState *state = container_of(listener, RemoteIoeventfdState,
+                                               mem_listener);
+
+    remote_ioeventfd_add(state, true, section, match_data, data, e);
+}
+
+static void remote_ioeventfd_io_add(MemoryListener *listener,
+                                    MemoryRegionSection *section,
+                                    bool match_data, uint64_t data,
+                                    EventNotifier *e)
+{
+    RemoteIoeventfdState *state = container_of(listener, RemoteIoeventfdState,
+                                               io_listener);
+
+    remote_ioeventfd_add(state, false, section, match_data, data, e);
+}
+
+static void remote_ioeventfd_mem_del(MemoryListener *listener,
+                                     MemoryRegionSection *section,
+                                     bool match_data, uint64_t data,
+                                     EventNotifier *e)
+{
+    remote_ioeventfd_del(container_of(listener, RemoteIoeventfdState,
+                                      mem_listener), e);
+}
+
+static void remote_ioeventfd_io_del(MemoryListener *listener,
+                                    MemoryRegionSection *section,
+                                    bool match_data, uint64_t data,
+                                    EventNotifier *e)
+{
+    remote_ioeventfd_del(container_of(listener, RemoteIoeventfdState,
+                                      io_listener), e);
+}
+
+void remote_ioeventfd_init(RemoteIoeventfdState *state, PCIBus *bus)
+{
+    state->bus = bus;
+    QTAILQ_INIT(&state->active);
+    QTAILQ_INIT(&state->pending);
+
+    state->mem_listener = (MemoryListener) {
+        .eventfd_add = remote_ioeventfd_mem_add,
+        .eventfd_del = remote_ioeventfd_mem_del,
+    };
+    state->io_listener = (MemoryListener) {
+        .eventfd_add = remote_ioeventfd_io_add,
+        .eventfd_del = remote_ioeventfd_io_del,
+    };
+    memory_listener_register(&state->mem_listener, &address_space_memory);
+    memory_listener_register(&state->io_listener, &address_space_io);
+}
+
+bool remote_ioeventfd_flush(PCIDevice *dev, QIOChannel *ioc, Error **errp)
+{
+    RemoteIoeventfdState *state = &REMOTE_MACHINE(current_machine)->ioeventfd;
+    RemoteIoeventfd *pending, *next;
+
+    QTAILQ_FOREACH_SAFE(pending, &state->pending, next, next) {
+        MPQemuMsg msg = { 0 };
+
+        if (pending->dev != dev) {
+            continue;
+        }
+
+        msg.cmd = MPQEMU_CMD_SET_IOEVENTFD;
+        msg.size = sizeof(IoeventfdMsg);
+        msg.data.ioeventfd = pending->msg;
+        if (pending->msg.assign) {
+            msg.num_fds = 1;
+            msg.fds[0] = event_notifier_get_fd(pending->e);
+        }
+
+        trace_remote_ioeventfd_flush(pending->msg.bar, pending->msg.offset,
+                                     pending->msg.size, pending->msg.assign);
+        QTAILQ_REMOVE(&state->pending, pending, next);
+        g_free(pending);
+
+        if (!mpqemu_msg_send(&msg, ioc, errp)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void remote_ioeventfd_forget(PCIDevice *dev)
+{
+    RemoteIoeventfdState *state = &REMOTE_MACHINE(current_machine)->ioeventfd;
+    RemoteIoeventfd *ioeventfd, *next;
+
+    QTAILQ_FOREACH_SAFE(ioeventfd, &state->pending, next, next) {
+        if (ioeventfd->dev == dev) {
+            QTAILQ_REMOVE(&state->pending, ioeventfd, next);
+            g_free(ioeventfd);
+        }
+    }
+    QTAILQ_FOREACH_SAFE(ioeventfd, &state->active, next, next) {
+        if (ioeventfd->dev == dev) {
+            QTAILQ_REMOVE(&state->active, ioeventfd, next);
+            g_free(ioeventfd);
+        }
+    }
+}
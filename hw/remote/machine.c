@@ -51,6 +51,7 @@ static void remote_machine_init(MachineState *machine)
     pci_host = PCI_HOST_BRIDGE(rem_host);
 
     remote_iohub_init(&s->iohub);
+    remote_ioeventfd_init(&s->ioeventfd, pci_host->bus);
 
     pci_bus_irqs(pci_host->bus, remote_iohub_set_irq, remote_iohub_map_irq,
                  &s->iohub, REMOTE_IOHUB_NB_PIRQS);
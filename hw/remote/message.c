@@ -19,13 +19,15 @@
 #include "exec/memattrs.h"
 #include "hw/remote/memory.h"
 #include "hw/remote/iohub.h"
+#include "hw/remote/ioeventfd.h"
 #include "sysemu/reset.h"
 
 static void process_config_write(QIOChannel *ioc, PCIDevice *dev,
                                  MPQemuMsg *msg, Error **errp);
 static void process_config_read(QIOChannel *ioc, PCIDevice *dev,
                                 MPQemuMsg *msg, Error **errp);
-static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, Error **errp);
+static void process_bar_write(QIOChannel *ioc, PCIDevice *dev,
+                              MPQemuMsg *msg, Error **errp);
 static void process_bar_read(QIOChannel *ioc, MPQemuMsg *msg, Error **errp);
 static void process_device_reset_msg(QIOChannel *ioc, PCIDevice *dev,
                                      Error **errp);
@@ -61,7 +63,7 @@ void coroutine_fn mpqemu_remote_msg_loop_co(void *data)
             process_config_read(com->ioc, pci_dev, &msg, &local_err);
             break;
         case MPQEMU_CMD_BAR_WRITE:
-            process_bar_write(com->ioc, &msg, &local_err);
+            process_bar_write(com->ioc, pci_dev, &msg, &local_err);
             break;
         case MPQEMU_CMD_BAR_READ:
             process_bar_read(com->ioc, &msg, &local_err);
@@ -83,6 +85,8 @@ void coroutine_fn mpqemu_remote_msg_loop_co(void *data)
         }
     }
 
+    remote_ioeventfd_forget(pci_dev);
+
     if (local_err) {
         error_report_err(local_err);
         qemu_system_shutdown_request(SHUTDOWN_CAUSE_HOST_ERROR);
@@ -109,7 +113,9 @@ static void process_config_write(QIOChannel *ioc, PCIDevice *dev,
     ret.cmd = MPQEMU_CMD_RET;
     ret.size = sizeof(ret.data.u64);
 
-    if (!mpqemu_msg_send(&ret, ioc, NULL)) {
+    /* Moving or disabling BARs also moves or removes their ioeventfds */
+    if (!remote_ioeventfd_flush(dev, ioc, NULL) ||
+        !mpqemu_msg_send(&ret, ioc, NULL)) {
         error_prepend(errp, "Error returning code to proxy, pid "FMT_pid": ",
                       getpid());
     }
@@ -139,7 +145,8 @@ static void process_config_read(QIOChannel *ioc, PCIDevice *dev,
     }
 }
 
-static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, Error **errp)
+static void process_bar_write(QIOChannel *ioc, PCIDevice *dev,
+                              MPQemuMsg *msg, Error **errp)
 {
     ERRP_GUARD();
     BarAccessMsg *bar_access = &msg->data.bar_access;
@@ -170,7 +177,9 @@ fail:
     ret.cmd = MPQEMU_CMD_RET;
     ret.size = sizeof(ret.data.u64);
 
-    if (!mpqemu_msg_send(&ret, ioc, NULL)) {
+    /* The driver may have just started the device, e.g. its queues */
+    if (!remote_ioeventfd_flush(dev, ioc, NULL) ||
+        !mpqemu_msg_send(&ret, ioc, NULL)) {
         error_prepend(errp, "Error returning code to proxy, pid "FMT_pid": ",
                       getpid());
     }
@@ -226,5 +235,7 @@ static void process_device_reset_msg(QIOChannel *ioc, PCIDevice *dev,
 
     ret.cmd = MPQEMU_CMD_RET;
 
-    mpqemu_msg_send(&ret, ioc, errp);
+    if (remote_ioeventfd_flush(dev, ioc, errp)) {
+        mpqemu_msg_send(&ret, ioc, errp);
+    }
 }
@@ -70,7 +70,7 @@ bool mpqemu_msg_send(MPQemuMsg *msg, QIOChannel *ioc, Error **errp)
     }
 
     if (!qio_channel_writev_full_all(ioc, send, G_N_ELEMENTS(send),
-                                    fds, nfds, errp)) {
+                                    fds, nfds, 0, errp)) {
         ret = true;
     } else {
         trace_mpqemu_send_io_error(msg->cmd, msg->size, nfds);
@@ -183,7 +183,9 @@ fail:
 }
 
 /*
- * Send msg and wait for a reply with command code RET_MSG.
+ * Send msg and wait for a reply with command code RET_MSG.  ioeventfd
+ * updates that the remote process sends ahead of the reply are applied
+ * to the proxy.
  * Returns the message received of size u64 or UINT64_MAX
  * on error.
  * Called from VCPU thread in non-coroutine context.
@@ -203,8 +205,16 @@ uint64_t mpqemu_msg_send_and_await_reply(MPQemuMsg *msg, PCIProxyDev *pdev,
         return ret;
     }
 
-    if (!mpqemu_msg_recv(&msg_reply, pdev->ioc, errp)) {
-        return ret;
+    for (;;) {
+        if (!mpqemu_msg_recv(&msg_reply, pdev->ioc, errp)) {
+            return ret;
+        }
+        if (!mpqemu_msg_valid(&msg_reply) ||
+            msg_reply.cmd != MPQEMU_CMD_SET_IOEVENTFD) {
+            break;
+        }
+        proxy_set_ioeventfd(pdev, &msg_reply);
+        memset(&msg_reply, 0, sizeof(msg_reply));
     }
 
     if (!mpqemu_msg_valid(&msg_reply) || msg_reply.cmd != MPQEMU_CMD_RET) {
@@ -259,6 +269,12 @@ bool mpqemu_msg_valid(MPQemuMsg *msg)
             return false;
         }
         break;
+    case MPQEMU_CMD_SET_IOEVENTFD:
+        if (msg->size != sizeof(IoeventfdMsg) ||
+            msg->num_fds != msg->data.ioeventfd.assign) {
+            return false;
+        }
+        break;
     default:
         break;
     }
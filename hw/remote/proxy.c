@@ -24,6 +24,7 @@
 #include "qemu/event_notifier.h"
 #include "sysemu/kvm.h"
 #include "util/event_notifier-posix.c"
+#include "trace.h"
 
 static void probe_pci_info(PCIDevice *dev, Error **errp);
 static void proxy_device_reset(DeviceState *dev);
@@ -136,6 +137,81 @@ static void pci_proxy_dev_exit(PCIDevice *pdev)
 
     event_notifier_cleanup(&dev->intr);
     event_notifier_cleanup(&dev->resample);
+
+    while (!QLIST_EMPTY(&dev->ioeventfds)) {
+        ProxyIoeventfd *ioeventfd = QLIST_FIRST(&dev->ioeventfds);
+
+        memory_region_del_eventfd(&dev->region[ioeventfd->bar].mr,
+                                  ioeventfd->offset, ioeventfd->size,
+                                  ioeventfd->match_data, ioeventfd->data,
+                                  &ioeventfd->e);
+        event_notifier_cleanup(&ioeventfd->e);
+        QLIST_REMOVE(ioeventfd, next);
+        g_free(ioeventfd);
+    }
+}
+
+/*
+ * Called with the BQL held, while waiting for the reply to a message that
+ * made the remote device add or remove an ioeventfd on one of its BARs.
+ */
+void proxy_set_ioeventfd(PCIProxyDev *pdev, MPQemuMsg *msg)
+{
+    IoeventfdMsg *args = &msg->data.ioeventfd;
+    ProxyIoeventfd *ioeventfd;
+    MemoryRegion *mr;
+
+    trace_proxy_set_ioeventfd(args->bar, args->offset, args->size,
+                              args->assign);
+
+    if (args->bar < 0 || args->bar >= PCI_NUM_REGIONS ||
+        !pdev->region[args->bar].present) {
+        goto fail;
+    }
+    mr = &pdev->region[args->bar].mr;
+
+    if (args->assign) {
+        if (args->offset >= memory_region_size(mr) ||
+            args->size > memory_region_size(mr) - args->offset) {
+            goto fail;
+        }
+
+        ioeventfd = g_new0(ProxyIoeventfd, 1);
+        ioeventfd->bar = args->bar;
+        ioeventfd->offset = args->offset;
+        ioeventfd->size = args->size;
+        ioeventfd->match_data = args->match_data;
+        ioeventfd->data = args->data;
+        event_notifier_init_fd(&ioeventfd->e, msg->fds[0]);
+        memory_region_add_eventfd(mr, args->offset, args->size,
+                                  args->match_data, args->data,
+                                  &ioeventfd->e);
+        QLIST_INSERT_HEAD(&pdev->ioeventfds, ioeventfd, next);
+        return;
+    }
+
+    QLIST_FOREACH(ioeventfd, &pdev->ioeventfds, next) {
+        if (ioeventfd->bar == args->bar &&
+            ioeventfd->offset == args->offset &&
+            ioeventfd->size == args->size &&
+            ioeventfd->match_data == args->match_data &&
+            ioeventfd->data == args->data) {
+            memory_region_del_eventfd(mr, args->offset, args->size,
+                                      args->match_data, args->data,
+                                      &ioeventfd->e);
+            event_notifier_cleanup(&ioeventfd->e);
+            QLIST_REMOVE(ioeventfd, next);
+            g_free(ioeventfd);
+            return;
+        }
+    }
+
+fail:
+    error_report("Invalid ioeventfd update for BAR %d from remote process",
+                 args->bar);
+    if (msg->num_fds) {
+        close(msg->fds[0]);
+    }
 }
 
 static void config_op_send(PCIProxyDev *pdev, uint32_t addr, uint32_t *val,
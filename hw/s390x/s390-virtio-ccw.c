@@ -118,6 +118,7 @@ static int virtio_ccw_hcall_notify(const uint64_t *args)
 {
     uint64_t subch_id = args[0];
     uint64_t queue = args[1];
+    VirtIODevice *vdev;
     SubchDev *sch;
     int cssid, ssid, schid, m;
 
@@ -128,10 +129,21 @@ static int virtio_ccw_hcall_notify(const uint64_t *args)
     if (!sch || !css_subch_visible(sch)) {
         return -EINVAL;
     }
+    vdev = virtio_ccw_get_vdev(sch);
+    if (vdev && virtio_vdev_has_feature(vdev, VIRTIO_F_NOTIFICATION_DATA)) {
+        /* The next available index is in bits 16-31 */
+        uint64_t data = queue;
+
+        queue = data & 0xffff;
+        if (queue < VIRTIO_QUEUE_MAX) {
+            virtio_queue_set_shadow_avail_idx(virtio_get_queue(vdev, queue),
+                                              data >> 16);
+        }
+    }
     if (queue >= VIRTIO_QUEUE_MAX) {
         return -EINVAL;
     }
-    virtio_queue_notify(virtio_ccw_get_vdev(sch), queue);
+    virtio_queue_notify(vdev, queue);
     return 0;
 
 }
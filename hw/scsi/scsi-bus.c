@@ -674,6 +674,12 @@ static const struct SCSIReqOps reqops_target_command = {
 };
 
 
+/*
+ * Maximum number of freed requests a device keeps around; enough to cover
+ * the queue depth of most HBAs without holding on to a lot of memory.
+ */
+#define SCSI_REQ_POOL_MAX 64
+
 SCSIRequest *scsi_req_alloc(const SCSIReqOps *reqops, SCSIDevice *d,
                             uint32_t tag, uint32_t lun, void *hba_private)
 {
@@ -683,7 +689,13 @@ SCSIRequest *scsi_req_alloc(const SCSIReqOps *reqops, SCSIDevice *d,
     const int memset_off = offsetof(SCSIRequest, sense)
                            + sizeof(req->sense);
 
-    req = g_malloc(reqops->size);
+    req = QTAILQ_FIRST(&d->req_pool);
+    if (req && req->ops->size == reqops->size) {
+        QTAILQ_REMOVE(&d->req_pool, req, next);
+        d->req_pool_len--;
+    } else {
+        req = g_malloc(reqops->size);
+    }
     memset((uint8_t *)req + memset_off, 0, reqops->size - memset_off);
     req->refcount = 1;
     req->bus = bus;
@@ -1360,6 +1372,24 @@ SCSIRequest *scsi_req_ref(SCSIRequest *req)
     return req;
 }
 
+/*
+ * Keep a freed request for reuse by scsi_req_alloc().  The pool only holds
+ * requests of one size, which in practice is that of the device's own
+ * request type.
+ */
+static void scsi_req_pool_put(SCSIDevice *d, SCSIRequest *req)
+{
+    SCSIRequest *first = QTAILQ_FIRST(&d->req_pool);
+
+    if (d->req_pool_len < SCSI_REQ_POOL_MAX &&
+        (!first || first->ops->size == req->ops->size)) {
+        QTAILQ_INSERT_HEAD(&d->req_pool, req, next);
+        d->req_pool_len++;
+    } else {
+        g_free(req);
+    }
+}
+
 void scsi_req_unref(SCSIRequest *req)
 {
     assert(req->refcount > 0);
@@ -1373,9 +1403,9 @@ void scsi_req_unref(SCSIRequest *req)
         if (req->ops->free_req) {
             req->ops->free_req(req);
         }
+        scsi_req_pool_put(req->dev, req);
         object_unref(OBJECT(req->dev));
         object_unref(OBJECT(qbus->parent));
-        g_free(req);
     }
 }
 
@@ -1812,6 +1842,17 @@ static void scsi_dev_instance_init(Object *obj)
     device_add_bootindex_property(obj, &s->conf.bootindex,
                                   "bootindex", NULL,
                                   &s->qdev);
+    QTAILQ_INIT(&s->req_pool);
+}
+
+static void scsi_dev_instance_finalize(Object *obj)
+{
+    SCSIDevice *s = SCSI_DEVICE(obj);
+    SCSIRequest *req, *next_req;
+
+    QTAILQ_FOREACH_SAFE(req, &s->req_pool, next, next_req) {
+        g_free(req);
+    }
 }
 
 static const TypeInfo scsi_device_type_info = {
@@ -1822,6 +1863,7 @@ static const TypeInfo scsi_device_type_info = {
     .class_size = sizeof(SCSIDeviceClass),
     .class_init = scsi_device_class_init,
     .instance_init = scsi_dev_instance_init,
+    .instance_finalize = scsi_dev_instance_finalize,
 };
 
 static void scsi_bus_class_init(ObjectClass *klass, void *data)
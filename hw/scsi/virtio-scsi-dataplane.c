@@ -28,8 +28,15 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
-    if (vs->conf.iothread) {
+    if (vs->conf.iothread && vs->conf.iothread_vq_mapping) {
+        error_setg(errp, "iothread and iothread-vq-mapping properties "
+                   "cannot be set at the same time");
+        return;
+    }
+
+    if (vs->conf.iothread || vs->conf.iothread_vq_mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -40,13 +47,73 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
             error_setg(errp, "ioeventfd is required for iothread");
             return;
         }
+    }
+
+    if (vs->conf.iothread) {
         s->ctx = iothread_get_aio_context(vs->conf.iothread);
+    } else if (vs->conf.iothread_vq_mapping) {
+        s->iothreads = iothread_parse_vq_mapping(
+            vs->conf.iothread_vq_mapping, &s->num_iothreads, errp);
+        if (!s->iothreads) {
+            return;
+        }
+        for (i = 0; i < s->num_iothreads; i++) {
+            object_ref(OBJECT(s->iothreads[i]));
+        }
+        s->ctx = iothread_get_aio_context(s->iothreads[0]);
     } else {
         if (!virtio_device_ioeventfd_enabled(vdev)) {
             return;
         }
         s->ctx = qemu_get_aio_context();
     }
+
+    s->cmd_vq_aio_context = g_new(AioContext *, vs->conf.num_queues);
+    for (i = 0; i < vs->conf.num_queues; i++) {
+        s->cmd_vq_aio_context[i] = s->iothreads ?
+            iothread_get_aio_context(s->iothreads[i % s->num_iothreads]) :
+            s->ctx;
+    }
+}
+
+/* Context: QEMU global mutex held */
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s)
+{
+    unsigned i;
+
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
+    }
+    g_free(s->iothreads);
+    s->iothreads = NULL;
+    s->num_iothreads = 0;
+    g_free(s->cmd_vq_aio_context);
+    s->cmd_vq_aio_context = NULL;
+}
+
+/*
+ * Keep the guest from submitting requests through the command queues of the
+ * IOThreads other than the one of s->ctx, which is quiesced by its users.
+ *
+ * Context: QEMU global mutex held
+ */
+void virtio_scsi_dataplane_disable_external(VirtIOSCSI *s)
+{
+    unsigned i;
+
+    for (i = 1; i < s->num_iothreads; i++) {
+        aio_disable_external(iothread_get_aio_context(s->iothreads[i]));
+    }
+}
+
+/* Context: QEMU global mutex held */
+void virtio_scsi_dataplane_enable_external(VirtIOSCSI *s)
+{
+    unsigned i;
+
+    for (i = 1; i < s->num_iothreads; i++) {
+        aio_enable_external(iothread_get_aio_context(s->iothreads[i]));
+    }
 }
 
 static bool virtio_scsi_data_plane_handle_cmd(VirtIODevice *vdev,
@@ -111,17 +178,28 @@ static int virtio_scsi_set_host_notifier(VirtIOSCSI *s, VirtQueue *vq, int n)
     return 0;
 }
 
-/* Context: BH in IOThread */
+/*
+ * Stop notifications for new requests from guest, for the virtqueues
+ * processed by the current IOThread.
+ *
+ * Context: BH in IOThread
+ */
 static void virtio_scsi_dataplane_stop_bh(void *opaque)
 {
     VirtIOSCSI *s = opaque;
     VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    AioContext *ctx = qemu_get_current_aio_context();
     int i;
 
-    virtio_queue_aio_set_host_notifier_handler(vs->ctrl_vq, s->ctx, NULL);
-    virtio_queue_aio_set_host_notifier_handler(vs->event_vq, s->ctx, NULL);
+    if (ctx == s->ctx) {
+        virtio_queue_aio_set_host_notifier_handler(vs->ctrl_vq, ctx, NULL);
+        virtio_queue_aio_set_host_notifier_handler(vs->event_vq, ctx, NULL);
+    }
     for (i = 0; i < vs->conf.num_queues; i++) {
-        virtio_queue_aio_set_host_notifier_handler(vs->cmd_vqs[i], s->ctx, NULL);
+        if (s->cmd_vq_aio_context[i] == ctx) {
+            virtio_queue_aio_set_host_notifier_handler(vs->cmd_vqs[i], ctx,
+                                                       NULL);
+        }
     }
 }
 
@@ -181,6 +259,19 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
 
     memory_region_transaction_commit();
 
+    for (i = 0; i < vs->conf.num_queues; i++) {
+        AioContext *ctx = s->cmd_vq_aio_context[i];
+
+        if (ctx == s->ctx) {
+            continue;
+        }
+
+        aio_context_acquire(ctx);
+        virtio_queue_aio_set_host_notifier_handler(vs->cmd_vqs[i], ctx,
+                                             virtio_scsi_data_plane_handle_cmd);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
     virtio_queue_aio_set_host_notifier_handler(vs->ctrl_vq, s->ctx,
                                             virtio_scsi_data_plane_handle_ctrl);
@@ -188,8 +279,10 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
                                            virtio_scsi_data_plane_handle_event);
 
     for (i = 0; i < vs->conf.num_queues; i++) {
-        virtio_queue_aio_set_host_notifier_handler(vs->cmd_vqs[i], s->ctx,
+        if (s->cmd_vq_aio_context[i] == s->ctx) {
+            virtio_queue_aio_set_host_notifier_handler(vs->cmd_vqs[i], s->ctx,
                                              virtio_scsi_data_plane_handle_cmd);
+        }
     }
 
     s->dataplane_starting = false;
@@ -240,6 +333,14 @@ void virtio_scsi_dataplane_stop(VirtIODevice *vdev)
     }
     s->dataplane_stopping = true;
 
+    for (i = 1; i < s->num_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->iothreads[i]);
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_scsi_dataplane_stop_bh, s);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
     aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
     aio_context_release(s->ctx);
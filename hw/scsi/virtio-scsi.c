@@ -935,7 +935,9 @@ static void virtio_scsi_hotunplug(HotplugHandler *hotplug_dev, DeviceState *dev,
     }
 
     aio_disable_external(ctx);
+    virtio_scsi_dataplane_disable_external(s);
     qdev_simple_device_unplug_cb(hotplug_dev, dev, errp);
+    virtio_scsi_dataplane_enable_external(s);
     aio_enable_external(ctx);
 
     if (s->ctx) {
@@ -1048,6 +1050,7 @@ static void virtio_scsi_device_unrealize(DeviceState *dev)
 
     qbus_set_hotplug_handler(BUS(&s->bus), NULL);
     virtio_scsi_common_unrealize(dev);
+    virtio_scsi_dataplane_cleanup(s);
 }
 
 static Property virtio_scsi_properties[] = {
@@ -1067,6 +1070,8 @@ static Property virtio_scsi_properties[] = {
                                                 VIRTIO_SCSI_F_CHANGE, true),
     DEFINE_PROP_LINK("iothread", VirtIOSCSI, parent_obj.conf.iothread,
                      TYPE_IOTHREAD, IOThread *),
+    DEFINE_PROP_STRING("iothread-vq-mapping", VirtIOSCSI,
+                       parent_obj.conf.iothread_vq_mapping),
     DEFINE_PROP_END_OF_LIST(),
 };
 
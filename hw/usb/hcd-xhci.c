@@ -665,11 +665,51 @@ static void xhci_event(XHCIState *xhci, XHCIEvent *event, int v)
     xhci_intr_raise(xhci, v);
 }
 
+/*
+ * Drop the TRBs read ahead from the ring.  This must be done whenever the
+ * driver may have rewritten TRBs that it had handed to the controller,
+ * i.e. whenever processing of the ring starts anew.
+ */
+static void xhci_ring_invalidate(XHCIRing *ring)
+{
+    ring->cache_len = 0;
+}
+
 static void xhci_ring_init(XHCIState *xhci, XHCIRing *ring,
                            dma_addr_t base)
 {
     ring->dequeue = base;
     ring->ccs = 1;
+    xhci_ring_invalidate(ring);
+}
+
+/*
+ * Read the TRB at @addr.  TRBs are read ahead so that walking a ring costs
+ * one DMA per XHCI_RING_PREFETCH_SIZE bytes rather than one per TRB.  The
+ * read-ahead stops at a 4 KiB boundary, as ring segments are allocated in
+ * pages and nothing says that the memory after them is mapped.
+ */
+static void xhci_ring_read_trb(XHCIState *xhci, XHCIRing *ring,
+                               dma_addr_t addr, XHCITRB *trb)
+{
+    dma_addr_t offset = addr - ring->cache_addr;
+    unsigned int len;
+
+    if (addr >= ring->cache_addr && offset + TRB_SIZE <= ring->cache_len) {
+        memcpy(trb, ring->cache + offset, TRB_SIZE);
+        return;
+    }
+
+    len = MIN(XHCI_RING_PREFETCH_SIZE, 0x1000 - (addr & 0xfff));
+    ring->cache_len = 0;
+    if (len < TRB_SIZE ||
+        dma_memory_read(xhci->as, addr, ring->cache, len) != MEMTX_OK) {
+        dma_memory_read(xhci->as, addr, trb, TRB_SIZE);
+        return;
+    }
+    ring->cache_addr = addr;
+    ring->cache_len = len;
+    memcpy(trb, ring->cache, TRB_SIZE);
 }
 
 static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
@@ -679,7 +719,7 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
 
     while (1) {
         TRBType type;
-        dma_memory_read(xhci->as, ring->dequeue, trb, TRB_SIZE);
+        xhci_ring_read_trb(xhci, ring, ring->dequeue, trb);
         trb->addr = ring->dequeue;
         trb->ccs = ring->ccs;
         le64_to_cpus(&trb->parameter);
@@ -710,11 +750,13 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
             if (trb->control & TRB_LK_TC) {
                 ring->ccs = !ring->ccs;
             }
+            /* The TRBs at the target may have been completed and reused */
+            xhci_ring_invalidate(ring);
         }
     }
 }
 
-static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
+static int xhci_ring_chain_length(XHCIState *xhci, XHCIRing *ring)
 {
     XHCITRB trb;
     int length = 0;
@@ -726,7 +768,7 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
 
     while (1) {
         TRBType type;
-        dma_memory_read(xhci->as, dequeue, &trb, TRB_SIZE);
+        xhci_ring_read_trb(xhci, ring, dequeue, &trb);
         le64_to_cpus(&trb.parameter);
         le32_to_cpus(&trb.status);
         le32_to_cpus(&trb.control);
@@ -745,6 +787,7 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
             if (trb.control & TRB_LK_TC) {
                 ccs = !ccs;
             }
+            xhci_ring_invalidate(ring);
             continue;
         }
 
@@ -1387,6 +1430,21 @@ static TRBCCode xhci_set_ep_dequeue(XHCIState *xhci, unsigned int slotid,
     return CC_SUCCESS;
 }
 
+/* Add a buffer to the transfer, merging it with the previous one if adjacent */
+static void xhci_xfer_sglist_add(XHCITransfer *xfer, dma_addr_t addr,
+                                 dma_addr_t len)
+{
+    QEMUSGList *sgl = &xfer->sgl;
+
+    if (sgl->nsg && sgl->sg[sgl->nsg - 1].base +
+                    sgl->sg[sgl->nsg - 1].len == addr) {
+        sgl->sg[sgl->nsg - 1].len += len;
+        sgl->size += len;
+        return;
+    }
+    qemu_sglist_add(sgl, addr, len);
+}
+
 static int xhci_xfer_create_sgl(XHCITransfer *xfer, int in_xfer)
 {
     XHCIState *xhci = xfer->epctx->xhci;
@@ -1419,9 +1477,9 @@ static int xhci_xfer_create_sgl(XHCITransfer *xfer, int in_xfer)
                     DPRINTF("xhci: invalid immediate data TRB\n");
                     goto err;
                 }
-                qemu_sglist_add(&xfer->sgl, trb->addr, chunk);
+                xhci_xfer_sglist_add(xfer, trb->addr, chunk);
             } else {
-                qemu_sglist_add(&xfer->sgl, addr, chunk);
+                xhci_xfer_sglist_add(xfer, addr, chunk);
             }
             break;
         }
@@ -1539,10 +1597,12 @@ static void xhci_stall_ep(XHCITransfer *xfer)
         }
         sctx->ring.dequeue = xfer->trbs[0].addr;
         sctx->ring.ccs = xfer->trbs[0].ccs;
+        xhci_ring_invalidate(&sctx->ring);
         xhci_set_ep_state(xhci, epctx, sctx, EP_HALTED);
     } else {
         epctx->ring.dequeue = xfer->trbs[0].addr;
         epctx->ring.ccs = xfer->trbs[0].ccs;
+        xhci_ring_invalidate(&epctx->ring);
         xhci_set_ep_state(xhci, epctx, NULL, EP_HALTED);
     }
 }
@@ -1912,6 +1972,7 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
         return;
     }
 
+    xhci_ring_invalidate(ring);
     epctx->kick_active++;
     while (1) {
         length = xhci_ring_chain_length(xhci, ring);
@@ -2434,6 +2495,7 @@ static void xhci_process_commands(XHCIState *xhci)
 
     xhci->crcr_low |= CRCR_CRR;
 
+    xhci_ring_invalidate(&xhci->cmd_ring);
     while ((type = xhci_ring_fetch(xhci, &xhci->cmd_ring, &trb, &addr))) {
         event.ptr = addr;
         switch (type) {
@@ -117,9 +117,16 @@ typedef enum TRBCCode {
     CC_SPLIT_TRANSACTION_ERROR
 } TRBCCode;
 
+/* Bytes of TRBs read ahead from a ring at once (16 TRBs) */
+#define XHCI_RING_PREFETCH_SIZE 256
+
 typedef struct XHCIRing {
     dma_addr_t dequeue;
     bool ccs;
+    /* TRBs read ahead from cache_addr, cache_len bytes; not migrated */
+    dma_addr_t cache_addr;
+    unsigned int cache_len;
+    uint8_t cache[XHCI_RING_PREFETCH_SIZE];
 } XHCIRing;
 
 typedef struct XHCIPort {
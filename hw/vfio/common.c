@@ -33,13 +33,17 @@
 #include "hw/hw.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/module.h"
 #include "qemu/range.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
 #include "sysemu/kvm.h"
 #include "sysemu/reset.h"
 #include "sysemu/runstate.h"
 #include "trace.h"
 #include "qapi/error.h"
 #include "migration/migration.h"
+#include "monitor/stats.h"
 
 VFIOGroupList vfio_group_list =
     QLIST_HEAD_INITIALIZER(vfio_group_list);
@@ -520,6 +524,41 @@ static int vfio_dma_map(VFIOContainer *container, hwaddr iova,
     return -errno;
 }
 
+/*
+ * Pinning a large section in VFIO_IOMMU_MAP_DMA faults in every page from
+ * a single thread, with the container lock held.  Populate big sections
+ * from several threads first, so that the kernel only has to pin them.
+ */
+#define VFIO_DMA_PREFAULT_MIN_SIZE      (1 * GiB)
+#define VFIO_DMA_PREFAULT_MAX_THREADS   16
+
+static void vfio_dma_prefault(MemoryRegion *mr, void *vaddr, ram_addr_t size)
+{
+    Error *local_err = NULL;
+
+    if (size < VFIO_DMA_PREFAULT_MIN_SIZE) {
+        return;
+    }
+
+    /*
+     * Touching the pages by hand would write back their old contents,
+     * racing with the guest if it is running.  MADV_POPULATE_WRITE does
+     * not have that problem, so only prefault if it is available.
+     */
+    if (qemu_madvise(vaddr, qemu_real_host_page_size,
+                     QEMU_MADV_POPULATE_WRITE)) {
+        return;
+    }
+
+    trace_vfio_dma_prefault(memory_region_name(mr), vaddr, size);
+    os_mem_prealloc(memory_region_get_fd(mr), vaddr, size,
+                    VFIO_DMA_PREFAULT_MAX_THREADS, NULL, false, &local_err);
+    if (local_err) {
+        /* Not fatal, VFIO_IOMMU_MAP_DMA reports the real failure if any */
+        warn_report_err(local_err);
+    }
+}
+
 static void vfio_host_win_add(VFIOContainer *container,
                               hwaddr min_iova, hwaddr max_iova,
                               uint64_t iova_pgsizes)
@@ -571,9 +610,15 @@ static bool vfio_listener_skipped_section(MemoryRegionSection *section)
            section->offset_within_address_space & (1ULL << 63);
 }
 
-/* Called with rcu_read_lock held.  */
+/*
+ * Called with rcu_read_lock held.  If @plen is not NULL, the entry may
+ * span several memory regions, for example when the vIOMMU coalesced
+ * contiguous pages, and *@plen is set to the length of the part that
+ * is in the first one.
+ */
 static bool vfio_get_xlat_addr(IOMMUTLBEntry *iotlb, void **vaddr,
-                               ram_addr_t *ram_addr, bool *read_only)
+                               ram_addr_t *ram_addr, bool *read_only,
+                               hwaddr *plen)
 {
     MemoryRegion *mr;
     hwaddr xlat;
@@ -637,7 +682,9 @@ static bool vfio_get_xlat_addr(IOMMUTLBEntry *iotlb, void **vaddr,
      * Translation truncates length to the IOMMU page size,
      * check that it did not truncate too much.
      */
-    if (len & iotlb->addr_mask) {
+    if (plen) {
+        *plen = len;
+    } else if (len & iotlb->addr_mask) {
         error_report("iommu has granularity incompatible with target AS");
         return false;
     }
@@ -677,28 +724,38 @@ static void vfio_iommu_map_notify(IOMMUNotifier *n, IOMMUTLBEntry *iotlb)
     rcu_read_lock();
 
     if ((iotlb->perm & IOMMU_RW) != IOMMU_NONE) {
+        IOMMUTLBEntry part = *iotlb;
+        hwaddr done = 0, len;
         bool read_only;
 
-        if (!vfio_get_xlat_addr(iotlb, &vaddr, NULL, &read_only)) {
-            goto out;
-        }
+        /* Map the range with one ioctl for each memory region it spans */
+        do {
+            part.translated_addr = iotlb->translated_addr + done;
+            part.addr_mask = iotlb->addr_mask - done;
+            if (!vfio_get_xlat_addr(&part, &vaddr, NULL, &read_only, &len)) {
+                goto out;
+            }
+            /*
+             * vaddr is only valid until rcu_read_unlock(). But after
+             * vfio_dma_map has set up the mapping the pages will be
+             * pinned by the kernel. This makes sure that the RAM backend
+             * of vaddr will always be there, even if the memory object is
+             * destroyed and its backing memory munmap-ed.
+             */
+            ret = vfio_dma_map(container, iova + done, len, vaddr,
+                               read_only);
+            if (ret) {
+                error_report("vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
+                             "0x%"HWADDR_PRIx", %p) = %d (%m)",
+                             container, iova + done, len, vaddr, ret);
+            }
+            done += len;
+        } while (done <= iotlb->addr_mask);
+    } else {
         /*
-         * vaddr is only valid until rcu_read_unlock(). But after
-         * vfio_dma_map has set up the mapping the pages will be
-         * pinned by the kernel. This makes sure that the RAM backend
-         * of vaddr will always be there, even if the memory object is
-         * destroyed and its backing memory munmap-ed.
+         * A single ioctl unmaps all the mappings in the range, as long
+         * as none of them is only partly inside it.
          */
-        ret = vfio_dma_map(container, iova,
-                           iotlb->addr_mask + 1, vaddr,
-                           read_only);
-        if (ret) {
-            error_report("vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
-                         "0x%"HWADDR_PRIx", %p) = %d (%m)",
-                         container, iova,
-                         iotlb->addr_mask + 1, vaddr, ret);
-        }
-    } else {
         ret = vfio_dma_unmap(container, iova, iotlb->addr_mask + 1, iotlb);
         if (ret) {
             error_report("vfio_dma_unmap(%p, 0x%"HWADDR_PRIx", "
@@ -1051,6 +1108,10 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
+    if (!memory_region_is_ram_device(section->mr) && !section->readonly) {
+        vfio_dma_prefault(section->mr, vaddr, int128_get64(llsize));
+    }
+
     ret = vfio_dma_map(container, iova, int128_get64(llsize),
                        vaddr, section->readonly);
     if (ret) {
@@ -1247,6 +1308,7 @@ static int vfio_get_dirty_bitmap(VFIOContainer *container, uint64_t iova,
 {
     struct vfio_iommu_type1_dirty_bitmap *dbitmap;
     struct vfio_iommu_type1_dirty_bitmap_get *range;
+    int64_t start_ns = get_clock();
     uint64_t pages;
     int ret;
 
@@ -1285,9 +1347,25 @@ static int vfio_get_dirty_bitmap(VFIOContainer *container, uint64_t iova,
     cpu_physical_memory_set_dirty_lebitmap((unsigned long *)range->bitmap.data,
                                             ram_addr, pages);
 
+    /* The bitmap is a multiple of 64 bits, and zero past the last page */
+    container->dirty_pages +=
+        bitmap_count_one((unsigned long *)range->bitmap.data,
+                         range->bitmap.size * BITS_PER_BYTE);
+    container->dirty_syncs++;
+    container->dirty_sync_ns += get_clock() - start_ns;
+
     trace_vfio_get_dirty_bitmap(container->fd, range->iova, range->size,
                                 range->bitmap.size, ram_addr);
 err_out:
+    if (ret) {
+        /*
+         * Without a bitmap there is no telling what the device wrote to,
+         * so send the whole range again rather than risk losing pages.
+         */
+        cpu_physical_memory_set_dirty_range(ram_addr,
+                                            pages * qemu_real_host_page_size,
+                                            DIRTY_CLIENTS_NOCODE);
+    }
     g_free(range->bitmap.data);
     g_free(dbitmap);
 
@@ -1306,7 +1384,10 @@ static void vfio_iommu_map_dirty_notify(IOMMUNotifier *n, IOMMUTLBEntry *iotlb)
     VFIOGuestIOMMU *giommu = gdn->giommu;
     VFIOContainer *container = giommu->container;
     hwaddr iova = iotlb->iova + giommu->iommu_offset;
+    IOMMUTLBEntry part = *iotlb;
     ram_addr_t translated_addr;
+    hwaddr done = 0, len;
+    int ret;
 
     trace_vfio_iommu_map_dirty_notify(iova, iova + iotlb->addr_mask);
 
@@ -1317,18 +1398,23 @@ static void vfio_iommu_map_dirty_notify(IOMMUNotifier *n, IOMMUTLBEntry *iotlb)
     }
 
     rcu_read_lock();
-    if (vfio_get_xlat_addr(iotlb, NULL, &translated_addr, NULL)) {
-        int ret;
+    /* Like the mappings, the range may span several memory regions */
+    do {
+        part.translated_addr = iotlb->translated_addr + done;
+        part.addr_mask = iotlb->addr_mask - done;
+        if (!vfio_get_xlat_addr(&part, NULL, &translated_addr, NULL, &len)) {
+            break;
+        }
 
-        ret = vfio_get_dirty_bitmap(container, iova, iotlb->addr_mask + 1,
+        ret = vfio_get_dirty_bitmap(container, iova + done, len,
                                     translated_addr);
         if (ret) {
             error_report("vfio_iommu_map_dirty_notify(%p, 0x%"HWADDR_PRIx", "
                          "0x%"HWADDR_PRIx") = %d (%m)",
-                         container, iova,
-                         iotlb->addr_mask + 1, ret);
+                         container, iova + done, len, ret);
         }
-    }
+        done += len;
+    } while (done <= iotlb->addr_mask);
     rcu_read_unlock();
 }
 
@@ -2577,3 +2663,114 @@ int vfio_eeh_as_op(AddressSpace *as, uint32_t op)
     }
     return vfio_eeh_container_op(container, op);
 }
+
+static StatsList *vfio_stats_add_scalar(StatsList *stats_list,
+                                        const char *name, uint64_t value)
+{
+    Stats *stats = g_new0(Stats, 1);
+
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+
+    QAPI_LIST_PREPEND(stats_list, stats);
+    return stats_list;
+}
+
+static void vfio_stats_add_device(StatsResultList **result, strList *names,
+                                  strList *targets, VFIOContainer *container,
+                                  VFIODevice *vbasedev)
+{
+    g_autofree char *qom_path = NULL;
+    StatsList *stats_list = NULL;
+
+    if (!vbasedev->dev) {
+        return;
+    }
+    qom_path = object_get_canonical_path(OBJECT(vbasedev->dev));
+    if (!apply_str_list_filter(qom_path, targets)) {
+        return;
+    }
+
+    if (apply_str_list_filter("dirty-sync-time", names)) {
+        stats_list = vfio_stats_add_scalar(stats_list, "dirty-sync-time",
+                                           container->dirty_sync_ns);
+    }
+    if (apply_str_list_filter("dirty-syncs", names)) {
+        stats_list = vfio_stats_add_scalar(stats_list, "dirty-syncs",
+                                           container->dirty_syncs);
+    }
+    if (apply_str_list_filter("dirty-pages", names)) {
+        stats_list = vfio_stats_add_scalar(stats_list, "dirty-pages",
+                                           container->dirty_pages);
+    }
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_VFIO, qom_path, stats_list);
+    }
+}
+
+/* Called with the BQL held, which keeps containers from going away */
+static void vfio_stats_cb(StatsResultList **result, StatsTarget target,
+                          strList *names, strList *targets, Error **errp)
+{
+    VFIOAddressSpace *space;
+    VFIOContainer *container;
+    VFIOGroup *group;
+    VFIODevice *vbasedev;
+
+    if (target != STATS_TARGET_VFIO_DEVICE) {
+        return;
+    }
+
+    QLIST_FOREACH(space, &vfio_address_spaces, list) {
+        QLIST_FOREACH(container, &space->containers, next) {
+            QLIST_FOREACH(group, &container->group_list, container_next) {
+                QLIST_FOREACH(vbasedev, &group->device_list, next) {
+                    vfio_stats_add_device(result, names, targets,
+                                          container, vbasedev);
+                }
+            }
+        }
+    }
+}
+
+static StatsSchemaValueList *vfio_stats_add_schema(StatsSchemaValueList *list,
+                                                   const char *name,
+                                                   bool nanoseconds)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = STATS_TYPE_CUMULATIVE;
+    if (nanoseconds) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+    }
+
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void vfio_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+
+    stats_list = vfio_stats_add_schema(stats_list, "dirty-sync-time", true);
+    stats_list = vfio_stats_add_schema(stats_list, "dirty-syncs", false);
+    stats_list = vfio_stats_add_schema(stats_list, "dirty-pages", false);
+    add_stats_schema(result, STATS_PROVIDER_VFIO,
+                     STATS_TARGET_VFIO_DEVICE, stats_list);
+}
+
+static void vfio_register_stats(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_VFIO, vfio_stats_cb,
+                        vfio_stats_schemas_cb);
+}
+
+type_init(vfio_register_stats)
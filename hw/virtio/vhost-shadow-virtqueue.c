@@ -0,0 +1,389 @@
+/*
+ * vhost shadow virtqueue
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qapi/error.h"
+#include "hw/virtio/vhost-shadow-virtqueue.h"
+#include "trace.h"
+
+size_t vhost_svq_driver_area_size(unsigned int num)
+{
+    size_t desc_size = sizeof(vring_desc_t) * num;
+    /* flags, idx, ring[num] and used_event */
+    size_t avail_size = sizeof(uint16_t) * (3 + num);
+
+    return ROUND_UP(desc_size + avail_size, qemu_real_host_page_size);
+}
+
+size_t vhost_svq_device_area_size(unsigned int num)
+{
+    /* flags, idx, ring[num] and avail_event */
+    size_t used_size = sizeof(uint16_t) * 3 + sizeof(vring_used_elem_t) * num;
+
+    return ROUND_UP(used_size, qemu_real_host_page_size);
+}
+
+bool vhost_svq_started(const VhostShadowVirtqueue *svq)
+{
+    return svq->vq != NULL;
+}
+
+static void vhost_svq_kick_device(VhostShadowVirtqueue *svq)
+{
+    /* Make the new avail idx visible before reading the used flags */
+    smp_mb();
+    if (le16_to_cpu(svq->vring.used->flags) & VRING_USED_F_NO_NOTIFY) {
+        return;
+    }
+
+    event_notifier_set(&svq->hdev_kick);
+}
+
+/* Chain the guest buffers of @elem in free descriptors of the vring */
+static void vhost_svq_add(VhostShadowVirtqueue *svq, VirtQueueElement *elem)
+{
+    vring_desc_t *descs = svq->vring.desc;
+    unsigned int num = elem->out_num + elem->in_num;
+    uint16_t head = svq->free_head;
+    uint16_t i = head;
+    unsigned int n;
+
+    assert(num && num <= svq->num_free);
+
+    /* Device-readable buffers go first */
+    for (n = 0; n < num; n++) {
+        bool write = n >= elem->out_num;
+        hwaddr addr = write ? elem->in_addr[n - elem->out_num] :
+                              elem->out_addr[n];
+        size_t len = write ? elem->in_sg[n - elem->out_num].iov_len :
+                             elem->out_sg[n].iov_len;
+        uint16_t flags = write ? VRING_DESC_F_WRITE : 0;
+
+        if (n + 1 < num) {
+            flags |= VRING_DESC_F_NEXT;
+        }
+        descs[i].addr = cpu_to_le64(addr);
+        descs[i].len = cpu_to_le32(len);
+        descs[i].flags = cpu_to_le16(flags);
+        /* The free list links double as the chain */
+        i = le16_to_cpu(descs[i].next);
+    }
+
+    svq->free_head = i;
+    svq->num_free -= num;
+    svq->ring_id_maps[head] = elem;
+
+    svq->vring.avail->ring[svq->shadow_avail_idx % svq->vring.num] =
+        cpu_to_le16(head);
+    svq->shadow_avail_idx++;
+
+    /* Descriptors and ring entry before the idx that publishes them */
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+}
+
+/* Forward the buffers the guest made available to the device */
+static void vhost_svq_process_avail(VhostShadowVirtqueue *svq)
+{
+    bool added = false;
+
+    do {
+        virtio_queue_set_notification(svq->vq, false);
+
+        for (;;) {
+            VirtQueueElement *elem = svq->next_guest_avail_elem;
+
+            svq->next_guest_avail_elem = NULL;
+            if (!elem) {
+                elem = virtqueue_pop(svq->vq, sizeof(*elem));
+                if (!elem) {
+                    break;
+                }
+            }
+
+            if (elem->out_num + elem->in_num > svq->vring.num) {
+                virtio_error(svq->vdev, "shadow virtqueue: element with %u "
+                             "buffers does not fit a vring of %u",
+                             elem->out_num + elem->in_num, svq->vring.num);
+                virtqueue_detach_element(svq->vq, elem, 0);
+                g_free(elem);
+                goto out;
+            }
+            if (elem->out_num + elem->in_num > svq->num_free) {
+                /*
+                 * Resumed when the device uses buffers.  Guest kicks are
+                 * left disabled until then.
+                 */
+                svq->next_guest_avail_elem = elem;
+                goto out;
+            }
+
+            vhost_svq_add(svq, elem);
+            added = true;
+        }
+
+        virtio_queue_set_notification(svq->vq, true);
+    } while (!virtio_queue_empty(svq->vq));
+
+out:
+    if (added) {
+        vhost_svq_kick_device(svq);
+    }
+}
+
+static void vhost_svq_handle_kick(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             svq_kick);
+
+    event_notifier_test_and_clear(n);
+    trace_vhost_svq_handle_kick(svq);
+    vhost_svq_process_avail(svq);
+}
+
+static void vhost_svq_notify_guest(VhostShadowVirtqueue *svq)
+{
+    WITH_RCU_READ_LOCK_GUARD() {
+        if (!virtio_should_notify(svq->vdev, svq->vq)) {
+            return;
+        }
+    }
+
+    if (svq->svq_call_set) {
+        event_notifier_set(&svq->svq_call);
+    }
+}
+
+/* Return the descriptor chain starting at @head to the free list */
+static void vhost_svq_free_chain(VhostShadowVirtqueue *svq, uint16_t head,
+                                 unsigned int num)
+{
+    vring_desc_t *descs = svq->vring.desc;
+    uint16_t last = head;
+    unsigned int n;
+
+    for (n = 1; n < num; n++) {
+        last = le16_to_cpu(descs[last].next);
+    }
+    descs[last].next = cpu_to_le16(svq->free_head);
+    svq->free_head = head;
+    svq->num_free += num;
+}
+
+/*
+ * Return the buffers used by the device to the guest.  Filling the guest
+ * element unmaps its buffers, which marks what the device wrote as dirty.
+ */
+static unsigned int vhost_svq_flush(VhostShadowVirtqueue *svq)
+{
+    unsigned int count = 0;
+
+    RCU_READ_LOCK_GUARD();
+
+    while (svq->last_used_idx != le16_to_cpu(svq->vring.used->idx)) {
+        vring_used_elem_t used;
+        VirtQueueElement *elem;
+        uint32_t id;
+
+        /* Used ring entry after the idx that published it */
+        smp_rmb();
+        used = svq->vring.used->ring[svq->last_used_idx % svq->vring.num];
+        id = le32_to_cpu(used.id);
+        elem = id < svq->vring.num ? svq->ring_id_maps[id] : NULL;
+        if (!elem) {
+            virtio_error(svq->vdev, "shadow virtqueue: device used "
+                         "descriptor %u, which was not available", id);
+            break;
+        }
+
+        svq->ring_id_maps[id] = NULL;
+        svq->last_used_idx++;
+        vhost_svq_free_chain(svq, id, elem->out_num + elem->in_num);
+
+        virtqueue_fill(svq->vq, elem, le32_to_cpu(used.len), count++);
+        g_free(elem);
+    }
+
+    if (count) {
+        virtqueue_flush(svq->vq, count);
+    }
+    return count;
+}
+
+static void vhost_svq_handle_call(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             hdev_call);
+    unsigned int count;
+
+    event_notifier_test_and_clear(n);
+    count = vhost_svq_flush(svq);
+    trace_vhost_svq_handle_call(svq, count);
+    if (count) {
+        vhost_svq_notify_guest(svq);
+    }
+
+    /* Descriptors were freed, retry what did not fit */
+    if (svq->next_guest_avail_elem) {
+        vhost_svq_process_avail(svq);
+    }
+}
+
+void vhost_svq_set_guest_kick_fd(VhostShadowVirtqueue *svq, int fd)
+{
+    assert(vhost_svq_started(svq));
+
+    if (event_notifier_get_fd(&svq->svq_kick) >= 0) {
+        event_notifier_set_handler(&svq->svq_kick, NULL);
+    }
+    event_notifier_init_fd(&svq->svq_kick, fd);
+    if (fd < 0) {
+        return;
+    }
+
+    event_notifier_set_handler(&svq->svq_kick, vhost_svq_handle_kick);
+    /* Pick up the buffers that were made available before shadowing */
+    event_notifier_set(&svq->svq_kick);
+}
+
+void vhost_svq_set_guest_call_fd(VhostShadowVirtqueue *svq, int fd)
+{
+    svq->svq_call_set = fd >= 0;
+    event_notifier_init_fd(&svq->svq_call, fd);
+}
+
+/*
+ * Start shadowing @vq.  @driver_area and @device_area must be sized with
+ * vhost_svq_driver_area_size() and vhost_svq_device_area_size() for the
+ * queue size, and be accessible by the device.
+ */
+void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
+                     VirtQueue *vq, void *driver_area, void *device_area)
+{
+    unsigned int num = virtio_queue_get_num(vdev, virtio_get_queue_index(vq));
+    unsigned int i;
+
+    assert(!vhost_svq_started(svq));
+
+    memset(driver_area, 0, vhost_svq_driver_area_size(num));
+    memset(device_area, 0, vhost_svq_device_area_size(num));
+    svq->vring.num = num;
+    svq->vring.desc = driver_area;
+    svq->vring.avail = driver_area + sizeof(vring_desc_t) * num;
+    svq->vring.used = device_area;
+
+    for (i = 0; i < num - 1; i++) {
+        svq->vring.desc[i].next = cpu_to_le16(i + 1);
+    }
+    svq->free_head = 0;
+    svq->num_free = num;
+    svq->shadow_avail_idx = 0;
+    svq->last_used_idx = 0;
+    svq->ring_id_maps = g_new0(VirtQueueElement *, num);
+    svq->next_guest_avail_elem = NULL;
+
+    svq->vdev = vdev;
+    svq->vq = vq;
+    event_notifier_init_fd(&svq->svq_kick, -1);
+    event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
+    trace_vhost_svq_start(svq, virtio_get_queue_index(vq), num);
+}
+
+/*
+ * Stop shadowing, with the device already stopped.  The guest gets back
+ * the buffers that the device did not use, with a length of 0, so that
+ * the last avail index of the VirtQueue can be handed to the next owner
+ * of the ring.
+ */
+void vhost_svq_stop(VhostShadowVirtqueue *svq)
+{
+    unsigned int count, i;
+
+    if (!vhost_svq_started(svq)) {
+        return;
+    }
+    trace_vhost_svq_stop(svq);
+
+    if (event_notifier_get_fd(&svq->svq_kick) >= 0) {
+        event_notifier_set_handler(&svq->svq_kick, NULL);
+    }
+    event_notifier_set_handler(&svq->hdev_call, NULL);
+    event_notifier_test_and_clear(&svq->hdev_call);
+
+    count = vhost_svq_flush(svq);
+
+    /* This is the element that was popped last */
+    if (svq->next_guest_avail_elem) {
+        virtqueue_unpop(svq->vq, svq->next_guest_avail_elem, 0);
+        g_free(svq->next_guest_avail_elem);
+        svq->next_guest_avail_elem = NULL;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        unsigned int returned = 0;
+
+        for (i = 0; i < svq->vring.num; i++) {
+            VirtQueueElement *elem = svq->ring_id_maps[i];
+
+            if (elem) {
+                virtqueue_fill(svq->vq, elem, 0, returned++);
+                g_free(elem);
+            }
+        }
+        if (returned) {
+            virtqueue_flush(svq->vq, returned);
+        }
+        count += returned;
+    }
+    if (count) {
+        vhost_svq_notify_guest(svq);
+    }
+
+    g_free(svq->ring_id_maps);
+    svq->ring_id_maps = NULL;
+    svq->vq = NULL;
+    svq->vdev = NULL;
+}
+
+VhostShadowVirtqueue *vhost_svq_new(Error **errp)
+{
+    g_autofree VhostShadowVirtqueue *svq = g_new0(VhostShadowVirtqueue, 1);
+    int r;
+
+    /* The guest call is set before the queue is started */
+    event_notifier_init_fd(&svq->svq_kick, -1);
+    event_notifier_init_fd(&svq->svq_call, -1);
+
+    r = event_notifier_init(&svq->hdev_kick, 0);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "cannot create shadow virtqueue kick");
+        return NULL;
+    }
+
+    r = event_notifier_init(&svq->hdev_call, 0);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "cannot create shadow virtqueue call");
+        event_notifier_cleanup(&svq->hdev_kick);
+        return NULL;
+    }
+
+    return g_steal_pointer(&svq);
+}
+
+void vhost_svq_free(VhostShadowVirtqueue *svq)
+{
+    if (!svq) {
+        return;
+    }
+
+    vhost_svq_stop(svq);
+    event_notifier_cleanup(&svq->hdev_kick);
+    event_notifier_cleanup(&svq->hdev_call);
+    g_free(svq);
+}
@@ -0,0 +1,64 @@
+/*
+ * vhost shadow virtqueue
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef VHOST_SHADOW_VIRTQUEUE_H
+#define VHOST_SHADOW_VIRTQUEUE_H
+
+#include "qemu/event_notifier.h"
+#include "hw/virtio/virtio.h"
+#include "standard-headers/linux/virtio_ring.h"
+
+/*
+ * A split vring owned by QEMU that is handed to the vhost device in place
+ * of the guest's.  Guest buffers are forwarded to it as they become
+ * available, and returned to the guest through the regular VirtQueue
+ * functions when the device uses them.  This marks the memory the device
+ * wrote as dirty for migration.
+ */
+typedef struct VhostShadowVirtqueue {
+    /* Shadow vring, in the device's (little endian) byte order */
+    struct vring vring;
+
+    /* Guest kick, handled by QEMU while the queue is shadowed */
+    EventNotifier svq_kick;
+    /* Guest call, valid if svq_call_set */
+    EventNotifier svq_call;
+    bool svq_call_set;
+
+    /* Notifiers given to the device instead of the guest ones */
+    EventNotifier hdev_kick;
+    EventNotifier hdev_call;
+
+    VirtIODevice *vdev;
+    VirtQueue *vq;
+
+    /* Guest element of each in-flight descriptor chain, by head index */
+    VirtQueueElement **ring_id_maps;
+    /* Element popped from the guest that did not fit in the vring yet */
+    VirtQueueElement *next_guest_avail_elem;
+
+    uint16_t shadow_avail_idx;
+    uint16_t last_used_idx;
+    uint16_t free_head;
+    unsigned int num_free;
+} VhostShadowVirtqueue;
+
+VhostShadowVirtqueue *vhost_svq_new(Error **errp);
+void vhost_svq_free(VhostShadowVirtqueue *svq);
+
+size_t vhost_svq_driver_area_size(unsigned int num);
+size_t vhost_svq_device_area_size(unsigned int num);
+
+void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
+                     VirtQueue *vq, void *driver_area, void *device_area);
+void vhost_svq_stop(VhostShadowVirtqueue *svq);
+bool vhost_svq_started(const VhostShadowVirtqueue *svq);
+
+void vhost_svq_set_guest_kick_fd(VhostShadowVirtqueue *svq, int fd);
+void vhost_svq_set_guest_call_fd(VhostShadowVirtqueue *svq, int fd);
+
+#endif
@@ -23,6 +23,7 @@
 #include "hw/virtio/vhost-user-fs.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
+#include "trace.h"
 
 static const int user_feature_bits[] = {
     VIRTIO_F_VERSION_1,
@@ -30,11 +31,149 @@ static const int user_feature_bits[] = {
     VIRTIO_RING_F_EVENT_IDX,
     VIRTIO_F_NOTIFY_ON_EMPTY,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_NOTIFICATION_DATA,
     VIRTIO_F_IOMMU_PLATFORM,
 
     VHOST_INVALID_FEATURE_BIT
 };
 
+/*
+ * Check that a slave request entry lies within the cache window and is
+ * suitably aligned for mmap.
+ */
+static bool vuf_check_cache_range(VHostUserFS *fs, uint64_t c_offset,
+                                  uint64_t len)
+{
+    uint64_t page_mask = qemu_real_host_page_size - 1;
+
+    return !(c_offset & page_mask) && !(len & page_mask) &&
+           c_offset < fs->conf.cache_size &&
+           len <= fs->conf.cache_size - c_offset;
+}
+
+/* Replace a part of the cache window with inaccessible anonymous memory */
+static int vuf_cache_clear(VHostUserFS *fs, uint64_t c_offset, uint64_t len)
+{
+    void *cache_host = memory_region_get_ram_ptr(&fs->cache);
+    void *ptr;
+
+    ptr = mmap(cache_host + c_offset, len, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (ptr != cache_host + c_offset) {
+        return -errno;
+    }
+    return 0;
+}
+
+static VHostUserFS *vuf_from_vhost_dev(struct vhost_dev *dev)
+{
+    VHostUserFS *fs;
+
+    if (!dev->vdev) {
+        return NULL;
+    }
+    fs = (VHostUserFS *)object_dynamic_cast(OBJECT(dev->vdev),
+                                            TYPE_VHOST_USER_FS);
+    if (!fs || !fs->conf.cache_size) {
+        return NULL;
+    }
+    return fs;
+}
+
+int vhost_user_fs_slave_map(struct vhost_dev *dev, VhostUserFSSlaveMsg *sm,
+                            int fd)
+{
+    VHostUserFS *fs = vuf_from_vhost_dev(dev);
+    void *cache_host;
+    unsigned int i;
+
+    if (!fs) {
+        error_report("%s: DAX cache not enabled", __func__);
+        return -EINVAL;
+    }
+    if (fd < 0) {
+        error_report("%s: bad fd for map", __func__);
+        return -EBADF;
+    }
+
+    cache_host = memory_region_get_ram_ptr(&fs->cache);
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES && sm->len[i]; i++) {
+        int prot = 0;
+        void *ptr;
+
+        if (!vuf_check_cache_range(fs, sm->c_offset[i], sm->len[i])) {
+            error_report("%s: bad range 0x%" PRIx64 "+0x%" PRIx64
+                         " for cache of size 0x%" PRIx64, __func__,
+                         sm->c_offset[i], sm->len[i], fs->conf.cache_size);
+            return -EINVAL;
+        }
+
+        if (sm->flags[i] & VHOST_USER_FS_FLAG_MAP_R) {
+            prot |= PROT_READ;
+        }
+        if (sm->flags[i] & VHOST_USER_FS_FLAG_MAP_W) {
+            prot |= PROT_WRITE;
+        }
+
+        trace_vhost_user_fs_slave_map(fs, sm->c_offset[i], sm->len[i],
+                                      sm->fd_offset[i], prot);
+        ptr = mmap(cache_host + sm->c_offset[i], sm->len[i], prot,
+                   MAP_SHARED | MAP_FIXED, fd, sm->fd_offset[i]);
+        if (ptr != cache_host + sm->c_offset[i]) {
+            int ret = -errno;
+
+            error_report("%s: map of 0x%" PRIx64 "+0x%" PRIx64 " failed: %s",
+                         __func__, sm->c_offset[i], sm->len[i],
+                         strerror(-ret));
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int vhost_user_fs_slave_unmap(struct vhost_dev *dev, VhostUserFSSlaveMsg *sm)
+{
+    VHostUserFS *fs = vuf_from_vhost_dev(dev);
+    unsigned int i;
+    int ret = 0;
+
+    if (!fs) {
+        error_report("%s: DAX cache not enabled", __func__);
+        return -EINVAL;
+    }
+
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES && sm->len[i]; i++) {
+        uint64_t c_offset = sm->c_offset[i];
+        uint64_t len = sm->len[i];
+        int err;
+
+        /* A length of ~0 removes every mapping in the cache */
+        if (len == ~(uint64_t)0) {
+            c_offset = 0;
+            len = fs->conf.cache_size;
+        }
+
+        if (!vuf_check_cache_range(fs, c_offset, len)) {
+            error_report("%s: bad range 0x%" PRIx64 "+0x%" PRIx64
+                         " for cache of size 0x%" PRIx64, __func__,
+                         c_offset, len, fs->conf.cache_size);
+            ret = -EINVAL;
+            continue;
+        }
+
+        trace_vhost_user_fs_slave_unmap(fs, c_offset, len);
+        err = vuf_cache_clear(fs, c_offset, len);
+        if (err < 0) {
+            error_report("%s: unmap of 0x%" PRIx64 "+0x%" PRIx64 " failed: %s",
+                         __func__, c_offset, len, strerror(-err));
+            ret = err;
+        }
+    }
+
+    return ret;
+}
+
 static void vuf_get_config(VirtIODevice *vdev, uint8_t *config)
 {
     VHostUserFS *fs = VHOST_USER_FS(vdev);
@@ -171,6 +310,26 @@ static bool vuf_guest_notifier_pending(VirtIODevice *vdev, int idx)
     return vhost_virtqueue_pending(&fs->vhost_dev, idx);
 }
 
+static void vuf_reset(VirtIODevice *vdev)
+{
+    VHostUserFS *fs = VHOST_USER_FS(vdev);
+    int ret;
+
+    if (!fs->conf.cache_size) {
+        return;
+    }
+
+    /*
+     * The driver forgets about the mappings when the device is reset,
+     * so do not leave file contents visible in the window.
+     */
+    ret = vuf_cache_clear(fs, 0, fs->conf.cache_size);
+    if (ret < 0) {
+        error_report("vhost-user-fs: failed to clear DAX cache: %s",
+                     strerror(-ret));
+    }
+}
+
 static void vuf_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -215,10 +374,36 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (fs->conf.cache_size &&
+        (!is_power_of_2(fs->conf.cache_size) ||
+         fs->conf.cache_size < qemu_real_host_page_size)) {
+        error_setg(errp, "cache-size property must be a power of 2 "
+                   "no smaller than the page size");
+        return;
+    }
+
     if (!vhost_user_init(&fs->vhost_user, &fs->conf.chardev, errp)) {
         return;
     }
 
+    if (fs->conf.cache_size) {
+        /*
+         * Reserve the whole window up front; pages are only made
+         * accessible when the daemon maps a file into them.
+         */
+        void *cache_ptr = mmap(NULL, fs->conf.cache_size, PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (cache_ptr == MAP_FAILED) {
+            error_setg_errno(errp, errno, "Unable to reserve DAX cache");
+            vhost_user_cleanup(&fs->vhost_user);
+            return;
+        }
+        memory_region_init_ram_device_ptr(&fs->cache, OBJECT(dev),
+                                          "virtio-fs-cache",
+                                          fs->conf.cache_size, cache_ptr);
+    }
+
     virtio_init(vdev, "vhost-user-fs", VIRTIO_ID_FS,
                 sizeof(struct virtio_fs_config));
 
@@ -243,6 +428,10 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
     return;
 
 err_virtio:
+    if (fs->conf.cache_size) {
+        munmap(memory_region_get_ram_ptr(&fs->cache), fs->conf.cache_size);
+        object_unparent(OBJECT(&fs->cache));
+    }
     vhost_user_cleanup(&fs->vhost_user);
     virtio_delete_queue(fs->hiprio_vq);
     for (i = 0; i < fs->conf.num_request_queues; i++) {
@@ -275,6 +464,10 @@ static void vuf_device_unrealize(DeviceState *dev)
     virtio_cleanup(vdev);
     g_free(fs->vhost_dev.vqs);
     fs->vhost_dev.vqs = NULL;
+
+    if (fs->conf.cache_size) {
+        munmap(memory_region_get_ram_ptr(&fs->cache), fs->conf.cache_size);
+    }
 }
 
 static const VMStateDescription vuf_vmstate = {
@@ -288,6 +481,7 @@ static Property vuf_properties[] = {
     DEFINE_PROP_UINT16("num-request-queues", VHostUserFS,
                        conf.num_request_queues, 1),
     DEFINE_PROP_UINT16("queue-size", VHostUserFS, conf.queue_size, 128),
+    DEFINE_PROP_SIZE("cache-size", VHostUserFS, conf.cache_size, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -314,6 +508,7 @@ static void vuf_class_init(ObjectClass *klass, void *data)
     vdc->set_status = vuf_set_status;
     vdc->guest_notifier_mask = vuf_guest_notifier_mask;
     vdc->guest_notifier_pending = vuf_guest_notifier_pending;
+    vdc->reset = vuf_reset;
 }
 
 static const TypeInfo vuf_info = {
@@ -15,6 +15,7 @@
 #include "hw/virtio/vhost-backend.h"
 #include "hw/virtio/virtio.h"
 #include "hw/virtio/virtio-net.h"
+#include "hw/virtio/vhost-user-fs.h"
 #include "chardev/char-fe.h"
 #include "io/channel-socket.h"
 #include "sysemu/kvm.h"
@@ -25,6 +26,7 @@
 #include "migration/migration.h"
 #include "migration/postcopy-ram.h"
 #include "trace.h"
+#include CONFIG_DEVICES
 
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -133,6 +135,10 @@ typedef enum VhostUserSlaveRequest {
     VHOST_USER_SLAVE_IOTLB_MSG = 1,
     VHOST_USER_SLAVE_CONFIG_CHANGE_MSG = 2,
     VHOST_USER_SLAVE_VRING_HOST_NOTIFIER_MSG = 3,
+    /* Message number 4 reserved for VHOST_USER_SLAVE_VRING_CALL. */
+    /* Message number 5 reserved for VHOST_USER_SLAVE_VRING_ERR. */
+    VHOST_USER_SLAVE_FS_MAP = 6,
+    VHOST_USER_SLAVE_FS_UNMAP = 7,
     VHOST_USER_SLAVE_MAX
 }  VhostUserSlaveRequest;
 
@@ -219,6 +225,7 @@ typedef union {
         VhostUserCryptoSession session;
         VhostUserVringArea area;
         VhostUserInflight inflight;
+        VhostUserFSSlaveMsg fs;
 } VhostUserPayload;
 
 typedef struct VhostUserMsg {
@@ -1541,6 +1548,14 @@ static gboolean slave_read(QIOChannel *ioc, GIOCondition condition,
         ret = vhost_user_slave_handle_vring_host_notifier(dev, &payload.area,
                                                           fd ? fd[0] : -1);
         break;
+#ifdef CONFIG_VHOST_USER_FS
+    case VHOST_USER_SLAVE_FS_MAP:
+        ret = vhost_user_fs_slave_map(dev, &payload.fs, fd ? fd[0] : -1);
+        break;
+    case VHOST_USER_SLAVE_FS_UNMAP:
+        ret = vhost_user_fs_slave_unmap(dev, &payload.fs);
+        break;
+#endif
     default:
         error_report("Received unexpected msg type: %d.", hdr.request);
         ret = -EINVAL;
@@ -1860,20 +1875,13 @@ static int vhost_user_postcopy_notifier(NotifierWithReturn *notifier,
     return 0;
 }
 
-static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
-                                   Error **errp)
+/* Negotiate the state that is shared by all queues of a connection */
+static int vhost_user_negotiate(struct vhost_dev *dev, Error **errp)
 {
+    struct vhost_user *u = dev->opaque;
     uint64_t features, protocol_features, ram_slots;
-    struct vhost_user *u;
     int err;
 
-    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
-
-    u = g_new0(struct vhost_user, 1);
-    u->user = opaque;
-    u->dev = dev;
-    dev->opaque = u;
-
     err = vhost_user_get_features(dev, &features);
     if (err < 0) {
         return err;
@@ -1955,6 +1963,49 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
         }
     }
 
+    return 0;
+}
+
+static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
+                                   Error **errp)
+{
+    struct vhost_user *u;
+    int err;
+
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
+
+    u = g_new0(struct vhost_user, 1);
+    u->user = opaque;
+    u->dev = dev;
+    dev->opaque = u;
+
+    /*
+     * The first queue pair always (re)connects first.  The others talk
+     * over the same socket, so they don't need to repeat the round trips.
+     */
+    if (dev->vq_index != 0 && u->user->negotiated) {
+        dev->backend_features |= u->user->backend_features;
+        dev->protocol_features = u->user->protocol_features;
+        dev->max_queues = u->user->max_queues;
+
+        if (dev->num_queues && dev->max_queues < dev->num_queues) {
+            error_setg(errp, "The maximum number of queues supported by the "
+                       "backend is %" PRIu64, dev->max_queues);
+            return -EINVAL;
+        }
+    } else {
+        u->user->negotiated = false;
+        err = vhost_user_negotiate(dev, errp);
+        if (err < 0) {
+            return err;
+        }
+        u->user->backend_features = dev->backend_features &
+                                    (1ULL << VHOST_USER_F_PROTOCOL_FEATURES);
+        u->user->protocol_features = dev->protocol_features;
+        u->user->max_queues = dev->max_queues;
+        u->user->negotiated = true;
+    }
+
     if (dev->migration_blocker == NULL &&
         !virtio_has_feature(dev->protocol_features,
                             VHOST_USER_PROTOCOL_F_LOG_SHMFD)) {
@@ -2404,6 +2455,7 @@ bool vhost_user_init(VhostUserState *user, CharBackend *chr, Error **errp)
     }
     user->chr = chr;
     user->memory_slots = 0;
+    user->negotiated = false;
     return true;
 }
 
@@ -18,8 +18,11 @@
 #include "hw/virtio/vhost-backend.h"
 #include "hw/virtio/virtio-net.h"
 #include "hw/virtio/vhost-vdpa.h"
+#include "hw/virtio/vhost-shadow-virtqueue.h"
 #include "exec/address-spaces.h"
 #include "qemu/main-loop.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
 #include "cpu.h"
 #include "trace.h"
 #include "qemu-common.h"
@@ -267,9 +270,48 @@ static void vhost_vdpa_add_status(struct vhost_dev *dev, uint8_t status)
     vhost_vdpa_call(dev, VHOST_VDPA_SET_STATUS, &s);
 }
 
+static void vhost_vdpa_svq_cleanup(struct vhost_dev *dev)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    int i;
+
+    if (!v->shadow_vqs) {
+        return;
+    }
+    for (i = 0; i < dev->nvqs; i++) {
+        vhost_svq_free(v->shadow_vqs[i]);
+    }
+    g_free(v->shadow_vqs);
+    v->shadow_vqs = NULL;
+}
+
+static int vhost_vdpa_svq_init(struct vhost_dev *dev, Error **errp)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    int i, r;
+
+    r = vhost_vdpa_call(dev, VHOST_VDPA_GET_IOVA_RANGE, &v->iova_range);
+    if (r) {
+        error_setg_errno(errp, -r, "shadow virtqueues need the IOVA range "
+                         "of the device");
+        return r;
+    }
+
+    v->shadow_vqs = g_new0(VhostShadowVirtqueue *, dev->nvqs);
+    for (i = 0; i < dev->nvqs; i++) {
+        v->shadow_vqs[i] = vhost_svq_new(errp);
+        if (!v->shadow_vqs[i]) {
+            vhost_vdpa_svq_cleanup(dev);
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
 static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque, Error **errp)
 {
     struct vhost_vdpa *v;
+    int r;
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_VDPA);
     trace_vhost_vdpa_init(dev, opaque);
 
@@ -279,12 +321,107 @@ static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque, Error **errp)
     v->listener = vhost_vdpa_memory_listener;
     v->msg_type = VHOST_IOTLB_MSG_V2;
 
+    if (v->shadow_vqs_enabled) {
+        r = vhost_vdpa_svq_init(dev, errp);
+        if (r) {
+            return r;
+        }
+    }
+
     vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
                                VIRTIO_CONFIG_S_DRIVER);
 
     return 0;
 }
 
+/*
+ * Each shadow virtqueue gets a slot at the top of the IOVA range that
+ * fits the largest vring, below which the guest memory is mapped 1:1.
+ */
+static size_t vhost_vdpa_svq_slot_size(void)
+{
+    return vhost_svq_driver_area_size(VIRTQUEUE_MAX_SIZE) +
+           vhost_svq_device_area_size(VIRTQUEUE_MAX_SIZE);
+}
+
+static hwaddr vhost_vdpa_svq_iova(struct vhost_vdpa *v, int idx)
+{
+    return v->iova_range.last + 1 - (idx + 1) * vhost_vdpa_svq_slot_size();
+}
+
+static void vhost_vdpa_svq_stop(struct vhost_dev *dev, int idx)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    VhostShadowVirtqueue *svq = v->shadow_vqs[idx];
+    hwaddr iova = vhost_vdpa_svq_iova(v, idx);
+    hwaddr device_iova = iova +
+                         vhost_svq_driver_area_size(VIRTQUEUE_MAX_SIZE);
+    void *driver_area = svq->vring.desc;
+    void *device_area = svq->vring.used;
+    unsigned int num = svq->vring.num;
+
+    if (!vhost_svq_started(svq)) {
+        return;
+    }
+
+    vhost_svq_stop(svq);
+    vhost_vdpa_dma_unmap(v, iova, vhost_svq_driver_area_size(num));
+    vhost_vdpa_dma_unmap(v, device_iova, vhost_svq_device_area_size(num));
+    qemu_vfree(driver_area);
+    qemu_vfree(device_area);
+}
+
+static int vhost_vdpa_svq_start(struct vhost_dev *dev, int idx,
+                                unsigned int num, Error **errp)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    VhostShadowVirtqueue *svq = v->shadow_vqs[idx];
+    VirtQueue *vq = virtio_get_queue(dev->vdev, dev->vq_index + idx);
+    size_t driver_size = vhost_svq_driver_area_size(num);
+    size_t device_size = vhost_svq_device_area_size(num);
+    hwaddr iova = vhost_vdpa_svq_iova(v, idx);
+    hwaddr device_iova = iova +
+                         vhost_svq_driver_area_size(VIRTQUEUE_MAX_SIZE);
+    void *driver_area, *device_area;
+    int r;
+
+    /* Buffer addresses are passed to the device as guest physical */
+    if (dev->vdev->dma_as != &address_space_memory) {
+        error_setg(errp, "shadow virtqueues do not support a vIOMMU");
+        return -ENOTSUP;
+    }
+    if (iova < v->iova_range.first || iova > v->iova_range.last) {
+        error_setg(errp, "IOVA range of the device is too small for "
+                   "shadow virtqueues");
+        return -ERANGE;
+    }
+
+    /* A previous start may have failed before the device was started */
+    vhost_vdpa_svq_stop(dev, idx);
+
+    driver_area = qemu_memalign(qemu_real_host_page_size, driver_size);
+    device_area = qemu_memalign(qemu_real_host_page_size, device_size);
+    vhost_svq_start(svq, dev->vdev, vq, driver_area, device_area);
+
+    r = vhost_vdpa_dma_map(v, iova, driver_size, driver_area, true);
+    if (r) {
+        goto fail;
+    }
+    r = vhost_vdpa_dma_map(v, device_iova, device_size, device_area, false);
+    if (r) {
+        vhost_vdpa_dma_unmap(v, iova, driver_size);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    vhost_svq_stop(svq);
+    qemu_vfree(driver_area);
+    qemu_vfree(device_area);
+    error_setg_errno(errp, -r, "cannot map shadow virtqueue %d", idx);
+    return r;
+}
+
 static void vhost_vdpa_host_notifier_uninit(struct vhost_dev *dev,
                                             int queue_index)
 {
@@ -375,6 +512,7 @@ static int vhost_vdpa_cleanup(struct vhost_dev *dev)
     trace_vhost_vdpa_cleanup(dev, v);
     vhost_vdpa_host_notifiers_uninit(dev, dev->nvqs);
     memory_listener_unregister(&v->listener);
+    vhost_vdpa_svq_cleanup(dev);
 
     dev->opaque = NULL;
     return 0;
@@ -411,10 +549,28 @@ static int vhost_vdpa_set_mem_table(struct vhost_dev *dev,
 static int vhost_vdpa_set_features(struct vhost_dev *dev,
                                    uint64_t features)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int ret;
     trace_vhost_vdpa_set_features(dev, features);
-    ret = vhost_vdpa_call(dev, VHOST_SET_FEATURES, &features);
     uint8_t status = 0;
+
+    if (v->shadow_vqs_enabled) {
+        /*
+         * Once the features are set, only VHOST_F_LOG_ALL changes, and
+         * the dirty log is kept by QEMU.  The shadow vrings are split
+         * and use neither event idx nor indirect descriptors.
+         */
+        vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &status);
+        if (status & VIRTIO_CONFIG_S_FEATURES_OK) {
+            return 0;
+        }
+        features &= ~(0x1ULL << VHOST_F_LOG_ALL |
+                      0x1ULL << VIRTIO_RING_F_EVENT_IDX |
+                      0x1ULL << VIRTIO_RING_F_INDIRECT_DESC |
+                      0x1ULL << VIRTIO_F_RING_PACKED);
+    }
+
+    ret = vhost_vdpa_call(dev, VHOST_SET_FEATURES, &features);
     if (ret) {
         return ret;
     }
@@ -550,7 +706,10 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
     if (started) {
         uint8_t status = 0;
         memory_listener_register(&v->listener, &address_space_memory);
-        vhost_vdpa_host_notifiers_init(dev);
+        /* With shadow virtqueues the guest kicks QEMU, not the device */
+        if (!v->shadow_vqs_enabled) {
+            vhost_vdpa_host_notifiers_init(dev);
+        }
         vhost_vdpa_set_vring_ready(dev);
         vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
         vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &status);
@@ -558,6 +717,13 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
         return !(status & VIRTIO_CONFIG_S_DRIVER_OK);
     } else {
         vhost_vdpa_reset_device(dev);
+        if (v->shadow_vqs_enabled) {
+            int i;
+
+            for (i = 0; i < dev->nvqs; i++) {
+                vhost_vdpa_svq_stop(dev, i);
+            }
+        }
         vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
                                    VIRTIO_CONFIG_S_DRIVER);
         vhost_vdpa_host_notifiers_uninit(dev, dev->nvqs);
@@ -570,40 +736,92 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
 static int vhost_vdpa_set_log_base(struct vhost_dev *dev, uint64_t base,
                                      struct vhost_log *log)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     trace_vhost_vdpa_set_log_base(dev, base, log->size, log->refcnt, log->fd,
                                   log->log);
+    if (v->shadow_vqs_enabled) {
+        return 0;
+    }
     return vhost_vdpa_call(dev, VHOST_SET_LOG_BASE, &base);
 }
 
 static int vhost_vdpa_set_vring_addr(struct vhost_dev *dev,
                                        struct vhost_vring_addr *addr)
 {
+    struct vhost_vdpa *v = dev->opaque;
+    uint8_t status = 0;
+
     trace_vhost_vdpa_set_vring_addr(dev, addr->index, addr->flags,
                                     addr->desc_user_addr, addr->used_user_addr,
                                     addr->avail_user_addr,
                                     addr->log_guest_addr);
+    if (v->shadow_vqs_enabled) {
+        /* Only the log flag changes while the shadow vrings are in use */
+        vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &status);
+        if (status & VIRTIO_CONFIG_S_DRIVER_OK) {
+            return 0;
+        }
+        addr->flags &= ~(1 << VHOST_VRING_F_LOG);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_ADDR, addr);
 }
 
 static int vhost_vdpa_set_vring_num(struct vhost_dev *dev,
                                       struct vhost_vring_state *ring)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     trace_vhost_vdpa_set_vring_num(dev, ring->index, ring->num);
+    if (v->shadow_vqs_enabled) {
+        Error *local_err = NULL;
+        int r;
+
+        /* The queue is starting, set up its shadow vring first */
+        r = vhost_vdpa_svq_start(dev, ring->index, ring->num, &local_err);
+        if (r) {
+            error_report_err(local_err);
+            /* vhost_virtqueue_start() reports errno */
+            errno = -r;
+            return r;
+        }
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_NUM, ring);
 }
 
 static int vhost_vdpa_set_vring_base(struct vhost_dev *dev,
                                        struct vhost_vring_state *ring)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     trace_vhost_vdpa_set_vring_base(dev, ring->index, ring->num);
+    if (v->shadow_vqs_enabled) {
+        /* The guest position is kept by the VirtQueue, the vring is new */
+        struct vhost_vring_state shadow = {
+            .index = ring->index,
+            .num = 0,
+        };
+
+        return vhost_vdpa_call(dev, VHOST_SET_VRING_BASE, &shadow);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_BASE, ring);
 }
 
 static int vhost_vdpa_get_vring_base(struct vhost_dev *dev,
                                        struct vhost_vring_state *ring)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int ret;
 
+    if (v->shadow_vqs_enabled) {
+        /* vhost_svq_stop() gave back what the device did not use */
+        ring->num = virtio_queue_get_last_avail_idx(dev->vdev,
+                                                    dev->vq_index +
+                                                    ring->index);
+        trace_vhost_vdpa_get_vring_base(dev, ring->index, ring->num);
+        return 0;
+    }
+
     ret = vhost_vdpa_call(dev, VHOST_GET_VRING_BASE, ring);
     trace_vhost_vdpa_get_vring_base(dev, ring->index, ring->num);
     return ret;
@@ -612,23 +830,52 @@ static int vhost_vdpa_get_vring_base(struct vhost_dev *dev,
 static int vhost_vdpa_set_vring_kick(struct vhost_dev *dev,
                                        struct vhost_vring_file *file)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     trace_vhost_vdpa_set_vring_kick(dev, file->index, file->fd);
+    if (v->shadow_vqs_enabled) {
+        VhostShadowVirtqueue *svq = v->shadow_vqs[file->index];
+        struct vhost_vring_file shadow = {
+            .index = file->index,
+            .fd = event_notifier_get_fd(&svq->hdev_kick),
+        };
+
+        vhost_svq_set_guest_kick_fd(svq, file->fd);
+        return vhost_vdpa_call(dev, VHOST_SET_VRING_KICK, &shadow);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_KICK, file);
 }
 
 static int vhost_vdpa_set_vring_call(struct vhost_dev *dev,
                                        struct vhost_vring_file *file)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     trace_vhost_vdpa_set_vring_call(dev, file->index, file->fd);
+    if (v->shadow_vqs_enabled) {
+        VhostShadowVirtqueue *svq = v->shadow_vqs[file->index];
+        struct vhost_vring_file shadow = {
+            .index = file->index,
+            .fd = event_notifier_get_fd(&svq->hdev_call),
+        };
+
+        vhost_svq_set_guest_call_fd(svq, file->fd);
+        return vhost_vdpa_call(dev, VHOST_SET_VRING_CALL, &shadow);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_CALL, file);
 }
 
 static int vhost_vdpa_get_features(struct vhost_dev *dev,
                                      uint64_t *features)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int ret;
 
     ret = vhost_vdpa_call(dev, VHOST_GET_FEATURES, features);
+    /* QEMU sees every buffer the device writes, and logs it */
+    if (!ret && v->shadow_vqs_enabled) {
+        *features |= 0x1ULL << VHOST_F_LOG_ALL;
+    }
     trace_vhost_vdpa_get_features(dev, *features);
     return ret;
 }
@@ -642,10 +889,22 @@ static int vhost_vdpa_set_owner(struct vhost_dev *dev)
 static int vhost_vdpa_vq_get_addr(struct vhost_dev *dev,
                     struct vhost_vring_addr *addr, struct vhost_virtqueue *vq)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_VDPA);
-    addr->desc_user_addr = (uint64_t)(unsigned long)vq->desc_phys;
-    addr->avail_user_addr = (uint64_t)(unsigned long)vq->avail_phys;
-    addr->used_user_addr = (uint64_t)(unsigned long)vq->used_phys;
+    if (v->shadow_vqs_enabled) {
+        int idx = vq - dev->vqs;
+        hwaddr iova = vhost_vdpa_svq_iova(v, idx);
+
+        addr->desc_user_addr = iova;
+        addr->avail_user_addr = iova + sizeof(vring_desc_t) * vq->num;
+        addr->used_user_addr = iova +
+            vhost_svq_driver_area_size(VIRTQUEUE_MAX_SIZE);
+    } else {
+        addr->desc_user_addr = (uint64_t)(unsigned long)vq->desc_phys;
+        addr->avail_user_addr = (uint64_t)(unsigned long)vq->avail_phys;
+        addr->used_user_addr = (uint64_t)(unsigned long)vq->used_phys;
+    }
     trace_vhost_vdpa_vq_get_addr(dev, vq, addr->desc_user_addr,
                                  addr->avail_user_addr, addr->used_user_addr);
     return 0;
@@ -324,14 +324,70 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+typedef struct FreePageReportRange {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+} FreePageReportRange;
+
+static gint free_page_report_range_cmp(gconstpointer a, gconstpointer b)
+{
+    const FreePageReportRange *ra = a;
+    const FreePageReportRange *rb = b;
+
+    if (ra->rb != rb->rb) {
+        return (uintptr_t)ra->rb < (uintptr_t)rb->rb ? -1 : 1;
+    }
+    if (ra->offset != rb->offset) {
+        return ra->offset < rb->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * The guest reports free memory in chunks of its own page-block order,
+ * often in no particular order and spread over several elements.  Sort
+ * the ranges and discard adjacent ones together, so that memory backed
+ * by huge pages is given back in as few and as large pieces as possible.
+ */
+static void virtio_balloon_discard_reported(GArray *ranges)
+{
+    FreePageReportRange *cur = NULL;
+    guint i;
+
+    g_array_sort(ranges, free_page_report_range_cmp);
+    for (i = 0; i < ranges->len; i++) {
+        FreePageReportRange *r = &g_array_index(ranges, FreePageReportRange,
+                                                i);
+
+        if (cur && cur->rb == r->rb && cur->offset + cur->size >= r->offset) {
+            cur->size = MAX(cur->size, r->offset + r->size - cur->offset);
+            continue;
+        }
+        if (cur) {
+            ram_block_discard_range(cur->rb, cur->offset, cur->size);
+        }
+        cur = r;
+    }
+    if (cur) {
+        ram_block_discard_range(cur->rb, cur->offset, cur->size);
+    }
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
+    g_autoptr(GPtrArray) elems = g_ptr_array_new();
+    g_autoptr(GArray) ranges = g_array_new(false, false,
+                                           sizeof(FreePageReportRange));
     VirtQueueElement *elem;
+    guint j;
 
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
+        g_ptr_array_add(elems, elem);
+
         /*
          * When we discard the page it has the effect of removing the page
          * from the hypervisor itself and causing it to be zeroed when it
@@ -340,14 +396,14 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
          * expecting it to retain a non-zero value.
          */
         if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
+            continue;
         }
 
         for (i = 0; i < elem->in_num; i++) {
             void *addr = elem->in_sg[i].iov_base;
-            size_t size = elem->in_sg[i].iov_len;
-            ram_addr_t ram_offset;
-            RAMBlock *rb;
+            FreePageReportRange range = {
+                .size = elem->in_sg[i].iov_len,
+            };
 
             /*
              * There is no need to check the memory section to see if
@@ -360,8 +416,8 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
              * will return NULL after the first bounce buffer and fail
              * to map any resources.
              */
-            rb = qemu_ram_block_from_host(addr, false, &ram_offset);
-            if (!rb) {
+            range.rb = qemu_ram_block_from_host(addr, false, &range.offset);
+            if (!range.rb) {
                 trace_virtio_balloon_bad_addr(elem->in_addr[i]);
                 continue;
             }
@@ -370,19 +426,32 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
              * For now we will simply ignore unaligned memory regions, or
              * regions that overrun the end of the RAMBlock.
              */
-            if (!QEMU_IS_ALIGNED(ram_offset | size, qemu_ram_pagesize(rb)) ||
-                (ram_offset + size) > qemu_ram_get_used_length(rb)) {
+            if (!QEMU_IS_ALIGNED(range.offset | range.size,
+                                 qemu_ram_pagesize(range.rb)) ||
+                (range.offset + range.size) >
+                qemu_ram_get_used_length(range.rb)) {
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            g_array_append_val(ranges, range);
         }
+    }
+
+    /*
+     * The guest may reuse the reported pages as soon as it sees the element
+     * in the used ring, so discard everything before returning anything.
+     * The mapped elements keep the RAMBlocks alive until then.
+     */
+    virtio_balloon_discard_reported(ranges);
 
-skip_element:
+    for (j = 0; j < elems->len; j++) {
+        elem = g_ptr_array_index(elems, j);
         virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
         g_free(elem);
     }
+    if (elems->len) {
+        virtio_notify(vdev, vq);
+    }
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -195,7 +195,14 @@ static uint64_t virtio_mmio_read(void *opaque, hwaddr offset, unsigned size)
         }
         return proxy->vqs[vdev->queue_sel].enabled;
     case VIRTIO_MMIO_INTERRUPT_STATUS:
-        return qatomic_read(&vdev->isr);
+        /*
+         * With irqfd the queues' notifications are injected by KVM and
+         * never pass through virtio_irq(), so the VRING bit cannot be
+         * tracked; report it unconditionally and let the driver scan
+         * its queues on every interrupt.
+         */
+        return qatomic_read(&vdev->isr) |
+               (proxy->irqfd_active ? VIRTIO_MMIO_INT_VRING : 0);
     case VIRTIO_MMIO_STATUS:
         return vdev->status;
     case VIRTIO_MMIO_CONFIG_GENERATION:
@@ -406,7 +413,17 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
         }
         break;
     case VIRTIO_MMIO_QUEUE_NOTIFY:
-        if (value < VIRTIO_QUEUE_MAX) {
+        if (virtio_vdev_has_feature(vdev, VIRTIO_F_NOTIFICATION_DATA)) {
+            /* The next available index is in the upper half */
+            uint16_t queue = value;
+
+            if (queue < VIRTIO_QUEUE_MAX) {
+                virtio_queue_set_shadow_avail_idx(virtio_get_queue(vdev,
+                                                                   queue),
+                                                  value >> 16);
+                virtio_queue_notify(vdev, queue);
+            }
+        } else if (value < VIRTIO_QUEUE_MAX) {
             virtio_queue_notify(vdev, value);
         }
         break;
@@ -661,8 +678,20 @@ static int virtio_mmio_set_guest_notifier(DeviceState *d, int n, bool assign,
         if (r < 0) {
             return r;
         }
+        if (with_irqfd) {
+            r = kvm_irqchip_add_irqfd_notifier(kvm_state, notifier, NULL,
+                                               proxy->irq);
+            if (r < 0) {
+                event_notifier_cleanup(notifier);
+                return r;
+            }
+        }
         virtio_queue_set_guest_notifier_fd_handler(vq, true, with_irqfd);
     } else {
+        if (with_irqfd) {
+            kvm_irqchip_remove_irqfd_notifier(kvm_state, notifier,
+                                              proxy->irq);
+        }
         virtio_queue_set_guest_notifier_fd_handler(vq, false, with_irqfd);
         event_notifier_cleanup(notifier);
     }
@@ -679,12 +708,23 @@ static int virtio_mmio_set_guest_notifiers(DeviceState *d, int nvqs,
 {
     VirtIOMMIOProxy *proxy = VIRTIO_MMIO(d);
     VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
-    /* TODO: need to check if kvm-arm supports irqfd */
-    bool with_irqfd = false;
+    bool with_irqfd;
     int r, n;
 
+    if (assign) {
+        /*
+         * irqfd injects a pulse, so it is only correct if the guest
+         * treats the interrupt line as edge-triggered; the board has
+         * to say so through the "irqfd" property.
+         */
+        with_irqfd = proxy->irqfd && kvm_irqfds_enabled();
+    } else {
+        with_irqfd = proxy->irqfd_active;
+    }
+
     nvqs = MIN(nvqs, VIRTIO_QUEUE_MAX);
 
+retry:
     for (n = 0; n < nvqs; n++) {
         if (!virtio_queue_get_num(vdev, n)) {
             break;
@@ -696,13 +736,21 @@ static int virtio_mmio_set_guest_notifiers(DeviceState *d, int nvqs,
         }
     }
 
+    proxy->irqfd_active = assign && with_irqfd;
     return 0;
 
 assign_error:
     /* We get here on assignment failure. Recover by undoing for VQs 0 .. n. */
     assert(assign);
     while (--n >= 0) {
-        virtio_mmio_set_guest_notifier(d, n, !assign, false);
+        virtio_mmio_set_guest_notifier(d, n, !assign, with_irqfd);
+    }
+    if (with_irqfd) {
+        /* e.g. the interrupt controller is not in the kernel */
+        warn_report_once("virtio-mmio: irqfd setup failed, falling back to "
+                         "userspace interrupt injection: %s", strerror(-r));
+        with_irqfd = false;
+        goto retry;
     }
     return r;
 }
@@ -725,6 +773,7 @@ static Property virtio_mmio_properties[] = {
     DEFINE_PROP_BOOL("force-legacy", VirtIOMMIOProxy, legacy, true),
     DEFINE_PROP_BIT("ioeventfd", VirtIOMMIOProxy, flags,
                     VIRTIO_IOMMIO_FLAG_USE_IOEVENTFD_BIT, true),
+    DEFINE_PROP_BOOL("irqfd", VirtIOMMIOProxy, irqfd, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
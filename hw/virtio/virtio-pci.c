@@ -28,6 +28,7 @@
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
@@ -1149,6 +1150,24 @@ static int virtio_pci_add_mem_cap(VirtIOPCIProxy *proxy,
     return offset;
 }
 
+int virtio_pci_add_shm_cap(VirtIOPCIProxy *proxy, uint8_t bar,
+                           uint64_t offset, uint64_t length, uint8_t id)
+{
+    struct virtio_pci_cap64 cap = {
+        .cap.cap_len = sizeof cap,
+        .cap.cfg_type = VIRTIO_PCI_CAP_SHARED_MEMORY_CFG,
+    };
+
+    cap.cap.bar = bar;
+    cap.cap.id = id;
+    cap.cap.length = cpu_to_le32(length);
+    cap.length_hi = cpu_to_le32(length >> 32);
+    cap.cap.offset = cpu_to_le32(offset);
+    cap.offset_hi = cpu_to_le32(offset >> 32);
+
+    return virtio_pci_add_mem_cap(proxy, &cap.cap);
+}
+
 static uint64_t virtio_pci_common_read(void *opaque, hwaddr addr,
                                        unsigned size)
 {
@@ -1357,6 +1376,21 @@ static uint64_t virtio_pci_notify_read(void *opaque, hwaddr addr,
     return 0;
 }
 
+/*
+ * With VIRTIO_F_NOTIFICATION_DATA, the driver writes 32 bits: the queue
+ * index, and the next available index in the upper half.
+ */
+static void virtio_pci_queue_notify(VirtIODevice *vdev, unsigned queue,
+                                    uint64_t val, unsigned size)
+{
+    if (size == 4 &&
+        virtio_vdev_has_feature(vdev, VIRTIO_F_NOTIFICATION_DATA)) {
+        virtio_queue_set_shadow_avail_idx(virtio_get_queue(vdev, queue),
+                                          val >> 16);
+    }
+    virtio_queue_notify(vdev, queue);
+}
+
 static void virtio_pci_notify_write(void *opaque, hwaddr addr,
                                     uint64_t val, unsigned size)
 {
@@ -1366,7 +1400,7 @@ static void virtio_pci_notify_write(void *opaque, hwaddr addr,
     unsigned queue = addr / virtio_pci_queue_mem_mult(proxy);
 
     if (vdev != NULL && queue < VIRTIO_QUEUE_MAX) {
-        virtio_queue_notify(vdev, queue);
+        virtio_pci_queue_notify(vdev, queue, val, size);
     }
 }
 
@@ -1378,8 +1412,12 @@ static void virtio_pci_notify_write_pio(void *opaque, hwaddr addr,
 
     unsigned queue = val;
 
+    if (vdev != NULL &&
+        virtio_vdev_has_feature(vdev, VIRTIO_F_NOTIFICATION_DATA)) {
+        queue = val & 0xffff;
+    }
     if (vdev != NULL && queue < VIRTIO_QUEUE_MAX) {
-        virtio_queue_notify(vdev, queue);
+        virtio_pci_queue_notify(vdev, queue, val, size);
     }
 }
 
@@ -1394,8 +1432,21 @@ static uint64_t virtio_pci_isr_read(void *opaque, hwaddr addr,
         return UINT64_MAX;
     }
 
+    /*
+     * This region is dispatched without the BQL.  Reading a clear ISR,
+     * which is what happens when another device raised a shared INTx
+     * line, needs nothing else: the line is only asserted while the ISR
+     * is set, and whoever clears it is the one that deasserts it.
+     */
     val = qatomic_xchg(&vdev->isr, 0);
-    pci_irq_deassert(&proxy->pci_dev);
+    if (!val) {
+        return 0;
+    }
+
+    QEMU_IOTHREAD_LOCK_GUARD();
+    /* The device may have set the ISR again since it was cleared above */
+    pci_set_irq(&proxy->pci_dev, !msix_enabled(&proxy->pci_dev) &&
+                                 (qatomic_read(&vdev->isr) & 1));
     return val;
 }
 
@@ -1518,6 +1569,7 @@ static void virtio_pci_modern_regions_init(VirtIOPCIProxy *proxy,
                           proxy,
                           name->str,
                           proxy->isr.size);
+    memory_region_clear_global_locking(&proxy->isr.mr);
 
     g_string_printf(name, "virtio-pci-device-%s", vdev_name);
     memory_region_init_io(&proxy->device.mr, OBJECT(proxy),
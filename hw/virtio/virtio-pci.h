@@ -252,4 +252,19 @@ void virtio_pci_types_register(const VirtioPCIDeviceTypeInfo *t);
  */
 unsigned virtio_pci_optimal_num_queues(unsigned fixed_queues);
 
+/**
+ * virtio_pci_add_shm_cap:
+ * @proxy: the virtio-pci device
+ * @bar: BAR that contains the shared memory region
+ * @offset: offset of the region within @bar
+ * @length: size of the region
+ * @id: device-specific identifier of the region
+ *
+ * Describe a virtio shared memory region to the driver.
+ *
+ * Returns: The offset of the capability in configuration space.
+ */
+int virtio_pci_add_shm_cap(VirtIOPCIProxy *proxy, uint8_t bar,
+                           uint64_t offset, uint64_t length, uint8_t id);
+
 #endif
@@ -26,69 +26,101 @@
 #include "block/thread-pool.h"
 #include "trace.h"
 
-typedef struct VirtIODeviceRequest {
+struct VirtIODeviceRequest {
     VirtQueueElement elem;
-    int fd;
     VirtIOPMEM *pmem;
     VirtIODevice *vdev;
     struct virtio_pmem_req req;
     struct virtio_pmem_resp resp;
-} VirtIODeviceRequest;
+    QSIMPLEQ_ENTRY(VirtIODeviceRequest) next;
+};
 
 static int worker_cb(void *opaque)
 {
-    VirtIODeviceRequest *req_data = opaque;
+    VirtIOPMEM *pmem = opaque;
     int err = 0;
 
     /* flush raw backing image */
-    err = fsync(req_data->fd);
-    trace_virtio_pmem_flush_done(err);
-    if (err != 0) {
-        err = 1;
+    if (pmem->datasync) {
+        err = qemu_fdatasync(pmem->flush_fd);
+    } else {
+        err = fsync(pmem->flush_fd);
     }
+    trace_virtio_pmem_flush_done(err);
 
-    virtio_stl_p(req_data->vdev, &req_data->resp.ret, err);
-
-    return 0;
+    return err;
 }
 
+static void virtio_pmem_start_flush(VirtIOPMEM *pmem);
+
 static void done_cb(void *opaque, int ret)
 {
-    VirtIODeviceRequest *req_data = opaque;
-    int len = iov_from_buf(req_data->elem.in_sg, req_data->elem.in_num, 0,
-                              &req_data->resp, sizeof(struct virtio_pmem_resp));
+    VirtIOPMEM *pmem = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(pmem);
+    VirtIODeviceRequest *req_data, *next;
 
     /* Callbacks are serialized, so no need to use atomic ops. */
-    virtqueue_push(req_data->pmem->rq_vq, &req_data->elem, len);
-    virtio_notify((VirtIODevice *)req_data->pmem, req_data->pmem->rq_vq);
-    trace_virtio_pmem_response();
-    g_free(req_data);
+    QSIMPLEQ_FOREACH_SAFE(req_data, &pmem->flushing_reqs, next, next) {
+        int len;
+
+        virtio_stl_p(vdev, &req_data->resp.ret, ret != 0);
+        len = iov_from_buf(req_data->elem.in_sg, req_data->elem.in_num, 0,
+                           &req_data->resp, sizeof(struct virtio_pmem_resp));
+        virtqueue_push(pmem->rq_vq, &req_data->elem, len);
+        trace_virtio_pmem_response();
+        g_free(req_data);
+    }
+    QSIMPLEQ_INIT(&pmem->flushing_reqs);
+    virtio_notify(vdev, pmem->rq_vq);
+
+    pmem->flush_in_flight = false;
+    virtio_pmem_start_flush(pmem);
 }
 
-static void virtio_pmem_flush(VirtIODevice *vdev, VirtQueue *vq)
+/*
+ * Start one fsync for all pending requests.  A request that arrives while
+ * a flush is running may have been preceded by writes that the running
+ * fsync misses, so it waits for the next one instead.
+ */
+static void virtio_pmem_start_flush(VirtIOPMEM *pmem)
 {
-    VirtIODeviceRequest *req_data;
-    VirtIOPMEM *pmem = VIRTIO_PMEM(vdev);
     HostMemoryBackend *backend = MEMORY_BACKEND(pmem->memdev);
     ThreadPool *pool = aio_get_thread_pool(qemu_get_aio_context());
 
-    trace_virtio_pmem_flush_request();
-    req_data = virtqueue_pop(vq, sizeof(VirtIODeviceRequest));
-    if (!req_data) {
-        virtio_error(vdev, "virtio-pmem missing request data");
+    if (pmem->flush_in_flight || QSIMPLEQ_EMPTY(&pmem->pending_reqs)) {
         return;
     }
 
-    if (req_data->elem.out_num < 1 || req_data->elem.in_num < 1) {
-        virtio_error(vdev, "virtio-pmem request not proper");
-        virtqueue_detach_element(vq, (VirtQueueElement *)req_data, 0);
-        g_free(req_data);
-        return;
+    QSIMPLEQ_CONCAT(&pmem->flushing_reqs, &pmem->pending_reqs);
+    pmem->flush_in_flight = true;
+    pmem->flush_fd = memory_region_get_fd(&backend->mr);
+    thread_pool_submit_aio(pool, worker_cb, pmem, done_cb, pmem);
+}
+
+static void virtio_pmem_flush(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIODeviceRequest *req_data;
+    VirtIOPMEM *pmem = VIRTIO_PMEM(vdev);
+
+    for (;;) {
+        req_data = virtqueue_pop(vq, sizeof(VirtIODeviceRequest));
+        if (!req_data) {
+            break;
+        }
+
+        trace_virtio_pmem_flush_request();
+        if (req_data->elem.out_num < 1 || req_data->elem.in_num < 1) {
+            virtio_error(vdev, "virtio-pmem request not proper");
+            virtqueue_detach_element(vq, (VirtQueueElement *)req_data, 0);
+            g_free(req_data);
+            break;
+        }
+        req_data->pmem = pmem;
+        req_data->vdev = vdev;
+        QSIMPLEQ_INSERT_TAIL(&pmem->pending_reqs, req_data, next);
     }
-    req_data->fd   = memory_region_get_fd(&backend->mr);
-    req_data->pmem = pmem;
-    req_data->vdev = vdev;
-    thread_pool_submit_aio(pool, worker_cb, req_data, done_cb, req_data);
+
+    virtio_pmem_start_flush(pmem);
 }
 
 static void virtio_pmem_get_config(VirtIODevice *vdev, uint8_t *config)
@@ -122,6 +154,8 @@ static void virtio_pmem_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    QSIMPLEQ_INIT(&pmem->pending_reqs);
+    QSIMPLEQ_INIT(&pmem->flushing_reqs);
     host_memory_backend_set_mapped(pmem->memdev, true);
     virtio_init(vdev, TYPE_VIRTIO_PMEM, VIRTIO_ID_PMEM,
                 sizeof(struct virtio_pmem_config));
@@ -161,6 +195,7 @@ static Property virtio_pmem_properties[] = {
     DEFINE_PROP_UINT64(VIRTIO_PMEM_ADDR_PROP, VirtIOPMEM, start, 0),
     DEFINE_PROP_LINK(VIRTIO_PMEM_MEMDEV_PROP, VirtIOPMEM, memdev,
                      TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_BOOL("datasync", VirtIOPMEM, datasync, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
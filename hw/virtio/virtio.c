@@ -12,6 +12,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "cpu.h"
 #include "trace.h"
@@ -19,14 +20,17 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/timer.h"
 #include "hw/virtio/virtio.h"
 #include "migration/qemu-file-types.h"
 #include "qemu/atomic.h"
 #include "hw/virtio/virtio-bus.h"
 #include "hw/qdev-properties.h"
 #include "hw/virtio/virtio-access.h"
+#include "monitor/stats.h"
 #include "sysemu/dma.h"
 #include "sysemu/runstate.h"
+#include "sysemu/xen.h"
 #include "standard-headers/linux/virtio_ids.h"
 
 /*
@@ -94,6 +98,33 @@ typedef struct VRingPackedDescEvent {
     uint16_t flags;
 } VRingPackedDescEvent ;
 
+/* Number of guest RAM ranges remembered per virtqueue for data buffers */
+#define VIRTQUEUE_MAP_CACHE_SIZE 8
+/* Guest RAM is looked up and cached in naturally aligned windows this big */
+#define VIRTQUEUE_MAP_CACHE_WINDOW (1 * GiB)
+
+typedef struct VirtQueueMapCache {
+    /* Value of vdev->map_cache_gen when the entry was filled */
+    uint32_t gen;
+    bool writable;
+    hwaddr start;
+    hwaddr len;
+    MemoryRegion *mr;
+    void *host;
+} VirtQueueMapCache;
+
+/*
+ * Latency histograms of a virtqueue, exported by query-stats.  Bucket 0
+ * counts latencies of 0ns, bucket N those in [2^(N-1), 2^N) ns, and the
+ * last one everything from about nine minutes up.
+ */
+#define VIRTQUEUE_LATENCY_BUCKETS 40
+
+typedef struct VirtQueueLatency {
+    uint64_t kick_to_pop[VIRTQUEUE_LATENCY_BUCKETS];
+    uint64_t pop_to_push[VIRTQUEUE_LATENCY_BUCKETS];
+} VirtQueueLatency;
+
 struct VirtQueue
 {
     VRing vring;
@@ -131,6 +162,14 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Guest RAM used by recent data buffers, see virtqueue_map_ram() */
+    VirtQueueMapCache map_cache[VIRTQUEUE_MAP_CACHE_SIZE];
+    unsigned int map_cache_next;
+
+    /* When the queue was notified and not popped since, or 0 */
+    int64_t kick_time_ns;
+    VirtQueueLatency *latency;
 };
 
 static void virtio_free_region_cache(VRingMemoryRegionCaches *caches)
@@ -835,12 +874,57 @@ static void virtqueue_packed_fill_desc(VirtQueue *vq,
     vring_packed_desc_write(vq->vdev, &desc, &caches->desc, head, strict_order);
 }
 
+/*
+ * The histograms are only updated by the thread that processes the
+ * queue; query-stats may read a slightly stale value, which is fine.
+ */
+static void virtqueue_latency_add(uint64_t *hist, int64_t ns)
+{
+    unsigned int bucket = ns > 0 ? 64 - clz64(ns) : 0;
+
+    hist[MIN(bucket, VIRTQUEUE_LATENCY_BUCKETS - 1)]++;
+}
+
+static void virtqueue_record_kick(VirtQueue *vq)
+{
+    if (vq->latency && !vq->kick_time_ns) {
+        vq->kick_time_ns = get_clock();
+    }
+}
+
+static void virtqueue_record_pop(VirtQueue *vq, VirtQueueElement *elem)
+{
+    int64_t now;
+
+    if (!vq->latency) {
+        return;
+    }
+    if (!elem) {
+        /* The queue is empty, whatever the last kick was for is done */
+        vq->kick_time_ns = 0;
+        return;
+    }
+
+    now = get_clock();
+    if (vq->kick_time_ns) {
+        virtqueue_latency_add(vq->latency->kick_to_pop,
+                              now - vq->kick_time_ns);
+        vq->kick_time_ns = 0;
+    }
+    elem->pop_time_ns = now;
+}
+
 /* Called within rcu_read_lock().  */
 void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len, unsigned int idx)
 {
     trace_virtqueue_fill(vq, elem, len, idx);
 
+    if (vq->latency && elem->pop_time_ns) {
+        virtqueue_latency_add(vq->latency->pop_to_push,
+                              get_clock() - elem->pop_time_ns);
+    }
+
     virtqueue_unmap_sg(vq, elem, len);
 
     if (virtio_device_disabled(vq->vdev)) {
@@ -919,6 +1003,30 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/*
+ * virtqueue_push_batch:
+ * @vq: The #VirtQueue
+ * @elems: The elements to return to the guest
+ * @lens: The number of bytes written to each element
+ * @count: Number of elements in @elems and @lens
+ *
+ * Like calling virtqueue_push() on each element, but the used index is
+ * only published once for the whole batch.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    assert(count <= vq->vring.num);
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens[i], i);
+    }
+    virtqueue_flush(vq, count);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1294,11 +1402,95 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
-static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
+/* Called within rcu_read_lock().  */
+static bool virtqueue_map_cache_fill(VirtQueue *vq, VirtQueueMapCache *c,
+                                     uint32_t gen, hwaddr start, hwaddr len)
+{
+    MemoryRegion *mr;
+    hwaddr xlat;
+
+    mr = address_space_translate(vq->vdev->dma_as, start, &xlat, &len, false,
+                                 MEMTXATTRS_UNSPECIFIED);
+    if (!memory_region_is_ram(mr) || !memory_access_is_direct(mr, false)) {
+        return false;
+    }
+
+    c->gen = gen;
+    c->writable = memory_access_is_direct(mr, true);
+    c->start = start;
+    c->len = len;
+    c->mr = mr;
+    c->host = memory_region_get_ram_ptr(mr) + xlat;
+    return true;
+}
+
+/*
+ * Map a data buffer that lies in plain guest RAM without a FlatView
+ * lookup, using the guest RAM ranges remembered in vq->map_cache.  An
+ * entry is only valid for the memory topology it was filled in, see
+ * virtio_memory_listener_commit().  The mapping holds a reference to
+ * the memory region exactly like dma_memory_map(), so it is released
+ * with dma_memory_unmap() as usual.
+ *
+ * Returns NULL if the buffer has to go through dma_memory_map().
+ *
+ * Called within rcu_read_lock().
+ */
+static void *virtqueue_map_ram(VirtQueue *vq, hwaddr pa, hwaddr *plen,
+                               bool is_write)
+{
+    VirtIODevice *vdev = vq->vdev;
+    VirtQueueMapCache *c;
+    hwaddr start, end;
+    uint32_t gen;
+    unsigned int i;
+
+    /* IOMMU mappings can change without a topology change */
+    if (vdev->dma_as != &address_space_memory || xen_enabled()) {
+        return NULL;
+    }
+
+    /* Pairs with the increment in virtio_memory_listener_commit() */
+    gen = qatomic_load_acquire(&vdev->map_cache_gen);
+
+    for (i = 0; i < VIRTQUEUE_MAP_CACHE_SIZE; i++) {
+        c = &vq->map_cache[i];
+        if (c->gen == gen && pa - c->start < c->len) {
+            goto found;
+        }
+    }
+
+    c = &vq->map_cache[vq->map_cache_next];
+    start = QEMU_ALIGN_DOWN(pa, VIRTQUEUE_MAP_CACHE_WINDOW);
+    end = start + VIRTQUEUE_MAP_CACHE_WINDOW - 1;
+    if (!virtqueue_map_cache_fill(vq, c, gen, start, end - start + 1) ||
+        pa - c->start >= c->len) {
+        /* The window starts in another region, cache from pa instead */
+        if (!virtqueue_map_cache_fill(vq, c, gen, pa, end - pa + 1)) {
+            c->len = 0;
+            return NULL;
+        }
+    }
+    vq->map_cache_next = (vq->map_cache_next + 1) % VIRTQUEUE_MAP_CACHE_SIZE;
+
+found:
+    if (is_write && !c->writable) {
+        return NULL;
+    }
+
+    dma_barrier(vdev->dma_as, is_write ? DMA_DIRECTION_FROM_DEVICE :
+                                         DMA_DIRECTION_TO_DEVICE);
+    *plen = MIN(*plen, c->len - (pa - c->start));
+    memory_region_ref(c->mr);
+    return c->host + (pa - c->start);
+}
+
+static bool virtqueue_map_desc(VirtQueue *vq, unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
                                hwaddr pa, size_t sz)
 {
+    VirtIODevice *vdev = vq->vdev;
     bool ok = false;
     unsigned num_sg = *p_num_sg;
     assert(num_sg <= max_num_sg);
@@ -1317,10 +1509,13 @@ static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
             goto out;
         }
 
-        iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
-                                              is_write ?
-                                              DMA_DIRECTION_FROM_DEVICE :
-                                              DMA_DIRECTION_TO_DEVICE);
+        iov[num_sg].iov_base = virtqueue_map_ram(vq, pa, &len, is_write);
+        if (!iov[num_sg].iov_base) {
+            iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
+                                                  is_write ?
+                                                  DMA_DIRECTION_FROM_DEVICE :
+                                                  DMA_DIRECTION_TO_DEVICE);
+        }
         if (!iov[num_sg].iov_base) {
             virtio_error(vdev, "virtio: bogus descriptor or out of resources");
             goto out;
@@ -1407,10 +1602,13 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     elem->out_addr = (void *)elem + out_addr_ofs;
     elem->in_sg = (void *)elem + in_sg_ofs;
     elem->out_sg = (void *)elem + out_sg_ofs;
+    elem->pop_time_ns = 0;
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/* Called within rcu_read_lock().  */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz,
+                                     bool set_avail_event)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1425,7 +1623,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
     if (virtio_queue_empty_rcu(vq)) {
         goto done;
     }
@@ -1447,7 +1644,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (set_avail_event &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -1491,7 +1689,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vq, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1500,7 +1698,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vq, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1547,7 +1745,8 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+/* Called within rcu_read_lock().  */
+static void *virtqueue_packed_pop_rcu(VirtQueue *vq, size_t sz)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1563,7 +1762,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     uint16_t id;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
     if (virtio_queue_packed_empty_rcu(vq)) {
         goto done;
     }
@@ -1619,7 +1817,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vq, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1628,7 +1826,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vq, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1684,15 +1882,67 @@ err_undo_map:
 
 void *virtqueue_pop(VirtQueue *vq, size_t sz)
 {
+    VirtQueueElement *elem;
+
     if (virtio_device_disabled(vq->vdev)) {
         return NULL;
     }
 
+    RCU_READ_LOCK_GUARD();
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        elem = virtqueue_packed_pop_rcu(vq, sz);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        elem = virtqueue_split_pop_rcu(vq, sz, true);
+    }
+    virtqueue_record_pop(vq, elem);
+    return elem;
+}
+
+/*
+ * virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: The size of each element to allocate, as for virtqueue_pop()
+ * @elems: Array that receives the popped elements
+ * @max: Maximum number of elements to pop
+ *
+ * Pop up to @max elements in one go.  The available index is read once
+ * and then served from its shadow copy, the RCU critical section is
+ * shared by the whole batch and, with VIRTIO_RING_F_EVENT_IDX, the
+ * avail event is written only once at the end.
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    VirtIODevice *vdev = vq->vdev;
+    bool packed;
+    unsigned int n;
+
+    if (virtio_device_disabled(vdev)) {
+        return 0;
+    }
+
+    packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
+
+    RCU_READ_LOCK_GUARD();
+    for (n = 0; n < max; n++) {
+        if (packed) {
+            elems[n] = virtqueue_packed_pop_rcu(vq, sz);
+        } else {
+            elems[n] = virtqueue_split_pop_rcu(vq, sz, false);
+        }
+        virtqueue_record_pop(vq, elems[n]);
+        if (!elems[n]) {
+            break;
+        }
     }
+
+    if (n && !packed &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
 }
 
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
@@ -2320,6 +2570,7 @@ static bool virtio_queue_notify_aio_vq(VirtQueue *vq)
         VirtIODevice *vdev = vq->vdev;
 
         trace_virtio_queue_notify(vdev, vq - vdev->vq, vq);
+        virtqueue_record_kick(vq);
         ret = vq->handle_aio_output(vdev, vq);
 
         if (unlikely(vdev->start_on_kick)) {
@@ -2340,6 +2591,7 @@ static void virtio_queue_notify_vq(VirtQueue *vq)
         }
 
         trace_virtio_queue_notify(vdev, vq - vdev->vq, vq);
+        virtqueue_record_kick(vq);
         vq->handle_output(vdev, vq);
 
         if (unlikely(vdev->start_on_kick)) {
@@ -2360,6 +2612,7 @@ void virtio_queue_notify(VirtIODevice *vdev, int n)
     if (vq->host_notifier_enabled) {
         event_notifier_set(&vq->host_notifier);
     } else if (vq->handle_output) {
+        virtqueue_record_kick(vq);
         vq->handle_output(vdev, vq);
 
         if (unlikely(vdev->start_on_kick)) {
@@ -2411,6 +2664,8 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].handle_aio_output = NULL;
     vdev->vq[i].used_elems = g_malloc0(sizeof(VirtQueueElement) *
                                        queue_size);
+    vdev->vq[i].kick_time_ns = 0;
+    vdev->vq[i].latency = g_new0(VirtQueueLatency, 1);
 
     return &vdev->vq[i];
 }
@@ -2423,6 +2678,8 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_aio_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    g_free(vq->latency);
+    vq->latency = NULL;
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2515,7 +2772,7 @@ static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 }
 
 /* Called within rcu_read_lock().  */
-static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
         return virtio_packed_should_notify(vdev, vq);
@@ -3432,6 +3689,26 @@ void virtio_queue_set_last_avail_idx(VirtIODevice *vdev, int n,
     }
 }
 
+/*
+ * Record the available index that the driver passed with
+ * VIRTIO_F_NOTIFICATION_DATA, so that checking whether the queue is
+ * empty does not need to read it from guest memory.  For packed queues
+ * @idx is the offset of the next descriptor and the wrap counter.
+ */
+void virtio_queue_set_shadow_avail_idx(VirtQueue *vq, uint16_t idx)
+{
+    if (!vq->vring.desc) {
+        return;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        vq->shadow_avail_wrap_counter = idx >> 15;
+        vq->shadow_avail_idx = idx & 0x7fff;
+    } else {
+        vq->shadow_avail_idx = idx;
+    }
+}
+
 static void virtio_queue_packed_restore_last_avail_idx(VirtIODevice *vdev,
                                                        int n)
 {
@@ -3638,6 +3915,7 @@ static void virtio_memory_listener_commit(MemoryListener *listener)
     VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
     int i;
 
+    qatomic_inc(&vdev->map_cache_gen);
     for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
         if (vdev->vq[i].vring.num == 0) {
             break;
@@ -3702,6 +3980,7 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
             break;
         }
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
+        g_free(vdev->vq[i].latency);
     }
     g_free(vdev->vq);
 }
@@ -3879,9 +4158,123 @@ static const TypeInfo virtio_device_info = {
     .class_size = sizeof(VirtioDeviceClass),
 };
 
+static StatsList *virtio_stats_add_histogram(StatsList *stats_list,
+                                             unsigned int queue,
+                                             const char *name,
+                                             const uint64_t *hist)
+{
+    Stats *stats = g_new0(Stats, 1);
+    uint64List **tail;
+    int i;
+
+    stats->name = g_strdup_printf("vq%u-%s", queue, name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QDICT;
+    tail = &stats->value->u.histogram.buckets;
+    for (i = 0; i < VIRTQUEUE_LATENCY_BUCKETS; i++) {
+        QAPI_LIST_APPEND(tail, hist[i]);
+    }
+
+    QAPI_LIST_PREPEND(stats_list, stats);
+    return stats_list;
+}
+
+typedef struct VirtioStatsArgs {
+    StatsResultList **result;
+    strList *names;
+    strList *targets;
+} VirtioStatsArgs;
+
+static int virtio_stats_add_device(Object *obj, void *opaque)
+{
+    VirtioStatsArgs *args = opaque;
+    g_autofree char *qom_path = NULL;
+    StatsList *stats_list = NULL;
+    VirtIODevice *vdev;
+    int i;
+
+    vdev = (VirtIODevice *)object_dynamic_cast(obj, TYPE_VIRTIO_DEVICE);
+    if (!vdev || !vdev->vq) {
+        return 0;
+    }
+    qom_path = object_get_canonical_path(obj);
+    if (!apply_str_list_filter(qom_path, args->targets)) {
+        return 0;
+    }
+
+    for (i = VIRTIO_QUEUE_MAX - 1; i >= 0; i--) {
+        VirtQueueLatency *latency = vdev->vq[i].latency;
+
+        if (!latency) {
+            continue;
+        }
+        if (apply_str_list_filter("pop-to-push", args->names)) {
+            stats_list = virtio_stats_add_histogram(stats_list, i,
+                                                    "pop-to-push",
+                                                    latency->pop_to_push);
+        }
+        if (apply_str_list_filter("kick-to-pop", args->names)) {
+            stats_list = virtio_stats_add_histogram(stats_list, i,
+                                                    "kick-to-pop",
+                                                    latency->kick_to_pop);
+        }
+    }
+
+    if (stats_list) {
+        add_stats_entry(args->result, STATS_PROVIDER_VIRTIO, qom_path,
+                        stats_list);
+    }
+    return 0;
+}
+
+/* Called with the BQL held, which keeps devices from going away */
+static void virtio_stats_cb(StatsResultList **result, StatsTarget target,
+                            strList *names, strList *targets, Error **errp)
+{
+    VirtioStatsArgs args = {
+        .result = result,
+        .names = names,
+        .targets = targets,
+    };
+
+    if (target == STATS_TARGET_VIRTIO_DEVICE) {
+        object_child_foreach_recursive(object_get_root(),
+                                       virtio_stats_add_device, &args);
+    }
+}
+
+static StatsSchemaValueList *virtio_stats_add_schema(StatsSchemaValueList *list,
+                                                     const char *name)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = STATS_TYPE_LOG2_HISTOGRAM;
+    value->has_unit = true;
+    value->unit = STATS_UNIT_SECONDS;
+    value->has_base = true;
+    value->base = 10;
+    value->exponent = -9;
+
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void virtio_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+
+    stats_list = virtio_stats_add_schema(stats_list, "pop-to-push");
+    stats_list = virtio_stats_add_schema(stats_list, "kick-to-pop");
+    add_stats_schema(result, STATS_PROVIDER_VIRTIO,
+                     STATS_TARGET_VIRTIO_DEVICE, stats_list);
+}
+
 static void virtio_register_types(void)
 {
     type_register_static(&virtio_device_info);
+    add_stats_callbacks(STATS_PROVIDER_VIRTIO, virtio_stats_cb,
+                        virtio_stats_schemas_cb);
 }
 
 type_init(virtio_register_types)
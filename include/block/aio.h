@@ -56,6 +56,20 @@ struct ThreadPool;
 struct LinuxAioState;
 struct LuringState;
 
+#define AIO_POLL_HIST_BUCKETS 16
+
+/* Userspace polling statistics of an AioContext */
+typedef struct AioPollStats {
+    uint64_t hits;      /* polling ended with an event */
+    uint64_t misses;    /* polling timed out without an event */
+    uint64_t time_ns;   /* total time spent polling */
+    /*
+     * Hits by polling time: bucket 0 counts hits within 1024 ns and bucket i
+     * those within (512 << i, 1024 << i] ns; the last bucket takes the rest.
+     */
+    uint64_t hist[AIO_POLL_HIST_BUCKETS];
+} AioPollStats;
+
 /* Is polling disabled? */
 bool aio_poll_disabled(AioContext *ctx);
 
@@ -197,6 +211,9 @@ struct AioContext {
      */
     struct ThreadPool *thread_pool;
 
+    /* Pool of large bounce buffers.  Has its own locking. */
+    struct BouncePool *bounce_pool;
+
 #ifdef CONFIG_LINUX_AIO
     /*
      * State for native Linux AIO.  Uses aio_context_acquire/release for
@@ -211,9 +228,16 @@ struct AioContext {
      */
     struct LuringState *linux_io_uring;
 
+    /*
+     * Second io_uring with polled completions (IORING_SETUP_IOPOLL), for
+     * reads and writes on O_DIRECT files.  Same locking as above.
+     */
+    struct LuringState *linux_io_uring_iopoll;
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+    bool fdmon_io_uring_multishot; /* multishot poll supported? */
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -231,9 +255,22 @@ struct AioContext {
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
+    int64_t poll_budget;    /* percent of a CPU polling may use, 0 = any */
+
+    AioPollStats poll_stats;
+
+    /* Accounting of poll_budget, see poll_budget_limit() */
+    int64_t poll_window_start;
+    int64_t poll_window_ns;
+    int64_t poll_cap_ns;    /* polling time limit derived from the stats */
+    uint32_t poll_window_hist[AIO_POLL_HIST_BUCKETS];
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
+    int thread_pool_min;    /* minimum number of thread pool workers */
+    int thread_pool_max;    /* maximum number of thread pool workers */
+    bool io_uring_sqpoll;   /* kernel thread polls the io_uring SQ */
+    bool io_uring_fixed;    /* register RAM and files with the io_uring */
 
     /*
      * List of handlers participating in userspace polling.  Protected by
@@ -289,7 +326,9 @@ void aio_context_unref(AioContext *ctx);
  * Bottom halves, timers and callbacks can be created or removed without
  * acquiring the AioContext.
  */
-void aio_context_acquire(AioContext *ctx);
+void aio_context_acquire_impl(AioContext *ctx, const char *file, int line);
+#define aio_context_acquire(ctx) \
+        aio_context_acquire_impl(ctx, __FILE__, __LINE__)
 
 /* Relinquish ownership of the AioContext. */
 void aio_context_release(AioContext *ctx);
@@ -509,6 +548,9 @@ GSource *aio_get_g_source(AioContext *ctx);
 /* Return the ThreadPool bound to this AioContext */
 struct ThreadPool *aio_get_thread_pool(AioContext *ctx);
 
+/* Return the BouncePool bound to this AioContext */
+struct BouncePool *aio_get_bounce_pool(AioContext *ctx);
+
 /* Setup the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 
@@ -520,6 +562,10 @@ struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/* Setup the LuringState with polled completions bound to this AioContext */
+struct LuringState *aio_setup_linux_io_uring_iopoll(AioContext *ctx,
+                                                    Error **errp);
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -751,12 +797,25 @@ void aio_context_use_g_source(AioContext *ctx);
  * @max_ns: how long to busy poll for, in nanoseconds
  * @grow: polling time growth factor
  * @shrink: polling time shrink factor
+ * @budget: percentage of a CPU that polling may use, 0 means no limit
  *
- * Poll mode can be disabled by setting poll_max_ns to 0.
+ * Poll mode can be disabled by setting poll_max_ns to 0.  With a @budget
+ * the polling time is also capped to what recent events needed, and polling
+ * stops for the rest of an accounting period once the budget is used up.
  */
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
-                                 Error **errp);
+                                 int64_t budget, Error **errp);
+
+/**
+ * aio_context_get_poll_stats:
+ * @ctx: the aio context
+ * @stats: filled in with the polling statistics of @ctx
+ *
+ * The statistics are updated by the thread of @ctx without synchronization,
+ * so they are only approximate when read from another thread.
+ */
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats);
 
 /**
  * aio_context_set_aio_params:
@@ -767,4 +826,26 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
                                 Error **errp);
 
+/**
+ * aio_context_set_thread_pool_params:
+ * @ctx: the aio context
+ * @min: minimum number of worker threads kept alive in the thread pool
+ * @max: maximum number of worker threads in the thread pool
+ */
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, Error **errp);
+
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @sqpoll: let a kernel thread poll the submission queue
+ * @fixed: register guest RAM and image files with the ring as fixed
+ *         buffers and files
+ *
+ * The parameters are used when the io_uring of @ctx is set up, so they
+ * cannot be changed once it exists.
+ */
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll, bool fixed,
+                                     Error **errp);
+
 #endif
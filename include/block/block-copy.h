@@ -50,10 +50,17 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
  * must be > 0.
  *
  * @max_chunk means maximum length for one IO operation. Zero means unlimited.
+ *
+ * If @nb_worker_ctxs is non-zero, the data of the sub-requests is copied in
+ * the AioContexts of @worker_ctxs in turn, which must stay valid until the
+ * call is finished.  This requires source and target to support requests
+ * from several AioContexts (see bdrv_supports_multi_context()).
  */
 BlockCopyCallState *block_copy_async(BlockCopyState *s,
                                      int64_t offset, int64_t bytes,
                                      int max_workers, int64_t max_chunk,
+                                     AioContext **worker_ctxs,
+                                     int nb_worker_ctxs,
                                      BlockCopyAsyncCallbackFunc cb,
                                      void *cb_opaque);
 
@@ -74,6 +81,24 @@ bool block_copy_call_cancelled(BlockCopyCallState *call_state);
 int block_copy_call_status(BlockCopyCallState *call_state, bool *error_is_read);
 
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed);
+
+/*
+ * In adaptive mode, the request length and the number of parallel requests
+ * of block_copy_async() calls are tuned from the measured throughput and
+ * latency.  @max_workers and @max_chunk of the call are then upper limits.
+ */
+void block_copy_set_adaptive(BlockCopyState *s, bool adaptive);
+
+typedef struct BlockCopyStats {
+    /* Current request length and parallel requests of background calls */
+    int64_t chunk_size;
+    int workers;
+    /* Measured for background calls over the last window, or 0 */
+    uint64_t throughput; /* bytes per second */
+    uint64_t latency_ns; /* average of one request */
+} BlockCopyStats;
+
+void block_copy_get_stats(BlockCopyState *s, BlockCopyStats *stats);
 void block_copy_kick(BlockCopyCallState *call_state);
 
 /*
@@ -32,6 +32,7 @@
 #include "qemu/stats64.h"
 #include "qemu/timer.h"
 #include "qemu/hbitmap.h"
+#include "qemu/interval-tree.h"
 #include "block/snapshot.h"
 #include "qemu/throttle.h"
 
@@ -87,6 +88,7 @@ typedef struct BdrvTrackedRequest {
     int64_t overlap_bytes;
 
     QLIST_ENTRY(BdrvTrackedRequest) list;
+    IntervalTreeNode node; /* overlap range in bs->tracked_request_tree */
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
 
@@ -120,6 +122,14 @@ struct BlockDriver {
      * on those children.
      */
     bool is_format;
+    /*
+     * Set to true if the driver's I/O path can run concurrently in
+     * coroutines of several AioContexts, without relying on the
+     * AioContext lock of the node.  Only then are the requests of a
+     * multi-context BlockBackend (see blk_set_multi_context()) run in the
+     * AioContext of their submitter.
+     */
+    bool supports_multi_context;
     /*
      * Return true if @to_replace can be replaced by a BDS with the
      * same data as @bs without it affecting @bs's behavior (that is,
@@ -420,6 +430,12 @@ struct BlockDriver {
     int64_t (*bdrv_getlength)(BlockDriverState *bs);
     bool has_variable_length;
     int64_t (*bdrv_get_allocated_file_size)(BlockDriverState *bs);
+    /*
+     * Return a file descriptor from which the data of @bs can be read with
+     * pread() or splice() at the same offsets, or -ENOTSUP.  It remains
+     * owned by the driver and is only valid while a request is in flight.
+     */
+    int (*bdrv_get_host_fd)(BlockDriverState *bs);
     BlockMeasureInfo *(*bdrv_measure)(QemuOpts *opts, BlockDriverState *in_bs,
                                       Error **errp);
 
@@ -839,6 +855,23 @@ struct BdrvChild {
     QLIST_ENTRY(BdrvChild) next_parent;
 };
 
+/*
+ * The last result that a node's driver returned from
+ * .bdrv_co_block_status, for a node that has no writers.  The extent
+ * starts at @offset and is @bytes long; @map is the host offset of
+ * @offset if @ret has BDRV_BLOCK_OFFSET_VALID.
+ */
+typedef struct BdrvBlockStatusCache {
+    bool valid;
+    bool want_zero;
+    unsigned int write_gen;
+    int ret;
+    int64_t offset;
+    int64_t bytes;
+    int64_t map;
+    BlockDriverState *file;
+} BdrvBlockStatusCache;
+
 /*
  * Note: the function bdrv_append() copies and swaps contents of
  * BlockDriverStates, so if you add new fields to this struct, please
@@ -970,6 +1003,16 @@ struct BlockDriverState {
     QemuMutex dirty_bitmap_mutex;
     QLIST_HEAD(, BdrvDirtyBitmap) dirty_bitmaps;
 
+    /*
+     * bdrv_set_dirty() does not take dirty_bitmap_mutex unless somebody
+     * else holds it.  @dirty_bitmap_setters counts the callers that are
+     * setting bits without the mutex, and @dirty_bitmap_locked is true
+     * while the mutex is held; bdrv_dirty_bitmaps_lock() waits for the
+     * former to drop to zero after setting the latter.
+     */
+    unsigned dirty_bitmap_setters;
+    bool dirty_bitmap_locked;
+
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
@@ -1002,6 +1045,7 @@ struct BlockDriverState {
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
+    IntervalTreeRoot tracked_request_tree;
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
@@ -1010,6 +1054,14 @@ struct BlockDriverState {
 
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
+
+    /*
+     * Lets chain walks skip the driver for layers that nobody writes to,
+     * such as backing files.  Protected by block_status_cache_lock, since
+     * a node may be queried from several AioContexts at once.
+     */
+    QemuSpin block_status_cache_lock;
+    BdrvBlockStatusCache block_status_cache;
 };
 
 struct BlockBackendRootState {
@@ -1236,6 +1288,9 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
  * driver that the mirror job inserts into the graph above @bs. NULL means that
  * a node name should be autogenerated.
  * @copy_mode: When to trigger writes to the target.
+ * @write_blocking_threshold: Amount of dirty data above which guest writes
+ * become synchronous in MIRROR_COPY_MODE_WRITE_BLOCKING_ON_BACKLOG, or 0 for
+ * the default.
  * @errp: Error object.
  *
  * Start a mirroring operation on @bs.  Clusters that are allocated
@@ -1252,7 +1307,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp);
+                  MirrorCopyMode copy_mode, int64_t write_blocking_threshold,
+                  Error **errp);
 
 /*
  * backup_job_create:
@@ -1302,6 +1358,13 @@ void bdrv_root_unref_child(BdrvChild *child);
 void bdrv_get_cumulative_perm(BlockDriverState *bs, uint64_t *perm,
                               uint64_t *shared_perm);
 
+/*
+ * Drop the cached block status of @bs.  Needed whenever the node's
+ * metadata can change other than through a write request, or its
+ * children change.
+ */
+void bdrv_block_status_cache_invalidate(BlockDriverState *bs);
+
 /**
  * Sets a BdrvChild's permissions.  Avoid if the parent is a BDS; use
  * bdrv_child_refresh_perms() instead and make the parent's
@@ -24,8 +24,19 @@ typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
 
+#define THREAD_POOL_MAX_THREADS_DEFAULT 64
+
+typedef struct ThreadPoolStats {
+    int threads;        /* worker threads, including those being created */
+    int idle_threads;   /* worker threads waiting for a request */
+    int queued;         /* requests waiting for a worker thread */
+    uint64_t requests;  /* requests submitted since the pool was created */
+} ThreadPoolStats;
+
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
+void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
 
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
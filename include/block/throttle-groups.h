@@ -57,8 +57,20 @@ typedef struct ThrottleGroupMember {
     unsigned       pending_reqs[2];
     QLIST_ENTRY(ThrottleGroupMember) round_robin;
 
+    /*
+     * Share of the group's I/O, see throttle_group_set_share().  vtime is
+     * the amount of I/O done by this member, scaled by its weight.
+     */
+    unsigned       weight;
+    unsigned       priority;
+    uint64_t       vtime[2];
+
 } ThrottleGroupMember;
 
+#define THROTTLE_GROUP_DEFAULT_WEIGHT 100
+#define THROTTLE_GROUP_MAX_WEIGHT     10000
+#define THROTTLE_GROUP_MAX_PRIORITY   7
+
 #define TYPE_THROTTLE_GROUP "throttle-group"
 OBJECT_DECLARE_SIMPLE_TYPE(ThrottleGroup, THROTTLE_GROUP)
 
@@ -74,6 +86,8 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
                                 const char *groupname,
                                 AioContext *ctx);
 void throttle_group_unregister_tgm(ThrottleGroupMember *tgm);
+void throttle_group_set_share(ThrottleGroupMember *tgm, unsigned weight,
+                              unsigned priority);
 void throttle_group_restart_tgm(ThrottleGroupMember *tgm);
 
 void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm,
@@ -70,6 +70,11 @@ struct Chardev {
     GSource *gsource;
     GMainContext *gcontext;
     DECLARE_BITMAP(features, QEMU_CHAR_FEATURE_LAST);
+
+    /* see qemu_chr_set_write_buffering(); protected by chr_write_lock */
+    GByteArray *write_buf;
+    guint write_buf_interval_ms;
+    GSource *write_buf_source;
 };
 
 /**
@@ -225,6 +230,23 @@ QemuOpts *qemu_chr_parse_compat(const char *label, const char *filename,
                                 bool permit_mux_mon);
 int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all);
 #define qemu_chr_write_all(s, buf, len) qemu_chr_write(s, buf, len, true)
+
+/**
+ * qemu_chr_set_write_buffering:
+ * @s: the character device
+ * @interval_ms: how long written data may be held before it reaches the
+ *               backend, or 0 to disable buffering
+ *
+ * Let qemu_chr_write() collect the data and pass it to the backend's
+ * chr_write callback in large chunks, from the chardev's main context,
+ * instead of once for every call.  Front-ends that write one byte at a
+ * time then no longer cost a system call for each byte.
+ *
+ * Buffered writes always succeed, so this is only suitable for backends
+ * without flow control, such as files.  Disabling buffering flushes the
+ * buffer; backends must do so before they close their output.
+ */
+void qemu_chr_set_write_buffering(Chardev *s, unsigned interval_ms);
 int qemu_chr_wait_connected(Chardev *chr, Error **errp);
 
 #define TYPE_CHARDEV "chardev"
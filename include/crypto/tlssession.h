@@ -321,4 +321,32 @@ int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
  */
 char *qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess);
 
+/**
+ * qcrypto_tls_session_set_socket:
+ * @sess: the TLS session object
+ * @fd: the socket that carries the session
+ *
+ * Perform the session's I/O directly on @fd, instead of using the
+ * callbacks set with qcrypto_tls_session_set_callbacks().  This is
+ * only done if the credentials have the "ktls" property set, as it lets
+ * the TLS library move the record layer into the kernel (kTLS) once the
+ * handshake has completed, if both the library and the kernel support
+ * it.  This must be called before the handshake starts.
+ *
+ * Returns: true if the session now uses @fd, false otherwise
+ */
+bool qcrypto_tls_session_set_socket(QCryptoTLSSession *sess, int fd);
+
+/**
+ * qcrypto_tls_session_has_ktls_send:
+ * @sess: the TLS session object
+ *
+ * Check whether records sent on the session are encrypted by the kernel,
+ * in which case payload data can be written directly to the socket.
+ * This is only meaningful once the handshake has completed.
+ *
+ * Returns: true if the kernel encrypts outgoing records
+ */
+bool qcrypto_tls_session_has_ktls_send(QCryptoTLSSession *sess);
+
 #endif /* QCRYPTO_TLSSESSION_H */
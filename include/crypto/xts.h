@@ -29,6 +29,10 @@
 
 #define XTS_BLOCK_SIZE 16
 
+/*
+ * The cipher functions may be asked to process several blocks at once;
+ * @length is always a multiple of XTS_BLOCK_SIZE.
+ */
 typedef void xts_cipher_func(const void *ctx,
                              size_t length,
                              uint8_t *dst,
@@ -45,6 +45,18 @@ typedef uintptr_t ram_addr_t;
 /* memory API */
 
 void qemu_ram_remap(ram_addr_t addr, ram_addr_t length);
+/**
+ * qemu_ram_map_file_private: map a file copy-on-write over guest RAM
+ *
+ * Replaces @length bytes of @block at @offset with a private mapping of
+ * @fd at @fd_offset, so the pages stay shared with the page cache until
+ * the guest writes to them.  Called within RCU critical section.
+ *
+ * Returns false if @block cannot be remapped; the caller then has to copy
+ * the data instead.
+ */
+bool qemu_ram_map_file_private(RAMBlock *block, ram_addr_t offset,
+                               ram_addr_t length, int fd, off_t fd_offset);
 /* This should not be used by devices.  */
 ram_addr_t qemu_ram_addr_from_host(void *ptr);
 RAMBlock *qemu_ram_block_by_name(const char *name);
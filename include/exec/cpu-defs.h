@@ -150,6 +150,21 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+/*
+ * A translation of size larger than TARGET_PAGE_SIZE, as passed to
+ * tlb_set_page_with_attrs.  Kept so that a miss on another page of
+ * the same mapping can be refilled without a page table walk.
+ */
+typedef struct CPUTLBLargeEntry {
+    target_ulong vaddr;
+    target_ulong size;
+    hwaddr paddr;
+    MemTxAttrs attrs;
+    int prot;
+} CPUTLBLargeEntry;
+
+#define CPU_TLB_LARGE_SIZE 8
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
@@ -173,6 +188,14 @@ typedef struct CPUTLBDesc {
     /* The tlb victim table, in two parts.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUIOTLBEntry viotlb[CPU_VTLB_SIZE];
+    /* The next index to use in the large page table.  */
+    size_t lindex;
+    /*
+     * Large pages installed since the last flush of this mmu_idx.
+     * Since flushing any page inside large_page_addr/mask flushes the
+     * whole mmu_idx, these remain valid until the next full flush.
+     */
+    CPUTLBLargeEntry ltable[CPU_TLB_LARGE_SIZE];
     /* The iotlb.  */
     CPUIOTLBEntry *iotlb;
 } CPUTLBDesc;
@@ -188,6 +211,20 @@ typedef struct CPUTLBDescFast {
     CPUTLBEntry *table;
 } CPUTLBDescFast QEMU_ALIGNED(2 * sizeof(void *));
 
+/* A range of pages to flush from the TLBs in @idxmap */
+typedef struct TLBFlushRangeData {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+    uint16_t bits;
+} TLBFlushRangeData;
+
+/*
+ * Number of page or range flushes from other vCPUs that can be queued
+ * for a vCPU before they are folded into a flush of the whole mmu_idx.
+ */
+#define CPU_TLB_PENDING_RANGES 16
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -200,6 +237,16 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Page and range flushes requested by other vCPUs, performed in
+     * one batch by a single queued work item.  Once the array is full,
+     * further requests accumulate in pending_overflow and flush their
+     * mmu_idx completely.  Protected by tlb_c.lock.
+     */
+    bool pending_queued;
+    uint16_t n_pending;
+    uint16_t pending_overflow;
+    TLBFlushRangeData pending[CPU_TLB_PENDING_RANGES];
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -208,6 +255,7 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t large_page_fill_count;
 } CPUTLBCommon;
 
 /*
@@ -305,8 +305,11 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
  * which provoked the TLB miss.
  *
  * At most one entry for a given virtual address is permitted. Only a
- * single TARGET_PAGE_SIZE region is mapped; the supplied @size is only
- * used by tlb_flush_page.
+ * single TARGET_PAGE_SIZE region is mapped; if the supplied @size is
+ * larger, it is used by tlb_flush_page and the translation of the
+ * whole naturally aligned @size region is remembered, so that misses
+ * on its other pages can be refilled without calling tlb_fill().
+ * The remembered translation is dropped on the next flush of @mmu_idx.
  */
 void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
                              hwaddr paddr, MemTxAttrs attrs,
@@ -498,6 +501,7 @@ struct TranslationBlock {
 #define CF_NO_GOTO_TB    0x00000200 /* Do not chain with goto_tb */
 #define CF_NO_GOTO_PTR   0x00000400 /* Do not chain with goto_ptr */
 #define CF_SINGLE_STEP   0x00000800 /* gdbstub single-step in effect */
+#define CF_TRACE         0x00001000 /* Hot TB, retranslated as a trace */
 #define CF_LAST_IO       0x00008000 /* Last insn may be an IO access.  */
 #define CF_MEMI_ONLY     0x00010000 /* Only instrument memory ops */
 #define CF_USE_ICOUNT    0x00020000
@@ -559,6 +563,12 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /*
+     * Executions left before the TB is retranslated with CF_TRACE.  Only
+     * decremented by the generated code if tb_trace_threshold is nonzero.
+     */
+    int32_t hot_count;
 };
 
 /* Hide the qatomic_read to make code a little easier on the eyes */
@@ -570,6 +580,12 @@ static inline uint32_t tb_cflags(const TranslationBlock *tb)
 /* current cflags for hashing/comparison */
 uint32_t curr_cflags(CPUState *cpu);
 
+/*
+ * Number of executions after which a TB is retranslated with CF_TRACE,
+ * or 0 to disable the profiling counters.
+ */
+extern uint32_t tb_trace_threshold;
+
 /* TranslationBlock invalidate API */
 #if defined(CONFIG_USER_ONLY)
 void tb_invalidate_phys_addr(target_ulong addr);
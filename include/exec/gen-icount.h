@@ -68,6 +68,28 @@ static inline void gen_tb_start(const TranslationBlock *tb)
     }
 
     tcg_temp_free_i32(count);
+
+    /*
+     * Count executions of the TB, so that hot code can be retranslated
+     * as a trace.  Chained TBs never go through the main loop, hence the
+     * counter lives in the generated code.
+     */
+    tcg_ctx->hot_label = NULL;
+    if (tb_trace_threshold &&
+        !(tb_cflags(tb) & (CF_TRACE | CF_USE_ICOUNT | CF_SINGLE_STEP |
+                           CF_COUNT_MASK))) {
+        TCGv_ptr ptr = tcg_const_ptr(&tb->hot_count);
+        TCGv_i32 hot = tcg_temp_new_i32();
+
+        tcg_ctx->hot_label = gen_new_label();
+        tcg_gen_ld_i32(hot, ptr, 0);
+        tcg_gen_subi_i32(hot, hot, 1);
+        tcg_gen_st_i32(hot, ptr, 0);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, hot, 0, tcg_ctx->hot_label);
+
+        tcg_temp_free_i32(hot);
+        tcg_temp_free_ptr(ptr);
+    }
 }
 
 static inline void gen_tb_end(const TranslationBlock *tb, int num_insns)
@@ -83,6 +105,11 @@ static inline void gen_tb_end(const TranslationBlock *tb, int num_insns)
 
     gen_set_label(tcg_ctx->exitreq_label);
     tcg_gen_exit_tb(tb, TB_EXIT_REQUESTED);
+
+    if (tcg_ctx->hot_label) {
+        gen_set_label(tcg_ctx->hot_label);
+        tcg_gen_exit_tb(tb, TB_EXIT_HOT);
+    }
 }
 
 #endif
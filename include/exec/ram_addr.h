@@ -336,10 +336,8 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                                                           ram_addr_t start,
                                                           ram_addr_t pages)
 {
-    unsigned long i, j;
-    unsigned long page_number, c;
-    hwaddr addr;
-    ram_addr_t ram_addr;
+    unsigned long i, j, n;
+    unsigned long c;
     unsigned long len = (pages + HOST_LONG_BITS - 1) / HOST_LONG_BITS;
     unsigned long hpratio = qemu_real_host_page_size / TARGET_PAGE_SIZE;
     unsigned long page = BIT_WORD(start >> TARGET_PAGE_BITS);
@@ -369,7 +367,7 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
 
                     qatomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset], temp);
 
-                    if (global_dirty_log) {
+                    if (global_dirty_tracking & GLOBAL_DIRTY_MIGRATION) {
                         qatomic_or(
                                 &blocks[DIRTY_MEMORY_MIGRATION][idx][offset],
                                 temp);
@@ -391,29 +389,46 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
         xen_hvm_modified_memory(start, pages << TARGET_PAGE_BITS);
     } else {
         uint8_t clients = tcg_enabled() ? DIRTY_CLIENTS_ALL : DIRTY_CLIENTS_NOCODE;
+        ram_addr_t run_start = 0, run_len = 0;
+        const ram_addr_t host_page_size = TARGET_PAGE_SIZE * hpratio;
 
-        if (!global_dirty_log) {
+        if (!(global_dirty_tracking & GLOBAL_DIRTY_MIGRATION)) {
             clients &= ~(1 << DIRTY_MEMORY_MIGRATION);
         }
 
         /*
          * bitmap-traveling is faster than memory-traveling (for addr...)
-         * especially when most of the memory is not dirty.
+         * especially when most of the memory is not dirty.  Runs of dirty
+         * pages, also across words, are set with a single call so that
+         * the destination bitmaps are updated a word at a time.
          */
         for (i = 0; i < len; i++) {
-            if (bitmap[i] != 0) {
-                c = leul_to_cpu(bitmap[i]);
-                do {
-                    j = ctzl(c);
-                    c &= ~(1ul << j);
-                    page_number = (i * HOST_LONG_BITS + j) * hpratio;
-                    addr = page_number * TARGET_PAGE_SIZE;
-                    ram_addr = start + addr;
-                    cpu_physical_memory_set_dirty_range(ram_addr,
-                                       TARGET_PAGE_SIZE * hpratio, clients);
-                } while (c != 0);
+            c = leul_to_cpu(bitmap[i]);
+            while (c != 0) {
+                j = ctzl(c);
+                n = ctol(c >> j);
+                if (run_len && run_start + run_len == i * HOST_LONG_BITS + j) {
+                    run_len += n;
+                } else {
+                    if (run_len) {
+                        cpu_physical_memory_set_dirty_range(
+                            start + run_start * host_page_size,
+                            run_len * host_page_size, clients);
+                    }
+                    run_start = i * HOST_LONG_BITS + j;
+                    run_len = n;
+                }
+                if (j + n == HOST_LONG_BITS) {
+                    break;
+                }
+                c &= ~0ul << (j + n);
             }
         }
+        if (run_len) {
+            cpu_physical_memory_set_dirty_range(
+                start + run_start * host_page_size,
+                run_len * host_page_size, clients);
+        }
     }
 }
 #endif /* not _WIN32 */
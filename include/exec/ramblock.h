@@ -69,6 +69,23 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * With mapped-ram migration: bitmap of the pages present in the
+     * migration file, and the offsets in the file of that bitmap and
+     * of the region holding the pages of this block.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    uint64_t pages_offset;
+
+    /*
+     * With a background snapshot to a mapped-ram file: the number of
+     * pages still to be saved in each chunk of 1 << wp_chunk_shift bytes.
+     * A chunk stays write protected until all of its pages are saved.
+     */
+    unsigned int *wp_pending;
+    uint8_t wp_chunk_shift;
 };
 #endif
 #endif
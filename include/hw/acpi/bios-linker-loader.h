@@ -1,6 +1,7 @@
 #ifndef BIOS_LINKER_LOADER_H
 #define BIOS_LINKER_LOADER_H
 
+#include "exec/hwaddr.h"
 
 typedef struct BIOSLinker {
     GArray *cmd_blob;
@@ -35,5 +36,9 @@ void bios_linker_loader_write_pointer(BIOSLinker *linker,
                                       const char *src_file,
                                       uint32_t src_offset);
 
+bool bios_linker_loader_run(const BIOSLinker *linker, hwaddr base,
+                            hwaddr size, const char *file_name,
+                            hwaddr *addr, Error **errp);
+
 void bios_linker_loader_cleanup(BIOSLinker *linker);
 #endif
@@ -288,6 +288,7 @@ struct qemu_work_item;
  * @opaque: User data.
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
+ * @kvm_vcpu_stats_fd: Binary statistics file descriptor of the vCPU, or -1.
  * @work_mutex: Lock to prevent multiple access to @work_list.
  * @work_list: List of pending asynchronous work.
  * @trace_dstate_delayed: Delayed changes to trace_dstate (includes all changes
@@ -301,6 +302,8 @@ struct qemu_work_item;
  *    ring is enabled.
  * @kvm_fetch_index: Keeps the index that we last fetched from the per-vCPU
  *    dirty ring structure.
+ * @dirty_pages: Number of dirty pages collected from the dirty ring of this
+ *    CPU since it was created.
  *
  * State of one CPU core or thread.
  */
@@ -347,12 +350,22 @@ struct CPUState {
     int num_ases;
     AddressSpace *as;
     MemoryRegion *memory;
+    /* the vCPU thread gets the CPU affinity of this context */
+    ThreadContext *thread_context;
 
     void *env_ptr; /* CPUArchState */
     IcountDecr *icount_decr_ptr;
 
     /* Accessed in parallel; all accesses must be atomic */
     TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    /*
+     * Second way of tb_jmp_cache, with the same index and access rules:
+     * holds the entry most recently displaced from tb_jmp_cache.
+     */
+    TranslationBlock *tb_jmp_victim[TB_JMP_CACHE_SIZE];
+    /* Lookups served from tb_jmp_victim, and those that fell to the qht */
+    size_t tb_jmp_victim_hits;
+    size_t tb_jmp_misses;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -374,10 +387,12 @@ struct CPUState {
 
     /* Only used in KVM */
     int kvm_fd;
+    int kvm_vcpu_stats_fd;
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
+    uint64_t dirty_pages;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -407,6 +422,13 @@ struct CPUState {
      */
     bool throttle_thread_scheduled;
 
+    /*
+     * Percentage of time this vCPU sleeps to keep its dirty page rate under
+     * its dirty limit, and whether a sleep is already scheduled for it.
+     */
+    unsigned int dirtylimit_throttle_pct;
+    bool dirtylimit_thread_scheduled;
+
     bool ignore_memory_transaction_failures;
 
     struct hax_vcpu_state *hax_vcpu;
@@ -434,6 +456,7 @@ static inline void cpu_tb_jmp_cache_clear(CPUState *cpu)
 
     for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
         qatomic_set(&cpu->tb_jmp_cache[i], NULL);
+        qatomic_set(&cpu->tb_jmp_victim[i], NULL);
     }
 }
 
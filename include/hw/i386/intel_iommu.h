@@ -24,6 +24,7 @@
 
 #include "hw/i386/x86-iommu.h"
 #include "qemu/iova-tree.h"
+#include "qemu/rcu.h"
 #include "qom/object.h"
 
 #define TYPE_INTEL_IOMMU_DEVICE "intel-iommu"
@@ -50,6 +51,9 @@ OBJECT_DECLARE_SIMPLE_TYPE(IntelIOMMUState, INTEL_IOMMU_DEVICE)
 
 #define DMAR_REPORT_F_INTR          (1)
 
+/* Number of translations cached by each VTDAddressSpace, a power of 2 */
+#define VTD_AS_IOTLB_CACHE_SIZE     64
+
 #define  VTD_MSI_ADDR_HI_MASK        (0xffffffff00000000ULL)
 #define  VTD_MSI_ADDR_HI_SHIFT       (32)
 #define  VTD_MSI_ADDR_LO_MASK        (0x00000000ffffffffULL)
@@ -58,6 +62,7 @@ typedef struct VTDContextEntry VTDContextEntry;
 typedef struct VTDContextCacheEntry VTDContextCacheEntry;
 typedef struct VTDAddressSpace VTDAddressSpace;
 typedef struct VTDIOTLBEntry VTDIOTLBEntry;
+typedef struct VTDIOTLBCacheEntry VTDIOTLBCacheEntry;
 typedef struct VTDBus VTDBus;
 typedef union VTD_IR_TableEntry VTD_IR_TableEntry;
 typedef union VTD_IR_MSIAddress VTD_IR_MSIAddress;
@@ -109,6 +114,12 @@ struct VTDAddressSpace {
     /* Superset of notifier flags that this address space has */
     IOMMUNotifierFlag notifier_flags;
     IOVATree *iova_tree;          /* Traces mapped IOVA ranges */
+    /*
+     * Translations that can be looked up without the IOMMU lock,
+     * indexed by a hash of the page number at their page size.
+     * Updated under the IOMMU lock, read under RCU.
+     */
+    VTDIOTLBCacheEntry *iotlb_cache[VTD_AS_IOTLB_CACHE_SIZE];
 };
 
 struct VTDBus {
@@ -125,6 +136,17 @@ struct VTDIOTLBEntry {
     uint8_t access_flags;
 };
 
+/* A translation in VTDAddressSpace.iotlb_cache, immutable once published */
+struct VTDIOTLBCacheEntry {
+    struct rcu_head rcu;
+    /* The entry is obsolete if gen != IntelIOMMUState.iotlb_cache_gen */
+    uint32_t gen;
+    hwaddr iova;
+    hwaddr translated_addr;
+    hwaddr addr_mask;
+    IOMMUAccessFlags perm;
+};
+
 /* VT-d Source-ID Qualifier types */
 enum {
     VTD_SQ_FULL = 0x00,     /* Full SID verification */
@@ -251,6 +273,19 @@ struct IntelIOMMUState {
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
     GHashTable *iotlb;              /* IOTLB */
+    /* Bumped by every IOTLB and context-cache invalidation, never 0 */
+    uint32_t iotlb_cache_gen;
+
+    /*
+     * Page-selective invalidation whose notification is deferred while
+     * the invalidation queue is processed, so that consecutive ranges
+     * are synced with a single page walk
+     */
+    bool qi_processing;
+    bool psi_pending;
+    uint16_t psi_domain_id;
+    hwaddr psi_addr;
+    hwaddr psi_size;
 
     GHashTable *vtd_as_by_busptr;   /* VTDBus objects indexed by PCIBus* reference */
     VTDBus *vtd_as_by_bus_num[VTD_PCI_BUS_MAX]; /* VTDBus objects indexed by bus number */
@@ -67,6 +67,16 @@
 #define PCIE_ECAM_BASE        0xe0000000
 #define PCIE_ECAM_SIZE        0x10000000
 
+/*
+ * With direct-boot=on, the boot information and the ACPI tables are
+ * placed where the BIOS would otherwise be, which the memory map given
+ * to the guest marks as reserved.
+ */
+#define MICROVM_BOOT_INFO_BASE 0xe0000
+#define MICROVM_BOOT_INFO_SIZE 0x10000
+#define MICROVM_BOOT_ACPI_BASE 0xf0000
+#define MICROVM_BOOT_ACPI_SIZE 0x10000
+
 /* Machine type options */
 #define MICROVM_MACHINE_PIT                 "pit"
 #define MICROVM_MACHINE_PIC                 "pic"
@@ -76,6 +86,7 @@
 #define MICROVM_MACHINE_ISA_SERIAL          "isa-serial"
 #define MICROVM_MACHINE_OPTION_ROMS         "x-option-roms"
 #define MICROVM_MACHINE_AUTO_KERNEL_CMDLINE "auto-kernel-cmdline"
+#define MICROVM_MACHINE_DIRECT_BOOT         "direct-boot"
 
 struct MicrovmMachineClass {
     X86MachineClass parent;
@@ -95,12 +106,17 @@ struct MicrovmMachineState {
     bool isa_serial;
     bool option_roms;
     bool auto_kernel_cmdline;
+    bool direct_boot;
 
     /* Machine state */
     uint32_t pcie_irq_base;
     uint32_t virtio_irq_base;
     uint32_t virtio_num_transports;
     bool kernel_cmdline_fixed;
+    uint32_t pvh_entry;
+    hwaddr initrd_addr;
+    hwaddr initrd_size;
+    hwaddr rsdp_addr;
     Notifier machine_done;
     Notifier powerdown_req;
     struct GPEXConfig gpex;
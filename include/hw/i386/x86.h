@@ -116,6 +116,15 @@ void x86_cpu_unplug_cb(HotplugHandler *hotplug_dev,
 void x86_bios_rom_init(MachineState *ms, const char *default_firmware,
                        MemoryRegion *rom_memory, bool isapc_ram_fw);
 
+/*
+ * Load the uncompressed kernel @kernel_filename, whose first bytes are
+ * in @header, at the addresses it was linked for, and return the
+ * entry point given by its PVH ELF note and the range it occupies.
+ * Returns false if the kernel is not an ELF file; exits on errors.
+ */
+bool x86_load_elf_pvh(const char *kernel_filename, uint8_t *header,
+                      uint32_t *pvh_entry, uint64_t *low, uint64_t *high);
+
 void x86_load_linux(X86MachineState *x86ms,
                     FWCfgState *fw_cfg,
                     int acpi_data_size,
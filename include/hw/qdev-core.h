@@ -168,6 +168,9 @@ struct NamedClockList {
  *            When accessed outside big qemu lock, must be accessed with
  *            qatomic_load_acquire()
  * @reset: ResettableState for the device; handled by Resettable interface.
+ * @realize_start_us: time at which the device was last realized, in
+ *                    microseconds since QEMU started
+ * @realize_us: time spent in the device's realize method, in microseconds
  *
  * This structure should not be accessed directly.  We declare it here
  * so that it can be embedded in individual device state structures.
@@ -192,6 +195,8 @@ struct DeviceState {
     int instance_id_alias;
     int alias_required_for_version;
     ResettableState reset;
+    int64_t realize_start_us;
+    int64_t realize_us;
 };
 
 struct DeviceListener {
@@ -825,6 +830,14 @@ typedef enum MachineInitPhase {
      */
     PHASE_ACCEL_CREATED,
 
+    /*
+     * Late backends, including memory backends, have been created.  The
+     * preallocation of their memory may still be running in the background
+     * until the machine is ready; memory backends created from now on are
+     * preallocated synchronously.
+     */
+    PHASE_LATE_BACKENDS_CREATED,
+
     /*
      * machine_class->init has been called, thus creating any embedded
      * devices and validating machine properties.  Devices created at
@@ -843,4 +856,10 @@ typedef enum MachineInitPhase {
 extern bool phase_check(MachineInitPhase phase);
 extern void phase_advance(MachineInitPhase phase);
 
+/*
+ * Return the time at which @phase was reached, in microseconds since
+ * QEMU started.  @phase must have been reached already.
+ */
+int64_t phase_get_time_us(MachineInitPhase phase);
+
 #endif
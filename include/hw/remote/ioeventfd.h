@@ -0,0 +1,42 @@
+/*
+ * ioeventfds of remote devices
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef REMOTE_IOEVENTFD_H
+#define REMOTE_IOEVENTFD_H
+
+#include "exec/memory.h"
+#include "hw/pci/pci.h"
+#include "io/channel.h"
+#include "qemu/queue.h"
+
+typedef struct RemoteIoeventfd RemoteIoeventfd;
+
+typedef struct RemoteIoeventfdState {
+    PCIBus *bus;
+    MemoryListener mem_listener;
+    MemoryListener io_listener;
+    /* ioeventfds that have been sent to the proxy or are about to be */
+    QTAILQ_HEAD(, RemoteIoeventfd) active;
+    /* changes not yet sent to the proxy */
+    QTAILQ_HEAD(, RemoteIoeventfd) pending;
+} RemoteIoeventfdState;
+
+void remote_ioeventfd_init(RemoteIoeventfdState *state, PCIBus *bus);
+
+/*
+ * Send the ioeventfds that were added to or removed from the BARs of
+ * @dev to its proxy.  This must be called before replying to a message
+ * that may have changed them, so that the proxy has caught up when it
+ * resumes the guest.
+ */
+bool remote_ioeventfd_flush(PCIDevice *dev, QIOChannel *ioc, Error **errp);
+
+/* Forget about the ioeventfds of @dev, once its proxy has gone away */
+void remote_ioeventfd_forget(PCIDevice *dev);
+
+#endif
@@ -16,12 +16,14 @@
 #include "hw/pci-host/remote.h"
 #include "io/channel.h"
 #include "hw/remote/iohub.h"
+#include "hw/remote/ioeventfd.h"
 
 struct RemoteMachineState {
     MachineState parent_obj;
 
     RemotePCIHost *host;
     RemoteIOHubState iohub;
+    RemoteIoeventfdState ioeventfd;
 };
 
 /* Used to pass to co-routine device and ioc. */
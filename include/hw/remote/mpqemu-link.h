@@ -41,6 +41,7 @@ typedef enum {
     MPQEMU_CMD_BAR_READ,
     MPQEMU_CMD_SET_IRQFD,
     MPQEMU_CMD_DEVICE_RESET,
+    MPQEMU_CMD_SET_IOEVENTFD,
     MPQEMU_CMD_MAX,
 } MPQemuCmd;
 
@@ -63,6 +64,20 @@ typedef struct {
     bool memory;
 } BarAccessMsg;
 
+/*
+ * Sent by the remote process, before its reply to the message that
+ * caused the change, when the device adds an ioeventfd to (@assign is
+ * true, with the eventfd attached) or removes one from one of its BARs.
+ */
+typedef struct {
+    int bar;
+    uint64_t offset;
+    unsigned size;
+    bool match_data;
+    uint64_t data;
+    bool assign;
+} IoeventfdMsg;
+
 /**
  * MPQemuMsg:
  * @cmd: The remote command
@@ -83,6 +98,7 @@ typedef struct {
         PciConfDataMsg pci_conf_data;
         SyncSysmemMsg sync_sysmem;
         BarAccessMsg bar_access;
+        IoeventfdMsg ioeventfd;
     } data;
 
     int fds[REMOTE_MAX_FDS];
@@ -96,4 +112,6 @@ uint64_t mpqemu_msg_send_and_await_reply(MPQemuMsg *msg, PCIProxyDev *pdev,
                                          Error **errp);
 bool mpqemu_msg_valid(MPQemuMsg *msg);
 
+void proxy_set_ioeventfd(PCIProxyDev *pdev, MPQemuMsg *msg);
+
 #endif
@@ -17,6 +17,16 @@
 #define TYPE_PCI_PROXY_DEV "x-pci-proxy-dev"
 OBJECT_DECLARE_SIMPLE_TYPE(PCIProxyDev, PCI_PROXY_DEV)
 
+typedef struct ProxyIoeventfd {
+    int bar;
+    uint64_t offset;
+    unsigned size;
+    bool match_data;
+    uint64_t data;
+    EventNotifier e;
+    QLIST_ENTRY(ProxyIoeventfd) next;
+} ProxyIoeventfd;
+
 typedef struct ProxyMemoryRegion {
     PCIProxyDev *dev;
     MemoryRegion mr;
@@ -43,6 +53,7 @@ struct PCIProxyDev {
     EventNotifier intr;
     EventNotifier resample;
     ProxyMemoryRegion region[PCI_NUM_REGIONS];
+    QLIST_HEAD(, ProxyIoeventfd) ioeventfds;
 };
 
 #endif /* PROXY_H */
@@ -77,6 +77,9 @@ struct SCSIDevice
     uint8_t sense[SCSI_SENSE_BUF_SIZE];
     uint32_t sense_len;
     QTAILQ_HEAD(, SCSIRequest) requests;
+    /* Freed requests kept for reuse, all of the same size */
+    QTAILQ_HEAD(, SCSIRequest) req_pool;
+    unsigned req_pool_len;
     uint32_t channel;
     uint32_t lun;
     int blocksize;
@@ -89,6 +89,9 @@ typedef struct VFIOContainer {
     uint64_t max_dirty_bitmap_size;
     unsigned long pgsizes;
     unsigned int dma_max_mappings;
+    uint64_t dirty_syncs;       /* dirty bitmaps retrieved */
+    uint64_t dirty_pages;       /* host pages reported dirty */
+    uint64_t dirty_sync_ns;     /* time spent retrieving and merging them */
     QLIST_HEAD(, VFIOGuestIOMMU) giommu_list;
     QLIST_HEAD(, VFIOHostDMAWindow) hostwin_list;
     QLIST_HEAD(, VFIOGroup) group_list;
@@ -21,6 +21,14 @@ typedef struct VhostUserState {
     CharBackend *chr;
     VhostUserHostNotifier notifier[VIRTIO_QUEUE_MAX];
     int memory_slots;
+    /*
+     * Per-connection features negotiated by the device with vq_index 0,
+     * reused by the other queue pairs of a multiqueue device.
+     */
+    bool negotiated;
+    uint64_t backend_features;
+    uint64_t protocol_features;
+    uint64_t max_queues;
 } VhostUserState;
 
 bool vhost_user_init(VhostUserState *user, CharBackend *chr, Error **errp);
@@ -13,6 +13,7 @@
 #define HW_VIRTIO_VHOST_VDPA_H
 
 #include "hw/virtio/virtio.h"
+#include "standard-headers/linux/vhost_types.h"
 
 typedef struct VhostVDPAHostNotifier {
     MemoryRegion mr;
@@ -25,6 +26,11 @@ typedef struct vhost_vdpa {
     MemoryListener listener;
     struct vhost_dev *dev;
     VhostVDPAHostNotifier notifier[VIRTIO_QUEUE_MAX];
+    /* Interpose QEMU-owned vrings between the guest and the device */
+    bool shadow_vqs_enabled;
+    struct vhost_vdpa_iova_range iova_range;
+    /* One per virtqueue of dev, if shadow_vqs_enabled */
+    struct VhostShadowVirtqueue **shadow_vqs;
 } VhostVDPA;
 
 #endif
@@ -36,6 +36,8 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    /* ':'-separated ids of the IOThreads the virtqueues are spread over */
+    char *iothread_vq_mapping;
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
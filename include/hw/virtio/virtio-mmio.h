@@ -60,6 +60,9 @@ struct VirtIOMMIOProxy {
     qemu_irq irq;
     bool legacy;
     uint32_t flags;
+    /* Inject queue interrupts through KVM; the line must be edge-triggered */
+    bool irqfd;
+    bool irqfd_active;
     /* Guest accessible state needing migration and reset */
     uint32_t host_features_sel;
     uint32_t guest_features_sel;
@@ -20,6 +20,7 @@
 #include "net/announce.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "sysemu/iothread.h"
 
 #include "ebpf/ebpf_rss.h"
 
@@ -47,6 +48,7 @@ typedef struct virtio_net_conf
     char *duplex_str;
     uint8_t duplex;
     char *primary_id_str;
+    char *iothread_vq_mapping;
 } virtio_net_conf;
 
 /* Coalesced packets type & status */
@@ -87,6 +89,7 @@ typedef struct VirtioNetRscStat {
     uint32_t purge_failed;
     uint32_t drain_failed;
     uint32_t final_failed;
+    uint32_t gro_bypass;
     int64_t  timer;
 } VirtioNetRscStat;
 
@@ -107,6 +110,7 @@ typedef struct VirtioNetRscSeg {
     uint16_t packets;
     uint16_t dup_ack;
     bool is_coalesced;      /* need recal ipv4 header checksum, mark here */
+    uint16_t gso_size;      /* payload of the first data segment, for GRO */
     VirtioNetRscUnit unit;
     NetClientState *nc;
 } VirtioNetRscSeg;
@@ -120,6 +124,7 @@ typedef struct VirtioNetRscChain {
     uint8_t  gso_type;
     uint16_t max_payload;
     QEMUTimer *drain_timer;
+    QEMUBH *drain_bh;                        /* GRO flush after a burst */
     QTAILQ_HEAD(, VirtioNetRscSeg) buffers;
     VirtioNetRscStat stat;
 } VirtioNetRscChain;
@@ -152,6 +157,12 @@ typedef struct VirtIONetQueue {
         VirtQueueElement *elem;
     } async_tx;
     struct VirtIONet *n;
+    /* IOThread of the queue pair with iothread-vq-mapping, or NULL */
+    AioContext *ctx;
+    /* Statistics, read-only QOM properties x-rxq<N>-packets etc. */
+    uint64_t rx_packets;
+    uint64_t rx_steered;
+    uint64_t tx_packets;
 } VirtIONetQueue;
 
 struct VirtIONet {
@@ -173,6 +184,9 @@ struct VirtIONet {
     uint32_t rsc_timeout;
     uint8_t rsc4_enabled;
     uint8_t rsc6_enabled;
+    /* Coalesce for any guest with TSO, reporting the result as GSO */
+    bool gro;
+    uint8_t gro_enabled;
     uint8_t has_ufo;
     uint32_t mergeable_rx_bufs;
     uint8_t promisc;
@@ -182,6 +196,10 @@ struct VirtIONet {
     uint8_t nouni;
     uint8_t nobcast;
     uint8_t vhost_started;
+    /* IOThreads of iothread-vq-mapping, assigned round-robin to queues */
+    IOThread **iothreads;
+    unsigned num_iothreads;
+    bool iothreads_started;
     struct {
         uint32_t in_use;
         uint32_t first_multi;
@@ -26,12 +26,24 @@ OBJECT_DECLARE_TYPE(VirtIOPMEM, VirtIOPMEMClass,
 #define VIRTIO_PMEM_ADDR_PROP "memaddr"
 #define VIRTIO_PMEM_MEMDEV_PROP "memdev"
 
+typedef struct VirtIODeviceRequest VirtIODeviceRequest;
+
 struct VirtIOPMEM {
     VirtIODevice parent_obj;
 
     VirtQueue *rq_vq;
     uint64_t start;
     HostMemoryBackend *memdev;
+    bool datasync;
+
+    /*
+     * Requests that arrive while a flush is running wait in pending_reqs
+     * and are all completed by the next flush.
+     */
+    bool flush_in_flight;
+    int flush_fd;
+    QSIMPLEQ_HEAD(, VirtIODeviceRequest) pending_reqs;
+    QSIMPLEQ_HEAD(, VirtIODeviceRequest) flushing_reqs;
 };
 
 struct VirtIOPMEMClass {
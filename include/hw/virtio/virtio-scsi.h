@@ -62,6 +62,8 @@ struct VirtIOSCSIConf {
     CharBackend chardev;
     uint32_t boot_tpgt;
     IOThread *iothread;
+    /* ':'-separated ids of the IOThreads the command queues are spread over */
+    char *iothread_vq_mapping;
 };
 
 struct VirtIOSCSI;
@@ -85,7 +87,15 @@ struct VirtIOSCSI {
     bool events_dropped;
 
     /* Fields for dataplane below */
-    AioContext *ctx; /* one iothread per virtio-scsi-pci for now */
+    AioContext *ctx; /* AioContext of the SCSI devices and control queues */
+
+    /*
+     * With iothread-vq-mapping the command queues are spread round-robin
+     * over iothreads; ctx is the AioContext of the first one.
+     */
+    IOThread **iothreads;
+    unsigned num_iothreads;
+    AioContext **cmd_vq_aio_context;
 
     bool dataplane_started;
     bool dataplane_starting;
@@ -160,6 +170,9 @@ void virtio_scsi_push_event(VirtIOSCSI *s, SCSIDevice *dev,
                             uint32_t event, uint32_t reason);
 
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp);
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s);
+void virtio_scsi_dataplane_disable_external(VirtIOSCSI *s);
+void virtio_scsi_dataplane_enable_external(VirtIOSCSI *s);
 int virtio_scsi_dataplane_start(VirtIODevice *s);
 void virtio_scsi_dataplane_stop(VirtIODevice *s);
 
@@ -35,6 +35,7 @@ typedef struct XenBlockProperties {
     XenBlockVdev vdev;
     BlockConf conf;
     unsigned int max_ring_page_order;
+    unsigned int max_queues;
     IOThread *iothread;
 } XenBlockProperties;
 
@@ -52,7 +53,7 @@ struct XenBlockDevice {
     XenBlockProperties props;
     const char *device_type;
     unsigned int info;
-    XenBlockDataPlane *dataplane;
+    XenBlockDataPlane **dataplanes; /* One per queue, props.max_queues */
     XenBlockDrive *drive;
     XenBlockIOThread *iothread;
 };
@@ -47,6 +47,9 @@ struct QIOChannelSocket {
     socklen_t localAddrLen;
     struct sockaddr_storage remoteAddr;
     socklen_t remoteAddrLen;
+    /* number of zero copy sendmsg() calls issued and completed */
+    ssize_t zero_copy_queued;
+    ssize_t zero_copy_sent;
 };
 
 
@@ -117,6 +120,19 @@ void qio_channel_socket_connect_async(QIOChannelSocket *ioc,
                                       GDestroyNotify destroy,
                                       GMainContext *context);
 
+/**
+ * qio_channel_socket_set_zero_copy_send:
+ * @ioc: the socket channel object
+ *
+ * Enable zero copy sends on the connected socket @ioc, if the
+ * host supports them. The channel then reports the
+ * QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY feature. This must be
+ * called before anything is written to the channel.
+ *
+ * Returns: true if zero copy sends are enabled, false otherwise
+ */
+bool qio_channel_socket_set_zero_copy_send(QIOChannelSocket *ioc);
+
 
 /**
  * qio_channel_socket_listen_sync:
@@ -48,6 +48,7 @@ struct QIOChannelTLS {
     QIOChannel *master;
     QCryptoTLSSession *session;
     QIOChannelShutdown shutdown;
+    bool ktls_send; /* the kernel encrypts what is written to master */
 };
 
 /**
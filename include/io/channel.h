@@ -32,12 +32,16 @@ OBJECT_DECLARE_TYPE(QIOChannel, QIOChannelClass,
 
 #define QIO_CHANNEL_ERR_BLOCK -2
 
+#define QIO_CHANNEL_WRITE_FLAG_ZERO_COPY 0x1
+
 typedef enum QIOChannelFeature QIOChannelFeature;
 
 enum QIOChannelFeature {
     QIO_CHANNEL_FEATURE_FD_PASS,
     QIO_CHANNEL_FEATURE_SHUTDOWN,
     QIO_CHANNEL_FEATURE_LISTEN,
+    QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY,
+    QIO_CHANNEL_FEATURE_SEEKABLE,
 };
 
 
@@ -78,6 +82,8 @@ struct QIOChannel {
     AioContext *ctx;
     Coroutine *read_coroutine;
     Coroutine *write_coroutine;
+    bool queue_writes; /* see qio_channel_queue_writes() */
+    GByteArray *write_queue;
 #ifdef _WIN32
     HANDLE event; /* For use with GSource on Win32 */
 #endif
@@ -104,6 +110,7 @@ struct QIOChannelClass {
                          size_t niov,
                          int *fds,
                          size_t nfds,
+                         int flags,
                          Error **errp);
     ssize_t (*io_readv)(QIOChannel *ioc,
                         const struct iovec *iov,
@@ -136,6 +143,18 @@ struct QIOChannelClass {
                                   IOHandler *io_read,
                                   IOHandler *io_write,
                                   void *opaque);
+    int (*io_flush)(QIOChannel *ioc,
+                    Error **errp);
+    ssize_t (*io_pwritev)(QIOChannel *ioc,
+                          const struct iovec *iov,
+                          size_t niov,
+                          off_t offset,
+                          Error **errp);
+    ssize_t (*io_preadv)(QIOChannel *ioc,
+                         const struct iovec *iov,
+                         size_t niov,
+                         off_t offset,
+                         Error **errp);
 };
 
 /* General I/O handling functions */
@@ -228,6 +247,7 @@ ssize_t qio_channel_readv_full(QIOChannel *ioc,
  * @niov: the length of the @iov array
  * @fds: an array of file handles to send
  * @nfds: number of file handles in @fds
+ * @flags: write flags (QIO_CHANNEL_WRITE_FLAG_*)
  * @errp: pointer to a NULL-initialized error object
  *
  * Write data to the IO channel, reading it from the
@@ -236,6 +256,13 @@ ssize_t qio_channel_readv_full(QIOChannel *ioc,
  * one is used. The @niov parameter specifies the
  * total number of elements in @iov.
  *
+ * If @flags contains QIO_CHANNEL_WRITE_FLAG_ZERO_COPY the
+ * data is not copied by the channel, so the memory regions
+ * referenced by @iov must not be modified or freed until
+ * qio_channel_flush() has returned.  This flag is only
+ * allowed when qio_channel_has_feature() returns a true
+ * value for QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY.
+ *
  * It is not required for all @iov data to be fully
  * sent. If the channel is in blocking mode, at least
  * one byte of data will be sent, but no more is
@@ -260,6 +287,7 @@ ssize_t qio_channel_writev_full(QIOChannel *ioc,
                                 size_t niov,
                                 int *fds,
                                 size_t nfds,
+                                int flags,
                                 Error **errp);
 
 /**
@@ -572,6 +600,38 @@ void qio_channel_set_delay(QIOChannel *ioc,
 void qio_channel_set_cork(QIOChannel *ioc,
                           bool enabled);
 
+/**
+ * qio_channel_queue_writes:
+ * @ioc: the channel object
+ *
+ * Start queueing the data passed to qio_channel_writev_full_all()
+ * and the functions built on it, until qio_channel_flush_queued_writes()
+ * is called.  Small writes are copied to a buffer in the channel and
+ * return right away.  A write that does not fit in the buffer is sent
+ * together with the queued data, in a single call to
+ * qio_channel_writev_full() where possible, without copying it.
+ *
+ * Unlike qio_channel_set_cork(), this reduces the number of system
+ * calls and not just the number of packets, and works for any kind
+ * of channel.  Writes with file handles or write flags are never
+ * queued; they send the queued data first.
+ */
+void qio_channel_queue_writes(QIOChannel *ioc);
+
+/**
+ * qio_channel_flush_queued_writes:
+ * @ioc: the channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Send the data queued since qio_channel_queue_writes() was called,
+ * waiting or yielding like qio_channel_writev_full_all(), and stop
+ * queueing writes.
+ *
+ * Returns: 0 if all queued bytes were written, or -1 on error
+ */
+int qio_channel_flush_queued_writes(QIOChannel *ioc,
+                                    Error **errp);
+
 
 /**
  * qio_channel_seek:
@@ -837,6 +897,7 @@ int qio_channel_readv_full_all(QIOChannel *ioc,
  * @niov: the length of the @iov array
  * @fds: an array of file handles to send
  * @nfds: number of file handles in @fds
+ * @flags: write flags (QIO_CHANNEL_WRITE_FLAG_*)
  * @errp: pointer to a NULL-initialized error object
  *
  *
@@ -853,6 +914,92 @@ int qio_channel_writev_full_all(QIOChannel *ioc,
                                 const struct iovec *iov,
                                 size_t niov,
                                 int *fds, size_t nfds,
-                                Error **errp);
+                                int flags, Error **errp);
+
+/**
+ * qio_channel_flush:
+ * @ioc: the channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Wait until all the data previously written with
+ * QIO_CHANNEL_WRITE_FLAG_ZERO_COPY has been sent, so that
+ * the memory it was read from can be reused.  Channels
+ * that do not support zero copy writes return immediately.
+ *
+ * Returns: -1 on error, 1 if all the data was sent but
+ * the kernel had to fall back to copying it, 0 otherwise
+ */
+int qio_channel_flush(QIOChannel *ioc,
+                      Error **errp);
+
+/**
+ * qio_channel_pwritev:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to write data from
+ * @niov: the length of the @iov array
+ * @offset: offset in the channel where writes should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Not all implementations will support this facility, so may report
+ * an error.  To avoid errors, the caller may check for the feature
+ * flag QIO_CHANNEL_FEATURE_SEEKABLE prior to calling this method.
+ *
+ * Behaves as qio_channel_writev_full, apart from not supporting
+ * sending of file handles as well as beginning the write at the
+ * passed @offset.  The current file position of the channel is
+ * not changed.
+ *
+ * Returns: the number of bytes sent, or -1 on error
+ */
+ssize_t qio_channel_pwritev(QIOChannel *ioc, const struct iovec *iov,
+                            size_t niov, off_t offset, Error **errp);
+
+/**
+ * qio_channel_pwrite:
+ * @ioc: the channel object
+ * @buf: the memory region to write data from
+ * @buflen: the number of bytes in @buf
+ * @offset: offset in the channel where writes should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Behaves as qio_channel_pwritev() with a single memory region.
+ */
+ssize_t qio_channel_pwrite(QIOChannel *ioc, char *buf, size_t buflen,
+                           off_t offset, Error **errp);
+
+/**
+ * qio_channel_preadv:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to read data into
+ * @niov: the length of the @iov array
+ * @offset: offset in the channel where reads should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Not all implementations will support this facility, so may report
+ * an error.  To avoid errors, the caller may check for the feature
+ * flag QIO_CHANNEL_FEATURE_SEEKABLE prior to calling this method.
+ *
+ * Behaves as qio_channel_readv_full, apart from not supporting
+ * receiving of file handles as well as beginning the read at the
+ * passed @offset.  The current file position of the channel is
+ * not changed.
+ *
+ * Returns: the number of bytes read, or -1 on error
+ */
+ssize_t qio_channel_preadv(QIOChannel *ioc, const struct iovec *iov,
+                           size_t niov, off_t offset, Error **errp);
+
+/**
+ * qio_channel_pread:
+ * @ioc: the channel object
+ * @buf: the memory region to read data into
+ * @buflen: the number of bytes to read into @buf
+ * @offset: offset in the channel where reads should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Behaves as qio_channel_preadv() with a single memory region.
+ */
+ssize_t qio_channel_pread(QIOChannel *ioc, char *buf, size_t buflen,
+                          off_t offset, Error **errp);
 
 #endif /* QIO_CHANNEL_H */
@@ -68,6 +68,13 @@ typedef struct SaveVMHandlers {
     int (*load_cleanup)(void *opaque);
     /* Called when postcopy migration wants to resume from failure */
     int (*resume_prepare)(MigrationState *s, void *opaque);
+    /*
+     * Called on the destination when the switchover-ack capability is
+     * set.  Returning true holds off the switchover until the device
+     * calls qemu_loadvm_approve_switchover(), typically once it has
+     * loaded the state that the source sends ahead of the switchover.
+     */
+    bool (*switchover_ack_needed)(void *opaque);
 } SaveVMHandlers;
 
 int register_savevm_live(const char *idstr,
@@ -78,4 +85,7 @@ int register_savevm_live(const char *idstr,
 
 void unregister_savevm(VMStateIf *obj, const char *idstr, void *opaque);
 
+/* See SaveVMHandlers.switchover_ack_needed */
+void qemu_loadvm_approve_switchover(void);
+
 #endif
@@ -190,6 +190,13 @@ struct VMStateDescription {
     int (*post_save)(void *opaque);
     bool (*needed)(void *opaque);
     bool (*dev_unplug_pending)(void *opaque);
+    /*
+     * Set if the state can be saved without the BQL once the VM is
+     * stopped, concurrently with devices of the same priority (see the
+     * "x-device-save-threads" migration property).  pre_save, post_save
+     * and all VMStateInfo callbacks for the fields must be thread-safe.
+     */
+    bool parallel_save;
 
     const VMStateField *fields;
     const VMStateDescription **subsections;
@@ -108,4 +108,41 @@ void net_toeplitz_add(uint32_t *result,
     *result = accumulator;
 }
 
+/*
+ * Longest Toeplitz hash input used for RSS: IPv6 source and destination
+ * addresses plus source and destination ports.
+ */
+#define NET_TOEPLITZ_MAX_INPUT 36
+#define NET_TOEPLITZ_KEY_SIZE  (NET_TOEPLITZ_MAX_INPUT + sizeof(uint32_t))
+
+/*
+ * Precomputed contribution of every possible byte value at every input
+ * position, so that hashing costs one table lookup per input byte rather
+ * than one conditional XOR and shift per input bit.
+ */
+typedef struct toeplitz_table_st {
+    uint8_t key[NET_TOEPLITZ_KEY_SIZE];
+    uint32_t byte[NET_TOEPLITZ_MAX_INPUT][256];
+} net_toeplitz_table;
+
+void net_toeplitz_table_init(net_toeplitz_table *table,
+                             const uint8_t *key_bytes);
+
+static inline
+uint32_t net_toeplitz_table_hash(const net_toeplitz_table *table,
+                                 const uint8_t *input,
+                                 uint32_t len)
+{
+    uint32_t result = 0;
+    uint32_t i;
+
+    assert(len <= NET_TOEPLITZ_MAX_INPUT);
+
+    for (i = 0; i < len; i++) {
+        result ^= table->byte[i][input[i]];
+    }
+
+    return result;
+}
+
 #endif /* QEMU_NET_CHECKSUM_H */
@@ -62,6 +62,7 @@ typedef struct SocketReadState SocketReadState;
 typedef void (SocketReadStateFinalize)(SocketReadState *rs);
 typedef void (NetAnnounce)(NetClientState *);
 typedef bool (SetSteeringEBPF)(NetClientState *, int);
+typedef bool (SetAioContext)(NetClientState *, AioContext *);
 
 typedef struct NetClientInfo {
     NetClientDriver type;
@@ -84,6 +85,7 @@ typedef struct NetClientInfo {
     SetVnetBE *set_vnet_be;
     NetAnnounce *announce;
     SetSteeringEBPF *set_steering_ebpf;
+    SetAioContext *set_aio_context;
 } NetClientInfo;
 
 struct NetClientState {
@@ -103,6 +105,8 @@ struct NetClientState {
     int vnet_hdr_len;
     bool is_netdev;
     bool do_not_pad; /* do not pad to the minimum ethernet frame length */
+    /* IOThread polling the backend, NULL for the main loop */
+    AioContext *aio_context;
     QTAILQ_HEAD(, NetFilterState) filters;
 };
 
@@ -174,6 +178,7 @@ void qemu_set_offload(NetClientState *nc, int csum, int tso4, int tso6,
 void qemu_set_vnet_hdr_len(NetClientState *nc, int len);
 int qemu_set_vnet_le(NetClientState *nc, bool is_le);
 int qemu_set_vnet_be(NetClientState *nc, bool is_be);
+bool qemu_net_client_set_aio_context(NetClientState *nc, AioContext *ctx);
 void qemu_macaddr_default_if_unset(MACAddr *macaddr);
 int qemu_show_nic_models(const char *arg, const char *const *models);
 void qemu_check_nic_model(NICInfo *nd, const char *model);
@@ -0,0 +1,43 @@
+/*
+ * Pool of aligned bounce buffers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef QEMU_BOUNCE_POOL_H
+#define QEMU_BOUNCE_POOL_H
+
+/*
+ * A bounce pool keeps a few free buffers for each power-of-two size class
+ * from 64 KiB to 2 MiB, so that requests needing a large bounce buffer do
+ * not have to map and fault in fresh memory each time.  Buffers in a size
+ * class are aligned to their size; 2 MiB buffers may be backed by
+ * transparent huge pages.  Other sizes are allocated with
+ * qemu_try_memalign() and freed directly.
+ *
+ * A pool is thread-safe, and a buffer may be released by a different
+ * thread, or to a different pool, than the one it came from.
+ */
+
+typedef struct BouncePool BouncePool;
+
+BouncePool *bounce_pool_new(void);
+void bounce_pool_free(BouncePool *pool);
+
+/**
+ * bounce_pool_try_alloc:
+ *
+ * Return a buffer of at least @size bytes, aligned to @align, or NULL if
+ * allocation fails.  The contents are undefined.  The buffer must be
+ * released with bounce_pool_release() and the same @size.
+ */
+void *bounce_pool_try_alloc(BouncePool *pool, size_t size, size_t align);
+
+/**
+ * bounce_pool_release:
+ *
+ * Return @buf, which was allocated with bounce_pool_try_alloc() for
+ * @size bytes, to @pool.  @buf may be NULL.
+ */
+void bounce_pool_release(BouncePool *pool, void *buf, size_t size);
+
+#endif
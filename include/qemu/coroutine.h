@@ -108,6 +108,21 @@ Coroutine *coroutine_fn qemu_coroutine_self(void);
  */
 bool qemu_in_coroutine(void);
 
+/**
+ * Increase coroutine pool size
+ *
+ * Devices that can have many requests in flight call this with their queue
+ * depth so that the coroutines (and their stacks) serving those requests are
+ * recycled instead of being allocated and freed for every burst.  Each call
+ * must be balanced by a qemu_coroutine_dec_pool_size() with the same value.
+ */
+void qemu_coroutine_inc_pool_size(unsigned int additional_pool_size);
+
+/**
+ * Decrease coroutine pool size
+ */
+void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size);
+
 /**
  * Return true if the coroutine is currently entered
  *
@@ -160,6 +175,10 @@ void qemu_co_mutex_init(CoMutex *mutex);
  * transferred to the caller of the current coroutine.
  */
 void coroutine_fn qemu_co_mutex_lock(CoMutex *mutex);
+void coroutine_fn qemu_co_mutex_lock_impl(CoMutex *mutex,
+                                          const char *file, int line);
+#define qemu_co_mutex_lock(m) \
+        qemu_co_mutex_lock_impl(m, __FILE__, __LINE__)
 
 /**
  * Unlocks the mutex and schedules the next coroutine that was waiting for this
@@ -173,9 +173,32 @@ char *freq_to_str(uint64_t freq_hz);
 /* used to print char* safely */
 #define STR_OR_NULL(str) ((str) ? (str) : "null")
 
-bool buffer_is_zero(const void *buf, size_t len);
+bool buffer_is_zero_ool(const void *buf, size_t len);
 bool test_buffer_is_zero_next_accel(void);
 
+/*
+ * Checks if a buffer is all zeroes.
+ *
+ * Most non-zero buffers, e.g. guest pages during migration, are told apart
+ * by looking at their first, middle and last byte, so do that inline.
+ */
+static inline bool buffer_is_zero(const void *vbuf, size_t len)
+{
+    const unsigned char *buf = vbuf;
+
+    if (len == 0) {
+        return true;
+    }
+    if (buf[0] || buf[len - 1] || buf[len / 2]) {
+        return false;
+    }
+    /* All bytes are covered for len <= 3.  */
+    if (len <= 3) {
+        return true;
+    }
+    return buffer_is_zero_ool(vbuf, len);
+}
+
 /*
  * Implementation of ULEB128 (http://en.wikipedia.org/wiki/LEB128)
  * Input is limited to 14-bit numbers
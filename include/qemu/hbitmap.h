@@ -125,6 +125,20 @@ uint64_t hbitmap_count(const HBitmap *hb);
  */
 void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count);
 
+#ifdef CONFIG_ATOMIC64
+/**
+ * hbitmap_set_atomic:
+ * @hb: HBitmap to operate on.
+ * @start: First bit to set (0-based).
+ * @count: Number of bits to set.
+ *
+ * Like hbitmap_set, but can run concurrently with other calls to
+ * hbitmap_set_atomic on the same HBitmap.  Any other operation on @hb
+ * must not overlap with it.
+ */
+void hbitmap_set_atomic(HBitmap *hb, uint64_t start, uint64_t count);
+#endif
+
 /**
  * hbitmap_reset:
  * @hb: HBitmap to operate on.
@@ -0,0 +1,69 @@
+/*
+ * Intrusive interval tree
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+/*
+ * An AVL tree of closed intervals [start, last], ordered by start and
+ * augmented with the largest 'last' of each subtree, so that all the
+ * intervals overlapping a given one can be found in O(log n) each.
+ * Unlike IOVATree, intervals may overlap, and they are embedded in the
+ * caller's structures, so that insertion and removal never allocate.
+ *
+ * The tree does not provide any locking.
+ */
+
+typedef struct IntervalTreeNode {
+    struct IntervalTreeNode *left;
+    struct IntervalTreeNode *right;
+    uint64_t start;
+    uint64_t last;              /* Inclusive */
+
+    /* Private */
+    uint64_t subtree_last;
+    int height;
+} IntervalTreeNode;
+
+typedef struct IntervalTreeRoot {
+    IntervalTreeNode *root;
+} IntervalTreeRoot;
+
+/**
+ * interval_tree_insert:
+ *
+ * Insert @node, with its start and last fields already set, into
+ * @root.  The interval must not change while @node is in the tree.
+ */
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_remove:
+ *
+ * Remove @node, which must be in @root.
+ */
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_iter_first:
+ *
+ * Return the node with the lowest start that overlaps [@start, @last],
+ * or NULL if there is none.
+ */
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last);
+
+/**
+ * interval_tree_iter_next:
+ *
+ * Return the node after @node, in the order of interval_tree_iter_first,
+ * that overlaps [@start, @last], or NULL if there is none.  The tree
+ * must not have been modified since @node was returned.
+ */
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeRoot *root,
+                                          IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last);
+
+#endif
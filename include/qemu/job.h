@@ -256,6 +256,12 @@ struct JobDriver {
      */
     void (*cancel)(Job *job, bool force);
 
+    /**
+     * If the callback is not NULL, it is invoked by query-jobs to add
+     * information that is specific to the job type to @info.
+     */
+    void (*query)(Job *job, JobInfo *info);
+
 
     /** Called when the job is freed */
     void (*free)(Job *job);
@@ -277,6 +277,38 @@ void qemu_mutex_lock_iothread_impl(const char *file, int line);
  */
 void qemu_mutex_unlock_iothread(void);
 
+typedef struct IOThreadLockAuto IOThreadLockAuto;
+
+static inline IOThreadLockAuto *qemu_iothread_auto_lock(const char *file,
+                                                        int line)
+{
+    if (qemu_mutex_iothread_locked()) {
+        return NULL;
+    }
+    qemu_mutex_lock_iothread_impl(file, line);
+    /* Anything non-NULL causes the cleanup function to be called */
+    return (IOThreadLockAuto *)(uintptr_t)1;
+}
+
+static inline void qemu_iothread_auto_unlock(IOThreadLockAuto *l)
+{
+    qemu_mutex_unlock_iothread();
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(IOThreadLockAuto, qemu_iothread_auto_unlock)
+
+/**
+ * QEMU_IOTHREAD_LOCK_GUARD: Lock the main loop mutex until the end of the
+ * scope, unless the calling thread already holds it.
+ *
+ * This is meant for the access handlers of memory regions that are
+ * dispatched without the main loop mutex (see
+ * memory_region_clear_global_locking()), on the paths that still need it.
+ */
+#define QEMU_IOTHREAD_LOCK_GUARD()                                      \
+    g_autoptr(IOThreadLockAuto) _iothread_lock_auto G_GNUC_UNUSED =     \
+        qemu_iothread_auto_lock(__FILE__, __LINE__)
+
 /*
  * qemu_cond_wait_iothread: Wait on condition for the main loop mutex
  *
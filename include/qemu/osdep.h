@@ -471,6 +471,16 @@ static inline void qemu_cleanup_generic_vfree(void *p)
 #else
 #define QEMU_MADV_REMOVE QEMU_MADV_DONTNEED
 #endif
+#ifdef MADV_POPULATE_WRITE
+#define QEMU_MADV_POPULATE_WRITE MADV_POPULATE_WRITE
+#else
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
+#endif
+#ifdef MADV_COLLAPSE
+#define QEMU_MADV_COLLAPSE MADV_COLLAPSE
+#else
+#define QEMU_MADV_COLLAPSE QEMU_MADV_INVALID
+#endif
 
 #elif defined(CONFIG_POSIX_MADVISE)
 
@@ -484,6 +494,8 @@ static inline void qemu_cleanup_generic_vfree(void *p)
 #define QEMU_MADV_HUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_NOHUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_REMOVE QEMU_MADV_DONTNEED
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
+#define QEMU_MADV_COLLAPSE QEMU_MADV_INVALID
 
 #else /* no-op */
 
@@ -497,6 +509,8 @@ static inline void qemu_cleanup_generic_vfree(void *p)
 #define QEMU_MADV_HUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_NOHUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_REMOVE QEMU_MADV_INVALID
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
+#define QEMU_MADV_COLLAPSE QEMU_MADV_INVALID
 
 #endif
 
@@ -687,8 +701,37 @@ unsigned long qemu_getauxval(unsigned long type);
 
 void qemu_set_tty_echo(int fd, bool echo);
 
-void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
-                     Error **errp);
+/**
+ * os_mem_prealloc:
+ * @fd: file descriptor backing @area, or -1 for anonymous memory
+ * @area: start of the memory to preallocate
+ * @sz: size of the memory to preallocate
+ * @max_threads: maximum number of threads to use
+ * @tc: thread context to create the threads in, or NULL
+ * @async: only start the threads, qemu_finish_async_mem_prealloc()
+ *         waits for them to complete
+ * @errp: returns an error if preallocating failed
+ *
+ * Touch all pages of @area so that they are populated.  With @async, the
+ * preallocation of several memory backends created at startup can proceed
+ * concurrently with each other and with the rest of machine creation.
+ * This is only done when the pages can be populated without changing
+ * their contents, so that other code may write to @area in the meantime;
+ * otherwise @area is preallocated before returning (also on errors).
+ */
+void os_mem_prealloc(int fd, char *area, size_t sz, int max_threads,
+                     ThreadContext *tc, bool async, Error **errp);
+
+/**
+ * qemu_finish_async_mem_prealloc:
+ * @errp: returns an error if preallocating any memory failed
+ *
+ * Wait for all preallocations started with os_mem_prealloc(async=true)
+ * to complete.
+ *
+ * Returns: true on success, false on failure.
+ */
+bool qemu_finish_async_mem_prealloc(Error **errp);
 
 /**
  * qemu_get_pid_name:
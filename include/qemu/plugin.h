@@ -67,6 +67,7 @@ enum plugin_dyn_cb_type {
 
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
+    PLUGIN_CB_REGULAR_COND,
     PLUGIN_CB_INLINE,
     PLUGIN_N_CB_SUBTYPES,
 };
@@ -84,10 +85,22 @@ struct qemu_plugin_dyn_cb {
     enum qemu_plugin_mem_rw rw;
     /* fields specific to each dyn_cb type go here */
     union {
+        /*
+         * @userp points to the value of vCPU 0; other vCPUs' values
+         * follow @stride bytes apart.
+         */
         struct {
             enum qemu_plugin_op op;
+            size_t stride;
             uint64_t imm;
         } inline_insn;
+        /* for PLUGIN_CB_REGULAR_COND; @userp is the callback's udata */
+        struct {
+            enum qemu_plugin_cond cond;
+            void *ptr;
+            size_t stride;
+            uint64_t imm;
+        } cond;
     };
 };
 
@@ -14,6 +14,7 @@
 enum QSPSortBy {
     QSP_SORT_BY_TOTAL_WAIT_TIME,
     QSP_SORT_BY_AVG_WAIT_TIME,
+    QSP_SORT_BY_CONTENDED,
 };
 
 void qsp_report(size_t max, enum QSPSortBy sort_by,
@@ -24,4 +25,7 @@ void qsp_enable(void);
 void qsp_disable(void);
 void qsp_reset(void);
 
+void qsp_co_mutex_record(CoMutex *mutex, const char *file, int line,
+                         int64_t ns, bool waited);
+
 #endif /* QEMU_QSP_H */
@@ -0,0 +1,84 @@
+/*
+ * QEMU Thread Context
+ *
+ * A thread context is a persistent thread that creates new threads on
+ * behalf of other parts of QEMU.  New threads inherit the CPU affinity of
+ * the creating thread, so threads created through a context run on the
+ * host CPUs (or NUMA nodes) configured for the context.  They also inherit
+ * its NUMA memory policy, so a context can make the threads it creates
+ * allocate memory from a given host node.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef QEMU_THREAD_CONTEXT_H
+#define QEMU_THREAD_CONTEXT_H
+
+#include "qemu/thread.h"
+#include "qom/object.h"
+
+#define TYPE_THREAD_CONTEXT "thread-context"
+OBJECT_DECLARE_TYPE(ThreadContext, ThreadContextClass,
+                    THREAD_CONTEXT)
+
+struct ThreadContextClass {
+    ObjectClass parent_class;
+};
+
+struct ThreadContext {
+    /* private */
+    Object parent;
+
+    /* private */
+    unsigned int thread_id;
+    QemuThread thread;
+
+    /* Semaphore to wait for context thread action. */
+    QemuSemaphore sem;
+    /* Semaphore to wait for action in context thread. */
+    QemuSemaphore sem_thread;
+    /* Mutex to synchronize requests. */
+    QemuMutex mutex;
+
+    /* Commands for the thread to execute. */
+    int thread_cmd;
+    void *thread_cmd_data;
+
+    /* CPU affinity bitmap used for initialization. */
+    unsigned long *init_cpu_bitmap;
+    int init_cpu_nbits;
+
+    /* Preferred host node for memory allocations, or -1. */
+    int memory_node;
+};
+
+/**
+ * thread_context_create_thread:
+ * @tc: the thread context
+ * @thread: the thread to create
+ * @name: name of the new thread
+ * @start_routine: entry point of the new thread
+ * @arg: argument passed to @start_routine
+ * @mode: QEMU_THREAD_JOINABLE or QEMU_THREAD_DETACHED
+ *
+ * Like qemu_thread_create(), but the new thread is created by the context
+ * thread of @tc and thus inherits its CPU affinity.
+ */
+void thread_context_create_thread(ThreadContext *tc, QemuThread *thread,
+                                  const char *name,
+                                  void *(*start_routine)(void *), void *arg,
+                                  int mode);
+
+/**
+ * thread_context_set_thread_affinity:
+ * @tc: the thread context
+ * @thread: an existing thread
+ *
+ * Give @thread the current CPU affinity of the context thread of @tc, for
+ * threads that were not created through the context.
+ *
+ * Returns: 0 on success, an error number on failure.
+ */
+int thread_context_set_thread_affinity(ThreadContext *tc, QemuThread *thread);
+
+#endif /* QEMU_THREAD_CONTEXT_H */
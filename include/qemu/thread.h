@@ -48,6 +48,7 @@ extern QemuMutexLockFunc qemu_mutex_lock_func;
 extern QemuMutexTrylockFunc qemu_mutex_trylock_func;
 extern QemuRecMutexLockFunc qemu_rec_mutex_lock_func;
 extern QemuRecMutexTrylockFunc qemu_rec_mutex_trylock_func;
+extern QemuRecMutexLockFunc qemu_aio_context_lock_func;
 extern QemuCondWaitFunc qemu_cond_wait_func;
 extern QemuCondTimedWaitFunc qemu_cond_timedwait_func;
 
@@ -188,6 +189,10 @@ void qemu_thread_create(QemuThread *thread, const char *name,
 void *qemu_thread_join(QemuThread *thread);
 void qemu_thread_get_self(QemuThread *thread);
 bool qemu_thread_is_self(QemuThread *thread);
+int qemu_thread_set_affinity(QemuThread *thread, unsigned long *host_cpus,
+                             unsigned long nbits);
+int qemu_thread_get_affinity(QemuThread *thread, unsigned long **host_cpus,
+                             unsigned long *nbits);
 void qemu_thread_exit(void *retval) QEMU_NORETURN;
 void qemu_thread_naming(bool enable);
 
@@ -241,21 +246,29 @@ static inline void qemu_spin_destroy(const QemuSpin *spin)
 #endif
 }
 
-static inline void qemu_spin_lock(QemuSpin *spin)
+void qemu_spin_lock_slowpath(QemuSpin *spin, const char *file, int line);
+
+static inline void qemu_spin_lock_impl(QemuSpin *spin, const char *file,
+                                       int line)
 {
 #ifdef CONFIG_TSAN
     __tsan_mutex_pre_lock(spin, 0);
 #endif
-    while (unlikely(__sync_lock_test_and_set(&spin->value, true))) {
-        while (qatomic_read(&spin->value)) {
-            cpu_relax();
-        }
+    if (unlikely(__sync_lock_test_and_set(&spin->value, true))) {
+        qemu_spin_lock_slowpath(spin, file, line);
     }
 #ifdef CONFIG_TSAN
     __tsan_mutex_post_lock(spin, 0, 0);
 #endif
 }
 
+#define qemu_spin_lock(spin) qemu_spin_lock_impl(spin, __FILE__, __LINE__)
+
+static inline void (qemu_spin_lock)(QemuSpin *spin)
+{
+    qemu_spin_lock(spin);
+}
+
 static inline bool qemu_spin_trylock(QemuSpin *spin)
 {
 #ifdef CONFIG_TSAN
@@ -30,6 +30,8 @@
 #define QEMU_OPT_BPS_WRITE_MAX_LENGTH "bps-write-max-length"
 #define QEMU_OPT_IOPS_SIZE "iops-size"
 #define QEMU_OPT_THROTTLE_GROUP_NAME "throttle-group"
+#define QEMU_OPT_THROTTLE_WEIGHT "weight"
+#define QEMU_OPT_THROTTLE_PRIORITY "priority"
 
 #define THROTTLE_OPT_PREFIX "throttling."
 #define THROTTLE_OPTS \
@@ -25,6 +25,7 @@ typedef struct VuFdWatch {
     int fd; /*kick fd*/
     void *pvt;
     vu_watch_cb cb;
+    AioContext *ctx; /* where the kick fd is monitored, NULL for server->ctx */
     QTAILQ_ENTRY(VuFdWatch) next;
 } VuFdWatch;
 
@@ -32,7 +33,9 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks and virtqueue kicks run in the given AioContext, unless
+ * vhost_user_server_set_queue_aio_context() moves the kicks of a virtqueue
+ * into another one.
  */
 typedef struct {
     QIONetListener *listener;
@@ -40,8 +43,21 @@ typedef struct {
     AioContext *ctx;
     int max_queues;
     const VuDevIface *vu_iface;
+    VuDevIface dev_iface; /* vu_iface as passed to libvhost-user */
 
-    /* Protected by ctx lock */
+    /*
+     * The AioContexts that process the virtqueues, indexed by queue.  NULL
+     * (for the array or an entry) means ctx.
+     */
+    AioContext **queue_ctxs;
+    bool queues_stopped; /* kick fds are not monitored */
+    bool queues_stopping; /* co_trip waits in vu_server_stop_queues() */
+    unsigned int in_flight; /* requests popped from the virtqueues */
+
+    /*
+     * Protected by ctx lock, and by stopping the virtqueues for the
+     * AioContexts in queue_ctxs
+     */
     VuDev vu_dev;
     QIOChannel *ioc; /* The I/O channel with the client */
     QIOChannelSocket *sioc; /* The underlying data channel with the client */
@@ -62,4 +78,11 @@ void vhost_user_server_stop(VuServer *server);
 void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx);
 void vhost_user_server_detach_aio_context(VuServer *server);
 
+void vhost_user_server_set_queue_aio_context(VuServer *server, int index,
+                                             AioContext *ctx);
+AioContext *vhost_user_server_get_queue_aio_context(VuServer *server,
+                                                    int index);
+void vhost_user_server_inc_in_flight(VuServer *server);
+void vhost_user_server_dec_in_flight(VuServer *server);
+
 #endif /* VHOST_USER_SERVER_H */
@@ -137,6 +137,13 @@ struct ObjectClass
     ObjectUnparent *unparent;
 
     GHashTable *properties;
+
+    /*
+     * Properties of the class and all its ancestors, built the first
+     * time a property of an instance of the class is looked up.
+     */
+    GHashTable *properties_cache;
+    bool properties_cached_by_subclass;
 };
 
 /**
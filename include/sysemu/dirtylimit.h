@@ -0,0 +1,19 @@
+/*
+ * Per-vCPU dirty page rate limit
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef SYSEMU_DIRTYLIMIT_H
+#define SYSEMU_DIRTYLIMIT_H
+
+/**
+ * dirtylimit_in_service:
+ *
+ * Returns: true if at least one vCPU has a dirty page rate limit, in which
+ * case the vCPUs that exceed their quota are throttled individually.
+ */
+bool dirtylimit_in_service(void);
+
+#endif
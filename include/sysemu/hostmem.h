@@ -56,6 +56,7 @@ struct HostMemoryBackendClass {
  * @size: amount of memory backend provides
  * @mr: MemoryRegion representing host memory belonging to backend
  * @prealloc_threads: number of threads to be used for preallocatining RAM
+ * @prealloc_context: thread context used to create the preallocation threads
  */
 struct HostMemoryBackend {
     /* private */
@@ -66,6 +67,7 @@ struct HostMemoryBackend {
     bool merge, dump, use_canonical_path;
     bool prealloc, is_mapped, share, reserve;
     uint32_t prealloc_threads;
+    ThreadContext *prealloc_context;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
 
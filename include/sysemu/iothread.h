@@ -17,6 +17,7 @@
 #include "block/aio.h"
 #include "qemu/thread.h"
 #include "qom/object.h"
+#include "qapi/qapi-builtin-types.h"
 
 #define TYPE_IOTHREAD "iothread"
 
@@ -37,9 +38,17 @@ struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+    int64_t poll_cpu_budget;
 
     /* AioContext AIO engine parameters */
     int64_t aio_max_batch;
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+    bool io_uring_sqpoll;
+    bool io_uring_fixed;
+
+    /* creates the iothread, which inherits its CPU affinity */
+    ThreadContext *thread_context;
 };
 typedef struct IOThread IOThread;
 
@@ -48,6 +57,11 @@ DECLARE_INSTANCE_CHECKER(IOThread, IOTHREAD,
 
 char *iothread_get_id(IOThread *iothread);
 IOThread *iothread_by_id(const char *id);
+bool iothread_ref_list(const strList *ids, IOThread ***iothreads,
+                       size_t *num_iothreads, Error **errp);
+void iothread_unref_list(IOThread **iothreads, size_t num_iothreads);
+IOThread **iothread_parse_vq_mapping(const char *mapping,
+                                     unsigned *num_iothreads, Error **errp);
 AioContext *iothread_get_aio_context(IOThread *iothread);
 GMainContext *iothread_get_g_main_context(IOThread *iothread);
 
@@ -221,6 +221,8 @@ int kvm_has_pit_state2(void);
 int kvm_has_many_ioeventfds(void);
 int kvm_has_gsi_routing(void);
 int kvm_has_intx_set_mask(void);
+bool kvm_dirty_ring_enabled(void);
+uint32_t kvm_dirty_ring_size(void);
 
 /**
  * kvm_arm_supports_user_irq
@@ -374,6 +374,14 @@ void tcg_gen_gvec_bitsel(unsigned vece, uint32_t dofs, uint32_t aofs,
                          uint32_t bofs, uint32_t cofs,
                          uint32_t oprsz, uint32_t maxsz);
 
+/*
+ * Perform byte table lookup within each 16-byte block:
+ * d[i] = b[i] < 16 ? a[(i & ~15) + b[i]] : 0.
+ * VECE must be MO_8 and OPRSZ a multiple of 16.
+ */
+void tcg_gen_gvec_tbl(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz, uint32_t maxsz);
+
 /*
  * 64-bit vector operations.  Use these when the register has been allocated
  * with tcg_global_mem_new_i64, and so we cannot also address it via pointer.
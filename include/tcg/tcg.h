@@ -194,6 +194,7 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_HAS_minmax_vec       0
 #define TCG_TARGET_HAS_bitsel_vec       0
 #define TCG_TARGET_HAS_cmpsel_vec       0
+#define TCG_TARGET_HAS_tbl_vec          0
 #else
 #define TCG_TARGET_MAYBE_vec            1
 #endif
@@ -517,6 +518,7 @@ typedef struct TCGProfile {
     int64_t tb_count1;
     int64_t tb_count;
     int64_t op_count; /* total insn count */
+    int64_t guest_insn_count; /* guest insns translated */
     int op_count_max; /* max insn per TB */
     int temp_count_max;
     int64_t temp_count;
@@ -591,6 +593,7 @@ struct TCGContext {
 #endif
 
     TCGLabel *exitreq_label;
+    TCGLabel *hot_label;
 
 #ifdef CONFIG_PLUGIN
     /*
@@ -807,6 +810,7 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_evict(void (*evict)(TranslationBlock *tb));
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -1207,11 +1211,9 @@ static inline unsigned get_mmuidx(TCGMemOpIdx oi)
  *        TB index (0 or 1). That is, we left the TB via (the equivalent
  *        of) "goto_tb <index>". The main loop uses this to determine
  *        how to link the TB just executed to the next.
- *  2:    we are using instruction counting code generation, and we
- *        did not start executing this TB because the instruction counter
- *        would hit zero midway through it. In this case the pointer
- *        returned is the TB we were about to execute, and the caller must
- *        arrange to execute the remaining count of instructions.
+ *  2:    we did not start executing this TB because it became hot and
+ *        should be retranslated with CF_TRACE. The pointer returned is
+ *        the TB we were about to execute.
  *  3:    we stopped because the CPU's exit_request flag was set
  *        (usually meaning that there is an interrupt that needs to be
  *        handled). The pointer returned is the TB we were about to execute
@@ -1234,6 +1236,7 @@ static inline unsigned get_mmuidx(TCGMemOpIdx oi)
 #define TB_EXIT_IDX0      0
 #define TB_EXIT_IDX1      1
 #define TB_EXIT_IDXMAX    1
+#define TB_EXIT_HOT       2
 #define TB_EXIT_REQUESTED 3
 
 #ifdef CONFIG_TCG_INTERPRETER
@@ -22,10 +22,25 @@
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 #include "qemu/atomic.h"
 
 
+/*
+ * If the master channel is a socket, let the session use it directly, so
+ * that the TLS library can offload the record layer to the kernel.
+ */
+static void qio_channel_tls_set_socket(QIOChannelTLS *ioc)
+{
+    QIOChannelSocket *sioc = (QIOChannelSocket *)
+        object_dynamic_cast(OBJECT(ioc->master), TYPE_QIO_CHANNEL_SOCKET);
+
+    if (sioc) {
+        qcrypto_tls_session_set_socket(ioc->session, sioc->fd);
+    }
+}
+
 static ssize_t qio_channel_tls_write_handler(const char *buf,
                                              size_t len,
                                              void *opaque)
@@ -91,6 +106,7 @@ qio_channel_tls_new_server(QIOChannel *master,
         qio_channel_tls_write_handler,
         qio_channel_tls_read_handler,
         ioc);
+    qio_channel_tls_set_socket(ioc);
 
     trace_qio_channel_tls_new_server(ioc, master, creds, aclname);
     return ioc;
@@ -133,6 +149,7 @@ qio_channel_tls_new_client(QIOChannel *master,
         qio_channel_tls_write_handler,
         qio_channel_tls_read_handler,
         tioc);
+    qio_channel_tls_set_socket(tioc);
 
     trace_qio_channel_tls_new_client(tioc, master, creds, hostname);
     return tioc;
@@ -169,6 +186,8 @@ static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
     status = qcrypto_tls_session_get_handshake_status(ioc->session);
     if (status == QCRYPTO_TLS_HANDSHAKE_COMPLETE) {
         trace_qio_channel_tls_handshake_complete(ioc);
+        ioc->ktls_send = qcrypto_tls_session_has_ktls_send(ioc->session);
+        trace_qio_channel_tls_ktls(ioc, ioc->ktls_send);
         if (qcrypto_tls_session_check_credentials(ioc->session,
                                                   &err) < 0) {
             trace_qio_channel_tls_credentials_deny(ioc);
@@ -301,12 +320,22 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
                                       size_t niov,
                                       int *fds,
                                       size_t nfds,
+                                      int flags,
                                       Error **errp)
 {
     QIOChannelTLS *tioc = QIO_CHANNEL_TLS(ioc);
     size_t i;
     ssize_t done = 0;
 
+    /*
+     * The kernel builds and encrypts the records, so there is no need to
+     * go through gnutls one iovec element at a time.
+     */
+    if (tioc->ktls_send) {
+        return qio_channel_writev_full(tioc->master, iov, niov,
+                                       NULL, 0, 0, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
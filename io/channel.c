@@ -72,6 +72,7 @@ ssize_t qio_channel_writev_full(QIOChannel *ioc,
                                 size_t niov,
                                 int *fds,
                                 size_t nfds,
+                                int flags,
                                 Error **errp)
 {
     QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
@@ -83,7 +84,14 @@ ssize_t qio_channel_writev_full(QIOChannel *ioc,
         return -1;
     }
 
-    return klass->io_writev(ioc, iov, niov, fds, nfds, errp);
+    if ((flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) &&
+        !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        error_setg_errno(errp, EINVAL,
+                         "Channel does not support zero copy writes");
+        return -1;
+    }
+
+    return klass->io_writev(ioc, iov, niov, fds, nfds, flags, errp);
 }
 
 
@@ -217,28 +225,61 @@ int qio_channel_writev_all(QIOChannel *ioc,
                            size_t niov,
                            Error **errp)
 {
-    return qio_channel_writev_full_all(ioc, iov, niov, NULL, 0, errp);
+    return qio_channel_writev_full_all(ioc, iov, niov, NULL, 0, 0, errp);
 }
 
+/* Writes are queued by qio_channel_queue_writes() up to this size */
+#define QIO_CHANNEL_WRITE_QUEUE_SIZE (64 * 1024)
+
 int qio_channel_writev_full_all(QIOChannel *ioc,
                                 const struct iovec *iov,
                                 size_t niov,
                                 int *fds, size_t nfds,
-                                Error **errp)
+                                int flags, Error **errp)
 {
     int ret = -1;
-    struct iovec *local_iov = g_new(struct iovec, niov);
-    struct iovec *local_iov_head = local_iov;
-    unsigned int nlocal_iov = niov;
+    struct iovec *local_iov;
+    struct iovec *local_iov_head;
+    unsigned int nlocal_iov = 0;
+    size_t size = iov_size(iov, niov);
+    size_t queued = 0;
+    size_t i;
+
+    if (ioc->queue_writes) {
+        if (nfds || flags) {
+            /* Keep fds attached to their data and flags to theirs */
+            ret = qio_channel_flush_queued_writes(ioc, errp);
+            ioc->queue_writes = true;
+            if (ret < 0) {
+                return ret;
+            }
+        } else if (ioc->write_queue->len + size <=
+                   QIO_CHANNEL_WRITE_QUEUE_SIZE) {
+            for (i = 0; i < niov; i++) {
+                g_byte_array_append(ioc->write_queue, iov[i].iov_base,
+                                    iov[i].iov_len);
+            }
+            return 0;
+        } else {
+            queued = ioc->write_queue->len;
+        }
+    }
 
-    nlocal_iov = iov_copy(local_iov, nlocal_iov,
-                          iov, niov,
-                          0, iov_size(iov, niov));
+    local_iov = g_new(struct iovec, niov + 1);
+    local_iov_head = local_iov;
+    if (queued) {
+        local_iov[0].iov_base = ioc->write_queue->data;
+        local_iov[0].iov_len = queued;
+        nlocal_iov++;
+    }
+    nlocal_iov += iov_copy(local_iov + nlocal_iov, niov,
+                           iov, niov,
+                           0, size);
 
     while (nlocal_iov > 0) {
         ssize_t len;
         len = qio_channel_writev_full(ioc, local_iov, nlocal_iov, fds, nfds,
-                                      errp);
+                                      flags, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
             if (qemu_in_coroutine()) {
                 qio_channel_yield(ioc, G_IO_OUT);
@@ -259,10 +300,38 @@ int qio_channel_writev_full_all(QIOChannel *ioc,
 
     ret = 0;
  cleanup:
+    if (queued) {
+        g_byte_array_set_size(ioc->write_queue, 0);
+    }
     g_free(local_iov_head);
     return ret;
 }
 
+void qio_channel_queue_writes(QIOChannel *ioc)
+{
+    assert(!ioc->queue_writes);
+    if (!ioc->write_queue) {
+        ioc->write_queue = g_byte_array_sized_new(QIO_CHANNEL_WRITE_QUEUE_SIZE);
+    }
+    ioc->queue_writes = true;
+}
+
+int qio_channel_flush_queued_writes(QIOChannel *ioc,
+                                    Error **errp)
+{
+    struct iovec iov;
+    int ret = 0;
+
+    ioc->queue_writes = false;
+    if (ioc->write_queue && ioc->write_queue->len) {
+        iov.iov_base = ioc->write_queue->data;
+        iov.iov_len = ioc->write_queue->len;
+        ret = qio_channel_writev_full_all(ioc, &iov, 1, NULL, 0, 0, errp);
+        g_byte_array_set_size(ioc->write_queue, 0);
+    }
+    return ret;
+}
+
 ssize_t qio_channel_readv(QIOChannel *ioc,
                           const struct iovec *iov,
                           size_t niov,
@@ -277,7 +346,7 @@ ssize_t qio_channel_writev(QIOChannel *ioc,
                            size_t niov,
                            Error **errp)
 {
-    return qio_channel_writev_full(ioc, iov, niov, NULL, 0, errp);
+    return qio_channel_writev_full(ioc, iov, niov, NULL, 0, 0, errp);
 }
 
 
@@ -297,7 +366,7 @@ ssize_t qio_channel_write(QIOChannel *ioc,
                           Error **errp)
 {
     struct iovec iov = { .iov_base = (char *)buf, .iov_len = buflen };
-    return qio_channel_writev_full(ioc, &iov, 1, NULL, 0, errp);
+    return qio_channel_writev_full(ioc, &iov, 1, NULL, 0, 0, errp);
 }
 
 
@@ -458,6 +527,82 @@ void qio_channel_set_cork(QIOChannel *ioc,
 }
 
 
+int qio_channel_flush(QIOChannel *ioc,
+                      Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+
+    if (!klass->io_flush ||
+        !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        return 0;
+    }
+
+    return klass->io_flush(ioc, errp);
+}
+
+
+ssize_t qio_channel_pwritev(QIOChannel *ioc, const struct iovec *iov,
+                            size_t niov, off_t offset, Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+
+    if (!klass->io_pwritev) {
+        error_setg(errp, "Channel does not support pwritev");
+        return -1;
+    }
+
+    if (!qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg_errno(errp, EINVAL, "Requested channel is not seekable");
+        return -1;
+    }
+
+    return klass->io_pwritev(ioc, iov, niov, offset, errp);
+}
+
+
+ssize_t qio_channel_pwrite(QIOChannel *ioc, char *buf, size_t buflen,
+                           off_t offset, Error **errp)
+{
+    struct iovec iov = {
+        .iov_base = buf,
+        .iov_len = buflen
+    };
+
+    return qio_channel_pwritev(ioc, &iov, 1, offset, errp);
+}
+
+
+ssize_t qio_channel_preadv(QIOChannel *ioc, const struct iovec *iov,
+                           size_t niov, off_t offset, Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+
+    if (!klass->io_preadv) {
+        error_setg(errp, "Channel does not support preadv");
+        return -1;
+    }
+
+    if (!qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg_errno(errp, EINVAL, "Requested channel is not seekable");
+        return -1;
+    }
+
+    return klass->io_preadv(ioc, iov, niov, offset, errp);
+}
+
+
+ssize_t qio_channel_pread(QIOChannel *ioc, char *buf, size_t buflen,
+                          off_t offset, Error **errp)
+{
+    struct iovec iov = {
+        .iov_base = buf,
+        .iov_len = buflen
+    };
+
+    return qio_channel_preadv(ioc, &iov, 1, offset, errp);
+}
+
+
 off_t qio_channel_io_seek(QIOChannel *ioc,
                           off_t offset,
                           int whence,
@@ -596,6 +741,9 @@ static void qio_channel_finalize(Object *obj)
     QIOChannel *ioc = QIO_CHANNEL(obj);
 
     g_free(ioc->name);
+    if (ioc->write_queue) {
+        g_byte_array_free(ioc->write_queue, true);
+    }
 
 #ifdef _WIN32
     if (ioc->event) {
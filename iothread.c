@@ -17,12 +17,14 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-misc.h"
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
+#include "qemu/thread-context.h"
 
 typedef ObjectClass IOThreadClass;
 
@@ -106,6 +108,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -160,6 +163,7 @@ static void iothread_set_aio_context_params(IOThread *iothread, Error **errp)
                                 iothread->poll_max_ns,
                                 iothread->poll_grow,
                                 iothread->poll_shrink,
+                                iothread->poll_cpu_budget,
                                 errp);
     if (*errp) {
         return;
@@ -168,6 +172,22 @@ static void iothread_set_aio_context_params(IOThread *iothread, Error **errp)
     aio_context_set_aio_params(iothread->ctx,
                                iothread->aio_max_batch,
                                errp);
+    if (*errp) {
+        return;
+    }
+
+    aio_context_set_thread_pool_params(iothread->ctx,
+                                       iothread->thread_pool_min,
+                                       iothread->thread_pool_max,
+                                       errp);
+    if (*errp) {
+        return;
+    }
+
+    aio_context_set_io_uring_params(iothread->ctx,
+                                    iothread->io_uring_sqpoll,
+                                    iothread->io_uring_fixed,
+                                    errp);
 }
 
 static void iothread_complete(UserCreatable *obj, Error **errp)
@@ -197,13 +217,21 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
-    /* This assumes we are called from a thread with useful CPU affinity for us
-     * to inherit.
+    /*
+     * Without a thread context, this assumes we are called from a thread
+     * with useful CPU affinity for us to inherit.
      */
     thread_name = g_strdup_printf("IO %s",
                         object_get_canonical_path_component(OBJECT(obj)));
-    qemu_thread_create(&iothread->thread, thread_name, iothread_run,
-                       iothread, QEMU_THREAD_JOINABLE);
+    if (iothread->thread_context) {
+        thread_context_create_thread(iothread->thread_context,
+                                     &iothread->thread, thread_name,
+                                     iothread_run, iothread,
+                                     QEMU_THREAD_JOINABLE);
+    } else {
+        qemu_thread_create(&iothread->thread, thread_name, iothread_run,
+                           iothread, QEMU_THREAD_JOINABLE);
+    }
     g_free(thread_name);
 
     /* Wait for initialization to complete */
@@ -226,9 +254,18 @@ static PollParamInfo poll_grow_info = {
 static PollParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
+static PollParamInfo poll_cpu_budget_info = {
+    "poll-cpu-budget", offsetof(IOThread, poll_cpu_budget),
+};
 static PollParamInfo aio_max_batch_info = {
     "aio-max-batch", offsetof(IOThread, aio_max_batch),
 };
+static PollParamInfo thread_pool_min_info = {
+    "thread-pool-min", offsetof(IOThread, thread_pool_min),
+};
+static PollParamInfo thread_pool_max_info = {
+    "thread-pool-max", offsetof(IOThread, thread_pool_max),
+};
 
 static void iothread_get_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
@@ -284,6 +321,7 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
                                     iothread->poll_max_ns,
                                     iothread->poll_grow,
                                     iothread->poll_shrink,
+                                    iothread->poll_cpu_budget,
                                     errp);
     }
 }
@@ -311,6 +349,77 @@ static void iothread_set_aio_param(Object *obj, Visitor *v,
     }
 }
 
+static void iothread_set_thread_pool_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (!iothread_set_param(obj, v, name, opaque, errp)) {
+        return;
+    }
+
+    if (iothread->ctx) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           errp);
+    }
+}
+
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    return IOTHREAD(obj)->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value,
+                                         Error **errp)
+{
+    ERRP_GUARD();
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        aio_context_set_io_uring_params(iothread->ctx, value,
+                                        iothread->io_uring_fixed, errp);
+        if (*errp) {
+            return;
+        }
+    }
+    iothread->io_uring_sqpoll = value;
+}
+
+static bool iothread_get_io_uring_fixed(Object *obj, Error **errp)
+{
+    return IOTHREAD(obj)->io_uring_fixed;
+}
+
+static void iothread_set_io_uring_fixed(Object *obj, bool value,
+                                        Error **errp)
+{
+    ERRP_GUARD();
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        aio_context_set_io_uring_params(iothread->ctx,
+                                        iothread->io_uring_sqpoll, value,
+                                        errp);
+        if (*errp) {
+            return;
+        }
+    }
+    iothread->io_uring_fixed = value;
+}
+
+static void iothread_check_thread_context(const Object *obj, const char *name,
+                                          Object *val, Error **errp)
+{
+    const IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        error_setg(errp, "'%s' cannot be changed once the iothread is running",
+                   name);
+    }
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -328,10 +437,33 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add(klass, "poll-cpu-budget", "int",
+                              iothread_get_poll_param,
+                              iothread_set_poll_param,
+                              NULL, &poll_cpu_budget_info);
     object_class_property_add(klass, "aio-max-batch", "int",
                               iothread_get_aio_param,
                               iothread_set_aio_param,
                               NULL, &aio_max_batch_info);
+    object_class_property_add(klass, "thread-pool-min", "int",
+                              iothread_get_aio_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_min_info);
+    object_class_property_add(klass, "thread-pool-max", "int",
+                              iothread_get_aio_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_max_info);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll);
+    object_class_property_add_bool(klass, "io-uring-fixed",
+                                   iothread_get_io_uring_fixed,
+                                   iothread_set_io_uring_fixed);
+    object_class_property_add_link(klass, "thread-context",
+                                   TYPE_THREAD_CONTEXT,
+                                   offsetof(IOThread, thread_context),
+                                   iothread_check_thread_context,
+                                   OBJ_PROP_LINK_STRONG);
 }
 
 static const TypeInfo iothread_info = {
@@ -369,6 +501,11 @@ static int query_one_iothread(Object *object, void *opaque)
     IOThreadInfoList ***tail = opaque;
     IOThreadInfo *info;
     IOThread *iothread;
+    uint64List **hist_tail;
+    AioPollStats stats;
+    ThreadPool *pool;
+    ThreadPoolStats pool_stats;
+    int i;
 
     iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
     if (!iothread) {
@@ -376,12 +513,33 @@ static int query_one_iothread(Object *object, void *opaque)
     }
 
     info = g_new0(IOThreadInfo, 1);
+    hist_tail = &info->poll_hit_histogram;
     info->id = iothread_get_id(iothread);
     info->thread_id = iothread->thread_id;
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    info->poll_cpu_budget = iothread->poll_cpu_budget;
     info->aio_max_batch = iothread->aio_max_batch;
+    info->thread_pool_min = iothread->thread_pool_min;
+    info->thread_pool_max = iothread->thread_pool_max;
+
+    pool = qatomic_read(&iothread->ctx->thread_pool);
+    if (pool) {
+        thread_pool_get_stats(pool, &pool_stats);
+        info->thread_pool_threads = pool_stats.threads;
+        info->thread_pool_idle_threads = pool_stats.idle_threads;
+        info->thread_pool_queued = pool_stats.queued;
+        info->thread_pool_requests = pool_stats.requests;
+    }
+
+    aio_context_get_poll_stats(iothread->ctx, &stats);
+    info->poll_hits = stats.hits;
+    info->poll_misses = stats.misses;
+    info->poll_time_ns = stats.time_ns;
+    for (i = 0; i < AIO_POLL_HIST_BUCKETS; i++) {
+        QAPI_LIST_APPEND(hist_tail, stats.hist[i]);
+    }
 
     QAPI_LIST_APPEND(*tail, info);
     return 0;
@@ -427,6 +585,83 @@ IOThread *iothread_by_id(const char *id)
     return IOTHREAD(object_resolve_path_type(id, TYPE_IOTHREAD, NULL));
 }
 
+void iothread_unref_list(IOThread **iothreads, size_t num_iothreads)
+{
+    size_t i;
+
+    for (i = 0; i < num_iothreads; i++) {
+        object_unref(OBJECT(iothreads[i]));
+    }
+    g_free(iothreads);
+}
+
+/*
+ * Look up the IOThreads named in @ids and take a reference to each.  On
+ * success, *iothreads is a new array of *num_iothreads IOThreads, NULL if
+ * @ids is empty.  Release it with iothread_unref_list().
+ */
+bool iothread_ref_list(const strList *ids, IOThread ***iothreads,
+                       size_t *num_iothreads, Error **errp)
+{
+    const strList *e;
+    IOThread **list;
+    size_t n = 0;
+    size_t i;
+
+    for (e = ids; e; e = e->next) {
+        n++;
+    }
+
+    list = g_new0(IOThread *, n);
+    for (i = 0, e = ids; e; i++, e = e->next) {
+        list[i] = iothread_by_id(e->value);
+        if (!list[i]) {
+            error_setg(errp, "iothread \"%s\" not found", e->value);
+            iothread_unref_list(list, i);
+            return false;
+        }
+        object_ref(OBJECT(list[i]));
+    }
+
+    *iothreads = list;
+    *num_iothreads = n;
+    return true;
+}
+
+/*
+ * Look up the ':'-separated IOThread ids of an iothread-vq-mapping device
+ * property.  IOThread ids cannot contain a ':'.  Returns a new array of
+ * *num_iothreads IOThreads, which does not hold references to them.
+ */
+IOThread **iothread_parse_vq_mapping(const char *mapping,
+                                     unsigned *num_iothreads, Error **errp)
+{
+    g_auto(GStrv) ids = g_strsplit(mapping, ":", -1);
+    unsigned n = g_strv_length(ids);
+    IOThread **iothreads;
+    unsigned i;
+
+    if (!n) {
+        error_setg(errp, "iothread-vq-mapping must name at least one "
+                   "IOThread");
+        return NULL;
+    }
+
+    iothreads = g_new0(IOThread *, n);
+    for (i = 0; i < n; i++) {
+        iothreads[i] = iothread_by_id(ids[i]);
+        if (!iothreads[i]) {
+            error_setg(errp, "IOThread '%s' of iothread-vq-mapping not found",
+                       ids[i]);
+            g_free(iothreads);
+            return NULL;
+        }
+    }
+
+    *num_iothreads = n;
+    return iothreads;
+}
+
 bool qemu_in_iothread(void)
 {
     return qemu_get_current_aio_context() == qemu_get_aio_context() ?
@@ -163,6 +163,10 @@ static JobInfo *job_query_single(Job *job, Error **errp)
                               g_strdup(error_get_pretty(job->err)) : NULL,
     };
 
+    if (job->driver->query) {
+        job->driver->query(job, info);
+    }
+
     return info;
 }
 
@@ -17,7 +17,9 @@
  *  along with this program; if not, see <http://www.gnu.org/licenses/>.
  */
 #include "qemu/osdep.h"
+#include "qemu/log.h"
 #include "qemu.h"
+#include "tcg/tcg.h"
 #ifdef CONFIG_GPROF
 #include <sys/gmon.h>
 #endif
@@ -33,6 +35,11 @@ void preexit_cleanup(CPUArchState *env, int code)
 #endif
 #ifdef CONFIG_GCOV
         __gcov_dump();
+#endif
+#ifdef CONFIG_PROFILER
+        if (qemu_loglevel_mask(CPU_LOG_JIT)) {
+            tcg_dump_info();
+        }
 #endif
         gdb_exit(code);
         qemu_plugin_user_exit();
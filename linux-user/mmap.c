@@ -43,20 +43,198 @@ bool have_mmap_lock(void)
     return mmap_lock_count > 0 ? true : false;
 }
 
+/*
+ * Guest address ranges, rounded out to host pages, with an mmap,
+ * munmap or mprotect in flight.  The host system calls of those run
+ * without mmap_lock, which is only taken to pick an address and then
+ * to update the page flags and translations, so that threads working
+ * on disjoint parts of the address space do not serialize on each
+ * other's system calls.
+ *
+ * The ranges in the tree never overlap, so looking a range up finds
+ * any in-flight operation that overlaps it.  A thread holding a range
+ * may take mmap_lock, so mmap_lock must never be held while waiting
+ * for a range.
+ */
+typedef struct MmapRange {
+    abi_ulong start;
+    abi_ulong last;
+    /* Range of the enclosing operation of this thread, if any */
+    struct MmapRange *outer;
+    /* Covered by @outer or by mmap_lock; nothing was inserted */
+    bool nested;
+} MmapRange;
+
+static pthread_mutex_t mmap_range_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mmap_range_cond = PTHREAD_COND_INITIALIZER;
+static GTree *mmap_ranges;
+static __thread MmapRange *mmap_range_held;
+
+static gint mmap_range_cmp(gconstpointer a, gconstpointer b, gpointer opaque)
+{
+    const MmapRange *ra = a, *rb = b;
+
+    if (ra->last < rb->start) {
+        return -1;
+    }
+    if (ra->start > rb->last) {
+        return 1;
+    }
+    return 0;
+}
+
+/* Called with mmap_range_mutex held.  */
+static bool mmap_range_busy_locked(MmapRange *r)
+{
+    return mmap_ranges && g_tree_lookup(mmap_ranges, r);
+}
+
+static void mmap_range_insert_locked(MmapRange *r)
+{
+    if (!mmap_ranges) {
+        mmap_ranges = g_tree_new_full(mmap_range_cmp, NULL, NULL, NULL);
+    }
+    g_tree_insert(mmap_ranges, r, r);
+    mmap_range_held = r;
+}
+
+static void mmap_range_init(MmapRange *r, abi_ulong start, abi_ulong last)
+{
+    MmapRange *outer = mmap_range_held;
+
+    r->start = start;
+    r->last = last;
+    r->outer = outer;
+    /*
+     * Nested operations, such as target_mmap falling back to
+     * target_mprotect, run inside the range of their caller.
+     */
+    r->nested = outer && outer->start <= start && last <= outer->last;
+    assert(r->nested || !outer);
+}
+
+static void mmap_range_init_len(MmapRange *r, abi_ulong start, abi_ulong len)
+{
+    mmap_range_init(r, start & qemu_host_page_mask,
+                    HOST_PAGE_ALIGN(start + len) - 1);
+}
+
+/* Return false instead of waiting if part of the range is busy.  */
+static bool mmap_range_trylock(MmapRange *r, abi_ulong start, abi_ulong len)
+{
+    bool ok = true;
+
+    mmap_range_init_len(r, start, len);
+    if (r->nested) {
+        return true;
+    }
+
+    pthread_mutex_lock(&mmap_range_mutex);
+    if (mmap_range_busy_locked(r)) {
+        ok = false;
+    } else {
+        mmap_range_insert_locked(r);
+    }
+    pthread_mutex_unlock(&mmap_range_mutex);
+    return ok;
+}
+
+static void mmap_range_wait(MmapRange *r)
+{
+    /*
+     * The ELF loader maps the program with mmap_lock held, at a
+     * point where there are no other threads to wait for.
+     */
+    if (r->nested || have_mmap_lock()) {
+        r->nested = true;
+        return;
+    }
+
+    pthread_mutex_lock(&mmap_range_mutex);
+    while (mmap_range_busy_locked(r)) {
+        pthread_cond_wait(&mmap_range_cond, &mmap_range_mutex);
+    }
+    mmap_range_insert_locked(r);
+    pthread_mutex_unlock(&mmap_range_mutex);
+}
+
+/* Wait until no operation in flight overlaps @r, without taking it.  */
+static void mmap_range_wait_idle(MmapRange *r)
+{
+    pthread_mutex_lock(&mmap_range_mutex);
+    while (mmap_range_busy_locked(r)) {
+        pthread_cond_wait(&mmap_range_cond, &mmap_range_mutex);
+    }
+    pthread_mutex_unlock(&mmap_range_mutex);
+}
+
+static void mmap_range_lock(MmapRange *r, abi_ulong start, abi_ulong len)
+{
+    mmap_range_init_len(r, start, len);
+    mmap_range_wait(r);
+}
+
+/* Wait for all operations in flight and exclude new ones.  */
+static void mmap_range_lock_all(MmapRange *r)
+{
+    mmap_range_init(r, 0, (abi_ulong)-1);
+    mmap_range_wait(r);
+}
+
+static void mmap_range_unlock(MmapRange *r)
+{
+    if (r->nested) {
+        return;
+    }
+
+    pthread_mutex_lock(&mmap_range_mutex);
+    g_tree_remove(mmap_ranges, r);
+    pthread_cond_broadcast(&mmap_range_cond);
+    pthread_mutex_unlock(&mmap_range_mutex);
+    mmap_range_held = r->outer;
+}
+
+/*
+ * Is the host page at @start part of an operation in flight in another
+ * thread?  The page can be part of at most one range.
+ */
+static bool mmap_range_busy(abi_ulong start)
+{
+    MmapRange r = { .start = start, .last = start + qemu_host_page_size - 1 };
+    MmapRange *found = NULL;
+
+    pthread_mutex_lock(&mmap_range_mutex);
+    if (mmap_ranges) {
+        found = g_tree_lookup(mmap_ranges, &r);
+    }
+    pthread_mutex_unlock(&mmap_range_mutex);
+    return found && found != mmap_range_held;
+}
+
 /* Grab lock to make sure things are in a consistent state after fork().  */
 void mmap_fork_start(void)
 {
     if (mmap_lock_count)
         abort();
     pthread_mutex_lock(&mmap_mutex);
+    pthread_mutex_lock(&mmap_range_mutex);
 }
 
 void mmap_fork_end(int child)
 {
-    if (child)
+    if (child) {
         pthread_mutex_init(&mmap_mutex, NULL);
-    else
+        /* The threads with operations in flight are gone */
+        if (mmap_ranges) {
+            g_tree_destroy(mmap_ranges);
+            mmap_ranges = NULL;
+        }
+        pthread_mutex_init(&mmap_range_mutex, NULL);
+        pthread_cond_init(&mmap_range_cond, NULL);
+    } else {
+        pthread_mutex_unlock(&mmap_range_mutex);
         pthread_mutex_unlock(&mmap_mutex);
+    }
 }
 
 /*
@@ -113,6 +291,7 @@ int target_mprotect(abi_ulong start, abi_ulong len, int target_prot)
 {
     abi_ulong end, host_start, host_end, addr;
     int prot1, ret, page_flags, host_prot;
+    MmapRange range;
 
     trace_target_mprotect(start, len, target_prot);
 
@@ -132,7 +311,7 @@ int target_mprotect(abi_ulong start, abi_ulong len, int target_prot)
         return 0;
     }
 
-    mmap_lock();
+    mmap_range_lock(&range, start, len);
     host_start = start & qemu_host_page_mask;
     host_end = HOST_PAGE_ALIGN(end);
     if (start > host_start) {
@@ -175,11 +354,13 @@ int target_mprotect(abi_ulong start, abi_ulong len, int target_prot)
             goto error;
         }
     }
+    mmap_lock();
     page_set_flags(start, start + len, page_flags);
     mmap_unlock();
+    mmap_range_unlock(&range);
     return 0;
 error:
-    mmap_unlock();
+    mmap_range_unlock(&range);
     return ret;
 }
 
@@ -291,7 +472,7 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size,
             looped = true;
         } else {
             prot = page_get_flags(addr);
-            if (prot) {
+            if (prot || mmap_range_busy(addr)) {
                 /* Page in use.  Restart below this page.  */
                 addr = end_addr = ((addr - size) & -align) + size;
             } else if (addr && addr + size == end_addr) {
@@ -424,8 +605,8 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
 {
     abi_ulong ret, end, real_start, real_end, retaddr, host_offset, host_len;
     int page_flags, host_prot;
+    MmapRange range = { .nested = true };
 
-    mmap_lock();
     trace_target_mmap(start, len, target_prot, flags, fd, offset);
 
     if (!len) {
@@ -473,11 +654,27 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
     if (!(flags & MAP_FIXED)) {
         host_len = len + offset - host_offset;
         host_len = HOST_PAGE_ALIGN(host_len);
-        start = mmap_find_vma(real_start, host_len, TARGET_PAGE_SIZE);
-        if (start == (abi_ulong)-1) {
-            errno = ENOMEM;
-            goto fail;
+        mmap_lock();
+        for (;;) {
+            start = mmap_find_vma(real_start, host_len, TARGET_PAGE_SIZE);
+            if (start == (abi_ulong)-1) {
+                mmap_unlock();
+                errno = ENOMEM;
+                goto fail;
+            }
+            if (mmap_range_trylock(&range, start, host_len)) {
+                break;
+            }
+            /*
+             * The area looks free, but a MAP_FIXED request from another
+             * thread is about to claim it.  Wait for that request to
+             * finish and look for another area.
+             */
+            mmap_unlock();
+            mmap_range_wait_idle(&range);
+            mmap_lock();
         }
+        mmap_unlock();
     }
 
     /* When mapping files into a memory area larger than the file, accesses
@@ -553,6 +750,8 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
             goto fail;
         }
 
+        mmap_range_lock(&range, start, len);
+
         /* worst case: we cannot map the file because the offset is not
            aligned, so we read it */
         if (!(flags & MAP_ANONYMOUS) &&
@@ -624,17 +823,21 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
         page_flags |= PAGE_ANON;
     }
     page_flags |= PAGE_RESET;
+    mmap_lock();
     page_set_flags(start, start + len, page_flags);
+    mmap_unlock();
  the_end:
+    mmap_lock();
     trace_target_mmap_complete(start);
     if (qemu_loglevel_mask(CPU_LOG_PAGE)) {
         log_page_dump(__func__);
     }
     tb_invalidate_phys_range(start, start + len);
     mmap_unlock();
+    mmap_range_unlock(&range);
     return start;
 fail:
-    mmap_unlock();
+    mmap_range_unlock(&range);
     return -1;
 }
 
@@ -683,6 +886,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
 {
     abi_ulong end, real_start, real_end, addr;
     int prot, ret;
+    MmapRange range;
 
     trace_target_munmap(start, len);
 
@@ -693,7 +897,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
         return -TARGET_EINVAL;
     }
 
-    mmap_lock();
+    mmap_range_lock(&range, start, len);
     end = start + len;
     real_start = start & qemu_host_page_mask;
     real_end = HOST_PAGE_ALIGN(end);
@@ -733,10 +937,12 @@ int target_munmap(abi_ulong start, abi_ulong len)
     }
 
     if (ret == 0) {
+        mmap_lock();
         page_set_flags(start, start + len, 0);
         tb_invalidate_phys_range(start, start + len);
+        mmap_unlock();
     }
-    mmap_unlock();
+    mmap_range_unlock(&range);
     return ret;
 }
 
@@ -746,6 +952,7 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
 {
     int prot;
     void *host_addr;
+    MmapRange range;
 
     if (!guest_range_valid_untagged(old_addr, old_size) ||
         ((flags & MREMAP_FIXED) &&
@@ -756,6 +963,7 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
         return -1;
     }
 
+    mmap_range_lock_all(&range);
     mmap_lock();
 
     if (flags & MREMAP_FIXED) {
@@ -826,5 +1034,6 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
     }
     tb_invalidate_phys_range(new_addr, new_addr + new_size);
     mmap_unlock();
+    mmap_range_unlock(&range);
     return new_addr;
 }
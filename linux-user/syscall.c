@@ -1185,6 +1185,42 @@ static inline abi_long host_to_target_timespec64(abi_ulong target_addr,
     return 0;
 }
 
+/*
+ * Time queries are frequent enough in some guests that the conversion
+ * through a host copy shows up.  If the guest structure has the same
+ * layout as the host one, let the host fill it in place instead.
+ */
+#if defined(TARGET_WORDS_BIGENDIAN) == defined(HOST_WORDS_BIGENDIAN) && \
+    !defined(DEBUG_REMAP)
+#define TIME_LAYOUT_MATCHES(ttype, htype, f1, f2)                       \
+    (sizeof(ttype) == sizeof(htype) &&                                  \
+     offsetof(ttype, f1) == offsetof(htype, f1) &&                      \
+     sizeof_field(ttype, f1) == sizeof_field(htype, f1) &&              \
+     offsetof(ttype, f2) == offsetof(htype, f2) &&                      \
+     sizeof_field(ttype, f2) == sizeof_field(htype, f2))
+#else
+#define TIME_LAYOUT_MATCHES(ttype, htype, f1, f2)  false
+#endif
+
+#define TIMESPEC_LAYOUT_MATCHES(ttype) \
+    TIME_LAYOUT_MATCHES(ttype, struct timespec, tv_sec, tv_nsec)
+#define TIMEVAL_LAYOUT_MATCHES(ttype) \
+    TIME_LAYOUT_MATCHES(ttype, struct timeval, tv_sec, tv_usec)
+
+/*
+ * Return a host pointer through which the host may write @size bytes at
+ * @target_addr directly, or NULL to use the converting path, which also
+ * takes care of reporting faults.
+ */
+static inline void *lock_user_inplace(abi_ulong target_addr, size_t size,
+                                      size_t align)
+{
+    if (!QEMU_IS_ALIGNED(target_addr, align)) {
+        return NULL;
+    }
+    return lock_user(VERIFY_WRITE, target_addr, size, 0);
+}
+
 #if defined(TARGET_NR_gettimeofday)
 static inline abi_long copy_to_user_timezone(abi_ulong target_tz_addr,
                                              struct timezone *tz)
@@ -9361,12 +9397,19 @@ static abi_long do_syscall1(void *cpu_env, int num, abi_long arg1,
 #if defined(TARGET_NR_gettimeofday)
     case TARGET_NR_gettimeofday:
         {
-            struct timeval tv;
+            struct timeval tv, *host_tv = NULL;
             struct timezone tz;
 
-            ret = get_errno(gettimeofday(&tv, &tz));
+            if (TIMEVAL_LAYOUT_MATCHES(struct target_timeval) && arg1) {
+                host_tv = lock_user_inplace(arg1, sizeof(tv),
+                                            __alignof__(tv));
+            }
+            ret = get_errno(gettimeofday(host_tv ? host_tv : &tv, &tz));
+            if (host_tv) {
+                unlock_user(host_tv, arg1, sizeof(tv));
+            }
             if (!is_error(ret)) {
-                if (arg1 && copy_to_user_timeval(arg1, &tv)) {
+                if (arg1 && !host_tv && copy_to_user_timeval(arg1, &tv)) {
                     return -TARGET_EFAULT;
                 }
                 if (arg2 && copy_to_user_timezone(arg2, &tz)) {
@@ -12071,7 +12114,16 @@ static abi_long do_syscall1(void *cpu_env, int num, abi_long arg1,
 #ifdef TARGET_NR_clock_gettime
     case TARGET_NR_clock_gettime:
     {
-        struct timespec ts;
+        struct timespec ts, *host_ts = NULL;
+
+        if (TIMESPEC_LAYOUT_MATCHES(struct target_timespec)) {
+            host_ts = lock_user_inplace(arg2, sizeof(ts), __alignof__(ts));
+        }
+        if (host_ts) {
+            ret = get_errno(clock_gettime(arg1, host_ts));
+            unlock_user(host_ts, arg2, sizeof(ts));
+            return ret;
+        }
         ret = get_errno(clock_gettime(arg1, &ts));
         if (!is_error(ret)) {
             ret = host_to_target_timespec(arg2, &ts);
@@ -12082,7 +12134,16 @@ static abi_long do_syscall1(void *cpu_env, int num, abi_long arg1,
 #ifdef TARGET_NR_clock_gettime64
     case TARGET_NR_clock_gettime64:
     {
-        struct timespec ts;
+        struct timespec ts, *host_ts = NULL;
+
+        if (TIMESPEC_LAYOUT_MATCHES(struct target__kernel_timespec)) {
+            host_ts = lock_user_inplace(arg2, sizeof(ts), __alignof__(ts));
+        }
+        if (host_ts) {
+            ret = get_errno(clock_gettime(arg1, host_ts));
+            unlock_user(host_ts, arg2, sizeof(ts));
+            return ret;
+        }
         ret = get_errno(clock_gettime(arg1, &ts));
         if (!is_error(ret)) {
             ret = host_to_target_timespec64(arg2, &ts);
@@ -27,6 +27,7 @@
 #include "qemu/rcu.h"
 #include "migration/failover.h"
 #include "migration/ram.h"
+#include "xbzrle.h"
 #ifdef CONFIG_REPLICATION
 #include "block/replication.h"
 #endif
@@ -47,6 +48,20 @@ static COLOMode last_colo_mode;
 
 #define COLO_BUFFER_BASE_SIZE (4 * 1024 * 1024)
 
+/*
+ * Most devices do not change between two checkpoints, so the device
+ * state is sent as an XBZRLE delta against the previous checkpoint when
+ * it has the same size.  XBZRLE works on whole longs, the bytes after
+ * the last whole long are appended to the delta as they are.
+ */
+typedef struct COLODeviceStateCache {
+    /* device state sent by the previous checkpoint */
+    uint8_t *data;
+    size_t size;
+    /* encoded delta, as large as @data */
+    uint8_t *delta;
+} COLODeviceStateCache;
+
 bool migration_in_colo_state(void)
 {
     MigrationState *s = migrate_get_current();
@@ -376,31 +391,58 @@ static void colo_receive_check_message(QEMUFile *f, COLOMessage expect_msg,
     }
 }
 
-static uint64_t colo_receive_message_value(QEMUFile *f, uint32_t expect_msg,
-                                           Error **errp)
+static void colo_send_device_state(MigrationState *s,
+                                   QIOChannelBuffer *bioc,
+                                   COLODeviceStateCache *cache,
+                                   Error **errp)
 {
-    Error *local_err = NULL;
-    uint64_t value;
-    int ret;
-
-    colo_receive_check_message(f, expect_msg, &local_err);
-    if (local_err) {
-        error_propagate(errp, local_err);
-        return 0;
+    ERRP_GUARD();
+    size_t size = bioc->usage;
+    size_t aligned = QEMU_ALIGN_DOWN(size, sizeof(long));
+    int delta_len = -1;
+
+    if (size == cache->size && aligned && size <= INT_MAX) {
+        /* Only use the delta if it is notably smaller than the state */
+        delta_len = xbzrle_encode_buffer(cache->data, bioc->data, aligned,
+                                         cache->delta,
+                                         aligned - aligned / 8);
+    }
+
+    if (delta_len >= 0) {
+        colo_send_message_value(s->to_dst_file,
+                                COLO_MESSAGE_VMSTATE_DELTA_SIZE,
+                                delta_len + size - aligned, errp);
+        if (*errp) {
+            return;
+        }
+        qemu_put_buffer(s->to_dst_file, cache->delta, delta_len);
+        qemu_put_buffer(s->to_dst_file, bioc->data + aligned, size - aligned);
+    } else {
+        /*
+         * We need the size of the VMstate data in Secondary side,
+         * With which we can decide how much data should be read.
+         */
+        colo_send_message_value(s->to_dst_file, COLO_MESSAGE_VMSTATE_SIZE,
+                                size, errp);
+        if (*errp) {
+            return;
+        }
+        qemu_put_buffer(s->to_dst_file, bioc->data, size);
     }
+    trace_colo_send_device_state(size, delta_len);
 
-    value = qemu_get_be64(f);
-    ret = qemu_file_get_error(f);
-    if (ret < 0) {
-        error_setg_errno(errp, -ret, "Failed to get value for COLO message: %s",
-                         COLOMessage_str(expect_msg));
+    if (size != cache->size) {
+        cache->data = g_realloc(cache->data, size);
+        cache->delta = g_realloc(cache->delta, size);
+        cache->size = size;
     }
-    return value;
+    memcpy(cache->data, bioc->data, size);
 }
 
 static int colo_do_checkpoint_transaction(MigrationState *s,
                                           QIOChannelBuffer *bioc,
-                                          QEMUFile *fb)
+                                          QEMUFile *fb,
+                                          COLODeviceStateCache *cache)
 {
     Error *local_err = NULL;
     int ret = -1;
@@ -468,17 +510,10 @@ static int colo_do_checkpoint_transaction(MigrationState *s,
 
     qemu_fflush(fb);
 
-    /*
-     * We need the size of the VMstate data in Secondary side,
-     * With which we can decide how much data should be read.
-     */
-    colo_send_message_value(s->to_dst_file, COLO_MESSAGE_VMSTATE_SIZE,
-                            bioc->usage, &local_err);
+    colo_send_device_state(s, bioc, cache, &local_err);
     if (local_err) {
         goto out;
     }
-
-    qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
     qemu_fflush(s->to_dst_file);
     ret = qemu_file_get_error(s->to_dst_file);
     if (ret < 0) {
@@ -526,6 +561,7 @@ static void colo_process_checkpoint(MigrationState *s)
 {
     QIOChannelBuffer *bioc;
     QEMUFile *fb = NULL;
+    COLODeviceStateCache cache = {};
     int64_t current_time = qemu_clock_get_ms(QEMU_CLOCK_HOST);
     Error *local_err = NULL;
     int ret;
@@ -589,7 +625,7 @@ static void colo_process_checkpoint(MigrationState *s)
         if (s->state != MIGRATION_STATUS_COLO) {
             goto out;
         }
-        ret = colo_do_checkpoint_transaction(s, bioc, fb);
+        ret = colo_do_checkpoint_transaction(s, bioc, fb, &cache);
         if (ret < 0) {
             goto out;
         }
@@ -604,6 +640,8 @@ out:
     if (fb) {
         qemu_fclose(fb);
     }
+    g_free(cache.data);
+    g_free(cache.delta);
 
     /*
      * There are only two reasons we can get here, some error happened
@@ -669,11 +707,85 @@ void migrate_start_colo_process(MigrationState *s)
     qemu_mutex_lock_iothread();
 }
 
-static void colo_incoming_process_checkpoint(MigrationIncomingState *mis,
-                      QEMUFile *fb, QIOChannelBuffer *bioc, Error **errp)
+/*
+ * Read the device state of a checkpoint into @bioc, which still holds
+ * the previous checkpoint's if the state is sent as a delta.
+ */
+static void colo_receive_device_state(MigrationIncomingState *mis,
+                                      QIOChannelBuffer *bioc, Error **errp)
 {
+    ERRP_GUARD();
+    size_t size = bioc->usage;
+    size_t aligned = QEMU_ALIGN_DOWN(size, sizeof(long));
+    g_autofree uint8_t *delta = NULL;
     uint64_t total_size;
     uint64_t value;
+    COLOMessage msg;
+    int ret;
+
+    msg = colo_receive_message(mis->from_src_file, errp);
+    if (*errp) {
+        return;
+    }
+    if (msg != COLO_MESSAGE_VMSTATE_SIZE &&
+        msg != COLO_MESSAGE_VMSTATE_DELTA_SIZE) {
+        error_setg(errp, "Unexpected COLO message %d, expected vmstate-size",
+                   msg);
+        return;
+    }
+    value = qemu_get_be64(mis->from_src_file);
+    ret = qemu_file_get_error(mis->from_src_file);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to get value for COLO message: %s",
+                         COLOMessage_str(msg));
+        return;
+    }
+
+    if (msg == COLO_MESSAGE_VMSTATE_DELTA_SIZE) {
+        if (value < size - aligned || value > size) {
+            error_setg(errp, "Got %" PRIu64 " bytes of VMState delta for %zu"
+                       " bytes of VMState", value, size);
+            return;
+        }
+        delta = g_malloc(value);
+        total_size = qemu_get_buffer(mis->from_src_file, delta, value);
+        if (total_size != value) {
+            error_setg(errp, "Got %" PRIu64 " VMState delta data, less than"
+                       " expected %" PRIu64, total_size, value);
+            return;
+        }
+        value -= size - aligned;
+        if (xbzrle_decode_buffer(delta, value, bioc->data, aligned) < 0) {
+            error_setg(errp, "Failed to decode VMState delta");
+            return;
+        }
+        memcpy(bioc->data + aligned, delta + value, size - aligned);
+        trace_colo_receive_device_state(size, value);
+        return;
+    }
+
+    /*
+     * Read VM device state data into channel buffer,
+     * It's better to re-use the memory allocated.
+     * Here we need to handle the channel buffer directly.
+     */
+    if (value > bioc->capacity) {
+        bioc->capacity = value;
+        bioc->data = g_realloc(bioc->data, bioc->capacity);
+    }
+    total_size = qemu_get_buffer(mis->from_src_file, bioc->data, value);
+    if (total_size != value) {
+        error_setg(errp, "Got %" PRIu64 " VMState data, less than expected"
+                    " %" PRIu64, total_size, value);
+        return;
+    }
+    bioc->usage = total_size;
+    trace_colo_receive_device_state(total_size, -1);
+}
+
+static void colo_incoming_process_checkpoint(MigrationIncomingState *mis,
+                      QEMUFile *fb, QIOChannelBuffer *bioc, Error **errp)
+{
     Error *local_err = NULL;
     int ret;
 
@@ -707,29 +819,11 @@ static void colo_incoming_process_checkpoint(MigrationIncomingState *mis,
         return;
     }
 
-    value = colo_receive_message_value(mis->from_src_file,
-                             COLO_MESSAGE_VMSTATE_SIZE, &local_err);
+    colo_receive_device_state(mis, bioc, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         return;
     }
-
-    /*
-     * Read VM device state data into channel buffer,
-     * It's better to re-use the memory allocated.
-     * Here we need to handle the channel buffer directly.
-     */
-    if (value > bioc->capacity) {
-        bioc->capacity = value;
-        bioc->data = g_realloc(bioc->data, bioc->capacity);
-    }
-    total_size = qemu_get_buffer(mis->from_src_file, bioc->data, value);
-    if (total_size != value) {
-        error_setg(errp, "Got %" PRIu64 " VMState data, less than expected"
-                    " %" PRIu64, total_size, value);
-        return;
-    }
-    bioc->usage = total_size;
     qio_channel_io_seek(QIO_CHANNEL(bioc), 0, 0, NULL);
 
     colo_send_message(mis->to_src_file, COLO_MESSAGE_VMSTATE_RECEIVED,
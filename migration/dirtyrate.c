@@ -16,7 +16,12 @@
 #include "cpu.h"
 #include "exec/ramblock.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
 #include "qapi/qapi-commands-migration.h"
+#include "hw/boards.h"
+#include "exec/memory.h"
+#include "sysemu/kvm.h"
 #include "ram.h"
 #include "trace.h"
 #include "dirtyrate.h"
@@ -70,18 +75,33 @@ static int dirtyrate_set_state(int *state, int old_state, int new_state)
 
 static struct DirtyRateInfo *query_dirty_rate_info(void)
 {
+    int i;
     int64_t dirty_rate = DirtyStat.dirty_rate;
     struct DirtyRateInfo *info = g_malloc0(sizeof(DirtyRateInfo));
+    DirtyRateVcpuList *head = NULL, **tail = &head;
 
     if (qatomic_read(&CalculatingState) == DIRTY_RATE_STATUS_MEASURED) {
         info->has_dirty_rate = true;
         info->dirty_rate = dirty_rate;
+
+        if (DirtyStat.mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING) {
+            for (i = 0; i < DirtyStat.nvcpu; i++) {
+                DirtyRateVcpu *rate = g_new0(DirtyRateVcpu, 1);
+
+                rate->id = DirtyStat.rates[i].id;
+                rate->dirty_rate = DirtyStat.rates[i].dirty_rate;
+                QAPI_LIST_APPEND(tail, rate);
+            }
+            info->has_vcpu_dirty_rate = true;
+            info->vcpu_dirty_rate = head;
+        }
     }
 
     info->status = CalculatingState;
     info->start_time = DirtyStat.start_time;
     info->calc_time = DirtyStat.calc_time;
     info->sample_pages = DirtyStat.sample_pages;
+    info->mode = DirtyStat.mode;
 
     trace_query_dirty_rate_info(DirtyRateStatus_str(CalculatingState));
 
@@ -89,8 +109,13 @@ static struct DirtyRateInfo *query_dirty_rate_info(void)
 }
 
 static void init_dirtyrate_stat(int64_t start_time, int64_t calc_time,
-                                uint64_t sample_pages)
+                                uint64_t sample_pages,
+                                DirtyRateMeasureMode mode)
 {
+    g_free(DirtyStat.rates);
+    DirtyStat.rates = NULL;
+    DirtyStat.nvcpu = 0;
+    DirtyStat.mode = mode;
     DirtyStat.total_dirty_samples = 0;
     DirtyStat.total_sample_count = 0;
     DirtyStat.total_block_mem_MB = 0;
@@ -334,6 +359,57 @@ static bool compare_page_hash_info(struct RamblockDirtyInfo *info,
     return true;
 }
 
+/*
+ * Count the pages collected from the dirty ring of each vcpu over the
+ * measurement period, which gives an exact per-vcpu dirty rate.
+ */
+static void calculate_dirtyrate_dirty_ring(struct DirtyRateConfig config)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    g_autofree uint64_t *start_pages = g_new0(uint64_t, ms->smp.max_cpus);
+    int64_t msec, initial_time;
+    int64_t total_rate = 0;
+    uint64_t pages;
+    CPUState *cpu;
+    int nvcpu = 0;
+
+    qemu_mutex_lock_iothread();
+    memory_global_dirty_log_start(GLOBAL_DIRTY_DIRTY_RATE);
+    /* Don't account the pages dirtied before the measurement starts */
+    memory_global_dirty_log_sync(false);
+    initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    CPU_FOREACH(cpu) {
+        start_pages[cpu->cpu_index] = cpu->dirty_pages;
+    }
+    qemu_mutex_unlock_iothread();
+
+    msec = config.sample_period_seconds * 1000;
+    msec = set_sample_page_period(msec, initial_time);
+    DirtyStat.start_time = initial_time / 1000;
+    DirtyStat.calc_time = msec / 1000;
+
+    qemu_mutex_lock_iothread();
+    memory_global_dirty_log_sync(false);
+    CPU_FOREACH(cpu) {
+        nvcpu++;
+    }
+    DirtyStat.rates = g_new0(DirtyRateVcpu, nvcpu);
+    CPU_FOREACH(cpu) {
+        DirtyRateVcpu *rate = &DirtyStat.rates[DirtyStat.nvcpu++];
+
+        pages = cpu->dirty_pages - start_pages[cpu->cpu_index];
+        rate->id = cpu->cpu_index;
+        rate->dirty_rate = pages * qemu_real_host_page_size * 1000 /
+                           (msec * MiB);
+        total_rate += rate->dirty_rate;
+        trace_dirtyrate_calculate_vcpu(rate->id, rate->dirty_rate);
+    }
+    memory_global_dirty_log_stop(GLOBAL_DIRTY_DIRTY_RATE);
+    qemu_mutex_unlock_iothread();
+
+    DirtyStat.dirty_rate = total_rate;
+}
+
 static void calculate_dirtyrate(struct DirtyRateConfig config)
 {
     struct RamblockDirtyInfo *block_dinfo = NULL;
@@ -385,9 +461,15 @@ void *get_dirtyrate_thread(void *arg)
     start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) / 1000;
     calc_time = config.sample_period_seconds;
     sample_pages = config.sample_pages_per_gigabytes;
-    init_dirtyrate_stat(start_time, calc_time, sample_pages);
+    init_dirtyrate_stat(start_time, calc_time, sample_pages, config.mode);
 
-    calculate_dirtyrate(config);
+    if (config.mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING) {
+        rcu_register_thread();
+        calculate_dirtyrate_dirty_ring(config);
+        rcu_unregister_thread();
+    } else {
+        calculate_dirtyrate(config);
+    }
 
     ret = dirtyrate_set_state(&CalculatingState, DIRTY_RATE_STATUS_MEASURING,
                               DIRTY_RATE_STATUS_MEASURED);
@@ -398,7 +480,8 @@ void *get_dirtyrate_thread(void *arg)
 }
 
 void qmp_calc_dirty_rate(int64_t calc_time, bool has_sample_pages,
-                         int64_t sample_pages, Error **errp)
+                         int64_t sample_pages, bool has_mode,
+                         DirtyRateMeasureMode mode, Error **errp)
 {
     static struct DirtyRateConfig config;
     QemuThread thread;
@@ -419,7 +502,23 @@ void qmp_calc_dirty_rate(int64_t calc_time, bool has_sample_pages,
         return;
     }
 
-    if (has_sample_pages) {
+    if (!has_mode) {
+        mode = DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING;
+    }
+
+    if (mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING) {
+        if (has_sample_pages) {
+            error_setg(errp, "sample-pages is used only in page-sampling "
+                       "mode");
+            return;
+        }
+        if (!kvm_enabled() || !kvm_dirty_ring_enabled()) {
+            error_setg(errp, "dirty-ring is disabled, use page-sampling "
+                       "mode or enable the KVM dirty ring");
+            return;
+        }
+        sample_pages = 0;
+    } else if (has_sample_pages) {
         if (!is_sample_pages_valid(sample_pages)) {
             error_setg(errp, "sample-pages is out of range[%d, %d].",
                             MIN_SAMPLE_PAGE_COUNT,
@@ -442,6 +541,7 @@ void qmp_calc_dirty_rate(int64_t calc_time, bool has_sample_pages,
 
     config.sample_period_seconds = calc_time;
     config.sample_pages_per_gigabytes = sample_pages;
+    config.mode = mode;
     qemu_thread_create(&thread, "get_dirtyrate", get_dirtyrate_thread,
                        (void *)&config, QEMU_THREAD_DETACHED);
 }
@@ -459,17 +559,29 @@ void hmp_info_dirty_rate(Monitor *mon, const QDict *qdict)
                    DirtyRateStatus_str(info->status));
     monitor_printf(mon, "Start Time: %"PRIi64" (ms)\n",
                    info->start_time);
-    monitor_printf(mon, "Sample Pages: %"PRIu64" (per GB)\n",
-                   info->sample_pages);
+    monitor_printf(mon, "Mode: %s\n", DirtyRateMeasureMode_str(info->mode));
+    if (info->mode == DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING) {
+        monitor_printf(mon, "Sample Pages: %"PRIu64" (per GB)\n",
+                       info->sample_pages);
+    }
     monitor_printf(mon, "Period: %"PRIi64" (sec)\n",
                    info->calc_time);
     monitor_printf(mon, "Dirty rate: ");
     if (info->has_dirty_rate) {
         monitor_printf(mon, "%"PRIi64" (MB/s)\n", info->dirty_rate);
+        if (info->has_vcpu_dirty_rate) {
+            DirtyRateVcpuList *rate;
+
+            for (rate = info->vcpu_dirty_rate; rate; rate = rate->next) {
+                monitor_printf(mon, "vcpu[%"PRIi64"], Dirty rate: %"PRIi64
+                               " (MB/s)\n", rate->value->id,
+                               rate->value->dirty_rate);
+            }
+        }
     } else {
         monitor_printf(mon, "(not ready)\n");
     }
-    g_free(info);
+    qapi_free_DirtyRateInfo(info);
 }
 
 void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
@@ -477,6 +589,8 @@ void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
     int64_t sec = qdict_get_try_int(qdict, "second", 0);
     int64_t sample_pages = qdict_get_try_int(qdict, "sample_pages_per_GB", -1);
     bool has_sample_pages = (sample_pages != -1);
+    bool dirty_ring = qdict_get_try_bool(qdict, "dirty_ring", false);
+    DirtyRateMeasureMode mode = DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING;
     Error *err = NULL;
 
     if (!sec) {
@@ -484,7 +598,12 @@ void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
         return;
     }
 
-    qmp_calc_dirty_rate(sec, has_sample_pages, sample_pages, &err);
+    if (dirty_ring) {
+        mode = DIRTY_RATE_MEASURE_MODE_DIRTY_RING;
+    }
+
+    qmp_calc_dirty_rate(sec, has_sample_pages, sample_pages, true,
+                        mode, &err);
     if (err) {
         hmp_handle_error(mon, err);
         return;
@@ -43,6 +43,7 @@
 struct DirtyRateConfig {
     uint64_t sample_pages_per_gigabytes; /* sample pages per GB */
     int64_t sample_period_seconds; /* time duration between two sampling */
+    DirtyRateMeasureMode mode; /* mode of dirtyrate measurement */
 };
 
 /*
@@ -69,6 +70,9 @@ struct DirtyRateStat {
     int64_t start_time; /* calculation start time in units of second */
     int64_t calc_time; /* time duration of two sampling in units of second */
     uint64_t sample_pages; /* sample pages per GB */
+    DirtyRateMeasureMode mode; /* mode of dirtyrate measurement */
+    int nvcpu; /* number of vcpu in dirty-ring mode */
+    DirtyRateVcpu *rates; /* dirty rate of each vcpu in dirty-ring mode */
 };
 
 void *get_dirtyrate_thread(void *arg);
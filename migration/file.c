@@ -0,0 +1,86 @@
+/*
+ * QEMU live migration to/from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "channel.h"
+#include "file.h"
+#include "migration.h"
+#include "io/channel-file.h"
+#include "io/task.h"
+#include "trace.h"
+
+static struct FileOutgoingArgs {
+    char *fname;
+} outgoing_args;
+
+/*
+ * Open another channel on the outgoing migration file, used by the
+ * multifd threads when the RAM pages are written at fixed offsets.
+ */
+void file_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelFile *ioc;
+    QIOTask *task;
+    Error *err = NULL;
+
+    ioc = qio_channel_file_new_path(outgoing_args.fname, O_WRONLY, 0, &err);
+
+    task = qio_task_new(OBJECT(ioc), f, data, NULL);
+    if (!ioc) {
+        qio_task_set_error(task, err);
+    }
+    qio_task_complete(task);
+}
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_outgoing(filename);
+
+    fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY | O_TRUNC,
+                                     0600, errp);
+    if (!fioc) {
+        return;
+    }
+
+    g_free(outgoing_args.fname);
+    outgoing_args.fname = g_strdup(filename);
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-outgoing");
+    migration_channel_connect(s, QIO_CHANNEL(fioc), NULL, NULL);
+    object_unref(OBJECT(fioc));
+}
+
+static gboolean file_accept_incoming_migration(QIOChannel *ioc,
+                                               GIOCondition condition,
+                                               gpointer opaque)
+{
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+    return G_SOURCE_REMOVE;
+}
+
+void file_start_incoming_migration(const char *filename, Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_incoming(filename);
+
+    fioc = qio_channel_file_new_path(filename, O_RDONLY, 0, errp);
+    if (!fioc) {
+        return;
+    }
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-incoming");
+    qio_channel_add_watch_full(QIO_CHANNEL(fioc), G_IO_IN,
+                               file_accept_incoming_migration,
+                               NULL, NULL,
+                               g_main_context_get_thread_default());
+}
@@ -20,6 +20,7 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
@@ -128,6 +129,7 @@ enum mig_rp_message_type {
     MIG_RP_MSG_REQ_PAGES,    /* data (start: be64, len: be32) */
     MIG_RP_MSG_RECV_BITMAP,  /* send recved_bitmap back to source */
     MIG_RP_MSG_RESUME_ACK,   /* tell source that we are ready to resume */
+    MIG_RP_MSG_SWITCHOVER_ACK, /* the source may stop the VM */
 
     MIG_RP_MSG_MAX
 };
@@ -154,7 +156,7 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_POSTCOPY_BLOCKTIME,
     MIGRATION_CAPABILITY_LATE_BLOCK_ACTIVATE,
     MIGRATION_CAPABILITY_RETURN_PATH,
-    MIGRATION_CAPABILITY_MULTIFD,
+    MIGRATION_CAPABILITY_MAPPED_RAM_MMAP,
     MIGRATION_CAPABILITY_PAUSE_BEFORE_SWITCHOVER,
     MIGRATION_CAPABILITY_AUTO_CONVERGE,
     MIGRATION_CAPABILITY_RELEASE_RAM,
@@ -162,7 +164,8 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_COMPRESS,
     MIGRATION_CAPABILITY_XBZRLE,
     MIGRATION_CAPABILITY_X_COLO,
-    MIGRATION_CAPABILITY_VALIDATE_UUID);
+    MIGRATION_CAPABILITY_VALIDATE_UUID,
+    MIGRATION_CAPABILITY_SWITCHOVER_ACK);
 
 /* When we add fault tolerance, we could have several
    migrations at once.  For now we don't need to add
@@ -208,6 +211,8 @@ void migration_object_init(void)
     qemu_sem_init(&current_incoming->postcopy_pause_sem_dst, 0);
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fault, 0);
     qemu_mutex_init(&current_incoming->page_request_mutex);
+    qemu_sem_init(&current_incoming->postcopy_qemufile_dst_sem, 0);
+    qemu_event_init(&current_incoming->postcopy_listen_event, false);
     current_incoming->page_requested = g_tree_new(page_request_addr_cmp);
 
     if (!migration_object_check(current_migration, &err)) {
@@ -278,6 +283,12 @@ void migration_incoming_state_destroy(void)
         qemu_fclose(mis->from_src_file);
         mis->from_src_file = NULL;
     }
+    if (mis->postcopy_qemufile_dst) {
+        migration_ioc_unregister_yank_from_file(mis->postcopy_qemufile_dst);
+        qemu_fclose(mis->postcopy_qemufile_dst);
+        mis->postcopy_qemufile_dst = NULL;
+    }
+    memset(mis->last_recv_block, 0, sizeof(mis->last_recv_block));
     if (mis->postcopy_remote_fds) {
         g_array_free(mis->postcopy_remote_fds, TRUE);
         mis->postcopy_remote_fds = NULL;
@@ -287,6 +298,7 @@ void migration_incoming_state_destroy(void)
     }
 
     qemu_event_reset(&mis->main_thread_load_event);
+    qemu_event_reset(&mis->postcopy_listen_event);
 
     if (mis->page_requested) {
         g_tree_destroy(mis->page_requested);
@@ -458,6 +470,11 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
 {
     const char *p = NULL;
 
+    if (migrate_mapped_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "Mapped-ram migration requires a file: URI");
+        return;
+    }
+
     qapi_event_send_migration(MIGRATION_STATUS_SETUP);
     if (strstart(uri, "tcp:", &p) ||
         strstart(uri, "unix:", NULL) ||
@@ -471,6 +488,8 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -480,6 +499,7 @@ static void process_incoming_migration_bh(void *opaque)
 {
     Error *local_err = NULL;
     MigrationIncomingState *mis = opaque;
+    int64_t start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
     /* If capability late_block_activate is set:
      * Only fire up the block code now if we're going to restart the
@@ -499,6 +519,8 @@ static void process_incoming_migration_bh(void *opaque)
             autostart = false;
         }
     }
+    migration_downtime_add_phase(&mis->downtime_recorder, "block-activate",
+                                 start_us);
 
     /*
      * This must happen after all error conditions are dealt with and
@@ -516,6 +538,7 @@ static void process_incoming_migration_bh(void *opaque)
 
     dirty_bitmap_mig_before_vm_start();
 
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     if (!global_state_received() ||
         global_state_get_runstate() == RUN_STATE_RUNNING) {
         if (autostart) {
@@ -529,6 +552,9 @@ static void process_incoming_migration_bh(void *opaque)
     } else {
         runstate_set(global_state_get_runstate());
     }
+    migration_downtime_add_phase(&mis->downtime_recorder, "vm-start",
+                                 start_us);
+    migration_downtime_stop(&mis->downtime_recorder);
     /*
      * This must happen after any state changes since as soon as an external
      * observer sees this event they might start to prod at the VM assuming
@@ -553,6 +579,7 @@ static void process_incoming_migration_co(void *opaque)
     postcopy_state_set(POSTCOPY_INCOMING_NONE);
     migrate_set_state(&mis->state, MIGRATION_STATUS_NONE,
                       MIGRATION_STATUS_ACTIVE);
+    migration_downtime_start(&mis->downtime_recorder);
     ret = qemu_loadvm_state(mis->from_src_file);
 
     ps = postcopy_state_get();
@@ -592,6 +619,8 @@ static void process_incoming_migration_co(void *opaque)
 
         /* Wait checkpoint incoming thread exit before free resource */
         qemu_thread_join(&mis->colo_incoming_thread);
+        /* The multifd threads must not write to the cache anymore */
+        multifd_load_shutdown();
         /* We hold the global iothread lock, so it is safe here */
         colo_release_ram_cache();
     }
@@ -718,8 +747,14 @@ void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
         /*
          * Common migration only needs one channel, so we can start
          * right now.  Multifd needs more than one channel, we wait.
+         * With mapped-ram the destination reads the pages straight
+         * from the file, so no multifd channel will connect.
          */
-        start_migration = !migrate_use_multifd();
+        start_migration = !migrate_use_multifd() || migrate_mapped_ram();
+    } else if (migrate_postcopy_preempt()) {
+        /* The only other connection is the postcopy preempt channel */
+        postcopy_preempt_new_channel(mis, qemu_fopen_channel_input(ioc));
+        return;
     } else {
         /* Multiple connections */
         assert(migrate_use_multifd());
@@ -747,6 +782,9 @@ bool migration_has_all_channels(void)
     bool all_channels;
 
     all_channels = multifd_recv_all_channels_created();
+    if (migrate_postcopy_preempt()) {
+        all_channels = all_channels && mis->postcopy_qemufile_dst != NULL;
+    }
 
     return all_channels && mis->from_src_file != NULL;
 }
@@ -825,6 +863,11 @@ void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value)
     migrate_send_rp_message(mis, MIG_RP_MSG_RESUME_ACK, sizeof(buf), &buf);
 }
 
+void migrate_send_rp_switchover_ack(MigrationIncomingState *mis)
+{
+    migrate_send_rp_message(mis, MIG_RP_MSG_SWITCHOVER_ACK, 0, NULL);
+}
+
 MigrationCapabilityStatusList *qmp_query_migrate_capabilities(Error **errp)
 {
     MigrationCapabilityStatusList *head = NULL, **tail = &head;
@@ -1060,6 +1103,63 @@ static void populate_disk_info(MigrationInfo *info)
     }
 }
 
+void migration_downtime_start(MigrationDowntimeRecorder *rec)
+{
+    qapi_free_MigrationDowntimeBreakdown(rec->breakdown);
+    rec->breakdown = g_new0(MigrationDowntimeBreakdown, 1);
+    rec->phases_tail = &rec->breakdown->phases;
+    rec->sections_tail = &rec->breakdown->sections;
+    rec->active = true;
+}
+
+void migration_downtime_stop(MigrationDowntimeRecorder *rec)
+{
+    rec->active = false;
+}
+
+void migration_downtime_add_phase(MigrationDowntimeRecorder *rec,
+                                  const char *name, int64_t start_us)
+{
+    MigrationDowntimeEntry *entry;
+
+    if (!rec->active) {
+        return;
+    }
+    entry = g_new0(MigrationDowntimeEntry, 1);
+    entry->name = g_strdup(name);
+    entry->time = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
+    trace_migration_downtime_phase(name, entry->time);
+    QAPI_LIST_APPEND(rec->phases_tail, entry);
+}
+
+void migration_downtime_add_section(MigrationDowntimeRecorder *rec,
+                                    const char *idstr, uint32_t instance_id,
+                                    int64_t time_us)
+{
+    MigrationDowntimeEntry *entry;
+
+    if (!rec->active) {
+        return;
+    }
+    entry = g_new0(MigrationDowntimeEntry, 1);
+    entry->name = g_strdup(idstr);
+    entry->has_instance_id = true;
+    entry->instance_id = instance_id;
+    entry->time = time_us;
+    trace_migration_downtime_section(idstr, instance_id, time_us);
+    QAPI_LIST_APPEND(rec->sections_tail, entry);
+}
+
+static void populate_downtime_breakdown(MigrationInfo *info,
+                                        MigrationDowntimeRecorder *rec)
+{
+    if (rec->breakdown && !rec->active) {
+        info->has_downtime_breakdown = true;
+        info->downtime_breakdown = QAPI_CLONE(MigrationDowntimeBreakdown,
+                                              rec->breakdown);
+    }
+}
+
 static void fill_source_migration_info(MigrationInfo *info)
 {
     MigrationState *s = migrate_get_current();
@@ -1112,6 +1212,7 @@ static void fill_source_migration_info(MigrationInfo *info)
         populate_time_info(info, s);
         populate_ram_info(info, s);
         populate_vfio_info(info);
+        populate_downtime_breakdown(info, &s->downtime_recorder);
         break;
     case MIGRATION_STATUS_FAILED:
         info->has_status = true;
@@ -1216,6 +1317,82 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_SWITCHOVER_ACK] &&
+        !cap_list[MIGRATION_CAPABILITY_RETURN_PATH]) {
+        error_setg(errp, "Switchover ack requires return-path");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Multifd zero page detection requires multifd");
+        return false;
+    }
+
+#ifdef CONFIG_LINUX
+    if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Zero copy send is only available with multifd");
+        return false;
+    }
+#endif
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        if (cap_list[MIGRATION_CAPABILITY_XBZRLE]) {
+            error_setg(errp, "Mapped-ram migration is incompatible with xbzrle");
+            return false;
+        }
+        if (cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
+            error_setg(errp,
+                       "Mapped-ram migration is incompatible with compression");
+            return false;
+        }
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp,
+                       "Mapped-ram migration is incompatible with postcopy");
+            return false;
+        }
+        if (cap_list[MIGRATION_CAPABILITY_X_COLO]) {
+            error_setg(errp, "Mapped-ram migration is incompatible with COLO");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM_MMAP] &&
+        !cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        error_setg(errp, "Mapped-ram-mmap requires mapped-ram");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
+        if (!cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Postcopy preempt requires postcopy-ram");
+            return false;
+        }
+        if (cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Postcopy preempt is incompatible with multifd");
+            return false;
+        }
+        /*
+         * Compressed pages are collected into the stream after they were
+         * queued, they could end up on the wrong channel.
+         */
+        if (cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
+            error_setg(errp,
+                       "Postcopy preempt is incompatible with compression");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_MULTIFD]) {
+        if (!cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp,
+                       "Postcopy multifd requires postcopy-ram and multifd");
+            return false;
+        }
+    }
+
     if (cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
         WriteTrackingSupport wt_support;
         int idx;
@@ -1247,6 +1424,17 @@ static bool migrate_caps_check(bool *cap_list,
                 return false;
             }
         }
+
+        /*
+         * Write protection is released once a page is in the migration
+         * stream, which the multifd channels only tell with mapped-ram.
+         */
+        if (cap_list[MIGRATION_CAPABILITY_MULTIFD] &&
+            !cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Background-snapshot with multifd requires "
+                       "mapped-ram");
+            return false;
+        }
     }
 
     return true;
@@ -1279,6 +1467,7 @@ static void fill_destination_migration_info(MigrationInfo *info)
     case MIGRATION_STATUS_COMPLETED:
         info->has_status = true;
         fill_destination_postcopy_migration_info(info);
+        populate_downtime_breakdown(info, &mis->downtime_recorder);
         break;
     }
     info->status = mis->state;
@@ -1805,6 +1994,7 @@ static void migrate_fd_cleanup(MigrationState *s)
         qemu_mutex_lock_iothread();
 
         multifd_save_cleanup();
+        postcopy_preempt_close_channel(s);
         qemu_mutex_lock(&s->qemu_file_lock);
         tmp = s->to_dst_file;
         s->to_dst_file = NULL;
@@ -1911,6 +2101,13 @@ static void migrate_fd_cancel(MigrationState *s)
     if (s->state == MIGRATION_STATUS_CANCELLING && f) {
         qemu_file_shutdown(f);
     }
+    if (s->state == MIGRATION_STATUS_CANCELLING) {
+        WITH_QEMU_LOCK_GUARD(&s->qemu_file_lock) {
+            if (s->postcopy_qemufile_src) {
+                qemu_file_shutdown(s->postcopy_qemufile_src);
+            }
+        }
+    }
     if (s->state == MIGRATION_STATUS_CANCELLING && s->block_inactive) {
         Error *local_err = NULL;
 
@@ -2035,10 +2232,13 @@ void migrate_init(MigrationState *s)
     s->mbps = 0.0;
     s->pages_per_second = 0.0;
     s->downtime = 0;
+    qapi_free_MigrationDowntimeBreakdown(s->downtime_recorder.breakdown);
+    s->downtime_recorder.breakdown = NULL;
     s->expected_downtime = 0;
     s->setup_time = 0;
     s->start_postcopy = false;
     s->postcopy_after_devices = false;
+    s->switchover_acked = false;
     s->migration_thread_running = false;
     error_free(s->error);
     s->error = NULL;
@@ -2218,6 +2418,16 @@ static bool migrate_prepare(MigrationState *s, bool blk, bool blk_inc,
             return false;
         }
 
+        /*
+         * The multifd channels are not re-established on recovery, and
+         * the pages sitting in them would be lost the same way.
+         */
+        if (migrate_postcopy_multifd()) {
+            error_setg(errp, "Postcopy recovery cannot work "
+                       "when postcopy-multifd capability is set");
+            return false;
+        }
+
         /* This is a resume, skip init status */
         return true;
     }
@@ -2294,6 +2504,28 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         }
     }
 
+    if (migrate_mapped_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(&local_err, "Mapped-ram migration requires a file: URI");
+    } else if (migrate_postcopy_preempt() &&
+               !strstart(uri, "tcp:", NULL) &&
+               !strstart(uri, "unix:", NULL) &&
+               !strstart(uri, "vsock:", NULL)) {
+        error_setg(&local_err, "Postcopy preempt requires a socket URI");
+    } else if (migrate_postcopy_preempt() &&
+               s->parameters.tls_creds && *s->parameters.tls_creds) {
+        error_setg(&local_err, "Postcopy preempt is not supported with TLS");
+    }
+    if (local_err) {
+        if (!(has_resume && resume)) {
+            yank_unregister_instance(MIGRATION_YANK_INSTANCE);
+        }
+        error_propagate(errp, local_err);
+        migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                          MIGRATION_STATUS_FAILED);
+        block_cleanup_parameters(s);
+        return;
+    }
+
     if (strstart(uri, "tcp:", &p) ||
         strstart(uri, "unix:", NULL) ||
         strstart(uri, "vsock:", NULL)) {
@@ -2306,6 +2538,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         if (!(has_resume && resume)) {
             yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -2362,6 +2596,24 @@ bool migrate_postcopy_ram(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM];
 }
 
+bool migrate_postcopy_preempt(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT];
+}
+
+bool migrate_postcopy_multifd(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_MULTIFD];
+}
+
 bool migrate_postcopy(void)
 {
     return migrate_postcopy_ram() || migrate_dirty_bitmaps();
@@ -2439,6 +2691,15 @@ int migrate_decompress_threads(void)
     return s->parameters.decompress_threads;
 }
 
+int migrate_device_save_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->device_save_threads;
+}
+
 bool migrate_dirty_bitmaps(void)
 {
     MigrationState *s;
@@ -2484,6 +2745,46 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_multifd_zero_page(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE];
+}
+
+bool migrate_use_zero_copy_send(void)
+{
+#ifdef CONFIG_LINUX
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ZERO_COPY_SEND];
+#else
+    return false;
+#endif
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+bool migrate_mapped_ram_mmap(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM_MMAP];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -2593,6 +2894,15 @@ bool migrate_background_snapshot(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT];
 }
 
+bool migrate_switchover_ack(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_SWITCHOVER_ACK];
+}
+
 /* migration thread support */
 /*
  * Something bad happened to the RP stream, mark an error
@@ -2614,6 +2924,7 @@ static struct rp_cmd_args {
     [MIG_RP_MSG_REQ_PAGES_ID]   = { .len = -1, .name = "REQ_PAGES_ID" },
     [MIG_RP_MSG_RECV_BITMAP]    = { .len = -1, .name = "RECV_BITMAP" },
     [MIG_RP_MSG_RESUME_ACK]     = { .len =  4, .name = "RESUME_ACK" },
+    [MIG_RP_MSG_SWITCHOVER_ACK] = { .len =  0, .name = "SWITCHOVER_ACK" },
     [MIG_RP_MSG_MAX]            = { .len = -1, .name = "MAX" },
 };
 
@@ -2836,6 +3147,11 @@ retry:
             }
             break;
 
+        case MIG_RP_MSG_SWITCHOVER_ACK:
+            trace_source_return_path_thread_switchover_acked();
+            qatomic_set(&ms->switchover_acked, true);
+            break;
+
         default:
             break;
         }
@@ -2932,6 +3248,18 @@ static int postcopy_start(MigrationState *ms)
     int64_t bandwidth = migrate_max_postcopy_bandwidth();
     bool restart_block = false;
     int cur_state = MIGRATION_STATUS_ACTIVE;
+
+    /*
+     * Connect the preempt channel before the guest stops; the connection
+     * is completed by the main loop, so this must not hold the iothread
+     * lock.
+     */
+    if (migrate_postcopy_preempt() && postcopy_preempt_setup(ms)) {
+        migrate_set_state(&ms->state, MIGRATION_STATUS_ACTIVE,
+                          MIGRATION_STATUS_FAILED);
+        return -1;
+    }
+
     if (!migrate_pause_before_switchover()) {
         migrate_set_state(&ms->state, MIGRATION_STATUS_ACTIVE,
                           MIGRATION_STATUS_POSTCOPY_ACTIVE);
@@ -3149,10 +3477,13 @@ static void migration_completion(MigrationState *s)
 {
     int ret;
     int current_active_state = s->state;
+    int64_t start_us;
 
     if (s->state == MIGRATION_STATUS_ACTIVE) {
         qemu_mutex_lock_iothread();
         s->downtime_start = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        migration_downtime_start(&s->downtime_recorder);
+        start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         qemu_system_wakeup_request(QEMU_WAKEUP_REASON_OTHER, NULL);
         s->vm_was_running = runstate_is_running();
         ret = global_state_store();
@@ -3165,6 +3496,8 @@ static void migration_completion(MigrationState *s)
                 ret = migration_maybe_pause(s, &current_active_state,
                                             MIGRATION_STATUS_DEVICE);
             }
+            migration_downtime_add_phase(&s->downtime_recorder, "vm-stop",
+                                         start_us);
             if (ret >= 0) {
                 qemu_file_set_rate_limit(s->to_dst_file, INT64_MAX);
                 ret = qemu_savevm_state_complete_precopy(s->to_dst_file, false,
@@ -3183,6 +3516,8 @@ static void migration_completion(MigrationState *s)
         trace_migration_completion_postcopy_end();
 
         qemu_savevm_state_complete_postcopy(s->to_dst_file);
+        /* Everything was sent, let the destination preempt thread quit */
+        ram_postcopy_preempt_send_eos(s);
         trace_migration_completion_postcopy_end_after_complete();
     } else if (s->state == MIGRATION_STATUS_CANCELLING) {
         goto fail;
@@ -3197,12 +3532,16 @@ static void migration_completion(MigrationState *s)
     if (s->rp_state.rp_thread_created) {
         int rp_error;
         trace_migration_return_path_end_before();
+        start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         rp_error = await_return_path_close_on_source(s);
+        migration_downtime_add_phase(&s->downtime_recorder, "return-path",
+                                     start_us);
         trace_migration_return_path_end_after(rp_error);
         if (rp_error) {
             goto fail_invalidate;
         }
     }
+    migration_downtime_stop(&s->downtime_recorder);
 
     if (qemu_file_get_error(s->to_dst_file)) {
         trace_migration_completion_file_err();
@@ -3249,6 +3588,9 @@ static void bg_migration_completion(MigrationState *s)
 {
     int current_active_state = s->state;
 
+    /* Wait for the pages still being written by other threads */
+    ram_write_tracking_flush();
+
     /*
      * Stop tracking RAM writes - un-protect memory, un-register UFFD
      * memory ranges, flush kernel wait queues and wake up threads
@@ -3373,6 +3715,12 @@ static MigThrError postcopy_pause(MigrationState *s)
         qemu_file_shutdown(file);
         qemu_fclose(file);
 
+        /*
+         * The preempt channel is not re-established on recovery, urgent
+         * pages go through the main channel from now on.
+         */
+        postcopy_preempt_close_channel(s);
+
         migrate_set_state(&s->state, s->state,
                           MIGRATION_STATUS_POSTCOPY_PAUSED);
 
@@ -3555,6 +3903,12 @@ static MigIterateState migration_iteration_run(MigrationState *s)
 {
     uint64_t pending_size, pend_pre, pend_compat, pend_post;
     bool in_postcopy = s->state == MIGRATION_STATUS_POSTCOPY_ACTIVE;
+    /*
+     * Devices on the destination may still be busy with state sent
+     * ahead of the switchover
+     */
+    bool can_switchover = in_postcopy || !migrate_switchover_ack() ||
+                          qatomic_read(&s->switchover_acked);
 
     qemu_savevm_state_pending(s->to_dst_file, s->threshold_size, &pend_pre,
                               &pend_compat, &pend_post);
@@ -3563,9 +3917,10 @@ static MigIterateState migration_iteration_run(MigrationState *s)
     trace_migrate_pending(pending_size, s->threshold_size,
                           pend_pre, pend_compat, pend_post);
 
-    if (pending_size && pending_size >= s->threshold_size) {
+    if ((pending_size && pending_size >= s->threshold_size) ||
+        !can_switchover) {
         /* Still a significant amount to transfer */
-        if (!in_postcopy && pend_pre <= s->threshold_size &&
+        if (!in_postcopy && pend_pre <= s->threshold_size && can_switchover &&
             qatomic_read(&s->start_postcopy)) {
             if (postcopy_start(s)) {
                 error_report("%s: postcopy failed to start", __func__);
@@ -4057,6 +4412,14 @@ void migrate_fd_connect(MigrationState *s, Error *error_in)
 
     qemu_file_set_rate_limit(s->to_dst_file, rate_limit);
     qemu_file_set_blocking(s->to_dst_file, true);
+    /*
+     * Background snapshots write-unprotect pages as soon as they are
+     * queued, so their content must be sent before that happens.
+     */
+    if (!migrate_background_snapshot()) {
+        qemu_file_set_async_writes(s->to_dst_file,
+                                   s->async_write_buffer_size);
+    }
 
     /*
      * Open the return path. For postcopy, it is used exclusively. For
@@ -4115,6 +4478,10 @@ void migration_global_dump(Monitor *mon)
                    ms->decompress_error_check ? "on" : "off");
     monitor_printf(mon, "clear-bitmap-shift: %u\n",
                    ms->clear_bitmap_shift);
+    monitor_printf(mon, "async-write-buffer-size: %" PRIu64 "\n",
+                   ms->async_write_buffer_size);
+    monitor_printf(mon, "device-save-threads: %u\n",
+                   ms->device_save_threads);
 }
 
 #define DEFINE_PROP_MIG_CAP(name, x)             \
@@ -4131,6 +4498,10 @@ static Property migration_properties[] = {
                       decompress_error_check, true),
     DEFINE_PROP_UINT8("x-clear-bitmap-shift", MigrationState,
                       clear_bitmap_shift, CLEAR_BITMAP_SHIFT_DEFAULT),
+    DEFINE_PROP_SIZE("x-async-write-buffer-size", MigrationState,
+                     async_write_buffer_size, 0),
+    DEFINE_PROP_UINT8("x-device-save-threads", MigrationState,
+                      device_save_threads, 0),
 
     /* Migration parameters */
     DEFINE_PROP_UINT8("x-compress-level", MigrationState,
@@ -4210,6 +4581,21 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-multifd-zero-page",
+            MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram-mmap",
+                        MIGRATION_CAPABILITY_MAPPED_RAM_MMAP),
+    DEFINE_PROP_MIG_CAP("x-postcopy-preempt",
+                        MIGRATION_CAPABILITY_POSTCOPY_PREEMPT),
+    DEFINE_PROP_MIG_CAP("x-postcopy-multifd",
+                        MIGRATION_CAPABILITY_POSTCOPY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-switchover-ack",
+                        MIGRATION_CAPABILITY_SWITCHOVER_ACK),
+#ifdef CONFIG_LINUX
+    DEFINE_PROP_MIG_CAP("x-zero-copy-send",
+            MIGRATION_CAPABILITY_ZERO_COPY_SEND),
+#endif
     DEFINE_PROP_MIG_CAP("x-background-snapshot",
             MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
 
@@ -4238,6 +4624,7 @@ static void migration_instance_finalize(Object *obj)
     qemu_sem_destroy(&ms->pause_sem);
     qemu_sem_destroy(&ms->postcopy_pause_sem);
     qemu_sem_destroy(&ms->postcopy_pause_rp_sem);
+    qemu_sem_destroy(&ms->postcopy_qemufile_src_sem);
     qemu_sem_destroy(&ms->rp_state.rp_sem);
     error_free(ms->error);
 }
@@ -4282,6 +4669,7 @@ static void migration_instance_init(Object *obj)
 
     qemu_sem_init(&ms->postcopy_pause_sem, 0);
     qemu_sem_init(&ms->postcopy_pause_rp_sem, 0);
+    qemu_sem_init(&ms->postcopy_qemufile_src_sem, 0);
     qemu_sem_init(&ms->rp_state.rp_sem, 0);
     qemu_sem_init(&ms->rate_limit_sem, 0);
     qemu_sem_init(&ms->wait_unplug_sem, 0);
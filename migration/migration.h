@@ -28,6 +28,23 @@ struct PostcopyBlocktimeContext;
 
 #define  MIGRATION_RESUME_ACK_VALUE  (1)
 
+/* Collects the MigrationDowntimeBreakdown of a migration */
+typedef struct MigrationDowntimeRecorder {
+    /* Set while entries are being added */
+    bool active;
+    MigrationDowntimeBreakdown *breakdown;
+    MigrationDowntimeEntryList **phases_tail;
+    MigrationDowntimeEntryList **sections_tail;
+} MigrationDowntimeRecorder;
+
+void migration_downtime_start(MigrationDowntimeRecorder *rec);
+void migration_downtime_stop(MigrationDowntimeRecorder *rec);
+void migration_downtime_add_phase(MigrationDowntimeRecorder *rec,
+                                  const char *name, int64_t start_us);
+void migration_downtime_add_section(MigrationDowntimeRecorder *rec,
+                                    const char *idstr, uint32_t instance_id,
+                                    int64_t time_us);
+
 /*
  * 1<<6=64 pages -> 256K chunk when page size is 4K.  This gives us
  * the benefit that all the chunks are 64 pages aligned then the
@@ -45,6 +62,15 @@ struct PostcopyBlocktimeContext;
  */
 #define CLEAR_BITMAP_SHIFT_MAX            31
 
+/* Channels that carry RAM pages in postcopy */
+enum {
+    /* The main migration stream */
+    RAM_CHANNEL_PRECOPY = 0,
+    /* Urgent (page fault) requests, with postcopy-preempt */
+    RAM_CHANNEL_POSTCOPY = 1,
+    RAM_CHANNEL_MAX,
+};
+
 /* State for the incoming migration */
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
@@ -110,10 +136,16 @@ struct MigrationIncomingState {
     /* List of listening socket addresses  */
     SocketAddressList *socket_address_list;
 
+    /* Time taken by the final sections and by the switchover */
+    MigrationDowntimeRecorder downtime_recorder;
+
     /* A tree of pages that we requested to the source VM */
     GTree *page_requested;
     /* For debugging purpose only, but would be nice to keep */
     int page_requested_count;
+
+    /* Devices that have not approved the switchover yet */
+    unsigned int switchover_ack_pending_num;
     /*
      * The mutex helps to maintain the requested pages that we sent to the
      * source, IOW, to guarantee coherent between the page_requests tree and
@@ -126,6 +158,27 @@ struct MigrationIncomingState {
      * contains valid information.
      */
     QemuMutex page_request_mutex;
+
+    /* Last RAMBlock received on each channel, for RAM_SAVE_FLAG_CONTINUE */
+    RAMBlock *last_recv_block[RAM_CHANNEL_MAX];
+
+    /*
+     * The postcopy-preempt channel.  The source connects it as postcopy
+     * starts; postcopy_qemufile_dst_sem is posted once it is set (or once
+     * the preempt thread has to give up waiting for it).
+     */
+    QEMUFile *postcopy_qemufile_dst;
+    QemuSemaphore postcopy_qemufile_dst_sem;
+    bool have_preempt_thread;
+    QemuThread preempt_thread;
+    /* Temporary host page for the pages arriving on the preempt channel */
+    void *postcopy_preempt_tmp_page;
+
+    /*
+     * Set once userfaultfd is registered on the guest RAM, the multifd
+     * receive threads must not place postcopy pages before that.
+     */
+    QemuEvent postcopy_listen_event;
 };
 
 MigrationIncomingState *migration_incoming_get_current(void);
@@ -215,6 +268,7 @@ struct MigrationState {
     /* Timestamp when VM is down (ms) to migrate the last stuff */
     int64_t downtime_start;
     int64_t downtime;
+    MigrationDowntimeRecorder downtime_recorder;
     int64_t expected_downtime;
     bool enabled_capabilities[MIGRATION_CAPABILITY__MAX];
     int64_t setup_time;
@@ -229,6 +283,8 @@ struct MigrationState {
     bool start_postcopy;
     /* Flag set after postcopy has sent the device state */
     bool postcopy_after_devices;
+    /* Flag set once the destination has acknowledged the switchover */
+    bool switchover_acked;
 
     /* Flag set once the migration thread is running (and needs joining) */
     bool migration_thread_running;
@@ -274,6 +330,14 @@ struct MigrationState {
     /* Needed by postcopy-pause state */
     QemuSemaphore postcopy_pause_sem;
     QemuSemaphore postcopy_pause_rp_sem;
+
+    /*
+     * The postcopy-preempt channel, protected by qemu_file_lock; only the
+     * migration thread writes to it.  postcopy_qemufile_src_sem is posted
+     * when the connection attempt finishes.
+     */
+    QEMUFile *postcopy_qemufile_src;
+    QemuSemaphore postcopy_qemufile_src_sem;
     /*
      * Whether we abort the migration if decompression errors are
      * detected at the destination. It is left at false for qemu
@@ -292,6 +356,20 @@ struct MigrationState {
      */
     uint8_t clear_bitmap_shift;
 
+    /*
+     * When non-zero, the outgoing QEMUFile buffers this many bytes and
+     * writes them out from a separate thread, while the migration
+     * thread fills a second buffer of the same size.
+     */
+    uint64_t async_write_buffer_size;
+
+    /*
+     * Number of threads that save the state of devices that allow it
+     * during stop-and-copy, 0 to save all of them in the migration
+     * thread.
+     */
+    uint8_t device_save_threads;
+
     /*
      * This save hostname when out-going migration starts
      */
@@ -326,6 +404,8 @@ bool migrate_postcopy(void);
 
 bool migrate_release_ram(void);
 bool migrate_postcopy_ram(void);
+bool migrate_postcopy_preempt(void);
+bool migrate_postcopy_multifd(void);
 bool migrate_zero_blocks(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_ignore_shared(void);
@@ -333,6 +413,10 @@ bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
+bool migrate_multifd_zero_page(void);
+bool migrate_use_zero_copy_send(void);
+bool migrate_mapped_ram(void);
+bool migrate_mapped_ram_mmap(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
@@ -355,9 +439,11 @@ int migrate_compress_level(void);
 int migrate_compress_threads(void);
 int migrate_compress_wait_thread(void);
 int migrate_decompress_threads(void);
+int migrate_device_save_threads(void);
 bool migrate_use_events(void);
 bool migrate_postcopy_blocktime(void);
 bool migrate_background_snapshot(void);
+bool migrate_switchover_ack(void);
 
 /* Sending on the return path - generic and then for each message type */
 void migrate_send_rp_shut(MigrationIncomingState *mis,
@@ -371,6 +457,7 @@ int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
+void migrate_send_rp_switchover_ack(MigrationIncomingState *mis);
 
 void dirty_bitmap_mig_before_vm_start(void);
 void dirty_bitmap_mig_cancel_outgoing(void);
@@ -0,0 +1,271 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/bswap.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Each page is compressed on its own, so pages can be decompressed
+ * straight into guest memory.  A packet is laid out as an array of the
+ * big endian compressed sizes of its pages, followed by the compressed
+ * pages themselves.
+ */
+
+struct lz4_data {
+    /* copy of the page being compressed, guest may change the original */
+    uint8_t *page;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+/* Room needed by a packet with all of its pages */
+static uint32_t lz4_packet_max_len(void)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+
+    return page_count * (sizeof(uint32_t) +
+                         LZ4_compressBound(qemu_target_page_size()));
+}
+
+/* Multifd lz4 compression */
+
+/**
+ * lz4_send_setup: setup send side
+ *
+ * Setup each channel with lz4 compression.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->zbuff_len = lz4_packet_max_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    z->page = g_try_malloc(qemu_target_page_size());
+    if (!z->zbuff || !z->page) {
+        g_free(z->zbuff);
+        g_free(z->page);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_send_cleanup: cleanup send side
+ *
+ * Return the memory of the channel.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->data;
+
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(z->page);
+    z->page = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_send_prepare: prepare date to be able to send
+ *
+ * Create a compressed buffer with all the pages that we are going to
+ * send.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ */
+static int lz4_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    struct lz4_data *z = p->data;
+    size_t page_size = qemu_target_page_size();
+    uint32_t *sizes = (uint32_t *)z->zbuff;
+    uint32_t pos = used * sizeof(uint32_t);
+    uint32_t i;
+    int ret;
+
+    for (i = 0; i < used; i++) {
+        memcpy(z->page, iov[i].iov_base, page_size);
+        ret = LZ4_compress_default((const char *)z->page,
+                                   (char *)z->zbuff + pos, page_size,
+                                   z->zbuff_len - pos);
+        if (ret <= 0) {
+            error_setg(errp, "multifd %d: LZ4_compress_default failed",
+                       p->id);
+            return -1;
+        }
+        sizes[i] = cpu_to_be32(ret);
+        pos += ret;
+    }
+    p->next_packet_size = pos;
+    p->flags |= MULTIFD_FLAG_LZ4;
+
+    return 0;
+}
+
+/**
+ * lz4_send_write: do the actual write of the data
+ *
+ * Do the actual write of the comprresed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int lz4_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct lz4_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+/**
+ * lz4_recv_setup: setup receive side
+ *
+ * Create the compressed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->zbuff_len = lz4_packet_max_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_recv_cleanup: setup receive side
+ *
+ * Return the memory of the channel.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct lz4_data *z = p->data;
+
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, and uncompress it into the actual
+ * pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int lz4_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    size_t page_size = qemu_target_page_size();
+    struct lz4_data *z = p->data;
+    uint32_t pos = used * sizeof(uint32_t);
+    uint32_t *sizes = (uint32_t *)z->zbuff;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+    if (in_size > z->zbuff_len || in_size < pos) {
+        error_setg(errp, "multifd %d: packet size received %u is invalid",
+                   p->id, in_size);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        uint32_t size = be32_to_cpu(sizes[i]);
+
+        if (size > in_size - pos) {
+            error_setg(errp, "multifd %d: compressed page %u overflows the "
+                       "packet", p->id, i);
+            return -1;
+        }
+        ret = LZ4_decompress_safe((const char *)z->zbuff + pos,
+                                  iov->iov_base, size, iov->iov_len);
+        if (ret != page_size) {
+            error_setg(errp, "multifd %d: LZ4_decompress_safe returned %d "
+                       "size expected %zu", p->id, ret, page_size);
+            return -1;
+        }
+        pos += size;
+    }
+    if (pos != in_size) {
+        error_setg(errp, "multifd %d: packet size received %u size used %u",
+                   p->id, in_size, pos);
+        return -1;
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_lz4_ops = {
+    .send_setup = lz4_send_setup,
+    .send_cleanup = lz4_send_cleanup,
+    .send_prepare = lz4_send_prepare,
+    .send_write = lz4_send_write,
+    .recv_setup = lz4_recv_setup,
+    .recv_cleanup = lz4_recv_cleanup,
+    .recv_pages = lz4_recv_pages
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
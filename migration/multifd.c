@@ -12,6 +12,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/rcu.h"
+#include "qemu/cutils.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -20,10 +21,13 @@
 #include "ram.h"
 #include "migration.h"
 #include "socket.h"
+#include "file.h"
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
 #include "multifd.h"
+#include "postcopy-ram.h"
+#include "migration/colo.h"
 
 #include "qemu/yank.h"
 #include "io/channel-socket.h"
@@ -95,7 +99,9 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
 /**
  * nocomp_send_write: do the actual write of the data
  *
- * For no compression we just have to write the data.
+ * For no compression we just have to write the data.  With zero-copy-send
+ * the pages are not copied by the channel; multifd_send_thread() flushes
+ * the channel at each sync point.
  *
  * Returns 0 for success or -1 for error
  *
@@ -105,7 +111,8 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
  */
 static int nocomp_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
-    return qio_channel_writev_all(p->c, p->pages->iov, used, errp);
+    return qio_channel_writev_full_all(p->c, p->pages->iov, used, NULL, 0,
+                                       p->write_flags, errp);
 }
 
 /**
@@ -273,6 +280,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->pages_used = cpu_to_be32(p->pages->used);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
+    packet->zero_pages = cpu_to_be32(p->zero_num);
 
     if (p->pages->block) {
         strncpy(packet->ramblock, p->pages->block->idstr, 256);
@@ -284,6 +292,12 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
         packet->offset[i] = cpu_to_be64(temp);
     }
+
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t temp = p->zero[i];
+
+        packet->offset[p->pages->used + i] = cpu_to_be64(temp);
+    }
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -329,6 +343,14 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     if (packet->pages_alloc > p->pages->allocated) {
         multifd_pages_clear(p->pages);
         p->pages = multifd_pages_init(packet->pages_alloc);
+        g_free(p->zero);
+        p->zero = g_new0(ram_addr_t, packet->pages_alloc);
+        if (p->postcopy_buf) {
+            qemu_vfree(p->postcopy_buf);
+            p->postcopy_buf = qemu_memalign(qemu_target_page_size(),
+                                            packet->pages_alloc *
+                                            qemu_target_page_size());
+        }
     }
 
     p->pages->used = be32_to_cpu(packet->pages_used);
@@ -339,10 +361,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->zero_num > packet->pages_alloc - p->pages->used) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d zero pages and expected maximum zero pages are %d",
+                   p->zero_num, packet->pages_alloc - p->pages->used);
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->pages->used == 0) {
+    if (p->pages->used == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -355,6 +385,36 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    if (p->flags & MULTIFD_FLAG_POSTCOPY) {
+        if (!p->postcopy_buf) {
+            error_setg(errp, "multifd: received a postcopy packet without "
+                       "postcopy-multifd");
+            return -1;
+        }
+        /* Only a whole host page can be placed */
+        if (qemu_ram_pagesize(block) != qemu_target_page_size()) {
+            error_setg(errp, "multifd: postcopy packet for ram block %s "
+                       "with huge pages", block->idstr);
+            return -1;
+        }
+    }
+
+    /*
+     * In COLO state the pages are not loaded into the secondary's memory
+     * directly, they go to the COLO cache until the checkpoint is done.
+     */
+    p->host = block->host;
+    if (migration_incoming_colo_enabled()) {
+        if (!block->colo_cache) {
+            error_setg(errp, "multifd: colo_cache is NULL in block %s",
+                       block->idstr);
+            return -1;
+        }
+        if (migration_incoming_in_colo_state()) {
+            p->host = block->colo_cache;
+        }
+    }
+
     for (i = 0; i < p->pages->used; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
@@ -364,10 +424,157 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                        offset, block->used_length);
             return -1;
         }
-        p->pages->iov[i].iov_base = block->host + offset;
+        p->pages->offset[i] = offset;
+        if (p->flags & MULTIFD_FLAG_POSTCOPY) {
+            p->pages->iov[i].iov_base = p->postcopy_buf +
+                                        i * qemu_target_page_size();
+        } else {
+            p->pages->iov[i].iov_base = p->host + offset;
+        }
         p->pages->iov[i].iov_len = qemu_target_page_size();
     }
 
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->pages->used + i]);
+
+        if (offset > (block->used_length - qemu_target_page_size())) {
+            error_setg(errp, "multifd: zero page offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, block->used_length);
+            return -1;
+        }
+        p->zero[i] = offset;
+    }
+    p->block = block;
+
+    return 0;
+}
+
+/**
+ * multifd_send_zero_page_detect: split out the zero pages of a packet
+ *
+ * Moves the offsets of the pages that are all zeros from @p->pages
+ * to @p->zero, so that only the pages with data are handed to the
+ * compression methods and written to the channel.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    uint32_t used = 0;
+    uint32_t i;
+
+    for (i = 0; i < pages->used; i++) {
+        if (buffer_is_zero(pages->iov[i].iov_base, page_size)) {
+            p->zero[p->zero_num++] = pages->offset[i];
+        } else {
+            pages->offset[used] = pages->offset[i];
+            pages->iov[used] = pages->iov[i];
+            used++;
+        }
+    }
+    pages->used = used;
+}
+
+/**
+ * multifd_recv_zero_page_process: handle the zero pages of a packet
+ *
+ * Pages that are already zero on the destination are not written, so
+ * they are not needlessly dirtied.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_recv_zero_page_process(MultiFDRecvParams *p)
+{
+    size_t page_size = qemu_target_page_size();
+    uint32_t i;
+
+    for (i = 0; i < p->zero_num; i++) {
+        ram_handle_compressed(p->host + p->zero[i], 0, page_size);
+    }
+}
+
+/**
+ * multifd_recv_colo_process: keep the COLO cache of the secondary up to date
+ *
+ * Before COLO state the pages went to the secondary's memory and are
+ * backed up in the COLO cache, as ram_load() does for the main channel.
+ * In COLO state they went to the cache, and are recorded in the bitmap
+ * of pages that colo_flush_ram_cache() copies to memory.
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ */
+static void multifd_recv_colo_process(MultiFDRecvParams *p, uint32_t used)
+{
+    RAMBlock *block = p->block;
+    size_t page_size = qemu_target_page_size();
+    uint32_t i;
+
+    if (p->host == block->colo_cache) {
+        colo_record_bitmap(block, p->pages->offset, used);
+        colo_record_bitmap(block, p->zero, p->zero_num);
+        return;
+    }
+
+    for (i = 0; i < used; i++) {
+        memcpy(block->colo_cache + p->pages->offset[i],
+               block->host + p->pages->offset[i], page_size);
+    }
+    for (i = 0; i < p->zero_num; i++) {
+        ram_handle_compressed(block->colo_cache + p->zero[i], 0, page_size);
+    }
+}
+
+/**
+ * multifd_recv_postcopy_place: place the pages of a postcopy packet
+ *
+ * The pages were received into @p->postcopy_buf, they are copied into
+ * guest memory with userfaultfd, which also wakes up the vCPUs that
+ * faulted on them.  Zero pages have to be placed as well.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int multifd_recv_postcopy_place(MultiFDRecvParams *p, uint32_t used,
+                                       Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    RAMBlock *block = p->block;
+    uint32_t i;
+    int ret;
+
+    /* The packet can overtake the listen command on the main channel */
+    qemu_event_wait(&mis->postcopy_listen_event);
+    if (p->quit) {
+        return 0;
+    }
+
+    for (i = 0; i < used; i++) {
+        ret = postcopy_place_page(mis, block->host + p->pages->offset[i],
+                                  p->pages->iov[i].iov_base, block);
+        if (ret) {
+            error_setg_errno(errp, -ret, "multifd %d: failed to place page",
+                             p->id);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < p->zero_num; i++) {
+        ret = postcopy_place_page_zero(mis, block->host + p->zero[i], block);
+        if (ret) {
+            error_setg_errno(errp, -ret,
+                             "multifd %d: failed to place zero page", p->id);
+            return -1;
+        }
+    }
+    trace_multifd_recv_postcopy_place(p->id, used, p->zero_num);
+
     return 0;
 }
 
@@ -446,6 +653,9 @@ static int multifd_send_pages(QEMUFile *f)
     assert(!p->pages->block);
 
     p->packet_num = multifd_send_state->packet_num++;
+    if (migration_in_postcopy()) {
+        p->flags |= MULTIFD_FLAG_POSTCOPY;
+    }
     multifd_send_state->pages = p->pages;
     p->pages = pages;
     transferred = ((uint64_t) pages->used) * qemu_target_page_size()
@@ -557,6 +767,8 @@ void multifd_save_cleanup(void)
         p->tls_hostname = NULL;
         multifd_pages_clear(p->pages);
         p->pages = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
@@ -575,6 +787,110 @@ void multifd_save_cleanup(void)
     multifd_send_state = NULL;
 }
 
+/**
+ * multifd_file_write_pages: write the pages of a job to a mapped-ram file
+ *
+ * Each run of contiguous pages is written with a single pwritev at its
+ * fixed offset in the @block region of the file, and the pages are
+ * recorded in the file bitmap that is saved at the end of migration.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @block: RAMBlock the pages belong to
+ * @used: number of pages with data
+ * @errp: pointer to an error
+ */
+static int multifd_file_write_pages(MultiFDSendParams *p, RAMBlock *block,
+                                    uint32_t used, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    int page_bits = qemu_target_page_bits();
+    uint32_t start, i;
+
+    int res = 0;
+
+    for (start = 0; start < used; start = i) {
+        ram_addr_t offset = pages->offset[start];
+        size_t len = page_size;
+        ssize_t ret;
+
+        for (i = start + 1; i < used; i++) {
+            if (pages->offset[i] != offset + len) {
+                break;
+            }
+            len += page_size;
+        }
+
+        ret = qio_channel_pwritev(p->c, &pages->iov[start], i - start,
+                                  block->pages_offset + offset, errp);
+        if (ret < 0) {
+            res = -1;
+            break;
+        }
+        if (ret != len) {
+            error_setg(errp, "multifd %d: short write to migration file",
+                       p->id);
+            res = -1;
+            break;
+        }
+    }
+
+    if (!res) {
+        for (i = 0; i < used; i++) {
+            set_bit_atomic(pages->offset[i] >> page_bits, block->file_bmap);
+        }
+        for (i = 0; i < p->zero_num; i++) {
+            clear_bit_atomic(p->zero[i] >> page_bits, block->file_bmap);
+        }
+    }
+
+    /*
+     * A background snapshot can let the guest write to the pages now.
+     * Do it even if the write failed, so that vCPUs are not blocked.
+     */
+    if (migrate_background_snapshot()) {
+        for (i = 0; i < used; i++) {
+            ram_write_tracking_page_done(block, pages->offset[i], 1);
+        }
+        for (i = 0; i < p->zero_num; i++) {
+            ram_write_tracking_page_done(block, p->zero[i], 1);
+        }
+    }
+
+    return res;
+}
+
+/*
+ * Pages are accounted as normal pages when they are queued.  The zero
+ * pages found by the channels are moved over to the duplicate counter
+ * here, in the migration thread, which owns ram_counters.
+ */
+static void multifd_send_account_zero_pages(QEMUFile *f)
+{
+    uint64_t zero_pages = 0;
+    int i;
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        WITH_QEMU_LOCK_GUARD(&p->mutex) {
+            zero_pages += p->num_zero_pages - p->num_zero_pages_acct;
+            p->num_zero_pages_acct = p->num_zero_pages;
+        }
+    }
+
+    if (zero_pages) {
+        uint64_t bytes = zero_pages * qemu_target_page_size();
+
+        ram_counters.normal -= zero_pages;
+        ram_counters.duplicate += zero_pages;
+        ram_counters.multifd_bytes -= bytes;
+        ram_counters.transferred -= bytes;
+    }
+}
+
 void multifd_send_sync_main(QEMUFile *f)
 {
     int i;
@@ -616,6 +932,7 @@ void multifd_send_sync_main(QEMUFile *f)
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
     }
+    multifd_send_account_zero_pages(f);
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
@@ -629,12 +946,23 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
+    if ((p->write_flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) &&
+        !qio_channel_has_feature(p->c, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        error_setg(&local_err, "multifd %d: zero copy send is not supported "
+                   "by the channel", p->id);
         ret = -1;
         goto out;
     }
-    /* initial packet */
-    p->num_packets = 1;
+
+    /* Channels writing to a mapped-ram file carry no packets */
+    if (!migrate_mapped_ram()) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
+    }
 
     while (true) {
         qemu_sem_wait(&p->sem);
@@ -645,10 +973,17 @@ static void *multifd_send_thread(void *opaque)
         qemu_mutex_lock(&p->mutex);
 
         if (p->pending_job) {
-            uint32_t used = p->pages->used;
+            RAMBlock *block = p->pages->block;
+            uint32_t used;
             uint64_t packet_num = p->packet_num;
             flags = p->flags;
 
+            p->zero_num = 0;
+            if (p->pages->used && migrate_multifd_zero_page()) {
+                multifd_send_zero_page_detect(p);
+            }
+            used = p->pages->used;
+
             if (used) {
                 ret = multifd_send_state->ops->send_prepare(p, used,
                                                             &local_err);
@@ -661,24 +996,56 @@ static void *multifd_send_thread(void *opaque)
             p->flags = 0;
             p->num_packets++;
             p->num_pages += used;
+            p->num_zero_pages += p->zero_num;
             p->pages->used = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, used, flags,
+            trace_multifd_send(p->id, packet_num, used, p->zero_num, flags,
                                p->next_packet_size);
 
-            ret = qio_channel_write_all(p->c, (void *)p->packet,
-                                        p->packet_len, &local_err);
-            if (ret != 0) {
-                break;
+            if (migrate_mapped_ram()) {
+                ret = multifd_file_write_pages(p, block, used, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            } else {
+                /*
+                 * The packet header is queued, and sent together with the
+                 * pages unless they are written with zero copy.
+                 */
+                qio_channel_queue_writes(p->c);
+                ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                            p->packet_len, &local_err);
+                if (ret == 0 && used) {
+                    ret = multifd_send_state->ops->send_write(p, used,
+                                                              &local_err);
+                }
+                if (ret == 0) {
+                    ret = qio_channel_flush_queued_writes(p->c, &local_err);
+                } else {
+                    qio_channel_flush_queued_writes(p->c, NULL);
+                }
+                if (ret != 0) {
+                    break;
+                }
             }
 
-            if (used) {
-                ret = multifd_send_state->ops->send_write(p, used, &local_err);
-                if (ret != 0) {
+            /*
+             * Zero copy writes must be completed before the sync is
+             * acknowledged, otherwise pages could still be in flight
+             * when the migration thread relies on them having been sent.
+             */
+            if ((flags & MULTIFD_FLAG_SYNC) &&
+                (p->write_flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY)) {
+                ret = qio_channel_flush(p->c, &local_err);
+                if (ret < 0) {
                     break;
                 }
+                if (ret == 1) {
+                    trace_multifd_send_zero_copy_fallback(p->id);
+                }
+                ret = 0;
             }
 
             qemu_mutex_lock(&p->mutex);
@@ -853,6 +1220,11 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
     } else {
         p->c = QIO_CHANNEL(sioc);
         qio_channel_set_delay(p->c, false);
+        /* The send thread fails if the socket cannot do zero copy */
+        if ((p->write_flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) &&
+            object_dynamic_cast(OBJECT(sioc), TYPE_QIO_CHANNEL_SOCKET)) {
+            qio_channel_socket_set_zero_copy_send(QIO_CHANNEL_SOCKET(sioc));
+        }
         p->running = true;
         if (!multifd_channel_connect(p, sioc, local_err)) {
             goto cleanup;
@@ -875,6 +1247,29 @@ int multifd_save_setup(Error **errp)
         return 0;
     }
     s = migrate_get_current();
+    if (migrate_use_zero_copy_send()) {
+        if (migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+            error_setg(errp, "Zero copy send is not compatible with "
+                       "multifd compression");
+            return -1;
+        }
+        if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+            error_setg(errp, "Zero copy send is not compatible with TLS");
+            return -1;
+        }
+    }
+    if (migrate_mapped_ram()) {
+        if (migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+            error_setg(errp, "Mapped-ram migration is not compatible with "
+                       "multifd compression");
+            return -1;
+        }
+        if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+            error_setg(errp, "Mapped-ram migration is not compatible with "
+                       "TLS");
+            return -1;
+        }
+    }
     thread_count = migrate_multifd_channels();
     multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
     multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
@@ -893,6 +1288,7 @@ int multifd_save_setup(Error **errp)
         p->pending_job = 0;
         p->id = i;
         p->pages = multifd_pages_init(page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->packet_len = sizeof(MultiFDPacket_t)
                       + sizeof(uint64_t) * page_count;
         p->packet = g_malloc0(p->packet_len);
@@ -900,7 +1296,13 @@ int multifd_save_setup(Error **errp)
         p->packet->version = cpu_to_be32(MULTIFD_VERSION);
         p->name = g_strdup_printf("multifdsend_%d", i);
         p->tls_hostname = g_strdup(s->hostname);
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        p->write_flags = migrate_use_zero_copy_send() ?
+                         QIO_CHANNEL_WRITE_FLAG_ZERO_COPY : 0;
+        if (migrate_mapped_ram()) {
+            file_send_channel_create(multifd_new_send_channel_async, p);
+        } else {
+            socket_send_channel_create(multifd_new_send_channel_async, p);
+        }
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -961,14 +1363,20 @@ static void multifd_recv_terminate_threads(Error *err)
         }
         qemu_mutex_unlock(&p->mutex);
     }
+    /* Wake up the channels waiting to place postcopy pages */
+    qemu_event_set(&migration_incoming_get_current()->postcopy_listen_event);
 }
 
-int multifd_load_cleanup(Error **errp)
+/*
+ * Stop the receiving threads, so that they do not touch the memory they
+ * write to anymore; the channels are freed by multifd_load_cleanup().
+ */
+void multifd_load_shutdown(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
-        return 0;
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
+        return;
     }
     multifd_recv_terminate_threads(NULL);
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -984,6 +1392,16 @@ int multifd_load_cleanup(Error **errp)
             qemu_thread_join(&p->thread);
         }
     }
+}
+
+int multifd_load_cleanup(Error **errp)
+{
+    int i;
+
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
+        return 0;
+    }
+    multifd_load_shutdown();
     for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
@@ -999,6 +1417,10 @@ int multifd_load_cleanup(Error **errp)
         p->name = NULL;
         multifd_pages_clear(p->pages);
         p->pages = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
+        qemu_vfree(p->postcopy_buf);
+        p->postcopy_buf = NULL;
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
@@ -1017,7 +1439,7 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1051,6 +1473,7 @@ static void *multifd_recv_thread(void *opaque)
 
     while (true) {
         uint32_t used;
+        uint32_t zero_num;
         uint32_t flags;
 
         if (p->quit) {
@@ -1074,10 +1497,11 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         used = p->pages->used;
+        zero_num = p->zero_num;
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, used, flags,
+        trace_multifd_recv(p->id, p->packet_num, used, zero_num, flags,
                            p->next_packet_size);
         p->num_packets++;
         p->num_pages += used;
@@ -1090,6 +1514,20 @@ static void *multifd_recv_thread(void *opaque)
             }
         }
 
+        if (flags & MULTIFD_FLAG_POSTCOPY) {
+            ret = multifd_recv_postcopy_place(p, used, &local_err);
+            if (ret != 0) {
+                break;
+            }
+        } else {
+            if (zero_num) {
+                multifd_recv_zero_page_process(p);
+            }
+            if ((used || zero_num) && migration_incoming_colo_enabled()) {
+                multifd_recv_colo_process(p, used);
+            }
+        }
+
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
@@ -1116,7 +1554,8 @@ int multifd_load_setup(Error **errp)
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    /* With mapped-ram the pages are read from the file by ram_load() */
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
@@ -1134,6 +1573,12 @@ int multifd_load_setup(Error **errp)
         p->quit = false;
         p->id = i;
         p->pages = multifd_pages_init(page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
+        if (migrate_postcopy_multifd()) {
+            p->postcopy_buf = qemu_memalign(qemu_target_page_size(),
+                                            page_count *
+                                            qemu_target_page_size());
+        }
         p->packet_len = sizeof(MultiFDPacket_t)
                       + sizeof(uint64_t) * page_count;
         p->packet = g_malloc0(p->packet_len);
@@ -1158,7 +1603,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return true;
     }
 
@@ -17,6 +17,7 @@ int multifd_save_setup(Error **errp);
 void multifd_save_cleanup(void);
 int multifd_load_setup(Error **errp);
 int multifd_load_cleanup(Error **errp);
+void multifd_load_shutdown(void);
 bool multifd_recv_all_channels_created(void);
 bool multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
@@ -32,6 +33,10 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_LZ4 (3 << 1)
+
+/* The pages of the packet have to be placed with postcopy-multifd */
+#define MULTIFD_FLAG_POSTCOPY (1 << 4)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -46,8 +51,15 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /* number of zero pages, only used with multifd-zero-page */
+    uint32_t zero_pages;
+    uint32_t unused32[1];  /* Reserved for future use */
+    uint64_t unused64[3];  /* Reserved for future use */
     char ramblock[256];
+    /*
+     * Offsets of the pages_used normal pages, followed by the offsets
+     * of the zero_pages zero pages.
+     */
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
 
@@ -99,11 +111,21 @@ typedef struct {
     uint32_t next_packet_size;
     /* global number of generated multifd packets */
     uint64_t packet_num;
+    /* QIO_CHANNEL_WRITE_FLAG_* used to write the pages */
+    int write_flags;
     /* thread local variables */
     /* packets sent through this channel */
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages detected by this channel */
+    uint64_t num_zero_pages;
+    /* zero pages already accounted in ram_counters */
+    uint64_t num_zero_pages_acct;
+    /* number of zero pages in the current packet */
+    uint32_t zero_num;
+    /* offsets of the zero pages in the current packet */
+    ram_addr_t *zero;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for compression methods */
@@ -143,6 +165,16 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* number of zero pages in the current packet */
+    uint32_t zero_num;
+    /* offsets of the zero pages in the current packet */
+    ram_addr_t *zero;
+    /* ramblock of the current packet */
+    RAMBlock *block;
+    /* where the pages of the current packet go, the COLO cache or RAM */
+    uint8_t *host;
+    /* postcopy pages are received here, then placed atomically */
+    uint8_t *postcopy_buf;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for de-compression methods */
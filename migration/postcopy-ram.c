@@ -18,10 +18,14 @@
 
 #include "qemu/osdep.h"
 #include "qemu/rcu.h"
+#include "qemu/units.h"
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
+#include "qemu-file-channel.h"
 #include "savevm.h"
+#include "socket.h"
+#include "yank_functions.h"
 #include "postcopy-ram.h"
 #include "ram.h"
 #include "qapi/error.h"
@@ -511,6 +515,86 @@ static int cleanup_range(RAMBlock *rb, void *opaque)
     return 0;
 }
 
+/*
+ * Collapse in steps so that the RCU read lock is not held for too long.
+ */
+#define POSTCOPY_COLLAPSE_STEP (64 * MiB)
+
+/*
+ * Postcopy places anonymous memory with 4k UFFDIO_COPY while THP is off for
+ * the range, so afterwards the guest runs on small pages until khugepaged
+ * gets round to them, which can take a very long time for a big guest.
+ * Collapse the memory back into huge pages from a background thread.
+ * opaque is a list of the idstrs of the RAMBlocks to collapse.
+ */
+static void *postcopy_collapse_thread(void *opaque)
+{
+    GSList *names = opaque;
+    bool supported = true;
+    GSList *l;
+
+    rcu_register_thread();
+    for (l = names; l && supported; l = l->next) {
+        ram_addr_t offset = 0;
+
+        for (;;) {
+            RAMBlock *rb;
+            ram_addr_t len;
+            int ret, err;
+
+            RCU_READ_LOCK_GUARD();
+            rb = qemu_ram_block_by_name(l->data);
+            if (!rb || offset >= rb->postcopy_length) {
+                break;
+            }
+            len = MIN(POSTCOPY_COLLAPSE_STEP, rb->postcopy_length - offset);
+            ret = qemu_madvise(qemu_ram_get_host_addr(rb) + offset, len,
+                               QEMU_MADV_COLLAPSE);
+            err = ret ? errno : 0;
+            trace_postcopy_collapse_range(l->data, offset, len, err);
+            if (err == EINVAL) {
+                /* No kernel support, leave it all to khugepaged */
+                supported = false;
+                break;
+            }
+            /* Other errors only mean that some of the range stays small */
+            offset += len;
+        }
+    }
+    g_slist_free_full(names, g_free);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static int collapse_range_add(RAMBlock *rb, void *opaque)
+{
+    GSList **names = opaque;
+
+    /* hugetlbfs was placed with whole huge pages already */
+    if (qemu_ram_pagesize(rb) == qemu_real_host_page_size) {
+        *names = g_slist_append(*names, g_strdup(qemu_ram_get_idstr(rb)));
+    }
+    return 0;
+}
+
+static void postcopy_collapse_start(void)
+{
+    GSList *names = NULL;
+    QemuThread thread;
+
+    if (QEMU_MADV_COLLAPSE == QEMU_MADV_INVALID) {
+        return;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        foreach_not_ignored_block(collapse_range_add, &names);
+    }
+    if (names) {
+        qemu_thread_create(&thread, "postcopy/thp", postcopy_collapse_thread,
+                           names, QEMU_THREAD_DETACHED);
+    }
+}
+
 /*
  * Initialise postcopy-ram, setting the RAM to a state where we can go into
  * postcopy later; must be called prior to any precopy.
@@ -532,6 +616,21 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 {
     trace_postcopy_ram_incoming_cleanup_entry();
 
+    if (mis->have_preempt_thread) {
+        /*
+         * On success the source ends the preempt stream once every page
+         * is out, so wait for the thread to load those; otherwise make it
+         * give up.
+         */
+        if (!mis->postcopy_qemufile_dst) {
+            qemu_sem_post(&mis->postcopy_qemufile_dst_sem);
+        } else if (mis->state == MIGRATION_STATUS_FAILED) {
+            qemu_file_shutdown(mis->postcopy_qemufile_dst);
+        }
+        qemu_thread_join(&mis->preempt_thread);
+        mis->have_preempt_thread = false;
+    }
+
     if (mis->have_fault_thread) {
         Error *local_err = NULL;
 
@@ -549,6 +648,9 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
         if (foreach_not_ignored_block(cleanup_range, mis)) {
             return -1;
         }
+        if (mis->state != MIGRATION_STATUS_FAILED) {
+            postcopy_collapse_start();
+        }
 
         trace_postcopy_ram_incoming_cleanup_closeuf();
         close(mis->userfault_fd);
@@ -574,6 +676,10 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
         munmap(mis->postcopy_tmp_zero_page, mis->largest_page_size);
         mis->postcopy_tmp_zero_page = NULL;
     }
+    if (mis->postcopy_preempt_tmp_page) {
+        munmap(mis->postcopy_preempt_tmp_page, mis->largest_page_size);
+        mis->postcopy_preempt_tmp_page = NULL;
+    }
     trace_postcopy_ram_incoming_cleanup_blocktime(
             get_postcopy_total_blocktime());
 
@@ -1062,6 +1168,40 @@ retry:
     return NULL;
 }
 
+/*
+ * Load the requested pages that arrive on the postcopy preempt channel,
+ * in parallel with the main stream.
+ */
+static void *postcopy_preempt_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    int ret;
+
+    rcu_register_thread();
+
+    /* The source connects the channel as postcopy starts */
+    qemu_sem_wait(&mis->postcopy_qemufile_dst_sem);
+    if (mis->postcopy_qemufile_dst) {
+        RCU_READ_LOCK_GUARD();
+
+        trace_postcopy_preempt_thread_entry();
+        ret = ram_load_postcopy(mis->postcopy_qemufile_dst,
+                                RAM_CHANNEL_POSTCOPY);
+        /*
+         * On errors, the pages that were lost are sent again by the
+         * source if postcopy gets recovered, through the main channel.
+         */
+        if (ret) {
+            error_report("%s: loading from the preempt channel failed: %d",
+                         __func__, ret);
+        }
+        trace_postcopy_preempt_thread_exit(ret);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
 int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
 {
     /* Open the fd for the kernel to give us userfaults */
@@ -1128,6 +1268,25 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
     }
     memset(mis->postcopy_tmp_zero_page, '\0', mis->largest_page_size);
 
+    if (migrate_postcopy_preempt()) {
+        mis->postcopy_preempt_tmp_page = mmap(NULL, mis->largest_page_size,
+                                              PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS,
+                                              -1, 0);
+        if (mis->postcopy_preempt_tmp_page == MAP_FAILED) {
+            int e = errno;
+            mis->postcopy_preempt_tmp_page = NULL;
+            error_report("%s: Failed to map postcopy_preempt_tmp_page %s",
+                         __func__, strerror(e));
+            return -e;
+        }
+
+        qemu_thread_create(&mis->preempt_thread, "postcopy/preempt",
+                           postcopy_preempt_thread, mis,
+                           QEMU_THREAD_JOINABLE);
+        mis->have_preempt_thread = true;
+    }
+
     trace_postcopy_ram_enable_notify();
 
     return 0;
@@ -1398,6 +1557,77 @@ void postcopy_discard_send_finish(MigrationState *ms)
                                        pds.nsentcmds);
 }
 
+static void postcopy_preempt_send_channel_new(QIOTask *task, gpointer opaque)
+{
+    MigrationState *s = opaque;
+    QIOChannel *ioc = QIO_CHANNEL(qio_task_get_source(task));
+    Error *local_err = NULL;
+
+    if (qio_task_propagate_error(task, &local_err)) {
+        trace_postcopy_preempt_new_channel_error(error_get_pretty(local_err));
+        migrate_set_error(s, local_err);
+        error_free(local_err);
+    } else {
+        QEMUFile *f;
+
+        qio_channel_set_name(ioc, "migration-postcopy-preempt");
+        migration_ioc_register_yank(ioc);
+        f = qemu_fopen_channel_output(ioc);
+        WITH_QEMU_LOCK_GUARD(&s->qemu_file_lock) {
+            s->postcopy_qemufile_src = f;
+        }
+        trace_postcopy_preempt_new_channel();
+    }
+    object_unref(OBJECT(ioc));
+    qemu_sem_post(&s->postcopy_qemufile_src_sem);
+}
+
+/*
+ * Connect the postcopy preempt channel to the destination, using the
+ * address of the main migration socket.  Must be called without the
+ * iothread lock, the connection completes in the main loop.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int postcopy_preempt_setup(MigrationState *s)
+{
+    socket_send_channel_create(postcopy_preempt_send_channel_new, s);
+    qemu_sem_wait(&s->postcopy_qemufile_src_sem);
+
+    if (!s->postcopy_qemufile_src) {
+        error_report("%s: could not connect the postcopy preempt channel",
+                     __func__);
+        return -1;
+    }
+    return 0;
+}
+
+/* Drop the postcopy preempt channel on the source, if it is connected */
+void postcopy_preempt_close_channel(MigrationState *s)
+{
+    QEMUFile *file;
+
+    WITH_QEMU_LOCK_GUARD(&s->qemu_file_lock) {
+        file = s->postcopy_qemufile_src;
+        s->postcopy_qemufile_src = NULL;
+    }
+    if (file) {
+        migration_ioc_unregister_yank_from_file(file);
+        qemu_file_shutdown(file);
+        qemu_fclose(file);
+    }
+}
+
+/* The postcopy preempt channel got connected on the destination */
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file)
+{
+    /* It is read by its own thread, not by a coroutine */
+    qemu_file_set_blocking(file, true);
+    mis->postcopy_qemufile_dst = file;
+    qemu_sem_post(&mis->postcopy_qemufile_dst_sem);
+    trace_postcopy_preempt_new_channel();
+}
+
 /*
  * Current state of incoming postcopy; note this is not part of
  * MigrationIncomingState since it's state is used during cleanup
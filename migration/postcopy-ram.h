@@ -106,6 +106,11 @@ PostcopyState postcopy_state_set(PostcopyState new_state);
 
 void postcopy_fault_thread_notify(MigrationIncomingState *mis);
 
+/* The postcopy preempt channel, see the postcopy-preempt capability */
+int postcopy_preempt_setup(MigrationState *s);
+void postcopy_preempt_close_channel(MigrationState *s);
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file);
+
 /*
  * To be called once at the start before any device initialisation
  */
@@ -25,6 +25,7 @@
 #include <zlib.h>
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
+#include "qemu/thread.h"
 #include "migration.h"
 #include "qemu-file.h"
 #include "trace.h"
@@ -32,6 +33,25 @@
 
 #define IO_BUF_SIZE 32768
 #define MAX_IOV_SIZE MIN_CONST(IOV_MAX, 64)
+#define ASYNC_MAX_IOV_SIZE MIN_CONST(IOV_MAX, 1024)
+
+/* See qemu_file_set_async_writes() */
+typedef struct QEMUFileWriter {
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
+
+    /* All fields below are protected by lock */
+    bool quit;
+    /* The buffers being written out, swapped with those of the QEMUFile */
+    uint8_t *buf;
+    unsigned long *may_free;
+    struct iovec *iov;
+    unsigned int iovcnt; /* 0 when idle */
+    int64_t pos;
+    int error;
+    Error *error_obj;
+} QEMUFileWriter;
 
 struct QEMUFile {
     const QEMUFileOps *ops;
@@ -45,11 +65,15 @@ struct QEMUFile {
                     when reading */
     int buf_index;
     int buf_size; /* 0 when writing */
-    uint8_t buf[IO_BUF_SIZE];
+    uint8_t *buf;
+    int buf_len; /* IO_BUF_SIZE, unless writes are asynchronous */
 
-    DECLARE_BITMAP(may_free, MAX_IOV_SIZE);
-    struct iovec iov[MAX_IOV_SIZE];
+    unsigned long *may_free;
+    struct iovec *iov;
     unsigned int iovcnt;
+    unsigned int iov_max;
+
+    QEMUFileWriter *writer;
 
     int last_error;
     Error *last_error_obj;
@@ -112,6 +136,11 @@ QEMUFile *qemu_fopen_ops(void *opaque, const QEMUFileOps *ops, bool has_ioc)
     f->opaque = opaque;
     f->ops = ops;
     f->has_ioc = has_ioc;
+    f->buf = g_malloc(IO_BUF_SIZE);
+    f->buf_len = IO_BUF_SIZE;
+    f->iov = g_new(struct iovec, MAX_IOV_SIZE);
+    f->iov_max = MAX_IOV_SIZE;
+    f->may_free = bitmap_new(f->iov_max);
     return f;
 }
 
@@ -176,39 +205,195 @@ bool qemu_file_is_writable(QEMUFile *f)
     return f->ops->writev_buffer;
 }
 
-static void qemu_iovec_release_ram(QEMUFile *f)
+static void qemu_iovec_release_ram(struct iovec *iovs, unsigned int iovcnt,
+                                   unsigned long *may_free)
 {
     struct iovec iov;
     unsigned long idx;
 
     /* Find and release all the contiguous memory ranges marked as may_free. */
-    idx = find_next_bit(f->may_free, f->iovcnt, 0);
-    if (idx >= f->iovcnt) {
+    idx = find_next_bit(may_free, iovcnt, 0);
+    if (idx >= iovcnt) {
         return;
     }
-    iov = f->iov[idx];
+    iov = iovs[idx];
 
     /* The madvise() in the loop is called for iov within a continuous range and
      * then reinitialize the iov. And in the end, madvise() is called for the
      * last iov.
      */
-    while ((idx = find_next_bit(f->may_free, f->iovcnt, idx + 1)) < f->iovcnt) {
+    while ((idx = find_next_bit(may_free, iovcnt, idx + 1)) < iovcnt) {
         /* check for adjacent buffer and coalesce them */
-        if (iov.iov_base + iov.iov_len == f->iov[idx].iov_base) {
-            iov.iov_len += f->iov[idx].iov_len;
+        if (iov.iov_base + iov.iov_len == iovs[idx].iov_base) {
+            iov.iov_len += iovs[idx].iov_len;
             continue;
         }
         if (qemu_madvise(iov.iov_base, iov.iov_len, QEMU_MADV_DONTNEED) < 0) {
             error_report("migrate: madvise DONTNEED failed %p %zd: %s",
                          iov.iov_base, iov.iov_len, strerror(errno));
         }
-        iov = f->iov[idx];
+        iov = iovs[idx];
     }
     if (qemu_madvise(iov.iov_base, iov.iov_len, QEMU_MADV_DONTNEED) < 0) {
             error_report("migrate: madvise DONTNEED failed %p %zd: %s",
                          iov.iov_base, iov.iov_len, strerror(errno));
     }
-    memset(f->may_free, 0, sizeof(f->may_free));
+    bitmap_zero(may_free, iovcnt);
+}
+
+static void *qemu_file_writer_thread(void *opaque)
+{
+    QEMUFile *f = opaque;
+    QEMUFileWriter *w = f->writer;
+    Error *local_error = NULL;
+    ssize_t expect, ret;
+
+    qemu_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->iovcnt && !w->quit) {
+            qemu_cond_wait(&w->cond, &w->lock);
+        }
+        if (!w->iovcnt) {
+            break;
+        }
+        qemu_mutex_unlock(&w->lock);
+
+        /* The QEMUFile does not touch the buffers until iovcnt is 0 */
+        expect = iov_size(w->iov, w->iovcnt);
+        ret = f->ops->writev_buffer(f->opaque, w->iov, w->iovcnt, w->pos,
+                                    &local_error);
+        qemu_iovec_release_ram(w->iov, w->iovcnt, w->may_free);
+
+        qemu_mutex_lock(&w->lock);
+        if (ret != expect && !w->error) {
+            w->error = ret < 0 ? ret : -EIO;
+            w->error_obj = local_error;
+        } else {
+            error_free(local_error);
+        }
+        local_error = NULL;
+        w->iovcnt = 0;
+        qemu_cond_broadcast(&w->cond);
+    }
+    qemu_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+/*
+ * Wait until the writer thread is idle and pick up the error it ran
+ * into, if any.  Called with w->lock held.
+ */
+static void qemu_file_writer_wait_locked(QEMUFile *f)
+{
+    QEMUFileWriter *w = f->writer;
+
+    while (w->iovcnt) {
+        qemu_cond_wait(&w->cond, &w->lock);
+    }
+    if (w->error) {
+        qemu_file_set_error_obj(f, w->error, w->error_obj);
+        w->error = 0;
+        w->error_obj = NULL;
+    }
+}
+
+static void qemu_file_writer_wait(QEMUFile *f)
+{
+    qemu_mutex_lock(&f->writer->lock);
+    qemu_file_writer_wait_locked(f);
+    qemu_mutex_unlock(&f->writer->lock);
+}
+
+void qemu_file_set_async_writes(QEMUFile *f, uint64_t buf_size)
+{
+    QEMUFileWriter *w;
+
+    /* RDMA sends RAM through its hooks, outside of the buffers */
+    if (f->hooks || f->writer || !buf_size) {
+        return;
+    }
+    assert(qemu_file_is_writable(f));
+    qemu_fflush(f);
+
+    g_free(f->buf);
+    g_free(f->iov);
+    g_free(f->may_free);
+    f->buf_len = MAX(IO_BUF_SIZE, MIN(buf_size, INT_MAX));
+    f->buf = g_malloc(f->buf_len);
+    f->iov_max = ASYNC_MAX_IOV_SIZE;
+    f->iov = g_new(struct iovec, f->iov_max);
+    f->may_free = bitmap_new(f->iov_max);
+
+    w = g_new0(QEMUFileWriter, 1);
+    w->buf = g_malloc(f->buf_len);
+    w->iov = g_new(struct iovec, f->iov_max);
+    w->may_free = bitmap_new(f->iov_max);
+    qemu_mutex_init(&w->lock);
+    qemu_cond_init(&w->cond);
+    f->writer = w;
+    qemu_thread_create(&w->thread, "migration_writer", qemu_file_writer_thread,
+                       f, QEMU_THREAD_JOINABLE);
+}
+
+static void qemu_file_writer_stop(QEMUFile *f)
+{
+    QEMUFileWriter *w = f->writer;
+
+    qemu_mutex_lock(&w->lock);
+    w->quit = true;
+    qemu_cond_broadcast(&w->cond);
+    qemu_mutex_unlock(&w->lock);
+    qemu_thread_join(&w->thread);
+
+    qemu_cond_destroy(&w->cond);
+    qemu_mutex_destroy(&w->lock);
+    error_free(w->error_obj);
+    g_free(w->buf);
+    g_free(w->iov);
+    g_free(w->may_free);
+    g_free(w);
+    f->writer = NULL;
+}
+
+/*
+ * Hand the buffered data over to the writer thread, if there is one,
+ * and carry on with the other set of buffers.  Only waits if the
+ * thread is still busy with the previous batch.
+ */
+static void qemu_fflush_async(QEMUFile *f)
+{
+    QEMUFileWriter *w = f->writer;
+    unsigned long *may_free;
+    struct iovec *iov;
+    uint8_t *buf;
+
+    if (!w) {
+        qemu_fflush(f);
+        return;
+    }
+    if (f->shutdown || !f->iovcnt) {
+        return;
+    }
+
+    qemu_mutex_lock(&w->lock);
+    qemu_file_writer_wait_locked(f);
+    buf = w->buf;
+    iov = w->iov;
+    may_free = w->may_free;
+    w->buf = f->buf;
+    w->iov = f->iov;
+    w->may_free = f->may_free;
+    f->buf = buf;
+    f->iov = iov;
+    f->may_free = may_free;
+    w->iovcnt = f->iovcnt;
+    w->pos = f->pos;
+    f->pos += iov_size(w->iov, w->iovcnt);
+    f->buf_index = 0;
+    f->iovcnt = 0;
+    qemu_cond_broadcast(&w->cond);
+    qemu_mutex_unlock(&w->lock);
 }
 
 /**
@@ -230,12 +415,16 @@ void qemu_fflush(QEMUFile *f)
     if (f->shutdown) {
         return;
     }
+    if (f->writer) {
+        /* Keep the data in order */
+        qemu_file_writer_wait(f);
+    }
     if (f->iovcnt > 0) {
         expect = iov_size(f->iov, f->iovcnt);
         ret = f->ops->writev_buffer(f->opaque, f->iov, f->iovcnt, f->pos,
                                     &local_error);
 
-        qemu_iovec_release_ram(f);
+        qemu_iovec_release_ram(f->iov, f->iovcnt, f->may_free);
     }
 
     if (ret >= 0) {
@@ -381,6 +570,9 @@ int qemu_fclose(QEMUFile *f)
 {
     int ret;
     qemu_fflush(f);
+    if (f->writer) {
+        qemu_file_writer_stop(f);
+    }
     ret = qemu_file_get_error(f);
 
     if (f->ops->close) {
@@ -396,6 +588,9 @@ int qemu_fclose(QEMUFile *f)
         ret = f->last_error;
     }
     error_free(f->last_error_obj);
+    g_free(f->buf);
+    g_free(f->iov);
+    g_free(f->may_free);
     g_free(f);
     trace_qemu_file_fclose();
     return ret;
@@ -419,7 +614,7 @@ static int add_to_iovec(QEMUFile *f, const uint8_t *buf, size_t size,
     {
         f->iov[f->iovcnt - 1].iov_len += size;
     } else {
-        if (f->iovcnt >= MAX_IOV_SIZE) {
+        if (f->iovcnt >= f->iov_max) {
             /* Should only happen if a previous fflush failed */
             assert(f->shutdown || !qemu_file_is_writable(f));
             return 1;
@@ -431,8 +626,8 @@ static int add_to_iovec(QEMUFile *f, const uint8_t *buf, size_t size,
         f->iov[f->iovcnt++].iov_len = size;
     }
 
-    if (f->iovcnt >= MAX_IOV_SIZE) {
-        qemu_fflush(f);
+    if (f->iovcnt >= f->iov_max) {
+        qemu_fflush_async(f);
         return 1;
     }
 
@@ -443,8 +638,8 @@ static void add_buf_to_iovec(QEMUFile *f, size_t len)
 {
     if (!add_to_iovec(f, f->buf + f->buf_index, len, false)) {
         f->buf_index += len;
-        if (f->buf_index == IO_BUF_SIZE) {
-            qemu_fflush(f);
+        if (f->buf_index == f->buf_len) {
+            qemu_fflush_async(f);
         }
     }
 }
@@ -469,7 +664,7 @@ void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, size_t size)
     }
 
     while (size > 0) {
-        l = IO_BUF_SIZE - f->buf_index;
+        l = f->buf_len - f->buf_index;
         if (l > size) {
             l = size;
         }
@@ -778,7 +973,7 @@ static int qemu_compress_data(z_stream *stream, uint8_t *dest, size_t dest_len,
 ssize_t qemu_put_compression_data(QEMUFile *f, z_stream *stream,
                                   const uint8_t *p, size_t size)
 {
-    ssize_t blen = IO_BUF_SIZE - f->buf_index - sizeof(int32_t);
+    ssize_t blen = f->buf_len - f->buf_index - sizeof(int32_t);
 
     if (blen < compressBound(size)) {
         return -1;
@@ -866,3 +1061,104 @@ QIOChannel *qemu_file_get_ioc(QEMUFile *file)
 {
     return file->has_ioc ? QIO_CHANNEL(file->opaque) : NULL;
 }
+
+/*
+ * Move the position of the underlying channel.  Pending writes are
+ * flushed first; buffered read data is dropped and will be refilled
+ * from the new position.
+ */
+void qemu_set_offset(QEMUFile *f, off_t off, int whence)
+{
+    Error *err = NULL;
+    off_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    ret = qio_channel_io_seek(qemu_file_get_ioc(f), off, whence, &err);
+    if (ret == (off_t)-1) {
+        qemu_file_set_error_obj(f, -errno, err);
+    }
+}
+
+/*
+ * Return the current position in the underlying channel of a writable
+ * QEMUFile, after flushing any pending data.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *err = NULL;
+    off_t ret;
+
+    qemu_fflush(f);
+
+    ret = qio_channel_io_seek(qemu_file_get_ioc(f), 0, SEEK_CUR, &err);
+    if (ret == (off_t)-1) {
+        qemu_file_set_error_obj(f, -errno, err);
+    }
+    return ret;
+}
+
+/*
+ * Write @buflen bytes at @pos of the underlying channel without going
+ * through the QEMUFile buffer and without moving the stream position.
+ */
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos)
+{
+    Error *err = NULL;
+    ssize_t ret;
+
+    if (f->last_error) {
+        return;
+    }
+
+    ret = qio_channel_pwrite(qemu_file_get_ioc(f), (char *)buf, buflen, pos,
+                             &err);
+    if (err) {
+        qemu_file_set_error_obj(f, -EIO, err);
+        return;
+    }
+
+    if ((ssize_t)buflen != ret) {
+        qemu_file_set_error_obj(f, -EIO, NULL);
+        return;
+    }
+
+    f->bytes_xfer += buflen;
+}
+
+/*
+ * Read @buflen bytes at @pos of the underlying channel without going
+ * through the QEMUFile buffer and without moving the stream position.
+ *
+ * Returns the number of bytes read, 0 on error.
+ */
+size_t qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t buflen,
+                          off_t pos)
+{
+    Error *err = NULL;
+    ssize_t ret;
+
+    if (f->last_error) {
+        return 0;
+    }
+
+    ret = qio_channel_pread(qemu_file_get_ioc(f), (char *)buf, buflen, pos,
+                            &err);
+    if (ret == -1 || err) {
+        qemu_file_set_error_obj(f, -EIO, err);
+        return 0;
+    }
+
+    if ((ssize_t)buflen != ret) {
+        qemu_file_set_error_obj(f, -EIO, NULL);
+        return 0;
+    }
+
+    return buflen;
+}
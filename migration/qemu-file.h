@@ -162,6 +162,13 @@ int qemu_file_shutdown(QEMUFile *f);
 QEMUFile *qemu_file_get_return_path(QEMUFile *f);
 void qemu_fflush(QEMUFile *f);
 void qemu_file_set_blocking(QEMUFile *f, bool block);
+/*
+ * Use buffers of @buf_size bytes for @f and write them out from a
+ * separate thread, so that filling a buffer overlaps with sending the
+ * previous one.  Write errors are then reported by a later write, by
+ * qemu_fflush() or by qemu_fclose().  Does nothing if @buf_size is 0.
+ */
+void qemu_file_set_async_writes(QEMUFile *f, uint64_t buf_size);
 
 void ram_control_before_iterate(QEMUFile *f, uint64_t flags);
 void ram_control_after_iterate(QEMUFile *f, uint64_t flags);
@@ -181,5 +188,11 @@ size_t ram_control_save_page(QEMUFile *f, ram_addr_t block_offset,
                              ram_addr_t offset, size_t size,
                              uint64_t *bytes_sent);
 QIOChannel *qemu_file_get_ioc(QEMUFile *file);
+void qemu_set_offset(QEMUFile *f, off_t off, int whence);
+off_t qemu_get_offset(QEMUFile *f);
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos);
+size_t qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t buflen,
+                          off_t pos);
 
 #endif
@@ -28,6 +28,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/main-loop.h"
@@ -55,8 +56,12 @@
 #include "qemu/iov.h"
 #include "multifd.h"
 #include "sysemu/runstate.h"
+#include "sysemu/dirtylimit.h"
+#include "io/channel-file.h"
 
 #if defined(__linux__)
+#include <poll.h>
+#include <sys/eventfd.h>
 #include "qemu/userfaultfd.h"
 #endif /* defined(__linux__) */
 
@@ -79,6 +84,22 @@
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
 
+/*
+ * mapped-ram: each RAMBlock record in the stream is followed by a
+ * header giving the offsets in the file of the block's page bitmap and
+ * of the region where its pages are stored at their fixed offsets.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_HDR_SIZE (sizeof(uint32_t) + 3 * sizeof(uint64_t))
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+/*
+ * With mapped-ram-mmap, shorter runs of pages are read: each mapping is a
+ * separate VMA, and there can only be so many of them.
+ */
+#define MAPPED_RAM_MMAP_MIN_RUN (1 * MiB)
+/* Prefetch in steps so that the RCU read lock is not held for too long */
+#define MAPPED_RAM_PREFETCH_STEP (64 * MiB)
+
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
     return buffer_is_zero(p, size);
@@ -350,6 +371,24 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* RAM_CHANNEL_* that @f currently writes to, see postcopy-preempt */
+    unsigned int postcopy_channel;
+
+    /*
+     * Background snapshot to a mapped-ram file: write faults are served
+     * by wp_fault_thread, and pages are unprotected by whoever saves the
+     * last page of their chunk, see ram_write_tracking_page_done().
+     */
+    bool wp_parallel;
+    bool wp_thread_running;
+    QemuThread wp_fault_thread;
+    /* Written to stop wp_fault_thread */
+    int wp_quit_fd;
+    /* First error of wp_fault_thread */
+    int wp_error;
+    /* Pages saved by wp_fault_thread, not yet in ram_counters */
+    uint64_t wp_normal_pages;
+    uint64_t wp_zero_pages;
 };
 typedef struct RAMState RAMState;
 
@@ -397,6 +436,8 @@ struct PageSearchStatus {
     unsigned long page;
     /* Set once we wrap around */
     bool         complete_round;
+    /* Whether the page was requested by the postcopy destination */
+    bool         postcopy_requested;
 };
 typedef struct PageSearchStatus PageSearchStatus;
 
@@ -836,6 +877,39 @@ migration_clear_memory_region_dirty_bitmap_range(RAMState *rs,
     }
 }
 
+/*
+ * Clear the dirty bit of @page, which other threads may clear too, and
+ * return whether it was set.  The thread that clears the bit saves the
+ * page.
+ */
+static bool ram_wp_claim_page(RAMState *rs, RAMBlock *rb, unsigned long page)
+{
+    unsigned long mask = BIT_MASK(page);
+
+    if (!(qatomic_fetch_and(&rb->bmap[BIT_WORD(page)], ~mask) & mask)) {
+        return false;
+    }
+    qatomic_dec(&rs->migration_dirty_pages);
+    return true;
+}
+
+/*
+ * Account the pages saved by the write fault thread, and report its
+ * errors on the migration stream.  Called by the migration thread.
+ */
+static void ram_wp_collect(RAMState *rs)
+{
+    uint64_t normal = qatomic_xchg(&rs->wp_normal_pages, 0);
+    int ret = qatomic_read(&rs->wp_error);
+
+    ram_counters.normal += normal;
+    ram_counters.transferred += normal * TARGET_PAGE_SIZE;
+    ram_counters.duplicate += qatomic_xchg(&rs->wp_zero_pages, 0);
+    if (ret) {
+        qemu_file_set_error(rs->f, ret);
+    }
+}
+
 static inline bool migration_bitmap_clear_dirty(RAMState *rs,
                                                 RAMBlock *rb,
                                                 unsigned long page)
@@ -852,6 +926,10 @@ static inline bool migration_bitmap_clear_dirty(RAMState *rs,
      */
     migration_clear_memory_region_dirty_bitmap(rs, rb, page);
 
+    if (rs->wp_parallel) {
+        return ram_wp_claim_page(rs, rb, page);
+    }
+
     ret = test_and_clear_bit(page, rb->bmap);
     if (ret) {
         rs->migration_dirty_pages--;
@@ -962,6 +1040,14 @@ static void migration_trigger_throttle(RAMState *rs)
      * that ram migration makes no progress. Avoid this by disabling the
      * throttling logic during the bulk phase of block migration. */
     if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+        /*
+         * vCPUs with a dirty page limit are already throttled one by one,
+         * don't slow down all the others with them.
+         */
+        if (dirtylimit_in_service()) {
+            return;
+        }
+
         /* The following detection logic can be refined later. For now:
            Check to see if the ratio between dirtied bytes and the approx.
            amount of bytes that just got transferred since the last time
@@ -978,7 +1064,7 @@ static void migration_trigger_throttle(RAMState *rs)
     }
 }
 
-static void migration_bitmap_sync(RAMState *rs)
+static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
     RAMBlock *block;
     int64_t end_time;
@@ -990,7 +1076,7 @@ static void migration_bitmap_sync(RAMState *rs)
     }
 
     trace_migration_bitmap_sync_start();
-    memory_global_dirty_log_sync();
+    memory_global_dirty_log_sync(last_stage);
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
@@ -1024,7 +1110,7 @@ static void migration_bitmap_sync(RAMState *rs)
     }
 }
 
-static void migration_bitmap_sync_precopy(RAMState *rs)
+static void migration_bitmap_sync_precopy(RAMState *rs, bool last_stage)
 {
     Error *local_err = NULL;
 
@@ -1037,7 +1123,7 @@ static void migration_bitmap_sync_precopy(RAMState *rs)
         local_err = NULL;
     }
 
-    migration_bitmap_sync(rs);
+    migration_bitmap_sync(rs, last_stage);
 
     if (precopy_notify(PRECOPY_NOTIFY_AFTER_BITMAP_SYNC, &local_err)) {
         error_report_err(local_err);
@@ -1080,7 +1166,22 @@ static int save_zero_page_to_file(RAMState *rs, QEMUFile *file,
  */
 static int save_zero_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
 {
-    int len = save_zero_page_to_file(rs, rs->f, block, offset);
+    int len;
+
+    if (migrate_mapped_ram()) {
+        uint8_t *p = block->host + offset;
+
+        if (!is_zero_range(p, TARGET_PAGE_SIZE)) {
+            return -1;
+        }
+        /* Zero pages are simply not present in the file */
+        clear_bit_atomic(offset >> TARGET_PAGE_BITS, block->file_bmap);
+        ram_write_tracking_page_done(block, offset, 1);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    len = save_zero_page_to_file(rs, rs->f, block, offset);
 
     if (len) {
         ram_counters.duplicate++;
@@ -1151,6 +1252,16 @@ static bool control_save_page(RAMState *rs, RAMBlock *block, ram_addr_t offset,
 static int save_normal_page(RAMState *rs, RAMBlock *block, ram_addr_t offset,
                             uint8_t *buf, bool async)
 {
+    if (migrate_mapped_ram()) {
+        qemu_put_buffer_at(rs->f, buf, TARGET_PAGE_SIZE,
+                           block->pages_offset + offset);
+        set_bit_atomic(offset >> TARGET_PAGE_BITS, block->file_bmap);
+        ram_write_tracking_page_done(block, offset, 1);
+        ram_counters.transferred += TARGET_PAGE_SIZE;
+        ram_counters.normal++;
+        return 1;
+    }
+
     ram_counters.transferred += save_page_header(rs, rs->f, block,
                                                  offset | RAM_SAVE_FLAG_PAGE);
     if (async) {
@@ -1446,6 +1557,8 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
     return block;
 }
 
+static void mapped_ram_save_bitmap(QEMUFile *f, RAMBlock *block);
+
 #if defined(__linux__)
 /**
  * poll_fault_page: try to get next UFFD write fault page and, if pending fault
@@ -1464,7 +1577,8 @@ static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
     RAMBlock *block;
     int res;
 
-    if (!migrate_background_snapshot()) {
+    /* The fault thread takes care of them with mapped-ram */
+    if (!migrate_background_snapshot() || rs->wp_parallel) {
         return NULL;
     }
 
@@ -1494,6 +1608,11 @@ static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
 {
     int res = 0;
 
+    /* With mapped-ram, see ram_write_tracking_page_done() */
+    if (rs->wp_parallel) {
+        return 0;
+    }
+
     /* Check if page is from UFFD-managed region. */
     if (pss->block->flags & RAM_UF_WRITEPROTECT) {
         void *page_address = pss->block->host + (start_page << TARGET_PAGE_BITS);
@@ -1509,6 +1628,234 @@ static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
     return res;
 }
 
+/*
+ * ram_wp_chunk_done: account @npages saved pages of chunk @chunk of
+ *   @block, and unprotect the chunk once all of its pages are saved
+ */
+static void ram_wp_chunk_done(RAMState *rs, RAMBlock *block,
+                              unsigned long chunk, unsigned int npages)
+{
+    ram_addr_t start = (ram_addr_t)chunk << block->wp_chunk_shift;
+    ram_addr_t len = MIN((ram_addr_t)1 << block->wp_chunk_shift,
+                         block->used_length - start);
+
+    if (qatomic_sub_fetch(&block->wp_pending[chunk], npages) == 0) {
+        uffd_change_protection(rs->uffdio_fd, block->host + start, len,
+                               false, false);
+    }
+}
+
+/**
+ * ram_write_tracking_page_done: mark pages as saved to a mapped-ram file
+ *   during a background snapshot
+ *
+ * Write protection is released in chunks of at least the transparent
+ * huge page size, so that the guest does not split huge pages in 4k
+ * ones when it writes to memory that was saved.  A chunk is unprotected
+ * by the thread that saves its last page: the migration thread, a
+ * multifd channel or the write fault thread.  Does nothing in other
+ * kinds of migration.
+ *
+ * Can be called from any thread.
+ *
+ * @block: RAM block of the pages
+ * @offset: offset of the first page in @block
+ * @npages: number of target pages, which must have been dirty
+ */
+void ram_write_tracking_page_done(RAMBlock *block, ram_addr_t offset,
+                                  unsigned long npages)
+{
+    ram_addr_t end = offset + ((ram_addr_t)npages << TARGET_PAGE_BITS);
+
+    if (!block->wp_pending) {
+        return;
+    }
+
+    while (offset < end) {
+        unsigned long chunk = offset >> block->wp_chunk_shift;
+        ram_addr_t chunk_end = MIN(end, (ram_addr_t)(chunk + 1) <<
+                                        block->wp_chunk_shift);
+
+        ram_wp_chunk_done(ram_state, block, chunk,
+                          (chunk_end - offset) >> TARGET_PAGE_BITS);
+        offset = chunk_end;
+    }
+}
+
+/*
+ * ram_wp_save_chunk: save the dirty pages of the chunk of @block that
+ *   contains @offset, on behalf of a vCPU that wrote to it
+ *
+ * Pages are written straight to their place in the mapped-ram file, in
+ * runs of contiguous pages.  Pages already claimed by the migration
+ * thread are left to it; the chunk stays protected until they are saved.
+ */
+static void ram_wp_save_chunk(RAMState *rs, RAMBlock *block,
+                              ram_addr_t offset)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(rs->f);
+    ram_addr_t chunk_size = (ram_addr_t)1 << block->wp_chunk_shift;
+    unsigned long chunk = offset >> block->wp_chunk_shift;
+    unsigned long page = (chunk * chunk_size) >> TARGET_PAGE_BITS;
+    unsigned long end = MIN((chunk + 1) * chunk_size,
+                            block->used_length) >> TARGET_PAGE_BITS;
+    unsigned long run = 0, run_pages = 0;
+    unsigned int claimed = 0, zero = 0;
+
+    for (; page <= end; page++) {
+        if (page < end && ram_wp_claim_page(rs, block, page)) {
+            claimed++;
+            if (!is_zero_range(block->host +
+                               ((ram_addr_t)page << TARGET_PAGE_BITS),
+                               TARGET_PAGE_SIZE)) {
+                if (!run_pages++) {
+                    run = page;
+                }
+                continue;
+            }
+            /* Zero pages are not present in the file */
+            zero++;
+        }
+
+        if (run_pages) {
+            ram_addr_t run_offset = (ram_addr_t)run << TARGET_PAGE_BITS;
+            size_t len = (size_t)run_pages << TARGET_PAGE_BITS;
+            Error *err = NULL;
+            ssize_t ret;
+
+            ret = qio_channel_pwrite(ioc, (char *)block->host + run_offset,
+                                     len, block->pages_offset + run_offset,
+                                     &err);
+            if (ret >= 0 && ret != len) {
+                error_setg(&err, "short write to migration file");
+            }
+            if (err) {
+                if (qatomic_cmpxchg(&rs->wp_error, 0, -EIO) == 0) {
+                    error_report_err(err);
+                } else {
+                    error_free(err);
+                }
+            }
+            bitmap_set_atomic(block->file_bmap, run, run_pages);
+            run_pages = 0;
+        }
+    }
+
+    trace_ram_write_tracking_fault(block->idstr, offset, claimed, zero);
+    if (claimed) {
+        qatomic_add(&rs->wp_normal_pages, claimed - zero);
+        qatomic_add(&rs->wp_zero_pages, zero);
+        /* Even on errors, so that the vCPU is not blocked forever */
+        ram_wp_chunk_done(rs, block, chunk, claimed);
+    }
+}
+
+#define RAM_WP_FAULT_BATCH 16
+
+/*
+ * ram_wp_fault_thread: serve the write faults of a background snapshot
+ *   to a mapped-ram file
+ *
+ * Unlike the migration thread, this thread does not have to wait for its
+ * turn in the stream, so vCPUs are only blocked while their chunk is
+ * written out.
+ */
+static void *ram_wp_fault_thread(void *opaque)
+{
+    RAMState *rs = opaque;
+    struct uffd_msg msgs[RAM_WP_FAULT_BATCH];
+    struct pollfd pfd[2] = {
+        { .fd = rs->uffdio_fd, .events = POLLIN },
+        { .fd = rs->wp_quit_fd, .events = POLLIN },
+    };
+
+    rcu_register_thread();
+
+    while (true) {
+        int i, n;
+
+        if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_report("%s: poll() failed: %s", __func__, strerror(errno));
+            qatomic_cmpxchg(&rs->wp_error, 0, -errno);
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+
+        n = uffd_read_events(rs->uffdio_fd, msgs, ARRAY_SIZE(msgs));
+        if (n < 0) {
+            qatomic_cmpxchg(&rs->wp_error, 0, -EIO);
+            break;
+        }
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            for (i = 0; i < n; i++) {
+                void *addr = (void *)(uintptr_t)msgs[i].arg.pagefault.address;
+                ram_addr_t offset;
+                RAMBlock *block;
+
+                block = qemu_ram_block_from_host(addr, false, &offset);
+                assert(block && block->wp_pending);
+                ram_wp_save_chunk(rs, block, offset);
+            }
+        }
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void ram_wp_fault_thread_stop(RAMState *rs)
+{
+    uint64_t val = 1;
+
+    if (!rs->wp_thread_running) {
+        return;
+    }
+
+    if (write(rs->wp_quit_fd, &val, sizeof(val)) != sizeof(val)) {
+        error_report("%s: write() failed: %s", __func__, strerror(errno));
+    }
+    qemu_thread_join(&rs->wp_fault_thread);
+    close(rs->wp_quit_fd);
+    rs->wp_thread_running = false;
+}
+
+/*
+ * ram_wp_setup_chunks: count the pages to save in each chunk of @block,
+ *   see ram_write_tracking_page_done()
+ */
+static void ram_wp_setup_chunks(RAMState *rs, RAMBlock *block)
+{
+    ram_addr_t chunk_size = MAX(block->page_size, QEMU_VMALLOC_ALIGN);
+    unsigned long chunk_pages = chunk_size >> TARGET_PAGE_BITS;
+    unsigned long nchunks = DIV_ROUND_UP(block->used_length, chunk_size);
+    unsigned long npages = block->used_length >> TARGET_PAGE_BITS;
+    unsigned long i;
+
+    block->wp_chunk_shift = ctz64(chunk_size);
+    block->wp_pending = g_new(unsigned int, nchunks);
+    for (i = 0; i < nchunks; i++) {
+        unsigned long first = i * chunk_pages;
+
+        block->wp_pending[i] =
+            bitmap_count_one_with_offset(block->bmap, first,
+                                         MIN(chunk_pages, npages - first));
+        if (!block->wp_pending[i]) {
+            /* Nothing to save here */
+            uffd_change_protection(rs->uffdio_fd,
+                                   block->host + i * chunk_size,
+                                   MIN(chunk_size,
+                                       block->used_length - i * chunk_size),
+                                   false, false);
+        }
+    }
+}
+
 /* ram_write_tracking_available: check if kernel supports required UFFD features
  *
  * Returns true if supports, false otherwise
@@ -1632,6 +1979,7 @@ int ram_write_tracking_start(void)
         return uffd_fd;
     }
     rs->uffdio_fd = uffd_fd;
+    rs->wp_parallel = migrate_mapped_ram();
 
     RCU_READ_LOCK_GUARD();
 
@@ -1653,11 +2001,26 @@ int ram_write_tracking_start(void)
         }
         block->flags |= RAM_UF_WRITEPROTECT;
         memory_region_ref(block->mr);
+        if (rs->wp_parallel) {
+            ram_wp_setup_chunks(rs, block);
+        }
 
         trace_ram_write_tracking_ramblock_start(block->idstr, block->page_size,
                 block->host, block->max_length);
     }
 
+    if (rs->wp_parallel) {
+        rs->wp_quit_fd = eventfd(0, EFD_CLOEXEC);
+        if (rs->wp_quit_fd < 0) {
+            error_report("ram_write_tracking_start(): eventfd() failed: %s",
+                         strerror(errno));
+            goto fail;
+        }
+        qemu_thread_create(&rs->wp_fault_thread, "snapshot/wp",
+                           ram_wp_fault_thread, rs, QEMU_THREAD_JOINABLE);
+        rs->wp_thread_running = true;
+    }
+
     return 0;
 
 fail:
@@ -1677,13 +2040,47 @@ fail:
         /* Cleanup flags and remove reference */
         block->flags &= ~RAM_UF_WRITEPROTECT;
         memory_region_unref(block->mr);
+        g_free(block->wp_pending);
+        block->wp_pending = NULL;
     }
 
     uffd_close_fd(uffd_fd);
     rs->uffdio_fd = -1;
+    rs->wp_parallel = false;
     return -1;
 }
 
+/**
+ * ram_write_tracking_flush: wait until all the RAM saved by other threads
+ *   is in the migration file
+ *
+ * With mapped-ram, stop the write fault thread, wait for the multifd
+ * channels and write the bitmaps of the pages present in the file.
+ * Called once ram_save_iterate() has found no more dirty pages, before
+ * ram_write_tracking_stop().  Errors are reported on the migration stream.
+ */
+void ram_write_tracking_flush(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+
+    if (!rs->wp_parallel) {
+        return;
+    }
+
+    ram_wp_fault_thread_stop(rs);
+    multifd_send_sync_main(rs->f);
+    ram_wp_collect(rs);
+
+    if (!qemu_file_get_error(rs->f)) {
+        WITH_RCU_READ_LOCK_GUARD() {
+            RAMBLOCK_FOREACH_MIGRATABLE(block) {
+                mapped_ram_save_bitmap(rs->f, block);
+            }
+        }
+    }
+}
+
 /**
  * ram_write_tracking_stop: stop UFFD-WP memory tracking and remove protection
  */
@@ -1692,6 +2089,8 @@ void ram_write_tracking_stop(void)
     RAMState *rs = ram_state;
     RAMBlock *block;
 
+    ram_wp_fault_thread_stop(rs);
+
     RCU_READ_LOCK_GUARD();
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
@@ -1714,6 +2113,7 @@ void ram_write_tracking_stop(void)
     /* Finally close UFFD file descriptor */
     uffd_close_fd(rs->uffdio_fd);
     rs->uffdio_fd = -1;
+    rs->wp_parallel = false;
 }
 
 #else
@@ -1754,10 +2154,24 @@ int ram_write_tracking_start(void)
     return -1;
 }
 
+void ram_write_tracking_flush(void)
+{
+    assert(0);
+}
+
 void ram_write_tracking_stop(void)
 {
     assert(0);
 }
+
+void ram_write_tracking_page_done(RAMBlock *block, ram_addr_t offset,
+                                  unsigned long npages)
+{
+}
+
+static void ram_wp_fault_thread_stop(RAMState *rs)
+{
+}
 #endif /* defined(__linux__) */
 
 /**
@@ -1821,6 +2235,7 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
          * really rare.
          */
         pss->complete_round = false;
+        pss->postcopy_requested = true;
     }
 
     return !!block;
@@ -1913,6 +2328,27 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
     return 0;
 }
 
+/**
+ * ram_postcopy_preempt_send_eos: close the postcopy preempt stream
+ *
+ * Called once postcopy has sent everything, so that the destination
+ * preempt thread stops reading pages and can be joined.
+ *
+ * @s: current migration state
+ */
+void ram_postcopy_preempt_send_eos(MigrationState *s)
+{
+    QEMUFile *f = s->postcopy_qemufile_src;
+
+    if (!f) {
+        return;
+    }
+
+    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
+    qemu_fflush(f);
+    ram_counters.transferred += 8;
+}
+
 static bool save_page_use_compression(RAMState *rs)
 {
     if (!migrate_use_compression()) {
@@ -1979,6 +2415,7 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    bool use_multifd;
     int res;
 
     if (control_save_page(rs, block, offset, &res)) {
@@ -1989,34 +2426,149 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return 1;
     }
 
-    res = save_zero_page(rs, block, offset);
-    if (res > 0) {
-        /* Must let xbzrle know, otherwise a previous (now 0'd) cached
-         * page would be stale
-         */
-        if (!save_page_use_compression(rs)) {
-            XBZRLE_cache_lock();
-            xbzrle_cache_zero_page(rs, block->offset + offset);
-            XBZRLE_cache_unlock();
-        }
-        ram_release_pages(block->idstr, offset, res);
-        return res;
-    }
-
     /*
      * Do not use multifd for:
      * 1. Compression as the first page in the new block should be posted out
      *    before sending the compressed page
-     * 2. In postcopy as one whole host page should be placed
+     * 2. In postcopy as one whole host page should be placed, unless
+     *    postcopy-multifd is set and a target page is a whole host page.
+     *    Pages requested by the destination still go through the main
+     *    channel, so they don't wait behind a full multifd packet.
      */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()
-        && !migration_in_postcopy()) {
+    use_multifd = !save_page_use_compression(rs) && migrate_use_multifd() &&
+                  (!migration_in_postcopy() ||
+                   (migrate_postcopy_multifd() && !pss->postcopy_requested &&
+                    qemu_ram_pagesize(block) == TARGET_PAGE_SIZE));
+
+    /* With multifd-zero-page the send threads look for zero pages */
+    if (!use_multifd || !migrate_multifd_zero_page()) {
+        res = save_zero_page(rs, block, offset);
+        if (res > 0) {
+            /*
+             * Must let xbzrle know, otherwise a previous (now 0'd) cached
+             * page would be stale
+             */
+            if (!save_page_use_compression(rs)) {
+                XBZRLE_cache_lock();
+                xbzrle_cache_zero_page(rs, block->offset + offset);
+                XBZRLE_cache_unlock();
+            }
+            ram_release_pages(block->idstr, offset, res);
+            return res;
+        }
+    }
+
+    if (use_multifd) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
     return ram_save_page(rs, pss, last_stage);
 }
 
+/*
+ * Whether urgent pages go through the postcopy preempt channel; it is
+ * dropped if postcopy has to be recovered.
+ */
+static bool postcopy_preempt_active(void)
+{
+    return migrate_postcopy_preempt() && migration_in_postcopy() &&
+           migrate_get_current()->postcopy_qemufile_src;
+}
+
+/*
+ * Switch rs->f to the given RAM_CHANNEL_*.  The receiving side tracks
+ * RAM_SAVE_FLAG_CONTINUE per channel, so the first page on the new
+ * channel always names its block.
+ */
+static void postcopy_preempt_choose_channel(RAMState *rs, unsigned int channel)
+{
+    MigrationState *s = migrate_get_current();
+
+    if (rs->postcopy_channel == channel) {
+        return;
+    }
+
+    rs->f = channel == RAM_CHANNEL_POSTCOPY ? s->postcopy_qemufile_src :
+                                              s->to_dst_file;
+    rs->postcopy_channel = channel;
+    rs->last_sent_block = NULL;
+    trace_postcopy_preempt_switch_channel(channel);
+}
+
+static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
+                              bool last_stage);
+
+/**
+ * postcopy_preempt_save_host_page: send a requested host page through
+ *   the preempt channel
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ * @last_stage: if we are at the completion stage
+ */
+static int postcopy_preempt_save_host_page(RAMState *rs, PageSearchStatus *pss,
+                                           bool last_stage)
+{
+    MigrationState *s = migrate_get_current();
+    int pages, ret;
+
+    postcopy_preempt_choose_channel(rs, RAM_CHANNEL_POSTCOPY);
+    pages = ram_save_host_page(rs, pss, last_stage);
+    /* The destination is waiting on this page, don't let it sit here */
+    qemu_fflush(rs->f);
+    ret = qemu_file_get_error(rs->f);
+    postcopy_preempt_choose_channel(rs, RAM_CHANNEL_PRECOPY);
+
+    if (ret) {
+        /* Fail the main channel too, so that postcopy gets paused */
+        qemu_file_set_error(s->to_dst_file, ret);
+        return ret;
+    }
+    return pages;
+}
+
+/**
+ * postcopy_preempt_serve: send the page requests that arrived while the
+ *   host page of @pss is being sent
+ *
+ * The requested pages go through the preempt channel, then the caller
+ * goes on with the rest of @pss's host page on the main channel.
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: the host page being interrupted
+ * @last_stage: if we are at the completion stage
+ */
+static int postcopy_preempt_serve(RAMState *rs, PageSearchStatus *pss,
+                                  bool last_stage)
+{
+    size_t pagesize_bits = qemu_ram_pagesize(pss->block) >> TARGET_PAGE_BITS;
+    PageSearchStatus urgent = { };
+    int tmppages, pages = 0;
+
+    trace_postcopy_preempt_serve(pss->block->idstr, pss->page);
+    while (get_queued_page(rs, &urgent)) {
+        if (urgent.block == pss->block &&
+            urgent.page / pagesize_bits == pss->page / pagesize_bits) {
+            /*
+             * Host pages must arrive in one piece on one channel; the
+             * rest of this one is about to be sent anyway.
+             */
+            continue;
+        }
+        tmppages = postcopy_preempt_save_host_page(rs, &urgent, last_stage);
+        if (tmppages < 0) {
+            return tmppages;
+        }
+        pages += tmppages;
+    }
+
+    return pages;
+}
+
 /**
  * ram_save_host_page: save a whole host page
  *
@@ -2062,11 +2614,27 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
             pages += tmppages;
             /*
              * Allow rate limiting to happen in the middle of huge pages if
-             * something is sent in the current iteration.
+             * something is sent in the current iteration.  Requested pages
+             * on the preempt channel are not rate limited.
              */
-            if (pagesize_bits > 1 && tmppages > 0) {
+            if (pagesize_bits > 1 && tmppages > 0 &&
+                rs->postcopy_channel == RAM_CHANNEL_PRECOPY) {
                 migration_rate_limit();
             }
+
+            /*
+             * With postcopy-preempt, page requests interrupt a background
+             * host page instead of waiting for all of it to go out.
+             */
+            if (rs->postcopy_channel == RAM_CHANNEL_PRECOPY &&
+                !QSIMPLEQ_EMPTY_ATOMIC(&rs->src_page_requests) &&
+                postcopy_preempt_active()) {
+                tmppages = postcopy_preempt_serve(rs, pss, last_stage);
+                if (tmppages < 0) {
+                    return tmppages;
+                }
+                pages += tmppages;
+            }
         }
         pss->page = migration_bitmap_find_dirty(rs, pss->block, pss->page);
     } while ((pss->page < hostpage_boundary) &&
@@ -2098,7 +2666,7 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 {
     PageSearchStatus pss;
     int pages = 0;
-    bool again, found;
+    bool again, found, urgent;
 
     /* No dirty page as there is zero RAM */
     if (!ram_bytes_total()) {
@@ -2115,14 +2683,17 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 
     do {
         again = true;
-        found = get_queued_page(rs, &pss);
+        pss.postcopy_requested = false;
+        found = urgent = get_queued_page(rs, &pss);
 
         if (!found) {
             /* priority queue empty, so just search for something dirty */
             found = find_dirty_block(rs, &pss, &again);
         }
 
-        if (found) {
+        if (urgent && postcopy_preempt_active()) {
+            pages = postcopy_preempt_save_host_page(rs, &pss, last_stage);
+        } else if (found) {
             pages = ram_save_host_page(rs, &pss, last_stage);
         }
     } while (!pages && again);
@@ -2218,7 +2789,12 @@ static void ram_save_cleanup(void *opaque)
         /* caller have hold iothread lock or is in a bh, so there is
          * no writing race against the migration bitmap
          */
-        memory_global_dirty_log_stop();
+        memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
+    }
+
+    /* Only still running if the background snapshot failed */
+    if (*rsp) {
+        ram_wp_fault_thread_stop(*rsp);
     }
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
@@ -2226,6 +2802,10 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
+        g_free(block->wp_pending);
+        block->wp_pending = NULL;
     }
 
     xbzrle_cleanup();
@@ -2492,7 +3072,7 @@ int ram_postcopy_send_discard_bitmap(MigrationState *ms)
     RCU_READ_LOCK_GUARD();
 
     /* This should be our last sync, the src is now paused */
-    migration_bitmap_sync(rs);
+    migration_bitmap_sync(rs, true);
 
     /* Easiest way to make sure we don't resume in the middle of a host-page */
     rs->last_seen_block = NULL;
@@ -2680,8 +3260,8 @@ static void ram_init_bitmaps(RAMState *rs)
         ram_list_init_bitmaps();
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
-            memory_global_dirty_log_start();
-            migration_bitmap_sync_precopy(rs);
+            memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
+            migration_bitmap_sync_precopy(rs, false);
         }
     }
     qemu_mutex_unlock_ramlist();
@@ -2749,6 +3329,14 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
         return;
     }
 
+    /*
+     * The pages of a background snapshot to a mapped-ram file stay write
+     * protected until they are saved, so they cannot be skipped.
+     */
+    if (ram_state->wp_parallel) {
+        return;
+    }
+
     for (; len > 0; len -= used_len, addr += used_len) {
         block = qemu_ram_block_from_host(addr, false, &offset);
         if (unlikely(!block || offset >= block->used_length)) {
@@ -2786,6 +3374,50 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
     }
 }
 
+/*
+ * mapped_ram_setup_ramblock: reserve the space of @block in the file
+ *
+ * Writes the mapped-ram header of @block and moves the stream past the
+ * region where its bitmap and its pages will be written in place.
+ *
+ * @f: QEMUFile where to send the data
+ * @block: RAMBlock being described
+ */
+static void mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    off_t header_offset;
+
+    block->file_bmap = bitmap_new(num_pages);
+
+    header_offset = qemu_get_offset(f);
+    block->bitmap_offset = header_offset + MAPPED_RAM_HDR_SIZE;
+    block->pages_offset = ROUND_UP(block->bitmap_offset + bitmap_size,
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    /* The rest of the stream goes after the pages of the block */
+    qemu_set_offset(f, block->pages_offset + block->used_length, SEEK_SET);
+}
+
+/*
+ * mapped_ram_save_bitmap: write the bitmap of the pages of @block
+ * present in the file, once all of them have been written.
+ */
+static void mapped_ram_save_bitmap(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+
+    qemu_put_buffer_at(f, (uint8_t *)block->file_bmap, bitmap_size,
+                       block->bitmap_offset);
+}
+
 /*
  * Each of ram_save_setup, ram_save_iterate and ram_save_complete has
  * long-running RCU critical section.  When rcu-reclaims in the code
@@ -2806,6 +3438,13 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     RAMState **rsp = opaque;
     RAMBlock *block;
 
+    if (migrate_mapped_ram() &&
+        !qio_channel_has_feature(qemu_file_get_ioc(f),
+                                 QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_report("mapped-ram migration needs a seekable channel");
+        return -1;
+    }
+
     if (compress_threads_save_setup()) {
         return -1;
     }
@@ -2833,6 +3472,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
@@ -2939,6 +3581,10 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
+    if (rs->wp_parallel) {
+        ram_wp_collect(rs);
+    }
+
     /*
      * Must occur before EOS (or any QEMUFile operation)
      * because of RDMA protocol.
@@ -2976,11 +3622,12 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 {
     RAMState **temp = opaque;
     RAMState *rs = *temp;
+    RAMBlock *block;
     int ret = 0;
 
     WITH_RCU_READ_LOCK_GUARD() {
         if (!migration_in_postcopy()) {
-            migration_bitmap_sync_precopy(rs);
+            migration_bitmap_sync_precopy(rs, true);
         }
 
         ram_control_before_iterate(f, RAM_CONTROL_FINISH);
@@ -3008,6 +3655,14 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     if (ret >= 0) {
         multifd_send_sync_main(rs->f);
+        if (migrate_mapped_ram()) {
+            /* All the pages are in place, record which ones are present */
+            WITH_RCU_READ_LOCK_GUARD() {
+                RAMBLOCK_FOREACH_MIGRATABLE(block) {
+                    mapped_ram_save_bitmap(f, block);
+                }
+            }
+        }
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
     }
@@ -3026,11 +3681,15 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
 
     remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
 
-    if (!migration_in_postcopy() &&
+    /*
+     * A background snapshot has nothing new to sync, and the write fault
+     * thread may be updating migration_dirty_pages.
+     */
+    if (!migration_in_postcopy() && !rs->wp_parallel &&
         remaining_size < max_size) {
         qemu_mutex_lock_iothread();
         WITH_RCU_READ_LOCK_GUARD() {
-            migration_bitmap_sync_precopy(rs);
+            migration_bitmap_sync_precopy(rs, false);
         }
         qemu_mutex_unlock_iothread();
         remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
@@ -3087,14 +3746,18 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
  *
  * @f: QEMUFile where to read the data from
  * @flags: Page flags (mostly to see if it's a continuation of previous block)
+ * @channel: RAM_CHANNEL_* that @f is, each one has its own previous block
  */
-static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
+static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags,
+                                              int channel)
 {
-    static RAMBlock *block;
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    RAMBlock *block;
     char id[256];
     uint8_t len;
 
     if (flags & RAM_SAVE_FLAG_CONTINUE) {
+        block = mis->last_recv_block[channel];
         if (!block) {
             error_report("Ack, bad migration stream!");
             return NULL;
@@ -3111,6 +3774,7 @@ static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
         error_report("Can't find block %s", id);
         return NULL;
     }
+    mis->last_recv_block[channel] = block;
 
     if (ramblock_is_ignored(block)) {
         error_report("block %s should not be migrated !", id);
@@ -3144,6 +3808,25 @@ static ram_addr_t host_page_offset_from_ram_block_offset(RAMBlock *block,
     return ((uintptr_t)block->host + offset) & (block->page_size - 1);
 }
 
+/*
+ * Record pages sent by the primary in the bitmap of pages that
+ * colo_flush_ram_cache() copies from the COLO cache to the secondary's
+ * memory.  The multifd receive threads call this concurrently.
+ */
+void colo_record_bitmap(RAMBlock *block, ram_addr_t *offsets,
+                        uint32_t pages)
+{
+    uint32_t i;
+
+    qemu_mutex_lock(&ram_state->bitmap_mutex);
+    for (i = 0; i < pages; i++) {
+        if (!test_and_set_bit(offsets[i] >> TARGET_PAGE_BITS, block->bmap)) {
+            ram_state->migration_dirty_pages++;
+        }
+    }
+    qemu_mutex_unlock(&ram_state->bitmap_mutex);
+}
+
 static inline void *colo_cache_from_block_offset(RAMBlock *block,
                              ram_addr_t offset, bool record_bitmap)
 {
@@ -3161,9 +3844,8 @@ static inline void *colo_cache_from_block_offset(RAMBlock *block,
     * It help us to decide which pages in ram cache should be flushed
     * into VM's RAM later.
     */
-    if (record_bitmap &&
-        !test_and_set_bit(offset >> TARGET_PAGE_BITS, block->bmap)) {
-        ram_state->migration_dirty_pages++;
+    if (record_bitmap) {
+        colo_record_bitmap(block, &offset, 1);
     }
     return block->colo_cache + offset;
 }
@@ -3430,14 +4112,14 @@ void colo_incoming_start_dirty_log(void)
     qemu_mutex_lock_iothread();
     qemu_mutex_lock_ramlist();
 
-    memory_global_dirty_log_sync();
+    memory_global_dirty_log_sync(false);
     WITH_RCU_READ_LOCK_GUARD() {
         RAMBLOCK_FOREACH_NOT_IGNORED(block) {
             ramblock_sync_dirty_bitmap(ram_state, block);
             /* Discard this dirty bitmap record */
             bitmap_zero(block->bmap, block->max_length >> TARGET_PAGE_BITS);
         }
-        memory_global_dirty_log_start();
+        memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
     }
     ram_state->migration_dirty_pages = 0;
     qemu_mutex_unlock_ramlist();
@@ -3449,7 +4131,7 @@ void colo_release_ram_cache(void)
 {
     RAMBlock *block;
 
-    memory_global_dirty_log_stop();
+    memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->bmap);
         block->bmap = NULL;
@@ -3526,19 +4208,23 @@ int ram_postcopy_incoming_init(MigrationIncomingState *mis)
  *
  * Returns 0 for success or -errno in case of error
  *
- * Called in postcopy mode by ram_load().
+ * Called in postcopy mode by ram_load(), and by the postcopy preempt
+ * thread for the preempt channel.
  * rcu_read_lock is taken prior to this being called.
  *
  * @f: QEMUFile where to send the data
+ * @channel: RAM_CHANNEL_* that @f is
  */
-static int ram_load_postcopy(QEMUFile *f)
+int ram_load_postcopy(QEMUFile *f, int channel)
 {
     int flags = 0, ret = 0;
     bool place_needed = false;
     bool matches_target_page_size = false;
     MigrationIncomingState *mis = migration_incoming_get_current();
     /* Temporary page that is later 'placed' */
-    void *postcopy_host_page = mis->postcopy_tmp_page;
+    void *postcopy_host_page = channel == RAM_CHANNEL_POSTCOPY ?
+                               mis->postcopy_preempt_tmp_page :
+                               mis->postcopy_tmp_page;
     void *host_page = NULL;
     bool all_zero = true;
     int target_pages = 0;
@@ -3568,7 +4254,7 @@ static int ram_load_postcopy(QEMUFile *f)
         trace_ram_load_postcopy_loop((uint64_t)addr, flags);
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE)) {
-            block = ram_block_from_stream(f, flags);
+            block = ram_block_from_stream(f, flags, channel);
             if (!block) {
                 ret = -EINVAL;
                 break;
@@ -3667,7 +4353,9 @@ static int ram_load_postcopy(QEMUFile *f)
 
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
-            multifd_recv_sync_main();
+            if (channel == RAM_CHANNEL_PRECOPY) {
+                multifd_recv_sync_main();
+            }
             break;
         default:
             error_report("Unknown combination of migration flags: 0x%x"
@@ -3726,7 +4414,7 @@ void colo_flush_ram_cache(void)
     void *src_host;
     unsigned long offset = 0;
 
-    memory_global_dirty_log_sync();
+    memory_global_dirty_log_sync(true);
     qemu_mutex_lock(&ram_state->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
         RAMBLOCK_FOREACH_NOT_IGNORED(block) {
@@ -3759,6 +4447,150 @@ void colo_flush_ram_cache(void)
     qemu_mutex_unlock(&ram_state->bitmap_mutex);
 }
 
+/*
+ * Pages of a mapped-ram file that were mapped rather than read are only
+ * faulted in from the file when the guest first touches them, so the VM
+ * can start as soon as the device state is loaded.  Read the rest of
+ * them into the page cache from a background thread while the guest
+ * runs, so that most of those faults do not have to wait for the disk.
+ * opaque is a list of the idstrs of the RAMBlocks to prefetch.
+ */
+static void *mapped_ram_prefetch_thread(void *opaque)
+{
+    GSList *names = opaque;
+    GSList *l;
+
+    rcu_register_thread();
+    for (l = names; l; l = l->next) {
+        ram_addr_t offset = 0;
+
+        for (;;) {
+            RAMBlock *rb;
+            ram_addr_t len;
+            int ret;
+
+            RCU_READ_LOCK_GUARD();
+            rb = qemu_ram_block_by_name(l->data);
+            if (!rb || offset >= rb->used_length) {
+                break;
+            }
+            len = MIN(MAPPED_RAM_PREFETCH_STEP, rb->used_length - offset);
+            ret = qemu_madvise(rb->host + offset, len, QEMU_MADV_WILLNEED);
+            trace_mapped_ram_prefetch_range(l->data, offset, len, ret);
+            offset += len;
+        }
+    }
+    g_slist_free_full(names, g_free);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void mapped_ram_prefetch_start(GSList *names)
+{
+    QemuThread thread;
+
+    qemu_thread_create(&thread, "mapped-ram/pf", mapped_ram_prefetch_thread,
+                       names, QEMU_THREAD_DETACHED);
+}
+
+/**
+ * mapped_ram_load_ramblock: load the pages of @block from a mapped-ram file
+ *
+ * Reads the header that follows the block record, then every run of
+ * pages present in the file is read straight into guest memory.  With
+ * mapped-ram-mmap, long runs are mapped copy-on-write from the file
+ * instead, so that many VMs started from the same file share the pages
+ * the guests do not write.  The idstr of @block is then added to
+ * @prefetch.
+ *
+ * Returns 0 for success or negative for error
+ *
+ * @f: QEMUFile where to read the data from
+ * @block: RAMBlock being loaded
+ * @length: length of the block on the source
+ * @prefetch: list of the blocks to prefetch once they are all loaded
+ */
+static int mapped_ram_load_ramblock(QEMUFile *f, RAMBlock *block,
+                                    ram_addr_t length, GSList **prefetch)
+{
+    unsigned long num_pages = length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    g_autofree unsigned long *bitmap = NULL;
+    uint64_t page_size, bitmap_offset, pages_offset;
+    unsigned long run_start, run_end;
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    uint32_t version;
+    bool mapped = false;
+    int fd = -1;
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    bitmap_offset = qemu_get_be64(f);
+    pages_offset = qemu_get_be64(f);
+
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_report("Unsupported mapped-ram version %u for block %s",
+                     version, block->idstr);
+        return -EINVAL;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_report("Mismatched mapped-ram page size for block %s "
+                     "%" PRIu64 " != %d", block->idstr, page_size,
+                     TARGET_PAGE_SIZE);
+        return -EINVAL;
+    }
+
+    bitmap = bitmap_new(num_pages);
+    if (qemu_get_buffer_at(f, (uint8_t *)bitmap, bitmap_size,
+                           bitmap_offset) != bitmap_size) {
+        error_report("Failed to read the mapped-ram bitmap of block %s",
+                     block->idstr);
+        return -EIO;
+    }
+
+    if (migrate_mapped_ram_mmap() &&
+        object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        fd = QIO_CHANNEL_FILE(ioc)->fd;
+    }
+
+    for (run_start = find_first_bit(bitmap, num_pages);
+         run_start < num_pages;
+         run_start = find_next_bit(bitmap, num_pages, run_end + 1)) {
+        ram_addr_t offset = (ram_addr_t)run_start << TARGET_PAGE_BITS;
+        size_t len;
+
+        run_end = find_next_zero_bit(bitmap, num_pages, run_start + 1);
+        len = (run_end - run_start) << TARGET_PAGE_BITS;
+
+        if (fd >= 0 && len >= MAPPED_RAM_MMAP_MIN_RUN) {
+            if (qemu_ram_map_file_private(block, offset, len, fd,
+                                          pages_offset + offset)) {
+                trace_mapped_ram_mmap_run(block->idstr, offset, len);
+                mapped = true;
+                continue;
+            }
+            /* Don't try again for this block */
+            fd = -1;
+        }
+
+        if (qemu_get_buffer_at(f, block->host + offset, len,
+                               pages_offset + offset) != len) {
+            error_report("Failed to read mapped-ram pages of block %s",
+                         block->idstr);
+            return -EIO;
+        }
+    }
+
+    if (mapped && QEMU_MADV_WILLNEED != QEMU_MADV_INVALID) {
+        *prefetch = g_slist_append(*prefetch, g_strdup(block->idstr));
+    }
+
+    /* The stream continues after the pages of the block */
+    qemu_set_offset(f, pages_offset + length, SEEK_SET);
+
+    return qemu_file_get_error(f);
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3780,6 +4612,7 @@ static int ram_load_precopy(QEMUFile *f)
 
     while (!ret && !(flags & RAM_SAVE_FLAG_EOS)) {
         ram_addr_t addr, total_ram_bytes;
+        GSList *prefetch = NULL;
         void *host = NULL, *host_bak = NULL;
         uint8_t ch;
 
@@ -3809,7 +4642,8 @@ static int ram_load_precopy(QEMUFile *f)
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(f, flags);
+            RAMBlock *block = ram_block_from_stream(f, flags,
+                                                    RAM_CHANNEL_PRECOPY);
 
             host = host_from_ram_block_offset(block, addr);
             /*
@@ -3898,6 +4732,10 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = mapped_ram_load_ramblock(f, block, length,
+                                                       &prefetch);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -3908,6 +4746,11 @@ static int ram_load_precopy(QEMUFile *f)
 
                 total_ram_bytes -= length;
             }
+            if (!ret && prefetch) {
+                mapped_ram_prefetch_start(prefetch);
+            } else {
+                g_slist_free_full(prefetch, g_free);
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
@@ -3986,7 +4829,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
      */
     WITH_RCU_READ_LOCK_GUARD() {
         if (postcopy_running) {
-            ret = ram_load_postcopy(f);
+            ret = ram_load_postcopy(f, RAM_CHANNEL_PRECOPY);
         } else {
             ret = ram_load_precopy(f);
         }
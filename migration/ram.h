@@ -62,6 +62,8 @@ int ram_postcopy_send_discard_bitmap(MigrationState *ms);
 /* For incoming postcopy discard */
 int ram_discard_range(const char *block_name, uint64_t start, size_t length);
 int ram_postcopy_incoming_init(MigrationIncomingState *mis);
+int ram_load_postcopy(QEMUFile *f, int channel);
+void ram_postcopy_preempt_send_eos(MigrationState *s);
 
 void ram_handle_compressed(void *host, uint8_t ch, uint64_t size);
 
@@ -78,12 +80,17 @@ int colo_init_ram_cache(void);
 void colo_flush_ram_cache(void);
 void colo_release_ram_cache(void);
 void colo_incoming_start_dirty_log(void);
+void colo_record_bitmap(RAMBlock *block, ram_addr_t *offsets,
+                        uint32_t pages);
 
 /* Background snapshot */
 bool ram_write_tracking_available(void);
 bool ram_write_tracking_compatible(void);
 void ram_write_tracking_prepare(void);
 int ram_write_tracking_start(void);
+void ram_write_tracking_flush(void);
 void ram_write_tracking_stop(void);
+void ram_write_tracking_page_done(RAMBlock *block, ram_addr_t offset,
+                                  unsigned long npages);
 
 #endif
@@ -17,6 +17,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "rdma.h"
 #include "migration.h"
 #include "qemu-file.h"
@@ -1117,6 +1118,77 @@ static int qemu_rdma_alloc_qp(RDMAContext *rdma)
     return 0;
 }
 
+/* Check whether the device can register memory without pinning it */
+static bool rdma_support_odp(struct ibv_context *dev)
+{
+    struct ibv_device_attr_ex attr = {0};
+
+    if (ibv_query_device_ex(dev, NULL, &attr)) {
+        return false;
+    }
+
+    return attr.odp_caps.general_caps & IBV_ODP_SUPPORT;
+}
+
+/*
+ * The pages of an On-Demand Paging region are only mapped for the
+ * device when it first accesses them, and a remote write that faults
+ * is answered with an RNR NAK and retried.  Prefetch the region so that
+ * this happens as rarely as possible.
+ */
+static void qemu_rdma_advise_prefetch_mr(struct ibv_pd *pd, uint64_t addr,
+                                         uint64_t len, uint32_t lkey,
+                                         const char *name, bool wr)
+{
+#ifdef HAVE_IBV_ADVISE_MR
+    int advice = wr ? IBV_ADVISE_MR_ADVICE_PREFETCH_WRITE :
+                 IBV_ADVISE_MR_ADVICE_PREFETCH;
+
+    /* The length of a scatter/gather element is 32 bits */
+    while (len) {
+        struct ibv_sge sg_list = {
+            .lkey = lkey,
+            .addr = addr,
+            .length = MIN(len, 1 * GiB),
+        };
+        int ret = ibv_advise_mr(pd, advice, IBV_ADVISE_MR_FLAG_FLUSH,
+                                &sg_list, 1);
+
+        trace_qemu_rdma_advise_mr(name, sg_list.length, addr,
+                                  ret ? strerror(ret) : "ok");
+        if (ret) {
+            return;
+        }
+        addr += sg_list.length;
+        len -= sg_list.length;
+    }
+#endif
+}
+
+/*
+ * Register a memory region, falling back to an On-Demand Paging region
+ * if the memory cannot be pinned and the device supports it.
+ */
+static struct ibv_mr *qemu_rdma_reg_mr(RDMAContext *rdma, void *addr,
+                                       size_t length, int access,
+                                       const char *name)
+{
+    struct ibv_mr *mr = ibv_reg_mr(rdma->pd, addr, length, access);
+
+    if (!mr && errno == ENOTSUP && rdma_support_odp(rdma->verbs)) {
+        access |= IBV_ACCESS_ON_DEMAND;
+        mr = ibv_reg_mr(rdma->pd, addr, length, access);
+        trace_qemu_rdma_register_odp_mr(name, length, mr != NULL);
+        if (mr) {
+            qemu_rdma_advise_prefetch_mr(rdma->pd, (uintptr_t)addr, length,
+                                         mr->lkey, name,
+                                         access & IBV_ACCESS_REMOTE_WRITE);
+        }
+    }
+
+    return mr;
+}
+
 static int qemu_rdma_reg_whole_ram_blocks(RDMAContext *rdma)
 {
     int i;
@@ -1124,11 +1196,12 @@ static int qemu_rdma_reg_whole_ram_blocks(RDMAContext *rdma)
 
     for (i = 0; i < local->nb_blocks; i++) {
         local->block[i].mr =
-            ibv_reg_mr(rdma->pd,
+            qemu_rdma_reg_mr(rdma,
                     local->block[i].local_host_addr,
                     local->block[i].length,
                     IBV_ACCESS_LOCAL_WRITE |
-                    IBV_ACCESS_REMOTE_WRITE
+                    IBV_ACCESS_REMOTE_WRITE,
+                    local->block[i].block_name
                     );
         if (!local->block[i].mr) {
             perror("Failed to register local dest ram block!");
@@ -1218,10 +1291,11 @@ static int qemu_rdma_register_and_get_keys(RDMAContext *rdma,
 
         trace_qemu_rdma_register_and_get_keys(len, chunk_start);
 
-        block->pmr[chunk] = ibv_reg_mr(rdma->pd,
+        block->pmr[chunk] = qemu_rdma_reg_mr(rdma,
                 chunk_start, len,
                 (rkey ? (IBV_ACCESS_LOCAL_WRITE |
-                        IBV_ACCESS_REMOTE_WRITE) : 0));
+                        IBV_ACCESS_REMOTE_WRITE) : 0),
+                block->block_name);
 
         if (!block->pmr[chunk]) {
             perror("Failed to register chunk!");
@@ -2713,6 +2787,7 @@ static ssize_t qio_channel_rdma_writev(QIOChannel *ioc,
                                        size_t niov,
                                        int *fds,
                                        size_t nfds,
+                                       int flags,
                                        Error **errp)
 {
     QIOChannelRDMA *rioc = QIO_CHANNEL_RDMA(ioc);
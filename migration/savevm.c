@@ -1362,7 +1362,9 @@ void qemu_savevm_state_complete_postcopy(QEMUFile *f)
 static
 int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
 {
+    MigrationDowntimeRecorder *rec = &migrate_get_current()->downtime_recorder;
     SaveStateEntry *se;
+    int64_t start_us;
     int ret;
 
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
@@ -1379,12 +1381,16 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
             }
         }
         trace_savevm_section_start(se->idstr, se->section_id);
+        start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
         save_section_header(f, se, QEMU_VM_SECTION_END);
 
         ret = se->ops->save_live_complete_precopy(f, se->opaque);
         trace_savevm_section_end(se->idstr, se->section_id, ret);
         save_section_footer(f, se);
+        migration_downtime_add_section(rec, se->idstr, se->instance_id,
+                                       qemu_clock_get_us(QEMU_CLOCK_REALTIME) -
+                                       start_us);
         if (ret < 0) {
             qemu_file_set_error(f, ret);
             return -1;
@@ -1394,51 +1400,209 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     return 0;
 }
 
+static bool should_save_device_state(SaveStateEntry *se)
+{
+    if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
+        return false;
+    }
+    if (se->vmsd && !vmstate_save_needed(se->vmsd, se->opaque)) {
+        trace_savevm_section_skip(se->idstr, se->section_id);
+        return false;
+    }
+    return true;
+}
+
+static int save_device_state(QEMUFile *f, SaveStateEntry *se,
+                             JSONWriter *vmdesc)
+{
+    int ret;
+
+    trace_savevm_section_start(se->idstr, se->section_id);
+
+    json_writer_start_object(vmdesc, NULL);
+    json_writer_str(vmdesc, "name", se->idstr);
+    json_writer_int64(vmdesc, "instance_id", se->instance_id);
+
+    save_section_header(f, se, QEMU_VM_SECTION_FULL);
+    ret = vmstate_save(f, se, vmdesc);
+    if (ret) {
+        return ret;
+    }
+    trace_savevm_section_end(se->idstr, se->section_id, 0);
+    save_section_footer(f, se);
+
+    json_writer_end_object(vmdesc);
+    return 0;
+}
+
+/* The state of one device, saved to memory by a device save thread */
+typedef struct DeviceSaveJob {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *fb;
+    JSONWriter *vmdesc;
+    int ret;
+    int64_t time_us;
+    QemuEvent done;
+} DeviceSaveJob;
+
+typedef struct DeviceSaveJobs {
+    DeviceSaveJob *jobs;
+    unsigned int n_jobs;
+    unsigned int next_job;
+} DeviceSaveJobs;
+
+static void *device_save_thread(void *opaque)
+{
+    DeviceSaveJobs *s = opaque;
+    DeviceSaveJob *job;
+    int64_t start_us;
+    unsigned int i;
+
+    rcu_register_thread();
+    while ((i = qatomic_fetch_inc(&s->next_job)) < s->n_jobs) {
+        job = &s->jobs[i];
+        start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        job->bioc = qio_channel_buffer_new(4096);
+        job->fb = qemu_fopen_channel_output(QIO_CHANNEL(job->bioc));
+        job->vmdesc = json_writer_new(false);
+        job->ret = save_device_state(job->fb, job->se, job->vmdesc);
+        qemu_fflush(job->fb);
+        if (!job->ret) {
+            job->ret = qemu_file_get_error(job->fb);
+        }
+        job->time_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
+        qemu_event_set(&job->done);
+    }
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+static bool save_device_state_in_thread(SaveStateEntry *se)
+{
+    return se->vmsd && se->vmsd->parallel_save &&
+           migrate_device_save_threads();
+}
+
+/*
+ * Save the devices from @first up to, but excluding, @end, which all
+ * have the same priority.  Those that allow it are saved to memory by
+ * separate threads while the others are saved in this thread; all of
+ * them are then written to @f in their usual order.  Devices with a
+ * lower priority are only saved after this returns, so they can rely
+ * on the state of higher priority ones having been saved.
+ */
+static int save_device_state_group(QEMUFile *f, SaveStateEntry *first,
+                                   SaveStateEntry *end, JSONWriter *vmdesc)
+{
+    MigrationDowntimeRecorder *rec = &migrate_get_current()->downtime_recorder;
+    DeviceSaveJobs s = { };
+    g_autofree QemuThread *threads = NULL;
+    unsigned int n_threads = 0;
+    DeviceSaveJob *job;
+    SaveStateEntry *se;
+    int64_t time_us;
+    unsigned int i;
+    int ret = 0;
+
+    for (se = first; se != end; se = QTAILQ_NEXT(se, entry)) {
+        if (save_device_state_in_thread(se)) {
+            s.n_jobs++;
+        }
+    }
+    if (s.n_jobs) {
+        s.jobs = g_new0(DeviceSaveJob, s.n_jobs);
+        s.n_jobs = 0;
+        for (se = first; se != end; se = QTAILQ_NEXT(se, entry)) {
+            if (save_device_state_in_thread(se) &&
+                should_save_device_state(se)) {
+                job = &s.jobs[s.n_jobs++];
+                job->se = se;
+                qemu_event_init(&job->done, false);
+            }
+        }
+        n_threads = MIN(migrate_device_save_threads(), s.n_jobs);
+        threads = g_new(QemuThread, n_threads);
+        for (i = 0; i < n_threads; i++) {
+            qemu_thread_create(&threads[i], "device_save", device_save_thread,
+                               &s, QEMU_THREAD_JOINABLE);
+        }
+    }
+
+    job = s.jobs;
+    for (se = first; se != end && !ret; se = QTAILQ_NEXT(se, entry)) {
+        if (job < s.jobs + s.n_jobs && job->se == se) {
+            qemu_event_wait(&job->done);
+            ret = job->ret;
+            if (!ret) {
+                qemu_put_buffer(f, job->bioc->data, job->bioc->usage);
+                json_writer_raw(vmdesc, NULL, json_writer_get(job->vmdesc));
+                migration_downtime_add_section(rec, se->idstr,
+                                               se->instance_id, job->time_us);
+            }
+            job++;
+        } else if (!save_device_state_in_thread(se) &&
+                   should_save_device_state(se)) {
+            time_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+            ret = save_device_state(f, se, vmdesc);
+            time_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - time_us;
+            migration_downtime_add_section(rec, se->idstr, se->instance_id,
+                                           time_us);
+        }
+    }
+
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    for (i = 0; i < s.n_jobs; i++) {
+        job = &s.jobs[i];
+        qemu_fclose(job->fb);
+        object_unref(OBJECT(job->bioc));
+        json_writer_free(job->vmdesc);
+        qemu_event_destroy(&job->done);
+    }
+    g_free(s.jobs);
+
+    return ret;
+}
+
 int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool in_postcopy,
                                                     bool inactivate_disks)
 {
+    MigrationDowntimeRecorder *rec = &migrate_get_current()->downtime_recorder;
     g_autoptr(JSONWriter) vmdesc = NULL;
+    int64_t start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     int vmdesc_len;
-    SaveStateEntry *se;
+    SaveStateEntry *se, *end;
     int ret;
 
     vmdesc = json_writer_new(false);
     json_writer_start_object(vmdesc, NULL);
     json_writer_int64(vmdesc, "page_size", qemu_target_page_size());
     json_writer_start_array(vmdesc, "devices");
-    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
-
-        if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
-            continue;
-        }
-        if (se->vmsd && !vmstate_save_needed(se->vmsd, se->opaque)) {
-            trace_savevm_section_skip(se->idstr, se->section_id);
-            continue;
+    for (se = QTAILQ_FIRST(&savevm_state.handlers); se; se = end) {
+        /* The handlers are sorted by priority */
+        end = QTAILQ_NEXT(se, entry);
+        while (end && save_state_priority(end) == save_state_priority(se)) {
+            end = QTAILQ_NEXT(end, entry);
         }
 
-        trace_savevm_section_start(se->idstr, se->section_id);
-
-        json_writer_start_object(vmdesc, NULL);
-        json_writer_str(vmdesc, "name", se->idstr);
-        json_writer_int64(vmdesc, "instance_id", se->instance_id);
-
-        save_section_header(f, se, QEMU_VM_SECTION_FULL);
-        ret = vmstate_save(f, se, vmdesc);
+        ret = save_device_state_group(f, se, end, vmdesc);
         if (ret) {
             qemu_file_set_error(f, ret);
             return ret;
         }
-        trace_savevm_section_end(se->idstr, se->section_id, 0);
-        save_section_footer(f, se);
-
-        json_writer_end_object(vmdesc);
     }
+    migration_downtime_add_phase(rec, "non-iterable", start_us);
 
     if (inactivate_disks) {
         /* Inactivate before sending QEMU_VM_EOF so that the
          * bdrv_invalidate_cache_all() on the other end won't fail. */
+        start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         ret = bdrv_inactivate_all();
+        migration_downtime_add_phase(rec, "block-inactivate", start_us);
         if (ret) {
             error_report("%s: bdrv_inactivate_all() failed (%d)",
                          __func__, ret);
@@ -1467,9 +1631,11 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
 int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
                                        bool inactivate_disks)
 {
+    MigrationDowntimeRecorder *rec = &migrate_get_current()->downtime_recorder;
     int ret;
     Error *local_err = NULL;
     bool in_postcopy = migration_in_postcopy();
+    int64_t start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
     if (precopy_notify(PRECOPY_NOTIFY_COMPLETE, &local_err)) {
         error_report_err(local_err);
@@ -1485,6 +1651,7 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
             return ret;
         }
     }
+    migration_downtime_add_phase(rec, "iterable", start_us);
 
     if (iterable_only) {
         goto flush;
@@ -1497,7 +1664,9 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
     }
 
 flush:
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     qemu_fflush(f);
+    migration_downtime_add_phase(rec, "flush", start_us);
     return 0;
 }
 
@@ -1972,6 +2141,8 @@ static int loadvm_postcopy_handle_listen(MigrationIncomingState *mis)
             postcopy_ram_incoming_cleanup(mis);
             return -1;
         }
+        /* Let the multifd threads place the pages that are on their way */
+        qemu_event_set(&mis->postcopy_listen_event);
     }
 
     if (postcopy_notify(POSTCOPY_NOTIFY_INBOUND_LISTEN, &local_err)) {
@@ -2295,6 +2466,10 @@ static int loadvm_process_command(QEMUFile *f)
             error_report("CMD_OPEN_RETURN_PATH failed");
             return -1;
         }
+        if (migrate_switchover_ack() && !mis->switchover_ack_pending_num) {
+            trace_loadvm_approve_switchover();
+            migrate_send_rp_switchover_ack(mis);
+        }
         break;
 
     case MIG_CMD_PING:
@@ -2380,11 +2555,13 @@ static bool check_section_footer(QEMUFile *f, SaveStateEntry *se)
 }
 
 static int
-qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis,
+                               uint8_t section_type)
 {
     uint32_t instance_id, version_id, section_id;
     SaveStateEntry *se;
     char idstr[256];
+    int64_t start_us;
     int ret;
 
     /* Read section start */
@@ -2431,6 +2608,7 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
         return -EINVAL;
     }
 
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     ret = vmstate_load(f, se);
     if (ret < 0) {
         error_report("error while loading state for instance 0x%"PRIx32" of"
@@ -2440,15 +2618,23 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
     if (!check_section_footer(f, se)) {
         return -EINVAL;
     }
+    if (section_type == QEMU_VM_SECTION_FULL) {
+        migration_downtime_add_section(&mis->downtime_recorder, se->idstr,
+                                       se->instance_id,
+                                       qemu_clock_get_us(QEMU_CLOCK_REALTIME) -
+                                       start_us);
+    }
 
     return 0;
 }
 
 static int
-qemu_loadvm_section_part_end(QEMUFile *f, MigrationIncomingState *mis)
+qemu_loadvm_section_part_end(QEMUFile *f, MigrationIncomingState *mis,
+                             uint8_t section_type)
 {
     uint32_t section_id;
     SaveStateEntry *se;
+    int64_t start_us;
     int ret;
 
     section_id = qemu_get_be32(f);
@@ -2471,6 +2657,7 @@ qemu_loadvm_section_part_end(QEMUFile *f, MigrationIncomingState *mis)
         return -EINVAL;
     }
 
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     ret = vmstate_load(f, se);
     if (ret < 0) {
         error_report("error while loading state section id %d(%s)",
@@ -2480,6 +2667,12 @@ qemu_loadvm_section_part_end(QEMUFile *f, MigrationIncomingState *mis)
     if (!check_section_footer(f, se)) {
         return -EINVAL;
     }
+    if (section_type == QEMU_VM_SECTION_END) {
+        migration_downtime_add_section(&mis->downtime_recorder, se->idstr,
+                                       se->instance_id,
+                                       qemu_clock_get_us(QEMU_CLOCK_REALTIME) -
+                                       start_us);
+    }
 
     return 0;
 }
@@ -2523,11 +2716,19 @@ static int qemu_loadvm_state_header(QEMUFile *f)
 
 static int qemu_loadvm_state_setup(QEMUFile *f)
 {
+    MigrationIncomingState *mis = migration_incoming_get_current();
     SaveStateEntry *se;
     int ret;
 
     trace_loadvm_state_setup();
+    mis->switchover_ack_pending_num = 0;
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (migrate_switchover_ack() && se->ops &&
+            se->ops->switchover_ack_needed &&
+            se->ops->switchover_ack_needed(se->opaque)) {
+            mis->switchover_ack_pending_num++;
+        }
+
         if (!se->ops || !se->ops->load_setup) {
             continue;
         }
@@ -2547,6 +2748,19 @@ static int qemu_loadvm_state_setup(QEMUFile *f)
     return 0;
 }
 
+void qemu_loadvm_approve_switchover(void)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+
+    assert(mis->switchover_ack_pending_num);
+    mis->switchover_ack_pending_num--;
+    /* If the return path is not open yet, CMD_OPEN_RETURN_PATH acks */
+    if (!mis->switchover_ack_pending_num && mis->to_src_file) {
+        trace_loadvm_approve_switchover();
+        migrate_send_rp_switchover_ack(mis);
+    }
+}
+
 void qemu_loadvm_state_cleanup(void)
 {
     SaveStateEntry *se;
@@ -2623,14 +2837,14 @@ retry:
         switch (section_type) {
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
-            ret = qemu_loadvm_section_start_full(f, mis);
+            ret = qemu_loadvm_section_start_full(f, mis, section_type);
             if (ret < 0) {
                 goto out;
             }
             break;
         case QEMU_VM_SECTION_PART:
         case QEMU_VM_SECTION_END:
-            ret = qemu_loadvm_section_part_end(f, mis);
+            ret = qemu_loadvm_section_part_end(f, mis, section_type);
             if (ret < 0) {
                 goto out;
             }
@@ -2684,6 +2898,7 @@ int qemu_loadvm_state(QEMUFile *f)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
     Error *local_err = NULL;
+    int64_t start_us;
     int ret;
 
     if (qemu_savevm_state_blocked(&local_err)) {
@@ -2751,8 +2966,11 @@ int qemu_loadvm_state(QEMUFile *f)
         }
     }
 
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     qemu_loadvm_state_cleanup();
     cpu_synchronize_all_post_init();
+    migration_downtime_add_phase(&mis->downtime_recorder, "load-cleanup",
+                                 start_us);
 
     return ret;
 }
@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
 /*
@@ -24,8 +25,8 @@
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
@@ -126,6 +127,161 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/*
+ * Return the index of the first byte at or after @i whose equality
+ * between @old_buf and @new_buf differs from @equal, or @slen if the
+ * run extends to the end of the buffer.
+ */
+static inline int xbzrle_run_end_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                      int i, int slen, bool equal)
+{
+    while (i + 32 <= slen) {
+        __m256i o = _mm256_loadu_si256((__m256i *)(old_buf + i));
+        __m256i n = _mm256_loadu_si256((__m256i *)(new_buf + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o, n));
+        uint32_t stop = equal ? ~eq : eq;
+
+        if (stop) {
+            return i + ctz32(stop);
+        }
+        i += 32;
+    }
+    while (i < slen && (old_buf[i] == new_buf[i]) == equal) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Same encoding as xbzrle_encode_buffer_int, so the output is byte for
+ * byte identical, but runs are found 32 bytes at a time.
+ */
+static int xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, end;
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        end = xbzrle_run_end_avx2(old_buf, new_buf, i, slen, true);
+        zrun_len = end - i;
+        i = end;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        end = xbzrle_run_end_avx2(old_buf, new_buf, i, slen, false);
+        nzrun_len = end - i;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + i, nzrun_len);
+        d += nzrun_len;
+        i = end;
+    }
+
+    return d;
+}
+#pragma GCC pop_options
+#endif
+
+/*
+ * Note that for test_xbzrle_encode_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX2    1
+
+static unsigned cpuid_cache;
+static int (*xbzrle_encode_accel)(uint8_t *, uint8_t *, int,
+                                  uint8_t *, int) = xbzrle_encode_buffer_int;
+
+static void init_accel(unsigned cache)
+{
+    int (*fn)(uint8_t *, uint8_t *, int, uint8_t *, int) =
+        xbzrle_encode_buffer_int;
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = xbzrle_encode_buffer_avx2;
+    }
+#endif
+    xbzrle_encode_accel = fn;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /*
+     * If no bits set, we just tested xbzrle_encode_buffer_int, and there
+     * are no more acceleration options to test.
+     */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
@@ -554,6 +554,14 @@ static void hmp_info_vnc_clients(Monitor *mon, VncClientInfoList *client)
         monitor_printf(mon, "    sasl_username: %s\n",
                        cinfo->has_sasl_username ?
                        cinfo->sasl_username : "none");
+        if (cinfo->has_encode_stats) {
+            VncEncodeStats *stats = cinfo->encode_stats;
+
+            monitor_printf(mon, "    encoded: %" PRIu64 " updates, %" PRIu64
+                           " rects, %" PRIu64 " bytes, %" PRIu64 " us\n",
+                           stats->updates, stats->rectangles, stats->bytes,
+                           stats->time_ns / 1000);
+        }
 
         client = client->next;
     }
@@ -1893,8 +1901,22 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
         monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        monitor_printf(mon, "  poll-cpu-budget=%" PRId64 "\n",
+                       value->poll_cpu_budget);
+        monitor_printf(mon, "  poll-hits=%" PRIu64 "\n", value->poll_hits);
+        monitor_printf(mon, "  poll-misses=%" PRIu64 "\n", value->poll_misses);
+        monitor_printf(mon, "  poll-time-ns=%" PRIu64 "\n",
+                       value->poll_time_ns);
         monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
                        value->aio_max_batch);
+        monitor_printf(mon, "  thread-pool-min=%" PRId64 "\n",
+                       value->thread_pool_min);
+        monitor_printf(mon, "  thread-pool-max=%" PRId64 "\n",
+                       value->thread_pool_max);
+        monitor_printf(mon, "  thread-pool-threads=%" PRId64 "\n",
+                       value->thread_pool_threads);
+        monitor_printf(mon, "  thread-pool-queued=%" PRId64 "\n",
+                       value->thread_pool_queued);
     }
 
     qapi_free_IOThreadInfoList(info_list);
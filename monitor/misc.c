@@ -324,10 +324,17 @@ static void hmp_info_sync_profile(Monitor *mon, const QDict *qdict)
 {
     int64_t max = qdict_get_try_int(qdict, "max", 10);
     bool mean = qdict_get_try_bool(qdict, "mean", false);
+    bool contended = qdict_get_try_bool(qdict, "contended", false);
     bool coalesce = !qdict_get_try_bool(qdict, "no_coalesce", false);
     enum QSPSortBy sort_by;
 
-    sort_by = mean ? QSP_SORT_BY_AVG_WAIT_TIME : QSP_SORT_BY_TOTAL_WAIT_TIME;
+    if (contended) {
+        sort_by = QSP_SORT_BY_CONTENDED;
+    } else if (mean) {
+        sort_by = QSP_SORT_BY_AVG_WAIT_TIME;
+    } else {
+        sort_by = QSP_SORT_BY_TOTAL_WAIT_TIME;
+    }
     qsp_report(max, sort_by, coalesce);
 }
 
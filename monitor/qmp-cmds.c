@@ -18,9 +18,12 @@
 #include "qemu/cutils.h"
 #include "qemu/option.h"
 #include "monitor/monitor.h"
+#include "monitor/stats.h"
 #include "sysemu/sysemu.h"
 #include "qemu/config-file.h"
 #include "qemu/uuid.h"
+#include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "chardev/char.h"
 #include "ui/qemu-spice.h"
 #include "ui/console.h"
@@ -31,12 +34,15 @@
 #include "sysemu/blockdev.h"
 #include "sysemu/block-backend.h"
 #include "qapi/error.h"
+#include "qapi/clone-visitor.h"
 #include "qapi/qapi-commands-acpi.h"
 #include "qapi/qapi-commands-block.h"
 #include "qapi/qapi-commands-control.h"
 #include "qapi/qapi-commands-machine.h"
 #include "qapi/qapi-commands-misc.h"
+#include "qapi/qapi-commands-stats.h"
 #include "qapi/qapi-commands-ui.h"
+#include "qapi/qapi-visit-stats.h"
 #include "qapi/qmp/qerror.h"
 #include "hw/mem/memory-device.h"
 #include "hw/acpi/acpi_dev_interface.h"
@@ -351,3 +357,276 @@ void qmp_display_reload(DisplayReloadOptions *arg, Error **errp)
         abort();
     }
 }
+
+typedef struct StatsCallbacks {
+    StatsProvider provider;
+    StatRetrieveFunc *stats_cb;
+    SchemaRetrieveFunc *schemas_cb;
+    QTAILQ_ENTRY(StatsCallbacks) next;
+} StatsCallbacks;
+
+static QTAILQ_HEAD(, StatsCallbacks) stats_callbacks =
+    QTAILQ_HEAD_INITIALIZER(stats_callbacks);
+
+void add_stats_callbacks(StatsProvider provider,
+                         StatRetrieveFunc *stats_fn,
+                         SchemaRetrieveFunc *schemas_fn)
+{
+    StatsCallbacks *entry = g_new(StatsCallbacks, 1);
+    entry->provider = provider;
+    entry->stats_cb = stats_fn;
+    entry->schemas_cb = schemas_fn;
+
+    QTAILQ_INSERT_TAIL(&stats_callbacks, entry, next);
+}
+
+static bool invoke_stats_cb(StatsCallbacks *entry,
+                            StatsResultList **stats_results,
+                            StatsFilter *filter, StatsRequest *request,
+                            Error **errp)
+{
+    strList *targets = NULL;
+    strList *names = NULL;
+    ERRP_GUARD();
+
+    if (request) {
+        if (request->provider != entry->provider) {
+            return true;
+        }
+        if (request->has_names && !request->names) {
+            return true;
+        }
+        names = request->has_names ? request->names : NULL;
+    }
+
+    switch (filter->target) {
+    case STATS_TARGET_VM:
+        break;
+    case STATS_TARGET_VCPU:
+        if (filter->u.vcpu.has_vcpus) {
+            if (!filter->u.vcpu.vcpus) {
+                /* No targets allowed?  Return no statistics.  */
+                return true;
+            }
+            targets = filter->u.vcpu.vcpus;
+        }
+        break;
+    case STATS_TARGET_VIRTIO_DEVICE:
+        if (filter->u.virtio_device.has_devices) {
+            if (!filter->u.virtio_device.devices) {
+                return true;
+            }
+            targets = filter->u.virtio_device.devices;
+        }
+        break;
+    case STATS_TARGET_VFIO_DEVICE:
+        if (filter->u.vfio_device.has_devices) {
+            if (!filter->u.vfio_device.devices) {
+                return true;
+            }
+            targets = filter->u.vfio_device.devices;
+        }
+        break;
+    default:
+        abort();
+    }
+
+    entry->stats_cb(stats_results, filter->target, names, targets, errp);
+    if (*errp) {
+        qapi_free_StatsResultList(*stats_results);
+        *stats_results = NULL;
+        return false;
+    }
+    return true;
+}
+
+StatsResultList *qmp_query_stats(StatsFilter *filter, Error **errp)
+{
+    StatsResultList *stats_results = NULL;
+    StatsCallbacks *entry;
+    StatsRequestList *request;
+
+    QTAILQ_FOREACH(entry, &stats_callbacks, next) {
+        if (filter->has_providers) {
+            for (request = filter->providers; request;
+                 request = request->next) {
+                if (!invoke_stats_cb(entry, &stats_results, filter,
+                                     request->value, errp)) {
+                    return NULL;
+                }
+            }
+        } else {
+            if (!invoke_stats_cb(entry, &stats_results, filter, NULL, errp)) {
+                return NULL;
+            }
+        }
+    }
+
+    return stats_results;
+}
+
+/*
+ * The statistics are collected in the main loop, with the BQL held, and
+ * published with RCU, so that query-stats-snapshot can run out of band in
+ * the monitor I/O thread and does not have to wait for the main loop.
+ */
+typedef struct StatsSnapshotRef {
+    struct rcu_head rcu;
+    StatsSnapshot *snapshot;
+} StatsSnapshotRef;
+
+static StatsSnapshotRef *stats_snapshot;
+static QEMUTimer *stats_snapshot_timer;
+static uint32_t stats_snapshot_interval;
+
+static void stats_snapshot_free(StatsSnapshotRef *ref)
+{
+    qapi_free_StatsSnapshot(ref->snapshot);
+    g_free(ref);
+}
+
+static void stats_snapshot_publish(StatsSnapshot *snapshot)
+{
+    StatsSnapshotRef *old = stats_snapshot;
+    StatsSnapshotRef *ref = NULL;
+
+    if (snapshot) {
+        ref = g_new0(StatsSnapshotRef, 1);
+        ref->snapshot = snapshot;
+    }
+
+    qatomic_rcu_set(&stats_snapshot, ref);
+    if (old) {
+        call_rcu(old, stats_snapshot_free, rcu);
+    }
+}
+
+static void stats_snapshot_take(void *opaque)
+{
+    StatsSnapshot *snapshot = g_new0(StatsSnapshot, 1);
+    StatsSnapshotTargetList **tail = &snapshot->targets;
+    StatsTarget target;
+
+    snapshot->timestamp = g_get_real_time();
+    for (target = 0; target < STATS_TARGET__MAX; target++) {
+        StatsFilter filter = { .target = target };
+        StatsSnapshotTarget *entry;
+        StatsResultList *results;
+        Error *local_err = NULL;
+
+        results = qmp_query_stats(&filter, &local_err);
+        if (local_err) {
+            /* Leave out the target, but keep the others */
+            error_free(local_err);
+            continue;
+        }
+
+        entry = g_new0(StatsSnapshotTarget, 1);
+        entry->target = target;
+        entry->stats = results;
+        QAPI_LIST_APPEND(tail, entry);
+    }
+
+    stats_snapshot_publish(snapshot);
+    timer_mod(stats_snapshot_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+              stats_snapshot_interval);
+}
+
+void qmp_stats_snapshot_set_interval(uint32_t interval, Error **errp)
+{
+    stats_snapshot_interval = interval;
+
+    if (!interval) {
+        if (stats_snapshot_timer) {
+            timer_del(stats_snapshot_timer);
+        }
+        stats_snapshot_publish(NULL);
+        return;
+    }
+
+    if (!stats_snapshot_timer) {
+        stats_snapshot_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                            stats_snapshot_take, NULL);
+    }
+    stats_snapshot_take(NULL);
+}
+
+/* May run out of band: must not take the BQL */
+StatsSnapshot *qmp_query_stats_snapshot(Error **errp)
+{
+    StatsSnapshotRef *ref;
+
+    RCU_READ_LOCK_GUARD();
+    ref = qatomic_rcu_read(&stats_snapshot);
+    if (!ref) {
+        error_setg(errp, "No statistics snapshot has been taken; "
+                   "use stats-snapshot-set-interval to take them");
+        return NULL;
+    }
+
+    return QAPI_CLONE(StatsSnapshot, ref->snapshot);
+}
+
+StatsSchemaList *qmp_query_stats_schemas(bool has_provider,
+                                         StatsProvider provider,
+                                         Error **errp)
+{
+    StatsSchemaList *stats_results = NULL;
+    StatsCallbacks *entry;
+    ERRP_GUARD();
+
+    QTAILQ_FOREACH(entry, &stats_callbacks, next) {
+        if (!has_provider || provider == entry->provider) {
+            entry->schemas_cb(&stats_results, errp);
+            if (*errp) {
+                qapi_free_StatsSchemaList(stats_results);
+                return NULL;
+            }
+        }
+    }
+
+    return stats_results;
+}
+
+void add_stats_entry(StatsResultList **stats_results, StatsProvider provider,
+                     const char *qom_path, StatsList *stats_list)
+{
+    StatsResult *entry = g_new0(StatsResult, 1);
+
+    entry->provider = provider;
+    if (qom_path) {
+        entry->has_qom_path = true;
+        entry->qom_path = g_strdup(qom_path);
+    }
+    entry->stats = stats_list;
+
+    QAPI_LIST_PREPEND(*stats_results, entry);
+}
+
+void add_stats_schema(StatsSchemaList **schema_results,
+                      StatsProvider provider, StatsTarget target,
+                      StatsSchemaValueList *stats_list)
+{
+    StatsSchema *entry = g_new0(StatsSchema, 1);
+
+    entry->provider = provider;
+    entry->target = target;
+    entry->stats = stats_list;
+    QAPI_LIST_PREPEND(*schema_results, entry);
+}
+
+bool apply_str_list_filter(const char *string, strList *list)
+{
+    strList *str_list = NULL;
+
+    if (!list) {
+        return true;
+    }
+    for (str_list = list; str_list; str_list = str_list->next) {
+        if (g_str_equal(string, str_list->value)) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -25,6 +25,8 @@
 #include "trace.h"
 #include "nbd-internal.h"
 #include "qemu/units.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -99,6 +101,11 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /* IOThreads that serve the clients, see nbd_export_client_aio_context() */
+    IOThread **client_iothreads;
+    size_t nr_client_iothreads;
+    size_t next_client_iothread;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -122,6 +129,15 @@ struct NBDClient {
     void (*close_fn)(NBDClient *client, bool negotiated);
 
     NBDExport *exp;
+    /*
+     * The AioContext of the IOThread that serves this client, or NULL if it is
+     * served from the AioContext of the export.  Such a client runs in
+     * parallel with the export's AioContext, so the fields that the main loop
+     * accesses (refcount, quiescing, closing, nb_requests and recv_coroutine)
+     * are accessed atomically, and exp->clients is only modified from the
+     * main loop or the export's AioContext.
+     */
+    AioContext *ctx;
     QCryptoTLSCreds *tlscreds;
     char *tlsauthz;
     QIOChannelSocket *sioc; /* The underlying data channel */
@@ -151,6 +167,12 @@ struct NBDClient {
 
 static void nbd_client_receive_next_request(NBDClient *client);
 
+/* The AioContext in which the requests of @client are received and handled */
+static AioContext *nbd_client_aio_context(NBDClient *client)
+{
+    return qatomic_read(&client->ctx) ?: client->exp->common.ctx;
+}
+
 /* Basic flow for negotiation
 
    Server         Client
@@ -1298,6 +1320,30 @@ static int nbd_negotiate_options(NBDClient *client, Error **errp)
     }
 }
 
+/*
+ * Pick the AioContext that serves a new client of @exp, going round robin
+ * through the client IOThreads of the export.  Returns NULL if the client is
+ * to be served from the export's own AioContext, which is always the case
+ * while the nodes below the export cannot take requests from several
+ * AioContexts.
+ */
+static AioContext *nbd_export_client_aio_context(NBDExport *exp)
+{
+    IOThread *iothread;
+    AioContext *ctx;
+
+    if (!exp->nr_client_iothreads ||
+        !blk_multi_context_active(exp->common.blk)) {
+        return NULL;
+    }
+
+    iothread = exp->client_iothreads[exp->next_client_iothread++ %
+                                     exp->nr_client_iothreads];
+    ctx = iothread_get_aio_context(iothread);
+
+    return ctx == exp->common.ctx ? NULL : ctx;
+}
+
 /* nbd_negotiate
  * Return:
  * -errno  on error, errp is set
@@ -1345,9 +1391,16 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
         return ret;
     }
 
-    /* Attach the channel to the same AioContext as the export */
+    /*
+     * Attach the channel to the AioContext that will serve the client, which
+     * is the same as the export's unless it has client IOThreads
+     */
     if (client->exp && client->exp->common.ctx) {
-        qio_channel_attach_aio_context(client->ioc, client->exp->common.ctx);
+        client->ctx = nbd_export_client_aio_context(client->exp);
+        trace_nbd_client_set_aio_context(client->exp->name,
+                                         nbd_client_aio_context(client));
+        qio_channel_attach_aio_context(client->ioc,
+                                       nbd_client_aio_context(client));
     }
 
     assert(!client->optlen);
@@ -1376,10 +1429,17 @@ nbd_read_eof(NBDClient *client, void *buffer, size_t size, Error **errp)
 
         len = qio_channel_readv(client->ioc, &iov, 1, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
+            /*
+             * A client in its own IOThread may miss the wake up from
+             * nbd_drained_begin() if it hadn't started waiting yet
+             */
+            if (!partial && qatomic_read(&client->quiescing)) {
+                return -EAGAIN;
+            }
             client->read_yielding = true;
             qio_channel_yield(client->ioc, G_IO_IN);
             client->read_yielding = false;
-            if (client->quiescing) {
+            if (qatomic_read(&client->quiescing)) {
                 return -EAGAIN;
             }
             continue;
@@ -1444,41 +1504,94 @@ static int nbd_receive_request(NBDClient *client, NBDRequest *request,
 
 void nbd_client_get(NBDClient *client)
 {
-    client->refcount++;
+    qatomic_inc(&client->refcount);
+}
+
+/*
+ * Take a reference to @client from the main loop, unless the last one is
+ * already gone and the client only waits for nbd_client_free_bh().
+ */
+static bool nbd_client_tryget(NBDClient *client)
+{
+    int refcount = qatomic_read(&client->refcount);
+
+    while (refcount) {
+        int old = qatomic_cmpxchg(&client->refcount, refcount, refcount + 1);
+        if (old == refcount) {
+            return true;
+        }
+        refcount = old;
+    }
+    return false;
+}
+
+static void nbd_client_free(NBDClient *client)
+{
+    qio_channel_detach_aio_context(client->ioc);
+    object_unref(OBJECT(client->sioc));
+    object_unref(OBJECT(client->ioc));
+    if (client->tlscreds) {
+        object_unref(OBJECT(client->tlscreds));
+    }
+    g_free(client->tlsauthz);
+    if (client->exp) {
+        QTAILQ_REMOVE(&client->exp->clients, client, next);
+        blk_exp_unref(&client->exp->common);
+    }
+    g_free(client->export_meta.bitmaps);
+    g_free(client);
+}
+
+static void nbd_client_free_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+    AioContext *ctx = blk_get_aio_context(client->exp->common.blk);
+
+    aio_context_acquire(ctx);
+    nbd_client_free(client);
+    aio_context_release(ctx);
+}
+
+/* Whether the current thread may modify exp->clients */
+static bool nbd_client_in_export_context(NBDClient *client)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    return !client->exp || ctx == qemu_get_aio_context() ||
+           ctx == client->exp->common.ctx;
 }
 
 void nbd_client_put(NBDClient *client)
 {
-    if (--client->refcount == 0) {
+    if (qatomic_fetch_dec(&client->refcount) == 1) {
         /* The last reference should be dropped by client->close,
          * which is called by client_close.
          */
         assert(client->closing);
 
-        qio_channel_detach_aio_context(client->ioc);
-        object_unref(OBJECT(client->sioc));
-        object_unref(OBJECT(client->ioc));
-        if (client->tlscreds) {
-            object_unref(OBJECT(client->tlscreds));
-        }
-        g_free(client->tlsauthz);
-        if (client->exp) {
-            QTAILQ_REMOVE(&client->exp->clients, client, next);
-            blk_exp_unref(&client->exp->common);
+        if (nbd_client_in_export_context(client)) {
+            nbd_client_free(client);
+        } else {
+            aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                    nbd_client_free_bh, client);
         }
-        g_free(client->export_meta.bitmaps);
-        g_free(client);
     }
 }
 
+static void nbd_client_close_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    client->close_fn(client, true);
+    nbd_client_put(client);
+}
+
 static void client_close(NBDClient *client, bool negotiated)
 {
-    if (client->closing) {
+    if (qatomic_xchg(&client->closing, true)) {
         return;
     }
 
-    client->closing = true;
-
     /* Force requests to finish.  They will drop their own references,
      * then we'll close the socket and free the NBDClient.
      */
@@ -1486,8 +1599,17 @@ static void client_close(NBDClient *client, bool negotiated)
                          NULL);
 
     /* Also tell the client, so that they release their reference.  */
-    if (client->close_fn) {
+    if (!client->close_fn) {
+        return;
+    }
+    if (nbd_client_in_export_context(client)) {
         client->close_fn(client, negotiated);
+    } else {
+        /* Only negotiated clients are served from their own IOThread */
+        assert(negotiated);
+        nbd_client_get(client);
+        aio_bh_schedule_oneshot(qemu_get_aio_context(), nbd_client_close_bh,
+                                client);
     }
 }
 
@@ -1496,7 +1618,7 @@ static NBDRequestData *nbd_request_get(NBDClient *client)
     NBDRequestData *req;
 
     assert(client->nb_requests <= MAX_NBD_REQUESTS - 1);
-    client->nb_requests++;
+    qatomic_inc(&client->nb_requests);
 
     req = g_new0(NBDRequestData, 1);
     nbd_client_get(client);
@@ -1513,9 +1635,9 @@ static void nbd_request_put(NBDRequestData *req)
     }
     g_free(req);
 
-    client->nb_requests--;
+    qatomic_dec(&client->nb_requests);
 
-    if (client->quiescing && client->nb_requests == 0) {
+    if (qatomic_read(&client->quiescing) && client->nb_requests == 0) {
         aio_wait_kick();
     }
 
@@ -1534,6 +1656,9 @@ static void blk_aio_attached(AioContext *ctx, void *opaque)
     exp->common.ctx = ctx;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
+        if (client->ctx) {
+            continue;
+        }
         qio_channel_attach_aio_context(client->ioc, ctx);
 
         assert(client->nb_requests == 0);
@@ -1550,30 +1675,86 @@ static void blk_aio_detach(void *opaque)
     trace_nbd_blk_aio_detach(exp->name, exp->common.ctx);
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
+        if (client->ctx) {
+            continue;
+        }
         qio_channel_detach_aio_context(client->ioc);
     }
 
     exp->common.ctx = NULL;
 }
 
+/*
+ * If a client in its own IOThread waits for a request on nbd_read_eof(),
+ * enter it so that it notices it is quiescing.
+ */
+static void nbd_client_wake_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    if (qatomic_read(&client->ctx) == qemu_get_current_aio_context() &&
+        client->recv_coroutine != NULL && client->read_yielding) {
+        qemu_aio_coroutine_enter(client->ctx, client->recv_coroutine);
+    }
+    nbd_client_put(client);
+}
+
+static void nbd_client_resume_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    if (qatomic_read(&client->ctx) == qemu_get_current_aio_context()) {
+        nbd_client_receive_next_request(client);
+    }
+    nbd_client_put(client);
+}
+
 static void nbd_drained_begin(void *opaque)
 {
     NBDExport *exp = opaque;
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = true;
+        qatomic_set(&client->quiescing, true);
+        if (client->ctx && nbd_client_tryget(client)) {
+            aio_bh_schedule_oneshot(client->ctx, nbd_client_wake_bh, client);
+        }
     }
 }
 
 static void nbd_drained_end(void *opaque)
 {
     NBDExport *exp = opaque;
-    NBDClient *client;
+    NBDClient *client, *next;
+    bool multi_context = blk_multi_context_active(exp->common.blk);
 
-    QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = false;
-        nbd_client_receive_next_request(client);
+    QTAILQ_FOREACH_SAFE(client, &exp->clients, next, next) {
+        qatomic_set(&client->quiescing, false);
+        if (!client->ctx) {
+            nbd_client_receive_next_request(client);
+            continue;
+        }
+        if (!nbd_client_tryget(client)) {
+            continue;
+        }
+
+        /*
+         * A node that cannot take requests from several AioContexts may have
+         * been added to the graph while drained; serve the client from the
+         * export's AioContext from now on, which is possible because it is
+         * idle at this point.
+         */
+        if (!multi_context && qatomic_read(&client->nb_requests) == 0 &&
+            qatomic_read(&client->recv_coroutine) == NULL) {
+            qio_channel_detach_aio_context(client->ioc);
+            qatomic_set(&client->ctx, NULL);
+            trace_nbd_client_set_aio_context(exp->name, exp->common.ctx);
+            qio_channel_attach_aio_context(client->ioc, exp->common.ctx);
+            nbd_client_receive_next_request(client);
+            nbd_client_put(client);
+        } else {
+            aio_bh_schedule_oneshot(client->ctx, nbd_client_resume_bh, client);
+        }
     }
 }
 
@@ -1583,6 +1764,14 @@ static bool nbd_drained_poll(void *opaque)
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
+        if (client->ctx) {
+            /* Woken up by nbd_client_wake_bh(), and kicks us once idle */
+            if (qatomic_read(&client->nb_requests) != 0 ||
+                qatomic_read(&client->recv_coroutine) != NULL) {
+                return true;
+            }
+            continue;
+        }
         if (client->nb_requests != 0) {
             /*
              * If there's a coroutine waiting for a request on nbd_read_eof()
@@ -1634,7 +1823,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     int64_t size;
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
-    bool shared = !exp_args->writable;
+    bool multi_conn = arg->has_multi_conn ? arg->multi_conn : readonly;
     strList *bitmaps;
     size_t i;
     int ret;
@@ -1687,13 +1876,17 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
                      NBD_FLAG_SEND_FUA | NBD_FLAG_SEND_CACHE);
     if (readonly) {
         exp->nbdflags |= NBD_FLAG_READ_ONLY;
-        if (shared) {
-            exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
-        }
     } else {
         exp->nbdflags |= (NBD_FLAG_SEND_TRIM | NBD_FLAG_SEND_WRITE_ZEROES |
                           NBD_FLAG_SEND_FAST_ZERO);
     }
+    /*
+     * All connections go through the same BlockBackend, so a flush on one of
+     * them also covers the writes that completed on the others.
+     */
+    if (multi_conn) {
+        exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+    }
     exp->size = QEMU_ALIGN_DOWN(size, BDRV_SECTOR_SIZE);
 
     for (bitmaps = arg->bitmaps; bitmaps; bitmaps = bitmaps->next) {
@@ -1746,6 +1939,16 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
 
     exp->allocation_depth = arg->allocation_depth;
 
+    if (!iothread_ref_list(arg->client_iothreads, &exp->client_iothreads,
+                           &exp->nr_client_iothreads, errp)) {
+        ret = -EINVAL;
+        goto fail_iothreads;
+    }
+    if (exp->nr_client_iothreads) {
+        /* Clients submit their requests from their own IOThread */
+        blk_set_multi_context(blk, true);
+    }
+
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
      * be properly quiesced when entering a drained section, as our coroutines
@@ -1761,6 +1964,10 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
 
     return 0;
 
+fail_iothreads:
+    for (i = 0; i < exp->nr_export_bitmaps; i++) {
+        bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
+    }
 fail:
     g_free(exp->export_bitmaps);
     g_free(exp->name);
@@ -1829,11 +2036,14 @@ static void nbd_export_delete(BlockExport *blk_exp)
         blk_remove_aio_context_notifier(exp->common.blk, blk_aio_attached,
                                         blk_aio_detach, exp);
         blk_set_disable_request_queuing(exp->common.blk, false);
+        blk_set_multi_context(exp->common.blk, false);
     }
 
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    iothread_unref_list(exp->client_iothreads, exp->nr_client_iothreads);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -2623,20 +2833,20 @@ static coroutine_fn void nbd_trip(void *opaque)
         return;
     }
 
-    if (client->quiescing) {
+    if (qatomic_read(&client->quiescing)) {
         /*
          * We're switching between AIO contexts. Don't attempt to receive a new
          * request and kick the main context which may be waiting for us.
          */
+        qatomic_set(&client->recv_coroutine, NULL);
         nbd_client_put(client);
-        client->recv_coroutine = NULL;
         aio_wait_kick();
         return;
     }
 
     req = nbd_request_get(client);
     ret = nbd_co_receive_request(req, &request, &local_err);
-    client->recv_coroutine = NULL;
+    qatomic_set(&client->recv_coroutine, NULL);
 
     if (client->closing) {
         /*
@@ -2647,7 +2857,7 @@ static coroutine_fn void nbd_trip(void *opaque)
     }
 
     if (ret == -EAGAIN) {
-        assert(client->quiescing);
+        assert(qatomic_read(&client->quiescing));
         goto done;
     }
 
@@ -2698,10 +2908,11 @@ disconnect:
 static void nbd_client_receive_next_request(NBDClient *client)
 {
     if (!client->recv_coroutine && client->nb_requests < MAX_NBD_REQUESTS &&
-        !client->quiescing) {
+        !qatomic_read(&client->quiescing)) {
         nbd_client_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, client);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(nbd_client_aio_context(client),
+                        client->recv_coroutine);
     }
 }
 
@@ -18,6 +18,7 @@
 #include "qemu/osdep.h"
 #include "net/checksum.h"
 #include "net/eth.h"
+#include "qemu/host-utils.h"
 
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
@@ -206,3 +207,31 @@ net_checksum_add_iov(const struct iovec *iov, const unsigned int iov_cnt,
     }
     return res;
 }
+
+void net_toeplitz_table_init(net_toeplitz_table *table,
+                             const uint8_t *key_bytes)
+{
+    uint32_t pos, value;
+
+    memcpy(table->key, key_bytes, sizeof(table->key));
+
+    for (pos = 0; pos < NET_TOEPLITZ_MAX_INPUT; pos++) {
+        /* Key bits [8 * pos, 8 * pos + 40) */
+        uint64_t window = ((uint64_t)ldl_be_p(&key_bytes[pos]) << 8) |
+                          key_bytes[pos + sizeof(uint32_t)];
+        uint32_t *entry = table->byte[pos];
+
+        /*
+         * Input bit 7 - b of this byte selects key bits starting at
+         * 8 * pos + 7 - b; build each entry from the one with its lowest
+         * set bit cleared.
+         */
+        entry[0] = 0;
+        for (value = 1; value < 256; value++) {
+            int b = ctz32(value);
+
+            entry[value] = entry[value & (value - 1)] ^
+                           (uint32_t)(window >> (b + 1));
+        }
+    }
+}
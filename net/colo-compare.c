@@ -730,32 +730,25 @@ static void coroutine_fn _compare_chr_send(void *opaque)
 
     while (!g_queue_is_empty(&sendco->send_list)) {
         SendEntry *entry = g_queue_pop_tail(&sendco->send_list);
-        uint32_t len = htonl(entry->size);
-
-        ret = qemu_chr_fe_write_all(sendco->chr, (uint8_t *)&len, sizeof(len));
-
-        if (ret != sizeof(len)) {
-            g_free(entry->buf);
-            g_slice_free(SendEntry, entry);
-            goto err;
-        }
+        uint32_t hdr[2];
+        int hdr_size = sizeof(hdr[0]);
 
+        hdr[0] = htonl(entry->size);
         if (!sendco->notify_remote_frame && s->vnet_hdr) {
             /*
              * We send vnet header len make other module(like filter-redirector)
              * know how to parse net packet correctly.
              */
-            len = htonl(entry->vnet_hdr_len);
+            hdr[1] = htonl(entry->vnet_hdr_len);
+            hdr_size += sizeof(hdr[1]);
+        }
 
-            ret = qemu_chr_fe_write_all(sendco->chr,
-                                        (uint8_t *)&len,
-                                        sizeof(len));
+        ret = qemu_chr_fe_write_all(sendco->chr, (uint8_t *)hdr, hdr_size);
 
-            if (ret != sizeof(len)) {
-                g_free(entry->buf);
-                g_slice_free(SendEntry, entry);
-                goto err;
-            }
+        if (ret != hdr_size) {
+            g_free(entry->buf);
+            g_slice_free(SendEntry, entry);
+            goto err;
         }
 
         ret = qemu_chr_fe_write_all(sendco->chr,
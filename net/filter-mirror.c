@@ -40,6 +40,8 @@ struct MirrorState {
     CharBackend chr_out;
     SocketReadState rs;
     bool vnet_hdr;
+    /* Framing header and packet, reused so that each send is one write */
+    GByteArray *send_buf;
 };
 
 static int filter_send(MirrorState *s,
@@ -49,49 +51,39 @@ static int filter_send(MirrorState *s,
     NetFilterState *nf = NETFILTER(s);
     int ret = 0;
     ssize_t size = 0;
-    uint32_t len = 0;
-    char *buf;
+    uint32_t hdr[2];
+    size_t hdr_size = sizeof(hdr[0]);
 
     size = iov_size(iov, iovcnt);
     if (!size) {
         return 0;
     }
 
-    len = htonl(size);
-    ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)&len, sizeof(len));
-    if (ret != sizeof(len)) {
-        goto err;
-    }
-
+    hdr[0] = htonl(size);
     if (s->vnet_hdr) {
         /*
          * If vnet_hdr = on, we send vnet header len to make other
          * module(like colo-compare) know how to parse net
          * packet correctly.
          */
-        ssize_t vnet_hdr_len;
-
-        vnet_hdr_len = nf->netdev->vnet_hdr_len;
-
-        len = htonl(vnet_hdr_len);
-        ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)&len, sizeof(len));
-        if (ret != sizeof(len)) {
-            goto err;
-        }
+        hdr[1] = htonl(nf->netdev->vnet_hdr_len);
+        hdr_size += sizeof(hdr[1]);
     }
 
-    buf = g_malloc(size);
-    iov_to_buf(iov, iovcnt, 0, buf, size);
-    ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)buf, size);
-    g_free(buf);
-    if (ret != size) {
-        goto err;
+    if (!s->send_buf) {
+        s->send_buf = g_byte_array_new();
+    }
+    g_byte_array_set_size(s->send_buf, hdr_size + size);
+    memcpy(s->send_buf->data, hdr, hdr_size);
+    iov_to_buf(iov, iovcnt, 0, s->send_buf->data + hdr_size, size);
+
+    ret = qemu_chr_fe_write_all(&s->chr_out, s->send_buf->data,
+                                s->send_buf->len);
+    if (ret != s->send_buf->len) {
+        return ret < 0 ? ret : -EIO;
     }
 
     return size;
-
-err:
-    return ret < 0 ? ret : -EIO;
 }
 
 static void redirector_to_filter(NetFilterState *nf,
@@ -421,6 +413,9 @@ static void filter_mirror_fini(Object *obj)
     MirrorState *s = FILTER_MIRROR(obj);
 
     g_free(s->outdev);
+    if (s->send_buf) {
+        g_byte_array_free(s->send_buf, true);
+    }
 }
 
 static void filter_redirector_fini(Object *obj)
@@ -429,6 +424,9 @@ static void filter_redirector_fini(Object *obj)
 
     g_free(s->indev);
     g_free(s->outdev);
+    if (s->send_buf) {
+        g_byte_array_free(s->send_buf, true);
+    }
 }
 
 static const TypeInfo filter_redirector_info = {
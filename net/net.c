@@ -528,6 +528,27 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
 #endif
 }
 
+/*
+ * Move the fd handlers of a backend to @ctx, or back to the main loop if
+ * @ctx is NULL.  The backend and its NIC must then only be used from that
+ * context, so backends with filters attached cannot be moved.
+ */
+bool qemu_net_client_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (!nc || !nc->info->set_aio_context) {
+        return false;
+    }
+    if (ctx && !QTAILQ_EMPTY(&nc->filters)) {
+        return false;
+    }
+    if (!nc->info->set_aio_context(nc, ctx)) {
+        return false;
+    }
+
+    nc->aio_context = ctx;
+    return true;
+}
+
 int qemu_can_receive_packet(NetClientState *nc)
 {
     if (nc->receive_disabled) {
@@ -988,6 +1009,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1081,6 +1105,9 @@ void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
@@ -1182,6 +1209,11 @@ void qmp_netdev_del(const char *id, Error **errp)
         return;
     }
 
+    if (nc->aio_context) {
+        error_setg(errp, "Device '%s' is in use by an IOThread", id);
+        return;
+    }
+
     qemu_del_net_client(nc);
 
     /*
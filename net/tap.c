@@ -31,7 +31,11 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <net/if.h>
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+#endif
 
+#include "block/aio.h"
 #include "net/eth.h"
 #include "net/net.h"
 #include "clients.h"
@@ -48,6 +52,25 @@
 
 #include "net/vhost_net.h"
 
+#ifdef CONFIG_LINUX_IO_URING
+/* Number of reads kept in flight on the tap fd */
+#define TAP_URING_DEPTH 16
+/* Tag for the user_data of cancel requests; the low bits are the slot */
+#define TAP_URING_CANCEL (1ULL << 63)
+
+typedef struct TAPUring {
+    struct io_uring ring;
+    uint8_t *bufs;
+    struct iovec iov[TAP_URING_DEPTH];
+    /* Bitmask of the slots that have a read in flight */
+    uint32_t inflight;
+    /* A read found no packet, wait for the tap fd to become readable */
+    bool wait_readable;
+    /* A read failed, don't queue any more */
+    bool failed;
+} TAPUring;
+#endif
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
@@ -62,6 +85,11 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    /* IOThread polling fd, NULL for the main loop */
+    AioContext *ctx;
+#ifdef CONFIG_LINUX_IO_URING
+    TAPUring *uring;
+#endif
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -70,8 +98,38 @@ static void launch_script(const char *setup_script, const char *ifname,
 static void tap_send(void *opaque);
 static void tap_writable(void *opaque);
 
+#ifdef CONFIG_LINUX_IO_URING
+static void tap_uring_start(TAPState *s);
+static void tap_uring_stop(TAPState *s, bool deliver);
+static void tap_uring_readable(void *opaque);
+#endif
+
 static void tap_update_fd_handler(TAPState *s)
 {
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->uring) {
+        bool reading = s->read_poll && s->enabled;
+
+        if (reading) {
+            tap_uring_start(s);
+        } else {
+            tap_uring_stop(s, s->enabled);
+        }
+        qemu_set_fd_handler(s->fd,
+                            reading && s->uring->wait_readable &&
+                            !s->uring->failed ? tap_uring_readable : NULL,
+                            s->write_poll && s->enabled ? tap_writable : NULL,
+                            s);
+        return;
+    }
+#endif
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false,
+                           s->read_poll && s->enabled ? tap_send : NULL,
+                           s->write_poll && s->enabled ? tap_writable : NULL,
+                           NULL, s);
+        return;
+    }
     qemu_set_fd_handler(s->fd,
                         s->read_poll && s->enabled ? tap_send : NULL,
                         s->write_poll && s->enabled ? tap_writable : NULL,
@@ -182,6 +240,27 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
+/* Pass one packet read from the tap fd on to the peer */
+static ssize_t tap_send_one(TAPState *s, uint8_t *buf, int size)
+{
+    uint8_t min_pkt[ETH_ZLEN];
+    size_t min_pktsz = sizeof(min_pkt);
+
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        buf  += s->host_vnet_hdr_len;
+        size -= s->host_vnet_hdr_len;
+    }
+
+    if (net_peer_needs_padding(&s->nc)) {
+        if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
+            buf = min_pkt;
+            size = min_pktsz;
+        }
+    }
+
+    return qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+}
+
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
@@ -189,28 +268,12 @@ static void tap_send(void *opaque)
     int packets = 0;
 
     while (true) {
-        uint8_t *buf = s->buf;
-        uint8_t min_pkt[ETH_ZLEN];
-        size_t min_pktsz = sizeof(min_pkt);
-
         size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
         if (size <= 0) {
             break;
         }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
-        }
-
-        if (net_peer_needs_padding(&s->nc)) {
-            if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
-                buf = min_pkt;
-                size = min_pktsz;
-            }
-        }
-
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+        size = tap_send_one(s, s->buf, size);
         if (size == 0) {
             tap_read_poll(s, false);
             break;
@@ -231,6 +294,181 @@ static void tap_send(void *opaque)
     }
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * With io_uring, TAP_URING_DEPTH reads are queued on the tap fd and a
+ * single wakeup of the ring fd delivers all the packets that arrived in
+ * the meantime, instead of one read() system call per packet.
+ */
+
+/* Handle one completion, returns false if the peer stopped receiving */
+static bool tap_uring_cqe(TAPState *s, struct io_uring_cqe *cqe, bool deliver)
+{
+    TAPUring *u = s->uring;
+    uint64_t slot = cqe->user_data;
+    int res = cqe->res;
+
+    io_uring_cqe_seen(&u->ring, cqe);
+    if (slot & TAP_URING_CANCEL) {
+        return true;
+    }
+
+    u->inflight &= ~(1u << slot);
+    if (res > 0 && deliver) {
+        /* If the peer is full the packet is queued, i.e. copied */
+        return tap_send_one(s, u->iov[slot].iov_base, res) != 0;
+    } else if (res == -EAGAIN) {
+        /* The tap fd is non-blocking, so reads fail once it is empty */
+        u->wait_readable = true;
+    } else if (res < 0 && res != -ECANCELED && res != -EINTR && !u->failed) {
+        error_report("tap: io_uring read failed, not receiving any more "
+                     "packets: %s", strerror(-res));
+        u->failed = true;
+    }
+    return true;
+}
+
+static void tap_uring_complete(void *opaque)
+{
+    TAPState *s = opaque;
+    struct io_uring_cqe *cqe;
+    bool more = true;
+
+    while (io_uring_peek_cqe(&s->uring->ring, &cqe) == 0) {
+        more &= tap_uring_cqe(s, cqe, true);
+    }
+
+    if (more) {
+        tap_update_fd_handler(s);
+    } else {
+        tap_read_poll(s, false);
+    }
+}
+
+static void tap_uring_readable(void *opaque)
+{
+    TAPState *s = opaque;
+
+    s->uring->wait_readable = false;
+    tap_update_fd_handler(s);
+}
+
+/*
+ * Queue reads for all idle slots, unless the tap fd is empty or broken,
+ * and wait for their completion
+ */
+static void tap_uring_start(TAPState *s)
+{
+    TAPUring *u = s->uring;
+    unsigned int i;
+
+    if (u->wait_readable || u->failed) {
+        qemu_set_fd_handler(u->ring.ring_fd,
+                            u->inflight ? tap_uring_complete : NULL, NULL, s);
+        return;
+    }
+
+    for (i = 0; i < TAP_URING_DEPTH; i++) {
+        struct io_uring_sqe *sqe;
+
+        if (u->inflight & (1u << i)) {
+            continue;
+        }
+        sqe = io_uring_get_sqe(&u->ring);
+        if (!sqe) {
+            break;
+        }
+        io_uring_prep_readv(sqe, s->fd, &u->iov[i], 1, 0);
+        sqe->user_data = i;
+        u->inflight |= 1u << i;
+    }
+    io_uring_submit(&u->ring);
+
+    qemu_set_fd_handler(u->ring.ring_fd, tap_uring_complete, NULL, s);
+}
+
+/*
+ * Cancel the reads in flight so that nobody else (e.g. vhost-net)
+ * loses packets to them.  Reads that already completed are passed on
+ * to the peer if @deliver is true, and dropped otherwise.
+ */
+static void tap_uring_stop(TAPState *s, bool deliver)
+{
+    TAPUring *u = s->uring;
+    struct io_uring_cqe *cqe;
+    unsigned int i;
+    int ret;
+
+    qemu_set_fd_handler(u->ring.ring_fd, NULL, NULL, NULL);
+
+    for (i = 0; i < TAP_URING_DEPTH; i++) {
+        struct io_uring_sqe *sqe;
+
+        if (!(u->inflight & (1u << i))) {
+            continue;
+        }
+        sqe = io_uring_get_sqe(&u->ring);
+        assert(sqe);
+        io_uring_prep_rw(IORING_OP_ASYNC_CANCEL, sqe, -1, NULL, 0, 0);
+        sqe->addr = i;
+        sqe->user_data = TAP_URING_CANCEL | i;
+    }
+    io_uring_submit(&u->ring);
+
+    while (u->inflight) {
+        ret = io_uring_wait_cqe(&u->ring, &cqe);
+        if (ret == -EINTR) {
+            continue;
+        } else if (ret < 0) {
+            error_report("tap: waiting for io_uring reads failed: %s",
+                         strerror(-ret));
+            abort();
+        }
+        tap_uring_cqe(s, cqe, deliver);
+    }
+}
+
+static int tap_uring_init(TAPState *s, Error **errp)
+{
+    TAPUring *u = g_new0(TAPUring, 1);
+    unsigned int i;
+    int ret;
+
+    /* Leave room for a cancel request per read */
+    ret = io_uring_queue_init(2 * TAP_URING_DEPTH, &u->ring, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "tap: failed to set up io_uring");
+        g_free(u);
+        return -1;
+    }
+
+    u->bufs = g_malloc(TAP_URING_DEPTH * NET_BUFSIZE);
+    for (i = 0; i < TAP_URING_DEPTH; i++) {
+        u->iov[i].iov_base = u->bufs + i * NET_BUFSIZE;
+        u->iov[i].iov_len = NET_BUFSIZE;
+    }
+
+    /* Switch the reads from the fd handler over to the ring */
+    qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    s->uring = u;
+    tap_update_fd_handler(s);
+    return 0;
+}
+
+static void tap_uring_cleanup(TAPState *s)
+{
+    if (!s->uring) {
+        return;
+    }
+
+    tap_uring_stop(s, false);
+    io_uring_queue_exit(&s->uring->ring);
+    g_free(s->uring->bufs);
+    g_free(s->uring);
+    s->uring = NULL;
+}
+#endif
+
 static bool tap_has_ufo(NetClientState *nc)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -334,6 +572,9 @@ static void tap_cleanup(NetClientState *nc)
     tap_exit_notify(&s->exit, NULL);
     qemu_remove_exit_notifier(&s->exit);
 
+#ifdef CONFIG_LINUX_IO_URING
+    tap_uring_cleanup(s);
+#endif
     tap_read_poll(s, false);
     tap_write_poll(s, false);
     close(s->fd);
@@ -343,6 +584,15 @@ static void tap_cleanup(NetClientState *nc)
 static void tap_poll(NetClientState *nc, bool enable)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * vhost-net disables polling after it has started, so packets that
+     * were already read can no longer be handed to the device: drop them.
+     */
+    if (s->uring && !enable) {
+        tap_uring_stop(s, false);
+    }
+#endif
     tap_read_poll(s, enable);
     tap_write_poll(s, enable);
 }
@@ -355,6 +605,33 @@ static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
     return tap_fd_set_steering_ebpf(s->fd, prog_fd) == 0;
 }
 
+/*
+ * Called from the old context, or from the main loop with the device
+ * quiesced.  The io_uring read ring stays in the main loop.
+ */
+static bool tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->uring) {
+        return false;
+    }
+#endif
+    if (s->vhost_net) {
+        return false;
+    }
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+    s->ctx = ctx;
+    tap_update_fd_handler(s);
+    return true;
+}
+
 int tap_get_fd(NetClientState *nc)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -381,6 +658,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -687,6 +965,12 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         return;
     }
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (tap->has_io_uring && tap->io_uring && tap_uring_init(s, errp) < 0) {
+        return;
+    }
+#endif
+
     if (tap->has_fd || tap->has_fds) {
         snprintf(s->nc.info_str, sizeof(s->nc.info_str), "fd=%d", fd);
     } else if (tap->has_helper) {
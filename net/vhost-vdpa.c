@@ -54,6 +54,7 @@ const int vdpa_feature_bits[] = {
     VIRTIO_NET_F_MTU,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_NOTIFICATION_DATA,
     VIRTIO_NET_F_RSS,
     VIRTIO_NET_F_HASH_REPORT,
     VIRTIO_NET_F_GUEST_ANNOUNCE,
@@ -171,7 +172,8 @@ static NetClientInfo net_vhost_vdpa_info = {
 };
 
 static int net_vhost_vdpa_init(NetClientState *peer, const char *device,
-                               const char *name, const char *vhostdev)
+                               const char *name, const char *vhostdev,
+                               bool svq)
 {
     NetClientState *nc = NULL;
     VhostVDPAState *s;
@@ -187,6 +189,7 @@ static int net_vhost_vdpa_init(NetClientState *peer, const char *device,
         return -errno;
     }
     s->vhost_vdpa.device_fd = vdpa_device_fd;
+    s->vhost_vdpa.shadow_vqs_enabled = svq;
     ret = vhost_vdpa_add(nc, (void *)&s->vhost_vdpa);
     assert(s->vhost_net);
     return ret;
@@ -222,5 +225,6 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
                           (char *)name, errp)) {
         return -1;
     }
-    return net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name, opts->vhostdev);
+    return net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name, opts->vhostdev,
+                               opts->has_x_svq && opts->x_svq);
 }
@@ -211,11 +211,75 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Make room in every scoreboard for @cpu.  Translated code embeds the
+ * scoreboards' addresses, so they may only move while no vCPU runs
+ * and the code cache must be flushed afterwards.  Without a current
+ * vCPU, no translated code can be running either: system emulation
+ * sizes the scoreboards for the maximum number of vCPUs up front, and
+ * user mode only creates vCPUs before the first one starts or from
+ * the syscall handler of a running one.
+ */
+static void plugin_grow_scoreboards__locked(CPUState *cpu)
+{
+    struct qemu_plugin_scoreboard *score;
+
+    if (cpu->cpu_index < plugin.scoreboard_alloc_size) {
+        return;
+    }
+    while (cpu->cpu_index >= plugin.scoreboard_alloc_size) {
+        plugin.scoreboard_alloc_size *= 2;
+    }
+    if (QLIST_EMPTY(&plugin.scoreboards)) {
+        return;
+    }
+
+    if (current_cpu) {
+        start_exclusive();
+    }
+    QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+        g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+    }
+    if (current_cpu) {
+        tb_flush(current_cpu);
+        end_exclusive();
+    }
+}
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score =
+        g_new0(struct qemu_plugin_scoreboard, 1);
+
+    /* Keep the entries of different vCPUs in different cache lines */
+    element_size = ROUND_UP(element_size, qemu_dcache_linesize);
+    score->data = g_array_sized_new(false, true, element_size,
+                                    plugin.scoreboard_alloc_size);
+    g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    g_array_free(score->data, true);
+    g_free(score);
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
     qemu_rec_mutex_lock(&plugin.lock);
+    plugin_grow_scoreboards__locked(cpu);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
@@ -283,7 +347,7 @@ static struct qemu_plugin_dyn_cb *plugin_get_dyn_cb(GArray **arr)
 void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_mem_rw rw,
                                enum qemu_plugin_op op, void *ptr,
-                               uint64_t imm)
+                               size_t stride, uint64_t imm)
 {
     struct qemu_plugin_dyn_cb *dyn_cb;
 
@@ -292,6 +356,7 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->type = PLUGIN_CB_INLINE;
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.stride = stride;
     dyn_cb->inline_insn.imm = imm;
 }
 
@@ -308,6 +373,25 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     dyn_cb->type = PLUGIN_CB_REGULAR;
 }
 
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        void *ptr, size_t stride,
+                                        uint64_t imm, void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->userp = udata;
+    /* Note flags are discarded as unused. */
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_REGULAR_COND;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.ptr = ptr;
+    dyn_cb->cond.stride = stride;
+    dyn_cb->cond.imm = imm;
+}
+
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
                                  enum qemu_plugin_cb_flags flags,
@@ -433,14 +517,18 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
-    uint64_t *val = cb->userp;
+    uint64_t *val = (uint64_t *)((char *)cb->userp +
+                                 cpu_index * cb->inline_insn.stride);
 
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
@@ -467,7 +555,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
             cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
             break;
         default:
             g_assert_not_reached();
@@ -552,6 +640,8 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    QLIST_INIT(&plugin.scoreboards);
+    plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
     atexit(qemu_plugin_atexit_cb);
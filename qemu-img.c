@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include <getopt.h>
+#include <math.h>
 
 #include "qemu-common.h"
 #include "qemu-version.h"
@@ -33,6 +34,7 @@
 #include "qapi/qobject-output-visitor.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qnum.h"
 #include "qemu/cutils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
@@ -41,6 +43,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "qemu/sockets.h"
+#include "qemu/timer.h"
 #include "qemu/units.h"
 #include "qom/object_interfaces.h"
 #include "sysemu/block-backend.h"
@@ -83,6 +86,10 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_THREADS = 278,
+    OPTION_RANDOM = 279,
+    OPTION_ZIPF = 280,
+    OPTION_RWMIX_READ = 281,
 };
 
 typedef enum OutputFormat {
@@ -1621,6 +1628,18 @@ enum ImgConvertBlockStatus {
 };
 
 #define MAX_COROUTINES 16
+/*
+ * Copy offloading serves whole allocated extents up to this size, so that
+ * reflinks turn into few metadata operations
+ */
+#define COPY_RANGE_MAX_SECTORS ((1 * GiB) >> BDRV_SECTOR_BITS)
+#define MAX_THREADS MAX_COROUTINES
+
+typedef struct ImgConvertThread {
+    QemuThread thread;
+    AioContext *ctx;
+    bool stopping;
+} ImgConvertThread;
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
 typedef struct ImgConvertState {
@@ -1643,6 +1662,7 @@ typedef struct ImgConvertState {
     int64_t target_backing_sectors; /* negative if unknown */
     bool wr_in_order;
     bool copy_range;
+    bool compressed_batches; /* target takes several clusters per write */
     bool salvage;
     bool quiet;
     int min_sparse;
@@ -1653,10 +1673,71 @@ typedef struct ImgConvertState {
     int running_coroutines;
     Coroutine *co[MAX_COROUTINES];
     int64_t wait_sector_num[MAX_COROUTINES];
+    long num_threads;
+    ImgConvertThread *threads;
     CoMutex lock;
     int ret;
 } ImgConvertState;
 
+/*
+ * With --threads, the coroutines are spread over the main thread and
+ * num_threads - 1 of these, each with an AioContext of its own.
+ */
+static void *convert_thread_fn(void *opaque)
+{
+    ImgConvertThread *t = opaque;
+
+    qemu_set_current_aio_context(t->ctx);
+    while (!qatomic_read(&t->stopping)) {
+        aio_poll(t->ctx, true);
+    }
+    return NULL;
+}
+
+static void convert_start_threads(ImgConvertState *s)
+{
+    int i;
+
+    s->threads = g_new0(ImgConvertThread, s->num_threads - 1);
+    for (i = 0; i < s->num_threads - 1; i++) {
+        ImgConvertThread *t = &s->threads[i];
+
+        t->ctx = aio_context_new(&error_abort);
+        qemu_thread_create(&t->thread, "qemu-img-convert", convert_thread_fn,
+                           t, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void convert_stop_threads(ImgConvertState *s)
+{
+    int i;
+
+    for (i = 0; i < s->num_threads - 1; i++) {
+        ImgConvertThread *t = &s->threads[i];
+
+        qatomic_set(&t->stopping, true);
+        aio_notify(t->ctx);
+        qemu_thread_join(&t->thread);
+        aio_context_unref(t->ctx);
+    }
+    g_free(s->threads);
+    s->threads = NULL;
+}
+
+/* The AioContext that runs coroutine @index */
+static AioContext *convert_co_aio_context(ImgConvertState *s, int index)
+{
+    int thread = index % s->num_threads;
+
+    return thread ? s->threads[thread - 1].ctx : qemu_get_aio_context();
+}
+
+/* Only the first error is reported as the result */
+static void convert_set_error(ImgConvertState *s, int ret)
+{
+    qatomic_cmpxchg(&s->ret, -EINPROGRESS, ret);
+}
+
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
@@ -1757,7 +1838,8 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 
     n = MIN(n, s->sector_next_status - sector_num);
     if (s->status == BLK_DATA) {
-        n = MIN(n, s->buf_sectors);
+        n = MIN(n, qatomic_read(&s->copy_range) ? COPY_RANGE_MAX_SECTORS
+                                                : s->buf_sectors);
     }
 
     /* We need to write complete clusters for compressed images, so if an
@@ -1829,6 +1911,34 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
 }
 
 
+/*
+ * Return true if the first cluster of @buf contains non-zero data, false if
+ * it is completely zeroed.  *pnum is set to the number of sectors, starting
+ * from @buf and in whole clusters except at the end of @buf, that share the
+ * same status.
+ */
+static bool is_allocated_clusters(ImgConvertState *s, const uint8_t *buf,
+                                  int n, int *pnum)
+{
+    int cluster_sectors = s->cluster_sectors;
+    bool allocated;
+    int i;
+
+    allocated = !buffer_is_zero(buf, MIN(n, cluster_sectors) *
+                                     BDRV_SECTOR_SIZE);
+    for (i = cluster_sectors; i < n; i += cluster_sectors) {
+        const uint8_t *p = buf + i * BDRV_SECTOR_SIZE;
+        int len = MIN(n - i, cluster_sectors) * BDRV_SECTOR_SIZE;
+
+        if (allocated == buffer_is_zero(p, len)) {
+            break;
+        }
+    }
+
+    *pnum = MIN(i, n);
+    return allocated;
+}
+
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
                                          enum ImgConvertBlockStatus status)
@@ -1852,14 +1962,14 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
+             * case we can only save the write if a cluster is completely
              * zeroed. */
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 is_allocated_clusters(s, buf, n, &n)))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -1924,6 +2034,38 @@ static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector
     return 0;
 }
 
+/*
+ * Copy a chunk that was sized for copy offloading through @buf, after
+ * offloading failed.  Errors are reported here.
+ */
+static void coroutine_fn convert_co_copy_bounce(ImgConvertState *s,
+                                                int64_t sector_num,
+                                                int nb_sectors, uint8_t *buf)
+{
+    int ret;
+
+    while (nb_sectors > 0) {
+        int n = MIN(nb_sectors, s->buf_sectors);
+
+        ret = convert_co_read(s, sector_num, n, buf);
+        if (ret < 0) {
+            error_report("error while reading at byte %lld: %s",
+                         sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
+            convert_set_error(s, ret);
+            return;
+        }
+        ret = convert_co_write(s, sector_num, n, buf, BLK_DATA);
+        if (ret < 0) {
+            error_report("error while writing at byte %lld: %s",
+                         sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
+            convert_set_error(s, ret);
+            return;
+        }
+        sector_num += n;
+        nb_sectors -= n;
+    }
+}
+
 static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
@@ -1939,24 +2081,24 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
     }
     assert(index >= 0);
 
-    s->running_coroutines++;
     buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
 
     while (1) {
         int n;
         int64_t sector_num;
         enum ImgConvertBlockStatus status;
-        bool copy_range;
+        bool copy_range, bounce;
 
         qemu_co_mutex_lock(&s->lock);
-        if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
+        if (qatomic_read(&s->ret) != -EINPROGRESS ||
+            s->sector_num >= s->total_sectors) {
             qemu_co_mutex_unlock(&s->lock);
             break;
         }
         n = convert_iteration_sectors(s, s->sector_num);
         if (n < 0) {
             qemu_co_mutex_unlock(&s->lock);
-            s->ret = n;
+            convert_set_error(s, n);
             break;
         }
         /* save current sector and allocation status to local variables */
@@ -1968,22 +2110,27 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         /* increment global sector counter so that other coroutines can
          * already continue reading beyond this request */
         s->sector_num += n;
-        qemu_co_mutex_unlock(&s->lock);
 
         if (status == BLK_DATA || (!s->min_sparse && status == BLK_ZERO)) {
             s->allocated_done += n;
             qemu_progress_print(100.0 * s->allocated_done /
                                         s->allocated_sectors, 0);
         }
+        qemu_co_mutex_unlock(&s->lock);
 
 retry:
-        copy_range = s->copy_range && s->status == BLK_DATA;
-        if (status == BLK_DATA && !copy_range) {
+        copy_range = qatomic_read(&s->copy_range) && status == BLK_DATA;
+        /*
+         * The chunk may have been sized for copy offloading, which this or
+         * another thread has disabled since.  It doesn't fit in @buf then.
+         */
+        bounce = status == BLK_DATA && !copy_range && n > s->buf_sectors;
+        if (status == BLK_DATA && !copy_range && !bounce) {
             ret = convert_co_read(s, sector_num, n, buf);
             if (ret < 0) {
                 error_report("error while reading at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
-                s->ret = ret;
+                convert_set_error(s, ret);
             }
         } else if (!s->min_sparse && status == BLK_ZERO) {
             status = BLK_DATA;
@@ -1992,55 +2139,67 @@ retry:
 
         if (s->wr_in_order) {
             /* keep writes in order */
-            while (s->wr_offs != sector_num && s->ret == -EINPROGRESS) {
+            qemu_co_mutex_lock(&s->lock);
+            while (s->wr_offs != sector_num &&
+                   qatomic_read(&s->ret) == -EINPROGRESS) {
                 s->wait_sector_num[index] = sector_num;
+                /*
+                 * The previous write may complete in another thread before
+                 * we yield.  aio_co_wake() then schedules us in our own
+                 * AioContext, which cannot run us before we have yielded.
+                 */
+                qemu_co_mutex_unlock(&s->lock);
                 qemu_coroutine_yield();
+                qemu_co_mutex_lock(&s->lock);
             }
             s->wait_sector_num[index] = -1;
+            qemu_co_mutex_unlock(&s->lock);
         }
 
-        if (s->ret == -EINPROGRESS) {
+        if (qatomic_read(&s->ret) == -EINPROGRESS) {
             if (copy_range) {
                 ret = convert_co_copy_range(s, sector_num, n);
                 if (ret) {
-                    s->copy_range = false;
+                    qatomic_set(&s->copy_range, false);
                     goto retry;
                 }
+            } else if (bounce) {
+                convert_co_copy_bounce(s, sector_num, n, buf);
+                ret = 0;
             } else {
                 ret = convert_co_write(s, sector_num, n, buf, status);
             }
             if (ret < 0) {
                 error_report("error while writing at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
-                s->ret = ret;
+                convert_set_error(s, ret);
             }
         }
 
         if (s->wr_in_order) {
-            /* reenter the coroutine that might have waited
-             * for this write to complete */
+            /* wake the coroutine that might wait for this write */
+            qemu_co_mutex_lock(&s->lock);
             s->wr_offs = sector_num + n;
             for (i = 0; i < s->num_coroutines; i++) {
                 if (s->co[i] && s->wait_sector_num[i] == s->wr_offs) {
-                    /*
-                     * A -> B -> A cannot occur because A has
-                     * s->wait_sector_num[i] == -1 during A -> B.  Therefore
-                     * B will never enter A during this time window.
-                     */
-                    qemu_coroutine_enter(s->co[i]);
+                    aio_co_wake(s->co[i]);
                     break;
                 }
             }
+            qemu_co_mutex_unlock(&s->lock);
         }
     }
 
     qemu_vfree(buf);
+    qemu_co_mutex_lock(&s->lock);
     s->co[index] = NULL;
-    s->running_coroutines--;
-    if (!s->running_coroutines && s->ret == -EINPROGRESS) {
-        /* the convert job finished successfully */
-        s->ret = 0;
+    if (qatomic_fetch_dec(&s->running_coroutines) == 1) {
+        /* the convert job finished successfully if nothing failed */
+        convert_set_error(s, 0);
+        /* convert_do_copy() may be waiting in another thread */
+        qemu_notify_event();
     }
+    qemu_co_mutex_unlock(&s->lock);
 }
 
 static int convert_do_copy(ImgConvertState *s)
@@ -2054,14 +2213,22 @@ static int convert_do_copy(ImgConvertState *s)
         s->has_zero_init = bdrv_has_zero_init(blk_bs(s->target));
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /*
+     * Allocate buffer for copied data. For compressed images, copy whole
+     * clusters; unless the target can compress several of them per request,
+     * only one cluster can be copied at a time.
+     */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        if (s->compressed_batches) {
+            s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors,
+                                             s->cluster_sectors);
+        } else {
+            s->buf_sectors = s->cluster_sectors;
+        }
     }
 
     while (sector_num < s->total_sectors) {
@@ -2081,15 +2248,25 @@ static int convert_do_copy(ImgConvertState *s)
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
+    if (s->num_threads > 1) {
+        convert_start_threads(s);
+    }
+    /* All coroutines must exist before the first one runs */
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
         s->wait_sector_num[i] = -1;
-        qemu_coroutine_enter(s->co[i]);
+    }
+    s->running_coroutines = s->num_coroutines;
+    for (i = 0; i < s->num_coroutines; i++) {
+        aio_co_enter(convert_co_aio_context(s, i), s->co[i]);
     }
 
-    while (s->running_coroutines) {
+    while (qatomic_read(&s->running_coroutines)) {
         main_loop_wait(false);
     }
+    if (s->threads) {
+        convert_stop_threads(s);
+    }
 
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
@@ -2208,6 +2385,7 @@ static int img_convert(int argc, char **argv)
         .buf_sectors        = IO_BUF_SIZE / BDRV_SECTOR_SIZE,
         .wr_in_order        = true,
         .num_coroutines     = 8,
+        .num_threads        = 1,
     };
 
     for(;;) {
@@ -2221,6 +2399,7 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"threads", required_argument, 0, OPTION_THREADS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:Cco:l:S:pt:T:qnm:WUr:",
@@ -2317,6 +2496,14 @@ static int img_convert(int argc, char **argv)
         case 'W':
             s.wr_in_order = false;
             break;
+        case OPTION_THREADS:
+            if (qemu_strtol(optarg, NULL, 0, &s.num_threads) ||
+                s.num_threads < 1 || s.num_threads > MAX_THREADS) {
+                error_report("Invalid number of threads. Allowed number of"
+                             " threads is between 1 and %d", MAX_THREADS);
+                goto fail_getopt;
+            }
+            break;
         case 'U':
             force_share = true;
             break;
@@ -2659,6 +2846,7 @@ static int img_convert(int argc, char **argv)
         ret = -1;
         goto out;
     }
+    s.compressed_batches = !!out_bs->drv->bdrv_co_pwritev_compressed_part;
 
     /* increase bufsectors from the default 4096 (2M) if opt_transfer
      * or discard_alignment of the out_bs is greater. Limit to
@@ -2716,6 +2904,34 @@ static int img_convert(int argc, char **argv)
         set_rate_limit(s.target, rate_limit);
     }
 
+    if (s.num_threads > 1) {
+        if (s.num_threads > s.num_coroutines) {
+            error_report("The number of threads may not exceed the number of "
+                         "coroutines");
+            ret = -1;
+            goto out;
+        }
+        if (rate_limit) {
+            error_report("Rate limiting cannot be combined with --threads");
+            ret = -1;
+            goto out;
+        }
+        for (bs_i = 0; bs_i < s.src_num; bs_i++) {
+            if (!bdrv_supports_multi_context(blk_bs(s.src[bs_i]))) {
+                error_report("Source image '%s' does not support --threads",
+                             argv[optind + bs_i]);
+                ret = -1;
+                goto out;
+            }
+        }
+        if (!bdrv_supports_multi_context(out_bs)) {
+            error_report("Target image '%s' does not support --threads",
+                         out_filename);
+            ret = -1;
+            goto out;
+        }
+    }
+
     ret = convert_do_copy(&s);
 
     /* Now copy the bitmaps */
@@ -3422,6 +3638,41 @@ static int img_snapshot(int argc, char **argv)
     return 0;
 }
 
+typedef struct RebaseCopyRangeCo {
+    BlockBackend *src;
+    BlockBackend *dst;
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+} RebaseCopyRangeCo;
+
+static void coroutine_fn rebase_co_copy_range_entry(void *opaque)
+{
+    RebaseCopyRangeCo *co = opaque;
+
+    co->ret = blk_co_copy_range(co->src, co->offset, co->dst, co->offset,
+                                co->bytes, 0, 0);
+    aio_wait_kick();
+}
+
+/* Copy @bytes at @offset from @src to @dst with copy offloading */
+static int rebase_copy_range(BlockBackend *src, BlockBackend *dst,
+                             int64_t offset, int64_t bytes)
+{
+    RebaseCopyRangeCo co = {
+        .src    = src,
+        .dst    = dst,
+        .offset = offset,
+        .bytes  = bytes,
+        .ret    = -EINPROGRESS,
+    };
+
+    qemu_coroutine_enter(qemu_coroutine_create(rebase_co_copy_range_entry,
+                                               &co));
+    AIO_WAIT_WHILE(blk_get_aio_context(dst), co.ret == -EINPROGRESS);
+    return co.ret;
+}
+
 static int img_rebase(int argc, char **argv)
 {
     BlockBackend *blk = NULL, *blk_old_backing = NULL, *blk_new_backing = NULL;
@@ -3437,6 +3688,7 @@ static int img_rebase(int argc, char **argv)
     bool force_share = false;
     int progress = 0;
     bool quiet = false;
+    bool copy_range = false;
     Error *local_err = NULL;
     bool image_opts = false;
 
@@ -3454,7 +3706,7 @@ static int img_rebase(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:b:upt:T:qU",
+        c = getopt_long(argc, argv, ":hf:F:b:upt:T:qUC",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -3502,6 +3754,9 @@ static int img_rebase(int argc, char **argv)
         case 'U':
             force_share = true;
             break;
+        case 'C':
+            copy_range = true;
+            break;
         }
     }
 
@@ -3509,6 +3764,11 @@ static int img_rebase(int argc, char **argv)
         progress = 0;
     }
 
+    if (copy_range && unsafe) {
+        error_report("Cannot use copy offloading in unsafe mode");
+        return 1;
+    }
+
     if (optind != argc - 1) {
         error_exit("Expecting one image file name");
     }
@@ -3778,7 +4038,14 @@ static int img_rebase(int argc, char **argv)
                 {
                     if (buf_old_is_zero) {
                         ret = blk_pwrite_zeroes(blk, offset + written, pnum, 0);
+                    } else if (copy_range &&
+                               rebase_copy_range(blk_old_backing, blk,
+                                                 offset + written,
+                                                 pnum) == 0) {
+                        ret = 0;
                     } else {
+                        /* Write the data for the rest of the image */
+                        copy_range = false;
                         ret = blk_pwrite(blk, offset + written,
                                          buf_old + written, pnum, 0);
                     }
@@ -4221,6 +4488,49 @@ out_no_progress:
     return 0;
 }
 
+/*
+ * Latencies are kept in a log-linear histogram: values below 16 ns have
+ * a bucket each, and every power of two above is split in 16 buckets,
+ * so that percentiles are within about 6% of the exact value.
+ */
+#define BENCH_LAT_SUB_BITS  4
+#define BENCH_LAT_BUCKETS \
+    ((64 - BENCH_LAT_SUB_BITS + 1) << BENCH_LAT_SUB_BITS)
+
+typedef struct BenchLatency {
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[BENCH_LAT_BUCKETS];
+} BenchLatency;
+
+/*
+ * Zipfian distribution, as in Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases"
+ */
+typedef struct BenchZipf {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} BenchZipf;
+
+typedef enum BenchAccess {
+    BENCH_ACCESS_SEQUENTIAL,
+    BENCH_ACCESS_RANDOM,
+    BENCH_ACCESS_ZIPF,
+} BenchAccess;
+
+typedef struct BenchRequest {
+    struct BenchData *b;
+    QEMUIOVector *qiov;
+    bool write;
+    int64_t start_ns;
+} BenchRequest;
+
 typedef struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
@@ -4234,11 +4544,129 @@ typedef struct BenchData {
     uint8_t *buf;
     QEMUIOVector *qiov;
 
+    BenchAccess access;
+    uint64_t nr_positions;
+    BenchZipf zipf;
+    int rwmix_read;
+    GRand *rand;
+
+    BenchRequest *reqs;
+    BenchRequest **free_reqs;
+    int nr_free_reqs;
+    BenchLatency lat[2];
+
     int in_flight;
     bool in_flush;
     uint64_t offset;
 } BenchData;
 
+static unsigned bench_lat_bucket(uint64_t ns)
+{
+    int shift;
+
+    if (ns < (1 << BENCH_LAT_SUB_BITS)) {
+        return ns;
+    }
+    shift = 63 - clz64(ns) - BENCH_LAT_SUB_BITS;
+    return ((shift + 1) << BENCH_LAT_SUB_BITS) +
+           ((ns >> shift) & ((1 << BENCH_LAT_SUB_BITS) - 1));
+}
+
+/* Highest value that falls in bucket @i */
+static uint64_t bench_lat_bucket_max(unsigned i)
+{
+    int shift;
+
+    if (i < (1 << BENCH_LAT_SUB_BITS)) {
+        return i;
+    }
+    shift = (i >> BENCH_LAT_SUB_BITS) - 1;
+    return (((uint64_t)(i & ((1 << BENCH_LAT_SUB_BITS) - 1)) +
+             (1 << BENCH_LAT_SUB_BITS) + 1) << shift) - 1;
+}
+
+static void bench_lat_add(BenchLatency *lat, uint64_t ns, int bytes)
+{
+    if (!lat->count || ns < lat->min) {
+        lat->min = ns;
+    }
+    lat->max = MAX(lat->max, ns);
+    lat->count++;
+    lat->bytes += bytes;
+    lat->sum += ns;
+    lat->buckets[bench_lat_bucket(ns)]++;
+}
+
+/* Return the latency below which @percent percent of the requests fall */
+static uint64_t bench_lat_percentile(BenchLatency *lat, double percent)
+{
+    uint64_t rank = ceil(lat->count * percent / 100);
+    uint64_t seen = 0;
+    unsigned i;
+
+    for (i = 0; i < BENCH_LAT_BUCKETS; i++) {
+        seen += lat->buckets[i];
+        if (seen >= MAX(rank, 1)) {
+            return MIN(bench_lat_bucket_max(i), lat->max);
+        }
+    }
+    return lat->max;
+}
+
+static void bench_zipf_init(BenchZipf *z, uint64_t n, double theta)
+{
+    uint64_t i;
+
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    for (i = 1; i <= n; i++) {
+        z->zetan += pow(i, -theta);
+    }
+    z->alpha = 1 / (1 - theta);
+    z->eta = (1 - pow(2.0 / n, 1 - theta)) /
+             (1 - (1 + pow(0.5, theta)) / z->zetan);
+}
+
+/* Return a position in [0, n), where lower positions are more likely */
+static uint64_t bench_zipf_next(BenchZipf *z, GRand *rand)
+{
+    double u = g_rand_double(rand);
+    double uz = u * z->zetan;
+    uint64_t ret;
+
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, z->theta)) {
+        return MIN(1, z->n - 1);
+    }
+    ret = z->n * pow(z->eta * u - z->eta + 1, z->alpha);
+    return MIN(ret, z->n - 1);
+}
+
+static uint64_t bench_next_offset(BenchData *b)
+{
+    uint64_t pos, offset = b->offset;
+
+    switch (b->access) {
+    case BENCH_ACCESS_SEQUENTIAL:
+        b->offset += b->step;
+        b->offset %= b->image_size;
+        return offset;
+    case BENCH_ACCESS_RANDOM:
+        pos = g_rand_double(b->rand) * b->nr_positions;
+        pos = MIN(pos, b->nr_positions - 1);
+        break;
+    case BENCH_ACCESS_ZIPF:
+        pos = bench_zipf_next(&b->zipf, b->rand);
+        break;
+    default:
+        abort();
+    }
+    return offset + pos * b->step;
+}
+
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
     if (ret < 0) {
@@ -4247,9 +4675,28 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
+static void bench_cb(void *opaque, int ret);
+
+static void bench_request_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+
+    if (ret < 0) {
+        error_report("Failed request: %s", strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+
+    bench_lat_add(&b->lat[req->write], get_clock() - req->start_ns,
+                  b->bufsize);
+    b->free_reqs[b->nr_free_reqs++] = req;
+    bench_cb(b, ret);
+}
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
+    BenchRequest *req;
     BlockAIOCB *acb;
 
     if (ret < 0) {
@@ -4292,18 +4739,24 @@ static void bench_cb(void *opaque, int ret)
     }
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
+        int64_t offset = bench_next_offset(b);
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        assert(b->nr_free_reqs > 0);
+        req = b->free_reqs[--b->nr_free_reqs];
+        req->write = b->write &&
+            (!b->rwmix_read || g_rand_int_range(b->rand, 0, 100) >=
+                               b->rwmix_read);
+        req->start_ns = get_clock();
+        if (req->write) {
+            acb = blk_aio_pwritev(b->blk, offset, req->qiov, 0,
+                                  bench_request_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, req->qiov, 0,
+                                 bench_request_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4312,6 +4765,75 @@ static void bench_cb(void *opaque, int ret)
     }
 }
 
+static const double bench_percentiles[] = { 50, 99, 99.9 };
+
+static void dump_human_bench_result(BenchData *b, double seconds)
+{
+    int i, j;
+
+    for (i = 0; i < 2; i++) {
+        BenchLatency *lat = &b->lat[i];
+
+        if (!lat->count) {
+            continue;
+        }
+        printf("%s: %" PRIu64 " requests, %.0f IOPS, %.2f MiB/s\n",
+               i ? "write" : "read", lat->count, lat->count / seconds,
+               lat->bytes / seconds / MiB);
+        printf("  latency (us): min %.1f, avg %.1f, max %.1f",
+               lat->min / 1000.0, (double)lat->sum / lat->count / 1000,
+               lat->max / 1000.0);
+        for (j = 0; j < ARRAY_SIZE(bench_percentiles); j++) {
+            printf(", p%g %.1f", bench_percentiles[j],
+                   bench_lat_percentile(lat, bench_percentiles[j]) / 1000.0);
+        }
+        printf("\n");
+    }
+}
+
+static void dump_json_bench_result(BenchData *b, double seconds)
+{
+    QDict *result = qdict_new();
+    GString *str;
+    int i, j;
+
+    qdict_put_int(result, "requests", b->lat[0].count + b->lat[1].count);
+    qdict_put(result, "seconds", qnum_from_double(seconds));
+
+    for (i = 0; i < 2; i++) {
+        BenchLatency *lat = &b->lat[i];
+        QDict *dict, *latency;
+
+        if (!lat->count) {
+            continue;
+        }
+
+        latency = qdict_new();
+        qdict_put_int(latency, "min", lat->min);
+        qdict_put_int(latency, "max", lat->max);
+        qdict_put_int(latency, "mean", lat->sum / lat->count);
+        for (j = 0; j < ARRAY_SIZE(bench_percentiles); j++) {
+            g_autofree char *name = g_strdup_printf("p%g",
+                                                    bench_percentiles[j]);
+
+            qdict_put_int(latency, name,
+                          bench_lat_percentile(lat, bench_percentiles[j]));
+        }
+
+        dict = qdict_new();
+        qdict_put_int(dict, "requests", lat->count);
+        qdict_put_int(dict, "bytes", lat->bytes);
+        qdict_put(dict, "iops", qnum_from_double(lat->count / seconds));
+        qdict_put(dict, "latency-ns", latency);
+        qdict_put(result, i ? "write" : "read", dict);
+    }
+
+    str = qobject_to_json_pretty(QOBJECT(result), true);
+    printf("%s\n", str->str);
+    g_string_free(str, true);
+    qobject_unref(result);
+}
+
 static int img_bench(int argc, char **argv)
 {
     int c, ret = 0;
@@ -4336,6 +4858,11 @@ static int img_bench(int argc, char **argv)
     int i;
     bool force_share = false;
     size_t buf_size;
+    BenchAccess access = BENCH_ACCESS_SEQUENTIAL;
+    double zipf_theta = 0;
+    int rwmix_read = 0;
+    OutputFormat output_format = OFORMAT_HUMAN;
+    double seconds;
 
     for (;;) {
         static const struct option long_options[] = {
@@ -4345,6 +4872,10 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"random", no_argument, 0, OPTION_RANDOM},
+            {"zipf", required_argument, 0, OPTION_ZIPF},
+            {"rwmix-read", required_argument, 0, OPTION_RWMIX_READ},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4478,6 +5009,40 @@ static int img_bench(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_RANDOM:
+            access = BENCH_ACCESS_RANDOM;
+            break;
+        case OPTION_ZIPF:
+            if (qemu_strtod(optarg, NULL, &zipf_theta) < 0 ||
+                !(zipf_theta > 0 && zipf_theta < 1)) {
+                error_report("Invalid zipf theta specified, it must be "
+                             "between 0 and 1");
+                return 1;
+            }
+            access = BENCH_ACCESS_ZIPF;
+            break;
+        case OPTION_RWMIX_READ:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid read percentage specified");
+                return 1;
+            }
+            rwmix_read = res;
+            break;
+        }
+        case OPTION_OUTPUT:
+            if (!strcmp(optarg, "json")) {
+                output_format = OFORMAT_JSON;
+            } else if (!strcmp(optarg, "human")) {
+                output_format = OFORMAT_HUMAN;
+            } else {
+                error_report("--output must be used with human or json "
+                             "as argument.");
+                return 1;
+            }
+            break;
         }
     }
 
@@ -4496,6 +5061,11 @@ static int img_bench(int argc, char **argv)
         ret = -1;
         goto out;
     }
+    if (!is_write && rwmix_read) {
+        error_report("--rwmix-read is only available in write tests");
+        ret = -1;
+        goto out;
+    }
 
     blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
                    force_share);
@@ -4521,13 +5091,49 @@ static int img_bench(int argc, char **argv)
         .write          = is_write,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
+        .access         = access,
+        .rwmix_read     = rwmix_read,
+        /* Use the same sequence of requests for each run */
+        .rand           = g_rand_new_with_seed(0),
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+
+    if (access != BENCH_ACCESS_SEQUENTIAL) {
+        if (offset + data.bufsize > image_size) {
+            error_report("Image too small for random requests");
+            ret = -1;
+            goto out;
+        }
+        data.nr_positions = (image_size - offset - data.bufsize) / data.step
+                            + 1;
+        if (access == BENCH_ACCESS_ZIPF) {
+            bench_zipf_init(&data.zipf, data.nr_positions, zipf_theta);
+        }
+    }
+
+    if (output_format == OFORMAT_HUMAN) {
+        printf("Sending %d %s requests, %d bytes each, %d in parallel ",
+               data.n, !data.write ? "read" : rwmix_read ? "mixed" : "write",
+               data.bufsize, data.nrreq);
+        switch (access) {
+        case BENCH_ACCESS_SEQUENTIAL:
+            printf("(starting at offset %" PRId64 ", step size %d)\n",
+                   data.offset, data.step);
+            break;
+        case BENCH_ACCESS_RANDOM:
+            printf("(random offsets from %" PRId64 ", step size %d)\n",
+                   data.offset, data.step);
+            break;
+        case BENCH_ACCESS_ZIPF:
+            printf("(zipfian offsets from %" PRId64 ", step size %d, "
+                   "theta %g)\n", data.offset, data.step, zipf_theta);
+            break;
+        }
+        if (rwmix_read) {
+            printf("Issuing %d%% of the requests as reads\n", rwmix_read);
+        }
+        if (flush_interval) {
+            printf("Sending flush every %d requests\n", flush_interval);
+        }
     }
 
     buf_size = data.nrreq * data.bufsize;
@@ -4537,11 +5143,19 @@ static int img_bench(int argc, char **argv)
     blk_register_buf(blk, data.buf, buf_size);
 
     data.qiov = g_new(QEMUIOVector, data.nrreq);
+    data.reqs = g_new(BenchRequest, data.nrreq);
+    data.free_reqs = g_new(BenchRequest *, data.nrreq);
     for (i = 0; i < data.nrreq; i++) {
         qemu_iovec_init(&data.qiov[i], 1);
         qemu_iovec_add(&data.qiov[i],
                        data.buf + i * data.bufsize, data.bufsize);
+        data.reqs[i] = (BenchRequest) {
+            .b      = &data,
+            .qiov   = &data.qiov[i],
+        };
+        data.free_reqs[i] = &data.reqs[i];
     }
+    data.nr_free_reqs = data.nrreq;
 
     gettimeofday(&t1, NULL);
     bench_cb(&data, 0);
@@ -4551,15 +5165,25 @@ static int img_bench(int argc, char **argv)
     }
     gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    seconds = (t2.tv_sec - t1.tv_sec)
+              + ((double)(t2.tv_usec - t1.tv_usec) / 1000000);
+    if (output_format == OFORMAT_JSON) {
+        dump_json_bench_result(&data, seconds);
+    } else {
+        printf("Run completed in %3.3f seconds.\n", seconds);
+        dump_human_bench_result(&data, seconds);
+    }
 
 out:
     if (data.buf) {
         blk_unregister_buf(blk, data.buf);
     }
     qemu_vfree(data.buf);
+    g_free(data.reqs);
+    g_free(data.free_reqs);
+    if (data.rand) {
+        g_rand_free(data.rand);
+    }
     blk_unref(blk);
 
     if (ret) {
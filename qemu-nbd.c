@@ -26,6 +26,7 @@
 #include "qemu/cutils.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/runstate.h" /* for qemu_system_killed() prototype */
+#include "sysemu/iothread.h"
 #include "block/block_int.h"
 #include "block/nbd.h"
 #include "qemu/main-loop.h"
@@ -64,6 +65,9 @@
 #define QEMU_NBD_OPT_FORK          263
 #define QEMU_NBD_OPT_TLSAUTHZ      264
 #define QEMU_NBD_OPT_PID_FILE      265
+#define QEMU_NBD_OPT_THREADS       266
+
+#define QEMU_NBD_MAX_THREADS       64
 
 #define MBR_SIZE 512
 
@@ -94,6 +98,7 @@ static void usage(const char *name)
 "  -k, --socket=PATH         path to the unix socket\n"
 "                            (default '"SOCKET_PATH"')\n"
 "  -e, --shared=NUM          device can be shared by NUM clients (default '1')\n"
+"      --threads=NUM         serve the clients from NUM I/O threads\n"
 "  -t, --persistent          don't exit on the last connection\n"
 "  -v, --verbose             display extra debugging information\n"
 "  -x, --export-name=NAME    expose export by name (default is empty string)\n"
@@ -532,6 +537,7 @@ int main(int argc, char **argv)
         { "trace", required_argument, NULL, 'T' },
         { "fork", no_argument, NULL, QEMU_NBD_OPT_FORK },
         { "pid-file", required_argument, NULL, QEMU_NBD_OPT_PID_FILE },
+        { "threads", required_argument, NULL, QEMU_NBD_OPT_THREADS },
         { NULL, 0, NULL, 0 }
     };
     int ch;
@@ -549,6 +555,8 @@ int main(int argc, char **argv)
     const char *export_name = NULL; /* defaults to "" later for server mode */
     const char *export_description = NULL;
     strList *bitmaps = NULL;
+    strList *client_iothreads = NULL;
+    unsigned threads = 0;
     bool alloc_depth = false;
     const char *tlscredsid = NULL;
     bool imageOpts = false;
@@ -747,6 +755,14 @@ int main(int argc, char **argv)
         case QEMU_NBD_OPT_PID_FILE:
             pid_file_name = optarg;
             break;
+        case QEMU_NBD_OPT_THREADS:
+            if (qemu_strtoui(optarg, NULL, 0, &threads) < 0 ||
+                threads < 1 || threads > QEMU_NBD_MAX_THREADS) {
+                error_report("Invalid number of threads '%s', must be "
+                             "between 1 and %d", optarg, QEMU_NBD_MAX_THREADS);
+                exit(EXIT_FAILURE);
+            }
+            break;
         }
     }
 
@@ -757,7 +773,8 @@ int main(int argc, char **argv)
         }
         if (export_name || export_description || dev_offset ||
             device || disconnect || fmt || sn_id_or_name || bitmaps ||
-            alloc_depth || seen_aio || seen_discard || seen_cache) {
+            alloc_depth || seen_aio || seen_discard || seen_cache ||
+            threads) {
             error_report("List mode is incompatible with per-device settings");
             exit(EXIT_FAILURE);
         }
@@ -1031,6 +1048,20 @@ int main(int argc, char **argv)
 
     nbd_server_is_qemu_nbd(true);
 
+    /* Created only now, threads don't survive --fork */
+    if (threads) {
+        strList **tail = &client_iothreads;
+        unsigned i;
+
+        for (i = 0; i < threads; i++) {
+            char *id = g_strdup_printf("qemu-nbd-iothread%u", i);
+
+            object_new_with_props(TYPE_IOTHREAD, object_get_objects_root(),
+                                  id, &error_fatal, NULL);
+            QAPI_LIST_APPEND(tail, id);
+        }
+    }
+
     export_opts = g_new(BlockExportOptions, 1);
     *export_opts = (BlockExportOptions) {
         .type               = BLOCK_EXPORT_TYPE_NBD,
@@ -1049,6 +1080,14 @@ int main(int argc, char **argv)
             .bitmaps              = bitmaps,
             .has_allocation_depth = alloc_depth,
             .allocation_depth     = alloc_depth,
+            /*
+             * Writers see each other's data as they share the BlockBackend,
+             * so multi-conn only depends on allowing several clients.
+             */
+            .has_multi_conn       = shared != 1,
+            .multi_conn           = true,
+            .has_client_iothreads = !!client_iothreads,
+            .client_iothreads     = client_iothreads,
         },
     };
     blk_exp_add(export_opts, &error_fatal);
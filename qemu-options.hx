@@ -145,7 +145,9 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                trace-threshold=n (retranslate TBs executed n times as traces)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-log-threads=n (threads merging KVM dirty bitmaps, default 0)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -179,6 +181,15 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``trace-threshold=n``
+        Counts how many times each translation block is executed, and
+        translates again as a trace the blocks that are executed ``n``
+        times.  Traces continue through direct jumps and past forward
+        conditional jumps, so that optimizations apply across guest
+        basic blocks; currently only
+        x86 guests form multi-block traces.  The default is 0, which
+        disables the execution counters.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -197,6 +208,13 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-log-threads=n``
+        When the KVM accelerator records dirty pages in a bitmap, each sync
+        of a large memory slot merges the bitmap into QEMU's dirty bitmaps
+        using up to n threads, one for every 64 GiB of the slot.  The
+        default value of 0 uses up to 8 threads, but no more than the
+        number of host CPUs.  Set it to 1 to merge from a single thread.
+
 ERST
 
 DEF("smp", HAS_ARG, QEMU_OPTION_smp,
@@ -1134,7 +1152,9 @@ SRST
             automatic conversion of plain zero writes by the OS to
             driver specific optimized zero write commands. You may even
             choose "unmap" if discard is set to "unmap" to allow a zero
-            write to be converted to an ``unmap`` operation.
+            write to be converted to an ``unmap`` operation.  For formats
+            that allocate storage in clusters, such as qcow2, zero
+            clusters inside larger writes are detected as well.
 
     ``Driver-specific options for file``
         This is the protocol-level block driver for accessing regular
@@ -2009,7 +2029,8 @@ DEF("spice", HAS_ARG, QEMU_OPTION_spice,
     "       [,image-compression=[auto_glz|auto_lz|quic|glz|lz|off]]\n"
     "       [,jpeg-wan-compression=[auto|never|always]]\n"
     "       [,zlib-glz-wan-compression=[auto|never|always]]\n"
-    "       [,streaming-video=[off|all|filter]][,disable-copy-paste=on|off]\n"
+    "       [,streaming-video=[off|all|filter]][,video-codecs=<encoder>:<codec>]\n"
+    "       [,disable-copy-paste=on|off]\n"
     "       [,disable-agent-file-xfer=on|off][,agent-mouse=[on|off]]\n"
     "       [,playback-compression=[on|off]][,seamless-migration=[on|off]]\n"
     "       [,gl=[on|off]][,rendernode=<file>]\n"
@@ -2096,6 +2117,15 @@ SRST
     ``streaming-video=[off|all|filter]``
         Configure video stream detection. Default is off.
 
+    ``video-codecs=<encoder>:<codec>[;<encoder>:<codec>...]``
+        Provide the preferred video encoders and codecs for the streams
+        detected with ``streaming-video``, for example
+        ``gstreamer:h264;gstreamer:vp8;spice:mjpeg``.  The GStreamer
+        encoders use whatever plugins are installed on the host, including
+        hardware encoders.  Combined with ``-display egl-headless``, this
+        also encodes the output of a virtio-gpu with GL or a vGPU.
+        Requires spice-server 0.13.2 or newer.
+
     ``agent-mouse=[on|off]``
         Enable/disable passing mouse events via vdagent. Default is on.
 
@@ -2571,7 +2601,11 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev tap,id=str[,fd=h][,fds=x:y:...:z][,ifname=name][,script=file][,downscript=dfile]\n"
     "         [,br=bridge][,helper=helper][,sndbuf=nbytes][,vnet_hdr=on|off][,vhost=on|off]\n"
     "         [,vhostfd=h][,vhostfds=x:y:...:z][,vhostforce=on|off][,queues=n]\n"
-    "         [,poll-us=n]\n"
+    "         [,poll-us=n]"
+#ifdef CONFIG_LINUX_IO_URING
+    "[,io-uring=on|off]"
+#endif
+    "\n"
     "                configure a host TAP network backend with ID 'str'\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
     "                use network scripts 'file' (default=" DEFAULT_NETWORK_SCRIPT ")\n"
@@ -2594,6 +2628,10 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'queues=n' to specify the number of queues to be created for multiqueue TAP\n"
     "                use 'poll-us=n' to specify the maximum number of microseconds that could be\n"
     "                spent on busy polling for vhost net\n"
+#ifdef CONFIG_LINUX_IO_URING
+    "                use 'io-uring=on' to keep several reads queued on the TAP device\n"
+    "                with io_uring instead of one read per packet\n"
+#endif
     "-netdev bridge,id=str[,br=bridge][,helper=helper]\n"
     "                configure a host TAP network backend with ID 'str' that is\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
@@ -2648,12 +2686,21 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m]\n"
+    "                attach to the existing network interface 'name' with AF_XDP socket\n"
+    "                use 'mode=MODE' to specify an XDP program attach mode\n"
+    "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
+    "                with 'queues=n' the number of queues to be used (default: 1)\n"
+    "                with 'start-queue=m' the first queue of the interface to use (default: 0)\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
 #endif
 #ifdef __linux__
-    "-netdev vhost-vdpa,id=str,vhostdev=/path/to/dev\n"
+    "-netdev vhost-vdpa,id=str,vhostdev=/path/to/dev[,x-svq=on|off]\n"
     "                configure a vhost-vdpa network,Establish a vhost-vdpa netdev\n"
 #endif
     "-netdev hubport,id=str,hubid=n[,netdev=nd]\n"
@@ -2672,6 +2719,9 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
 #endif
@@ -2701,7 +2751,7 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "                old way to initialize a host network interface\n"
     "                (use the -netdev option if possible instead)\n", QEMU_ARCH_ALL)
 SRST
-``-nic [tap|bridge|user|l2tpv3|vde|netmap|vhost-user|socket][,...][,mac=macaddr][,model=mn]``
+``-nic [tap|bridge|user|l2tpv3|vde|netmap|af-xdp|vhost-user|socket][,...][,mac=macaddr][,model=mn]``
     This option is a shortcut for configuring both the on-board
     (default) guest NIC hardware and the host network backend in one go.
     The host backend options are the same as with the corresponding
@@ -3115,6 +3165,31 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m]``
+    Configure AF_XDP backend to connect to a network interface 'name'
+    using AF_XDP socket.  A specified program attach mode for a default
+    XDP program will be forced if specified, otherwise the native mode
+    is tried first, falling back to 'skb'.  Zero-copy mode is used when
+    the driver supports it, unless 'force-copy=on' is given.
+
+    With 'queues=n', one AF_XDP socket is opened for each of the n
+    interface queues starting at 'start-queue', and each of them is
+    connected to the matching queue of a multiqueue virtio-net device.
+    The interface's receive traffic must be steered to those queues,
+    for example by limiting the number of channels with ethtool.  This
+    option is only available if QEMU has been compiled with AF_XDP
+    support enabled.
+
+    Example:
+
+    .. parsed-literal::
+
+        # set number of queues to 4
+        ethtool -L eth0 combined 4
+        # launch QEMU instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1,mq=on \\
+            -netdev af-xdp,id=n1,ifname=eth0,queues=4
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -3134,7 +3209,7 @@ SRST
              -netdev type=vhost-user,id=net0,chardev=chr0 \
              -device virtio-net-pci,netdev=net0
 
-``-netdev vhost-vdpa,vhostdev=/path/to/dev``
+``-netdev vhost-vdpa,vhostdev=/path/to/dev[,x-svq=on|off]``
     Establish a vhost-vdpa netdev.
 
     vDPA device is a device that uses a datapath which complies with
@@ -3142,6 +3217,10 @@ SRST
     vDPA devices can be both physically located on the hardware or
     emulated by software.
 
+    ``x-svq=on`` makes QEMU forward the virtqueues through rings of its
+    own, at some CPU cost, so that the guest can be live migrated.  It
+    is experimental and does not support a vIOMMU.
+
 ``-netdev hubport,id=id,hubid=hubid[,netdev=nd]``
     Create a hub port on the emulated hub with ID hubid.
 
@@ -3192,7 +3271,8 @@ DEF("chardev", HAS_ARG, QEMU_OPTION_chardev,
     "-chardev vc,id=id[[,width=width][,height=height]][[,cols=cols][,rows=rows]]\n"
     "         [,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev ringbuf,id=id[,size=size][,logfile=PATH][,logappend=on|off]\n"
-    "-chardev file,id=id,path=path[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
+    "-chardev file,id=id,path=path[,flush-interval=ms][,mux=on|off][,logfile=PATH]\n"
+    "         [,logappend=on|off]\n"
     "-chardev pipe,id=id,path=path[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
 #ifdef _WIN32
     "-chardev console,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
@@ -3397,13 +3477,19 @@ The available backends are:
     Create a ring buffer with fixed size ``size``. size must be a power
     of two and defaults to ``64K``.
 
-``-chardev file,id=id,path=path``
+``-chardev file,id=id,path=path[,flush-interval=ms]``
     Log all traffic received from the guest to a file.
 
     ``path`` specifies the path of the file to be opened. This file will
     be created if it does not already exist, and overwritten if it does.
     ``path`` is required.
 
+    ``flush-interval`` collects the output and writes it to the file at
+    most ``ms`` milliseconds later, instead of every time the guest
+    writes to the device.  This removes the main cost of heavy logging
+    to a serial console, which writes one byte at a time.  It defaults
+    to 0, which writes the output right away.
+
 ``-chardev pipe,id=id,path=path``
     Create a two-way connection to the guest. The behaviour differs
     slightly between Windows hosts and other hosts:
@@ -4619,7 +4705,7 @@ SRST
     they are specified. Note that the 'id' property must be set. These
     objects are placed in the '/objects' path.
 
-    ``-object memory-backend-file,id=id,size=size,mem-path=dir,share=on|off,discard-data=on|off,merge=on|off,dump=on|off,prealloc=on|off,host-nodes=host-nodes,policy=default|preferred|bind|interleave,align=align,readonly=on|off``
+    ``-object memory-backend-file,id=id,size=size,mem-path=dir,share=on|off,discard-data=on|off,merge=on|off,dump=on|off,prealloc=on|off,prealloc-threads=threads,prealloc-context=id,host-nodes=host-nodes,policy=default|preferred|bind|interleave,align=align,readonly=on|off``
         Creates a memory file backend object, which can be used to back
         the guest RAM with huge pages.
 
@@ -4662,6 +4748,20 @@ SRST
 
         The ``prealloc`` boolean option enables memory preallocation.
 
+        The ``prealloc-threads`` option specifies the number of threads
+        used for preallocation (default 1). Memory backends created on
+        the command line are preallocated concurrently, in the background
+        while the rest of the machine is created; QEMU waits for the
+        preallocation to complete before the guest can run. This
+        requires host support for MADV\_POPULATE\_WRITE (Linux 5.14 or
+        newer), otherwise the memory is preallocated while the backend
+        is created.
+
+        The ``prealloc-context`` option specifies the thread context
+        object used to create the preallocation threads, so that they
+        run on the host CPUs (for example of the NUMA node the memory
+        is bound to with ``host-nodes``) given by the context.
+
         The ``host-nodes`` option binds the memory range to a list of
         NUMA host nodes.
 
@@ -4737,6 +4837,43 @@ SRST
 
         The ``share`` boolean option is on by default with memfd.
 
+    ``-object thread-context,id=id,cpu-affinity=cpu-affinity,node-affinity=node-affinity``
+        Creates a thread context that can be used to create threads on
+        behalf of other parts of QEMU, such as memory preallocation
+        threads of memory backends (see ``prealloc-context``). New
+        threads inherit the CPU affinity of the thread context.
+
+        The ``cpu-affinity`` option is a list of host CPU numbers that
+        is used as the CPU affinity of the thread context; the
+        ``node-affinity`` option is a list of host NUMA nodes whose
+        CPUs are used instead. The two options cannot be combined. The
+        CPU affinity can also be changed by management tools through
+        the ``thread-id`` property of the context.
+
+        .. parsed-literal::
+
+             -object thread-context,id=tc1,node-affinity=0-1 \\
+             -object memory-backend-file,id=mem0,size=1T,mem-path=/dev/hugepages,prealloc=on,prealloc-threads=16,prealloc-context=tc1,host-nodes=0-1,policy=bind
+
+        Thread contexts can also place IOThreads (see the
+        ``thread-context`` option of ``iothread``) and vCPU threads.
+        Setting the ``thread-context`` property of a CPU gives its vCPU
+        thread the CPU affinity of the context before the vCPU runs. It
+        can be set for all CPUs with ``-global``, for hotplugged CPUs
+        with ``-device``, and for any CPU with ``qom-set``, for example
+        while the machine is still stopped with ``-S``. With
+        single-threaded TCG all vCPUs share one thread, so the last
+        affinity set wins.
+
+        .. parsed-literal::
+
+             -object thread-context,id=tc2,cpu-affinity=4 \\
+             -object iothread,id=iothread1,thread-context=tc2
+
+        ::
+
+            (qemu) qom-set /machine/unattached/device[0] thread-context tc2
+
     ``-object rng-builtin,id=id``
         Creates a random number generator backend which obtains entropy
         from QEMU builtin functions. The ``id`` parameter is a unique ID
@@ -5305,7 +5442,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,poll-cpu-budget=poll-cpu-budget,aio-max-batch=aio-max-batch,thread-pool-min=thread-pool-min,thread-pool-max=thread-pool-max,io-uring-sqpoll=on|off,io-uring-fixed=on|off,thread-context=id``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -5341,10 +5478,40 @@ SRST
         the polling time when the algorithm detects it is spending too
         long polling without encountering events.
 
+        The ``poll-cpu-budget`` parameter is the percentage of a CPU
+        (0 to 100) that polling may use; polling stops for the rest of
+        each 100 ms period once it is used up. It also caps the polling
+        time to twice what 90% of recently polled events needed. 0, the
+        default, means no limit. The polling statistics are reported by
+        ``query-iothreads``.
+
         The ``aio-max-batch`` parameter is the maximum number of requests
         in a batch for the AIO engine, 0 means that the engine will use
         its default.
 
+        The ``thread-pool-min`` and ``thread-pool-max`` parameters set the
+        number of worker threads of the IOThread's thread pool, which runs
+        blocking work such as ``aio=threads`` I/O and qcow2 compression and
+        encryption. ``thread-pool-min`` workers (default 0) are kept alive
+        even when idle, and at most ``thread-pool-max`` (default 64) are
+        created. Workers are created by the IOThread, or by other workers,
+        so they inherit the IOThread's CPU affinity and NUMA placement.
+
+        The ``io-uring-sqpoll`` and ``io-uring-fixed`` parameters tune the
+        io_uring used by block devices with ``aio=io_uring``.
+        ``io-uring-sqpoll=on`` lets a kernel thread poll for new requests,
+        so that submitting them needs no system call. ``io-uring-fixed=on``
+        registers guest RAM as fixed buffers and the image files as fixed
+        files; guest RAM is then pinned, which needs a large enough
+        ``RLIMIT_MEMLOCK``. Both fall back to normal operation if the
+        kernel refuses them, and neither can be changed once the io_uring
+        is in use.
+
+        The ``thread-context`` parameter names a ``thread-context`` object
+        that creates the IOThread, so that the IOThread and its thread
+        pool workers run with the CPU affinity of the context from the
+        start. It cannot be changed once the IOThread is running.
+
         The IOThread parameters can be modified at run-time using the
         ``qom-set`` command (where ``iothread1`` is the IOThread's
         ``id``):
@@ -24,17 +24,22 @@
 #include "qapi/qmp/qstring.h"
 #include "json-parser-int.h"
 
+/*
+ * Tokens are stored back to back in a single buffer, rather than
+ * allocated one by one; @size is the distance to the next token.
+ */
 struct JSONToken {
     JSONTokenType type;
     int x;
     int y;
+    size_t size;
     char str[];
 };
 
 typedef struct JSONParserContext {
     Error *err;
-    JSONToken *current;
-    GQueue *buf;
+    GByteArray *buf;
+    size_t pos;
     va_list *ap;
 } JSONParserContext;
 
@@ -216,6 +221,17 @@ static QString *parse_string(JSONParserContext *ctxt, JSONToken *token)
             }
             /* fall through */
         default:
+            /* Copy runs of printable ASCII characters in one go */
+            beg = ptr;
+            while (*ptr >= 0x20 && *ptr < 0x7F && *ptr != quote &&
+                   *ptr != '\\' && *ptr != '%') {
+                ptr++;
+            }
+            if (ptr > beg) {
+                g_string_append_len(str, beg, ptr - beg);
+                break;
+            }
+
             cp = mod_utf8_codepoint(ptr, 6, &end);
             if (cp < 0) {
                 parse_error(ctxt, token, "invalid UTF-8 sequence in string");
@@ -235,20 +251,26 @@ out:
     return NULL;
 }
 
-/* Note: the token object returned by parser_context_peek_token or
- * parser_context_pop_token is deleted as soon as parser_context_pop_token
- * is called again.
+/*
+ * Note: the token objects returned by parser_context_peek_token and
+ * parser_context_pop_token stay valid until json_parser_parse returns.
  */
-static JSONToken *parser_context_pop_token(JSONParserContext *ctxt)
+static JSONToken *parser_context_peek_token(JSONParserContext *ctxt)
 {
-    g_free(ctxt->current);
-    ctxt->current = g_queue_pop_head(ctxt->buf);
-    return ctxt->current;
+    if (ctxt->pos >= ctxt->buf->len) {
+        return NULL;
+    }
+    return (JSONToken *)(ctxt->buf->data + ctxt->pos);
 }
 
-static JSONToken *parser_context_peek_token(JSONParserContext *ctxt)
+static JSONToken *parser_context_pop_token(JSONParserContext *ctxt)
 {
-    return g_queue_peek_head(ctxt->buf);
+    JSONToken *token = parser_context_peek_token(ctxt);
+
+    if (token) {
+        ctxt->pos += token->size;
+    }
+    return token;
 }
 
 /**
@@ -559,32 +581,33 @@ static QObject *parse_value(JSONParserContext *ctxt)
     }
 }
 
-JSONToken *json_token(JSONTokenType type, int x, int y, GString *tokstr)
+void json_token_append(GByteArray *tokens, JSONTokenType type, int x, int y,
+                       GString *tokstr)
 {
-    JSONToken *token = g_malloc(sizeof(JSONToken) + tokstr->len + 1);
+    size_t pos = tokens->len;
+    size_t size = ROUND_UP(sizeof(JSONToken) + tokstr->len + 1,
+                           __alignof__(JSONToken));
+    JSONToken *token;
 
+    g_byte_array_set_size(tokens, pos + size);
+    token = (JSONToken *)(tokens->data + pos);
     token->type = type;
-    memcpy(token->str, tokstr->str, tokstr->len);
-    token->str[tokstr->len] = 0;
     token->x = x;
     token->y = y;
-    return token;
+    token->size = size;
+    memcpy(token->str, tokstr->str, tokstr->len);
+    token->str[tokstr->len] = 0;
 }
 
-QObject *json_parser_parse(GQueue *tokens, va_list *ap, Error **errp)
+QObject *json_parser_parse(GByteArray *tokens, va_list *ap, Error **errp)
 {
     JSONParserContext ctxt = { .buf = tokens, .ap = ap };
     QObject *result;
 
     result = parse_value(&ctxt);
-    assert(ctxt.err || g_queue_is_empty(ctxt.buf));
+    assert(ctxt.err || ctxt.pos == tokens->len);
 
     error_propagate(errp, ctxt.err);
 
-    while (!g_queue_is_empty(ctxt.buf)) {
-        parser_context_pop_token(&ctxt);
-    }
-    g_free(ctxt.current);
-
     return result;
 }
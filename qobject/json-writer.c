@@ -84,19 +84,27 @@ static bool in_object(JSONWriter *writer)
     return depth && !writer->container_is_array->data[depth - 1];
 }
 
+static void append_indent(JSONWriter *writer)
+{
+    gsize len = writer->contents->len;
+    gsize indent = writer->container_is_array->len * 4;
+
+    g_string_set_size(writer->contents, len + 1 + indent);
+    writer->contents->str[len] = '\n';
+    memset(writer->contents->str + len + 1, ' ', indent);
+}
+
 static void pretty_newline(JSONWriter *writer)
 {
     if (writer->pretty) {
-        g_string_append_printf(writer->contents, "\n%*s",
-                               writer->container_is_array->len * 4, "");
+        append_indent(writer);
     }
 }
 
 static void pretty_newline_or_space(JSONWriter *writer)
 {
     if (writer->pretty) {
-        g_string_append_printf(writer->contents, "\n%*s",
-                               writer->container_is_array->len * 4, "");
+        append_indent(writer);
     } else {
         g_string_append_c(writer->contents, ' ');
     }
@@ -111,6 +119,16 @@ static void quoted_str(JSONWriter *writer, const char *str)
     g_string_append_c(writer->contents, '"');
 
     for (ptr = str; *ptr; ptr = end) {
+        /* Copy runs of characters that need no escaping in one go */
+        end = (char *)ptr;
+        while (*end >= 0x20 && *end < 0x7F && *end != '"' && *end != '\\') {
+            end++;
+        }
+        if (end > ptr) {
+            g_string_append_len(writer->contents, ptr, end - ptr);
+            continue;
+        }
+
         cp = mod_utf8_codepoint(ptr, 6, &end);
         switch (cp) {
         case '\"':
@@ -212,16 +230,31 @@ void json_writer_null(JSONWriter *writer, const char *name)
     g_string_append(writer->contents, "null");
 }
 
+static void append_uint64(JSONWriter *writer, bool negative, uint64_t val)
+{
+    char buf[21];
+    char *p = buf + sizeof(buf);
+
+    do {
+        *--p = '0' + val % 10;
+        val /= 10;
+    } while (val);
+    if (negative) {
+        *--p = '-';
+    }
+    g_string_append_len(writer->contents, p, buf + sizeof(buf) - p);
+}
+
 void json_writer_int64(JSONWriter *writer, const char *name, int64_t val)
 {
     maybe_comma_name(writer, name);
-    g_string_append_printf(writer->contents, "%" PRId64, val);
+    append_uint64(writer, val < 0, val < 0 ? -(uint64_t)val : val);
 }
 
 void json_writer_uint64(JSONWriter *writer, const char *name, uint64_t val)
 {
     maybe_comma_name(writer, name);
-    g_string_append_printf(writer->contents, "%" PRIu64, val);
+    append_uint64(writer, false, val);
 }
 
 void json_writer_double(JSONWriter *writer, const char *name, double val)
@@ -245,3 +278,13 @@ void json_writer_str(JSONWriter *writer, const char *name, const char *str)
     maybe_comma_name(writer, name);
     quoted_str(writer, str);
 }
+
+/*
+ * Append @json, a complete value produced by another JSONWriter, as an
+ * element of the current container.
+ */
+void json_writer_raw(JSONWriter *writer, const char *name, const char *json)
+{
+    maybe_comma_name(writer, name);
+    g_string_append(writer->contents, json);
+}
@@ -351,6 +351,8 @@ static void type_initialize(TypeImpl *ti)
 
     ti->class->properties = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
                                                   object_property_free);
+    ti->class->properties_cache = NULL;
+    ti->class->properties_cached_by_subclass = false;
 
     ti->class->type = ti;
 
@@ -1250,6 +1252,26 @@ object_property_add(Object *obj, const char *name, const char *type,
                                    opaque, &error_abort);
 }
 
+static void object_class_drop_properties_cache(ObjectClass *klass)
+{
+    GHashTable *cache = qatomic_xchg(&klass->properties_cache, NULL);
+
+    if (cache) {
+        g_hash_table_unref(cache);
+    }
+}
+
+static void type_drop_properties_cache(gpointer key, gpointer value,
+                                       gpointer opaque)
+{
+    TypeImpl *type = value;
+    TypeImpl *ancestor = opaque;
+
+    if (type->class && type_is_ancestor(type, ancestor)) {
+        object_class_drop_properties_cache(type->class);
+    }
+}
+
 ObjectProperty *
 object_class_property_add(ObjectClass *klass,
                           const char *name,
@@ -1275,15 +1297,64 @@ object_class_property_add(ObjectClass *klass,
 
     g_hash_table_insert(klass->properties, prop->name, prop);
 
+    /*
+     * Class properties are normally added by class_init, before any
+     * cache exists; in the rare case they are added later, throw away
+     * the caches that are now out of date.
+     */
+    object_class_drop_properties_cache(klass);
+    if (klass->properties_cached_by_subclass) {
+        g_hash_table_foreach(type_table_get(), type_drop_properties_cache,
+                             klass->type);
+    }
+
     return prop;
 }
 
+/*
+ * Return a table with the properties of @klass and all its ancestors,
+ * so that looking up a property takes a single hash table lookup
+ * instead of one per class in the hierarchy.  Only used for lookups on
+ * instances of @klass, because class_init has run by then for @klass
+ * and all its ancestors and their set of properties is unlikely to
+ * change.
+ */
+static GHashTable *object_class_get_properties_cache(ObjectClass *klass)
+{
+    GHashTable *cache = qatomic_rcu_read(&klass->properties_cache);
+    GHashTableIter iter;
+    gpointer key, value;
+    ObjectClass *k;
+
+    if (cache) {
+        return cache;
+    }
+
+    cache = g_hash_table_new(g_str_hash, g_str_equal);
+    for (k = klass; k; k = object_class_get_parent(k)) {
+        g_hash_table_iter_init(&iter, k->properties);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            g_hash_table_insert(cache, key, value);
+        }
+        if (k != klass) {
+            k->properties_cached_by_subclass = true;
+        }
+    }
+
+    /* Another thread may have built the same cache concurrently */
+    if (qatomic_cmpxchg(&klass->properties_cache, NULL, cache)) {
+        g_hash_table_unref(cache);
+        cache = qatomic_rcu_read(&klass->properties_cache);
+    }
+    return cache;
+}
+
 ObjectProperty *object_property_find(Object *obj, const char *name)
 {
     ObjectProperty *prop;
     ObjectClass *klass = object_get_class(obj);
 
-    prop = object_class_property_find(klass, name);
+    prop = g_hash_table_lookup(object_class_get_properties_cache(klass), name);
     if (prop) {
         return prop;
     }
@@ -15,6 +15,7 @@
 #include "replay-internal.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/bswap.h"
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -60,31 +61,58 @@ void replay_put_event(uint8_t event)
 }
 
 
+/*
+ * Multi-byte values are stored big-endian.  Write and read them with a
+ * single stdio call each, rather than one call (and one stream lock)
+ * per byte.
+ */
+static void replay_put_bytes(const uint8_t *buf, size_t size)
+{
+    if (replay_file) {
+        if (fwrite(buf, 1, size, replay_file) != size) {
+            replay_write_error();
+        }
+    }
+}
+
+static void replay_get_bytes(uint8_t *buf, size_t size)
+{
+    if (replay_file) {
+        if (fread(buf, 1, size, replay_file) != size) {
+            replay_read_error();
+        }
+    }
+}
+
 void replay_put_word(uint16_t word)
 {
-    replay_put_byte(word >> 8);
-    replay_put_byte(word);
+    uint8_t buf[2];
+
+    stw_be_p(buf, word);
+    replay_put_bytes(buf, sizeof(buf));
 }
 
 void replay_put_dword(uint32_t dword)
 {
-    replay_put_word(dword >> 16);
-    replay_put_word(dword);
+    uint8_t buf[4];
+
+    stl_be_p(buf, dword);
+    replay_put_bytes(buf, sizeof(buf));
 }
 
 void replay_put_qword(int64_t qword)
 {
-    replay_put_dword(qword >> 32);
-    replay_put_dword(qword);
+    uint8_t buf[8];
+
+    stq_be_p(buf, qword);
+    replay_put_bytes(buf, sizeof(buf));
 }
 
 void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
-        }
+        replay_put_bytes(buf, size);
     }
 }
 
@@ -103,44 +131,33 @@ uint8_t replay_get_byte(void)
 
 uint16_t replay_get_word(void)
 {
-    uint16_t word = 0;
-    if (replay_file) {
-        word = replay_get_byte();
-        word = (word << 8) + replay_get_byte();
-    }
+    uint8_t buf[2] = { 0 };
 
-    return word;
+    replay_get_bytes(buf, sizeof(buf));
+    return lduw_be_p(buf);
 }
 
 uint32_t replay_get_dword(void)
 {
-    uint32_t dword = 0;
-    if (replay_file) {
-        dword = replay_get_word();
-        dword = (dword << 16) + replay_get_word();
-    }
+    uint8_t buf[4] = { 0 };
 
-    return dword;
+    replay_get_bytes(buf, sizeof(buf));
+    return ldl_be_p(buf);
 }
 
 int64_t replay_get_qword(void)
 {
-    int64_t qword = 0;
-    if (replay_file) {
-        qword = replay_get_dword();
-        qword = (qword << 32) + replay_get_dword();
-    }
+    uint8_t buf[8] = { 0 };
 
-    return qword;
+    replay_get_bytes(buf, sizeof(buf));
+    return ldq_be_p(buf);
 }
 
 void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(buf, *size);
     }
 }
 
@@ -149,9 +166,7 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(*buf, *size);
     }
 }
 
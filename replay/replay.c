@@ -10,6 +10,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "sysemu/cpu-timers.h"
 #include "sysemu/replay.h"
@@ -25,12 +26,15 @@
 #define REPLAY_VERSION              0xe0200a
 /* Size of replay log header */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+/* Size of the stdio buffer of the replay log */
+#define REPLAY_FILE_BUFFER_SIZE     (1 * MiB)
 
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
 
 /* Name of replay file  */
 static char *replay_filename;
+static char *replay_file_buffer;
 ReplayState replay_state;
 static GSList *replay_blockers;
 
@@ -264,6 +268,12 @@ static void replay_enable(const char *fname, int mode)
         fprintf(stderr, "Replay: open %s: %s\n", fname, strerror(errno));
         exit(1);
     }
+    /*
+     * Events are small and frequent; a large buffer keeps the log from
+     * turning into a stream of tiny reads and writes.
+     */
+    replay_file_buffer = g_malloc(REPLAY_FILE_BUFFER_SIZE);
+    setvbuf(replay_file, replay_file_buffer, _IOFBF, REPLAY_FILE_BUFFER_SIZE);
 
     replay_filename = g_strdup(fname);
     replay_mode = mode;
@@ -379,6 +389,8 @@ void replay_finish(void)
         fclose(replay_file);
         replay_file = NULL;
     }
+    g_free(replay_file_buffer);
+    replay_file_buffer = NULL;
     if (replay_filename) {
         g_free(replay_filename);
         replay_filename = NULL;
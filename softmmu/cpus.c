@@ -34,6 +34,8 @@
 #include "sysemu/hw_accel.h"
 #include "exec/exec-all.h"
 #include "qemu/thread.h"
+#include "qemu/thread-context.h"
+#include "qemu/error-report.h"
 #include "qemu/plugin.h"
 #include "sysemu/cpus.h"
 #include "qemu/guest-random.h"
@@ -632,6 +634,17 @@ void qemu_init_vcpu(CPUState *cpu)
     while (!cpu->created) {
         qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
     }
+
+    /* The vCPU has not run any guest code yet */
+    if (cpu->thread_context) {
+        int ret = thread_context_set_thread_affinity(cpu->thread_context,
+                                                     cpu->thread);
+
+        if (ret) {
+            warn_report("Setting CPU affinity of vCPU %d failed: %s",
+                        cpu->cpu_index, strerror(ret));
+        }
+    }
 }
 
 void cpu_stop_current(void)
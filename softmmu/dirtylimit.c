@@ -0,0 +1,370 @@
+/*
+ * Per-vCPU dirty page rate limit
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/main-loop.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-migration.h"
+#include "qapi/qmp/qdict.h"
+#include "hw/boards.h"
+#include "hw/core/cpu.h"
+#include "exec/memory.h"
+#include "sysemu/kvm.h"
+#include "sysemu/dirtylimit.h"
+#include "monitor/hmp.h"
+#include "monitor/monitor.h"
+#include "trace.h"
+
+/* Period over which the dirty page rate of the vCPUs is measured */
+#define DIRTYLIMIT_CALC_PERIOD_MS   1000
+/* Cycle of the timer making the limited vCPUs sleep */
+#define DIRTYLIMIT_TIMESLICE_NS     10000000
+#define DIRTYLIMIT_THROTTLE_PCT_MAX 99
+
+typedef struct VcpuDirtyLimitState {
+    /* Dirty page rate quota in MB/s, 0 if the vCPU is not limited */
+    uint64_t quota;
+    /* Dirty page rate measured over the last period, in bytes/s */
+    uint64_t current_rate;
+    /* CPUState::dirty_pages at the start of the period */
+    uint64_t start_pages;
+} VcpuDirtyLimitState;
+
+typedef struct DirtyLimitState {
+    VcpuDirtyLimitState *states;
+    int max_cpus;
+    /* Number of vCPUs that have a quota */
+    int limited_nvcpu;
+    int64_t period_start_ms;
+    QEMUTimer *timer;
+    QemuThread thread;
+    QemuSemaphore quit_sem;
+} DirtyLimitState;
+
+/* Protected by the BQL */
+static DirtyLimitState *dirtylimit_state;
+
+bool dirtylimit_in_service(void)
+{
+    return dirtylimit_state && dirtylimit_state->limited_nvcpu;
+}
+
+static void dirtylimit_period_start(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        dirtylimit_state->states[cpu->cpu_index].start_pages =
+            cpu->dirty_pages;
+    }
+    dirtylimit_state->period_start_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+}
+
+/*
+ * The dirty page rate of a vCPU is proportional to the share of time it
+ * runs, so scale that share by quota / rate to bring the rate to the quota.
+ * Average with the previous value to smooth the measurement noise.
+ */
+static void dirtylimit_adjust_throttle(CPUState *cpu,
+                                       VcpuDirtyLimitState *state)
+{
+    unsigned int old_pct = qatomic_read(&cpu->dirtylimit_throttle_pct);
+    double run, quota = (double)state->quota * MiB;
+    unsigned int pct;
+
+    if (!state->current_rate) {
+        pct = 0;
+    } else {
+        run = (100.0 - old_pct) * quota / state->current_rate;
+        run = MIN(run, 100.0);
+        pct = MIN(100 - (unsigned int)run, DIRTYLIMIT_THROTTLE_PCT_MAX);
+        pct = (pct + old_pct) / 2;
+    }
+
+    trace_dirtylimit_adjust_throttle(cpu->cpu_index, state->quota,
+                                     state->current_rate / MiB, pct);
+    qatomic_set(&cpu->dirtylimit_throttle_pct, pct);
+}
+
+static void dirtylimit_period_end(void)
+{
+    int64_t period = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                     dirtylimit_state->period_start_ms;
+    VcpuDirtyLimitState *state;
+    CPUState *cpu;
+
+    /* Collect the pages still sitting in the dirty rings */
+    memory_global_dirty_log_sync(false);
+
+    CPU_FOREACH(cpu) {
+        state = &dirtylimit_state->states[cpu->cpu_index];
+        state->current_rate = (cpu->dirty_pages - state->start_pages) *
+                              qemu_real_host_page_size * 1000 /
+                              MAX(period, 1);
+        if (state->quota) {
+            dirtylimit_adjust_throttle(cpu, state);
+        }
+    }
+}
+
+static void *dirtylimit_calc_thread(void *opaque)
+{
+    DirtyLimitState *s = opaque;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock_iothread();
+    dirtylimit_period_start();
+    qemu_mutex_unlock_iothread();
+
+    while (qemu_sem_timedwait(&s->quit_sem, DIRTYLIMIT_CALC_PERIOD_MS)) {
+        qemu_mutex_lock_iothread();
+        dirtylimit_period_end();
+        dirtylimit_period_start();
+        qemu_mutex_unlock_iothread();
+    }
+
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+static void dirtylimit_vcpu_sleep(CPUState *cpu, run_on_cpu_data opaque)
+{
+    unsigned int pct = qatomic_read(&cpu->dirtylimit_throttle_pct);
+    int64_t sleeptime_ns, endtime_ns;
+
+    sleeptime_ns = (int64_t)DIRTYLIMIT_TIMESLICE_NS * pct / 100;
+    endtime_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + sleeptime_ns;
+    while (sleeptime_ns > 0 && !cpu->stop) {
+        if (sleeptime_ns > SCALE_MS) {
+            qemu_cond_timedwait_iothread(cpu->halt_cond,
+                                         sleeptime_ns / SCALE_MS);
+        } else {
+            qemu_mutex_unlock_iothread();
+            g_usleep(sleeptime_ns / SCALE_US);
+            qemu_mutex_lock_iothread();
+        }
+        sleeptime_ns = endtime_ns - qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
+    qatomic_set(&cpu->dirtylimit_thread_scheduled, 0);
+}
+
+static void dirtylimit_timer_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (qatomic_read(&cpu->dirtylimit_throttle_pct) &&
+            !qatomic_xchg(&cpu->dirtylimit_thread_scheduled, 1)) {
+            async_run_on_cpu(cpu, dirtylimit_vcpu_sleep, RUN_ON_CPU_NULL);
+        }
+    }
+
+    timer_mod(dirtylimit_state->timer,
+              qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
+              DIRTYLIMIT_TIMESLICE_NS);
+}
+
+static void dirtylimit_state_init(void)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    DirtyLimitState *s = g_new0(DirtyLimitState, 1);
+
+    s->max_cpus = ms->smp.max_cpus;
+    s->states = g_new0(VcpuDirtyLimitState, s->max_cpus);
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL_RT, dirtylimit_timer_tick,
+                            NULL);
+    qemu_sem_init(&s->quit_sem, 0);
+    dirtylimit_state = s;
+
+    memory_global_dirty_log_start(GLOBAL_DIRTY_LIMIT);
+    qemu_thread_create(&s->thread, "dirtylimit", dirtylimit_calc_thread, s,
+                       QEMU_THREAD_JOINABLE);
+    dirtylimit_timer_tick(NULL);
+}
+
+static void dirtylimit_state_finalize(void)
+{
+    DirtyLimitState *s = dirtylimit_state;
+
+    /* The measurement thread takes the BQL */
+    qemu_sem_post(&s->quit_sem);
+    qemu_mutex_unlock_iothread();
+    qemu_thread_join(&s->thread);
+    qemu_mutex_lock_iothread();
+
+    memory_global_dirty_log_stop(GLOBAL_DIRTY_LIMIT);
+    timer_free(s->timer);
+    qemu_sem_destroy(&s->quit_sem);
+    g_free(s->states);
+    g_free(s);
+    dirtylimit_state = NULL;
+}
+
+static void dirtylimit_set_vcpu(CPUState *cpu, uint64_t quota)
+{
+    VcpuDirtyLimitState *state = &dirtylimit_state->states[cpu->cpu_index];
+
+    if (!state->quota && quota) {
+        dirtylimit_state->limited_nvcpu++;
+    } else if (state->quota && !quota) {
+        dirtylimit_state->limited_nvcpu--;
+        qatomic_set(&cpu->dirtylimit_throttle_pct, 0);
+    }
+    state->quota = quota;
+    trace_dirtylimit_set_vcpu(cpu->cpu_index, quota);
+}
+
+static bool dirtylimit_get_cpus(bool has_cpu_index, int64_t cpu_index,
+                                CPUState **cpu, Error **errp)
+{
+    if (!has_cpu_index) {
+        *cpu = NULL;
+        return true;
+    }
+
+    *cpu = qemu_get_cpu(cpu_index);
+    if (!*cpu) {
+        error_setg(errp, "invalid cpu-index %" PRId64, cpu_index);
+        return false;
+    }
+    return true;
+}
+
+void qmp_set_vcpu_dirty_limit(bool has_cpu_index, int64_t cpu_index,
+                              uint64_t dirty_rate, Error **errp)
+{
+    CPUState *cpu;
+
+    if (!kvm_enabled() || !kvm_dirty_ring_enabled()) {
+        error_setg(errp, "dirty page limit requires KVM with dirty ring "
+                   "enabled");
+        return;
+    }
+
+    if (!dirty_rate) {
+        error_setg(errp, "dirty-rate must be greater than 0, use "
+                   "cancel-vcpu-dirty-limit to remove a limit");
+        return;
+    }
+
+    if (!dirtylimit_get_cpus(has_cpu_index, cpu_index, &cpu, errp)) {
+        return;
+    }
+
+    if (!dirtylimit_state) {
+        dirtylimit_state_init();
+    }
+
+    if (cpu) {
+        dirtylimit_set_vcpu(cpu, dirty_rate);
+    } else {
+        CPU_FOREACH(cpu) {
+            dirtylimit_set_vcpu(cpu, dirty_rate);
+        }
+    }
+}
+
+void qmp_cancel_vcpu_dirty_limit(bool has_cpu_index, int64_t cpu_index,
+                                 Error **errp)
+{
+    CPUState *cpu;
+
+    if (!dirtylimit_get_cpus(has_cpu_index, cpu_index, &cpu, errp)) {
+        return;
+    }
+
+    if (!dirtylimit_state) {
+        return;
+    }
+
+    if (cpu) {
+        dirtylimit_set_vcpu(cpu, 0);
+    } else {
+        CPU_FOREACH(cpu) {
+            dirtylimit_set_vcpu(cpu, 0);
+        }
+    }
+
+    if (!dirtylimit_state->limited_nvcpu) {
+        dirtylimit_state_finalize();
+    }
+}
+
+DirtyLimitInfoList *qmp_query_vcpu_dirty_limit(Error **errp)
+{
+    DirtyLimitInfoList *head = NULL, **tail = &head;
+    VcpuDirtyLimitState *state;
+    DirtyLimitInfo *info;
+    CPUState *cpu;
+
+    if (!dirtylimit_state) {
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        state = &dirtylimit_state->states[cpu->cpu_index];
+        if (!state->quota) {
+            continue;
+        }
+        info = g_new0(DirtyLimitInfo, 1);
+        info->cpu_index = cpu->cpu_index;
+        info->limit_rate = state->quota;
+        info->current_rate = state->current_rate / MiB;
+        QAPI_LIST_APPEND(tail, info);
+    }
+
+    return head;
+}
+
+void hmp_info_vcpu_dirty_limit(Monitor *mon, const QDict *qdict)
+{
+    DirtyLimitInfoList *info, *head = qmp_query_vcpu_dirty_limit(NULL);
+
+    if (!head) {
+        monitor_printf(mon, "Dirty page limit not enabled!\n");
+        return;
+    }
+
+    for (info = head; info != NULL; info = info->next) {
+        monitor_printf(mon, "vcpu[%"PRIi64"], limit rate %"PRIu64" (MB/s),"
+                       " current rate %"PRIu64" (MB/s)\n",
+                       info->value->cpu_index,
+                       info->value->limit_rate,
+                       info->value->current_rate);
+    }
+
+    qapi_free_DirtyLimitInfoList(head);
+}
+
+void hmp_set_vcpu_dirty_limit(Monitor *mon, const QDict *qdict)
+{
+    int64_t dirty_rate = qdict_get_int(qdict, "dirty_rate");
+    int64_t cpu_index = qdict_get_try_int(qdict, "cpu_index", -1);
+    Error *err = NULL;
+
+    if (dirty_rate <= 0) {
+        monitor_printf(mon, "dirty_rate must be greater than 0\n");
+        return;
+    }
+
+    qmp_set_vcpu_dirty_limit(cpu_index != -1, cpu_index, dirty_rate, &err);
+    hmp_handle_error(mon, err);
+}
+
+void hmp_cancel_vcpu_dirty_limit(Monitor *mon, const QDict *qdict)
+{
+    int64_t cpu_index = qdict_get_try_int(qdict, "cpu_index", -1);
+    Error *err = NULL;
+
+    qmp_cancel_vcpu_dirty_limit(cpu_index != -1, cpu_index, &err);
+    hmp_handle_error(mon, err);
+}
@@ -39,7 +39,18 @@
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
-bool global_dirty_log;
+unsigned int global_dirty_tracking;
+
+/*
+ * Every change to a MemoryRegion that can affect the FlatViews stamps the
+ * region with a new sequence number.  A FlatView only needs to be rendered
+ * again if a region below its root has a stamp newer than the view, see
+ * flatview_is_stale().  Changes that affect all views, such as starting
+ * global dirty logging, bump memory_region_global_change_seq instead.
+ */
+static uint64_t memory_region_change_seq;
+static uint64_t memory_region_global_change_seq;
+static unsigned memory_region_subtree_gen;
 
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
@@ -725,12 +736,70 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
 }
 
 /* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+static void memory_region_changed(MemoryRegion *mr)
+{
+    mr->change_seq = ++memory_region_change_seq;
+}
+
+/*
+ * Return the newest change stamp of @mr and everything reachable from
+ * it, including alias targets.  The result is cached for the duration
+ * of a single flatviews_reset(), since regions can be reached from
+ * several roots and several times within a root.
+ */
+static uint64_t memory_region_subtree_change_seq(MemoryRegion *mr)
+{
+    MemoryRegion *subregion;
+    uint64_t seq;
+
+    if (mr->subtree_gen == memory_region_subtree_gen) {
+        return mr->subtree_seq;
+    }
+
+    seq = mr->change_seq;
+    if (mr->alias) {
+        seq = MAX(seq, memory_region_subtree_change_seq(mr->alias));
+    }
+    QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
+        seq = MAX(seq, memory_region_subtree_change_seq(subregion));
+    }
+
+    mr->subtree_gen = memory_region_subtree_gen;
+    mr->subtree_seq = seq;
+    return seq;
+}
+
+static bool flatview_is_stale(FlatView *view)
+{
+    if (view->render_seq < memory_region_global_change_seq) {
+        return true;
+    }
+    return view->root &&
+           memory_region_subtree_change_seq(view->root) > view->render_seq;
+}
+
+static bool flatview_ranges_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i]) ||
+            a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static FlatView *render_memory_topology(MemoryRegion *mr)
 {
-    int i;
     FlatView *view;
 
     view = flatview_new(mr);
+    view->render_seq = memory_region_change_seq;
 
     if (mr) {
         render_memory_region(view, mr, int128_zero(),
@@ -739,6 +808,13 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    return view;
+}
+
+static void flatview_build_dispatch(FlatView *view)
+{
+    int i;
+
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -746,6 +822,14 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
         flatview_add_to_dispatch(view, &mrs);
     }
     address_space_dispatch_compact(view->dispatch);
+}
+
+static FlatView *generate_memory_topology(MemoryRegion *mr)
+{
+    FlatView *view;
+
+    view = render_memory_topology(mr);
+    flatview_build_dispatch(view);
     g_hash_table_replace(flat_views, mr, view);
 
     return view;
@@ -1003,27 +1087,54 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
+    memory_region_subtree_gen++;
 
-    /* Render unique FVs */
+    /*
+     * Render unique FVs.  Views whose regions did not change since they
+     * were rendered are kept as they are, and so are views whose ranges
+     * come out the same; this saves rebuilding the dispatch tree and
+     * lets address_space_set_flatview() skip the listeners.
+     */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *old_view, *view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        old_view = old_views ? g_hash_table_lookup(old_views, physmr) : NULL;
+        if (old_view && !flatview_is_stale(old_view)) {
+            flatview_ref(old_view);
+            g_hash_table_replace(flat_views, physmr, old_view);
+            continue;
+        }
+
+        view = render_memory_topology(physmr);
+        if (old_view && flatview_ranges_equal(view, old_view)) {
+            old_view->render_seq = view->render_seq;
+            flatview_unref(view);
+            flatview_ref(old_view);
+            g_hash_table_replace(flat_views, physmr, old_view);
+            continue;
+        }
+
+        flatview_build_dispatch(view);
+        g_hash_table_replace(flat_views, physmr, view);
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
 }
 
-static void address_space_set_flatview(AddressSpace *as)
+/* Returns true if the FlatView of @as changed.  */
+static bool address_space_set_flatview(AddressSpace *as)
 {
     FlatView *old_view = address_space_to_flatview(as);
     MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
@@ -1032,7 +1143,7 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
-        return;
+        return false;
     }
 
     if (old_view) {
@@ -1066,6 +1177,7 @@ static void address_space_set_flatview(AddressSpace *as)
     if (old_view) {
         flatview_unref(old_view);
     }
+    return true;
 }
 
 static void address_space_update_topology(AddressSpace *as)
@@ -1100,8 +1212,10 @@ void memory_region_transaction_commit(void)
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (address_space_set_flatview(as) ||
+                    ioeventfd_update_pending) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
@@ -1246,6 +1360,7 @@ static void memory_region_initfn(Object *obj)
     mr->ops = &unassigned_mem_ops;
     mr->enabled = true;
     mr->romd_mode = true;
+    mr->global_locking = true;
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
@@ -1816,8 +1931,8 @@ uint8_t memory_region_get_dirty_log_mask(MemoryRegion *mr)
     uint8_t mask = mr->dirty_log_mask;
     RAMBlock *rb = mr->ram_block;
 
-    if (global_dirty_log && ((rb && qemu_ram_is_migratable(rb)) ||
-                             memory_region_is_iommu(mr))) {
+    if ((global_dirty_tracking & GLOBAL_DIRTY_MIGRATION) &&
+        ((rb && qemu_ram_is_migratable(rb)) || memory_region_is_iommu(mr))) {
         mask |= (1 << DIRTY_MEMORY_MIGRATION);
     }
 
@@ -2109,6 +2224,7 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
+    memory_region_changed(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -2126,7 +2242,8 @@ void memory_region_set_dirty(MemoryRegion *mr, hwaddr addr,
  * If memory region `mr' is NULL, do global sync.  Otherwise, sync
  * dirty bitmap for the specified memory region.
  */
-static void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
+static void memory_region_sync_dirty_bitmap(MemoryRegion *mr,
+                                            bool last_stage)
 {
     MemoryListener *listener;
     AddressSpace *as;
@@ -2155,7 +2272,7 @@ static void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
              * is to do a global sync, because we are not capable to
              * sync in a finer granularity.
              */
-            listener->log_sync_global(listener);
+            listener->log_sync_global(listener, last_stage);
         }
     }
 }
@@ -2218,7 +2335,7 @@ DirtyBitmapSnapshot *memory_region_snapshot_and_clear_dirty(MemoryRegion *mr,
 {
     DirtyBitmapSnapshot *snapshot;
     assert(mr->ram_block);
-    memory_region_sync_dirty_bitmap(mr);
+    memory_region_sync_dirty_bitmap(mr, false);
     snapshot = cpu_physical_memory_snapshot_and_clear_dirty(mr, addr, size, client);
     memory_global_after_dirty_log_sync();
     return snapshot;
@@ -2237,6 +2354,7 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
+        memory_region_changed(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -2247,6 +2365,7 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
+        memory_region_changed(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -2257,6 +2376,7 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
+        memory_region_changed(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -2414,6 +2534,16 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_set_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = true;
+}
+
+void memory_region_clear_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = false;
+}
+
 static bool userspace_eventfd_warning;
 
 void memory_region_add_eventfd(MemoryRegion *mr,
@@ -2509,6 +2639,7 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
+    memory_region_changed(mr);
     memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
@@ -2548,6 +2679,7 @@ void memory_region_del_subregion(MemoryRegion *mr,
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
+    memory_region_changed(mr);
     memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
@@ -2559,6 +2691,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
+    memory_region_changed(mr);
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2575,6 +2708,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
+    memory_region_changed(mr);
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2612,6 +2746,7 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
+    memory_region_changed(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -2741,9 +2876,9 @@ bool memory_region_present(MemoryRegion *container, hwaddr addr)
     return mr && mr != container;
 }
 
-void memory_global_dirty_log_sync(void)
+void memory_global_dirty_log_sync(bool last_stage)
 {
-    memory_region_sync_dirty_bitmap(NULL);
+    memory_region_sync_dirty_bitmap(NULL, last_stage);
 }
 
 void memory_global_after_dirty_log_sync(void)
@@ -2752,61 +2887,110 @@ void memory_global_after_dirty_log_sync(void)
 }
 
 static VMChangeStateEntry *vmstate_change;
+/* Users of dirty tracking whose stop is postponed until the VM runs */
+static unsigned int postponed_stop_flags;
 
-void memory_global_dirty_log_start(void)
+static void memory_global_dirty_log_do_stop(unsigned int flags)
 {
-    if (vmstate_change) {
-        qemu_del_vm_change_state_handler(vmstate_change);
-        vmstate_change = NULL;
+    assert(flags && !(flags & (~GLOBAL_DIRTY_MASK)));
+
+    /* Only stop what was actually started */
+    flags &= global_dirty_tracking;
+    if (!flags) {
+        return;
     }
+    global_dirty_tracking &= ~flags;
 
-    global_dirty_log = true;
+    trace_global_dirty_changed(global_dirty_tracking);
 
-    MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
+    if (global_dirty_tracking && !(flags & GLOBAL_DIRTY_MIGRATION)) {
+        /* Still in use by another user */
+        return;
+    }
 
     /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
     memory_region_transaction_begin();
+    memory_region_global_change_seq = ++memory_region_change_seq;
     memory_region_update_pending = true;
     memory_region_transaction_commit();
+
+    if (!global_dirty_tracking) {
+        MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
+    }
 }
 
-static void memory_global_dirty_log_do_stop(void)
+/* Execute the stop that was postponed until the VM runs, if any */
+static void memory_global_dirty_log_stop_postponed_run(void)
 {
-    global_dirty_log = false;
+    assert(vmstate_change);
 
-    /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
-    memory_region_transaction_begin();
-    memory_region_update_pending = true;
-    memory_region_transaction_commit();
+    if (postponed_stop_flags) {
+        memory_global_dirty_log_do_stop(postponed_stop_flags);
+        postponed_stop_flags = 0;
+    }
 
-    MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
+    qemu_del_vm_change_state_handler(vmstate_change);
+    vmstate_change = NULL;
+}
+
+void memory_global_dirty_log_start(unsigned int flags)
+{
+    unsigned int old_flags;
+
+    assert(flags && !(flags & (~GLOBAL_DIRTY_MASK)));
+
+    if (vmstate_change) {
+        /* A restart cancels the postponed stop of the same user */
+        postponed_stop_flags &= ~flags;
+        memory_global_dirty_log_stop_postponed_run();
+    }
+
+    flags &= ~global_dirty_tracking;
+    if (!flags) {
+        return;
+    }
+
+    old_flags = global_dirty_tracking;
+    global_dirty_tracking |= flags;
+    trace_global_dirty_changed(global_dirty_tracking);
+
+    if (!old_flags) {
+        MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
+    }
+
+    if (!old_flags || (flags & GLOBAL_DIRTY_MIGRATION)) {
+        /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
+        memory_region_transaction_begin();
+        memory_region_global_change_seq = ++memory_region_change_seq;
+        memory_region_update_pending = true;
+        memory_region_transaction_commit();
+    }
 }
 
 static void memory_vm_change_state_handler(void *opaque, bool running,
                                            RunState state)
 {
     if (running) {
-        memory_global_dirty_log_do_stop();
-
-        if (vmstate_change) {
-            qemu_del_vm_change_state_handler(vmstate_change);
-            vmstate_change = NULL;
-        }
+        memory_global_dirty_log_stop_postponed_run();
     }
 }
 
-void memory_global_dirty_log_stop(void)
+void memory_global_dirty_log_stop(unsigned int flags)
 {
     if (!runstate_is_running()) {
+        /* Postpone the dirty log stop, e.g., to when VM starts again */
         if (vmstate_change) {
-            return;
+            /* Batch with previous postponed flags */
+            postponed_stop_flags |= flags;
+        } else {
+            postponed_stop_flags = flags;
+            vmstate_change = qemu_add_vm_change_state_handler(
+                memory_vm_change_state_handler, NULL);
         }
-        vmstate_change = qemu_add_vm_change_state_handler(
-                                memory_vm_change_state_handler, NULL);
         return;
     }
 
-    memory_global_dirty_log_do_stop();
+    memory_global_dirty_log_do_stop(flags);
 }
 
 static void listener_add_address_space(MemoryListener *listener,
@@ -2818,7 +3002,7 @@ static void listener_add_address_space(MemoryListener *listener,
     if (listener->begin) {
         listener->begin(listener);
     }
-    if (global_dirty_log) {
+    if (global_dirty_tracking) {
         if (listener->log_global_start) {
             listener->log_global_start(listener);
         }
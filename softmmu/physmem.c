@@ -126,6 +126,8 @@ typedef struct PhysPageMap {
 
 struct AddressSpaceDispatch {
     MemoryRegionSection *mru_section;
+    /* Unique among all dispatches ever created, tags the lookup cache */
+    uint64_t gen;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
@@ -329,6 +331,47 @@ static MemoryRegionSection *phys_page_find(AddressSpaceDispatch *d, hwaddr addr)
     }
 }
 
+/*
+ * Per-thread cache of phys_page_find results, so that threads doing
+ * repeated DMA or MMIO to a few pages skip the radix tree walk, without
+ * bouncing mru_section between threads.  Entries are tagged with the
+ * generation of the dispatch they were looked up in, so they become
+ * stale as soon as the FlatView changes.
+ */
+#define PHYS_LOOKUP_CACHE_BITS 6
+#define PHYS_LOOKUP_CACHE_SIZE (1 << PHYS_LOOKUP_CACHE_BITS)
+
+typedef struct PhysLookupCacheEntry {
+    uint64_t gen;
+    hwaddr index;
+    MemoryRegionSection *section;
+} PhysLookupCacheEntry;
+
+static __thread PhysLookupCacheEntry phys_lookup_cache[PHYS_LOOKUP_CACHE_SIZE];
+
+/* Written under the BQL, by address_space_dispatch_new */
+static uint64_t phys_dispatch_gen;
+
+/* Called from RCU critical section */
+static MemoryRegionSection *phys_page_find_cached(AddressSpaceDispatch *d,
+                                                  hwaddr addr)
+{
+    hwaddr index = addr >> TARGET_PAGE_BITS;
+    PhysLookupCacheEntry *e =
+        &phys_lookup_cache[index & (PHYS_LOOKUP_CACHE_SIZE - 1)];
+
+    if (e->gen != d->gen || e->index != index) {
+        /*
+         * Every section in the map other than a subpage covers the
+         * whole page, so the result only depends on the page.
+         */
+        e->gen = d->gen;
+        e->index = index;
+        e->section = phys_page_find(d, addr);
+    }
+    return e->section;
+}
+
 /* Called from RCU critical section */
 static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
@@ -339,8 +382,10 @@ static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
 
     if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
         !section_covers_addr(section, addr)) {
-        section = phys_page_find(d, addr);
-        qatomic_set(&d->mru_section, section);
+        section = phys_page_find_cached(d, addr);
+        if (qatomic_read(&d->mru_section) != section) {
+            qatomic_set(&d->mru_section, section);
+        }
     }
     if (resolve_subpage && section->mr->subpage) {
         subpage = container_of(section->mr, subpage_t, iomem);
@@ -2271,6 +2316,45 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
         }
     }
 }
+
+bool qemu_ram_map_file_private(RAMBlock *block, ram_addr_t offset,
+                               ram_addr_t length, int fd, off_t fd_offset)
+{
+    void *vaddr = ramblock_ptr(block, offset);
+    int flags = MAP_FIXED | MAP_PRIVATE;
+    void *area;
+
+    /*
+     * Only plain anonymous memory can be replaced behind the back of its
+     * users; with discards disabled something, e.g. VFIO, may have pinned
+     * the old pages.
+     */
+    if (block->fd >= 0 || (block->flags & (RAM_SHARED | RAM_PREALLOC)) ||
+        xen_enabled() || ram_block_discard_is_disabled() ||
+        block->page_size != qemu_real_host_page_size ||
+        !QEMU_IS_ALIGNED((uintptr_t)vaddr | length | fd_offset,
+                         qemu_real_host_page_size)) {
+        return false;
+    }
+
+    flags |= block->flags & RAM_NORESERVE ? MAP_NORESERVE : 0;
+    area = mmap(vaddr, length, PROT_READ | PROT_WRITE, flags, fd, fd_offset);
+    if (area != vaddr) {
+        return false;
+    }
+    memory_try_enable_merging(vaddr, length);
+    qemu_ram_setup_dump(vaddr, length);
+    if (!qtest_enabled()) {
+        qemu_madvise(vaddr, length, QEMU_MADV_DONTFORK);
+    }
+    return true;
+}
+#else
+bool qemu_ram_map_file_private(RAMBlock *block, ram_addr_t offset,
+                               ram_addr_t length, int fd, off_t fd_offset)
+{
+    return false;
+}
 #endif /* !_WIN32 */
 
 /* Return a host pointer to ram allocated with qemu_ram_alloc.
@@ -2583,6 +2667,8 @@ AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv)
     AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
     uint16_t n;
 
+    /* Never 0, which empty lookup cache entries have */
+    d->gen = ++phys_dispatch_gen;
     n = dummy_section(&d->map, fv, &io_mem_unassigned);
     assert(n == PHYS_SECTION_UNASSIGNED);
 
@@ -2741,14 +2827,22 @@ static int memory_access_size(MemoryRegion *mr, unsigned l, hwaddr addr)
 
 static bool prepare_mmio_access(MemoryRegion *mr)
 {
+    bool unlocked = !qemu_mutex_iothread_locked();
     bool release_lock = false;
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (unlocked && mr->global_locking) {
         qemu_mutex_lock_iothread();
+        unlocked = false;
         release_lock = true;
     }
     if (mr->flush_coalesced_mmio) {
+        if (unlocked) {
+            qemu_mutex_lock_iothread();
+        }
         qemu_flush_coalesced_mmio_buffer();
+        if (unlocked) {
+            qemu_mutex_unlock_iothread();
+        }
     }
 
     return release_lock;
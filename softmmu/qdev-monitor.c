@@ -907,6 +907,68 @@ void qmp_device_del(const char *id, Error **errp)
     }
 }
 
+static int startup_profile_add_device(Object *obj, void *opaque)
+{
+    GSList **devices = opaque;
+    DeviceState *dev = (DeviceState *)object_dynamic_cast(obj, TYPE_DEVICE);
+
+    if (dev && dev->realized &&
+        (!phase_check(PHASE_MACHINE_READY) ||
+         dev->realize_start_us < phase_get_time_us(PHASE_MACHINE_READY))) {
+        *devices = g_slist_prepend(*devices, dev);
+    }
+    return 0;
+}
+
+static gint startup_profile_compare_devices(gconstpointer a, gconstpointer b)
+{
+    const DeviceState *dev_a = a, *dev_b = b;
+
+    if (dev_a->realize_start_us != dev_b->realize_start_us) {
+        return dev_a->realize_start_us < dev_b->realize_start_us ? -1 : 1;
+    }
+    return 0;
+}
+
+StartupProfile *qmp_query_startup_profile(Error **errp)
+{
+    StartupProfile *profile = g_new0(StartupProfile, 1);
+    StartupPhaseInfoList **phase_tail = &profile->phases;
+    StartupDeviceInfoList **dev_tail = &profile->devices;
+    MachineInitPhase phase;
+    GSList *devices = NULL, *l;
+
+    QEMU_BUILD_BUG_ON(STARTUP_PHASE__MAX !=
+                      PHASE_MACHINE_READY - PHASE_MACHINE_CREATED + 1);
+
+    for (phase = PHASE_MACHINE_CREATED;
+         phase <= PHASE_MACHINE_READY && phase_check(phase); phase++) {
+        StartupPhaseInfo *info = g_new0(StartupPhaseInfo, 1);
+
+        info->phase = phase - PHASE_MACHINE_CREATED;
+        info->time_us = phase_get_time_us(phase);
+        QAPI_LIST_APPEND(phase_tail, info);
+    }
+
+    /* Devices that have been unplugged since startup are not reported */
+    object_child_foreach_recursive(object_get_root(),
+                                   startup_profile_add_device, &devices);
+    devices = g_slist_sort(devices, startup_profile_compare_devices);
+    for (l = devices; l; l = l->next) {
+        DeviceState *dev = l->data;
+        StartupDeviceInfo *info = g_new0(StartupDeviceInfo, 1);
+
+        info->qom_path = object_get_canonical_path(OBJECT(dev));
+        info->type = g_strdup(object_get_typename(OBJECT(dev)));
+        info->time_us = dev->realize_start_us;
+        info->realize_us = dev->realize_us;
+        QAPI_LIST_APPEND(dev_tail, info);
+    }
+    g_slist_free(devices);
+
+    return profile;
+}
+
 void hmp_device_add(Monitor *mon, const QDict *qdict)
 {
     Error *err = NULL;
@@ -1962,6 +1962,7 @@ static void qemu_create_late_backends(void)
     net_init_clients(&error_fatal);
 
     object_option_foreach_add(object_create_late);
+    phase_advance(PHASE_LATE_BACKENDS_CREATED);
 
     if (tpm_init() < 0) {
         exit(1);
@@ -2668,6 +2669,16 @@ static void qemu_machine_creation_done(void)
 
     qdev_prop_check_globals();
 
+    /*
+     * Memory backends created on the command line are preallocated in the
+     * background while the board and the devices are created.  Wait for
+     * the preallocation to complete before the machine is reset and the
+     * vCPUs can run.
+     */
+    if (!qemu_finish_async_mem_prealloc(&error_fatal)) {
+        exit(1);
+    }
+
     qdev_machine_creation_done();
 
     if (machine->cgs) {
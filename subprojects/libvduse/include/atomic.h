@@ -0,0 +1 @@
+../../../include/qemu/atomic.h
\ No newline at end of file
@@ -7564,6 +7564,21 @@ static void disas_simd_tb(DisasContext *s, uint32_t insn)
         return;
     }
 
+#ifndef HOST_WORDS_BIGENDIAN
+    /*
+     * A single-register TBL of a full vector is exactly the generic
+     * byte table lookup.  On a big-endian host the bytes within each
+     * uint64_t are stored swapped, which the generic op cannot see.
+     */
+    if (!is_tbx && len == 16 && is_q) {
+        tcg_gen_gvec_tbl(MO_8, vec_full_reg_offset(s, rd),
+                         vec_full_reg_offset(s, rn),
+                         vec_full_reg_offset(s, rm),
+                         16, vec_full_reg_size(s));
+        return;
+    }
+#endif
+
     tcg_gen_gvec_2_ptr(vec_full_reg_offset(s, rd),
                        vec_full_reg_offset(s, rm), cpu_env,
                        is_q ? 16 : 8, vec_full_reg_size(s),
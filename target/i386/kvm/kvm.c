@@ -131,6 +131,12 @@ static bool has_msr_mcg_ext_ctl;
 static struct kvm_cpuid2 *cpuid_cache;
 static struct kvm_cpuid2 *hv_cpuid_cache;
 static struct kvm_msr_list *kvm_feature_msrs;
+/*
+ * Values of the feature MSRs, indexed like kvm_feature_msrs.  They do not
+ * change for the life of the VM, but are needed again for every vCPU.
+ */
+static uint64_t *kvm_feature_msr_values;
+static unsigned long *kvm_feature_msr_cached;
 
 #define BUS_LOCK_SLICE_TIME 1000000000ULL /* ns */
 static RateLimit bus_lock_ratelimit_ctrl;
@@ -457,17 +463,23 @@ uint64_t kvm_arch_get_supported_msr_feature(KVMState *s, uint32_t index)
         return 0; /* if the feature MSR is not supported, simply return 0 */
     }
 
-    msr_data.info.nmsrs = 1;
-    msr_data.entries[0].index = index;
+    if (test_bit(i, kvm_feature_msr_cached)) {
+        value = kvm_feature_msr_values[i];
+    } else {
+        msr_data.info.nmsrs = 1;
+        msr_data.entries[0].index = index;
 
-    ret = kvm_ioctl(s, KVM_GET_MSRS, &msr_data);
-    if (ret != 1) {
-        error_report("KVM get MSR (index=0x%x) feature failed, %s",
-            index, strerror(-ret));
-        exit(1);
-    }
+        ret = kvm_ioctl(s, KVM_GET_MSRS, &msr_data);
+        if (ret != 1) {
+            error_report("KVM get MSR (index=0x%x) feature failed, %s",
+                index, strerror(-ret));
+            exit(1);
+        }
 
-    value = msr_data.entries[0].data;
+        value = msr_data.entries[0].data;
+        kvm_feature_msr_values[i] = value;
+        set_bit(i, kvm_feature_msr_cached);
+    }
     switch (index) {
     case MSR_IA32_VMX_PROCBASED_CTLS2:
         if (!has_msr_vmx_procbased_ctls2) {
@@ -2068,6 +2080,8 @@ static int kvm_get_supported_feature_msrs(KVMState *s)
         return ret;
     }
 
+    kvm_feature_msr_values = g_new0(uint64_t, kvm_feature_msrs->nmsrs);
+    kvm_feature_msr_cached = bitmap_new(kvm_feature_msrs->nmsrs);
     return 0;
 }
 
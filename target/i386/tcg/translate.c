@@ -23,6 +23,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg-op.h"
+#include "tcg/tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translator.h"
 
@@ -2719,6 +2720,61 @@ static void gen_jmp(DisasContext *s, target_ulong eip)
     gen_jmp_tb(s, eip, 0);
 }
 
+/*
+ * When translating a trace, continue at the target of a direct jump
+ * instead of ending the TB.  The target must be forward and in the first
+ * page of the TB, so that [pc_first, pc_next) still covers all the code
+ * that was translated and SMC detection keeps working.  The lazy flags
+ * state is carried over, so flags that are overwritten after the jump
+ * are never computed.
+ */
+static bool gen_jmp_trace(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    if (!(tb_cflags(s->base.tb) & CF_TRACE) || !s->jmp_opt ||
+        pc < s->pc ||
+        (pc & TARGET_PAGE_MASK) != (s->base.pc_first & TARGET_PAGE_MASK) ||
+        pc - s->base.pc_first >= TARGET_PAGE_SIZE - 32) {
+        return false;
+    }
+    s->pc = pc;
+    return true;
+}
+
+/*
+ * When translating a trace, a forward conditional jump becomes a side
+ * exit: the taken path leaves through lookup_and_goto_ptr, and the
+ * translation continues with the fall-through path.  cc_op stays static
+ * on the fall-through path, so the flags consumed by the jump are not
+ * materialized there if later instructions overwrite them.  Backward
+ * jumps are usually loops and are taken, so they keep ending the TB with
+ * two chained exits.
+ */
+static bool gen_jcc_trace(DisasContext *s, int b,
+                          target_ulong val, target_ulong next_eip)
+{
+    TCGLabel *fallthrough;
+
+    if (!(tb_cflags(s->base.tb) & CF_TRACE) || !s->jmp_opt ||
+        val <= next_eip) {
+        return false;
+    }
+
+    /* The side exit needs cc_op in env, the fall-through path keeps it */
+    gen_update_cc_op(s);
+    fallthrough = gen_new_label();
+    gen_jcc1_noeob(s, b ^ 1, fallthrough);
+
+    gen_jmp_im(s, val);
+    gen_jr(s, s->tmp0);
+    /* gen_jr() ended the block, but only the side exit did */
+    s->base.is_jmp = DISAS_NEXT;
+
+    gen_set_label(fallthrough);
+    return true;
+}
+
 static inline void gen_ldq_env_A0(DisasContext *s, int offset)
 {
     tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, MO_LEQ);
@@ -3107,6 +3163,91 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/*
+ * Expand the SSE integer and logical operations that have a direct
+ * gvec equivalent, so that they use host vector instructions rather
+ * than a helper call.  Only the low 128 bits are written, as legacy
+ * SSE encodings preserve the rest of the YMM register.  Returns false
+ * if B is not one of these operations.
+ */
+static bool gen_sse_gvec(int b, int b1, int op1_offset, int op2_offset)
+{
+    uint32_t d = op1_offset, a = op1_offset, o = op2_offset;
+
+    if (b >= 0x54 && b <= 0x57) {
+        /* andps/andpd, andnps/andnpd, orps/orpd, xorps/xorpd */
+        if (b1 > 1) {
+            return false;
+        }
+    } else if (b1 != 1) {
+        return false;
+    }
+
+    switch (b) {
+    case 0x54: /* andps */
+    case 0xdb: /* pand */
+        tcg_gen_gvec_and(MO_64, d, a, o, 16, 16);
+        break;
+    case 0x55: /* andnps */
+    case 0xdf: /* pandn */
+        tcg_gen_gvec_andc(MO_64, d, o, a, 16, 16);
+        break;
+    case 0x56: /* orps */
+    case 0xeb: /* por */
+        tcg_gen_gvec_or(MO_64, d, a, o, 16, 16);
+        break;
+    case 0x57: /* xorps */
+    case 0xef: /* pxor */
+        tcg_gen_gvec_xor(MO_64, d, a, o, 16, 16);
+        break;
+    case 0x64 ... 0x66: /* pcmpgt[bwd] */
+        tcg_gen_gvec_cmp(TCG_COND_GT, b - 0x64, d, a, o, 16, 16);
+        break;
+    case 0x74 ... 0x76: /* pcmpeq[bwd] */
+        tcg_gen_gvec_cmp(TCG_COND_EQ, b - 0x74, d, a, o, 16, 16);
+        break;
+    case 0xd4: /* paddq */
+        tcg_gen_gvec_add(MO_64, d, a, o, 16, 16);
+        break;
+    case 0xd5: /* pmullw */
+        tcg_gen_gvec_mul(MO_16, d, a, o, 16, 16);
+        break;
+    case 0xd8 ... 0xd9: /* psubus[bw] */
+        tcg_gen_gvec_ussub(b - 0xd8, d, a, o, 16, 16);
+        break;
+    case 0xda: /* pminub */
+        tcg_gen_gvec_umin(MO_8, d, a, o, 16, 16);
+        break;
+    case 0xdc ... 0xdd: /* paddus[bw] */
+        tcg_gen_gvec_usadd(b - 0xdc, d, a, o, 16, 16);
+        break;
+    case 0xde: /* pmaxub */
+        tcg_gen_gvec_umax(MO_8, d, a, o, 16, 16);
+        break;
+    case 0xe8 ... 0xe9: /* psubs[bw] */
+        tcg_gen_gvec_sssub(b - 0xe8, d, a, o, 16, 16);
+        break;
+    case 0xea: /* pminsw */
+        tcg_gen_gvec_smin(MO_16, d, a, o, 16, 16);
+        break;
+    case 0xec ... 0xed: /* padds[bw] */
+        tcg_gen_gvec_ssadd(b - 0xec, d, a, o, 16, 16);
+        break;
+    case 0xee: /* pmaxsw */
+        tcg_gen_gvec_smax(MO_16, d, a, o, 16, 16);
+        break;
+    case 0xf8 ... 0xfb: /* psub[bwdq] */
+        tcg_gen_gvec_sub(b - 0xf8, d, a, o, 16, 16);
+        break;
+    case 0xfc ... 0xfe: /* padd[bwd] */
+        tcg_gen_gvec_add(b - 0xfc, d, a, o, 16, 16);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start)
 {
@@ -4542,6 +4683,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, s->ptr0, s->ptr1, s->A0);
             break;
         default:
+            if (is_xmm && gen_sse_gvec(b, b1, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(s->ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(s->ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, s->ptr0, s->ptr1);
@@ -6747,7 +6891,9 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffffffff;
         }
         gen_bnd_jmp(s);
-        gen_jmp(s, tval);
+        if (!gen_jmp_trace(s, tval)) {
+            gen_jmp(s, tval);
+        }
         break;
     case 0xea: /* ljmp im */
         {
@@ -6769,7 +6915,9 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        if (!gen_jmp_trace(s, tval)) {
+            gen_jmp(s, tval);
+        }
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
@@ -6787,7 +6935,9 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffff;
         }
         gen_bnd_jmp(s);
-        gen_jcc(s, b, tval, next_eip);
+        if (!gen_jcc_trace(s, b, tval, next_eip)) {
+            gen_jcc(s, b, tval, next_eip);
+        }
         break;
 
     case 0x190 ... 0x19f: /* setcc Gv */
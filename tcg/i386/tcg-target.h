@@ -178,6 +178,16 @@ extern bool have_movbe;
 #define TCG_TARGET_HAS_qemu_st8_i32     1
 #endif
 
+/*
+ * The inline compare-and-swap needs enough argument registers for the
+ * six arguments of the slow path helper.
+ */
+#if TCG_TARGET_REG_BITS == 64 && defined(CONFIG_SOFTMMU) && !defined(_WIN64)
+#define TCG_TARGET_HAS_qemu_cmpxchg     1
+#else
+#define TCG_TARGET_HAS_qemu_cmpxchg     0
+#endif
+
 /* We do not support older SSE systems, only beginning with AVX1.  */
 #define TCG_TARGET_HAS_v64              have_avx1
 #define TCG_TARGET_HAS_v128             have_avx1
@@ -199,6 +209,7 @@ extern bool have_movbe;
 #define TCG_TARGET_HAS_minmax_vec       1
 #define TCG_TARGET_HAS_bitsel_vec       0
 #define TCG_TARGET_HAS_cmpsel_vec       -1
+#define TCG_TARGET_HAS_tbl_vec          -1
 
 #define TCG_TARGET_deposit_i32_valid(ofs, len) \
     (((ofs) == 0 && (len) == 8) || ((ofs) == 8 && (len) == 8) || \
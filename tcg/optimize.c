@@ -1591,6 +1591,8 @@ void tcg_optimize(TCGContext *s)
             case INDEX_op_qemu_st_i32:
             case INDEX_op_qemu_st8_i32:
             case INDEX_op_qemu_st_i64:
+            case INDEX_op_qemu_cmpxchg_i32:
+            case INDEX_op_qemu_cmpxchg_i64:
             case INDEX_op_call:
                 /* Opcodes that touch guest memory stop the optimization.  */
                 prev_mb = NULL;
@@ -56,6 +56,17 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+
+    /*
+     * Once every region has been handed out, full regions that no context
+     * is using any more are queued in @full, oldest first, as candidates
+     * for eviction; evicted regions are kept in @free until reused.
+     */
+    size_t *full;
+    size_t full_head;
+    size_t n_full;
+    size_t *free;
+    size_t n_free;
 };
 
 static struct tcg_region_state region;
@@ -329,14 +340,35 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
     s->code_gen_highwater = end - TCG_HIGHWATER;
 }
 
+static size_t tcg_region_size(size_t curr_region)
+{
+    void *start, *end;
+
+    tcg_region_bounds(curr_region, &start, &end);
+    return end - start;
+}
+
+/* The index of the region that @s is currently generating code into */
+static size_t tcg_region_of(const TCGContext *s)
+{
+    if (s->code_gen_buffer < region.start_aligned + region.stride) {
+        return 0;
+    }
+    return (s->code_gen_buffer - region.start_aligned) / region.stride;
+}
+
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
-        return true;
+    if (region.current < region.n) {
+        tcg_region_assign(s, region.current);
+        region.current++;
+        return false;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
-    return false;
+    if (region.n_free) {
+        tcg_region_assign(s, region.free[--region.n_free]);
+        return false;
+    }
+    return true;
 }
 
 /*
@@ -346,18 +378,68 @@ static bool tcg_region_alloc__locked(TCGContext *s)
 bool tcg_region_alloc(TCGContext *s)
 {
     bool err;
-    /* read the region size now; alloc__locked will overwrite it on success */
+    /* read the region now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t old = tcg_region_of(s);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.full[(region.full_head + region.n_full) % region.n] = old;
+        region.n_full++;
     }
     qemu_mutex_unlock(&region.lock);
     return err;
 }
 
+static gboolean tcg_region_evict_iter(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    void (*evict)(TranslationBlock *tb) = data;
+
+    evict(value);
+    return false;
+}
+
+/*
+ * Call from a safe-work context.
+ * Evict the full region that was filled the longest time ago, calling
+ * @evict on each of its TBs before its space is made available to
+ * tcg_region_alloc again.  The callback must unlink the TB from every
+ * structure outside of the region trees.
+ * Returns false if there was no region to evict.
+ */
+bool tcg_region_evict(void (*evict)(TranslationBlock *tb))
+{
+    struct tcg_region_tree *rt;
+    size_t victim;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.n_full == 0) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+    victim = region.full[region.full_head];
+    region.full_head = (region.full_head + 1) % region.n;
+    region.n_full--;
+    qemu_mutex_unlock(&region.lock);
+
+    rt = region_trees + victim * tree_size;
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, tcg_region_evict_iter, evict);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    qemu_mutex_lock(&region.lock);
+    region.agg_size_full -= tcg_region_size(victim) - TCG_HIGHWATER;
+    region.free[region.n_free++] = victim;
+    qemu_mutex_unlock(&region.lock);
+    return true;
+}
+
 /*
  * Perform a context's first region allocation.
  * This function does _not_ increment region.agg_size_full.
@@ -384,6 +466,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.full_head = 0;
+    region.n_full = 0;
+    region.n_free = 0;
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -853,6 +938,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
      * the buffer; we will assign those to the last region.
      */
     region.n = tcg_n_regions(tb_size, max_cpus);
+    region.full = g_new(size_t, region.n);
+    region.free = g_new(size_t, region.n);
     region_size = tb_size / region.n;
     region_size = QEMU_ALIGN_DOWN(region_size, page_size);
 
@@ -3697,3 +3697,19 @@ void tcg_gen_gvec_bitsel(unsigned vece, uint32_t dofs, uint32_t aofs,
 
     tcg_gen_gvec_4(dofs, aofs, bofs, cofs, oprsz, maxsz, &g);
 }
+
+void tcg_gen_gvec_tbl(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const TCGOpcode vecop_list[] = { INDEX_op_tbl_vec, 0 };
+    static const GVecGen3 g = {
+        .fniv = tcg_gen_tbl_vec,
+        .fno = gen_helper_gvec_tbl,
+        .opt_opc = vecop_list,
+        .vece = MO_8
+    };
+
+    tcg_debug_assert(vece == MO_8);
+    tcg_debug_assert(oprsz % 16 == 0);
+    tcg_gen_gvec_3(dofs, aofs, bofs, oprsz, maxsz, &g);
+}
@@ -781,3 +781,9 @@ void tcg_gen_cmpsel_vec(TCGCond cond, unsigned vece, TCGv_vec r,
     }
     tcg_swap_vecop_list(hold_list);
 }
+
+void tcg_gen_tbl_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    tcg_debug_assert(vece == MO_8);
+    do_op3_nofail(vece, r, a, b, INDEX_op_tbl_vec);
+}
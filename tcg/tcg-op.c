@@ -2724,8 +2724,8 @@ void tcg_gen_exit_tb(const TranslationBlock *tb, unsigned idx)
         tcg_debug_assert(tcg_ctx->goto_tb_issue_mask & (1 << idx));
 #endif
     } else {
-        /* This is an exit via the exitreq label.  */
-        tcg_debug_assert(idx == TB_EXIT_REQUESTED);
+        /* This is an exit via the exitreq or hot label.  */
+        tcg_debug_assert(idx == TB_EXIT_REQUESTED || idx == TB_EXIT_HOT);
     }
 
     plugin_gen_disable_mem_helpers();
@@ -3105,6 +3105,44 @@ static void * const table_cmpxchg[16] = {
     WITH_ATOMIC64([MO_64 | MO_BE] = gen_helper_atomic_cmpxchgq_be)
 };
 
+/*
+ * Backends with TCG_TARGET_HAS_qemu_cmpxchg do the compare-and-swap
+ * inline after the TLB lookup, and only call the atomic helpers on a
+ * miss.  They only handle host-endian accesses, and the helpers are
+ * still needed for the memory callbacks of plugins.
+ */
+static bool gen_cmpxchg_inline(MemOp memop)
+{
+    if (!TCG_TARGET_HAS_qemu_cmpxchg || (memop & MO_BSWAP)) {
+        return false;
+    }
+#ifdef CONFIG_PLUGIN
+    if (tcg_ctx->plugin_insn != NULL) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+static void gen_cmpxchg(TCGOpcode opc, TCGArg retv, TCGv addr,
+                        TCGArg cmpv, TCGArg newv, MemOp memop, TCGArg idx)
+{
+    TCGMemOpIdx oi = make_memop_idx(memop, idx);
+    uint16_t info = trace_mem_get_info(memop, idx, 0);
+
+    trace_guest_mem_before_tcg(tcg_ctx->cpu, cpu_env, addr, info);
+    trace_guest_mem_before_tcg(tcg_ctx->cpu, cpu_env, addr,
+                               info | TRACE_MEM_ST);
+
+    /* Only 64-bit hosts implement the opcodes */
+    tcg_debug_assert(TCG_TARGET_REG_BITS == 64);
+#if TARGET_LONG_BITS == 32
+    tcg_gen_op5(opc, retv, tcgv_i32_arg(addr), cmpv, newv, oi);
+#else
+    tcg_gen_op5(opc, retv, tcgv_i64_arg(addr), cmpv, newv, oi);
+#endif
+}
+
 void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
                                 TCGv_i32 newv, TCGArg idx, MemOp memop)
 {
@@ -3127,6 +3165,14 @@ void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
             tcg_gen_mov_i32(retv, t1);
         }
         tcg_temp_free_i32(t1);
+    } else if (gen_cmpxchg_inline(memop)) {
+        gen_cmpxchg(INDEX_op_qemu_cmpxchg_i32, tcgv_i32_arg(retv), addr,
+                    tcgv_i32_arg(cmpv), tcgv_i32_arg(newv),
+                    memop & ~MO_SIGN, idx);
+
+        if (memop & MO_SIGN) {
+            tcg_gen_ext_i32(retv, retv, memop);
+        }
     } else {
         gen_atomic_cx_i32 gen;
         TCGMemOpIdx oi;
@@ -3165,6 +3211,9 @@ void tcg_gen_atomic_cmpxchg_i64(TCGv_i64 retv, TCGv addr, TCGv_i64 cmpv,
             tcg_gen_mov_i64(retv, t1);
         }
         tcg_temp_free_i64(t1);
+    } else if ((memop & MO_SIZE) == MO_64 && gen_cmpxchg_inline(memop)) {
+        gen_cmpxchg(INDEX_op_qemu_cmpxchg_i64, tcgv_i64_arg(retv), addr,
+                    tcgv_i64_arg(cmpv), tcgv_i64_arg(newv), memop, idx);
     } else if ((memop & MO_SIZE) == MO_64) {
 #ifdef CONFIG_ATOMIC64
         gen_atomic_cx_i64 gen;
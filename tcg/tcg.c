@@ -1184,6 +1184,10 @@ bool tcg_op_supported(TCGOpcode op)
     case INDEX_op_qemu_st8_i32:
         return TCG_TARGET_HAS_qemu_st8_i32;
 
+    case INDEX_op_qemu_cmpxchg_i32:
+    case INDEX_op_qemu_cmpxchg_i64:
+        return TCG_TARGET_HAS_qemu_cmpxchg;
+
     case INDEX_op_mov_i32:
     case INDEX_op_setcond_i32:
     case INDEX_op_brcond_i32:
@@ -1440,6 +1444,8 @@ bool tcg_op_supported(TCGOpcode op)
         return have_vec && TCG_TARGET_HAS_bitsel_vec;
     case INDEX_op_cmpsel_vec:
         return have_vec && TCG_TARGET_HAS_cmpsel_vec;
+    case INDEX_op_tbl_vec:
+        return have_vec && TCG_TARGET_HAS_tbl_vec;
 
     default:
         tcg_debug_assert(op > INDEX_op_last_generic && op < NB_OPS);
@@ -1909,6 +1915,8 @@ static void tcg_dump_ops(TCGContext *s, bool have_prefs)
             case INDEX_op_qemu_st8_i32:
             case INDEX_op_qemu_ld_i64:
             case INDEX_op_qemu_st_i64:
+            case INDEX_op_qemu_cmpxchg_i32:
+            case INDEX_op_qemu_cmpxchg_i64:
                 {
                     TCGMemOpIdx oi = op->args[k++];
                     MemOp op = get_memop(oi);
@@ -3225,13 +3233,31 @@ static TCGReg tcg_reg_alloc(TCGContext *s, TCGRegSet required_regs,
             tcg_reg_free(s, reg, allocated_regs);
             return reg;
         } else {
+            int spill = -1;
+
+            /*
+             * Prefer a register whose temp is a constant or already in
+             * sync with memory: dropping it costs no store, and a later
+             * use costs the same reload as any other spilled value.
+             */
             for (i = 0; i < n; i++) {
                 TCGReg reg = order[i];
                 if (tcg_regset_test_reg(set, reg)) {
-                    tcg_reg_free(s, reg, allocated_regs);
-                    return reg;
+                    TCGTemp *ts = s->reg_to_temp[reg];
+
+                    if (temp_readonly(ts) || ts->mem_coherent) {
+                        spill = reg;
+                        break;
+                    }
+                    if (spill < 0) {
+                        spill = reg;
+                    }
                 }
             }
+            if (spill >= 0) {
+                tcg_reg_free(s, spill, allocated_regs);
+                return spill;
+            }
         }
     }
 
@@ -4078,6 +4104,7 @@ void tcg_profile_snapshot(TCGProfile *prof, bool counters, bool table)
             PROF_ADD(prof, orig, tb_count1);
             PROF_ADD(prof, orig, tb_count);
             PROF_ADD(prof, orig, op_count);
+            PROF_ADD(prof, orig, guest_insn_count);
             PROF_MAX(prof, orig, op_count_max);
             PROF_ADD(prof, orig, temp_count);
             PROF_MAX(prof, orig, temp_count_max);
@@ -4388,12 +4415,14 @@ void tcg_dump_info(void)
     const TCGProfile *s;
     int64_t tb_count;
     int64_t tb_div_count;
+    int64_t insn_div_count;
     int64_t tot;
 
     tcg_profile_snapshot_counters(&prof);
     s = &prof;
     tb_count = s->tb_count;
     tb_div_count = tb_count ? tb_count : 1;
+    insn_div_count = s->guest_insn_count ? s->guest_insn_count : 1;
     tot = s->interm_time + s->code_time;
 
     qemu_printf("JIT cycles          %" PRId64 " (%0.3f s at 2.4 GHz)\n",
@@ -4438,6 +4467,17 @@ void tcg_dump_info(void)
                 s->restore_count);
     qemu_printf("  avg cycles        %0.1f\n",
                 s->restore_count ? (double)s->restore_time / s->restore_count : 0);
+    qemu_printf("translated insns    %" PRId64 " (avg %0.1f/TB)\n",
+                s->guest_insn_count,
+                (double)s->guest_insn_count / tb_div_count);
+    qemu_printf("  ns/insn translate %0.1f\n",
+                (double)s->interm_time / insn_div_count);
+    qemu_printf("  ns/insn optimize  %0.1f\n",
+                (double)s->opt_time / insn_div_count);
+    qemu_printf("  ns/insn codegen   %0.1f\n",
+                (double)s->code_time / insn_div_count);
+    qemu_printf("cpu_exec time       %0.3f s\n",
+                s->cpu_exec_time / (double)NANOSECONDS_PER_SECOND);
 }
 #else
 void tcg_dump_info(void)
@@ -61,6 +61,7 @@ static uint64_t tci_uint64(uint32_t high, uint32_t low)
  *   i = immediate (uint32_t)
  *   I = immediate (tcg_target_ulong)
  *   l = label or pointer
+ *   L = label in the word following the instruction
  *   m = immediate (TCGMemOpIdx)
  *   n = immediate (call return length)
  *   r = register
@@ -144,6 +145,25 @@ static void tci_args_rrrc(uint32_t insn,
     *c3 = extract32(insn, 20, 4);
 }
 
+/*
+ * The label of a conditional branch does not fit in the instruction with
+ * the comparison, so it follows as a full word, relative to its end.
+ */
+static void *tci_args_L(const uint32_t **tb_ptr)
+{
+    int32_t diff = *(*tb_ptr)++;
+    return (void *)*tb_ptr + diff;
+}
+
+static void tci_args_rrcL(uint32_t insn, const uint32_t **tb_ptr,
+                          TCGReg *r0, TCGReg *r1, TCGCond *c2, void **l3)
+{
+    *r0 = extract32(insn, 8, 4);
+    *r1 = extract32(insn, 12, 4);
+    *c2 = extract32(insn, 16, 4);
+    *l3 = tci_args_L(tb_ptr);
+}
+
 static void tci_args_rrrm(uint32_t insn,
                           TCGReg *r0, TCGReg *r1, TCGReg *r2, TCGMemOpIdx *m3)
 {
@@ -182,6 +202,18 @@ static void tci_args_rrrr(uint32_t insn,
     *r3 = extract32(insn, 20, 4);
 }
 
+static void tci_args_rrrrcL(uint32_t insn, const uint32_t **tb_ptr,
+                            TCGReg *r0, TCGReg *r1, TCGReg *r2, TCGReg *r3,
+                            TCGCond *c4, void **l5)
+{
+    *r0 = extract32(insn, 8, 4);
+    *r1 = extract32(insn, 12, 4);
+    *r2 = extract32(insn, 16, 4);
+    *r3 = extract32(insn, 20, 4);
+    *c4 = extract32(insn, 24, 4);
+    *l5 = tci_args_L(tb_ptr);
+}
+
 static void tci_args_rrrrrc(uint32_t insn, TCGReg *r0, TCGReg *r1,
                             TCGReg *r2, TCGReg *r3, TCGReg *r4, TCGCond *c5)
 {
@@ -559,6 +591,15 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             T2 = tci_uint64(regs[r4], regs[r3]);
             regs[r0] = tci_compare64(T1, T2, condition);
             break;
+        case INDEX_op_brcond2_i32:
+            tci_args_rrrrcL(insn, &tb_ptr, &r0, &r1, &r2, &r3,
+                            &condition, &ptr);
+            T1 = tci_uint64(regs[r1], regs[r0]);
+            T2 = tci_uint64(regs[r3], regs[r2]);
+            if (tci_compare64(T1, T2, condition)) {
+                tb_ptr = ptr;
+            }
+            break;
 #elif TCG_TARGET_REG_BITS == 64
         case INDEX_op_setcond_i64:
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
@@ -767,8 +808,8 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         case INDEX_op_brcond_i32:
-            tci_args_rl(insn, tb_ptr, &r0, &ptr);
-            if ((uint32_t)regs[r0]) {
+            tci_args_rrcL(insn, &tb_ptr, &r0, &r1, &condition, &ptr);
+            if (tci_compare32(regs[r0], regs[r1], condition)) {
                 tb_ptr = ptr;
             }
             break;
@@ -980,8 +1021,8 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         case INDEX_op_brcond_i64:
-            tci_args_rl(insn, tb_ptr, &r0, &ptr);
-            if (regs[r0]) {
+            tci_args_rrcL(insn, &tb_ptr, &r0, &r1, &condition, &ptr);
+            if (tci_compare64(regs[r0], regs[r1], condition)) {
                 tb_ptr = ptr;
             }
             break;
@@ -1181,11 +1222,20 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
 
     case INDEX_op_brcond_i32:
     case INDEX_op_brcond_i64:
-        tci_args_rl(insn, tb_ptr, &r0, &ptr);
-        info->fprintf_func(info->stream, "%-12s  %s, 0, ne, %p",
-                           op_name, str_r(r0), ptr);
+        tci_args_rrcL(insn, &tb_ptr, &r0, &r1, &c, &ptr);
+        info->fprintf_func(info->stream, "%-12s  %s, %s, %s, %p",
+                           op_name, str_r(r0), str_r(r1), str_c(c), ptr);
         break;
 
+#if TCG_TARGET_REG_BITS == 32
+    case INDEX_op_brcond2_i32:
+        tci_args_rrrrcL(insn, &tb_ptr, &r0, &r1, &r2, &r3, &c, &ptr);
+        info->fprintf_func(info->stream, "%-12s  %s, %s, %s, %s, %s, %p",
+                           op_name, str_r(r0), str_r(r1), str_r(r2),
+                           str_r(r3), str_c(c), ptr);
+        break;
+#endif
+
     case INDEX_op_setcond_i32:
     case INDEX_op_setcond_i64:
         tci_args_rrrc(insn, &r0, &r1, &r2, &c);
@@ -1396,5 +1446,6 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
         break;
     }
 
-    return sizeof(insn);
+    /* Conditional branches are followed by their label. */
+    return (uintptr_t)tb_ptr - (uintptr_t)addr;
 }
@@ -0,0 +1,99 @@
+/*
+ * QEMU JSON parser and writer speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qobject.h"
+#include "qemu/units.h"
+
+/*
+ * Build a document that looks like the reply to a large query-*
+ * command: an array of objects with string, integer and boolean
+ * members, and a nested array of integers.
+ */
+static GString *make_document(size_t entries)
+{
+    GString *doc = g_string_new("{\"return\": [");
+    size_t i;
+
+    for (i = 0; i < entries; i++) {
+        g_string_append_printf(doc,
+            "%s{\"node-name\": \"node%zu\", \"drv\": \"qcow2\", "
+            "\"file\": \"/var/lib/images/disk-%zu.qcow2\", "
+            "\"ro\": %s, \"bps\": %zu, \"iops\": %zu, "
+            "\"offsets\": [%zu, %zu, %zu, %zu]}",
+            i ? ", " : "", i, i, i & 1 ? "true" : "false",
+            i * 4096, i * 7, i, i << 9, i << 18, i << 27);
+    }
+    g_string_append(doc, "]}");
+    return doc;
+}
+
+static void test_json_parse_speed(const void *opaque)
+{
+    GString *doc = make_document(GPOINTER_TO_SIZE(opaque));
+    const size_t total = 256 * MiB;
+    QObject *obj;
+    size_t pos;
+
+    g_test_timer_start();
+    for (pos = 0; pos < total; pos += doc->len) {
+        obj = qobject_from_json(doc->str, &error_abort);
+        qobject_unref(obj);
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("parse: document %zu bytes %.2f MB/sec",
+                   doc->len, total / MiB / g_test_timer_last());
+    g_string_free(doc, true);
+}
+
+static void test_json_write_speed(const void *opaque)
+{
+    GString *doc = make_document(GPOINTER_TO_SIZE(opaque));
+    QObject *obj = qobject_from_json(doc->str, &error_abort);
+    const size_t total = 256 * MiB;
+    GString *out;
+    size_t pos;
+
+    g_test_timer_start();
+    for (pos = 0; pos < total; pos += doc->len) {
+        out = qobject_to_json(obj);
+        g_string_free(out, true);
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("write: document %zu bytes %.2f MB/sec",
+                   doc->len, total / MiB / g_test_timer_last());
+    qobject_unref(obj);
+    g_string_free(doc, true);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t entries[] = { 1, 100, 10000 };
+    size_t i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(entries); i++) {
+        char *name;
+
+        name = g_strdup_printf("/json/benchmark/parse/%zu", entries[i]);
+        g_test_add_data_func(name, GSIZE_TO_POINTER(entries[i]),
+                             test_json_parse_speed);
+        g_free(name);
+
+        name = g_strdup_printf("/json/benchmark/write/%zu", entries[i]);
+        g_test_add_data_func(name, GSIZE_TO_POINTER(entries[i]),
+                             test_json_write_speed);
+        g_free(name);
+    }
+
+    return g_test_run();
+}
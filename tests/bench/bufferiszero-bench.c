@@ -0,0 +1,71 @@
+/*
+ * QEMU buffer_is_zero speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+
+typedef struct BufferIsZeroOpts {
+    size_t len;
+    /* offset of the only non-zero byte, or -1 for an all-zero buffer */
+    ssize_t nonzero;
+} BufferIsZeroOpts;
+
+static void test_bufferiszero_speed(const void *opaque)
+{
+    const BufferIsZeroOpts *opts = opaque;
+    const size_t total = 1 * GiB;
+    bool expected = opts->nonzero < 0;
+    uint8_t *buf;
+    size_t pos;
+
+    buf = g_malloc0(MAX(opts->len, 64 * KiB));
+    if (!expected) {
+        buf[opts->nonzero] = 1;
+    }
+
+    do {
+        g_test_timer_start();
+        for (pos = 0; pos < total; pos += opts->len) {
+            g_assert(buffer_is_zero(buf, opts->len) == expected);
+        }
+        g_test_timer_elapsed();
+
+        g_test_message("buffer_is_zero: len %zu bytes %s %.2f MB/sec",
+                       opts->len, expected ? "zero" : "non-zero",
+                       total / MiB / g_test_timer_last());
+    } while (test_buffer_is_zero_next_accel());
+
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t lens[] = { 32, 128, 256, 4 * KiB, 64 * KiB };
+    size_t i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(lens); i++) {
+        BufferIsZeroOpts *zero = g_new(BufferIsZeroOpts, 1);
+        BufferIsZeroOpts *tail = g_new(BufferIsZeroOpts, 1);
+        char *name;
+
+        *zero = (BufferIsZeroOpts) { .len = lens[i], .nonzero = -1 };
+        name = g_strdup_printf("/bufferiszero/benchmark/zero/%zu", lens[i]);
+        g_test_add_data_func_full(name, zero, test_bufferiszero_speed, g_free);
+        g_free(name);
+
+        /* a non-zero byte where the inline checks do not see it */
+        *tail = (BufferIsZeroOpts) { .len = lens[i], .nonzero = lens[i] - 2 };
+        name = g_strdup_printf("/bufferiszero/benchmark/tail/%zu", lens[i]);
+        g_test_add_data_func_full(name, tail, test_bufferiszero_speed, g_free);
+        g_free(name);
+    }
+
+    return g_test_run();
+}
@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include <math.h>
 #include <fenv.h>
+#include "qemu/bitops.h"
 #include "qemu/timer.h"
 #include "qemu/int128.h"
 #include "fpu/softfloat.h"
@@ -34,6 +35,10 @@ enum op {
     OP_FMA,
     OP_SQRT,
     OP_CMP,
+    OP_MAX,
+    OP_RINT,
+    OP_TOINT,
+    OP_CVT,
     OP_MAX_NR,
 };
 
@@ -45,6 +50,10 @@ static const char * const op_names[] = {
     [OP_FMA] = "mulAdd",
     [OP_SQRT] = "sqrt",
     [OP_CMP] = "cmp",
+    [OP_MAX] = "max",
+    [OP_RINT] = "rint",
+    [OP_TOINT] = "toint",
+    [OP_CVT] = "cvt",
     [OP_MAX_NR] = NULL,
 };
 
@@ -225,6 +234,41 @@ static void fill_random(union fp *ops, int n_ops, enum precision prec,
     }
 }
 
+/*
+ * Keep the exponent of the inputs in [-30, 30], so that conversions to
+ * integer and to the other precision are in range, and rounding to an
+ * integer is not a no-op.
+ */
+static void limit_exponent(union fp *ops, int n_ops, enum precision prec)
+{
+    uint64_t exp;
+    int i;
+
+    for (i = 0; i < n_ops; i++) {
+        switch (prec) {
+        case PREC_SINGLE:
+        case PREC_FLOAT32:
+            exp = extract32(float32_val(ops[i].f32), 23, 8) % 61 + 127 - 30;
+            ops[i].f32 = make_float32(deposit32(float32_val(ops[i].f32),
+                                                23, 8, exp));
+            break;
+        case PREC_DOUBLE:
+        case PREC_FLOAT64:
+            exp = extract64(float64_val(ops[i].f64), 52, 11) % 61 + 1023 - 30;
+            ops[i].f64 = make_float64(deposit64(float64_val(ops[i].f64),
+                                                52, 11, exp));
+            break;
+        case PREC_QUAD:
+        case PREC_FLOAT128:
+            exp = extract64(ops[i].f128.high, 48, 15) % 61 + 16383 - 30;
+            ops[i].f128.high = deposit64(ops[i].f128.high, 48, 15, exp);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+}
+
 /*
  * The main benchmark function. Instead of (ab)using macros, we rely
  * on the compiler to unfold this at compile-time.
@@ -239,9 +283,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
         int i;
 
         update_random_ops(n_ops, prec);
+        fill_random(ops, n_ops, prec, no_neg);
+        if (op == OP_RINT || op == OP_TOINT || op == OP_CVT) {
+            limit_exponent(ops, n_ops, prec);
+        }
         switch (prec) {
         case PREC_SINGLE:
-            fill_random(ops, n_ops, prec, no_neg);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float a = ops[0].f;
@@ -270,13 +317,24 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MAX:
+                    res.f = fmaxf(a, b);
+                    break;
+                case OP_RINT:
+                    res.f = rintf(a);
+                    break;
+                case OP_TOINT:
+                    res.u64 = (int64_t)a;
+                    break;
+                case OP_CVT:
+                    res.d = a;
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_DOUBLE:
-            fill_random(ops, n_ops, prec, no_neg);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 double a = ops[0].d;
@@ -305,13 +363,24 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MAX:
+                    res.d = fmax(a, b);
+                    break;
+                case OP_RINT:
+                    res.d = rint(a);
+                    break;
+                case OP_TOINT:
+                    res.u64 = (int64_t)a;
+                    break;
+                case OP_CVT:
+                    res.f = a;
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_FLOAT32:
-            fill_random(ops, n_ops, prec, no_neg);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float32 a = ops[0].f32;
@@ -340,13 +409,24 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float32_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MAX:
+                    res.f32 = float32_maxnum(a, b, &soft_status);
+                    break;
+                case OP_RINT:
+                    res.f32 = float32_round_to_int(a, &soft_status);
+                    break;
+                case OP_TOINT:
+                    res.u64 = float32_to_int64_round_to_zero(a, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f64 = float32_to_float64(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_FLOAT64:
-            fill_random(ops, n_ops, prec, no_neg);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float64 a = ops[0].f64;
@@ -375,13 +455,24 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float64_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MAX:
+                    res.f64 = float64_maxnum(a, b, &soft_status);
+                    break;
+                case OP_RINT:
+                    res.f64 = float64_round_to_int(a, &soft_status);
+                    break;
+                case OP_TOINT:
+                    res.u64 = float64_to_int64_round_to_zero(a, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f32 = float64_to_float32(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_FLOAT128:
-            fill_random(ops, n_ops, prec, no_neg);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float128 a = ops[0].f128;
@@ -410,6 +501,18 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float128_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MAX:
+                    res.f128 = float128_maxnum(a, b, &soft_status);
+                    break;
+                case OP_RINT:
+                    res.f128 = float128_round_to_int(a, &soft_status);
+                    break;
+                case OP_TOINT:
+                    res.u64 = float128_to_int64_round_to_zero(a, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f64 = float128_to_float64(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -448,6 +551,10 @@ GEN_BENCH_ALL_TYPES(mul, OP_MUL, 2)
 GEN_BENCH_ALL_TYPES(div, OP_DIV, 2)
 GEN_BENCH_ALL_TYPES(fma, OP_FMA, 3)
 GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_ALL_TYPES(max, OP_MAX, 2)
+GEN_BENCH_ALL_TYPES(rint, OP_RINT, 1)
+GEN_BENCH_ALL_TYPES(toint, OP_TOINT, 1)
+GEN_BENCH_ALL_TYPES(cvt, OP_CVT, 1)
 #undef GEN_BENCH_ALL_TYPES
 
 #define GEN_BENCH_ALL_TYPES_NO_NEG(name, op, n)                         \
@@ -480,6 +587,10 @@ static const bench_func_t bench_funcs[OP_MAX_NR][PREC_MAX_NR] = {
     GEN_BENCH_FUNCS(fma, OP_FMA),
     GEN_BENCH_FUNCS(sqrt, OP_SQRT),
     GEN_BENCH_FUNCS(cmp, OP_CMP),
+    GEN_BENCH_FUNCS(max, OP_MAX),
+    GEN_BENCH_FUNCS(rint, OP_RINT),
+    GEN_BENCH_FUNCS(toint, OP_TOINT),
+    GEN_BENCH_FUNCS(cvt, OP_CVT),
 };
 
 #undef GEN_BENCH_FUNCS
@@ -0,0 +1,93 @@
+/*
+ * QTest testcase for memory topology updates
+ *
+ * Toggles memory decoding of a PCI device while many other PCI devices
+ * have their BARs mapped, so that every toggle commits a memory
+ * transaction that only changes a small part of the memory map.  Run
+ * with "-m perf" to time the updates; the numbers include the round
+ * trip through the qtest protocol.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "libqos/libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+
+#define NUM_DEVICES         24
+#define ITERATIONS          100
+#define PERF_ITERATIONS     10000
+
+/* Offset of the name of the current test in the pci-testdev header */
+#define TESTDEV_NAME        16
+
+static void test_bar_toggle(void)
+{
+    GString *cmdline = g_string_new("-machine pc");
+    QPCIDevice *devs[NUM_DEVICES];
+    QPCIDevice *dev;
+    QPCIBus *pcibus;
+    QTestState *qts;
+    QPCIBar bar;
+    uint32_t name;
+    uint16_t cmd;
+    double elapsed;
+    int i, n;
+
+    for (i = 0; i < NUM_DEVICES; i++) {
+        g_string_append_printf(cmdline, " -device pci-testdev,addr=%x.0",
+                               i + 4);
+    }
+    qts = qtest_init(cmdline->str);
+    g_string_free(cmdline, true);
+
+    pcibus = qpci_new_pc(qts, NULL);
+    for (i = 0; i < NUM_DEVICES; i++) {
+        devs[i] = qpci_device_find(pcibus, QPCI_DEVFN(i + 4, 0));
+        g_assert(devs[i]);
+        qpci_device_enable(devs[i]);
+    }
+
+    /* Map the BARs of all devices, the last one is toggled below */
+    for (i = 0; i < NUM_DEVICES - 1; i++) {
+        qpci_iomap(devs[i], 0, NULL);
+    }
+    dev = devs[NUM_DEVICES - 1];
+    bar = qpci_iomap(dev, 0, NULL);
+
+    /* Select the first test, so that the BAR has data to read back */
+    qpci_io_writeb(dev, bar, 0, 0);
+    name = qpci_io_readl(dev, bar, TESTDEV_NAME);
+    g_assert_cmpuint(name, !=, 0);
+
+    n = g_test_perf() ? PERF_ITERATIONS : ITERATIONS;
+    cmd = qpci_config_readw(dev, PCI_COMMAND);
+    g_test_timer_start();
+    for (i = 0; i < n; i++) {
+        qpci_config_writew(dev, PCI_COMMAND, cmd & ~PCI_COMMAND_MEMORY);
+        qpci_config_writew(dev, PCI_COMMAND, cmd);
+    }
+    elapsed = g_test_timer_elapsed();
+    if (g_test_perf()) {
+        g_test_message("%d memory topology updates: %f s, %f us each",
+                       2 * n, elapsed, elapsed * 1e6 / (2 * n));
+    }
+
+    g_assert_cmpuint(qpci_io_readl(dev, bar, TESTDEV_NAME), ==, name);
+
+    for (i = 0; i < NUM_DEVICES; i++) {
+        g_free(devs[i]);
+    }
+    qpci_free_pc(pcibus);
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/memory-topology/bar-toggle", test_bar_toggle);
+
+    return g_test_run();
+}
@@ -474,6 +474,10 @@ typedef struct {
     bool only_target;
     /* Use dirty ring if true; dirty logging otherwise */
     bool use_dirty_ring;
+    /* Enable postcopy-preempt on both sides (postcopy tests only) */
+    bool postcopy_preempt;
+    /* Enable multifd and postcopy-multifd on both sides (likewise) */
+    bool postcopy_multifd;
     char *opts_source;
     char *opts_target;
 } MigrateStart;
@@ -663,9 +667,13 @@ static int migrate_postcopy_prepare(QTestState **from_ptr,
                                     MigrateStart *args)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    bool postcopy_preempt = args->postcopy_preempt;
+    bool postcopy_multifd = args->postcopy_multifd;
     QTestState *from, *to;
 
-    if (test_migrate_start(&from, &to, uri, args)) {
+    /* The multifd channels have to be set before the destination listens */
+    if (test_migrate_start(&from, &to, postcopy_multifd ? "defer" : uri,
+                           args)) {
         return -1;
     }
 
@@ -673,6 +681,26 @@ static int migrate_postcopy_prepare(QTestState **from_ptr,
     migrate_set_capability(to, "postcopy-ram", true);
     migrate_set_capability(to, "postcopy-blocktime", true);
 
+    if (postcopy_preempt) {
+        migrate_set_capability(from, "postcopy-preempt", true);
+        migrate_set_capability(to, "postcopy-preempt", true);
+    }
+
+    if (postcopy_multifd) {
+        QDict *rsp;
+
+        migrate_set_parameter_int(from, "multifd-channels", 4);
+        migrate_set_parameter_int(to, "multifd-channels", 4);
+        migrate_set_capability(from, "multifd", true);
+        migrate_set_capability(to, "multifd", true);
+        migrate_set_capability(from, "postcopy-multifd", true);
+        migrate_set_capability(to, "postcopy-multifd", true);
+
+        rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                               "  'arguments': { 'uri': %s }}", uri);
+        qobject_unref(rsp);
+    }
+
     /* We want to pick a speed slow enough that the test completes
      * quickly, but that it doesn't complete precopy even on a slow
      * machine, so also set the downtime.
@@ -719,6 +747,34 @@ static void test_postcopy(void)
     migrate_postcopy_complete(from, to);
 }
 
+static void test_postcopy_preempt(void)
+{
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+
+    args->postcopy_preempt = true;
+
+    if (migrate_postcopy_prepare(&from, &to, args)) {
+        return;
+    }
+    migrate_postcopy_start(from, to);
+    migrate_postcopy_complete(from, to);
+}
+
+static void test_postcopy_multifd(void)
+{
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+
+    args->postcopy_multifd = true;
+
+    if (migrate_postcopy_prepare(&from, &to, args)) {
+        return;
+    }
+    migrate_postcopy_start(from, to);
+    migrate_postcopy_complete(from, to);
+}
+
 static void test_postcopy_recovery(void)
 {
     MigrateStart *args = migrate_start_new();
@@ -1225,7 +1281,7 @@ static void test_migrate_auto_converge(void)
     test_migrate_end(from, to, true);
 }
 
-static void test_multifd_tcp(const char *method)
+static void test_multifd_tcp_cap(const char *method, const char *cap)
 {
     MigrateStart *args = migrate_start_new();
     QTestState *from, *to;
@@ -1255,6 +1311,11 @@ static void test_multifd_tcp(const char *method)
     migrate_set_capability(from, "multifd", true);
     migrate_set_capability(to, "multifd", true);
 
+    if (cap) {
+        migrate_set_capability(from, cap, true);
+        migrate_set_capability(to, cap, true);
+    }
+
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
                            "  'arguments': { 'uri': 'tcp:127.0.0.1:0' }}");
@@ -1281,11 +1342,21 @@ static void test_multifd_tcp(const char *method)
     test_migrate_end(from, to, true);
 }
 
+static void test_multifd_tcp(const char *method)
+{
+    test_multifd_tcp_cap(method, NULL);
+}
+
 static void test_multifd_tcp_none(void)
 {
     test_multifd_tcp("none");
 }
 
+static void test_multifd_tcp_zero_page(void)
+{
+    test_multifd_tcp_cap("none", "multifd-zero-page");
+}
+
 static void test_multifd_tcp_zlib(void)
 {
     test_multifd_tcp("zlib");
@@ -1298,6 +1369,115 @@ static void test_multifd_tcp_zstd(void)
 }
 #endif
 
+#ifdef CONFIG_LZ4
+static void test_multifd_tcp_lz4(void)
+{
+    test_multifd_tcp("lz4");
+}
+#endif
+
+/*
+ * The whole migration is written to a file by the source, and only
+ * then loaded by the destination.
+ */
+static void test_mapped_ram_common(bool multifd)
+{
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    QDict *rsp;
+    g_autofree char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        return;
+    }
+
+    /* 1GB/s */
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+    migrate_set_parameter_int(from, "downtime-limit", CONVERGE_DOWNTIME);
+
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+
+    if (multifd) {
+        migrate_set_parameter_int(from, "multifd-channels", 4);
+        migrate_set_capability(from, "multifd", true);
+        migrate_set_capability(to, "multifd", true);
+    }
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(from);
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+}
+
+static void test_mapped_ram(void)
+{
+    test_mapped_ram_common(false);
+}
+
+static void test_multifd_mapped_ram(void)
+{
+    test_mapped_ram_common(true);
+}
+
+/* Migrate a guest that never ran to @file, and return the stream */
+static gchar *save_paused_guest(int device_save_threads, const char *file,
+                                gsize *len)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs, file);
+    g_autofree char *path = g_strdup_printf("%s/%s", tmpfs, file);
+    QTestState *who;
+    gchar *contents;
+
+    who = qtest_initf("-nodefaults -S -M pc -m 64M -rtc clock=vm "
+                      "-global migration.x-device-save-threads=%d "
+                      "-blockdev driver=null-co,node-name=disk0 "
+                      "-blockdev driver=null-co,node-name=disk1 "
+                      "-device virtio-blk-pci,drive=disk0 "
+                      "-device virtio-blk-pci,drive=disk1 "
+                      "-device virtio-net-pci -device virtio-net-pci",
+                      device_save_threads);
+    migrate_qmp(who, uri, "{}");
+    wait_for_migration_complete(who);
+    qtest_quit(who);
+
+    g_assert(g_file_get_contents(path, &contents, len, NULL));
+    cleanup(file);
+    return contents;
+}
+
+/*
+ * The virtio devices are saved by separate threads with
+ * x-device-save-threads, which must neither change the stream nor the
+ * vmdesc at its end.
+ */
+static void test_device_save_threads(void)
+{
+    g_autofree gchar *serial = NULL;
+    g_autofree gchar *threaded = NULL;
+    gsize serial_len, threaded_len;
+
+    serial = save_paused_guest(0, "migfile-serial", &serial_len);
+    threaded = save_paused_guest(4, "migfile-threaded", &threaded_len);
+
+    g_assert_cmpuint(serial_len, ==, threaded_len);
+    g_assert(memcmp(serial, threaded, serial_len) == 0);
+}
+
 /*
  * This test does:
  *  source               target
@@ -1466,6 +1646,8 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/postcopy/unix", test_postcopy);
     qtest_add_func("/migration/postcopy/recovery", test_postcopy_recovery);
+    qtest_add_func("/migration/postcopy/preempt/unix", test_postcopy_preempt);
+    qtest_add_func("/migration/postcopy/multifd/unix", test_postcopy_multifd);
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
     qtest_add_func("/migration/precopy/tcp", test_precopy_tcp);
@@ -1481,11 +1663,22 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
     qtest_add_func("/migration/multifd/tcp/none", test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/zero-page",
+                   test_multifd_tcp_zero_page);
     qtest_add_func("/migration/multifd/tcp/cancel", test_multifd_tcp_cancel);
+    qtest_add_func("/migration/mapped-ram", test_mapped_ram);
+    qtest_add_func("/migration/multifd/mapped-ram", test_multifd_mapped_ram);
+    if (g_str_equal(qtest_get_arch(), "x86_64")) {
+        qtest_add_func("/migration/device-save-threads",
+                       test_device_save_threads);
+    }
     qtest_add_func("/migration/multifd/tcp/zlib", test_multifd_tcp_zlib);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/zstd", test_multifd_tcp_zstd);
 #endif
+#ifdef CONFIG_LZ4
+    qtest_add_func("/migration/multifd/tcp/lz4", test_multifd_tcp_lz4);
+#endif
 
     if (kvm_dirty_ring_supported()) {
         qtest_add_func("/migration/dirty_ring",
@@ -100,6 +100,8 @@ static bool query_is_ignored(const char *cmd)
         /* Success depends on Host or Hypervisor SEV support */
         "query-sev",
         "query-sev-capabilities",
+        /* Success depends on stats-snapshot-set-interval */
+        "query-stats-snapshot",
         NULL
     };
     int i;
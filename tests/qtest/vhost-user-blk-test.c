@@ -882,7 +882,7 @@ static void quit_storage_daemon(void *data)
 }
 
 static void start_vhost_user_blk(GString *cmd_line, int vus_instances,
-                                 int num_queues)
+                                 int num_queues, int num_iothreads)
 {
     const char *vhost_user_blk_bin = qtest_qemu_storage_daemon_binary();
     int i;
@@ -894,6 +894,11 @@ static void start_vhost_user_blk(GString *cmd_line, int vus_instances,
                            "exec %s ",
                            vhost_user_blk_bin);
 
+    for (i = 0; i < num_iothreads; i++) {
+        g_string_append_printf(storage_daemon_command,
+                               "--object iothread,id=iothread%d ", i);
+    }
+
     g_string_append_printf(cmd_line,
             " -object memory-backend-memfd,id=mem,size=256M,share=on "
             " -M memory-backend=mem -m 256M ");
@@ -907,9 +912,15 @@ static void start_vhost_user_blk(GString *cmd_line, int vus_instances,
         g_string_append_printf(storage_daemon_command,
             "--blockdev driver=file,node-name=disk%d,filename=%s "
             "--export type=vhost-user-blk,id=disk%d,addr.type=unix,addr.path=%s,"
-            "node-name=disk%i,writable=on,num-queues=%d ",
+            "node-name=disk%i,writable=on,num-queues=%d",
             i, img_path, i, sock_path, i, num_queues);
 
+        for (int j = 0; j < num_iothreads; j++) {
+            g_string_append_printf(storage_daemon_command,
+                                   ",queue-iothreads.%d=iothread%d", j, j);
+        }
+        g_string_append_printf(storage_daemon_command, " ");
+
         g_string_append_printf(cmd_line, "-chardev socket,id=char%d,path=%s ",
                                i + 1, sock_path);
     }
@@ -942,7 +953,13 @@ static void start_vhost_user_blk(GString *cmd_line, int vus_instances,
 
 static void *vhost_user_blk_test_setup(GString *cmd_line, void *arg)
 {
-    start_vhost_user_blk(cmd_line, 1, 1);
+    start_vhost_user_blk(cmd_line, 1, 1, 0);
+    return arg;
+}
+
+static void *vhost_user_blk_iothread_test_setup(GString *cmd_line, void *arg)
+{
+    start_vhost_user_blk(cmd_line, 1, 1, 1);
     return arg;
 }
 
@@ -956,13 +973,20 @@ static void *vhost_user_blk_test_setup(GString *cmd_line, void *arg)
 static void *vhost_user_blk_hotplug_test_setup(GString *cmd_line, void *arg)
 {
     /* "-chardev socket,id=char2" is used for pci_hotplug*/
-    start_vhost_user_blk(cmd_line, 2, 1);
+    start_vhost_user_blk(cmd_line, 2, 1, 0);
     return arg;
 }
 
 static void *vhost_user_blk_multiqueue_test_setup(GString *cmd_line, void *arg)
 {
-    start_vhost_user_blk(cmd_line, 2, 8);
+    start_vhost_user_blk(cmd_line, 2, 8, 0);
+    return arg;
+}
+
+static void *vhost_user_blk_multiqueue_iothreads_test_setup(GString *cmd_line,
+                                                            void *arg)
+{
+    start_vhost_user_blk(cmd_line, 2, 8, 2);
     return arg;
 }
 
@@ -992,6 +1016,14 @@ static void register_vhost_user_blk_test(void)
 
     opts.before = vhost_user_blk_multiqueue_test_setup;
     qos_add_test("multiqueue", "vhost-user-blk-pci", multiqueue, &opts);
+
+    opts.before = vhost_user_blk_iothread_test_setup;
+    qos_add_test("basic-iothread", "vhost-user-blk", basic, &opts);
+    qos_add_test("indirect-iothread", "vhost-user-blk", indirect, &opts);
+
+    opts.before = vhost_user_blk_multiqueue_iothreads_test_setup;
+    qos_add_test("multiqueue-iothreads", "vhost-user-blk-pci", multiqueue,
+                 &opts);
 }
 
 libqos_init(register_vhost_user_blk_test);
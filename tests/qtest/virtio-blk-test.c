@@ -780,6 +780,14 @@ static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void *virtio_blk_test_setup_iothreads(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line,
+                    " -object iothread,id=iothread0"
+                    " -object iothread,id=iothread1");
+    return virtio_blk_test_setup(cmd_line, arg);
+}
+
 static void register_virtio_blk_test(void)
 {
     QOSGraphTestOptions opts = {
@@ -797,6 +805,13 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    opts.before = virtio_blk_test_setup_iothreads;
+    opts.edge = (QOSGraphEdgeOptions) {
+        .extra_device_opts = "num-queues=4,"
+                             "iothread-vq-mapping=iothread0:iothread1",
+    };
+    qos_add_test("iothread-vq-mapping", "virtio-blk-pci", basic, &opts);
 }
 
 libqos_init(register_virtio_blk_test);
@@ -311,6 +311,28 @@ fail:
     unlink(tmp_path);
 }
 
+static void test_iothread_vq_mapping(void *obj, void *data,
+                                     QGuestAllocator *t_alloc)
+{
+    QVirtioSCSIPCI *scsi_pci = obj;
+    QVirtioSCSI *scsi = &scsi_pci->scsi;
+    QVirtioSCSIQueues *vs;
+    uint8_t buf[512] = { 0 };
+    const uint8_t write_cdb[VIRTIO_SCSI_CDB_SIZE] = {
+        /* WRITE(10) to LBA 0, transfer length 1 */
+        0x2a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00
+    };
+    int ret;
+
+    alloc = t_alloc;
+    vs = qvirtio_scsi_init(scsi->vdev);
+
+    ret = virtio_scsi_do_command(vs, write_cdb, NULL, 0, buf, 512, NULL);
+    g_assert_cmphex(ret, ==, 0);
+
+    qvirtio_scsi_pci_free(vs);
+}
+
 static void *virtio_scsi_hotplug_setup(GString *cmd_line, void *arg)
 {
     g_string_append(cmd_line,
@@ -359,6 +381,16 @@ static void *virtio_scsi_setup_iothread(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void *virtio_scsi_setup_iothreads(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line,
+                    " -object iothread,id=thread0"
+                    " -object iothread,id=thread1"
+                    " -blockdev driver=null-co,read-zeroes=on,node-name=null0"
+                    " -device scsi-hd,drive=null0");
+    return arg;
+}
+
 static void register_virtio_scsi_test(void)
 {
     QOSGraphTestOptions opts = { };
@@ -383,6 +415,14 @@ static void register_virtio_scsi_test(void)
     };
     qos_add_test("iothread-attach-node", "virtio-scsi-pci",
                  test_iothread_attach_node, &opts);
+
+    opts.before = virtio_scsi_setup_iothreads;
+    opts.edge = (QOSGraphEdgeOptions) {
+        .extra_device_opts = "num_queues=2,"
+                             "iothread-vq-mapping=thread0:thread1",
+    };
+    qos_add_test("iothread-vq-mapping", "virtio-scsi-pci",
+                 test_iothread_vq_mapping, &opts);
 }
 
 libqos_init(register_virtio_scsi_test);
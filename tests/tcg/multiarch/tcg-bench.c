@@ -0,0 +1,93 @@
+/*
+ * TCG translation and execution benchmark
+ *
+ * The first phase calls a large number of distinct small functions
+ * exactly once each, so its run time is dominated by translating
+ * them.  The second phase spins in a small loop, so its run time is
+ * dominated by executing translated code.  Run it with "-d jit" on a
+ * QEMU configured with --enable-profiler to get the translator's own
+ * view of the first phase, or with the insn plugin to count the
+ * guest instructions executed.
+ *
+ * Usage: tcg-bench [iterations]
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS 1000000
+
+/* 8 * 8 * 8 distinct functions, named with octal digits */
+#define FN(n)                                                   \
+    static uint64_t fn##n(uint64_t x)                           \
+    {                                                           \
+        return (x * (n * 2 + 1)) ^ (x >> (n % 7 + 1)) ^ n;      \
+    }
+#define FN8(n) FN(n##0) FN(n##1) FN(n##2) FN(n##3) \
+               FN(n##4) FN(n##5) FN(n##6) FN(n##7)
+#define FN64(n) FN8(n##0) FN8(n##1) FN8(n##2) FN8(n##3) \
+                FN8(n##4) FN8(n##5) FN8(n##6) FN8(n##7)
+
+FN64(00) FN64(01) FN64(02) FN64(03) FN64(04) FN64(05) FN64(06) FN64(07)
+
+#define P(n) fn##n
+#define P8(n) P(n##0), P(n##1), P(n##2), P(n##3), \
+              P(n##4), P(n##5), P(n##6), P(n##7)
+#define P64(n) P8(n##0), P8(n##1), P8(n##2), P8(n##3), \
+               P8(n##4), P8(n##5), P8(n##6), P8(n##7)
+
+static uint64_t (*const fns[])(uint64_t) = {
+    P64(00), P64(01), P64(02), P64(03), P64(04), P64(05), P64(06), P64(07)
+};
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = DEFAULT_ITERATIONS;
+    uint64_t acc = 1;
+    int64_t start, translate_ns, execute_ns;
+    size_t i;
+    long n;
+
+    if (argc > 1) {
+        iterations = atol(argv[1]);
+        if (iterations <= 0) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    start = now_ns();
+    for (i = 0; i < sizeof(fns) / sizeof(fns[0]); i++) {
+        acc = fns[i](acc);
+    }
+    translate_ns = now_ns() - start;
+
+    start = now_ns();
+    for (n = 0; n < iterations; n++) {
+        acc = acc * 6364136223846793005ULL + 1442695040888963407ULL;
+        acc ^= acc >> 17;
+    }
+    execute_ns = now_ns() - start;
+
+    printf("translate: %zu functions, %lld ns, %lld ns/function\n",
+           i, (long long)translate_ns, (long long)(translate_ns / i));
+    printf("execute: %ld iterations, %lld ns, %lld ps/iteration\n",
+           iterations, (long long)execute_ns,
+           (long long)(execute_ns * 1000 / iterations));
+    /* Keep the result live so that nothing is optimized away */
+    printf("result: %llx\n", (unsigned long long)acc);
+
+    return EXIT_SUCCESS;
+}
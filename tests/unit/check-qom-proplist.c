@@ -647,6 +647,30 @@ static void test_qom_partial_path(void)
     object_unparent(cont1);
 }
 
+static bool test_late_prop_get(Object *obj, Error **errp)
+{
+    return true;
+}
+
+static void test_dummy_late_class_prop(void)
+{
+    Object *obj = object_new(TYPE_DUMMY);
+
+    /* Look up properties, so that the class caches them */
+    g_assert(object_property_find(obj, "sv"));
+    g_assert(object_property_find(obj, "type"));
+    g_assert(!object_property_find(obj, "late"));
+
+    /* A property added later to an ancestor class must be found too */
+    object_class_property_add_bool(object_class_by_name(TYPE_OBJECT), "late",
+                                   test_late_prop_get, NULL);
+    g_assert(object_property_find(obj, "late"));
+    g_assert(object_property_get_bool(obj, "late", &error_abort));
+    g_assert(object_property_find(obj, "sv"));
+
+    object_unref(obj);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -666,6 +690,8 @@ int main(int argc, char **argv)
     g_test_add_func("/qom/proplist/class_iterator", test_dummy_class_iterator);
     g_test_add_func("/qom/proplist/delchild", test_dummy_delchild);
     g_test_add_func("/qom/resolve/partial", test_qom_partial_path);
+    /* Must be last, since it adds a property to all objects */
+    g_test_add_func("/qom/proplist/lateclassprop", test_dummy_late_class_prop);
 
     return g_test_run();
 }
@@ -619,7 +619,7 @@ static void test_propagate_mirror(void)
     mirror_start("job0", src, target, NULL, JOB_DEFAULT, 0, 0, 0,
                  MIRROR_SYNC_MODE_NONE, MIRROR_OPEN_BACKING_CHAIN, false,
                  BLOCKDEV_ON_ERROR_REPORT, BLOCKDEV_ON_ERROR_REPORT,
-                 false, "filter_node", MIRROR_COPY_MODE_BACKGROUND,
+                 false, "filter_node", MIRROR_COPY_MODE_BACKGROUND, 0,
                  &error_abort);
     job = job_get("job0");
     filter = bdrv_find_node("filter_node");
@@ -743,6 +743,110 @@ static void test_attach_preserve_blk_ctx(void)
     blk_unref(blk);
 }
 
+static int coroutine_fn bdrv_test_multi_ctx_co_preadv(BlockDriverState *bs,
+                                                      uint64_t offset,
+                                                      uint64_t bytes,
+                                                      QEMUIOVector *qiov,
+                                                      int flags)
+{
+    AioContext **req_ctx = bs->opaque;
+
+    *req_ctx = qemu_get_current_aio_context();
+    return 0;
+}
+
+static BlockDriver bdrv_test_multi_ctx = {
+    .format_name            = "test-multi-ctx",
+    .instance_size          = sizeof(AioContext *),
+    .supports_multi_context = true,
+
+    .bdrv_co_preadv         = bdrv_test_multi_ctx_co_preadv,
+};
+
+typedef struct MultiCtxReq {
+    BlockBackend *blk;
+    QEMUIOVector qiov;
+    AioContext *cb_ctx;
+    bool done;
+} MultiCtxReq;
+
+static void test_multi_ctx_cb(void *opaque, int ret)
+{
+    MultiCtxReq *req = opaque;
+
+    g_assert_cmpint(ret, ==, 0);
+    req->cb_ctx = qemu_get_current_aio_context();
+    qatomic_set(&req->done, true);
+    aio_wait_kick();
+}
+
+static void test_multi_ctx_submit_bh(void *opaque)
+{
+    MultiCtxReq *req = opaque;
+    AioContext *ctx = blk_get_aio_context(req->blk);
+
+    aio_context_acquire(ctx);
+    blk_aio_preadv(req->blk, 0, &req->qiov, 0, test_multi_ctx_cb, req);
+    aio_context_release(ctx);
+}
+
+/*
+ * Submit a read from @submit_ctx, return the AioContexts the driver and
+ * the completion callback ran in
+ */
+static void test_multi_ctx_read(BlockBackend *blk, AioContext *submit_ctx,
+                                AioContext **req_ctx, AioContext **cb_ctx)
+{
+    uint8_t buf[512];
+    MultiCtxReq req = { .blk = blk };
+
+    qemu_iovec_init_buf(&req.qiov, buf, sizeof(buf));
+    aio_bh_schedule_oneshot(submit_ctx, test_multi_ctx_submit_bh, &req);
+    AIO_WAIT_WHILE(NULL, !qatomic_read(&req.done));
+
+    *req_ctx = *(AioContext **)blk_bs(blk)->opaque;
+    *cb_ctx = req.cb_ctx;
+}
+
+static void test_multi_context(void)
+{
+    IOThread *home = iothread_new();
+    IOThread *other = iothread_new();
+    AioContext *home_ctx = iothread_get_aio_context(home);
+    AioContext *other_ctx = iothread_get_aio_context(other);
+    AioContext *req_ctx, *cb_ctx;
+    BlockBackend *blk;
+    BlockDriverState *bs;
+
+    blk = blk_new(home_ctx, BLK_PERM_ALL, BLK_PERM_ALL);
+    bs = bdrv_new_open_driver(&bdrv_test_multi_ctx, "base", BDRV_O_RDWR,
+                              &error_abort);
+    bs->total_sectors = 65536 / BDRV_SECTOR_SIZE;
+    blk_insert_bs(blk, bs, &error_abort);
+
+    /* By default requests are moved into the BlockBackend's AioContext */
+    test_multi_ctx_read(blk, other_ctx, &req_ctx, &cb_ctx);
+    g_assert(req_ctx == home_ctx);
+    g_assert(cb_ctx == home_ctx);
+
+    /* A multi-context BlockBackend runs them where they come from */
+    blk_set_multi_context(blk, true);
+    test_multi_ctx_read(blk, other_ctx, &req_ctx, &cb_ctx);
+    g_assert(req_ctx == other_ctx);
+    g_assert(cb_ctx == other_ctx);
+
+    test_multi_ctx_read(blk, home_ctx, &req_ctx, &cb_ctx);
+    g_assert(req_ctx == home_ctx);
+    g_assert(cb_ctx == home_ctx);
+
+    blk_set_multi_context(blk, false);
+    aio_context_acquire(home_ctx);
+    blk_set_aio_context(blk, qemu_get_aio_context(), &error_abort);
+    aio_context_release(home_ctx);
+    bdrv_unref(bs);
+    blk_unref(blk);
+}
+
 int main(int argc, char **argv)
 {
     int i;
@@ -763,6 +867,7 @@ int main(int argc, char **argv)
     g_test_add_func("/propagate/basic", test_propagate_basic);
     g_test_add_func("/propagate/diamond", test_propagate_diamond);
     g_test_add_func("/propagate/mirror", test_propagate_mirror);
+    g_test_add_func("/multi-context/aio", test_multi_context);
 
     return g_test_run();
 }
@@ -0,0 +1,77 @@
+/*
+ * Bounce buffer pool unit-tests.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bounce-pool.h"
+
+static void test_bounce_pool_reuse(void)
+{
+    BouncePool *pool = bounce_pool_new();
+    void *a, *b;
+
+    a = bounce_pool_try_alloc(pool, 100 * 1024, 4096);
+    g_assert_nonnull(a);
+    g_assert_true(QEMU_PTR_IS_ALIGNED(a, 128 * 1024));
+    memset(a, 0xaa, 128 * 1024);
+    bounce_pool_release(pool, a, 100 * 1024);
+
+    /* Same size class, so the buffer is reused */
+    b = bounce_pool_try_alloc(pool, 128 * 1024, 512);
+    g_assert_true(a == b);
+    bounce_pool_release(pool, b, 128 * 1024);
+
+    /* Larger alignment than the class cannot reuse it */
+    b = bounce_pool_try_alloc(pool, 128 * 1024, 256 * 1024);
+    g_assert_true(QEMU_PTR_IS_ALIGNED(b, 256 * 1024));
+    bounce_pool_release(pool, b, 128 * 1024);
+
+    bounce_pool_release(pool, NULL, 128 * 1024);
+    bounce_pool_free(pool);
+}
+
+static void test_bounce_pool_unpooled(void)
+{
+    BouncePool *pool = bounce_pool_new();
+    size_t sizes[] = { 1, 4096, 32 * 1024, 2 * 1024 * 1024 + 1 };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        void *buf = bounce_pool_try_alloc(pool, sizes[i], 4096);
+
+        g_assert_nonnull(buf);
+        g_assert_true(QEMU_PTR_IS_ALIGNED(buf, 4096));
+        memset(buf, 0x55, sizes[i]);
+        bounce_pool_release(pool, buf, sizes[i]);
+    }
+    bounce_pool_free(pool);
+}
+
+/* Releasing more buffers than the pool keeps frees the rest */
+static void test_bounce_pool_depth(void)
+{
+    BouncePool *pool = bounce_pool_new();
+    void *bufs[16];
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(bufs); i++) {
+        bufs[i] = bounce_pool_try_alloc(pool, 2 * 1024 * 1024, 4096);
+        g_assert_nonnull(bufs[i]);
+        g_assert_true(QEMU_PTR_IS_ALIGNED(bufs[i], 2 * 1024 * 1024));
+    }
+    for (i = 0; i < ARRAY_SIZE(bufs); i++) {
+        bounce_pool_release(pool, bufs[i], 2 * 1024 * 1024);
+    }
+    bounce_pool_free(pool);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bounce-pool/reuse", test_bounce_pool_reuse);
+    g_test_add_func("/bounce-pool/unpooled", test_bounce_pool_unpooled);
+    g_test_add_func("/bounce-pool/depth", test_bounce_pool_depth);
+    return g_test_run();
+}
@@ -1307,6 +1307,47 @@ static void char_file_test(void)
     char_file_test_internal(NULL, NULL);
 }
 
+static void char_file_flush_interval_test(void)
+{
+    char *tmp_path = g_dir_make_tmp("qemu-test-char.XXXXXX", NULL);
+    char *out = g_build_filename(tmp_path, "out", NULL);
+    ChardevFile file = { .out = out,
+                         .has_flush_interval = true,
+                         .flush_interval = 60000 };
+    ChardevBackend backend = { .type = CHARDEV_BACKEND_KIND_FILE,
+                               .u.file.data = &file };
+    char *contents = NULL;
+    Chardev *chr;
+    gsize length;
+    int ret;
+
+    chr = qemu_chardev_new(NULL, TYPE_CHARDEV_FILE, &backend,
+                           NULL, &error_abort);
+    ret = qemu_chr_write_all(chr, (uint8_t *)"hello!", 6);
+    g_assert_cmpint(ret, ==, 6);
+    ret = qemu_chr_write(chr, (uint8_t *)"hello!", 6, false);
+    g_assert_cmpint(ret, ==, 6);
+
+    /* Still buffered */
+    ret = g_file_get_contents(out, &contents, &length, NULL);
+    g_assert(ret == TRUE);
+    g_assert_cmpint(length, ==, 0);
+    g_free(contents);
+
+    /* Flushed when the chardev goes away */
+    object_unparent(OBJECT(chr));
+    ret = g_file_get_contents(out, &contents, &length, NULL);
+    g_assert(ret == TRUE);
+    g_assert_cmpint(length, ==, 12);
+    g_assert(strncmp(contents, "hello!hello!", 12) == 0);
+
+    g_unlink(out);
+    g_free(contents);
+    g_rmdir(tmp_path);
+    g_free(tmp_path);
+    g_free(out);
+}
+
 static void char_null_test(void)
 {
     Error *err = NULL;
@@ -1472,6 +1513,7 @@ int main(int argc, char **argv)
     g_test_add_func("/char/pipe", char_pipe_test);
 #endif
     g_test_add_func("/char/file", char_file_test);
+    g_test_add_func("/char/file-flush-interval", char_file_flush_interval_test);
 #ifndef _WIN32
     g_test_add_func("/char/file-fifo", char_file_fifo_test);
 #endif
@@ -13,6 +13,7 @@
 #include "qemu/hbitmap.h"
 #include "qemu/bitmap.h"
 #include "block/block.h"
+#include "qemu/thread.h"
 
 #define LOG_BITS_PER_LONG          (BITS_PER_LONG == 32 ? 5 : 6)
 
@@ -1042,6 +1043,68 @@ static void test_hbitmap_next_dirty_area_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_dirty_area_check(data, 0, INT64_MAX);
 }
 
+#ifdef CONFIG_ATOMIC64
+#define SET_ATOMIC_THREADS 4
+
+typedef struct TestSetAtomicThread {
+    TestHBitmapData *data;
+    int index;
+} TestSetAtomicThread;
+
+/* Overlapping ranges that cross word boundaries on every level */
+static void test_set_atomic_range(int thread, int i,
+                                  uint64_t *first, uint64_t *count)
+{
+    *first = ((uint64_t)i * SET_ATOMIC_THREADS + thread) * (L1 + 3);
+    *count = L1 * 2 + thread;
+}
+
+static void *test_set_atomic_thread(void *opaque)
+{
+    TestSetAtomicThread *t = opaque;
+    uint64_t first, count;
+    int i;
+
+    for (i = 0; i < L2 / 8; i++) {
+        test_set_atomic_range(t->index, i, &first, &count);
+        hbitmap_set_atomic(t->data->hb, first, count);
+    }
+    return NULL;
+}
+
+static void test_hbitmap_set_atomic(TestHBitmapData *data,
+                                    const void *unused)
+{
+    TestSetAtomicThread t[SET_ATOMIC_THREADS];
+    QemuThread threads[SET_ATOMIC_THREADS];
+    uint64_t first, count;
+    int i, j;
+
+    hbitmap_test_init(data, L3, 0);
+    for (j = 0; j < SET_ATOMIC_THREADS; j++) {
+        t[j] = (TestSetAtomicThread) { .data = data, .index = j };
+        qemu_thread_create(&threads[j], "set-atomic", test_set_atomic_thread,
+                           &t[j], QEMU_THREAD_JOINABLE);
+    }
+    for (j = 0; j < SET_ATOMIC_THREADS; j++) {
+        qemu_thread_join(&threads[j]);
+    }
+
+    /* Fill the shadow bitmap and check that counts and levels agree */
+    for (j = 0; j < SET_ATOMIC_THREADS; j++) {
+        for (i = 0; i < L2 / 8; i++) {
+            test_set_atomic_range(j, i, &first, &count);
+            bitmap_set(data->bits, first, count);
+        }
+    }
+    hbitmap_test_check(data, 0);
+
+    /* Setting an already dirty range changes nothing */
+    hbitmap_set_atomic(data->hb, 0, L1);
+    hbitmap_test_check(data, 0);
+}
+#endif
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1058,6 +1121,9 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/set/general", test_hbitmap_set);
     hbitmap_test_add("/hbitmap/set/twice", test_hbitmap_set_twice);
     hbitmap_test_add("/hbitmap/set/overlap", test_hbitmap_set_overlap);
+#ifdef CONFIG_ATOMIC64
+    hbitmap_test_add("/hbitmap/set/atomic", test_hbitmap_set_atomic);
+#endif
     hbitmap_test_add("/hbitmap/reset/empty", test_hbitmap_reset_empty);
     hbitmap_test_add("/hbitmap/reset/general", test_hbitmap_reset);
     hbitmap_test_add("/hbitmap/reset/all", test_hbitmap_reset_all);
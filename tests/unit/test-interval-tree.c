@@ -0,0 +1,130 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Interval tree unit-tests.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+#define NODES   512
+#define RANGE   4096
+
+static IntervalTreeNode nodes[NODES];
+static bool in_tree[NODES];
+
+static bool overlaps(IntervalTreeNode *n, uint64_t start, uint64_t last)
+{
+    return n->start <= last && start <= n->last;
+}
+
+/* Compare the result of an iteration with a linear scan of all nodes */
+static void check_query(IntervalTreeRoot *root, uint64_t start,
+                        uint64_t last)
+{
+    bool seen[NODES] = { false };
+    IntervalTreeNode *n;
+    uint64_t prev_start = 0;
+    int i, count = 0;
+
+    for (n = interval_tree_iter_first(root, start, last); n;
+         n = interval_tree_iter_next(root, n, start, last)) {
+        i = n - nodes;
+        g_assert_cmpint(i, >=, 0);
+        g_assert_cmpint(i, <, NODES);
+        g_assert_true(in_tree[i]);
+        g_assert_false(seen[i]);
+        g_assert_true(overlaps(n, start, last));
+        g_assert_cmpuint(n->start, >=, prev_start);
+        prev_start = n->start;
+        seen[i] = true;
+        count++;
+    }
+
+    for (i = 0; i < NODES; i++) {
+        if (in_tree[i] && overlaps(&nodes[i], start, last)) {
+            g_assert_true(seen[i]);
+            count--;
+        }
+    }
+    g_assert_cmpint(count, ==, 0);
+}
+
+static void test_interval_tree_empty(void)
+{
+    IntervalTreeRoot root = { NULL };
+
+    g_assert_null(interval_tree_iter_first(&root, 0, UINT64_MAX));
+}
+
+static void test_interval_tree_random(void)
+{
+    IntervalTreeRoot root = { NULL };
+    int i, round;
+
+    memset(in_tree, 0, sizeof(in_tree));
+
+    for (round = 0; round < 20000; round++) {
+        i = g_test_rand_int_range(0, NODES);
+        if (in_tree[i]) {
+            interval_tree_remove(&nodes[i], &root);
+            in_tree[i] = false;
+        } else {
+            nodes[i].start = g_test_rand_int_range(0, RANGE);
+            nodes[i].last = nodes[i].start + g_test_rand_int_range(0, 64);
+            interval_tree_insert(&nodes[i], &root);
+            in_tree[i] = true;
+        }
+
+        if (round % 16 == 0) {
+            uint64_t start = g_test_rand_int_range(0, RANGE);
+
+            check_query(&root, start,
+                        start + g_test_rand_int_range(0, 256));
+        }
+    }
+
+    check_query(&root, 0, UINT64_MAX);
+    for (i = 0; i < NODES; i++) {
+        if (in_tree[i]) {
+            interval_tree_remove(&nodes[i], &root);
+            in_tree[i] = false;
+        }
+    }
+    g_assert_null(root.root);
+}
+
+/* Identical intervals are kept apart by their address */
+static void test_interval_tree_same_start(void)
+{
+    IntervalTreeRoot root = { NULL };
+    int i;
+
+    memset(in_tree, 0, sizeof(in_tree));
+
+    for (i = 0; i < 64; i++) {
+        nodes[i].start = 100;
+        nodes[i].last = 100 + i;
+        interval_tree_insert(&nodes[i], &root);
+        in_tree[i] = true;
+    }
+    check_query(&root, 100, 100);
+    check_query(&root, 130, 200);
+    check_query(&root, 0, 99);
+
+    for (i = 0; i < 64; i += 2) {
+        interval_tree_remove(&nodes[i], &root);
+        in_tree[i] = false;
+    }
+    check_query(&root, 120, 120);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/empty", test_interval_tree_empty);
+    g_test_add_func("/interval-tree/random", test_interval_tree_random);
+    g_test_add_func("/interval-tree/same-start",
+                    test_interval_tree_same_start);
+    return g_test_run();
+}
@@ -20,6 +20,7 @@
 
 #include "qemu/osdep.h"
 #include "io/channel-buffer.h"
+#include "qapi/error.h"
 #include "qemu/module.h"
 #include "io-channel-helpers.h"
 
@@ -41,6 +42,45 @@ static void test_io_channel_buf(void)
 }
 
 
+static void test_io_channel_buf_queue_writes(void)
+{
+    QIOChannelBuffer *buf = qio_channel_buffer_new(0);
+    QIOChannel *ioc = QIO_CHANNEL(buf);
+    size_t big_len = 128 * 1024;
+    char *big = g_malloc(big_len);
+
+    memset(big, 'x', big_len);
+    qio_channel_queue_writes(ioc);
+
+    /* Small writes are held back */
+    g_assert_cmpint(qio_channel_write_all(ioc, "Hello", 5, &error_abort),
+                    ==, 0);
+    g_assert_cmpint(qio_channel_write_all(ioc, " world", 6, &error_abort),
+                    ==, 0);
+    g_assert_cmpint(buf->usage, ==, 0);
+
+    g_assert_cmpint(qio_channel_flush_queued_writes(ioc, &error_abort),
+                    ==, 0);
+    g_assert_cmpint(buf->usage, ==, 11);
+    g_assert(memcmp(buf->data, "Hello world", 11) == 0);
+
+    /* A large write pushes out the queued data before it */
+    qio_channel_queue_writes(ioc);
+    g_assert_cmpint(qio_channel_write_all(ioc, "!", 1, &error_abort), ==, 0);
+    g_assert_cmpint(qio_channel_write_all(ioc, big, big_len, &error_abort),
+                    ==, 0);
+    g_assert_cmpint(buf->usage, ==, 12 + big_len);
+    g_assert(buf->data[11] == '!');
+    g_assert(memcmp(buf->data + 12, big, big_len) == 0);
+    g_assert_cmpint(qio_channel_flush_queued_writes(ioc, &error_abort),
+                    ==, 0);
+    g_assert_cmpint(buf->usage, ==, 12 + big_len);
+
+    g_free(big);
+    object_unref(OBJECT(buf));
+}
+
+
 int main(int argc, char **argv)
 {
     module_call_init(MODULE_INIT_QOM);
@@ -48,5 +88,7 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/io/channel/buf", test_io_channel_buf);
+    g_test_add_func("/io/channel/buf/queue-writes",
+                    test_io_channel_buf_queue_writes);
     return g_test_run();
 }
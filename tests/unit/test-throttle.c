@@ -729,6 +729,18 @@ static void test_groups(void)
     throttle_group_get_config(tgm3, &cfg2);
     g_assert(!memcmp(&cfg1, &cfg2, sizeof(cfg1)));
 
+    /* Members get an even share unless told otherwise */
+    g_assert(tgm1->weight == THROTTLE_GROUP_DEFAULT_WEIGHT);
+    g_assert(tgm3->weight == THROTTLE_GROUP_DEFAULT_WEIGHT);
+    g_assert(tgm1->priority == 0);
+
+    /* The share of a member does not affect the other members */
+    throttle_group_set_share(tgm1, 400, 1);
+    g_assert(tgm1->weight == 400);
+    g_assert(tgm1->priority == 1);
+    g_assert(tgm3->weight == THROTTLE_GROUP_DEFAULT_WEIGHT);
+    g_assert(tgm3->priority == 0);
+
     throttle_group_unregister_tgm(tgm1);
     throttle_group_unregister_tgm(tgm2);
     throttle_group_unregister_tgm(tgm3);
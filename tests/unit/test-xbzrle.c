@@ -174,6 +174,59 @@ static void test_encode_decode(void)
     }
 }
 
+#define ACCEL_CASES 64
+
+static void fill_accel_case(int seed, uint8_t *old, uint8_t *new)
+{
+    GRand *rand = g_rand_new_with_seed(seed);
+    int i;
+
+    /* short, frequently interrupted runs of either kind */
+    for (i = 0; i < XBZRLE_PAGE_SIZE; i++) {
+        old[i] = g_rand_int_range(rand, 0, 256);
+        new[i] = g_rand_int_range(rand, 0, seed % 8 + 2) ? old[i] : ~old[i];
+    }
+    g_rand_free(rand);
+}
+
+static void test_encode_accel(void)
+{
+    uint8_t *old = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *new = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *ref = g_malloc(ACCEL_CASES * XBZRLE_PAGE_SIZE);
+    int ref_dlen[ACCEL_CASES];
+    bool first = true;
+    int i, dlen;
+
+    /*
+     * Every encoder must produce exactly the output of the most
+     * preferred one, including where it gives up on overflow.
+     */
+    do {
+        for (i = 0; i < ACCEL_CASES; i++) {
+            fill_accel_case(i, old, new);
+            dlen = xbzrle_encode_buffer(old, new, XBZRLE_PAGE_SIZE,
+                                        compressed, XBZRLE_PAGE_SIZE);
+            if (first) {
+                ref_dlen[i] = dlen;
+                memcpy(ref + i * XBZRLE_PAGE_SIZE, compressed,
+                       MAX(dlen, 0));
+                continue;
+            }
+            g_assert_cmpint(dlen, ==, ref_dlen[i]);
+            g_assert(memcmp(ref + i * XBZRLE_PAGE_SIZE, compressed,
+                            MAX(dlen, 0)) == 0);
+        }
+        first = false;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old);
+    g_free(new);
+    g_free(compressed);
+    g_free(ref);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +239,8 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    /* must be last, it cycles through the encoders */
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
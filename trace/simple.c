@@ -12,6 +12,7 @@
 #ifndef _WIN32
 #include <pthread.h>
 #endif
+#include "qemu/atomic.h"
 #include "qemu/timer.h"
 #include "trace/control.h"
 #include "trace/simple.h"
@@ -30,9 +31,6 @@
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
-
 /*
  * Trace records are written out by a dedicated thread.  The thread waits for
  * records to become available, writes them out, and then waits again.
@@ -44,14 +42,45 @@ static GCond trace_empty_cond;
 static bool trace_available;
 static bool trace_writeout_enabled;
 
+/*
+ * Each thread writes its records to a ring buffer of its own.  A buffer has
+ * a single producer, its thread, and a single consumer, the writeout
+ * thread, so recording an event needs neither a lock nor an atomic
+ * read-modify-write, and threads tracing at the same time do not bounce
+ * cache lines between each other.
+ *
+ * @head and @tail only ever increase; they are taken modulo TRACE_BUF_LEN,
+ * which must be a power of two, to index @data.
+ */
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    TRACE_BUF_LEN = 4096 * 16,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
+typedef struct TraceThreadBuffer {
+    struct TraceThreadBuffer *next;
+    /* Cleared when the thread exits, so that another one can take over */
+    int owned;
+    /* Only used by the owner */
+    bool busy;
+    unsigned int tail_cache;
+    /* End of the records that are complete, written by the owner */
+    unsigned int head;
+    uint8_t data[TRACE_BUF_LEN];
+    /*
+     * End of the records written out, written by the writeout thread.
+     * Kept away from @head so that the two do not share a cache line.
+     */
+    unsigned int tail;
+} TraceThreadBuffer;
+
+static void trace_thread_buffer_release(gpointer opaque);
+
+static TraceThreadBuffer *trace_buffers;
+static __thread TraceThreadBuffer *trace_thread_buffer;
+static GPrivate trace_thread_buffer_key =
+    G_PRIVATE_INIT(trace_thread_buffer_release);
+static int trace_kicked;
 static volatile gint dropped_events;
 static uint32_t trace_pid;
 static FILE *trace_fp;
@@ -76,53 +105,67 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_buffer(TraceThreadBuffer *buf, unsigned int idx,
+                             void *dataptr, size_t size)
+{
+    unsigned int off = idx % TRACE_BUF_LEN;
+    size_t first = MIN(size, TRACE_BUF_LEN - off);
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+    memcpy(dataptr, buf->data + off, first);
+    memcpy((uint8_t *)dataptr + first, buf->data, size - first);
+}
+
+static unsigned int write_to_buffer(TraceThreadBuffer *buf, unsigned int idx,
+                                    const void *dataptr, size_t size)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
+    unsigned int off = idx % TRACE_BUF_LEN;
+    size_t first = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(buf->data + off, dataptr, first);
+    memcpy(buf->data, (const uint8_t *)dataptr + first, size - first);
+    return idx + size; /* most callers wants to know where to write next */
+}
+
+static bool write_buffer_to_file(TraceThreadBuffer *buf, unsigned int idx,
+                                 size_t size)
+{
+    unsigned int off = idx % TRACE_BUF_LEN;
+    size_t first = MIN(size, TRACE_BUF_LEN - off);
+
+    if (fwrite(buf->data + off, first, 1, trace_fp) != 1) {
+        return false;
     }
+    return size == first ||
+           fwrite(buf->data, size - first, 1, trace_fp) == 1;
 }
+
 /**
- * Read a trace record from the trace buffer
+ * Find the oldest trace record that is ready to be written out
+ *
+ * @record      Filled with the header of the record
  *
- * @idx         Trace buffer index
- * @record      Trace record to fill
+ * Threads record events independently, so merge their buffers by
+ * timestamp to keep the trace file mostly in order.
  *
- * Returns false if the record is not valid.
+ * Returns the buffer holding the record at its tail, or NULL if all
+ * buffers are empty.
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static TraceThreadBuffer *get_trace_record(TraceRecord *record)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    TraceThreadBuffer *buf, *oldest = NULL;
+    TraceRecord header;
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+    for (buf = qatomic_load_acquire(&trace_buffers); buf; buf = buf->next) {
+        if (qatomic_load_acquire(&buf->head) == buf->tail) {
+            continue;
+        }
+        read_from_buffer(buf, buf->tail, &header, sizeof(header));
+        if (!oldest || header.timestamp_ns < record->timestamp_ns) {
+            oldest = buf;
+            *record = header;
+        }
     }
-
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
+    return oldest;
 }
 
 /**
@@ -145,10 +188,21 @@ static void flush_trace_file(bool wait)
 
 static void wait_for_trace_records_available(void)
 {
+    gint64 end_time = g_get_monotonic_time() + G_TIME_SPAN_SECOND;
+
     g_mutex_lock(&trace_lock);
     while (!(trace_available && trace_writeout_enabled)) {
         g_cond_signal(&trace_empty_cond);
-        g_cond_wait(&trace_available_cond, &trace_lock);
+        if (!trace_writeout_enabled) {
+            g_cond_wait(&trace_available_cond, &trace_lock);
+        } else if (!g_cond_wait_until(&trace_available_cond, &trace_lock,
+                                      end_time)) {
+            /*
+             * Threads that trace rarely do not fill their buffer enough to
+             * kick us, write out their records every now and then too.
+             */
+            break;
+        }
     }
     trace_available = false;
     g_mutex_unlock(&trace_lock);
@@ -156,18 +210,19 @@ static void wait_for_trace_records_available(void)
 
 static gpointer writeout_thread(gpointer opaque)
 {
-    TraceRecord *recordptr;
+    TraceThreadBuffer *buf;
+    TraceRecord record;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
     int dropped_count;
     size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
 
     for (;;) {
         wait_for_trace_records_available();
+        qatomic_set(&trace_kicked, 0);
 
         if (g_atomic_int_get(&dropped_events)) {
             dropped.rec.event = DROPPED_EVENT_ID;
@@ -183,12 +238,10 @@ static gpointer writeout_thread(gpointer opaque)
             unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
+        while ((buf = get_trace_record(&record)) != NULL) {
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+            write_buffer_to_file(buf, buf->tail, record.length);
+            qatomic_store_release(&buf->tail, buf->tail + record.length);
         }
 
         fflush(trace_fp);
@@ -196,87 +249,119 @@ static gpointer writeout_thread(gpointer opaque)
     return NULL;
 }
 
+/*
+ * Give the thread a buffer, preferably one left behind by a thread that
+ * has exited.  Buffers are never freed, the writeout thread walks the list
+ * without a lock.
+ */
+static TraceThreadBuffer *trace_thread_buffer_get(void)
+{
+    TraceThreadBuffer *buf, *next;
+
+    for (buf = qatomic_load_acquire(&trace_buffers); buf; buf = buf->next) {
+        if (!qatomic_read(&buf->owned) && !qatomic_xchg(&buf->owned, 1)) {
+            goto out;
+        }
+    }
+
+    /* don't use g_malloc, can deadlock when traced */
+    buf = calloc(1, sizeof(*buf));
+    if (!buf) {
+        return NULL;
+    }
+    buf->owned = 1;
+    do {
+        next = qatomic_read(&trace_buffers);
+        buf->next = next;
+    } while (qatomic_cmpxchg(&trace_buffers, next, buf) != next);
+
+out:
+    trace_thread_buffer = buf;
+    g_private_set(&trace_thread_buffer_key, buf);
+    return buf;
+}
+
+static void trace_thread_buffer_release(gpointer opaque)
+{
+    TraceThreadBuffer *buf = opaque;
+
+    trace_thread_buffer = NULL;
+    qatomic_store_release(&buf->owned, 0);
+}
+
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off, &val,
+                                   sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off, &slen,
+                                   sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off, s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuffer *buf = trace_thread_buffer;
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
+    TraceRecord record;
 
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
+    if (unlikely(!buf)) {
+        buf = trace_thread_buffer_get();
+        if (!buf) {
+            g_atomic_int_inc(&dropped_events);
+            return -ENOMEM;
+        }
+    }
+
+    /* An event traced from a signal handler in the middle of another one */
+    if (buf->busy) {
+        g_atomic_int_inc(&dropped_events);
+        return -EBUSY;
+    }
+    buf->busy = true;
+    barrier();
 
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
+    if (buf->head + rec_len - buf->tail_cache > TRACE_BUF_LEN) {
+        buf->tail_cache = qatomic_load_acquire(&buf->tail);
+        if (buf->head + rec_len - buf->tail_cache > TRACE_BUF_LEN) {
             /* Trace Buffer Full, Event dropped ! */
             g_atomic_int_inc(&dropped_events);
+            barrier();
+            buf->busy = false;
             return -ENOSPC;
         }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
-
-    idx = old_idx % TRACE_BUF_LEN;
+    }
 
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    record.event = event;
+    record.timestamp_ns = get_clock();
+    record.length = rec_len;
+    record.pid = trace_pid;
 
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
+    rec->buf = buf;
+    rec->rec_off = write_to_buffer(buf, buf->head, &record, sizeof(record));
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
-    }
-}
-
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
-    }
-    return idx; /* most callers wants to know where to write next */
-}
-
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
-        flush_trace_file(false);
+    TraceThreadBuffer *buf = rec->buf;
+
+    /* Publish the record to the writeout thread */
+    qatomic_store_release(&buf->head, rec->rec_off);
+    barrier();
+    buf->busy = false;
+
+    if (buf->head - buf->tail_cache > TRACE_BUF_FLUSH_THRESHOLD) {
+        buf->tail_cache = qatomic_load_acquire(&buf->tail);
+        if (buf->head - buf->tail_cache > TRACE_BUF_FLUSH_THRESHOLD &&
+            !qatomic_xchg(&trace_kicked, 1)) {
+            flush_trace_file(false);
+        }
     }
 }
 
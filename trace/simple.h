@@ -19,7 +19,7 @@ void st_init_group(size_t group);
 void st_flush_trace_buffer(void);
 
 typedef struct {
-    unsigned int tbuf_idx;
+    struct TraceThreadBuffer *buf;
     unsigned int rec_off;
 } TraceBufferRecord;
 
@@ -138,6 +138,9 @@ struct QemuConsole {
     QEMUTimer *ui_timer;
     const GraphicHwOps *hw_ops;
     void *hw;
+    /* damage collected while hw_ops->gfx_update runs */
+    bool damage_batched;
+    pixman_region32_t damage;
 
     /* Text console state */
     int width;
@@ -268,15 +271,44 @@ void graphic_hw_update_done(QemuConsole *con)
     }
 }
 
+static void dpy_gfx_update_flush(QemuConsole *con)
+{
+    pixman_box32_t *rects;
+    int i, n;
+
+    con->damage_batched = false;
+    rects = pixman_region32_rectangles(&con->damage, &n);
+    for (i = 0; i < n; i++) {
+        dpy_gfx_update(con, rects[i].x1, rects[i].y1,
+                       rects[i].x2 - rects[i].x1, rects[i].y2 - rects[i].y1);
+    }
+    pixman_region32_fini(&con->damage);
+}
+
 void graphic_hw_update(QemuConsole *con)
 {
     bool async = false;
+    bool batch;
+
     con = con ? con : active_console;
     if (!con) {
         return;
     }
     if (con->hw_ops->gfx_update) {
+        /*
+         * Devices typically report one update per dirty scanline or band.
+         * Merge them so that the display backends see a few rectangles
+         * rather than hundreds of slivers per refresh.
+         */
+        batch = !con->damage_batched;
+        if (batch) {
+            con->damage_batched = true;
+            pixman_region32_init(&con->damage);
+        }
         con->hw_ops->gfx_update(con->hw);
+        if (batch) {
+            dpy_gfx_update_flush(con);
+        }
         async = con->hw_ops->gfx_update_async;
     }
     if (!async) {
@@ -1641,6 +1673,14 @@ void dpy_gfx_update(QemuConsole *con, int x, int y, int w, int h)
     w = MIN(w, width - x);
     h = MIN(h, height - y);
 
+    if (con->damage_batched) {
+        if (w > 0 && h > 0) {
+            pixman_region32_union_rect(&con->damage, &con->damage,
+                                       x, y, w, h);
+        }
+        return;
+    }
+
     if (!qemu_console_is_visible(con)) {
         return;
     }
@@ -1688,6 +1728,12 @@ void dpy_gfx_replace_surface(QemuConsole *con,
 
     assert(old_surface != surface);
 
+    if (con->damage_batched) {
+        /* Switching redraws everything, earlier damage is moot */
+        pixman_region32_fini(&con->damage);
+        pixman_region32_init(&con->damage);
+    }
+
     con->surface = surface;
     QLIST_FOREACH(dcl, &s->listeners, next) {
         if (con != (dcl->con ? dcl->con : active_console)) {
@@ -147,7 +147,12 @@ static void egl_scanout_flush(DisplayChangeListener *dcl,
         egl_fb_blit(&edpy->blit_fb, &edpy->guest_fb, edpy->y_0_top);
     }
 
-    egl_fb_read(edpy->ds, &edpy->blit_fb);
+    /*
+     * Only read back what changed: at high resolutions the readback is
+     * what limits the frame rate, and the consumers (VNC, or SPICE with
+     * video streaming) only look at the damaged area anyway.
+     */
+    egl_fb_read_rect(edpy->ds, &edpy->blit_fb, x, y, w, h);
     dpy_gfx_update(edpy->dcl.con, x, y, w, h);
 }
 
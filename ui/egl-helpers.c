@@ -110,6 +110,28 @@ void egl_fb_read(DisplaySurface *dst, egl_fb *src)
                  GL_BGRA, GL_UNSIGNED_BYTE, surface_data(dst));
 }
 
+void egl_fb_read_rect(DisplaySurface *dst, egl_fb *src,
+                      int x, int y, int w, int h)
+{
+    int bpp = surface_bytes_per_pixel(dst);
+
+    x = MIN(MAX(x, 0), surface_width(dst));
+    y = MIN(MAX(y, 0), surface_height(dst));
+    w = MIN(w, surface_width(dst) - x);
+    h = MIN(h, surface_height(dst) - y);
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, src->framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+    glPixelStorei(GL_PACK_ROW_LENGTH, surface_stride(dst) / bpp);
+    glReadPixels(x, y, w, h, GL_BGRA, GL_UNSIGNED_BYTE,
+                 (uint8_t *)surface_data(dst) + y * surface_stride(dst) +
+                 x * bpp);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+}
+
 void egl_texture_blit(QemuGLShader *gls, egl_fb *dst, egl_fb *src, bool flip)
 {
     glBindFramebuffer(GL_FRAMEBUFFER_EXT, dst->framebuffer);
@@ -470,6 +470,9 @@ static QemuOptsList qemu_spice_opts = {
         },{
             .name = "streaming-video",
             .type = QEMU_OPT_STRING,
+        },{
+            .name = "video-codecs",
+            .type = QEMU_OPT_STRING,
         },{
             .name = "agent-mouse",
             .type = QEMU_OPT_BOOL,
@@ -805,6 +808,20 @@ static void qemu_spice_init(void)
         spice_server_set_streaming_video(spice_server, SPICE_STREAM_VIDEO_OFF);
     }
 
+    str = qemu_opt_get(opts, "video-codecs");
+    if (str) {
+#if SPICE_SERVER_VERSION >= 0x000d02 /* release 0.13.2 */
+        if (spice_server_set_video_codecs(spice_server, str)) {
+            error_report("Invalid video codecs.");
+            exit(1);
+        }
+#else
+        error_report("this qemu build does not support the "
+                     "\"video-codecs\" option");
+        exit(1);
+#endif
+    }
+
     spice_server_set_agent_mouse
         (spice_server, qemu_opt_get_bool(opts, "agent-mouse", 1));
     spice_server_set_playback_compression
@@ -32,6 +32,7 @@
 #include "qemu/sockets.h"
 #include "qemu/main-loop.h"
 #include "block/aio.h"
+#include "qemu/timer.h"
 #include "trace.h"
 
 /*
@@ -45,28 +46,32 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
- * its own output buffer.
+ * While a VNC worker thread is working, the VncDisplay global lock is held
+ * in shared mode to avoid screen corruption (this does not block vnc_refresh()
+ * because it uses trylock()) but the output lock is not held because the
+ * thread works on its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * There are several worker threads, so that clients are encoded in parallel.
+ * The jobs of a single client are still run one at a time and in order,
+ * because the encoders keep compression state across updates.
  */
 
+/* Upper limit on the number of encoding threads */
+#define VNC_WORKER_THREADS_MAX 8
+
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
+    int n_threads;
     bool exit;
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
 typedef struct VncJobQueue VncJobQueue;
 
-/*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
- */
+/* We use a single global queue, shared by all encoding threads */
 static VncJobQueue *queue;
 
 static void vnc_lock_queue(VncJobQueue *queue)
@@ -235,6 +240,31 @@ static bool vnc_worker_clamp_rect(VncState *vs, VncJob *job, VncRect *rect)
     return false;
 }
 
+/*
+ * Return the first job that can run now, i.e. that is not running and whose
+ * client has no earlier job in the queue.
+ */
+static VncJob *vnc_next_job_locked(VncJobQueue *queue)
+{
+    VncJob *job, *prev;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->running) {
+            continue;
+        }
+        for (prev = QTAILQ_FIRST(&queue->jobs); prev != job;
+             prev = QTAILQ_NEXT(prev, next)) {
+            if (prev->vs == job->vs) {
+                break;
+            }
+        }
+        if (prev == job) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
 static int vnc_worker_thread_loop(VncJobQueue *queue)
 {
     VncJob *job;
@@ -242,19 +272,20 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     VncState vs = {};
     int n_rectangles;
     int saved_offset;
+    int64_t start_ns;
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    while (!(job = vnc_next_job_locked(queue)) && !queue->exit) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
-    vnc_unlock_queue(queue);
-    assert(job->vs->magic == VNC_MAGIC);
-
     if (queue->exit) {
+        vnc_unlock_queue(queue);
         return -1;
     }
+    job->running = true;
+    vnc_unlock_queue(queue);
+    assert(job->vs->magic == VNC_MAGIC);
+    start_ns = get_clock();
 
     vnc_lock_output(job->vs);
     if (job->vs->ioc == NULL || job->vs->abort == true) {
@@ -282,12 +313,12 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
-    vnc_lock_display(job->vs->vd);
+    vnc_lock_display_shared(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->ioc == NULL) {
-            vnc_unlock_display(job->vs->vd);
+            vnc_unlock_display_shared(job->vs->vd);
             /* Copy persistent encoding data */
             vnc_async_encoding_end(job->vs, &vs);
             goto disconnected;
@@ -304,7 +335,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         g_free(entry);
     }
     trace_vnc_job_nrects(&vs, job, n_rectangles);
-    vnc_unlock_display(job->vs->vd);
+    vnc_unlock_display_shared(job->vs->vd);
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
@@ -312,6 +343,10 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
 
     vnc_lock_output(job->vs);
     if (job->vs->ioc != NULL) {
+        job->vs->encode_stats.updates++;
+        job->vs->encode_stats.rectangles += n_rectangles;
+        job->vs->encode_stats.bytes += vs.output.offset;
+        job->vs->encode_stats.time_ns += get_clock() - start_ns;
         buffer_move(&job->vs->jobs_buffer, &vs.output);
         /* Copy persistent encoding data */
         vnc_async_encoding_end(job->vs, &vs);
@@ -355,11 +390,16 @@ static void vnc_queue_clear(VncJobQueue *q)
 static void *vnc_worker_thread(void *arg)
 {
     VncJobQueue *queue = arg;
-
-    qemu_thread_get_self(&queue->thread);
+    bool last;
 
     while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+
+    vnc_lock_queue(queue);
+    last = --queue->n_threads == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
@@ -371,12 +411,21 @@ static bool vnc_worker_thread_running(void)
 void vnc_start_worker_thread(void)
 {
     VncJobQueue *q;
+    int i, n;
 
     if (vnc_worker_thread_running())
         return ;
 
     q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
+    n = MIN(g_get_num_processors(), VNC_WORKER_THREADS_MAX);
+    q->n_threads = n;
+    for (i = 0; i < n; i++) {
+        QemuThread thread;
+        char *name = g_strdup_printf("vnc_worker/%d", i);
+
+        qemu_thread_create(&thread, name, vnc_worker_thread, q,
+                           QEMU_THREAD_DETACHED);
+        g_free(name);
+    }
     queue = q; /* Set global queue */
 }
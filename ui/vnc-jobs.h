@@ -40,9 +40,20 @@ void vnc_jobs_consume_buffer(VncState *vs);
 void vnc_start_worker_thread(void);
 
 /* Locks */
+/*
+ * Exclusive access to the server surface, e.g. to update it.  This fails
+ * while worker threads are encoding from the surface.
+ */
 static inline int vnc_trylock_display(VncDisplay *vd)
 {
-    return qemu_mutex_trylock(&vd->mutex);
+    if (qemu_mutex_trylock(&vd->mutex)) {
+        return -EBUSY;
+    }
+    if (qatomic_read(&vd->n_encoders)) {
+        qemu_mutex_unlock(&vd->mutex);
+        return -EBUSY;
+    }
+    return 0;
 }
 
 static inline void vnc_lock_display(VncDisplay *vd)
@@ -55,6 +66,22 @@ static inline void vnc_unlock_display(VncDisplay *vd)
     qemu_mutex_unlock(&vd->mutex);
 }
 
+/*
+ * Shared access to the server surface, for the worker threads that encode
+ * from it.  Several workers can hold it at the same time.
+ */
+static inline void vnc_lock_display_shared(VncDisplay *vd)
+{
+    qemu_mutex_lock(&vd->mutex);
+    qatomic_inc(&vd->n_encoders);
+    qemu_mutex_unlock(&vd->mutex);
+}
+
+static inline void vnc_unlock_display_shared(VncDisplay *vd)
+{
+    qatomic_dec(&vd->n_encoders);
+}
+
 static inline void vnc_lock_output(VncState *vs)
 {
     qemu_mutex_lock(&vs->output_mutex);
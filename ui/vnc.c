@@ -55,6 +55,9 @@
 #include "qemu/cutils.h"
 #include "qemu/help_option.h"
 #include "io/dns-resolver.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define VNC_REFRESH_INTERVAL_BASE GUI_REFRESH_INTERVAL_DEFAULT
 #define VNC_REFRESH_INTERVAL_INC  50
@@ -321,7 +324,7 @@ static void vnc_qmp_event(VncState *vs, QAPIEvent event)
     qapi_free_VncServerInfo(si);
 }
 
-static VncClientInfo *qmp_query_vnc_client(const VncState *client)
+static VncClientInfo *qmp_query_vnc_client(VncState *client)
 {
     VncClientInfo *info;
     Error *err = NULL;
@@ -350,6 +353,15 @@ static VncClientInfo *qmp_query_vnc_client(const VncState *client)
     }
 #endif
 
+    info->encode_stats = g_new0(VncEncodeStats, 1);
+    vnc_lock_output(client);
+    info->encode_stats->updates = client->encode_stats.updates;
+    info->encode_stats->rectangles = client->encode_stats.rectangles;
+    info->encode_stats->bytes = client->encode_stats.bytes;
+    info->encode_stats->time_ns = client->encode_stats.time_ns;
+    vnc_unlock_output(client);
+    info->has_encode_stats = true;
+
     return info;
 }
 
@@ -3087,6 +3099,35 @@ static void vnc_rect_updated(VncDisplay *vd, int x, int y, struct timeval * tv)
     rect->updated = true;
 }
 
+/* Bytes of the server surface covered by one bit of a dirty bitmap */
+#define VNC_DIRTY_CHUNK_BYTES (VNC_DIRTY_PIXELS_PER_BIT * VNC_SERVER_FB_BYTES)
+
+/*
+ * Compare a chunk of the guest surface with the server surface.  Nearly all
+ * chunks are full ones, which are compared without going through memcmp().
+ */
+static bool vnc_chunk_equal(const uint8_t *server_ptr,
+                            const uint8_t *guest_ptr, int len)
+{
+#ifdef __SSE2__
+    QEMU_BUILD_BUG_ON(VNC_DIRTY_CHUNK_BYTES % 64);
+    if (len == VNC_DIRTY_CHUNK_BYTES) {
+        __m128i t = _mm_setzero_si128();
+        int i;
+
+        for (i = 0; i < VNC_DIRTY_CHUNK_BYTES; i += 16) {
+            __m128i s = _mm_loadu_si128((const __m128i *)(server_ptr + i));
+            __m128i g = _mm_loadu_si128((const __m128i *)(guest_ptr + i));
+
+            t = _mm_or_si128(t, _mm_xor_si128(s, g));
+        }
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(t, _mm_setzero_si128()))
+               == 0xFFFF;
+    }
+#endif
+    return memcmp(server_ptr, guest_ptr, len) == 0;
+}
+
 static int vnc_refresh_server_surface(VncDisplay *vd)
 {
     int width = MIN(pixman_image_get_width(vd->guest.fb),
@@ -3114,8 +3155,7 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     server_row0 = (uint8_t *)pixman_image_get_data(vd->server);
     server_stride = guest_stride = guest_ll =
         pixman_image_get_stride(vd->server);
-    cmp_bytes = MIN(VNC_DIRTY_PIXELS_PER_BIT * VNC_SERVER_FB_BYTES,
-                    server_stride);
+    cmp_bytes = MIN(VNC_DIRTY_CHUNK_BYTES, server_stride);
     if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
         int width = pixman_image_get_width(vd->server);
         tmpbuf = qemu_pixman_linebuf_create(VNC_SERVER_FB_FORMAT, width);
@@ -3162,7 +3202,7 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
                 _cmp_bytes = line_bytes - x * cmp_bytes;
             }
             assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+            if (vnc_chunk_equal(server_ptr, guest_ptr, _cmp_bytes)) {
                 continue;
             }
             memcpy(server_ptr, guest_ptr, _cmp_bytes);
@@ -158,6 +158,7 @@ struct VncDisplay
     int ledstate;
     QKbdState *kbd;
     QemuMutex mutex;
+    int n_encoders; /* worker threads holding the display in shared mode */
 
     QEMUCursor *cursor;
     int cursor_msize;
@@ -250,6 +251,7 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    bool running;
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -337,6 +339,13 @@ struct VncState
     QemuMutex output_mutex;
     QEMUBH *bh;
     Buffer jobs_buffer;
+    /* protected by output_mutex */
+    struct {
+        uint64_t updates;
+        uint64_t rectangles;
+        uint64_t bytes;
+        uint64_t time_ns;
+    } encode_stats;
 
     /* Encoding specific, if you add something here, don't forget to
      *  update vnc_async_encoding_start()
@@ -87,13 +87,14 @@ static bool aio_remove_fd_handler(AioContext *ctx, AioHandler *node)
     return true;
 }
 
-void aio_set_fd_handler(AioContext *ctx,
-                        int fd,
-                        bool is_external,
-                        IOHandler *io_read,
-                        IOHandler *io_write,
-                        AioPollFn *io_poll,
-                        void *opaque)
+static void aio_set_fd_handler_common(AioContext *ctx,
+                                      int fd,
+                                      bool is_external,
+                                      bool is_event_notifier,
+                                      IOHandler *io_read,
+                                      IOHandler *io_write,
+                                      AioPollFn *io_poll,
+                                      void *opaque)
 {
     AioHandler *node;
     AioHandler *new_node = NULL;
@@ -129,6 +130,7 @@ void aio_set_fd_handler(AioContext *ctx,
         new_node->io_poll = io_poll;
         new_node->opaque = opaque;
         new_node->is_external = is_external;
+        new_node->is_event_notifier = is_event_notifier;
 
         if (is_new) {
             new_node->pfd.fd = fd;
@@ -164,6 +166,18 @@ void aio_set_fd_handler(AioContext *ctx,
     }
 }
 
+void aio_set_fd_handler(AioContext *ctx,
+                        int fd,
+                        bool is_external,
+                        IOHandler *io_read,
+                        IOHandler *io_write,
+                        AioPollFn *io_poll,
+                        void *opaque)
+{
+    aio_set_fd_handler_common(ctx, fd, is_external, false,
+                              io_read, io_write, io_poll, opaque);
+}
+
 void aio_set_fd_poll(AioContext *ctx, int fd,
                      IOHandler *io_poll_begin,
                      IOHandler *io_poll_end)
@@ -184,8 +198,9 @@ void aio_set_event_notifier(AioContext *ctx,
                             EventNotifierHandler *io_read,
                             AioPollFn *io_poll)
 {
-    aio_set_fd_handler(ctx, event_notifier_get_fd(notifier), is_external,
-                       (IOHandler *)io_read, NULL, io_poll, notifier);
+    aio_set_fd_handler_common(ctx, event_notifier_get_fd(notifier),
+                              is_external, true, (IOHandler *)io_read, NULL,
+                              io_poll, notifier);
 }
 
 void aio_set_event_notifier_poll(AioContext *ctx,
@@ -459,6 +474,31 @@ static bool remove_idle_poll_handlers(AioContext *ctx, int64_t now)
     return progress;
 }
 
+static unsigned poll_hist_bucket(int64_t ns)
+{
+    int64_t us = (ns - 1) >> 10;
+
+    return us > 0 ? MIN(64 - clz64(us), AIO_POLL_HIST_BUCKETS - 1) : 0;
+}
+
+static void poll_account(AioContext *ctx, bool progress, int64_t elapsed_time)
+{
+    AioPollStats *stats = &ctx->poll_stats;
+
+    stats->time_ns += elapsed_time;
+    if (progress) {
+        unsigned bucket = poll_hist_bucket(elapsed_time);
+
+        stats->hits++;
+        stats->hist[bucket]++;
+        ctx->poll_window_hist[bucket]++;
+    } else {
+        stats->misses++;
+    }
+
+    ctx->poll_window_ns += elapsed_time;
+}
+
 /* run_poll_handlers:
  * @ctx: the AioContext
  * @max_ns: maximum time to poll for, in nanoseconds
@@ -496,6 +536,8 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
         assert(!(max_ns && progress));
     } while (elapsed_time < max_ns && !ctx->fdmon_ops->need_wait(ctx));
 
+    poll_account(ctx, progress, elapsed_time);
+
     if (remove_idle_poll_handlers(ctx, start_time + elapsed_time)) {
         *timeout = 0;
         progress = true;
@@ -512,6 +554,69 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
     return progress;
 }
 
+#define POLL_BUDGET_WINDOW_NS (100 * SCALE_MS)
+#define POLL_BUDGET_MIN_HITS  16
+
+/*
+ * End a poll_budget accounting window.  If enough events were caught by
+ * polling, cap the polling time to twice what 90% of them needed: polling
+ * longer only burns CPU for the few events that arrive late.  The headroom
+ * lets the cap move up again if events start to take longer.
+ */
+static void poll_budget_end_window(AioContext *ctx, int64_t now)
+{
+    uint32_t hits = 0, sum = 0;
+    unsigned i;
+
+    for (i = 0; i < AIO_POLL_HIST_BUCKETS; i++) {
+        hits += ctx->poll_window_hist[i];
+    }
+
+    ctx->poll_cap_ns = 0;
+    if (hits >= POLL_BUDGET_MIN_HITS) {
+        for (i = 0; i < AIO_POLL_HIST_BUCKETS - 1; i++) {
+            sum += ctx->poll_window_hist[i];
+            if ((uint64_t)sum * 10 >= (uint64_t)hits * 9) {
+                break;
+            }
+        }
+
+        if (i < AIO_POLL_HIST_BUCKETS - 1) {
+            ctx->poll_cap_ns = 2048LL << i;
+        }
+    }
+
+    if (ctx->poll_cap_ns && ctx->poll_ns > ctx->poll_cap_ns) {
+        trace_poll_shrink(ctx, ctx->poll_ns, ctx->poll_cap_ns);
+        ctx->poll_ns = ctx->poll_cap_ns;
+    }
+
+    memset(ctx->poll_window_hist, 0, sizeof(ctx->poll_window_hist));
+    ctx->poll_window_ns = 0;
+    ctx->poll_window_start = now;
+}
+
+/*
+ * Returns how long polling may go on without exceeding ctx->poll_budget
+ * percent of the current accounting window, at most @max_ns.
+ */
+static int64_t poll_budget_limit(AioContext *ctx, int64_t max_ns)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t allowance = POLL_BUDGET_WINDOW_NS / 100 * ctx->poll_budget;
+
+    if (now - ctx->poll_window_start >= POLL_BUDGET_WINDOW_NS) {
+        poll_budget_end_window(ctx, now);
+        max_ns = MIN(max_ns, ctx->poll_ns);
+    }
+
+    if (ctx->poll_window_ns >= allowance) {
+        return 0;
+    }
+
+    return MIN(max_ns, allowance - ctx->poll_window_ns);
+}
+
 /* try_poll_mode:
  * @ctx: the AioContext
  * @timeout: timeout for blocking wait, computed by the caller and updated if
@@ -530,6 +635,9 @@ static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
     }
 
     max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
+    if (max_ns && ctx->poll_budget) {
+        max_ns = poll_budget_limit(ctx, max_ns);
+    }
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         poll_set_started(ctx, true);
 
@@ -651,6 +759,10 @@ bool aio_poll(AioContext *ctx, bool blocking)
             if (ctx->poll_ns > ctx->poll_max_ns) {
                 ctx->poll_ns = ctx->poll_max_ns;
             }
+            if (ctx->poll_budget && ctx->poll_cap_ns &&
+                ctx->poll_ns > ctx->poll_cap_ns) {
+                ctx->poll_ns = ctx->poll_cap_ns;
+            }
 
             trace_poll_grow(ctx, old, ctx->poll_ns);
         }
@@ -704,8 +816,14 @@ void aio_context_use_g_source(AioContext *ctx)
 }
 
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
-                                 int64_t grow, int64_t shrink, Error **errp)
+                                 int64_t grow, int64_t shrink,
+                                 int64_t budget, Error **errp)
 {
+    if (budget > 100) {
+        error_setg(errp, "poll-cpu-budget must be in range [0, 100]");
+        return;
+    }
+
     /* No thread synchronization here, it doesn't matter if an incorrect value
      * is used once.
      */
@@ -713,10 +831,17 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     ctx->poll_ns = 0;
     ctx->poll_grow = grow;
     ctx->poll_shrink = shrink;
+    ctx->poll_budget = budget;
+    ctx->poll_cap_ns = 0;
 
     aio_notify(ctx);
 }
 
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats)
+{
+    *stats = ctx->poll_stats;
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
                                 Error **errp)
 {
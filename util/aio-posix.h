@@ -37,6 +37,7 @@ struct AioHandler {
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
     bool is_external;
+    bool is_event_notifier; /* io_read clears all pending events */
 };
 
 /* Add a handler to a ready list */
@@ -434,13 +434,19 @@ void aio_context_use_g_source(AioContext *ctx)
 }
 
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
-                                 int64_t grow, int64_t shrink, Error **errp)
+                                 int64_t grow, int64_t shrink,
+                                 int64_t budget, Error **errp)
 {
     if (max_ns) {
         error_setg(errp, "AioContext polling is not implemented on Windows");
     }
 }
 
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
                                 Error **errp)
 {
@@ -27,6 +27,7 @@
 #include "qapi/error.h"
 #include "block/aio.h"
 #include "block/thread-pool.h"
+#include "qemu/bounce-pool.h"
 #include "qemu/main-loop.h"
 #include "qemu/atomic.h"
 #include "qemu/rcu_queue.h"
@@ -320,6 +321,7 @@ aio_ctx_finalize(GSource     *source)
     unsigned flags;
 
     thread_pool_free(ctx->thread_pool);
+    bounce_pool_free(ctx->bounce_pool);
 
 #ifdef CONFIG_LINUX_AIO
     if (ctx->linux_aio) {
@@ -335,6 +337,11 @@ aio_ctx_finalize(GSource     *source)
         luring_cleanup(ctx->linux_io_uring);
         ctx->linux_io_uring = NULL;
     }
+    if (ctx->linux_io_uring_iopoll) {
+        luring_detach_aio_context(ctx->linux_io_uring_iopoll, ctx);
+        luring_cleanup(ctx->linux_io_uring_iopoll);
+        ctx->linux_io_uring_iopoll = NULL;
+    }
 #endif
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
@@ -387,11 +394,35 @@ GSource *aio_get_g_source(AioContext *ctx)
 ThreadPool *aio_get_thread_pool(AioContext *ctx)
 {
     if (!ctx->thread_pool) {
-        ctx->thread_pool = thread_pool_new(ctx);
+        qatomic_set(&ctx->thread_pool, thread_pool_new(ctx));
     }
     return ctx->thread_pool;
 }
 
+BouncePool *aio_get_bounce_pool(AioContext *ctx)
+{
+    return ctx->bounce_pool;
+}
+
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, Error **errp)
+{
+    ThreadPool *pool;
+
+    if (min > max || !max || min > INT_MAX || max > INT_MAX) {
+        error_setg(errp, "bad thread-pool-min/thread-pool-max values");
+        return;
+    }
+
+    ctx->thread_pool_min = min;
+    ctx->thread_pool_max = max;
+
+    pool = qatomic_read(&ctx->thread_pool);
+    if (pool) {
+        thread_pool_update_params(pool, ctx);
+    }
+}
+
 #ifdef CONFIG_LINUX_AIO
 LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp)
 {
@@ -418,7 +449,8 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx->io_uring_sqpoll,
+                                      ctx->io_uring_fixed, false, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -432,8 +464,40 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
     assert(ctx->linux_io_uring);
     return ctx->linux_io_uring;
 }
+
+LuringState *aio_setup_linux_io_uring_iopoll(AioContext *ctx, Error **errp)
+{
+    if (ctx->linux_io_uring_iopoll) {
+        return ctx->linux_io_uring_iopoll;
+    }
+
+    ctx->linux_io_uring_iopoll = luring_init(ctx->io_uring_sqpoll,
+                                             ctx->io_uring_fixed, true, errp);
+    if (!ctx->linux_io_uring_iopoll) {
+        return NULL;
+    }
+
+    luring_attach_aio_context(ctx->linux_io_uring_iopoll, ctx);
+    return ctx->linux_io_uring_iopoll;
+}
 #endif
 
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll, bool fixed,
+                                     Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if ((ctx->linux_io_uring || ctx->linux_io_uring_iopoll) &&
+        (sqpoll != ctx->io_uring_sqpoll || fixed != ctx->io_uring_fixed)) {
+        error_setg(errp, "io_uring parameters cannot be changed while "
+                   "io_uring is in use");
+        return;
+    }
+#endif
+
+    ctx->io_uring_sqpoll = sqpoll;
+    ctx->io_uring_fixed = fixed;
+}
+
 void aio_notify(AioContext *ctx)
 {
     /*
@@ -543,9 +607,12 @@ AioContext *aio_context_new(Error **errp)
 
 #ifdef CONFIG_LINUX_IO_URING
     ctx->linux_io_uring = NULL;
+    ctx->linux_io_uring_iopoll = NULL;
 #endif
 
     ctx->thread_pool = NULL;
+    /* Created right away, because it is also used by thread pool workers */
+    ctx->bounce_pool = bounce_pool_new();
     qemu_rec_mutex_init(&ctx->lock);
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
 
@@ -556,6 +623,9 @@ AioContext *aio_context_new(Error **errp)
 
     ctx->aio_max_batch = 0;
 
+    ctx->thread_pool_min = 0;
+    ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+
     return ctx;
 fail:
     g_source_destroy(&ctx->source);
@@ -659,9 +729,11 @@ void aio_context_unref(AioContext *ctx)
     g_source_unref(&ctx->source);
 }
 
-void aio_context_acquire(AioContext *ctx)
+void aio_context_acquire_impl(AioContext *ctx, const char *file, int line)
 {
-    qemu_rec_mutex_lock(&ctx->lock);
+    QemuRecMutexLockFunc f = qatomic_read(&qemu_aio_context_lock_func);
+
+    f(&ctx->lock, file, line);
 }
 
 void aio_context_release(AioContext *ctx)
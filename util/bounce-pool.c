@@ -0,0 +1,115 @@
+/*
+ * Pool of aligned bounce buffers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bounce-pool.h"
+#include "qemu/host-utils.h"
+#include "qemu/thread.h"
+
+#define BOUNCE_POOL_MIN_SHIFT   16      /* 64 KiB */
+#define BOUNCE_POOL_MAX_SHIFT   21      /* 2 MiB */
+#define BOUNCE_POOL_CLASSES \
+    (BOUNCE_POOL_MAX_SHIFT - BOUNCE_POOL_MIN_SHIFT + 1)
+
+/* Free buffers kept per class, i.e. up to about 16 MiB per pool */
+#define BOUNCE_POOL_DEPTH       4
+
+struct BouncePool {
+    QemuMutex lock;
+    unsigned int nr_free[BOUNCE_POOL_CLASSES];
+    void *free[BOUNCE_POOL_CLASSES][BOUNCE_POOL_DEPTH];
+};
+
+/*
+ * Return the size class of @size, or -1 if @size is not pooled.  Sizes
+ * well below the smallest class are cheap to allocate and not worth
+ * rounding up.
+ */
+static int bounce_pool_class(size_t size)
+{
+    int shift;
+
+    if (size <= (1 << BOUNCE_POOL_MIN_SHIFT) / 2 ||
+        size > (1 << BOUNCE_POOL_MAX_SHIFT)) {
+        return -1;
+    }
+    shift = 64 - clz64(size - 1);
+    return MAX(shift, BOUNCE_POOL_MIN_SHIFT) - BOUNCE_POOL_MIN_SHIFT;
+}
+
+BouncePool *bounce_pool_new(void)
+{
+    BouncePool *pool = g_new0(BouncePool, 1);
+
+    qemu_mutex_init(&pool->lock);
+    return pool;
+}
+
+void bounce_pool_free(BouncePool *pool)
+{
+    int i;
+
+    if (!pool) {
+        return;
+    }
+
+    for (i = 0; i < BOUNCE_POOL_CLASSES; i++) {
+        while (pool->nr_free[i]) {
+            qemu_vfree(pool->free[i][--pool->nr_free[i]]);
+        }
+    }
+    qemu_mutex_destroy(&pool->lock);
+    g_free(pool);
+}
+
+void *bounce_pool_try_alloc(BouncePool *pool, size_t size, size_t align)
+{
+    int cls = bounce_pool_class(size);
+    size_t class_size;
+    void *buf = NULL;
+
+    if (cls < 0) {
+        return qemu_try_memalign(align, size);
+    }
+
+    /* Buffers in the pool are aligned to their size */
+    class_size = (size_t)1 << (cls + BOUNCE_POOL_MIN_SHIFT);
+    if (align <= class_size) {
+        qemu_mutex_lock(&pool->lock);
+        if (pool->nr_free[cls]) {
+            buf = pool->free[cls][--pool->nr_free[cls]];
+        }
+        qemu_mutex_unlock(&pool->lock);
+        if (buf) {
+            return buf;
+        }
+    }
+
+    buf = qemu_try_memalign(MAX(align, class_size), class_size);
+    if (buf && cls == BOUNCE_POOL_CLASSES - 1) {
+        qemu_madvise(buf, class_size, QEMU_MADV_HUGEPAGE);
+    }
+    return buf;
+}
+
+void bounce_pool_release(BouncePool *pool, void *buf, size_t size)
+{
+    int cls = bounce_pool_class(size);
+
+    if (!buf) {
+        return;
+    }
+
+    if (cls >= 0) {
+        qemu_mutex_lock(&pool->lock);
+        if (pool->nr_free[cls] < BOUNCE_POOL_DEPTH) {
+            pool->free[cls][pool->nr_free[cls]++] = buf;
+            buf = NULL;
+        }
+        qemu_mutex_unlock(&pool->lock);
+    }
+    qemu_vfree(buf);
+}
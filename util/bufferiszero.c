@@ -329,6 +329,60 @@ static bool select_accel_fn(const void *buf, size_t len)
     return buffer_zero_int(buf, len);
 }
 
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+
+/*
+ * Advanced SIMD is part of the base aarch64 ISA, so there is no need for
+ * a runtime check.  Note that this function requires len >= 64.
+ */
+static bool
+buffer_zero_neon(const void *buf, size_t len)
+{
+    uint8x16_t t = vld1q_u8(buf);
+    const uint8x16_t *p = (uint8x16_t *)(((uintptr_t)buf + 5 * 16) & -16);
+    const uint8x16_t *e = (uint8x16_t *)(((uintptr_t)buf + len) & -16);
+
+    /* Loop over 16-byte aligned blocks of 64.  */
+    while (likely(p <= e)) {
+        __builtin_prefetch(p);
+        if (unlikely(vmaxvq_u8(t))) {
+            return false;
+        }
+        t = vorrq_u8(vorrq_u8(p[-4], p[-3]), vorrq_u8(p[-2], p[-1]));
+        p += 4;
+    }
+
+    /* Finish the aligned tail.  */
+    t = vorrq_u8(t, e[-3]);
+    t = vorrq_u8(t, e[-2]);
+    t = vorrq_u8(t, e[-1]);
+
+    /* Finish the unaligned tail.  */
+    t = vorrq_u8(t, vld1q_u8(buf + len - 16));
+
+    return !vmaxvq_u8(t);
+}
+
+static bool (*buffer_accel)(const void *, size_t) = buffer_zero_neon;
+
+bool test_buffer_is_zero_next_accel(void)
+{
+    if (buffer_accel == buffer_zero_int) {
+        return false;
+    }
+    buffer_accel = buffer_zero_int;
+    return true;
+}
+
+static bool select_accel_fn(const void *buf, size_t len)
+{
+    if (likely(len >= 64)) {
+        return buffer_accel(buf, len);
+    }
+    return buffer_zero_int(buf, len);
+}
+
 #else
 #define select_accel_fn  buffer_zero_int
 bool test_buffer_is_zero_next_accel(void)
@@ -338,14 +392,11 @@ bool test_buffer_is_zero_next_accel(void)
 #endif
 
 /*
- * Checks if a buffer is all zeroes
+ * Checks if a buffer is all zeroes; the inline buffer_is_zero() has
+ * already checked that len is not zero.
  */
-bool buffer_is_zero(const void *buf, size_t len)
+bool buffer_is_zero_ool(const void *buf, size_t len)
 {
-    if (unlikely(len == 0)) {
-        return true;
-    }
-
     /* Fetch the beginning of the buffer while we select the accelerator.  */
     __builtin_prefetch(buf);
 
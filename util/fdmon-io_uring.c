@@ -25,7 +25,12 @@
  *
  * File descriptor monitoring is implemented using the following operations:
  *
- * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.
+ * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.  Event
+ *    notifiers are added as multishot polls (IORING_POLL_ADD_MULTI) when the
+ *    kernel supports it, so they stay armed after an event: their handlers
+ *    always clear the eventfd, so a cqe per wakeup misses nothing.  Other
+ *    file descriptors may be left readable by their handler and need the
+ *    level-triggered behavior of re-adding a one-shot poll after each event.
  * 2. IORING_OP_POLL_REMOVE - removes a file descriptor being monitored.  When
  *    the poll mask changes for a file descriptor it is first removed and then
  *    re-added with the new poll mask, so this operation is also used as part
@@ -172,6 +177,11 @@ static void add_poll_add_sqe(AioContext *ctx, AioHandler *node)
     int events = poll_events_from_pfd(node->pfd.events);
 
     io_uring_prep_poll_add(sqe, node->pfd.fd, events);
+#ifdef IORING_POLL_ADD_MULTI
+    if (node->is_event_notifier && ctx->fdmon_io_uring_multishot) {
+        sqe->len |= IORING_POLL_ADD_MULTI;
+    }
+#endif
     io_uring_sqe_set_data(sqe, node);
 }
 
@@ -228,6 +238,21 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+#ifdef IORING_CQE_F_MORE
+    /*
+     * A multishot IORING_OP_POLL_ADD stays armed as long as the kernel sets
+     * this flag, the handler cannot be deleted before the final cqe.
+     */
+    if (cqe->flags & IORING_CQE_F_MORE) {
+        if (qatomic_read(&node->flags) & FDMON_IO_URING_REMOVE) {
+            return false;
+        }
+
+        aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
+        return true;
+    }
+#endif
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -239,9 +264,22 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    if (cqe->res < 0) {
+        /* Kernels without multishot poll support reject the flag */
+        if (cqe->res == -EINVAL && node->is_event_notifier) {
+            ctx->fdmon_io_uring_multishot = false;
+        }
+
+        add_poll_add_sqe(ctx, node);
+        return false;
+    }
+
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
-    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
+    /*
+     * IORING_OP_POLL_ADD is one-shot (or was a multishot poll terminated by
+     * the kernel) so we must re-arm it
+     */
     add_poll_add_sqe(ctx, node);
     return true;
 }
@@ -331,6 +369,9 @@ bool fdmon_io_uring_setup(AioContext *ctx)
     }
 
     QSLIST_INIT(&ctx->submit_list);
+#ifdef IORING_POLL_ADD_MULTI
+    ctx->fdmon_io_uring_multishot = true;
+#endif
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
@@ -453,6 +453,89 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
     }
 }
 
+#ifdef CONFIG_ATOMIC64
+/*
+ * Set bit @pos of @level, and of the levels above it as long as a word
+ * goes from zero to nonzero.
+ */
+static void hb_set_bit_atomic(HBitmap *hb, int level, uint64_t pos)
+{
+    unsigned long bit;
+    unsigned long old;
+
+    for (; level >= 0; level--) {
+        bit = 1UL << (pos & (BITS_PER_LONG - 1));
+        pos >>= BITS_PER_LEVEL;
+        old = qatomic_fetch_or(&hb->levels[level][pos], bit);
+        if (old != 0) {
+            break;
+        }
+    }
+}
+
+/*
+ * Set [start, last] in the last layer.  Only the caller that turns a word
+ * from zero to nonzero updates the layer above, so that concurrent callers
+ * agree on who does it.  Returns the number of bits changed by this call.
+ */
+static uint64_t hb_set_between_atomic(HBitmap *hb, uint64_t start,
+                                      uint64_t last)
+{
+    unsigned long *level = hb->levels[HBITMAP_LEVELS - 1];
+    size_t pos = start >> BITS_PER_LEVEL;
+    size_t lastpos = last >> BITS_PER_LEVEL;
+    uint64_t changed = 0;
+    unsigned long mask;
+    unsigned long old;
+
+    for (; pos <= lastpos; pos++) {
+        mask = ~0UL;
+        if (pos == start >> BITS_PER_LEVEL) {
+            mask &= ~0UL << (start & (BITS_PER_LONG - 1));
+        }
+        if (pos == lastpos) {
+            mask &= ~0UL >> (BITS_PER_LONG - 1 - (last & (BITS_PER_LONG - 1)));
+        }
+        /* Writes to an already dirty area do not need to touch the line */
+        old = qatomic_read(&level[pos]);
+        if ((old & mask) == mask) {
+            continue;
+        }
+        old = qatomic_fetch_or(&level[pos], mask);
+        changed += ctpopl(mask & ~old);
+        if (old == 0) {
+            hb_set_bit_atomic(hb, HBITMAP_LEVELS - 2, pos);
+        }
+    }
+    return changed;
+}
+
+void hbitmap_set_atomic(HBitmap *hb, uint64_t start, uint64_t count)
+{
+    uint64_t first, changed;
+    uint64_t last = start + count - 1;
+
+    if (count == 0) {
+        return;
+    }
+
+    trace_hbitmap_set(hb, start, count,
+                      start >> hb->granularity, last >> hb->granularity);
+
+    first = start >> hb->granularity;
+    last >>= hb->granularity;
+    assert(last < hb->size);
+
+    changed = hb_set_between_atomic(hb, first, last);
+    if (changed) {
+        qatomic_add(&hb->count, changed);
+        if (hb->meta) {
+            hbitmap_set_atomic(hb->meta, start, count);
+        }
+    }
+}
+#endif
+
 /* Resetting works the other way round: propagate up if the new
  * value is zero.
  */
@@ -0,0 +1,193 @@
+/*
+ * Intrusive interval tree
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+/* Nodes are ordered by start, and nodes with the same start by address */
+static int interval_tree_cmp(const IntervalTreeNode *a,
+                             const IntervalTreeNode *b)
+{
+    if (a->start != b->start) {
+        return a->start < b->start ? -1 : 1;
+    }
+    if (a != b) {
+        return (uintptr_t)a < (uintptr_t)b ? -1 : 1;
+    }
+    return 0;
+}
+
+static int interval_tree_height(const IntervalTreeNode *n)
+{
+    return n ? n->height : 0;
+}
+
+static void interval_tree_update(IntervalTreeNode *n)
+{
+    n->height = 1 + MAX(interval_tree_height(n->left),
+                        interval_tree_height(n->right));
+    n->subtree_last = n->last;
+    if (n->left) {
+        n->subtree_last = MAX(n->subtree_last, n->left->subtree_last);
+    }
+    if (n->right) {
+        n->subtree_last = MAX(n->subtree_last, n->right->subtree_last);
+    }
+}
+
+static IntervalTreeNode *interval_tree_rotate_right(IntervalTreeNode *n)
+{
+    IntervalTreeNode *l = n->left;
+
+    n->left = l->right;
+    l->right = n;
+    interval_tree_update(n);
+    interval_tree_update(l);
+    return l;
+}
+
+static IntervalTreeNode *interval_tree_rotate_left(IntervalTreeNode *n)
+{
+    IntervalTreeNode *r = n->right;
+
+    n->right = r->left;
+    r->left = n;
+    interval_tree_update(n);
+    interval_tree_update(r);
+    return r;
+}
+
+/* Update @n after a change below it, and rebalance the subtree */
+static IntervalTreeNode *interval_tree_balance(IntervalTreeNode *n)
+{
+    int diff = interval_tree_height(n->left) - interval_tree_height(n->right);
+
+    if (diff > 1) {
+        if (interval_tree_height(n->left->left) <
+            interval_tree_height(n->left->right)) {
+            n->left = interval_tree_rotate_left(n->left);
+        }
+        return interval_tree_rotate_right(n);
+    }
+    if (diff < -1) {
+        if (interval_tree_height(n->right->right) <
+            interval_tree_height(n->right->left)) {
+            n->right = interval_tree_rotate_right(n->right);
+        }
+        return interval_tree_rotate_left(n);
+    }
+    interval_tree_update(n);
+    return n;
+}
+
+static IntervalTreeNode *interval_tree_insert_at(IntervalTreeNode *n,
+                                                 IntervalTreeNode *node)
+{
+    if (!n) {
+        return node;
+    }
+    if (interval_tree_cmp(node, n) < 0) {
+        n->left = interval_tree_insert_at(n->left, node);
+    } else {
+        n->right = interval_tree_insert_at(n->right, node);
+    }
+    return interval_tree_balance(n);
+}
+
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    assert(node->start <= node->last);
+
+    node->left = NULL;
+    node->right = NULL;
+    interval_tree_update(node);
+    root->root = interval_tree_insert_at(root->root, node);
+}
+
+static IntervalTreeNode *interval_tree_remove_min(IntervalTreeNode *n,
+                                                  IntervalTreeNode **min)
+{
+    if (!n->left) {
+        *min = n;
+        return n->right;
+    }
+    n->left = interval_tree_remove_min(n->left, min);
+    return interval_tree_balance(n);
+}
+
+static IntervalTreeNode *interval_tree_remove_at(IntervalTreeNode *n,
+                                                 IntervalTreeNode *node)
+{
+    IntervalTreeNode *min, *right;
+    int cmp;
+
+    assert(n);
+    cmp = interval_tree_cmp(node, n);
+    if (cmp < 0) {
+        n->left = interval_tree_remove_at(n->left, node);
+    } else if (cmp > 0) {
+        n->right = interval_tree_remove_at(n->right, node);
+    } else {
+        if (!n->right) {
+            return n->left;
+        }
+        right = interval_tree_remove_min(n->right, &min);
+        min->left = n->left;
+        min->right = right;
+        n = min;
+    }
+    return interval_tree_balance(n);
+}
+
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    root->root = interval_tree_remove_at(root->root, node);
+}
+
+/*
+ * Return the first node of the subtree @n that overlaps [@start, @last]
+ * and comes after @prev, or after nothing if @prev is NULL.
+ */
+static IntervalTreeNode *interval_tree_find(IntervalTreeNode *n,
+                                            uint64_t start, uint64_t last,
+                                            const IntervalTreeNode *prev)
+{
+    IntervalTreeNode *found;
+
+    if (!n || n->subtree_last < start) {
+        return NULL;
+    }
+    if (prev && interval_tree_cmp(n, prev) <= 0) {
+        /* Only the right subtree can come after @prev */
+        return interval_tree_find(n->right, start, last, prev);
+    }
+
+    found = interval_tree_find(n->left, start, last, prev);
+    if (found) {
+        return found;
+    }
+    if (n->start > last) {
+        /* Neither @n nor anything to its right can overlap */
+        return NULL;
+    }
+    if (n->last >= start) {
+        return n;
+    }
+    return interval_tree_find(n->right, start, last, prev);
+}
+
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last)
+{
+    return interval_tree_find(root->root, start, last, NULL);
+}
+
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeRoot *root,
+                                          IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last)
+{
+    return interval_tree_find(root->root, start, last, node);
+}
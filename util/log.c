@@ -334,6 +334,10 @@ const QEMULogItem qemu_log_items[] = {
 #endif
     { LOG_STRACE, "strace",
       "log every user-mode syscall, its input, and its result" },
+#ifdef CONFIG_PROFILER
+    { CPU_LOG_JIT, "jit",
+      "print TCG profiler statistics when a user-mode program exits" },
+#endif
     { 0, NULL, NULL },
 };
 
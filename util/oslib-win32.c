@@ -370,8 +370,8 @@ int getpagesize(void)
     return system_info.dwPageSize;
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+void os_mem_prealloc(int fd, char *area, size_t memory, int max_threads,
+                     ThreadContext *tc, bool async, Error **errp)
 {
     int i;
     size_t pagesize = qemu_real_host_page_size;
@@ -382,6 +382,12 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 }
 
+bool qemu_finish_async_mem_prealloc(Error **errp)
+{
+    /* os_mem_prealloc() always completes synchronously */
+    return true;
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
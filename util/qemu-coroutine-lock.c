@@ -232,10 +232,12 @@ static void coroutine_fn qemu_co_mutex_lock_slowpath(AioContext *ctx,
     trace_qemu_co_mutex_lock_return(mutex, self);
 }
 
-void coroutine_fn qemu_co_mutex_lock(CoMutex *mutex)
+void coroutine_fn qemu_co_mutex_lock_impl(CoMutex *mutex,
+                                          const char *file, int line)
 {
     AioContext *ctx = qemu_get_current_aio_context();
     Coroutine *self = qemu_coroutine_self();
+    int64_t t0 = qsp_is_enabled() ? get_clock() : 0;
     int waiters, i;
 
     /* Running a very small critical section on pthread_mutex_t and CoMutex
@@ -270,6 +272,16 @@ retry_fast_path:
     }
     mutex->holder = self;
     self->locks_held++;
+
+    if (unlikely(t0)) {
+        qsp_co_mutex_record(mutex, file, line, get_clock() - t0,
+                            waiters != 0 || i > 0);
+    }
+}
+
+void coroutine_fn (qemu_co_mutex_lock)(CoMutex *mutex)
+{
+    qemu_co_mutex_lock(mutex);
 }
 
 void coroutine_fn qemu_co_mutex_unlock(CoMutex *mutex)
@@ -10,11 +10,23 @@
  * help diagnose performance problems, e.g. scalability issues when
  * contention is high.
  *
- * The primitives currently supported are mutexes, recursive mutexes and
- * condition variables. Note that not all related functions are intercepted;
- * instead we profile only those functions that can have a performance impact,
- * either due to blocking (e.g. cond_wait, mutex_lock) or cache line
- * contention (e.g. mutex_lock, mutex_trylock).
+ * The primitives currently supported are mutexes, recursive mutexes,
+ * condition variables, spinlocks, AioContext locks and CoMutexes. Note that
+ * not all related functions are intercepted; instead we profile only those
+ * functions that can have a performance impact, either due to blocking (e.g.
+ * cond_wait, mutex_lock) or cache line contention (e.g. mutex_lock,
+ * mutex_trylock).
+ *
+ * Besides the time spent waiting, each call site counts how many of its
+ * acquisitions were contended, i.e. could not take the lock straight away,
+ * and keeps a histogram of the wait times of those acquisitions.  The mutex
+ * wrappers first try to take the lock without blocking, so that uncontended
+ * acquisitions are cheap to tell apart and need no clock reads.
+ *
+ * Spinlocks are taken inline and QSP has no hook in their fast path, so only
+ * their contended acquisitions are recorded. CoMutexes are not intercepted
+ * through function pointers either; qemu_co_mutex_lock() checks
+ * qsp_is_enabled() and records into QSP itself.
  *
  * QSP's design focuses on speed and scalability. This is achieved
  * by having threads do their profiling entirely on thread-local data.
@@ -62,6 +74,7 @@
 #include "qemu/thread.h"
 #include "qemu/timer.h"
 #include "qemu/qht.h"
+#include "qemu/host-utils.h"
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
 
@@ -70,6 +83,9 @@ enum QSPType {
     QSP_BQL_MUTEX,
     QSP_REC_MUTEX,
     QSP_CONDVAR,
+    QSP_AIO_CONTEXT,
+    QSP_SPIN,
+    QSP_CO_MUTEX,
 };
 
 struct QSPCallSite {
@@ -80,11 +96,20 @@ struct QSPCallSite {
 };
 typedef struct QSPCallSite QSPCallSite;
 
+/*
+ * Histogram of the wait times of contended acquisitions: bucket 0 counts
+ * waits shorter than 1 us, bucket i > 0 counts waits in [2^(i+9), 2^(i+10))
+ * ns, and the last bucket also counts anything longer than that.
+ */
+#define QSP_HIST_BUCKETS 24
+
 struct QSPEntry {
     void *thread_ptr;
     const QSPCallSite *callsite;
     aligned_uint64_t n_acqs;
+    aligned_uint64_t n_waits;
     aligned_uint64_t ns;
+    aligned_uint64_t hist[QSP_HIST_BUCKETS];
     unsigned int n_objs; /* count of coalesced objs; only used for reporting */
 };
 typedef struct QSPEntry QSPEntry;
@@ -107,6 +132,13 @@ static size_t qsp_qemu_path_len;
 /* the address of qsp_thread gives us a unique 'thread ID' */
 static __thread int qsp_thread;
 
+/*
+ * Set while the current thread is updating the profile.  QHT takes spinlocks,
+ * and recording a contended spinlock from within QSP's own hash tables could
+ * otherwise recurse.
+ */
+static __thread bool qsp_recording;
+
 /*
  * Call sites are the same for all threads, so we track them in a separate hash
  * table to save memory.
@@ -122,6 +154,9 @@ static const char * const qsp_typenames[] = {
     [QSP_BQL_MUTEX] = "BQL mutex",
     [QSP_REC_MUTEX] = "rec_mutex",
     [QSP_CONDVAR]   = "condvar",
+    [QSP_AIO_CONTEXT] = "AioContext",
+    [QSP_SPIN]      = "spinlock",
+    [QSP_CO_MUTEX]  = "CoMutex",
 };
 
 QemuMutexLockFunc qemu_bql_mutex_lock_func = qemu_mutex_lock_impl;
@@ -130,6 +165,7 @@ QemuMutexTrylockFunc qemu_mutex_trylock_func = qemu_mutex_trylock_impl;
 QemuRecMutexLockFunc qemu_rec_mutex_lock_func = qemu_rec_mutex_lock_impl;
 QemuRecMutexTrylockFunc qemu_rec_mutex_trylock_func =
     qemu_rec_mutex_trylock_impl;
+QemuRecMutexLockFunc qemu_aio_context_lock_func = qemu_rec_mutex_lock_impl;
 QemuCondWaitFunc qemu_cond_wait_func = qemu_cond_wait_impl;
 QemuCondTimedWaitFunc qemu_cond_timedwait_func = qemu_cond_timedwait_impl;
 
@@ -340,41 +376,73 @@ static QSPEntry *qsp_entry_get(const void *obj, const char *file, int line,
     return qsp_entry_find(&qsp_ht, &orig, hash);
 }
 
+static inline unsigned int qsp_hist_bucket(int64_t delta)
+{
+    /* 1024 ns is close enough to 1 us */
+    if (delta < 1024) {
+        return 0;
+    }
+    return MIN(63 - clz64(delta) - 9, QSP_HIST_BUCKETS - 1);
+}
+
 /*
  * @e is in the global hash table; it is only written to by the current thread,
  * so we write to it atomically (as in "write once") to prevent torn reads.
  */
-static inline void do_qsp_entry_record(QSPEntry *e, int64_t delta, bool acq)
+static inline void do_qsp_entry_record(QSPEntry *e, int64_t delta, bool acq,
+                                       bool waited)
 {
     qatomic_set_u64(&e->ns, e->ns + delta);
     if (acq) {
         qatomic_set_u64(&e->n_acqs, e->n_acqs + 1);
     }
+    if (waited) {
+        unsigned int b = qsp_hist_bucket(delta);
+
+        qatomic_set_u64(&e->n_waits, e->n_waits + 1);
+        qatomic_set_u64(&e->hist[b], e->hist[b] + 1);
+    }
 }
 
-static inline void qsp_entry_record(QSPEntry *e, int64_t delta)
+static inline void qsp_entry_record(QSPEntry *e, int64_t delta, bool waited)
 {
-    do_qsp_entry_record(e, delta, true);
+    do_qsp_entry_record(e, delta, true, waited);
 }
 
-#define QSP_GEN_VOID(type_, qsp_t_, func_, impl_)                       \
+static void qsp_record(const void *obj, const char *file, int line,
+                       enum QSPType type, int64_t delta, bool acq, bool waited)
+{
+    QSPEntry *e;
+
+    qsp_recording = true;
+    e = qsp_entry_get(obj, file, line, type);
+    do_qsp_entry_record(e, delta, acq, waited);
+    qsp_recording = false;
+}
+
+/*
+ * Try the lock first, and only read the clock if that fails.  The
+ * uncontended case thus costs about the same as without QSP.
+ */
+#define QSP_GEN_VOID(type_, qsp_t_, func_, impl_, try_impl_)            \
     static void func_(type_ *obj, const char *file, int line)           \
     {                                                                   \
-        QSPEntry *e;                                                    \
         int64_t t0, t1;                                                 \
                                                                         \
+        if (!try_impl_(obj, file, line)) {                              \
+            qsp_record(obj, file, line, qsp_t_, 0, true, false);        \
+            return;                                                     \
+        }                                                               \
         t0 = get_clock();                                               \
         impl_(obj, file, line);                                         \
         t1 = get_clock();                                               \
                                                                         \
-        e = qsp_entry_get(obj, file, line, qsp_t_);                     \
-        qsp_entry_record(e, t1 - t0);                                   \
+        qsp_record(obj, file, line, qsp_t_, t1 - t0, true, true);       \
     }
 
 #define QSP_GEN_RET1(type_, qsp_t_, func_, impl_)                       \
     static int func_(type_ *obj, const char *file, int line)            \
     {                                                                   \
-        QSPEntry *e;                                                    \
         int64_t t0, t1;                                                 \
         int err;                                                        \
                                                                         \
@@ -382,19 +450,22 @@ static inline void qsp_entry_record(QSPEntry *e, int64_t delta)
         err = impl_(obj, file, line);                                   \
         t1 = get_clock();                                               \
                                                                         \
-        e = qsp_entry_get(obj, file, line, qsp_t_);                     \
-        do_qsp_entry_record(e, t1 - t0, !err);                          \
+        qsp_record(obj, file, line, qsp_t_, t1 - t0, !err, !!err);      \
         return err;                                                     \
     }
 
-QSP_GEN_VOID(QemuMutex, QSP_BQL_MUTEX, qsp_bql_mutex_lock, qemu_mutex_lock_impl)
-QSP_GEN_VOID(QemuMutex, QSP_MUTEX, qsp_mutex_lock, qemu_mutex_lock_impl)
+QSP_GEN_VOID(QemuMutex, QSP_BQL_MUTEX, qsp_bql_mutex_lock, qemu_mutex_lock_impl,
+             qemu_mutex_trylock_impl)
+QSP_GEN_VOID(QemuMutex, QSP_MUTEX, qsp_mutex_lock, qemu_mutex_lock_impl,
+             qemu_mutex_trylock_impl)
 QSP_GEN_RET1(QemuMutex, QSP_MUTEX, qsp_mutex_trylock, qemu_mutex_trylock_impl)
 
 QSP_GEN_VOID(QemuRecMutex, QSP_REC_MUTEX, qsp_rec_mutex_lock,
-             qemu_rec_mutex_lock_impl)
+             qemu_rec_mutex_lock_impl, qemu_rec_mutex_trylock_impl)
 QSP_GEN_RET1(QemuRecMutex, QSP_REC_MUTEX, qsp_rec_mutex_trylock,
              qemu_rec_mutex_trylock_impl)
+QSP_GEN_VOID(QemuRecMutex, QSP_AIO_CONTEXT, qsp_aio_context_lock,
+             qemu_rec_mutex_lock_impl, qemu_rec_mutex_trylock_impl)
 
 #undef QSP_GEN_RET1
 #undef QSP_GEN_VOID
@@ -402,22 +473,19 @@ QSP_GEN_RET1(QemuRecMutex, QSP_REC_MUTEX, qsp_rec_mutex_trylock,
 static void
 qsp_cond_wait(QemuCond *cond, QemuMutex *mutex, const char *file, int line)
 {
-    QSPEntry *e;
     int64_t t0, t1;
 
     t0 = get_clock();
     qemu_cond_wait_impl(cond, mutex, file, line);
     t1 = get_clock();
 
-    e = qsp_entry_get(cond, file, line, QSP_CONDVAR);
-    qsp_entry_record(e, t1 - t0);
+    qsp_record(cond, file, line, QSP_CONDVAR, t1 - t0, true, true);
 }
 
 static bool
 qsp_cond_timedwait(QemuCond *cond, QemuMutex *mutex, int ms,
                    const char *file, int line)
 {
-    QSPEntry *e;
     int64_t t0, t1;
     bool ret;
 
@@ -425,8 +493,7 @@ qsp_cond_timedwait(QemuCond *cond, QemuMutex *mutex, int ms,
     ret = qemu_cond_timedwait_impl(cond, mutex, ms, file, line);
     t1 = get_clock();
 
-    e = qsp_entry_get(cond, file, line, QSP_CONDVAR);
-    qsp_entry_record(e, t1 - t0);
+    qsp_record(cond, file, line, QSP_CONDVAR, t1 - t0, true, true);
     return ret;
 }
 
@@ -435,6 +502,38 @@ bool qsp_is_enabled(void)
     return qatomic_read(&qemu_mutex_lock_func) == qsp_mutex_lock;
 }
 
+/* Called by qemu_spin_lock() after failing to take @spin at the first try */
+void qemu_spin_lock_slowpath(QemuSpin *spin, const char *file, int line)
+{
+    bool profile = !qsp_recording && qsp_is_enabled();
+    int64_t t0 = 0;
+
+    if (profile) {
+        t0 = get_clock();
+    }
+    do {
+        while (qatomic_read(&spin->value)) {
+            cpu_relax();
+        }
+    } while (__sync_lock_test_and_set(&spin->value, true));
+
+    if (profile) {
+        qsp_record(spin, file, line, QSP_SPIN, get_clock() - t0, true, true);
+    }
+}
+
+/*
+ * Called by qemu_co_mutex_lock() when QSP is enabled.  The coroutine may
+ * have moved to another thread while it waited, so this must not be
+ * inlined into the caller, lest the address of qsp_thread be cached.
+ */
+__attribute__((noinline))
+void qsp_co_mutex_record(CoMutex *mutex, const char *file, int line,
+                         int64_t ns, bool waited)
+{
+    qsp_record(mutex, file, line, QSP_CO_MUTEX, ns, true, waited);
+}
+
 void qsp_enable(void)
 {
     qatomic_set(&qemu_mutex_lock_func, qsp_mutex_lock);
@@ -442,6 +541,7 @@ void qsp_enable(void)
     qatomic_set(&qemu_bql_mutex_lock_func, qsp_bql_mutex_lock);
     qatomic_set(&qemu_rec_mutex_lock_func, qsp_rec_mutex_lock);
     qatomic_set(&qemu_rec_mutex_trylock_func, qsp_rec_mutex_trylock);
+    qatomic_set(&qemu_aio_context_lock_func, qsp_aio_context_lock);
     qatomic_set(&qemu_cond_wait_func, qsp_cond_wait);
     qatomic_set(&qemu_cond_timedwait_func, qsp_cond_timedwait);
 }
@@ -453,6 +553,7 @@ void qsp_disable(void)
     qatomic_set(&qemu_bql_mutex_lock_func, qemu_mutex_lock_impl);
     qatomic_set(&qemu_rec_mutex_lock_func, qemu_rec_mutex_lock_impl);
     qatomic_set(&qemu_rec_mutex_trylock_func, qemu_rec_mutex_trylock_impl);
+    qatomic_set(&qemu_aio_context_lock_func, qemu_rec_mutex_lock_impl);
     qatomic_set(&qemu_cond_wait_func, qemu_cond_wait_impl);
     qatomic_set(&qemu_cond_timedwait_func, qemu_cond_timedwait_impl);
 }
@@ -485,6 +586,13 @@ static gint qsp_tree_cmp(gconstpointer ap, gconstpointer bp, gpointer up)
         }
         break;
     }
+    case QSP_SORT_BY_CONTENDED:
+        if (a->n_waits > b->n_waits) {
+            return -1;
+        } else if (a->n_waits < b->n_waits) {
+            return 1;
+        }
+        break;
     default:
         g_assert_not_reached();
     }
@@ -531,6 +639,7 @@ static void qsp_aggregate(void *p, uint32_t h, void *up)
     const QSPEntry *e = p;
     QSPEntry *agg;
     uint32_t hash;
+    int i;
 
     hash = qsp_entry_no_thread_hash(e);
     agg = qsp_entry_find(ht, e, hash);
@@ -540,6 +649,10 @@ static void qsp_aggregate(void *p, uint32_t h, void *up)
      */
     agg->ns += qatomic_read_u64(&e->ns);
     agg->n_acqs += qatomic_read_u64(&e->n_acqs);
+    agg->n_waits += qatomic_read_u64(&e->n_waits);
+    for (i = 0; i < QSP_HIST_BUCKETS; i++) {
+        agg->hist[i] += qatomic_read_u64(&e->hist[i]);
+    }
 }
 
 static void qsp_iter_diff(void *p, uint32_t hash, void *htp)
@@ -547,19 +660,26 @@ static void qsp_iter_diff(void *p, uint32_t hash, void *htp)
     struct qht *ht = htp;
     QSPEntry *old = p;
     QSPEntry *new;
+    int i;
 
     new = qht_lookup(ht, old, hash);
     /* entries are never deleted, so we must have this one */
     g_assert(new != NULL);
     /* our reading of the stats happened after the snapshot was taken */
     g_assert(new->n_acqs >= old->n_acqs);
+    g_assert(new->n_waits >= old->n_waits);
     g_assert(new->ns >= old->ns);
 
     new->n_acqs -= old->n_acqs;
+    new->n_waits -= old->n_waits;
     new->ns -= old->ns;
+    for (i = 0; i < QSP_HIST_BUCKETS; i++) {
+        g_assert(new->hist[i] >= old->hist[i]);
+        new->hist[i] -= old->hist[i];
+    }
 
     /* No point in reporting an empty entry */
-    if (new->n_acqs == 0 && new->ns == 0) {
+    if (new->n_acqs == 0 && new->n_waits == 0 && new->ns == 0) {
         bool removed = qht_remove(ht, new, hash);
 
         g_assert(removed);
@@ -578,6 +698,7 @@ static void qsp_iter_callsite_coalesce(void *p, uint32_t h, void *htp)
     QSPEntry *old = p;
     QSPEntry *e;
     uint32_t hash;
+    int i;
 
     hash = qsp_entry_no_thread_obj_hash(old);
     e = qht_lookup(ht, old, hash);
@@ -589,6 +710,10 @@ static void qsp_iter_callsite_coalesce(void *p, uint32_t h, void *htp)
     }
     e->ns += old->ns;
     e->n_acqs += old->n_acqs;
+    e->n_waits += old->n_waits;
+    for (i = 0; i < QSP_HIST_BUCKETS; i++) {
+        e->hist[i] += old->hist[i];
+    }
 }
 
 static void qsp_ht_delete(void *p, uint32_t h, void *htp)
@@ -664,7 +789,9 @@ struct QSPReportEntry {
     const char *typename;
     double time_s;
     double ns_avg;
+    double ns_p99;
     uint64_t n_acqs;
+    uint64_t n_waits;
     unsigned int n_objs;
 };
 typedef struct QSPReportEntry QSPReportEntry;
@@ -676,6 +803,28 @@ struct QSPReport {
 };
 typedef struct QSPReport QSPReport;
 
+/*
+ * Upper bound of the histogram bucket that holds the 99th percentile of the
+ * contended waits, or 0 if there were none.
+ */
+static double qsp_entry_p99(const QSPEntry *e)
+{
+    uint64_t target = e->n_waits - e->n_waits / 100;
+    uint64_t sum = 0;
+    int i;
+
+    if (!e->n_waits) {
+        return 0;
+    }
+    for (i = 0; i < QSP_HIST_BUCKETS - 1; i++) {
+        sum += e->hist[i];
+        if (sum >= target) {
+            break;
+        }
+    }
+    return (double)(1ULL << (i + 10));
+}
+
 static gboolean qsp_tree_report(gpointer key, gpointer value, gpointer udata)
 {
     const QSPEntry *e = key;
@@ -694,7 +843,9 @@ static gboolean qsp_tree_report(gpointer key, gpointer value, gpointer udata)
     entry->typename = qsp_typenames[e->callsite->type];
     entry->time_s = e->ns * 1e-9;
     entry->n_acqs = e->n_acqs;
+    entry->n_waits = e->n_waits;
     entry->ns_avg = e->n_acqs ? e->ns / e->n_acqs : 0;
+    entry->ns_p99 = qsp_entry_p99(e);
     return FALSE;
 }
 
@@ -721,11 +872,12 @@ static void pr_report(const QSPReport *rep)
     /* white space to leave to the right of "Call site" */
     callsite_rspace = callsite_len - strlen("Call site");
 
-    qemu_printf("Type               Object  Call site%*s  Wait Time (s)  "
-                "       Count  Average (us)\n", callsite_rspace, "");
+    qemu_printf("Type                Object  Call site%*s  Wait Time (s)  "
+                "       Count     Contended  Average (us)  p99 (us)\n",
+                callsite_rspace, "");
 
     /* build a horizontal rule with dashes */
-    n_dashes = 79 + callsite_rspace;
+    n_dashes = 104 + callsite_rspace;
     dashes = g_malloc(n_dashes + 1);
     memset(dashes, '-', n_dashes);
     dashes[n_dashes] = '\0';
@@ -735,16 +887,18 @@ static void pr_report(const QSPReport *rep)
         const QSPReportEntry *e = &rep->entries[i];
         GString *s = g_string_new(NULL);
 
-        g_string_append_printf(s, "%-9s  ", e->typename);
+        g_string_append_printf(s, "%-10s  ", e->typename);
         if (e->n_objs > 1) {
             g_string_append_printf(s, "[%12u]", e->n_objs);
         } else {
             g_string_append_printf(s, "%14p", e->obj);
         }
-        g_string_append_printf(s, "  %s%*s  %13.5f  %12" PRIu64 "  %12.2f\n",
+        g_string_append_printf(s, "  %s%*s  %13.5f  %12" PRIu64 "  %12"
+                               PRIu64 "  %12.2f  %8.0f\n",
                                e->callsite_at,
                                callsite_len - (int)strlen(e->callsite_at), "",
-                               e->time_s, e->n_acqs, e->ns_avg * 1e-3);
+                               e->time_s, e->n_acqs, e->n_waits,
+                               e->ns_avg / 1000, e->ns_p99 / 1000);
         qemu_printf("%s", s->str);
         g_string_free(s, TRUE);
     }
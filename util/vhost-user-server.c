@@ -12,6 +12,9 @@
 #include "qemu/vhost-user-server.h"
 #include "block/aio-wait.h"
 
+/* How often vu_server_stop_queues() checks for in-flight requests */
+#define VU_SERVER_IN_FLIGHT_POLL_NS (100 * SCALE_US)
+
 /*
  * Theory of operation:
  *
@@ -51,6 +54,16 @@
  * possible by QIOChannel's support for spurious coroutine re-entry in
  * qio_channel_yield(). The coroutine will restart I/O when re-entered from the
  * new AioContext.
+ *
+ * The kick fds of some virtqueues can be monitored in other AioContexts,
+ * usually those of IOThreads, with vhost_user_server_set_queue_aio_context().
+ * Their requests are then popped and completed in those AioContexts, in
+ * parallel with vu_client_trip().  libvhost-user is not thread-safe, so
+ * before a vhost-user protocol message is processed vu_client_trip() stops
+ * monitoring all kick fds, moves through each of these AioContexts to make
+ * sure that none of them still runs a kick handler, and waits until the
+ * requests counted by vhost_user_server_inc_in_flight() have completed.  The
+ * kick fds are monitored again when it waits for the next message.
  */
 
 static void vmsg_close_fds(VhostUserMsg *vmsg)
@@ -168,15 +181,111 @@ fail:
     return false;
 }
 
+/* The AioContext in which the kick fd of @vu_fd_watch is monitored */
+static AioContext *vu_fd_watch_aio_context(VuServer *server,
+                                           VuFdWatch *vu_fd_watch)
+{
+    return vu_fd_watch->ctx ?: server->ctx;
+}
+
+static void kick_handler(void *opaque);
+
+/* Resume monitoring the kick fds stopped by vu_server_stop_queues() */
+static void vu_server_start_queues(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    if (!server->queues_stopped) {
+        return;
+    }
+
+    server->queues_stopped = false;
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        aio_set_fd_handler(vu_fd_watch_aio_context(server, vu_fd_watch),
+                           vu_fd_watch->fd, true, kick_handler, NULL, NULL,
+                           vu_fd_watch);
+    }
+}
+
+/*
+ * Make sure that no other AioContext accesses libvhost-user state until
+ * vu_server_start_queues() is called.  Nothing to do when all virtqueues
+ * are processed in server->ctx.
+ */
+static void coroutine_fn vu_server_stop_queues(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+    AioContext *ctx;
+    int i, j;
+
+    if (!server->queue_ctxs || server->queues_stopped) {
+        return;
+    }
+
+    server->queues_stopped = true;
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        aio_set_fd_handler(vu_fd_watch_aio_context(server, vu_fd_watch),
+                           vu_fd_watch->fd, true, NULL, NULL, NULL, NULL);
+    }
+
+    qatomic_set(&server->queues_stopping, true);
+
+    /*
+     * Once the coroutine runs in an AioContext, that AioContext is not in
+     * the middle of a kick handler anymore
+     */
+    for (i = 0; i < server->max_queues; i++) {
+        ctx = server->queue_ctxs[i];
+        for (j = 0; j < i && server->queue_ctxs[j] != ctx; j++) {
+            /* Only visit each AioContext once */
+        }
+        if (ctx && j == i) {
+            aio_co_reschedule_self(ctx);
+        }
+    }
+
+    /* The requests popped so far complete in their virtqueue's AioContext */
+    while (qatomic_read(&server->in_flight) > 0) {
+        qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, VU_SERVER_IN_FLIGHT_POLL_NS);
+    }
+
+    /* server->ctx is NULL while the server switches AioContexts */
+    while (!(ctx = qatomic_read(&server->ctx))) {
+        qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, VU_SERVER_IN_FLIGHT_POLL_NS);
+    }
+    aio_co_reschedule_self(ctx);
+
+    qatomic_set(&server->queues_stopping, false);
+}
+
+/* Stop the virtqueues before libvhost-user processes a message */
+static int vu_server_process_msg(VuDev *vu_dev, VhostUserMsg *vmsg,
+                                 int *do_reply)
+{
+    VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+
+    vu_server_stop_queues(server);
+
+    if (server->vu_iface->process_msg) {
+        return server->vu_iface->process_msg(vu_dev, vmsg, do_reply);
+    }
+    return false;
+}
+
 static coroutine_fn void vu_client_trip(void *opaque)
 {
     VuServer *server = opaque;
     VuDev *vu_dev = &server->vu_dev;
 
-    while (!vu_dev->broken && vu_dispatch(vu_dev)) {
-        /* Keep running */
+    while (!vu_dev->broken) {
+        /* Process the virtqueues until the next message is received */
+        vu_server_start_queues(server);
+        if (!vu_dispatch(vu_dev)) {
+            break;
+        }
     }
 
+    vu_server_stop_queues(server);
     vu_deinit(vu_dev);
 
     /* vu_deinit() should have called remove_watch() */
@@ -248,11 +357,17 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
 
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
+        /* libvhost-user only watches kick fds, with the queue index as pvt */
+        vu_fd_watch->ctx = vhost_user_server_get_queue_aio_context(server,
+                                                        (intptr_t)pvt);
         qemu_set_nonblock(fd);
-        aio_set_fd_handler(server->ioc->ctx, fd, true, kick_handler,
-                           NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+        if (!server->queues_stopped) {
+            aio_set_fd_handler(vu_fd_watch_aio_context(server, vu_fd_watch),
+                               fd, true, kick_handler, NULL, NULL,
+                               vu_fd_watch);
+        }
     }
 }
 
@@ -270,7 +385,20 @@ static void remove_watch(VuDev *vu_dev, int fd)
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ioc->ctx, fd, true, NULL, NULL, NULL, NULL);
+
+    if (vu_fd_watch->ctx && qemu_get_current_aio_context() != server->ctx) {
+        /*
+         * A kick handler failed in the AioContext of its virtqueue, which
+         * must not modify the list.  The client is disconnected, so the
+         * watch is freed when vu_deinit() stops the device.
+         */
+        aio_set_fd_handler(vu_fd_watch->ctx, fd, true,
+                           NULL, NULL, NULL, NULL);
+        return;
+    }
+
+    aio_set_fd_handler(vu_fd_watch_aio_context(server, vu_fd_watch), fd, true,
+                       NULL, NULL, NULL, NULL);
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
     g_free(vu_fd_watch);
@@ -288,8 +416,12 @@ static void vu_accept(QIONetListener *listener, QIOChannelSocket *sioc,
         return;
     }
 
+    server->dev_iface = *server->vu_iface;
+    server->dev_iface.process_msg = vu_server_process_msg;
+
     if (!vu_init(&server->vu_dev, server->max_queues, sioc->fd, panic_cb,
-                 vu_message_read, set_watch, remove_watch, server->vu_iface)) {
+                 vu_message_read, set_watch, remove_watch,
+                 &server->dev_iface)) {
         error_report("Failed to initialize libvhost-user");
         return;
     }
@@ -333,7 +465,8 @@ void vhost_user_server_stop(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
+            aio_set_fd_handler(vu_fd_watch_aio_context(server, vu_fd_watch),
+                               vu_fd_watch->fd, true,
                                NULL, NULL, NULL, vu_fd_watch);
         }
 
@@ -344,6 +477,9 @@ void vhost_user_server_stop(VuServer *server)
 
     aio_context_release(server->ctx);
 
+    g_free(server->queue_ctxs);
+    server->queue_ctxs = NULL;
+
     if (server->listener) {
         qio_net_listener_disconnect(server->listener);
         object_unref(OBJECT(server->listener));
@@ -376,11 +512,17 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
     qio_channel_attach_aio_context(server->ioc, ctx);
 
     QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->ctx || server->queues_stopped) {
+            continue;
+        }
         aio_set_fd_handler(ctx, vu_fd_watch->fd, true, kick_handler, NULL,
                            NULL, vu_fd_watch);
     }
 
-    aio_co_schedule(ctx, server->co_trip);
+    /* vu_server_stop_queues() moves to the new AioContext by itself */
+    if (!qatomic_read(&server->queues_stopping)) {
+        aio_co_schedule(ctx, server->co_trip);
+    }
 }
 
 /* Called with server->ctx acquired */
@@ -390,6 +532,9 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+            if (vu_fd_watch->ctx) {
+                continue;
+            }
             aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
                                NULL, NULL, NULL, vu_fd_watch);
         }
@@ -397,7 +542,52 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         qio_channel_detach_aio_context(server->ioc);
     }
 
-    server->ctx = NULL;
+    qatomic_set(&server->ctx, NULL);
+}
+
+/*
+ * Process the kicks of virtqueue @index in @ctx rather than in the
+ * AioContext of the server, or again in the latter if @ctx is NULL.  Must be
+ * called before a client connects.
+ *
+ * The caller has to complete the requests of the virtqueue in @ctx, and
+ * count them with vhost_user_server_inc_in_flight() and
+ * vhost_user_server_dec_in_flight().
+ */
+void vhost_user_server_set_queue_aio_context(VuServer *server, int index,
+                                             AioContext *ctx)
+{
+    assert(!server->sioc);
+    assert(index >= 0 && index < server->max_queues);
+
+    if (!server->queue_ctxs) {
+        server->queue_ctxs = g_new0(AioContext *, server->max_queues);
+    }
+    server->queue_ctxs[index] = ctx;
+}
+
+/*
+ * The AioContext that processes the kicks of virtqueue @index, or NULL if it
+ * is the AioContext of the server
+ */
+AioContext *vhost_user_server_get_queue_aio_context(VuServer *server,
+                                                    int index)
+{
+    if (!server->queue_ctxs || index < 0 || index >= server->max_queues) {
+        return NULL;
+    }
+    return server->queue_ctxs[index];
+}
+
+/* Count a request that was popped from a virtqueue until it is pushed back */
+void vhost_user_server_inc_in_flight(VuServer *server)
+{
+    qatomic_inc(&server->in_flight);
+}
+
+void vhost_user_server_dec_in_flight(VuServer *server)
+{
+    qatomic_dec(&server->in_flight);
 }
 
 bool vhost_user_server_start(VuServer *server,